@@ -53,16 +53,44 @@ extern "C" {
 /* output log's level total number */
 #define ELOG_LVL_TOTAL_NUM                   6
 
+/*
+ * interned tag: the name with its FNV-1a hash and length, all folded by the compiler from the string literal,
+ *     ELOG_TAG_DEFINE(TAG, "slot");          a const ElogTag TAG of the file, TAG is its pointer for elog_x()
+ *     elog_i(ELOG_TAG("other"), ...)         one in place, in an expression
+ * the hash covers the first ELOG_FILTER_TAG_MAX_LEN characters, as the tag level filters compare them, and is the one
+ * of elog_tag_hash(): the tag level filter is a table lookup by it, no string is compared per call
+ */
+#define ELOG_TAG_HASH_LEN                    16
+#define ELOG_TAG_FNV_BASIS                   2166136261UL
+#define ELOG_TAG_FNV_PRIME                   16777619UL
+#define ELOG_TAG_C_(s, i)                    ((i) < sizeof(s) - 1 && (i) < ELOG_FILTER_TAG_MAX_LEN \
+                                             ? (uint8_t) (s)[(i) < sizeof(s) ? (i) : 0] : 0U)
+#define ELOG_TAG_H_(h, s, i)                 ((uint32_t) (((h) ^ ELOG_TAG_C_(s, i)) * ELOG_TAG_FNV_PRIME))
+#define ELOG_TAG_H4_(h, s, i)                ELOG_TAG_H_(ELOG_TAG_H_(ELOG_TAG_H_(ELOG_TAG_H_(h, s, i), s, (i) + 1), \
+                                             s, (i) + 2), s, (i) + 3)
+#define ELOG_TAG_HASH(s)                     ELOG_TAG_H4_(ELOG_TAG_H4_(ELOG_TAG_H4_(ELOG_TAG_H4_(ELOG_TAG_FNV_BASIS, \
+                                             s, 0), s, 4), s, 8), s, 12)
+#define ELOG_TAG_INIT(s)                     {s, ELOG_TAG_HASH(s), sizeof(s) - 1}
+#define ELOG_TAG_DEFINE(name, s)             static const ElogTag name[1] = {ELOG_TAG_INIT(s)}
+#define ELOG_TAG(s)                          (&(const ElogTag) ELOG_TAG_INIT(s))
+
 /* EasyLogger software version number */
 #define ELOG_SW_VERSION                      "2.2.99"
 
+/* placement of the line, async and buffered output buffers */
+#ifdef ELOG_BUF_SECTION
+    #define ELOG_BUF_ATTR                    __attribute__((section(ELOG_BUF_SECTION)))
+#else
+    #define ELOG_BUF_ATTR
+#endif
+
 /* EasyLogger assert for developer. */
 #ifdef ELOG_ASSERT_ENABLE
     #define ELOG_ASSERT(EXPR)                                                 \
     if (!(EXPR))                                                              \
     {                                                                         \
         if (elog_assert_hook == NULL) {                                       \
-            elog_a("elog", "(%s) has assert failed at %s:%ld.", #EXPR, __FUNCTION__, __LINE__); \
+            elog_a(ELOG_TAG("elog"), "(%s) has assert failed at %s:%ld.", #EXPR, __FUNCTION__, __LINE__); \
             while (1);                                                        \
         } else {                                                              \
             elog_assert_hook(#EXPR, __FUNCTION__, __LINE__);                  \
@@ -100,45 +128,70 @@ extern "C" {
     #define ELOG_OUTPUT_LINE 0
     #endif
 
+    #ifdef ELOG_BIN_OUTPUT_ENABLE
+    /*
+     * binary output: the format string with the file and line is placed in the ELOG_BIN_SECTION no-load section, only
+     * its offset there, the tick, the tag pointer and up to 8 raw 32-bit arguments are output;
+     * Tools/elog_decode.py formats them again from the ELF
+     */
+    #define ELOG_BIN_STR_(x) #x
+    #define ELOG_BIN_STR(x) ELOG_BIN_STR_(x)
+    #define ELOG_BIN_FMT(fmt, ...) fmt
+    #define ELOG_BIN_ARGS(fmt, ...) __VA_ARGS__
+    #define ELOG_BIN_NARG_(fmt, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+    #define ELOG_BIN_NARG(...) ELOG_BIN_NARG_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, 0)
+    #define elog_level_output(level, tag, ...)                                \
+    do {                                                                      \
+        static const char elog_bin_fmt[] __attribute__((section(ELOG_BIN_SECTION), used)) = \
+                __FILE__ ":" ELOG_BIN_STR(__LINE__) "\0" ELOG_BIN_FMT(__VA_ARGS__, 0); \
+        /* the format is still checked, the call is never made */             \
+        (void) sizeof(elog_bin_check(__VA_ARGS__));                           \
+        elog_bin_output(level, tag, (uintptr_t) elog_bin_fmt, ELOG_BIN_NARG(__VA_ARGS__), ELOG_BIN_ARGS(__VA_ARGS__, 0)); \
+    } while (0)
+    #else
+    #define elog_level_output(level, tag, ...) \
+            elog_output(level, tag, ELOG_OUTPUT_DIR, ELOG_OUTPUT_FUNC, ELOG_OUTPUT_LINE, __VA_ARGS__)
+    #endif /* ELOG_BIN_OUTPUT_ENABLE */
+
     #define elog_raw(...)  elog_raw_output(__VA_ARGS__)
     #if ELOG_OUTPUT_LVL >= ELOG_LVL_ASSERT
         #define elog_assert(tag, ...) \
-                elog_output(ELOG_LVL_ASSERT, tag, ELOG_OUTPUT_DIR, ELOG_OUTPUT_FUNC, ELOG_OUTPUT_LINE, __VA_ARGS__)
+                elog_level_output(ELOG_LVL_ASSERT, tag, __VA_ARGS__)
     #else
         #define elog_assert(tag, ...)
     #endif /* ELOG_OUTPUT_LVL >= ELOG_LVL_ASSERT */
 
     #if ELOG_OUTPUT_LVL >= ELOG_LVL_ERROR
         #define elog_error(tag, ...) \
-                elog_output(ELOG_LVL_ERROR, tag, ELOG_OUTPUT_DIR, ELOG_OUTPUT_FUNC, ELOG_OUTPUT_LINE, __VA_ARGS__)
+                elog_level_output(ELOG_LVL_ERROR, tag, __VA_ARGS__)
     #else
         #define elog_error(tag, ...)
     #endif /* ELOG_OUTPUT_LVL >= ELOG_LVL_ERROR */
 
     #if ELOG_OUTPUT_LVL >= ELOG_LVL_WARN
         #define elog_warn(tag, ...) \
-                elog_output(ELOG_LVL_WARN, tag, ELOG_OUTPUT_DIR, ELOG_OUTPUT_FUNC, ELOG_OUTPUT_LINE, __VA_ARGS__)
+                elog_level_output(ELOG_LVL_WARN, tag, __VA_ARGS__)
     #else
         #define elog_warn(tag, ...)
     #endif /* ELOG_OUTPUT_LVL >= ELOG_LVL_WARN */
 
     #if ELOG_OUTPUT_LVL >= ELOG_LVL_INFO
         #define elog_info(tag, ...) \
-                elog_output(ELOG_LVL_INFO, tag, ELOG_OUTPUT_DIR, ELOG_OUTPUT_FUNC, ELOG_OUTPUT_LINE, __VA_ARGS__)
+                elog_level_output(ELOG_LVL_INFO, tag, __VA_ARGS__)
     #else
         #define elog_info(tag, ...)
     #endif /* ELOG_OUTPUT_LVL >= ELOG_LVL_INFO */
 
     #if ELOG_OUTPUT_LVL >= ELOG_LVL_DEBUG
         #define elog_debug(tag, ...) \
-                elog_output(ELOG_LVL_DEBUG, tag, ELOG_OUTPUT_DIR, ELOG_OUTPUT_FUNC, ELOG_OUTPUT_LINE, __VA_ARGS__)
+                elog_level_output(ELOG_LVL_DEBUG, tag, __VA_ARGS__)
     #else
         #define elog_debug(tag, ...)
     #endif /* ELOG_OUTPUT_LVL >= ELOG_LVL_DEBUG */
 
     #if ELOG_OUTPUT_LVL == ELOG_LVL_VERBOSE
         #define elog_verbose(tag, ...) \
-                elog_output(ELOG_LVL_VERBOSE, tag, ELOG_OUTPUT_DIR, ELOG_OUTPUT_FUNC, ELOG_OUTPUT_LINE, __VA_ARGS__)
+                elog_level_output(ELOG_LVL_VERBOSE, tag, __VA_ARGS__)
     #else
         #define elog_verbose(tag, ...)
     #endif /* ELOG_OUTPUT_LVL == ELOG_LVL_VERBOSE */
@@ -160,21 +213,54 @@ typedef enum {
 #define ELOG_FMT_ALL    (ELOG_FMT_LVL|ELOG_FMT_TAG|ELOG_FMT_TIME|ELOG_FMT_P_INFO|ELOG_FMT_T_INFO| \
     ELOG_FMT_DIR|ELOG_FMT_FUNC|ELOG_FMT_LINE)
 
+/* interned tag, see ELOG_TAG() */
+typedef struct {
+    const char *name;
+    uint32_t id;       /**< elog_tag_hash() of name */
+    size_t len;        /**< strlen(name) */
+} ElogTag;
+
+/* open addressing table of the tag level filters by tag id, a power of 2, twice the filters at least */
+#define ELOG_FILTER_TAG_LVL_TABLE_SIZE       16
+#if ELOG_FILTER_TAG_LVL_TABLE_SIZE < 2 * ELOG_FILTER_TAG_LVL_MAX_NUM
+    #error "ELOG_FILTER_TAG_LVL_TABLE_SIZE must be twice ELOG_FILTER_TAG_LVL_MAX_NUM at least"
+#endif
+
 /* output log's tag filter */
 typedef struct {
     uint8_t level;
     char tag[ELOG_FILTER_TAG_MAX_LEN + 1];
     bool tag_use_flag; /**< false : tag is no used   true: tag is used */
+    uint32_t id;       /**< elog_tag_hash() of tag */
 } ElogTagLvlFilter, *ElogTagLvlFilter_t;
 
+/* slot of the tag level lookup table */
+typedef struct {
+    uint32_t id;
+    uint8_t level;
+    bool used;
+} ElogTagLvlSlot;
+
 /* output log's filter */
 typedef struct {
     uint8_t level;
     char tag[ELOG_FILTER_TAG_MAX_LEN + 1];
     char keyword[ELOG_FILTER_KW_MAX_LEN + 1];
     ElogTagLvlFilter tag_lvl[ELOG_FILTER_TAG_LVL_MAX_NUM];
+    ElogTagLvlSlot tag_lvl_table[ELOG_FILTER_TAG_LVL_TABLE_SIZE]; /**< built from tag_lvl by each change */
+    uint8_t tag_lvl_num; /**< filters in use, 0: no lookup at all */
 } ElogFilter, *ElogFilter_t;
 
+/* rate limit rule of a tag (or every tag) for its lines of level and above (less severe) */
+typedef struct {
+    uint32_t id;       /**< elog_tag_hash() of the tag */
+    bool any;          /**< every tag, id unused */
+    bool used;
+    uint8_t level;
+    uint16_t burst;    /**< lines at once, 0: no limit and no coalescing at all */
+    uint16_t per_sec;  /**< lines per second after the burst */
+} ElogRateRule;
+
 /* easy logger */
 typedef struct {
     ElogFilter filter;
@@ -189,6 +275,10 @@ typedef struct {
     bool text_color_enabled;
 #endif
 
+#ifdef ELOG_RATE_LIMIT_ENABLE
+    ElogRateRule rate_rule[ELOG_RATE_RULE_MAX_NUM];
+#endif
+
 }EasyLogger, *EasyLogger_t;
 
 /* EasyLogger error code */
@@ -212,9 +302,13 @@ void elog_set_filter_tag(const char *tag);
 void elog_set_filter_kw(const char *keyword);
 void elog_set_filter_tag_lvl(const char *tag, uint8_t level);
 uint8_t elog_get_filter_tag_lvl(const char *tag);
+uint32_t elog_tag_hash(const char *tag);
+void elog_set_rate_limit(const char *tag, uint8_t level, uint16_t burst, uint16_t per_sec);
 void elog_raw_output(const char *format, ...);
-void elog_output(uint8_t level, const char *tag, const char *file, const char *func,
+void elog_output(uint8_t level, const ElogTag *tag, const char *file, const char *func,
         const long line, const char *format, ...);
+void elog_bin_output(uint8_t level, const ElogTag *tag, uint16_t id, size_t argc, ...);
+int elog_bin_check(const char *format, ...) __attribute__((format(printf, 1, 2)));
 void elog_output_lock_enabled(bool enabled);
 extern void (*elog_assert_hook)(const char* expr, const char* func, size_t line);
 void elog_assert_set_hook(void (*hook)(const char* expr, const char* func, size_t line));
@@ -222,12 +316,43 @@ int8_t elog_find_lvl(const char *log);
 const char *elog_find_tag(const char *log, uint8_t lvl, size_t *tag_len);
 void elog_hexdump(const char *name, uint8_t width, const void *buf, uint16_t size);
 
-#define elog_a(tag, ...)     elog_assert(tag, __VA_ARGS__)
-#define elog_e(tag, ...)     elog_error(tag, __VA_ARGS__)
-#define elog_w(tag, ...)     elog_warn(tag, __VA_ARGS__)
-#define elog_i(tag, ...)     elog_info(tag, __VA_ARGS__)
-#define elog_d(tag, ...)     elog_debug(tag, __VA_ARGS__)
-#define elog_v(tag, ...)     elog_verbose(tag, __VA_ARGS__)
+/**
+ * compile-time level of the source, the elog_x and log_x calls above it compile to nothing, the format strings too
+ * NOTE: The `LOG_LVL` must defined before including the <elog.h>, see the ELOG_TAG_LVL_xxx table in elog_cfg.h.
+ */
+#if !defined(LOG_LVL)
+    #define LOG_LVL          ELOG_LVL_VERBOSE
+#endif
+#if LOG_LVL >= ELOG_LVL_ASSERT
+    #define elog_a(tag, ...) elog_assert(tag, __VA_ARGS__)
+#else
+    #define elog_a(tag, ...) ((void)0)
+#endif
+#if LOG_LVL >= ELOG_LVL_ERROR
+    #define elog_e(tag, ...) elog_error(tag, __VA_ARGS__)
+#else
+    #define elog_e(tag, ...) ((void)0)
+#endif
+#if LOG_LVL >= ELOG_LVL_WARN
+    #define elog_w(tag, ...) elog_warn(tag, __VA_ARGS__)
+#else
+    #define elog_w(tag, ...) ((void)0)
+#endif
+#if LOG_LVL >= ELOG_LVL_INFO
+    #define elog_i(tag, ...) elog_info(tag, __VA_ARGS__)
+#else
+    #define elog_i(tag, ...) ((void)0)
+#endif
+#if LOG_LVL >= ELOG_LVL_DEBUG
+    #define elog_d(tag, ...) elog_debug(tag, __VA_ARGS__)
+#else
+    #define elog_d(tag, ...) ((void)0)
+#endif
+#if LOG_LVL >= ELOG_LVL_VERBOSE
+    #define elog_v(tag, ...) elog_verbose(tag, __VA_ARGS__)
+#else
+    #define elog_v(tag, ...) ((void)0)
+#endif
 
 /**
  * log API short definition
@@ -236,36 +361,33 @@ void elog_hexdump(const char *name, uint8_t width, const void *buf, uint16_t siz
 #if !defined(LOG_TAG)
     #define LOG_TAG          "NO_TAG"
 #endif
-#if !defined(LOG_LVL)
-    #define LOG_LVL          ELOG_LVL_VERBOSE
-#endif
 #if LOG_LVL >= ELOG_LVL_ASSERT
-    #define log_a(...)       elog_a(LOG_TAG, __VA_ARGS__)
+    #define log_a(...)       elog_a(ELOG_TAG(LOG_TAG), __VA_ARGS__)
 #else
     #define log_a(...)       ((void)0);
 #endif
 #if LOG_LVL >= ELOG_LVL_ERROR
-    #define log_e(...)       elog_e(LOG_TAG, __VA_ARGS__)
+    #define log_e(...)       elog_e(ELOG_TAG(LOG_TAG), __VA_ARGS__)
 #else
     #define log_e(...)       ((void)0);
 #endif
 #if LOG_LVL >= ELOG_LVL_WARN
-    #define log_w(...)       elog_w(LOG_TAG, __VA_ARGS__)
+    #define log_w(...)       elog_w(ELOG_TAG(LOG_TAG), __VA_ARGS__)
 #else
     #define log_w(...)       ((void)0);
 #endif
 #if LOG_LVL >= ELOG_LVL_INFO
-    #define log_i(...)       elog_i(LOG_TAG, __VA_ARGS__)
+    #define log_i(...)       elog_i(ELOG_TAG(LOG_TAG), __VA_ARGS__)
 #else
     #define log_i(...)       ((void)0);
 #endif
 #if LOG_LVL >= ELOG_LVL_DEBUG
-    #define log_d(...)       elog_d(LOG_TAG, __VA_ARGS__)
+    #define log_d(...)       elog_d(ELOG_TAG(LOG_TAG), __VA_ARGS__)
 #else
     #define log_d(...)       ((void)0);
 #endif
 #if LOG_LVL >= ELOG_LVL_VERBOSE
-    #define log_v(...)       elog_v(LOG_TAG, __VA_ARGS__)
+    #define log_v(...)       elog_v(ELOG_TAG(LOG_TAG), __VA_ARGS__)
 #else
     #define log_v(...)       ((void)0);
 #endif
@@ -283,6 +405,14 @@ void elog_flush(void);
 void elog_async_enabled(bool enabled);
 size_t elog_async_get_log(char *log, size_t size);
 size_t elog_async_get_line_log(char *log, size_t size);
+char *elog_async_line_span(uint8_t level, size_t *size);
+void elog_async_line_commit(size_t size);
+uint32_t elog_async_get_lost(void);
+
+/* elog_port.c */
+uint32_t elog_port_get_tick(void);
+void elog_port_flush(void);
+void elog_port_irq_handler(void);
 
 /* elog_utils.c */
 size_t elog_strcpy(size_t cur_len, char *dst, const char *src);
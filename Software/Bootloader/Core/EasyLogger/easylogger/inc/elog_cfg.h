@@ -33,10 +33,38 @@
 #define ELOG_OUTPUT_ENABLE
 /* setting static output log level. range: from ELOG_LVL_ASSERT to ELOG_LVL_VERBOSE */
 #define ELOG_OUTPUT_LVL                          ELOG_LVL_VERBOSE
+/* compile-time level of each tag, a source sets LOG_LVL to its entry before including elog.h */
+#define ELOG_TAG_LVL_BOOTLOADER                  ELOG_LVL_INFO
+#define ELOG_TAG_LVL_SLOT                        ELOG_LVL_INFO
+#define ELOG_TAG_LVL_INSTALL                     ELOG_LVL_INFO
+#define ELOG_TAG_LVL_UART                        ELOG_LVL_INFO
+#define ELOG_TAG_LVL_ESP                         ELOG_LVL_INFO
+#define ELOG_TAG_LVL_SCATTER                     ELOG_LVL_INFO
+#define ELOG_TAG_LVL_OSPI_CAL                    ELOG_LVL_INFO
+#define ELOG_TAG_LVL_KV                          ELOG_LVL_INFO
+#define ELOG_TAG_LVL_LFS                         ELOG_LVL_INFO
+#define ELOG_TAG_LVL_ROLLBACK                    ELOG_LVL_INFO
+#define ELOG_TAG_LVL_ESPFLASH                    ELOG_LVL_INFO
+#define ELOG_TAG_LVL_FAULT                       ELOG_LVL_INFO
+#define ELOG_TAG_LVL_EXT                         ELOG_LVL_INFO
+#define ELOG_TAG_LVL_CONSOLE                     ELOG_LVL_INFO
+#define ELOG_TAG_LVL_PART                        ELOG_LVL_INFO
+#define ELOG_TAG_LVL_PERF                        ELOG_LVL_INFO
+#define ELOG_TAG_LVL_USB                         ELOG_LVL_INFO
+#define ELOG_TAG_LVL_BRIDGE                      ELOG_LVL_INFO
+#define ELOG_TAG_LVL_SELFUPDATE                  ELOG_LVL_INFO
+#define ELOG_TAG_LVL_BUNDLE                      ELOG_LVL_INFO
+#define ELOG_TAG_LVL_TRIAL                       ELOG_LVL_INFO
+#define ELOG_TAG_LVL_PCPROF                      ELOG_LVL_INFO
+#define ELOG_TAG_LVL_BENCH                       ELOG_LVL_INFO
+/* SFUD_INFO and SFUD_DEBUG of sfud_def.h */
+#define ELOG_TAG_LVL_SFUD                        ELOG_LVL_INFO
 /* enable assert check */
 #define ELOG_ASSERT_ENABLE
 /* buffer size for every line's log */
 #define ELOG_LINE_BUF_SIZE                       1024
+/* section of the line, async and buffered output buffers, none of them is moved by a DMA; off: .bss */
+#define ELOG_BUF_SECTION                         ".dtcm_bss"
 /* output line number max length */
 #define ELOG_LINE_NUM_MAX_LEN                    5
 /* output filter's tag max length */
@@ -48,6 +76,16 @@
 /* output newline sign */
 #define ELOG_NEWLINE_SIGN                        "\n"
 /*---------------------------------------------------------------------------*/
+/* rate limit of each call site and coalescing of a line repeated back to back, see elog_set_rate_limit() */
+#define ELOG_RATE_LIMIT_ENABLE
+/* default rule, every tag and level: a burst of lines, then lines per second */
+#define ELOG_RATE_LIMIT_BURST                    20
+#define ELOG_RATE_LIMIT_PER_SEC                  10
+/* rules of elog_set_rate_limit(), the default one included */
+#define ELOG_RATE_RULE_MAX_NUM                   4
+/* "last message repeated N times" at the latest this long after the first repeat */
+#define ELOG_REPEAT_REPORT_MS                    5000
+/*---------------------------------------------------------------------------*/
 /* enable log color */
 #define ELOG_COLOR_ENABLE
 /* change the some level logs to not default color if you want */
@@ -64,12 +102,32 @@
 //#define ELOG_FMT_USING_DIR
 //#define ELOG_FMT_USING_LINE
 /*---------------------------------------------------------------------------*/
-///* enable asynchronous output mode */
-//#define ELOG_ASYNC_OUTPUT_ENABLE
-///* the highest output level for async mode, other level will sync output */
-//#define ELOG_ASYNC_OUTPUT_LVL                    ELOG_LVL_ASSERT
-///* buffer size for asynchronous output mode */
-//#define ELOG_ASYNC_OUTPUT_BUF_SIZE               (ELOG_LINE_BUF_SIZE * 10)
+/* copy every output to the no-init boot log ring of boot_log.h, the application can fetch it */
+#define ELOG_PORT_BOOT_LOG_ENABLE
+/* copy every output to the log area of the EXT flash, see plugins/flash/elog_flash.h */
+#define ELOG_PORT_FLASH_ENABLE
+/* copy every output to the ITM stimulus port, SWO, when the debugger enables it */
+//#define ELOG_PORT_ITM_ENABLE
+#define ELOG_PORT_ITM_PORT                       0
+/* copy every output to a SEGGER RTT up buffer in DTCM, the logs which don't fit are trimmed */
+//#define ELOG_PORT_RTT_ENABLE
+#define ELOG_PORT_RTT_BUF_SIZE                   4096
+/* copy every output to the ESP32-C3 while the ESP-Hosted link is up, see boot_netlog.h */
+#define ELOG_PORT_ESP_ENABLE
+/* send the output to USART2, off: the other outputs only */
+#define ELOG_PORT_UART_ENABLE
+/*---------------------------------------------------------------------------*/
+/* enable binary output mode, the level logs are decoded on the host by Tools/elog_decode.py */
+//#define ELOG_BIN_OUTPUT_ENABLE
+/* no-load section of the binary output format strings, 64KB at most */
+#define ELOG_BIN_SECTION                         ".elog_fmt"
+/*---------------------------------------------------------------------------*/
+/* enable asynchronous output mode, bare metal: the DMA interrupt of elog_port.c drains the ring */
+#define ELOG_ASYNC_OUTPUT_ENABLE
+/* the highest output level for async mode, other level will sync output */
+#define ELOG_ASYNC_OUTPUT_LVL                    ELOG_LVL_ASSERT
+/* buffer size for asynchronous output mode */
+#define ELOG_ASYNC_OUTPUT_BUF_SIZE               (ELOG_LINE_BUF_SIZE * 4)
 ///* each asynchronous output's log which must end with newline sign */
 //#define ELOG_ASYNC_LINE_OUTPUT
 ///* asynchronous output mode using POSIX pthread implementation */
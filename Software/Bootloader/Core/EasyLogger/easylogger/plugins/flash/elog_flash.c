@@ -0,0 +1,319 @@
+/**
+ * @file elog_flash.c
+ * @brief elog sink which appends the output to a sector ring on a SFUD flash, see elog_flash.h.
+ */
+#include <elog_flash.h>
+#include <string.h>
+
+#if ELOG_FLASH_SECTOR_NUM < ELOG_FLASH_ERASED_SECTORS + 2
+    #error "The flash log needs two sectors more than the erased ones (in elog_flash_cfg.h)"
+#endif
+
+#define FLASH_MAGIC                     0x46474C45UL /* 'ELGF' */
+#define FLASH_PAGES                     (ELOG_FLASH_SECTOR_SIZE / ELOG_FLASH_PAGE_SIZE)
+#define FLASH_HEADER_SIZE               sizeof(flash_header)
+#define FLASH_SECTOR_DATA               (ELOG_FLASH_SECTOR_SIZE - FLASH_HEADER_SIZE)
+
+typedef struct {
+    uint32_t magic;                              /**< FLASH_MAGIC */
+    uint32_t seq;                                /**< counts up sector by sector */
+} flash_header;
+
+/* RAM index of the log area */
+static struct {
+    const sfud_flash *flash;                     /**< NULL: no flash, the lines stay in the buffer */
+    uint32_t base;                               /**< address of sector 0 */
+    uint32_t seq;                                /**< sequence number of the head sector */
+    size_t head;                                 /**< sector being written */
+    size_t page;                                 /**< next page of the head sector, 0: no header yet */
+    size_t erased;                               /**< erased sectors after the head */
+    sfud_async op;                               /**< background erase of sector head + erased + 1 */
+    size_t len;                                  /**< bytes in buf */
+    size_t lost;                                 /**< bytes dropped, buf was full, for the debugger */
+} log_flash;
+static char log_buf[ELOG_FLASH_BUF_SIZE];
+static uint8_t page_buf[ELOG_FLASH_PAGE_SIZE];
+
+extern void elog_output_lock(void);
+extern void elog_output_unlock(void);
+
+static uint32_t sector_addr(size_t sector) {
+    return log_flash.base + (uint32_t) (sector % ELOG_FLASH_SECTOR_NUM) * ELOG_FLASH_SECTOR_SIZE;
+}
+
+static bool read_header(size_t sector, flash_header *header) {
+    return sfud_read(log_flash.flash, sector_addr(sector), sizeof(*header), (uint8_t *) header) == SFUD_SUCCESS
+            && header->magic == FLASH_MAGIC;
+}
+
+/* a page is erased when all its bytes are 0xFF, the log never has a page of them */
+static bool page_erased(uint32_t addr) {
+    size_t i;
+
+    if (sfud_read(log_flash.flash, addr, ELOG_FLASH_PAGE_SIZE, page_buf) != SFUD_SUCCESS) {
+        return false;
+    }
+    for (i = 0; i < ELOG_FLASH_PAGE_SIZE; i++) {
+        if (page_buf[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sector_erased(size_t sector) {
+    size_t page;
+
+    for (page = 0; page < FLASH_PAGES; page++) {
+        if (!page_erased(sector_addr(sector) + page * ELOG_FLASH_PAGE_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * move the background erase on, start the next one while less than ELOG_FLASH_ERASED_SECTORS are erased
+ *
+ * @param wait wait the running erase to end
+ * @param start start a new erase
+ *
+ * @return true: no erase is running
+ */
+static bool erase_ahead(bool wait, bool start) {
+    sfud_err result = wait ? sfud_async_wait(&log_flash.op) : sfud_async_poll(&log_flash.op);
+
+    if (result == SFUD_ERR_BUSY) {
+        return false;
+    }
+    if (log_flash.op.flash) {
+        log_flash.op.flash = NULL;
+        if (result == SFUD_SUCCESS) {
+            log_flash.erased++;
+        }
+    }
+    if (start && log_flash.erased < ELOG_FLASH_ERASED_SECTORS) {
+        log_flash.op.done = NULL;
+        if (sfud_erase_async(log_flash.flash, &log_flash.op, sector_addr(log_flash.head + log_flash.erased + 1),
+                ELOG_FLASH_SECTOR_SIZE) != SFUD_SUCCESS) {
+            log_flash.op.flash = NULL;
+            return true;
+        }
+        /* an erase which has ended already is counted by the next call */
+        return false;
+    }
+    return true;
+}
+
+/* program the next page from the buffer, the rest of a short one stays 0xFF */
+static sfud_err program_page(size_t size) {
+    size_t header = 0, data;
+    uint32_t addr;
+    flash_header sector;
+    sfud_err result;
+
+    if (log_flash.page == FLASH_PAGES) {
+        /* the next sector is erased ahead, it's only erased here when that failed */
+        if (log_flash.erased == 0) {
+            result = sfud_erase(log_flash.flash, sector_addr(log_flash.head + 1), ELOG_FLASH_SECTOR_SIZE);
+            if (result != SFUD_SUCCESS) {
+                return result;
+            }
+        }
+        log_flash.erased = log_flash.erased ? log_flash.erased - 1 : 0;
+        log_flash.head = (log_flash.head + 1) % ELOG_FLASH_SECTOR_NUM;
+        log_flash.seq++;
+        log_flash.page = 0;
+    }
+    memset(page_buf, 0xFF, sizeof(page_buf));
+    if (log_flash.page == 0) {
+        sector.magic = FLASH_MAGIC;
+        sector.seq = log_flash.seq;
+        memcpy(page_buf, &sector, sizeof(sector));
+        header = sizeof(sector);
+    }
+    data = size < ELOG_FLASH_PAGE_SIZE - header ? size : ELOG_FLASH_PAGE_SIZE - header;
+    /* SFUD may log while programming, the lines go after these ones */
+    elog_output_lock();
+    memcpy(&page_buf[header], log_buf, data);
+    elog_output_unlock();
+    addr = sector_addr(log_flash.head) + (uint32_t) log_flash.page * ELOG_FLASH_PAGE_SIZE;
+    result = sfud_write(log_flash.flash, addr, ELOG_FLASH_PAGE_SIZE, page_buf);
+    if (result == SFUD_SUCCESS) {
+        log_flash.page++;
+        elog_output_lock();
+        log_flash.len -= data;
+        memmove(log_buf, &log_buf[data], log_flash.len);
+        elog_output_unlock();
+    }
+    return result;
+}
+
+/* bytes the next page takes */
+static size_t page_data_size(void) {
+    return ELOG_FLASH_PAGE_SIZE - (log_flash.page % FLASH_PAGES == 0 ? FLASH_HEADER_SIZE : 0);
+}
+
+/**
+ * take the log area at the end of the flash, find its head, the buffered lines are programmed from then on
+ *
+ * @param flash flash device, initialized
+ *
+ * @return result
+ */
+sfud_err elog_flash_init(const sfud_flash *flash) {
+    flash_header header;
+    size_t sector, page;
+    bool found = false;
+    sfud_err result;
+
+    if (!flash->init_ok || flash->chip.erase_gran > ELOG_FLASH_SECTOR_SIZE
+            || flash->chip.capacity < ELOG_FLASH_SECTOR_NUM * ELOG_FLASH_SECTOR_SIZE) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    log_flash.flash = flash;
+    log_flash.base = flash->chip.capacity - ELOG_FLASH_SECTOR_NUM * ELOG_FLASH_SECTOR_SIZE;
+    log_flash.op.flash = NULL;
+    log_flash.op.result = SFUD_SUCCESS;
+    log_flash.erased = 0;
+
+    /* the head is the sector with the newest sequence number */
+    for (sector = 0; sector < ELOG_FLASH_SECTOR_NUM; sector++) {
+        if (read_header(sector, &header) && (!found || (int32_t) (header.seq - log_flash.seq) > 0)) {
+            log_flash.head = sector;
+            log_flash.seq = header.seq;
+            found = true;
+        }
+    }
+    if (found) {
+        for (page = 1; page < FLASH_PAGES && !page_erased(sector_addr(log_flash.head) + page * ELOG_FLASH_PAGE_SIZE);
+                page++) {
+        }
+        log_flash.page = page;
+    } else {
+        /* a new log area, sector 0 is written first */
+        log_flash.head = 0;
+        log_flash.seq = 0;
+        log_flash.page = 0;
+        if (!sector_erased(0)) {
+            result = sfud_erase(flash, sector_addr(0), ELOG_FLASH_SECTOR_SIZE);
+            if (result != SFUD_SUCCESS) {
+                log_flash.flash = NULL;
+                return result;
+            }
+        }
+    }
+    /* an erase may have been cut off by a reset, only a sector read back as erased counts */
+    while (log_flash.erased < ELOG_FLASH_ERASED_SECTORS && sector_erased(log_flash.head + log_flash.erased + 1)) {
+        log_flash.erased++;
+    }
+    return SFUD_SUCCESS;
+}
+
+/**
+ * append the output to the RAM buffer
+ *
+ * @note the elog output lock is held, the flash isn't touched here
+ *
+ * @param log output of log
+ * @param size log size
+ */
+void elog_flash_write(const char *log, size_t size) {
+    size_t len = ELOG_FLASH_BUF_SIZE - log_flash.len;
+
+    if (len > size) {
+        len = size;
+    }
+    memcpy(&log_buf[log_flash.len], log, len);
+    log_flash.len += len;
+    log_flash.lost += size - len;
+}
+
+/**
+ * program the whole pages of the buffer, never waits for the background erase
+ */
+void elog_flash_poll(void) {
+    /* the pages wait while an erase runs, they are only a few ms behind */
+    if (log_flash.flash == NULL || !erase_ahead(false, false)) {
+        return;
+    }
+    while (log_flash.len >= page_data_size() && program_page(log_flash.len) == SFUD_SUCCESS) {
+    }
+    /* the erase of the sector left by a switch runs till the next call */
+    erase_ahead(false, true);
+}
+
+/**
+ * program all the buffer, the last page padded, and wait for the background erase
+ */
+void elog_flash_flush(void) {
+    if (log_flash.flash == NULL) {
+        return;
+    }
+    erase_ahead(true, false);
+    while (log_flash.len && program_page(log_flash.len) == SFUD_SUCCESS) {
+    }
+}
+
+/**
+ * read the log from the flash, oldest first
+ *
+ * @note buffered lines aren't in it till they are programmed, a short page reads its 0xFF padding
+ *
+ * @param index byte offset from the oldest log
+ * @param buf read buffer
+ * @param size bytes to read
+ *
+ * @return bytes read, 0: the end
+ */
+size_t elog_flash_read(size_t index, char *buf, size_t size) {
+    flash_header header;
+    size_t sector, i, data, done = 0;
+
+    if (log_flash.flash == NULL) {
+        return 0;
+    }
+    /* the sectors after the head are erased or the oldest ones */
+    for (i = 1; i <= ELOG_FLASH_SECTOR_NUM && done < size; i++) {
+        sector = log_flash.head + i;
+        if (i == ELOG_FLASH_SECTOR_NUM) {
+            data = log_flash.page ? log_flash.page * ELOG_FLASH_PAGE_SIZE - FLASH_HEADER_SIZE : 0;
+        } else if (i <= log_flash.erased || (log_flash.op.flash && i == log_flash.erased + 1)
+                || !read_header(sector, &header)) {
+            continue;
+        } else {
+            data = FLASH_SECTOR_DATA;
+        }
+        if (index >= data) {
+            index -= data;
+            continue;
+        }
+        data -= index;
+        if (data > size - done) {
+            data = size - done;
+        }
+        if (sfud_read(log_flash.flash, sector_addr(sector) + FLASH_HEADER_SIZE + index, data,
+                (uint8_t *) &buf[done]) != SFUD_SUCCESS) {
+            break;
+        }
+        done += data;
+        index = 0;
+    }
+    return done;
+}
+
+/**
+ * erase the log area, the log starts over
+ */
+void elog_flash_clean(void) {
+    if (log_flash.flash == NULL) {
+        return;
+    }
+    erase_ahead(true, false);
+    if (sfud_erase(log_flash.flash, log_flash.base, ELOG_FLASH_SECTOR_NUM * ELOG_FLASH_SECTOR_SIZE) == SFUD_SUCCESS) {
+        log_flash.head = 0;
+        log_flash.seq = 0;
+        log_flash.page = 0;
+        log_flash.erased = ELOG_FLASH_SECTOR_NUM - 1;
+    }
+}
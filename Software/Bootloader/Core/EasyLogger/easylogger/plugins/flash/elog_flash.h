@@ -0,0 +1,48 @@
+/**
+ * @file elog_flash.h
+ * @brief elog sink which appends the output to a sector ring on a SFUD flash.
+ *
+ * The elog port hands every output to elog_flash_write(), see
+ * ELOG_PORT_FLASH_ENABLE in elog_cfg.h. The lines only go into a RAM buffer
+ * there, the output lock is held and the flash may be in use. elog_flash_poll()
+ * programs the whole pages of the buffer and elog_flash_flush() the rest, one
+ * ELOG_FLASH_PAGE_SIZE page program each.
+ *
+ * The log area is the last ELOG_FLASH_SECTOR_NUM sectors of the flash, used as
+ * a ring. The first page of a sector starts with a header (magic, sequence
+ * number), a new sector takes the next sequence number. ELOG_FLASH_ERASED_SECTORS
+ * sectors after the head are kept erased: entering a sector starts the erase of
+ * the next one with the oldest log in the background, so every sector is erased
+ * once per lap. elog_flash_init() finds the head from the headers and the first
+ * erased page, it's kept in RAM from then on.
+ *
+ * A page flushed before it was full is padded with 0xFF, the erased value,
+ * which is never in the log text.
+ *
+ * @note The flash is owned by the sink while its erase runs in the background,
+ *       call elog_flash_flush() before anything else uses it.
+ */
+#ifndef _ELOG_FLASH_H_
+#define _ELOG_FLASH_H_
+
+#include <elog.h>
+#include <sfud.h>
+#include <elog_flash_cfg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* elog_flash.c */
+sfud_err elog_flash_init(const sfud_flash *flash);
+void elog_flash_write(const char *log, size_t size);
+void elog_flash_poll(void);
+void elog_flash_flush(void);
+size_t elog_flash_read(size_t index, char *buf, size_t size);
+void elog_flash_clean(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ELOG_FLASH_H_ */
@@ -0,0 +1,19 @@
+/**
+ * @file elog_flash_cfg.h
+ * @brief Configuration of the elog flash sink, see elog_flash.h.
+ */
+#ifndef _ELOG_FLASH_CFG_H_
+#define _ELOG_FLASH_CFG_H_
+
+/* RAM buffer of the lines not programmed yet, the lines which don't fit are lost */
+#define ELOG_FLASH_BUF_SIZE                      4096
+/* page program size, every program is a whole page */
+#define ELOG_FLASH_PAGE_SIZE                     256
+/* sector size, the erase granularity of the flash */
+#define ELOG_FLASH_SECTOR_SIZE                   4096
+/* sectors of the log area, at the end of the flash */
+#define ELOG_FLASH_SECTOR_NUM                    16
+/* sectors after the head kept erased, a sector switch never waits for an erase */
+#define ELOG_FLASH_ERASED_SECTORS                2
+
+#endif /* _ELOG_FLASH_CFG_H_ */
@@ -27,9 +27,259 @@
  */
 
 #include <elog.h>
-#include <stdio.h>
+#include <string.h>
 #include "stm32h7xx_hal.h"
 #include "usart.h"
+#include "spsc_ring.h"
+#include "boot_time.h"
+#include "boot_trace.h"
+#ifdef ELOG_PORT_BOOT_LOG_ENABLE
+#include "boot_log.h"
+#endif
+#ifdef ELOG_PORT_FLASH_ENABLE
+#include <elog_flash.h>
+#endif
+#ifdef ELOG_PORT_ESP_ENABLE
+#include "boot_netlog.h"
+#endif
+
+/* the log is copied into the ring, the DMA1 drains it to USART2, a power of two */
+#define PORT_RING_SIZE                  (4 * 1024)
+/* the output stops taking logs when the drain stalls longer */
+#define PORT_FLUSH_TIMEOUT_MS           1000
+
+/* the DMA1 can't reach the TCMs, it stays in RAM_D1 */
+static char port_ring_buf[PORT_RING_SIZE] __attribute__((aligned(32)));
+/* the output puts with the interrupts masked, the DMA completion takes what was sent without a lock */
+static spsc_ring port_ring = { (uint8_t *) port_ring_buf, PORT_RING_SIZE - 1, 0, 0 };
+/* bytes the DMA is sending, 0: idle */
+static volatile size_t port_dma_len;
+static bool port_dma_ready;
+static DMA_HandleTypeDef hdma_usart2_tx;
+/* interrupt mask of the outermost output lock */
+static uint32_t port_lock_primask;
+static uint8_t port_lock_depth;
+#ifdef ELOG_PORT_RTT_ENABLE
+/* up buffer of the SEGGER RTT control block */
+typedef struct {
+    const char *name;
+    char *buf;
+    uint32_t size;
+    volatile uint32_t wr;                        /**< written by the target */
+    volatile uint32_t rd;                        /**< written by the debugger */
+    uint32_t flags;                              /**< 1: no block, trim */
+} port_rtt_buffer;
+
+/* SEGGER RTT control block, 1 up buffer, the debugger finds it by the id in RAM */
+typedef struct {
+    char id[16];
+    int32_t up_num;
+    int32_t down_num;
+    port_rtt_buffer up[1];
+} port_rtt_cb;
+
+/* DTCM: the D-Cache doesn't hide the data from the debugger, which reads the memory */
+static port_rtt_cb port_rtt __attribute__((section(".dtcm"), aligned(16)));
+static char port_rtt_buf[ELOG_PORT_RTT_BUF_SIZE] __attribute__((section(".dtcm")));
+#endif /* ELOG_PORT_RTT_ENABLE */
+
+/* log time of the last stamp, seconds and microseconds of boot_time_us() */
+static uint32_t time_sec, time_usec;
+/* "sec.usec" of elog_port_get_time() */
+static char time_buf[18];
+
+#ifdef ELOG_PORT_ITM_ENABLE
+/* ITM stimulus port over SWO, only while the debugger has it enabled */
+static void port_itm_output(const char *log, size_t size) {
+    volatile ITM_Type *itm = ITM;
+    uint32_t word;
+
+    if (!(itm->TCR & ITM_TCR_ITMENA_Msk) || !(itm->TER & (1UL << ELOG_PORT_ITM_PORT))) {
+        return;
+    }
+    /* 32-bit writes, a quarter of the stimulus writes of ITM_SendChar() */
+    for (; size >= 4; log += 4, size -= 4) {
+        memcpy(&word, log, sizeof(word));
+        while (itm->PORT[ELOG_PORT_ITM_PORT].u32 == 0) {
+        }
+        itm->PORT[ELOG_PORT_ITM_PORT].u32 = word;
+    }
+    for (; size; log++, size--) {
+        while (itm->PORT[ELOG_PORT_ITM_PORT].u32 == 0) {
+        }
+        itm->PORT[ELOG_PORT_ITM_PORT].u8 = (uint8_t) *log;
+    }
+}
+#endif /* ELOG_PORT_ITM_ENABLE */
+
+#ifdef ELOG_PORT_RTT_ENABLE
+static void port_rtt_init(void) {
+    static const char id[] = "SEGGER RTT";
+
+    memset(&port_rtt, 0, sizeof(port_rtt));
+    port_rtt.up_num = 1;
+    port_rtt.up[0].name = "Terminal";
+    port_rtt.up[0].buf = port_rtt_buf;
+    port_rtt.up[0].size = sizeof(port_rtt_buf);
+    port_rtt.up[0].flags = 1;
+    /* the id last, the debugger must not find a half-made block */
+    __DMB();
+    memcpy(port_rtt.id, id, sizeof(id));
+}
+
+/* the RAM ring read by the debugger, what doesn't fit is trimmed, it never waits */
+static void port_rtt_output(const char *log, size_t size) {
+    port_rtt_buffer *up = &port_rtt.up[0];
+    uint32_t wr = up->wr, rd = up->rd, len;
+
+    while (size) {
+        len = rd > wr ? rd - wr - 1 : up->size - wr - (rd == 0);
+        if (len == 0) {
+            return;
+        }
+        if (len > size) {
+            len = (uint32_t) size;
+        }
+        memcpy(&up->buf[wr], log, len);
+        log += len;
+        size -= len;
+        wr += len;
+        if (wr == up->size) {
+            wr = 0;
+        }
+        /* the data before the offset */
+        __DMB();
+        up->wr = wr;
+    }
+}
+#endif /* ELOG_PORT_RTT_ENABLE */
+
+/**
+ * the outputs besides USART2, the interrupts are masked or it's the DMA interrupt
+ */
+static void port_copy(const char *log, size_t size) {
+#ifdef ELOG_PORT_BOOT_LOG_ENABLE
+    boot_log_write(log, size);
+#endif
+#ifdef ELOG_PORT_FLASH_ENABLE
+    elog_flash_write(log, size);
+#endif
+#ifdef ELOG_PORT_ITM_ENABLE
+    port_itm_output(log, size);
+#endif
+#ifdef ELOG_PORT_RTT_ENABLE
+    port_rtt_output(log, size);
+#endif
+#ifdef ELOG_PORT_ESP_ENABLE
+    boot_netlog_write(log, size);
+#endif
+    (void) log;
+    (void) size;
+}
+
+/**
+ * send the next contiguous part of the ring, the interrupts are masked or it's the DMA interrupt
+ */
+static void port_dma_next(void) {
+    uint8_t *span;
+    size_t len;
+
+    if (port_dma_len || (len = spsc_ring_read_span(&port_ring, 0, &span)) == 0) {
+        return;
+    }
+    /* the DMA reads the memory, not the D-Cache */
+    SCB_CleanDCache_by_Addr((uint32_t *) span, (int32_t) len);
+    port_dma_len = len;
+    SET_BIT(USART2->CR3, USART_CR3_DMAT);
+    boot_trace_begin(BOOT_TRACE_USART2_DMA, len);
+    if (HAL_DMA_Start_IT(&hdma_usart2_tx, (uint32_t) (uintptr_t) span, (uint32_t) (uintptr_t) &USART2->TDR, len)
+            != HAL_OK) {
+        /* the log is dropped rather than the boot stalled */
+        port_dma_len = 0;
+        spsc_ring_consume(&port_ring, spsc_ring_used(&port_ring));
+    }
+}
+
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+#ifdef ELOG_ASYNC_LINE_OUTPUT
+#define PORT_ASYNC_GET_LOG              elog_async_get_line_log
+#else
+#define PORT_ASYNC_GET_LOG              elog_async_get_log
+#endif
+
+/**
+ * move the async output ring of elog_async.c into the free space of the port ring, never waits, the interrupts are
+ * masked or it's the DMA interrupt
+ */
+static void port_async_drain(void) {
+    uint8_t *span;
+    size_t len, got;
+
+    if (!port_dma_ready) {
+        /* blocking fallback, the ring is only a bounce buffer then */
+        while ((got = PORT_ASYNC_GET_LOG(port_ring_buf, PORT_RING_SIZE)) != 0) {
+            port_copy(port_ring_buf, got);
+#ifdef ELOG_PORT_UART_ENABLE
+            HAL_UART_Transmit(&huart2, (uint8_t *) port_ring_buf, got, 0xFFFF);
+#endif
+        }
+        return;
+    }
+    do {
+        len = spsc_ring_write_span(&port_ring, &span);
+        got = len ? PORT_ASYNC_GET_LOG((char *) span, len) : 0;
+        port_copy((const char *) span, got);
+        spsc_ring_commit(&port_ring, got);
+        /* the free space wraps, the rest goes to the ring start */
+    } while (got && got == len);
+    port_dma_next();
+}
+#endif /* ELOG_ASYNC_OUTPUT_ENABLE */
+
+/* TX-complete chaining, the next part goes out right away */
+static void port_dma_done(DMA_HandleTypeDef *hdma) {
+    (void) hdma;
+    boot_trace_end(BOOT_TRACE_USART2_DMA, port_dma_len);
+    spsc_ring_consume(&port_ring, port_dma_len);
+    port_dma_len = 0;
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+    port_async_drain();
+#else
+    port_dma_next();
+#endif
+}
+
+/* serve the DMA interrupt by polling when the caller has the interrupts masked */
+static void port_dma_poll(void) {
+    if (__get_PRIMASK()) {
+        elog_port_irq_handler();
+    }
+}
+
+/**
+ * DMA1 stream5 interrupt, the DMA completion and the async output notice
+ */
+void elog_port_irq_handler(void) {
+    HAL_DMA_IRQHandler(&hdma_usart2_tx);
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+    /* pended by elog_async_output_notice(), or room freed by the completion */
+    port_async_drain();
+#endif
+}
+
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+/**
+ * new log in the async output ring, the DMA interrupt drains it once the output lock is released
+ */
+void elog_async_output_notice(void) {
+    if (port_dma_ready) {
+        NVIC_SetPendingIRQ(DMA1_Stream5_IRQn);
+    } else {
+        /* no DMA interrupt, the output lock nests */
+        port_async_drain();
+    }
+}
+#endif
 
 /**
  * EasyLogger port initialize
@@ -39,11 +289,69 @@
 ElogErrCode elog_port_init(void) {
     ElogErrCode result = ELOG_NO_ERR;
 
-    /* add your code here */
+#ifdef ELOG_PORT_BOOT_LOG_ENABLE
+    boot_log_init();
+#endif
+#ifdef ELOG_PORT_RTT_ENABLE
+    port_rtt_init();
+#endif
+#ifdef ELOG_PORT_UART_ENABLE
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    hdma_usart2_tx.Instance = DMA1_Stream5;
+    hdma_usart2_tx.Init.Request = DMA_REQUEST_USART2_TX;
+    hdma_usart2_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_usart2_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart2_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart2_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart2_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart2_tx.Init.Mode = DMA_NORMAL;
+    hdma_usart2_tx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_usart2_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    port_dma_ready = HAL_DMA_Init(&hdma_usart2_tx) == HAL_OK;
+    if (port_dma_ready) {
+        hdma_usart2_tx.XferCpltCallback = port_dma_done;
+        hdma_usart2_tx.XferErrorCallback = port_dma_done;
+        /* below the flash DMA, the log may wait */
+        HAL_NVIC_SetPriority(DMA1_Stream5_IRQn, 15, 0);
+        HAL_NVIC_EnableIRQ(DMA1_Stream5_IRQn);
+    }
+#endif /* ELOG_PORT_UART_ENABLE */
 
     return result;
 }
 
+/**
+ * wait all the log in the ring is sent
+ *
+ * @note call it before anything else uses USART2 (the UART upload) and before the jump to the application
+ */
+void elog_port_flush(void) {
+    uint32_t start = HAL_GetTick(), primask;
+
+#ifdef ELOG_PORT_ESP_ENABLE
+    boot_netlog_flush();
+#endif
+    /* the direct boot never starts USART2, its registers read 0 */
+    if (!READ_BIT(USART2->CR1, USART_CR1_UE)) {
+        return;
+    }
+    /* HAL_GetTick() moves on with the interrupts masked too, see boot_time.h */
+    do {
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+        primask = __get_PRIMASK();
+        __disable_irq();
+        port_async_drain();
+        __set_PRIMASK(primask);
+#else
+        (void) primask;
+#endif
+        port_dma_poll();
+    } while ((port_dma_len || spsc_ring_used(&port_ring)) && HAL_GetTick() - start < PORT_FLUSH_TIMEOUT_MS);
+    while (!(USART2->ISR & USART_ISR_TC) && HAL_GetTick() - start < PORT_FLUSH_TIMEOUT_MS) {
+    }
+}
+
 /**
  * EasyLogger port deinitialize
  *
@@ -61,26 +369,100 @@ void elog_port_deinit(void) {
  * @param size log size
  */
 void elog_port_output(const char *log, size_t size) {
-    HAL_UART_Transmit(&huart2, (uint8_t *) log, size, 0xFFFF);
-    /* add your code here */
+    uint32_t primask, start = HAL_GetTick();
+    size_t len;
+
+    port_copy(log, size);
+    if (!port_dma_ready) {
+#ifdef ELOG_PORT_UART_ENABLE
+        HAL_UART_Transmit(&huart2, (uint8_t *) log, size, 0xFFFF);
+#endif
+        return;
+    }
+    while (size) {
+        /* port_async_drain() in the DMA interrupt writes the ring too, one writer at a time */
+        primask = __get_PRIMASK();
+        __disable_irq();
+        len = spsc_ring_write(&port_ring, log, size);
+        port_dma_next();
+        __set_PRIMASK(primask);
+
+        log += len;
+        size -= len;
+        if (len == 0) {
+            /* the ring is full, wait for the DMA to drain some */
+            port_dma_poll();
+            if (HAL_GetTick() - start > PORT_FLUSH_TIMEOUT_MS) {
+                return;
+            }
+        }
+    }
 }
 
 /**
  * output lock
  */
 void elog_port_output_lock(void) {
+    uint32_t primask = __get_PRIMASK();
 
-    /* add your code here */
-
+    /* the DMA interrupt takes the async output ring, it waits till the unlock */
+    __disable_irq();
+    if (port_lock_depth++ == 0) {
+        port_lock_primask = primask;
+    }
 }
 
 /**
  * output unlock
  */
 void elog_port_output_unlock(void) {
+    if (--port_lock_depth == 0) {
+        __set_PRIMASK(port_lock_primask);
+    }
+}
 
-    /* add your code here */
+/* move the stamp on to now, the output lock is held: no other stamp comes in between */
+static void port_time_update(void) {
+    uint64_t now = boot_time_us();
 
+    time_sec = (uint32_t) (now / 1000000U);
+    time_usec = (uint32_t) (now % 1000000U);
+}
+
+/**
+ * write the current time in place, the line formatter of elog.c
+ *
+ * @param buf "sec.usec" goes there, no '\0'
+ * @param size bytes of buf
+ *
+ * @return length written, 0: it doesn't fit
+ */
+size_t elog_port_put_time(char *buf, size_t size) {
+    uint32_t n;
+    size_t len = 8;
+    char *p;
+    int i;
+
+    port_time_update();
+    for (n = time_sec; n >= 10; n /= 10) {
+        len++;
+    }
+    if (len > size) {
+        return 0;
+    }
+    /* written backwards from the end, no snprintf on every line */
+    p = buf + len;
+    n = time_usec;
+    for (i = 0; i < 6; i++, n /= 10) {
+        *--p = (char) ('0' + n % 10);
+    }
+    *--p = '.';
+    n = time_sec;
+    do {
+        *--p = (char) ('0' + n % 10);
+        n /= 10;
+    } while (n);
+    return len;
 }
 
 /**
@@ -89,12 +471,17 @@ void elog_port_output_unlock(void) {
  * @return current time
  */
 const char *elog_port_get_time(void) {
+    time_buf[elog_port_put_time(time_buf, sizeof(time_buf) - 1)] = '\0';
+    return time_buf;
+}
 
-    /* add your code here */
-    uint32_t tick = HAL_GetTick();
-    static char tick_str[12] = {0};
-    snprintf(tick_str, 12, "%lu", tick);
-    return tick_str;
+/**
+ * get current time interface of the binary output
+ *
+ * @return milliseconds since reset
+ */
+uint32_t elog_port_get_tick(void) {
+    return HAL_GetTick();
 }
 
 /**
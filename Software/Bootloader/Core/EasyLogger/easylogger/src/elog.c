@@ -114,10 +114,56 @@
 #endif
 #endif /* ELOG_COLOR_ENABLE */
 
+#ifdef ELOG_BIN_OUTPUT_ENABLE
+/* binary log frame start, never in the ASCII text */
+#define ELOG_BIN_SYNC                  0xA5
+/* sync, level and argc, id, tick, tag */
+#define ELOG_BIN_HEAD_SIZE             12
+#endif
+
+/* line prefix cache: slots by tag and level, bytes of a prefix */
+#define ELOG_PREFIX_CACHE_SIZE         16
+#define ELOG_PREFIX_MAX_LEN            48
+
+/* color, level, tag and its padding, the '[' of the time: the same bytes on every line of a tag and level */
+typedef struct {
+    const char *name;
+    uint8_t level;
+    uint8_t len;
+    uint16_t gen;
+    char text[ELOG_PREFIX_MAX_LEN];
+} ElogPrefix;
+
+#ifdef ELOG_RATE_LIMIT_ENABLE
+/* rate limited call sites by their format string, a power of 2 */
+#define ELOG_RATE_SITE_NUM             16
+/* line buffer of the drop and repeat reports */
+#define ELOG_NOTE_BUF_SIZE             96
+
+/* rate limit state of a call site */
+typedef struct {
+    const char *format;  /**< the call site, NULL: free */
+    ElogTag tag;         /**< copy, ELOG_TAG() may be gone when the drops are reported */
+    uint8_t level;
+    uint32_t tick;       /**< elog_port_get_tick() of the last line */
+    uint32_t credit;     /**< lines * 1000 it may send now */
+    uint32_t dropped;    /**< lines dropped since the last one sent */
+} ElogRateSite;
+
+/* the last line sent and its repeats */
+typedef struct {
+    ElogTag tag;
+    uint8_t level;
+    uint32_t hash;       /**< FNV-1a of the message, behind the time and file info */
+    uint32_t count;      /**< repeats held back */
+    uint32_t tick;       /**< elog_port_get_tick() of the first of them */
+} ElogRepeat;
+#endif /* ELOG_RATE_LIMIT_ENABLE */
+
 /* EasyLogger object */
 static EasyLogger elog;
 /* every line log's buffer */
-static char log_buf[ELOG_LINE_BUF_SIZE] = { 0 };
+static char log_buf[ELOG_LINE_BUF_SIZE] ELOG_BUF_ATTR = { 0 };
 /* level output info */
 static const char *level_output_info[] = {
         [ELOG_LVL_ASSERT]  = "A/",
@@ -140,6 +186,15 @@ static const char *color_output_info[] = {
 };
 #endif /* ELOG_COLOR_ENABLE */
 
+static ElogPrefix prefix_cache[ELOG_PREFIX_CACHE_SIZE];
+/* a format or color change moves it on, the prefixes built before are stale */
+static uint16_t prefix_gen = 1;
+
+#ifdef ELOG_RATE_LIMIT_ENABLE
+static ElogRateSite rate_site[ELOG_RATE_SITE_NUM];
+static ElogRepeat line_repeat;
+#endif
+
 static bool get_fmt_enabled(uint8_t level, size_t set);
 static bool get_fmt_used_and_enabled_u32(uint8_t level, size_t set, uint32_t arg);
 static bool get_fmt_used_and_enabled_ptr(uint8_t level, size_t set, const char* arg);
@@ -197,6 +252,11 @@ ElogErrCode elog_init(void) {
     /* set tag_level to default val */
     elog_set_filter_tag_lvl_default();
 
+#ifdef ELOG_RATE_LIMIT_ENABLE
+    /* the default rate limit of every tag and level */
+    elog_set_rate_limit(NULL, ELOG_LVL_ASSERT, ELOG_RATE_LIMIT_BURST, ELOG_RATE_LIMIT_PER_SEC);
+#endif
+
     elog.init_ok = true;
 
     return result;
@@ -289,6 +349,7 @@ void elog_set_text_color_enabled(bool enabled) {
     ELOG_ASSERT((enabled == false) || (enabled == true));
 
     elog.text_color_enabled = enabled;
+    prefix_gen++;
 }
 
 /**
@@ -320,6 +381,7 @@ void elog_set_fmt(uint8_t level, size_t set) {
     ELOG_ASSERT(level <= ELOG_LVL_VERBOSE);
 
     elog.enabled_fmt_set[level] = set;
+    prefix_gen++;
 }
 
 /**
@@ -402,6 +464,93 @@ static void elog_set_filter_tag_lvl_default(void)
         elog.filter.tag_lvl[i].level = ELOG_FILTER_LVL_SILENT;
         elog.filter.tag_lvl[i].tag_use_flag = false;
     }
+    memset(elog.filter.tag_lvl_table, 0, sizeof(elog.filter.tag_lvl_table));
+    elog.filter.tag_lvl_num = 0;
+}
+
+/**
+ * FNV-1a hash of the tag, the one ELOG_TAG_HASH() folds at compile time
+ *
+ * @param tag tag
+ *
+ * @return tag id
+ */
+uint32_t elog_tag_hash(const char *tag)
+{
+    uint32_t hash = ELOG_TAG_FNV_BASIS;
+    bool end = false;
+    uint8_t c;
+
+    for (size_t i = 0; i < ELOG_TAG_HASH_LEN; i++) {
+        c = 0;
+        if (!end && i < ELOG_FILTER_TAG_MAX_LEN) {
+            c = (uint8_t) tag[i];
+            end = c == '\0';
+        }
+        hash = (uint32_t) ((hash ^ c) * ELOG_TAG_FNV_PRIME);
+    }
+
+    return hash;
+}
+
+/**
+ * rebuild the lookup table from the tag level filters, under the output lock
+ */
+static void tag_lvl_table_build(void)
+{
+    ElogTagLvlSlot *table = elog.filter.tag_lvl_table;
+    size_t i, slot;
+
+    memset(table, 0, sizeof(elog.filter.tag_lvl_table));
+    elog.filter.tag_lvl_num = 0;
+    for (i = 0; i < ELOG_FILTER_TAG_LVL_MAX_NUM; i++) {
+        if (!elog.filter.tag_lvl[i].tag_use_flag) {
+            continue;
+        }
+        /* the table is never full, an empty slot ends every probe */
+        for (slot = elog.filter.tag_lvl[i].id & (ELOG_FILTER_TAG_LVL_TABLE_SIZE - 1); table[slot].used;
+                slot = (slot + 1) & (ELOG_FILTER_TAG_LVL_TABLE_SIZE - 1)) {
+        }
+        table[slot].id = elog.filter.tag_lvl[i].id;
+        table[slot].level = elog.filter.tag_lvl[i].level;
+        table[slot].used = true;
+        elog.filter.tag_lvl_num++;
+    }
+}
+
+/**
+ * level of the tag level filter of a tag id, no lock: a filter changing meanwhile applies from the next line on
+ *
+ * @return ELOG_FILTER_LVL_ALL: no filter on the tag
+ */
+static uint8_t tag_lvl_find(uint32_t id)
+{
+    const ElogTagLvlSlot *table = elog.filter.tag_lvl_table;
+    size_t slot;
+
+    for (slot = id & (ELOG_FILTER_TAG_LVL_TABLE_SIZE - 1); table[slot].used;
+            slot = (slot + 1) & (ELOG_FILTER_TAG_LVL_TABLE_SIZE - 1)) {
+        if (table[slot].id == id) {
+            return table[slot].level;
+        }
+    }
+
+    return ELOG_FILTER_LVL_ALL;
+}
+
+/**
+ * @return true: the level and tag filters drop the log, constant time when no tag filter is set
+ */
+static bool tag_filtered(uint8_t level, const ElogTag *tag)
+{
+    if (level > elog.filter.level) {
+        return true;
+    }
+    if (elog.filter.tag_lvl_num && level > tag_lvl_find(tag->id)) {
+        return true;
+    }
+    /* tag filter, a substring of the tag */
+    return elog.filter.tag[0] != '\0' && !strstr(tag->name, elog.filter.tag);
 }
 
 /**
@@ -459,11 +608,13 @@ void elog_set_filter_tag_lvl(const char *tag, uint8_t level)
                     strncpy(elog.filter.tag_lvl[i].tag, tag, ELOG_FILTER_TAG_MAX_LEN);
                     elog.filter.tag_lvl[i].level = level;
                     elog.filter.tag_lvl[i].tag_use_flag = true;
+                    elog.filter.tag_lvl[i].id = elog_tag_hash(tag);
                     break;
                 }
             }
         }
     }
+    tag_lvl_table_build();
     elog_output_unlock();
 }
 
@@ -478,25 +629,66 @@ void elog_set_filter_tag_lvl(const char *tag, uint8_t level)
 uint8_t elog_get_filter_tag_lvl(const char *tag)
 {
     ELOG_ASSERT(tag != ((void *)0));
-    uint8_t i = 0;
-    uint8_t level = ELOG_FILTER_LVL_ALL;
 
-    if (!elog.init_ok) {
-        return level;
+    if (!elog.init_ok || !elog.filter.tag_lvl_num) {
+        return ELOG_FILTER_LVL_ALL;
     }
 
+    return tag_lvl_find(elog_tag_hash(tag));
+}
+
+/**
+ * set the rate limit of the lines of a tag at level and above (less severe)
+ *
+ * Each call site (format string) may send burst lines at once, then per_sec
+ * lines per second. The lines over it are dropped and counted, the count is
+ * reported ahead of the next line the site sends. A line which repeats the
+ * message of the one before is held back and counted, "last message repeated
+ * N times" goes out ahead of the next other line, or with a repeat at least
+ * ELOG_REPEAT_REPORT_MS after the first one. A line takes the rule of its own
+ * tag before the one of every tag, then the one of the highest level.
+ *
+ * @param tag tag, NULL: every tag
+ * @param level the lowest level, ELOG_LVL_ASSERT: all of them
+ * @param burst lines at once, 0: no limit and no coalescing of these lines
+ * @param per_sec lines per second after the burst
+ */
+void elog_set_rate_limit(const char *tag, uint8_t level, uint16_t burst, uint16_t per_sec)
+{
+#ifdef ELOG_RATE_LIMIT_ENABLE
+    uint32_t id = tag ? elog_tag_hash(tag) : 0;
+    ElogRateRule *rule = NULL;
+    uint8_t i;
+
+    ELOG_ASSERT(level <= ELOG_LVL_VERBOSE);
+
     elog_output_lock();
-    /* find the tag in arr */
-    for (i =0; i< ELOG_FILTER_TAG_LVL_MAX_NUM; i++){
-        if (elog.filter.tag_lvl[i].tag_use_flag == true &&
-            !strncmp(tag, elog.filter.tag_lvl[i].tag,ELOG_FILTER_TAG_MAX_LEN)){
-            level = elog.filter.tag_lvl[i].level;
+    /* the rule of the tag and level, a free one otherwise */
+    for (i = 0; i < ELOG_RATE_RULE_MAX_NUM; i++) {
+        if (elog.rate_rule[i].used && elog.rate_rule[i].any == !tag && elog.rate_rule[i].level == level &&
+                (!tag || elog.rate_rule[i].id == id)) {
+            rule = &elog.rate_rule[i];
             break;
         }
+        if (!elog.rate_rule[i].used && !rule) {
+            rule = &elog.rate_rule[i];
+        }
+    }
+    if (rule) {
+        rule->id = id;
+        rule->any = !tag;
+        rule->used = true;
+        rule->level = level;
+        rule->burst = burst;
+        rule->per_sec = per_sec;
     }
     elog_output_unlock();
-
-    return level;
+#else
+    (void) tag;
+    (void) level;
+    (void) burst;
+    (void) per_sec;
+#endif /* ELOG_RATE_LIMIT_ENABLE */
 }
 
 /**
@@ -547,181 +739,465 @@ void elog_raw_output(const char *format, ...) {
     va_end(args);
 }
 
+/* copy src to buf from len on, size bytes at most, no '\0' */
+static size_t line_put(char *buf, size_t len, size_t size, const char *src) {
+    while (*src && len < size) {
+        buf[len++] = *src++;
+    }
+    return len;
+}
+
+/* the cached prefix of level and tag, built on a miss */
+static const ElogPrefix *prefix_get(uint8_t level, const ElogTag *tag) {
+    ElogPrefix *prefix = &prefix_cache[(tag->id + level) & (ELOG_PREFIX_CACHE_SIZE - 1)];
+    size_t len = 0, pad;
+
+    /* by the name: ELOG_TAG() in a function is an automatic object, its address may be another tag's later */
+    if (prefix->name == tag->name && prefix->level == level && prefix->gen == prefix_gen) {
+        return prefix;
+    }
+#ifdef ELOG_COLOR_ENABLE
+    if (elog.text_color_enabled) {
+        len = line_put(prefix->text, len, ELOG_PREFIX_MAX_LEN, CSI_START);
+        len = line_put(prefix->text, len, ELOG_PREFIX_MAX_LEN, color_output_info[level]);
+    }
+#endif
+    if (get_fmt_enabled(level, ELOG_FMT_LVL)) {
+        len = line_put(prefix->text, len, ELOG_PREFIX_MAX_LEN, level_output_info[level]);
+    }
+    if (get_fmt_enabled(level, ELOG_FMT_TAG)) {
+        len = line_put(prefix->text, len, ELOG_PREFIX_MAX_LEN, tag->name);
+        /* if the tag length is less than 50% ELOG_FILTER_TAG_MAX_LEN, then fill space */
+        for (pad = tag->len; pad < ELOG_FILTER_TAG_MAX_LEN / 2 && len < ELOG_PREFIX_MAX_LEN; pad++) {
+            prefix->text[len++] = ' ';
+        }
+        len = line_put(prefix->text, len, ELOG_PREFIX_MAX_LEN, " ");
+    }
+    if (get_fmt_enabled(level, ELOG_FMT_TIME | ELOG_FMT_P_INFO | ELOG_FMT_T_INFO)) {
+        len = line_put(prefix->text, len, ELOG_PREFIX_MAX_LEN, "[");
+    }
+    prefix->name = tag->name;
+    prefix->level = (uint8_t) level;
+    prefix->len = (uint8_t) len;
+    prefix->gen = prefix_gen;
+    return prefix;
+}
+
 /**
- * output the log
+ * format a line up to its end signs, in one pass over buf
  *
- * @param level level
- * @param tag tag
- * @param file file name
- * @param func function name
- * @param line line number
- * @param format output format
- * @param ... args
+ * @param buf line buffer
+ * @param size bytes of buf
+ * @param exact true: 0 when the line doesn't fit, false: the line is cut to fit
  *
+ * @return line length, the CSI end and newline signs still fit behind it
  */
-void elog_output(uint8_t level, const char *tag, const char *file, const char *func,
-        const long line, const char *format, ...) {
-    extern const char *elog_port_get_time(void);
+static size_t line_format(char *buf, size_t size, size_t *body, bool exact, uint8_t level, const ElogTag *tag,
+        const char *file, const char *func, const long line, const char *format, va_list args) {
+    extern size_t elog_port_put_time(char *buf, size_t size);
     extern const char *elog_port_get_p_info(void);
     extern const char *elog_port_get_t_info(void);
 
-    size_t tag_len = strlen(tag), log_len = 0, newline_len = strlen(ELOG_NEWLINE_SIGN);
+    const ElogPrefix *prefix = prefix_get(level, tag);
+    size_t len = prefix->len, reserve = sizeof(ELOG_NEWLINE_SIGN) - 1;
     char line_num[ELOG_LINE_NUM_MAX_LEN + 1] = { 0 };
-    char tag_sapce[ELOG_FILTER_TAG_MAX_LEN / 2 + 1] = { 0 };
-    va_list args;
     int fmt_result;
 
-    ELOG_ASSERT(level <= ELOG_LVL_VERBOSE);
-
-    /* check output enabled */
-    if (!elog.output_enabled) {
-        return;
-    }
-    /* level filter */
-    if (level > elog.filter.level || level > elog_get_filter_tag_lvl(tag)) {
-        return;
-    } else if (!strstr(tag, elog.filter.tag)) { /* tag filter */
-        return;
-    }
-    /* args point to the first variable parameter */
-    va_start(args, format);
-    /* lock output */
-    elog_output_lock();
-
 #ifdef ELOG_COLOR_ENABLE
-    /* add CSI start sign and color info */
     if (elog.text_color_enabled) {
-        log_len += elog_strcpy(log_len, log_buf + log_len, CSI_START);
-        log_len += elog_strcpy(log_len, log_buf + log_len, color_output_info[level]);
+        reserve += sizeof(CSI_END) - 1;
     }
 #endif
-
-    /* package level info */
-    if (get_fmt_enabled(level, ELOG_FMT_LVL)) {
-        log_len += elog_strcpy(log_len, log_buf + log_len, level_output_info[level]);
-    }
-    /* package tag info */
-    if (get_fmt_enabled(level, ELOG_FMT_TAG)) {
-        log_len += elog_strcpy(log_len, log_buf + log_len, tag);
-        /* if the tag length is less than 50% ELOG_FILTER_TAG_MAX_LEN, then fill space */
-        if (tag_len <= ELOG_FILTER_TAG_MAX_LEN / 2) {
-            memset(tag_sapce, ' ', ELOG_FILTER_TAG_MAX_LEN / 2 - tag_len);
-            log_len += elog_strcpy(log_len, log_buf + log_len, tag_sapce);
-        }
-        log_len += elog_strcpy(log_len, log_buf + log_len, " ");
+    if (size <= len + reserve) {
+        return 0;
     }
-    /* package time, process and thread info */
+    memcpy(buf, prefix->text, len);
+    /* package time, process and thread info, the '[' is in the prefix */
     if (get_fmt_enabled(level, ELOG_FMT_TIME | ELOG_FMT_P_INFO | ELOG_FMT_T_INFO)) {
-        log_len += elog_strcpy(log_len, log_buf + log_len, "[");
         /* package time info */
         if (get_fmt_enabled(level, ELOG_FMT_TIME)) {
-            log_len += elog_strcpy(log_len, log_buf + log_len, elog_port_get_time());
+            len += elog_port_put_time(buf + len, size - len);
             if (get_fmt_enabled(level, ELOG_FMT_P_INFO | ELOG_FMT_T_INFO)) {
-                log_len += elog_strcpy(log_len, log_buf + log_len, " ");
+                len = line_put(buf, len, size, " ");
             }
         }
         /* package process info */
         if (get_fmt_enabled(level, ELOG_FMT_P_INFO)) {
-            log_len += elog_strcpy(log_len, log_buf + log_len, elog_port_get_p_info());
+            len = line_put(buf, len, size, elog_port_get_p_info());
             if (get_fmt_enabled(level, ELOG_FMT_T_INFO)) {
-                log_len += elog_strcpy(log_len, log_buf + log_len, " ");
+                len = line_put(buf, len, size, " ");
             }
         }
         /* package thread info */
         if (get_fmt_enabled(level, ELOG_FMT_T_INFO)) {
-            log_len += elog_strcpy(log_len, log_buf + log_len, elog_port_get_t_info());
+            len = line_put(buf, len, size, elog_port_get_t_info());
         }
-        log_len += elog_strcpy(log_len, log_buf + log_len, "] ");
+        len = line_put(buf, len, size, "] ");
     }
     /* package file directory and name, function name and line number info */
     if (get_fmt_used_and_enabled_ptr(level, ELOG_FMT_DIR, file) ||
             get_fmt_used_and_enabled_ptr(level, ELOG_FMT_FUNC, func) ||
             get_fmt_used_and_enabled_u32(level, ELOG_FMT_LINE, line)) {
-        log_len += elog_strcpy(log_len, log_buf + log_len, "(");
+        len = line_put(buf, len, size, "(");
         /* package file info */
         if (get_fmt_used_and_enabled_ptr(level, ELOG_FMT_DIR, file)) {
-            log_len += elog_strcpy(log_len, log_buf + log_len, file);
+            len = line_put(buf, len, size, file);
             if (get_fmt_used_and_enabled_ptr(level, ELOG_FMT_FUNC, func)) {
-                log_len += elog_strcpy(log_len, log_buf + log_len, ":");
+                len = line_put(buf, len, size, ":");
             } else if (get_fmt_used_and_enabled_u32(level, ELOG_FMT_LINE, line)) {
-                log_len += elog_strcpy(log_len, log_buf + log_len, " ");
+                len = line_put(buf, len, size, " ");
             }
         }
         /* package line info */
         if (get_fmt_used_and_enabled_u32(level, ELOG_FMT_LINE, line)) {
             snprintf(line_num, ELOG_LINE_NUM_MAX_LEN, "%ld", line);
-            log_len += elog_strcpy(log_len, log_buf + log_len, line_num);
+            len = line_put(buf, len, size, line_num);
             if (get_fmt_used_and_enabled_ptr(level, ELOG_FMT_FUNC, func)) {
-                log_len += elog_strcpy(log_len, log_buf + log_len, " ");
+                len = line_put(buf, len, size, " ");
             }
         }
         /* package func info */
         if (get_fmt_used_and_enabled_ptr(level, ELOG_FMT_FUNC, func)) {
-            log_len += elog_strcpy(log_len, log_buf + log_len, func);
-            
+            len = line_put(buf, len, size, func);
         }
-        log_len += elog_strcpy(log_len, log_buf + log_len, ")");
+        len = line_put(buf, len, size, ")");
     }
+    *body = len;
     /* package other log data to buffer. '\0' must be added in the end by vsnprintf. */
-    fmt_result = vsnprintf(log_buf + log_len, ELOG_LINE_BUF_SIZE - log_len, format, args);
-
-    va_end(args);
-    /* calculate log length */
-    if ((log_len + fmt_result <= ELOG_LINE_BUF_SIZE) && (fmt_result > -1)) {
-        log_len += fmt_result;
+    fmt_result = vsnprintf(buf + len, size - len, format, args);
+    if (fmt_result > -1 && len + fmt_result + reserve <= size) {
+        len += fmt_result;
+    } else if (exact) {
+        return 0;
     } else {
-        /* using max length */
-        log_len = ELOG_LINE_BUF_SIZE;
+        /* cut, reserve some space for CSI end sign and newline sign */
+        len = size - reserve;
+        if (*body > len) {
+            *body = len;
+        }
     }
-    /* overflow check and reserve some space for CSI end sign and newline sign */
+    return len;
+}
+
+/* add the CSI end and newline signs, their space was kept by line_format() */
+static size_t line_end(char *buf, size_t len) {
 #ifdef ELOG_COLOR_ENABLE
-    if (log_len + (sizeof(CSI_END) - 1) + newline_len > ELOG_LINE_BUF_SIZE) {
-        /* using max length */
-        log_len = ELOG_LINE_BUF_SIZE;
-        /* reserve some space for CSI end sign */
-        log_len -= (sizeof(CSI_END) - 1);
+    if (elog.text_color_enabled) {
+        memcpy(buf + len, CSI_END, sizeof(CSI_END) - 1);
+        len += sizeof(CSI_END) - 1;
+    }
+#endif
+    memcpy(buf + len, ELOG_NEWLINE_SIGN, sizeof(ELOG_NEWLINE_SIGN) - 1);
+    return len + sizeof(ELOG_NEWLINE_SIGN) - 1;
+}
+
+/* output a line put together, in the async ring, the buffer or to the port */
+static void line_out(uint8_t level, const char *buf, size_t len) {
+#if defined(ELOG_ASYNC_OUTPUT_ENABLE)
+    extern void elog_async_output(uint8_t level, const char *log, size_t size);
+    elog_async_output(level, buf, len);
+#elif defined(ELOG_BUF_OUTPUT_ENABLE)
+    extern void elog_buf_output(const char *log, size_t size);
+    elog_buf_output(buf, len);
 #else
-    if (log_len + newline_len > ELOG_LINE_BUF_SIZE) {
-        /* using max length */
-        log_len = ELOG_LINE_BUF_SIZE;
-#endif /* ELOG_COLOR_ENABLE */
-        /* reserve some space for newline sign */
-        log_len -= newline_len;
+    (void) level;
+    elog_port_output(buf, len);
+#endif
+}
+
+#ifdef ELOG_RATE_LIMIT_ENABLE
+/* a short line of elog itself, the drop and repeat reports, past the rate limit */
+static void note_output(uint8_t level, const ElogTag *tag, const char *format, ...) {
+    char buf[ELOG_NOTE_BUF_SIZE];
+    size_t len, body;
+    va_list args;
+
+    va_start(args, format);
+    len = line_format(buf, sizeof(buf), &body, false, level, tag, NULL, NULL, 0, format, args);
+    va_end(args);
+    line_out(level, buf, line_end(buf, len));
+}
+
+/* the rule of a line, see elog_set_rate_limit(), NULL: none */
+static const ElogRateRule *rate_rule_find(uint8_t level, const ElogTag *tag) {
+    const ElogRateRule *rule, *best = NULL;
+    uint8_t i;
+
+    for (i = 0; i < ELOG_RATE_RULE_MAX_NUM; i++) {
+        rule = &elog.rate_rule[i];
+        if (!rule->used || level < rule->level || (!rule->any && rule->id != tag->id)) {
+            continue;
+        }
+        if (!best || (best->any && !rule->any) || (best->any == rule->any && rule->level > best->level)) {
+            best = rule;
+        }
+    }
+    return best;
+}
+
+/**
+ * rate limit of the call site of a line, a token bucket
+ *
+ * @param coalesce true: the repeats of the line are coalesced
+ *
+ * @return true: the line is dropped
+ */
+static bool rate_limited(uint8_t level, const ElogTag *tag, const char *format, bool *coalesce) {
+    const ElogRateRule *rule = rate_rule_find(level, tag);
+    ElogRateSite *site = &rate_site[((uintptr_t) format >> 2) & (ELOG_RATE_SITE_NUM - 1)];
+    uint32_t now, credit_max, elapsed;
+
+    *coalesce = rule && rule->burst;
+    if (!*coalesce) {
+        return false;
+    }
+    now = elog_port_get_tick();
+    credit_max = rule->burst * 1000U;
+    if (site->format != format) {
+        /* another site takes the slot, the drops of the one before are reported now */
+        if (site->dropped) {
+            note_output(site->level, &site->tag, "%lu lines dropped by the rate limit",
+                    (unsigned long) site->dropped);
+        }
+        site->format = format;
+        site->tag = *tag;
+        site->level = level;
+        site->credit = credit_max;
+        site->dropped = 0;
+    } else {
+        /* per_sec lines * 1000 a second is per_sec a millisecond, no overflow below the full credit */
+        elapsed = now - site->tick;
+        if (rule->per_sec && elapsed >= credit_max / rule->per_sec) {
+            site->credit = credit_max;
+        } else if (site->credit + elapsed * rule->per_sec < credit_max) {
+            site->credit += elapsed * rule->per_sec;
+        } else {
+            site->credit = credit_max;
+        }
+    }
+    site->tick = now;
+    if (site->credit < 1000U) {
+        site->dropped++;
+        return true;
+    }
+    site->credit -= 1000U;
+    if (site->dropped) {
+        note_output(level, tag, "%lu lines dropped by the rate limit", (unsigned long) site->dropped);
+        site->dropped = 0;
+    }
+    return false;
+}
+
+/**
+ * coalescing of the lines which repeat the message of the one before
+ *
+ * @param msg message of the line, behind its time and file info
+ *
+ * @return true: a repeat, counted, the line is dropped
+ */
+static bool line_repeated(uint8_t level, const ElogTag *tag, const char *msg, size_t len) {
+    uint32_t hash = 2166136261UL, now;
+
+    while (len--) {
+        hash = (hash ^ (uint8_t) *msg++) * 16777619UL;
     }
-    /* keyword filter */
+    if (hash == line_repeat.hash && level == line_repeat.level && tag->name == line_repeat.tag.name) {
+        now = elog_port_get_tick();
+        if (line_repeat.count++ == 0) {
+            line_repeat.tick = now;
+        } else if (now - line_repeat.tick >= ELOG_REPEAT_REPORT_MS) {
+            note_output(level, tag, "last message repeated %lu times", (unsigned long) line_repeat.count);
+            line_repeat.count = 0;
+        }
+        return true;
+    }
+    if (line_repeat.count) {
+        note_output(line_repeat.level, &line_repeat.tag, "last message repeated %lu times",
+                (unsigned long) line_repeat.count);
+    }
+    line_repeat.tag = *tag;
+    line_repeat.level = level;
+    line_repeat.hash = hash;
+    line_repeat.count = 0;
+    return false;
+}
+#endif /* ELOG_RATE_LIMIT_ENABLE */
+
+/* keyword filter and repeat coalescing, true: the line goes out */
+static bool line_pass(uint8_t level, const ElogTag *tag, char *buf, size_t body, size_t len, bool coalesce) {
     if (elog.filter.keyword[0] != '\0') {
         /* add string end sign */
-        log_buf[log_len] = '\0';
-        /* find the keyword */
-        if (!strstr(log_buf, elog.filter.keyword)) {
-            /* unlock output */
+        buf[len] = '\0';
+        if (!strstr(buf, elog.filter.keyword)) {
+            return false;
+        }
+    }
+#ifdef ELOG_RATE_LIMIT_ENABLE
+    if (coalesce && line_repeated(level, tag, buf + body, len - body)) {
+        return false;
+    }
+#else
+    (void) level;
+    (void) tag;
+    (void) body;
+    (void) coalesce;
+#endif
+    return true;
+}
+
+/**
+ * output the log
+ *
+ * The prefix of the level and tag comes from prefix_cache, the time is
+ * written in place and the message formatted behind it, all in one pass.
+ * In async mode the line is formatted straight into the free span of the
+ * output ring, it goes through log_buf only when the span is short (the
+ * ring wraps there, or it's full). With ELOG_RATE_LIMIT_ENABLE the call
+ * site is rate limited and the repeats coalesced, see elog_set_rate_limit().
+ *
+ * @param level level
+ * @param tag interned tag, ELOG_TAG()
+ * @param file file name
+ * @param func function name
+ * @param line line number
+ * @param format output format
+ * @param ... args
+ *
+ */
+void elog_output(uint8_t level, const ElogTag *tag, const char *file, const char *func,
+        const long line, const char *format, ...) {
+    size_t log_len, body;
+    bool coalesce = false;
+    va_list args;
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+    va_list span_args;
+    size_t span_size;
+    char *span;
+#endif
+
+    ELOG_ASSERT(level <= ELOG_LVL_VERBOSE);
+
+    /* check output enabled */
+    if (!elog.output_enabled) {
+        return;
+    }
+    /* level and tag filters */
+    if (tag_filtered(level, tag)) {
+        return;
+    }
+    /* args point to the first variable parameter */
+    va_start(args, format);
+    /* lock output */
+    elog_output_lock();
+
+#ifdef ELOG_RATE_LIMIT_ENABLE
+    if (rate_limited(level, tag, format, &coalesce)) {
+        elog_output_unlock();
+        va_end(args);
+        return;
+    }
+#endif
+
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+    /* in place in the ring, a line the span can't hold is formatted again in log_buf */
+    span = elog_async_line_span(level, &span_size);
+#ifdef ELOG_RATE_LIMIT_ENABLE
+    /* a repeat count held back goes into the ring ahead of the line, which can't sit there yet */
+    if (line_repeat.count) {
+        span = NULL;
+    }
+#endif
+    if (span) {
+        va_copy(span_args, args);
+        log_len = line_format(span, span_size, &body, true, level, tag, file, func, line, format, span_args);
+        va_end(span_args);
+        if (log_len) {
+            if (line_pass(level, tag, span, body, log_len, coalesce)) {
+                elog_async_line_commit(line_end(span, log_len));
+            }
             elog_output_unlock();
+            va_end(args);
             return;
         }
     }
+#endif
 
-#ifdef ELOG_COLOR_ENABLE
-    /* add CSI end sign */
-    if (elog.text_color_enabled) {
-        log_len += elog_strcpy(log_len, log_buf + log_len, CSI_END);
+    log_len = line_format(log_buf, ELOG_LINE_BUF_SIZE, &body, false, level, tag, file, func, line, format, args);
+    va_end(args);
+    /* keyword filter, repeats */
+    if (!line_pass(level, tag, log_buf, body, log_len, coalesce)) {
+        /* unlock output */
+        elog_output_unlock();
+        return;
     }
-#endif
+    /* output log */
+    line_out(level, log_buf, line_end(log_buf, log_len));
+    /* unlock output */
+    elog_output_unlock();
+}
+
+#ifdef ELOG_BIN_OUTPUT_ENABLE
+/**
+ * output the log in binary, see elog_level_output() in elog.h
+ *
+ * frame, little-endian: ELOG_BIN_SYNC, level << 4 | argc, 16-bit format id, 32-bit tick, 32-bit tag pointer, argc
+ * 32-bit args. The text of elog_raw() and elog_hexdump() stays in between, it's ASCII, so the sync byte isn't in it.
+ *
+ * @note the arguments are taken as 32-bit words, no floating point or 64-bit ones; a string is only decoded when it is
+ * const data of the ELF, the keyword filter can't be used
+ *
+ * @param level level
+ * @param tag interned tag, ELOG_TAG(), its name pointer goes out
+ * @param id format string offset in ELOG_BIN_SECTION
+ * @param argc arguments count
+ * @param ... args
+ */
+void elog_bin_output(uint8_t level, const ElogTag *tag, uint16_t id, size_t argc, ...) {
+    uint8_t frame[ELOG_BIN_HEAD_SIZE + 8 * sizeof(uint32_t)];
+    uint32_t word;
+    size_t i, len;
+    va_list args;
+
+    ELOG_ASSERT(level <= ELOG_LVL_VERBOSE && argc <= 8);
 
-    /* package newline sign */
-    log_len += elog_strcpy(log_len, log_buf + log_len, ELOG_NEWLINE_SIGN);
+    /* check output enabled */
+    if (!elog.output_enabled) {
+        return;
+    }
+    /* level and tag filters */
+    if (tag_filtered(level, tag)) {
+        return;
+    }
+    frame[0] = ELOG_BIN_SYNC;
+    frame[1] = (uint8_t) (level << 4 | argc);
+    frame[2] = (uint8_t) id;
+    frame[3] = (uint8_t) (id >> 8);
+    word = elog_port_get_tick();
+    memcpy(&frame[4], &word, sizeof(word));
+    word = (uint32_t) (uintptr_t) tag->name;
+    memcpy(&frame[8], &word, sizeof(word));
+    len = ELOG_BIN_HEAD_SIZE;
+    va_start(args, argc);
+    for (i = 0; i < argc; i++, len += sizeof(word)) {
+        word = va_arg(args, uint32_t);
+        memcpy(&frame[len], &word, sizeof(word));
+    }
+    va_end(args);
+
+    elog_output_lock();
     /* output log */
 #if defined(ELOG_ASYNC_OUTPUT_ENABLE)
     extern void elog_async_output(uint8_t level, const char *log, size_t size);
-    elog_async_output(level, log_buf, log_len);
+    elog_async_output(level, (const char *) frame, len);
 #elif defined(ELOG_BUF_OUTPUT_ENABLE)
     extern void elog_buf_output(const char *log, size_t size);
-    elog_buf_output(log_buf, log_len);
+    elog_buf_output((const char *) frame, len);
 #else
-    elog_port_output(log_buf, log_len);
+    elog_port_output((const char *) frame, len);
 #endif
-    /* unlock output */
     elog_output_unlock();
 }
+#endif /* ELOG_BIN_OUTPUT_ENABLE */
 
 /**
  * get format enabled
@@ -853,6 +1329,30 @@ const char *elog_find_tag(const char *log, uint8_t lvl, size_t *tag_len) {
     return tag;
 }
 
+/* hex digits of the value, 4 at least, returns the end */
+static char *hexdump_hex(char *p, uint32_t value) {
+    static const char hex[] = "0123456789ABCDEF";
+    int shift = value > 0xFFFF ? (value > 0xFFFFF ? 20 : 16) : 12;
+
+    for (; shift >= 0; shift -= 4) {
+        *p++ = hex[(value >> shift) & 0x0F];
+    }
+    return p;
+}
+
+/* hand the packed lines to the output */
+static void hexdump_output(size_t log_len) {
+#if defined(ELOG_ASYNC_OUTPUT_ENABLE)
+    extern void elog_async_output(uint8_t level, const char *log, size_t size);
+    elog_async_output(ELOG_LVL_DEBUG, log_buf, log_len);
+#elif defined(ELOG_BUF_OUTPUT_ENABLE)
+    extern void elog_buf_output(const char *log, size_t size);
+    elog_buf_output(log_buf, log_len);
+#else
+    elog_port_output(log_buf, log_len);
+#endif
+}
+
 /**
  * dump the hex format data to log
  *
@@ -865,11 +1365,11 @@ void elog_hexdump(const char *name, uint8_t width, const void *buf, uint16_t siz
 {
 #define __is_print(ch)       ((unsigned int)((ch) - ' ') < 127u - ' ')
 
+    static const char hex[] = "0123456789ABCDEF";
     uint16_t i, j;
-    uint16_t log_len = 0;
     const uint8_t *buf_p = buf;
-    char dump_string[8] = {0};
-    int fmt_result;
+    size_t name_len = strlen(name), newline_len = strlen(ELOG_NEWLINE_SIGN), line_max;
+    char *p, *end = log_buf + ELOG_LINE_BUF_SIZE;
 
     if (!elog.output_enabled) {
         return;
@@ -878,58 +1378,65 @@ void elog_hexdump(const char *name, uint8_t width, const void *buf, uint16_t siz
     /* level filter */
     if (ELOG_LVL_DEBUG > elog.filter.level) {
         return;
-    } else if (!strstr(name, elog.filter.tag)) { /* tag filter */
+    } else if (elog.filter.tag[0] != '\0' && !strstr(name, elog.filter.tag)) { /* tag filter */
         return;
     }
+    /* "D/HEX name: XXXX-XXXX: ", the hex and char columns, the newline */
+    line_max = 6 + name_len + 2 + 11 + 2 + width * 4 + width / 8 + 2 + newline_len;
+    if (line_max > ELOG_LINE_BUF_SIZE) {
+        /* the name is cut, the columns are kept */
+        name_len -= name_len < line_max - ELOG_LINE_BUF_SIZE ? name_len : line_max - ELOG_LINE_BUF_SIZE;
+        line_max = ELOG_LINE_BUF_SIZE;
+    }
 
     /* lock output */
     elog_output_lock();
 
+    /* the lines are packed into log_buf and output together, no libc formatting */
+    p = log_buf;
     for (i = 0; i < size; i += width) {
-        /* package header */
-        fmt_result = snprintf(log_buf, ELOG_LINE_BUF_SIZE, "D/HEX %s: %04X-%04X: ", name, i, i + width - 1);
-        /* calculate log length */
-        if ((fmt_result > -1) && (fmt_result <= ELOG_LINE_BUF_SIZE)) {
-            log_len = fmt_result;
-        } else {
-            log_len = ELOG_LINE_BUF_SIZE;
+        if (end - p < (ptrdiff_t) line_max) {
+            hexdump_output(p - log_buf);
+            p = log_buf;
         }
+        /* package header */
+        memcpy(p, "D/HEX ", 6);
+        p += 6;
+        memcpy(p, name, name_len);
+        p += name_len;
+        *p++ = ':';
+        *p++ = ' ';
+        p = hexdump_hex(p, i);
+        *p++ = '-';
+        p = hexdump_hex(p, (uint32_t) i + width - 1);
+        *p++ = ':';
+        *p++ = ' ';
         /* dump hex */
         for (j = 0; j < width; j++) {
             if (i + j < size) {
-                snprintf(dump_string, sizeof(dump_string), "%02X ", buf_p[i + j]);
+                *p++ = hex[buf_p[i + j] >> 4];
+                *p++ = hex[buf_p[i + j] & 0x0F];
             } else {
-                strncpy(dump_string, "   ", sizeof(dump_string));
+                *p++ = ' ';
+                *p++ = ' ';
             }
-            log_len += elog_strcpy(log_len, log_buf + log_len, dump_string);
+            *p++ = ' ';
             if ((j + 1) % 8 == 0) {
-                log_len += elog_strcpy(log_len, log_buf + log_len, " ");
+                *p++ = ' ';
             }
         }
-        log_len += elog_strcpy(log_len, log_buf + log_len, "  ");
+        *p++ = ' ';
+        *p++ = ' ';
         /* dump char for hex */
-        for (j = 0; j < width; j++) {
-            if (i + j < size) {
-                snprintf(dump_string, sizeof(dump_string), "%c", __is_print(buf_p[i + j]) ? buf_p[i + j] : '.');
-                log_len += elog_strcpy(log_len, log_buf + log_len, dump_string);
-            }
-        }
-        /* overflow check and reserve some space for newline sign */
-        if (log_len + strlen(ELOG_NEWLINE_SIGN) > ELOG_LINE_BUF_SIZE) {
-            log_len = ELOG_LINE_BUF_SIZE - strlen(ELOG_NEWLINE_SIGN);
+        for (j = 0; j < width && i + j < size; j++) {
+            *p++ = __is_print(buf_p[i + j]) ? (char) buf_p[i + j] : '.';
         }
         /* package newline sign */
-        log_len += elog_strcpy(log_len, log_buf + log_len, ELOG_NEWLINE_SIGN);
-        /* do log output */
-#if defined(ELOG_ASYNC_OUTPUT_ENABLE)
-        extern void elog_async_output(uint8_t level, const char *log, size_t size);
-        elog_async_output(ELOG_LVL_DEBUG, log_buf, log_len);
-#elif defined(ELOG_BUF_OUTPUT_ENABLE)
-        extern void elog_buf_output(const char *log, size_t size);
-        elog_buf_output(log_buf, log_len);
-#else
-        elog_port_output(log_buf, log_len);
-#endif
+        memcpy(p, ELOG_NEWLINE_SIGN, newline_len);
+        p += newline_len;
+    }
+    if (p != log_buf) {
+        hexdump_output(p - log_buf);
     }
     /* unlock output */
     elog_output_unlock();
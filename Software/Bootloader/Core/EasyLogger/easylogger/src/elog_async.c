@@ -28,6 +28,7 @@
 
 #include <elog.h>
 #include <string.h>
+#include "spsc_ring.h"
 
 #ifdef ELOG_ASYNC_OUTPUT_ENABLE
 
@@ -75,9 +76,16 @@ static pthread_t async_output_thread;
 #ifdef ELOG_ASYNC_OUTPUT_BUF_SIZE
 #define OUTPUT_BUF_SIZE                          ELOG_ASYNC_OUTPUT_BUF_SIZE
 #else
-#define OUTPUT_BUF_SIZE                          (ELOG_LINE_BUF_SIZE * 10)
+#define OUTPUT_BUF_SIZE                          (ELOG_LINE_BUF_SIZE * 8)
 #endif /* ELOG_ASYNC_OUTPUT_BUF_SIZE */
 
+/* a free span shorter than this at the buffer end isn't worth a formatting attempt, the line wraps */
+#define LINE_SPAN_MIN                            128
+
+#if OUTPUT_BUF_SIZE & (OUTPUT_BUF_SIZE - 1)
+#error "the asynchronous output buffer size must be a power of two"
+#endif
+
 /* Initialize OK flag */
 static bool init_ok = false;
 #ifdef ELOG_ASYNC_OUTPUT_USING_PTHREAD
@@ -87,47 +95,13 @@ static bool thread_running = false;
 /* asynchronous output mode enabled flag */
 static bool is_enabled = false;
 /* asynchronous output mode's ring buffer */
-static char log_buf[OUTPUT_BUF_SIZE] = { 0 };
-/* log ring buffer write index */
-static size_t write_index = 0;
-/* log ring buffer read index */
-static size_t read_index = 0;
-/* log ring buffer full flag */
-static bool buf_is_full = false;
-/* log ring buffer empty flag */
-static bool buf_is_empty = true;
+static char log_buf[OUTPUT_BUF_SIZE] ELOG_BUF_ATTR = { 0 };
+/* the output lock serializes the writers, the single reader (the port) takes the log without a lock */
+static spsc_ring log_ring = { (uint8_t *) log_buf, OUTPUT_BUF_SIZE - 1, 0, 0 };
+/* bytes the full ring dropped, see elog_async_get_lost() */
+static uint32_t lost_size = 0;
 
 extern void elog_port_output(const char *log, size_t size);
-extern void elog_output_lock(void);
-extern void elog_output_unlock(void);
-
-/**
- * asynchronous output ring buffer used size
- *
- * @return used size
- */
-static size_t elog_async_get_buf_used(void) {
-    if (write_index > read_index) {
-        return write_index - read_index;
-    } else {
-        if (!buf_is_full && !buf_is_empty) {
-            return OUTPUT_BUF_SIZE - (read_index - write_index);
-        } else if (buf_is_full) {
-            return OUTPUT_BUF_SIZE;
-        } else {
-            return 0;
-        }
-    }
-}
-
-/**
- * asynchronous output ring buffer remain space
- *
- * @return remain space
- */
-static size_t async_get_buf_space(void) {
-    return OUTPUT_BUF_SIZE - elog_async_get_buf_used();
-}
 
 /**
  * put log to asynchronous output ring buffer
@@ -138,35 +112,7 @@ static size_t async_get_buf_space(void) {
  * @return put log size, the log which beyond ring buffer space will be dropped
  */
 static size_t async_put_log(const char *log, size_t size) {
-    size_t space = 0;
-
-    space = async_get_buf_space();
-    /* no space */
-    if (!space) {
-        size = 0;
-        goto __exit;
-    }
-    /* drop some log */
-    if (space <= size) {
-        size = space;
-        buf_is_full = true;
-    }
-
-    if (write_index + size < OUTPUT_BUF_SIZE) {
-        memcpy(log_buf + write_index, log, size);
-        write_index += size;
-    } else {
-        memcpy(log_buf + write_index, log, OUTPUT_BUF_SIZE - write_index);
-        memcpy(log_buf, log + OUTPUT_BUF_SIZE - write_index,
-                size - (OUTPUT_BUF_SIZE - write_index));
-        write_index += size - OUTPUT_BUF_SIZE;
-    }
-
-    buf_is_empty = false;
-
-__exit:
-
-    return size;
+    return spsc_ring_write(&log_ring, log, size);
 }
 
 #ifdef ELOG_ASYNC_LINE_OUTPUT
@@ -180,44 +126,22 @@ __exit:
  * @return get line log size, the log size is less than ring buffer used size
  */
 size_t elog_async_get_line_log(char *log, size_t size) {
-    size_t used = 0, cpy_log_size = 0;
-    /* lock output */
-    elog_output_lock();
-    used = elog_async_get_buf_used();
-
-    /* no log */
-    if (!used || !size) {
-        goto __exit;
-    }
-    /* less log */
-    if (used <= size) {
-        size = used;
-    }
+    size_t cpy_log_size = 0, span_size, line_size;
+    uint8_t *span;
 
-    if (read_index + size < OUTPUT_BUF_SIZE) {
-        cpy_log_size = elog_cpyln(log, log_buf + read_index, size);
-        read_index += cpy_log_size;
-    } else {
-        cpy_log_size = elog_cpyln(log, log_buf + read_index, OUTPUT_BUF_SIZE - read_index);
-        if (cpy_log_size == OUTPUT_BUF_SIZE - read_index) {
-            cpy_log_size += elog_cpyln(log + cpy_log_size, log_buf, size - cpy_log_size);
-            read_index += cpy_log_size - OUTPUT_BUF_SIZE;
-        } else {
-            read_index += cpy_log_size;
+    /* two spans at most, the line may go on at the ring start */
+    while (cpy_log_size < size && (span_size = spsc_ring_read_span(&log_ring, cpy_log_size, &span)) != 0) {
+        if (span_size > size - cpy_log_size) {
+            span_size = size - cpy_log_size;
+        }
+        line_size = elog_cpyln(log + cpy_log_size, (const char *) span, span_size);
+        cpy_log_size += line_size;
+        if (line_size < span_size) {
+            break;
         }
     }
+    spsc_ring_consume(&log_ring, cpy_log_size);
 
-    if (used == cpy_log_size) {
-        buf_is_empty = true;
-    }
-
-    if (cpy_log_size) {
-        buf_is_full = false;
-    }
-
-__exit:
-    /* lock output */
-    elog_output_unlock();
     return cpy_log_size;
 }
 #else
@@ -230,37 +154,7 @@ __exit:
  * @return get log size, the log size is less than ring buffer used size
  */
 size_t elog_async_get_log(char *log, size_t size) {
-    size_t used = 0;
-    /* lock output */
-    elog_output_lock();
-    used = elog_async_get_buf_used();
-    /* no log */
-    if (!used || !size) {
-        size = 0;
-        goto __exit;
-    }
-    /* less log */
-    if (used <= size) {
-        size = used;
-        buf_is_empty = true;
-    }
-
-    if (read_index + size < OUTPUT_BUF_SIZE) {
-        memcpy(log, log_buf + read_index, size);
-        read_index += size;
-    } else {
-        memcpy(log, log_buf + read_index, OUTPUT_BUF_SIZE - read_index);
-        memcpy(log + OUTPUT_BUF_SIZE - read_index, log_buf,
-                size - (OUTPUT_BUF_SIZE - read_index));
-        read_index += size - OUTPUT_BUF_SIZE;
-    }
-
-    buf_is_full = false;
-
-__exit:
-    /* lock output */
-    elog_output_unlock();
-    return size;
+    return spsc_ring_read(&log_ring, log, size);
 }
 #endif /* ELOG_ASYNC_LINE_OUTPUT */
 
@@ -272,6 +166,7 @@ void elog_async_output(uint8_t level, const char *log, size_t size) {
     if (is_enabled) {
         if (level >= OUTPUT_LVL) {
             put_size = async_put_log(log, size);
+            lost_size += size - put_size;
             /* notify output log thread */
             if (put_size > 0) {
                 elog_async_output_notice();
@@ -284,6 +179,42 @@ void elog_async_output(uint8_t level, const char *log, size_t size) {
     }
 }
 
+/**
+ * free span of the ring for a line formatted in place, elog_async_line_commit() puts it
+ *
+ * @param level level of the line
+ * @param size bytes at the span, ELOG_LINE_BUF_SIZE at most
+ *
+ * @return the span, NULL: the line goes through elog_async_output()
+ */
+char *elog_async_line_span(uint8_t level, size_t *size) {
+    uint8_t *span;
+
+    if (!is_enabled || level < OUTPUT_LVL) {
+        return NULL;
+    }
+    *size = spsc_ring_write_span(&log_ring, &span);
+    if (*size < LINE_SPAN_MIN) {
+        return NULL;
+    }
+    if (*size > ELOG_LINE_BUF_SIZE) {
+        *size = ELOG_LINE_BUF_SIZE;
+    }
+    return (char *) span;
+}
+
+/**
+ * put the line written at elog_async_line_span()
+ *
+ * @param size line length
+ */
+void elog_async_line_commit(size_t size) {
+    extern void elog_async_output_notice(void);
+
+    spsc_ring_commit(&log_ring, size);
+    elog_async_output_notice();
+}
+
 #ifdef ELOG_ASYNC_OUTPUT_USING_PTHREAD
 void elog_async_output_notice(void) {
     sem_post(&output_notice);
@@ -316,6 +247,15 @@ static void *async_output(void *arg) {
 }
 #endif
 
+/**
+ * bytes of log dropped since the start because the ring was full, the tail of a line cut off included
+ *
+ * @return dropped bytes
+ */
+uint32_t elog_async_get_lost(void) {
+    return lost_size;
+}
+
 /**
  * enable or disable asynchronous output mode
  * the log will be output directly when mode is disabled
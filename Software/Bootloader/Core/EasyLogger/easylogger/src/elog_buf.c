@@ -35,7 +35,7 @@
 #endif
 
 /* buffered output mode's buffer */
-static char log_buf[ELOG_BUF_OUTPUT_BUF_SIZE] = { 0 };
+static char log_buf[ELOG_BUF_OUTPUT_BUF_SIZE] ELOG_BUF_ATTR = { 0 };
 /* log buffer current write size */
 static size_t buf_write_size = 0;
 /* buffered output mode enabled flag */
@@ -0,0 +1,85 @@
+/**
+ * @file boot_agent.h
+ * @brief RAM-resident programming agent, built as ESPHostedEVBAgent.elf.
+ *
+ * The agent is the bootloader built with BOOT_AGENT and linked with
+ * STM32H730VBTX_RAM.ld: the debugger loads it into the AXI SRAM and starts
+ * it, main() brings the flashes and the clocks up as usual and runs
+ * boot_agent_run() in place of the updates and the slot selection. The
+ * debugger then only moves data into the mailbox, the agent erases with the
+ * largest blocks sfud_erase() can plan, programs with the page program SFUD
+ * picked (quad input on the MAIN flash) and reads back by the MDMA / DMA1.
+ * OpenOCD's generic OSPI driver does each of those through the debug port.
+ *
+ * The mailbox is at BOOT_AGENT_ADDR in the AXI SRAM, above the code, with
+ * BOOT_AGENT_BUF_NUM command slots, each one owns one data buffer:
+ *
+ *     1. wait for magic == BOOT_AGENT_MAGIC, the agent is up
+ *     2. fill buf[i] for a program command
+ *     3. write flash, addr, size of slot[i], then cmd last
+ *     4. go on with slot[i + 1] (ping-pong) while the agent works on slot[i]
+ *     5. before reusing slot[i] wait for its cmd back at BOOT_AGENT_CMD_NONE,
+ *        result is the sfud_err of the command, crc the CRC-32 of a CRC command
+ *
+ * The agent takes the slots strictly in turn 0, 1, 0, 1 ... so the debugger
+ * has to post them in that order. Program commands skip the pages of buf[i]
+ * which are all 0xFF, the range is expected erased. The debugger writes the
+ * mailbox behind the D-Cache, the agent invalidates and cleans the lines it
+ * shares with it.
+ */
+#ifndef __BOOT_AGENT_H__
+#define __BOOT_AGENT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* 64KB + 96 bytes at 192KB into the 320KB AXI SRAM, the linker script keeps the code below it */
+#define BOOT_AGENT_ADDR                          0x24030000UL
+#define BOOT_AGENT_MAGIC                         0x54474142UL /* 'BAGT' */
+#define BOOT_AGENT_VERSION                       1
+#define BOOT_AGENT_BUF_NUM                       2
+#define BOOT_AGENT_BUF_SIZE                      0x8000UL
+
+typedef enum {
+    BOOT_AGENT_CMD_NONE = 0,                     /**< slot free, the last command is done */
+    BOOT_AGENT_CMD_ERASE = 1,                    /**< sfud_erase() of addr, size */
+    BOOT_AGENT_CMD_ERASE_CHIP = 2,               /**< sfud_chip_erase() */
+    BOOT_AGENT_CMD_PROGRAM = 3,                  /**< sfud_write() of size bytes of buf[i] at addr */
+    BOOT_AGENT_CMD_CRC = 4,                      /**< CRC-32 (zlib) of addr, size into crc */
+} boot_agent_cmd;
+
+/* one command, a cache line */
+typedef struct {
+    volatile uint32_t cmd;                       /**< boot_agent_cmd, written last by the debugger, cleared by the agent */
+    uint32_t flash;                              /**< SFUD_xxx_FLASH */
+    uint32_t addr;                               /**< flash address */
+    uint32_t size;                               /**< bytes, at most BOOT_AGENT_BUF_SIZE for a program command */
+    volatile int32_t result;                     /**< sfud_err of the command */
+    volatile uint32_t crc;                       /**< CRC-32 of a CRC command */
+    uint32_t reserved[2];
+} boot_agent_slot;
+
+typedef struct {
+    volatile uint32_t magic;                     /**< BOOT_AGENT_MAGIC once the agent waits for commands */
+    uint16_t version;                            /**< BOOT_AGENT_VERSION */
+    uint16_t buf_num;                            /**< BOOT_AGENT_BUF_NUM */
+    uint32_t buf_size;                           /**< BOOT_AGENT_BUF_SIZE */
+    volatile uint32_t done;                      /**< commands run */
+    volatile uint32_t errors;                    /**< commands failed */
+    uint32_t reserved[3];
+    boot_agent_slot slot[BOOT_AGENT_BUF_NUM];
+    uint8_t buf[BOOT_AGENT_BUF_NUM][BOOT_AGENT_BUF_SIZE];
+} boot_agent_mailbox;
+
+extern boot_agent_mailbox boot_agent_box;
+
+void boot_agent_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_AGENT_H__ */
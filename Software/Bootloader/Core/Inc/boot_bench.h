@@ -0,0 +1,87 @@
+/**
+ * @file boot_bench.h
+ * @brief On-target benchmark of the two SFUD flashes, built as ESPHostedEVBBench.elf.
+ *
+ * The bench executable is the bootloader built with BOOT_BENCH: main() brings
+ * the flashes and the clocks up as usual, runs boot_bench_run() in place of
+ * the updates and the slot selection, and stays there. The results print as
+ * a table over USART2 (elog_raw), one row per measurement:
+ *
+ *     erase        one erase granule at a time, then the area in one sfud_erase()
+ *     program      page programs of the erased area
+ *     read x1/2/4  indirect sfud_read() at each data line width, EXT at one line
+ *     part         erase, program and read again by the part driver, boot_part.h
+ *     xip memcpy   memcpy() out of the XIP window, D-Cache cold then warm
+ *     xip mdma     boot_mem_copy() out of the XIP window
+ *     crc          boot_crc32_hw() of the XIP window and of an SRAM buffer
+ *     sha-256      hash_region(), MAIN through the window, EXT buffered
+ *     ed25519      boot_ed25519_verify() of a known signature, in cycles
+ *
+ * The bootloader links it as well, the bench command of the service console
+ * (boot_console.h) runs it on a unit in the field.
+ *
+ * The bench area is BOOT_BENCH_AREA_SIZE bytes: the reserved block at the end
+ * of the MAIN flash (see boot_slot.h) and the block right before the log area
+ * of the EXT flash. Both are erased and programmed, the slots, the slot
+ * records and the flash log are left alone.
+ *
+ * boot_bench_mem_run() follows with the memories, for the placement of the
+ * stack, the DMA pools, the log rings and the relocated code: a
+ * BOOT_BENCH_MEM_SIZE buffer of each RAM bank (the ITCM after the code, the
+ * dma_alloc.h arenas of the others, less when the arena has less room) and
+ * the bench area through the XIP window, each with the D-Cache on, then
+ * off, in cycles per byte:
+ *
+ *     seq rd/wr    word loads or stores by the CPU, 8 per loop
+ *     rand rd      dependent loads at random words, 4x the figure is the latency
+ *     rand wr      stores at random words
+ *     copy rd/wr   memcpy(), the MDMA (boot_mem.h) and the DMA2D out of the
+ *                  memory into a RAM_D1 buffer and back, the DMA2D not on the
+ *                  TCMs; the DMA figures include the cache upkeep
+ *
+ * Each case starts with no line of its buffers in the D-Cache and the
+ * interrupts masked for the CPU ones. With the D-Cache on, the buffer fits
+ * it: the rand rd figure mixes misses and hits as it would at run time.
+ *
+ * boot_bench_log_run() times elog_i() as its caller sees it, for the log
+ * policy around the flash and link work. Each output mode the build can
+ * switch to at run time takes its turn: sync (the line into the port ring,
+ * the caller waits while it's full), async (into the async ring, drained
+ * by the DMA interrupt, a full ring drops) and buf (elog_buf.c, when
+ * async isn't built). The binary output of ELOG_BIN_OUTPUT_ENABLE and the
+ * sinks of elog_port.c (ITM, RTT, the flash log, ...) are fixed by the
+ * build, the table names them; their figures take a build of their own.
+ * Per mode and format, from a constant string to a 160-character %s:
+ *
+ *     cycles       an elog_i() call with the output drained before it
+ *     lines/s      LOG_RUN_LINES calls back to back, up to the last byte out
+ *     worst us     the longest call of those, the caller blocked
+ *     lost         bytes the async ring dropped meanwhile
+ *
+ * The interrupts run, the DMA interrupt of the log is part of the figures.
+ * The bench lines go to every sink, the flash log area included.
+ */
+#ifndef __BOOT_BENCH_H__
+#define __BOOT_BENCH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOT_BENCH_AREA_SIZE                     0x10000UL
+/* MAIN flash: the reserved block after slot B */
+#define BOOT_BENCH_MAIN_ADDR                     0x7F0000UL
+/* bytes of the XIP window the CRC and the hash of the MAIN flash take */
+#define BOOT_BENCH_XIP_SIZE                      0x100000UL
+/* bytes of each memory boot_bench_mem_run() takes, a power of 2 */
+#define BOOT_BENCH_MEM_SIZE                      0x4000UL
+
+void boot_bench_run(void);
+void boot_bench_mem_run(void);
+void boot_bench_log_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_BENCH_H__ */
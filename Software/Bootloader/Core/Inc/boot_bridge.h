@@ -0,0 +1,62 @@
+/**
+ * @file boot_bridge.h
+ * @brief USART2 to ESP32-C3 UART5 passthrough, circular DMA on both sides.
+ *
+ * The service console of boot_console.h opens the bridge with "bridge", or
+ * "bridge download" to reset the ESP32 into its ROM serial loader first
+ * (ESP_BOOT low while ESP_EN is pulsed). From then on the USB-UART of the
+ * host talks to the ESP32 directly: the ESP-IDF monitor sees its log,
+ * esptool flashes it, with --before no_reset --after no_reset as the
+ * DTR/RTS lines of the host don't reach the ESP32 through the board. The
+ * bridge holds till the next reset of the board, nothing of the boot runs
+ * meanwhile and the log of the bootloader is off.
+ *
+ * Both links run at the link baud rate of boot_uart.h, UART5 takes the BRR
+ * settings of USART2 as both are clocked from PCLK1; a BAUD frame before
+ * CONSOLE raises it. Keep esptool at that rate (--baud), its
+ * CHANGE_BAUDRATE would move the ESP32 side alone.
+ *
+ * Each direction is a circular DMA from the RX data register into a
+ * BOOT_BRIDGE_RING_SIZE spsc_ring.h ring and a normal DMA from the ring to
+ * the TX data register of the other UART, a contiguous span at a time,
+ * restarted by the polling loop as soon as the last one is sent. The CPU
+ * never touches the bytes. Neither link has RTS/CTS wired: the 16 byte
+ * FIFOs of the UARTs take the gaps of the DMA restarts, the ring takes the
+ * rest, and with the same rate on both sides the ring drains as fast as it
+ * fills. An overrun of a FIFO is counted in the stats of the direction,
+ * for the debugger.
+ *
+ *     USART2 RX -> DMA2 stream0 (circular) -> ring -> DMA2 stream1 -> UART5 TX
+ *     UART5 RX  -> DMA2 stream2 (circular) -> ring -> DMA2 stream3 -> USART2 TX
+ *
+ * @note The pins of UART5 are the ones of boot_espflash.h, PB6 TX to the
+ *       ESP32 RXD, PB5 RX from its TXD.
+ */
+#ifndef __BOOT_BRIDGE_H__
+#define __BOOT_BRIDGE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* per direction, a power of two; 10ms at 4Mbaud */
+#define BOOT_BRIDGE_RING_SIZE                    4096
+/* ESP_EN held low, then the ROM loader gets to sample IO9 */
+#define BOOT_BRIDGE_RESET_MS                     10
+#define BOOT_BRIDGE_BOOT_MS                      50
+
+typedef struct {
+    uint32_t bytes;                              /**< bytes sent on */
+    uint32_t overruns;                           /**< RX FIFO overruns, a byte or more lost each */
+} boot_bridge_stats;
+
+void boot_bridge_run(uint32_t baud, bool download);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_BRIDGE_H__ */
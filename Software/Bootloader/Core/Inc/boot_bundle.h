@@ -0,0 +1,104 @@
+/**
+ * @file boot_bundle.h
+ * @brief Update bundle of the STM32 application, the ESP32 firmware and assets, routed as it streams in.
+ *
+ * One download, one signature, one pass. The bundle is a boot_bundle_header,
+ * its boot_bundle_entry table, the BOOT_ED25519_SIG_SIZE bytes Ed25519
+ * signature of both, then the data of each entry back to back in table order:
+ *
+ *     SLOT   a slot upload, header area and image, to the staging slot of the
+ *            MAIN flash, see boot_slot.h
+ *     ESP    an ESP32 bundle of boot_espflash.h, to BOOT_ESPFLASH_PATH on the
+ *            littlefs of the EXT flash: boot_espflash_update() flashes it later
+ *            in the same boot
+ *     FILE   an asset, to the littlefs path of the entry
+ *
+ * Each entry has its own compression, none or heatshrink with its window
+ * and lookahead, and the SHA-256 of its bytes as they are in the bundle.
+ * boot_bundle_feed() takes the bundle in pieces of any size, the pieces of an
+ * entry are hashed by the HASH unit, decoded and written as they come:
+ * nothing is read back and no entry waits for the whole bundle.
+ *
+ * The table is checked before any entry is taken: its CRC-32, and with
+ * BOOT_SIGN_KEY its signature, which covers every digest and so the whole
+ * bundle. Till boot_bundle_finish() nothing is in force: the slot is the
+ * staging one, the files go to BOOT_BUNDLE_TMP_PATH names. Once every entry
+ * has matched its digest and its size, the slot is committed with
+ * boot_slot_commit(), then the files are renamed into place; anything else
+ * drops them and leaves the slot unselected.
+ *
+ * @note Builds with BOOT_LFS, see boot_lfs.h. The bundle mounts the file
+ *       system itself and holds the HASH unit from boot_bundle_start() to
+ *       boot_bundle_finish(), the receiver of boot_esp.h feeds it.
+ */
+#ifndef __BOOT_BUNDLE_H__
+#define __BOOT_BUNDLE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef BOOT_LFS
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sfud.h>
+
+#define BOOT_BUNDLE_MAGIC                        0x4C444242UL /* 'BBDL' */
+#define BOOT_BUNDLE_VERSION                      1
+#define BOOT_BUNDLE_MAX_ENTRIES                  8
+#define BOOT_BUNDLE_PATH_SIZE                    32
+/* the name an entry is written to, the entry index appended, till boot_bundle_finish() */
+#define BOOT_BUNDLE_TMP_PATH                     "/.bundle"
+
+typedef enum {
+    BOOT_BUNDLE_DEST_SLOT = 1,
+    BOOT_BUNDLE_DEST_ESP = 2,
+    BOOT_BUNDLE_DEST_FILE = 3,
+} boot_bundle_dest;
+
+typedef enum {
+    BOOT_BUNDLE_COMPRESSION_NONE = 0,
+    BOOT_BUNDLE_COMPRESSION_HEATSHRINK = 1,
+} boot_bundle_compression;
+
+typedef enum {
+    BOOT_BUNDLE_OK = 0,
+    BOOT_BUNDLE_ERR_FORMAT = 1,                  /**< a bad header or table, or the bundle is cut or too long */
+    BOOT_BUNDLE_ERR_SIGN = 2,                    /**< the signature of the table is bad */
+    BOOT_BUNDLE_ERR_DIGEST = 3,                  /**< an entry doesn't match its digest or its size */
+    BOOT_BUNDLE_ERR_FLASH = 4,                   /**< a flash, file system or HASH unit error */
+    BOOT_BUNDLE_ERR_IMAGE = 5,                   /**< the slot entry isn't a valid image */
+} boot_bundle_status;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_BUNDLE_MAGIC */
+    uint16_t version;                            /**< BOOT_BUNDLE_VERSION */
+    uint16_t num;                                /**< entries after the header */
+    uint32_t size;                               /**< bundle bytes, header, table and signature included */
+    uint32_t crc;                                /**< boot_image_crc32 of the header before it and the entries */
+} boot_bundle_header;
+
+typedef struct {
+    uint8_t dest;                                /**< boot_bundle_dest, one SLOT entry at most */
+    uint8_t compression;                         /**< boot_bundle_compression */
+    uint8_t window_sz2;                          /**< heatshrink window size, log2 */
+    uint8_t lookahead_sz2;                       /**< heatshrink lookahead size, log2 */
+    uint32_t size;                               /**< bytes in the bundle */
+    uint32_t out_size;                           /**< bytes at the destination */
+    uint8_t digest[32];                          /**< SHA-256 of the bytes in the bundle */
+    char path[BOOT_BUNDLE_PATH_SIZE];            /**< FILE: littlefs path, NUL terminated */
+} boot_bundle_entry;
+
+bool boot_bundle_start(const sfud_flash *flash);
+boot_bundle_status boot_bundle_feed(const void *data, size_t len);
+boot_bundle_status boot_bundle_finish(bool *selected);
+
+#endif /* BOOT_LFS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_BUNDLE_H__ */
@@ -0,0 +1,78 @@
+/**
+ * @file boot_clock.h
+ * @brief Bring the flashes up on HSI while HSE starts, switch to the PLL afterwards.
+ *
+ * The HSE crystal takes milliseconds to start, the 550MHz PLL can't lock
+ * before it. boot_clock_start() only requests VOS0 and starts HSE, the
+ * peripherals are initialized and the flashes probed on the 64MHz HSI in the
+ * meantime:
+ *
+ *     clock    HSI phase                       PLL phase
+ *     HCLK     64MHz                           275MHz
+ *     OSPI     HCLK / 2 = 32MHz                HCLK / 5 = 55MHz, or PLL2R / N
+ *     SPI2     per_ck (HSI) = 64MHz            PLL2P = 160MHz
+ *     USART2   PCLK1 = 64MHz                   PCLK1 = 137.5MHz
+ *
+ * boot_clock_switch() waits what is left of the HSE start and the PLL lock,
+ * runs the CubeMX SystemClock_Config() and re-times the peripherals. It must
+ * come before anything which depends on the final clock: the UART upload
+ * baud rate, the memory-mapped image check and its profile.
+ * The warm entry of boot_warm.h runs the whole boot on the PLL, the switch
+ * only re-times the peripherals then.
+ *
+ * SPI2 divides its kernel clock by 2: the EXT flash runs at 32MHz, then at
+ * 80MHz, within the fast read rating of the parts and the SPI timing of the
+ * MCU. SPI2 comes up on the first use of the EXT flash (boot_ext.h), in
+ * either phase: boot_clock_spi2() sets its clock after its init.
+ *
+ * OCTOSPI1 divides HCLK by default, 275MHz only divides down to 137.5MHz,
+ * 91.7MHz or 68.75MHz. Built with BOOT_CLOCK_OSPI_PLL2_HZ (the CMake cache
+ * entry BOOT_OSPI_PLL2_HZ) its kernel clock is PLL2R in the PLL phase, set
+ * to that target just below the rating of the MAIN flash, e.g. 132MHz: the
+ * calibration of boot_ospi_cal.h then sweeps the prescalers of that clock,
+ * 1 the fastest. PLL2 keeps SPI2 on PLL2P, the VCO is the multiple of the
+ * target which gives SPI2 the most of its 160MHz, with the fractional
+ * divider. PLL2 is set up once, on its first use, and left running: the
+ * kernel clocks on it are never cut. The HSI phase and the direct path up
+ * to boot_clock_ospi() stay on HCLK, 64MHz at most, a slower clock for the
+ * same prescaler.
+ *
+ * With BOOT_DIRECT_LL the direct path sets the clock of SystemClock_Config()
+ * by register writes, boot_clock_config_ll(), see boot_direct.h.
+ */
+#ifndef __BOOT_CLOCK_H__
+#define __BOOT_CLOCK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* highest OCTOSPI1 clock, the NOR read commands of the main flash are fine with it */
+#define BOOT_CLOCK_OSPI_MAX_HZ                   55000000UL
+/* PLL2 from HSE (25MHz): / M = 5MHz, * N = 320MHz VCO, / P = 160MHz SPI2 kernel clock */
+#define BOOT_CLOCK_PLL2_M                        5
+#define BOOT_CLOCK_PLL2_N                        64
+#define BOOT_CLOCK_PLL2_P                        2
+#define BOOT_CLOCK_SPI2_KERNEL_MAX_HZ            160000000UL
+/* PLL2R target of the OCTOSPI1 kernel clock, 0: HCLK */
+#ifndef BOOT_CLOCK_OSPI_PLL2_HZ
+#define BOOT_CLOCK_OSPI_PLL2_HZ                  0
+#endif
+
+void boot_clock_start(void);
+void boot_clock_retime(void);
+void boot_clock_spi2(void);
+void boot_clock_ospi(void);
+uint32_t boot_clock_ospi_hz(void);
+void boot_clock_switch(void);
+#ifdef BOOT_DIRECT_LL
+void boot_clock_config_ll(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_CLOCK_H__ */
@@ -0,0 +1,42 @@
+/**
+ * @file boot_cmp.h
+ * @brief Compare, blank check and software CRC-32 of the verify paths, ITCM code.
+ *
+ * The installs compare the flash with RAM before they program a sector
+ * (boot_install.h, boot_selfupdate.h), the file system and the records check
+ * for erased flash, the link receivers take the CRC-32 of every frame. The
+ * byte loops of newlib and the bitwise CRC leave most of the load bandwidth
+ * of the M7 unused there:
+ *
+ *     boot_cmp_equal(a, b, size)     memcmp() == 0, 16 bytes a round
+ *     boot_cmp_blank(buf, size)      all bytes 0xFF, 16 bytes a round
+ *     boot_cmp_crc32(crc, buf, size) boot_image_crc32(), 4 bytes a round
+ *
+ * The rounds load by LDRD pairs, both pairs in flight before the first
+ * compare, and stop at the first round which differs. They run from the ITCM
+ * (.itcm_text) and so may run with the OCTOSPI flash out of memory-mapped
+ * mode, the CRC tables are in the DTCM, built on the first call.
+ *
+ * @note boot_cmp_equal() and boot_cmp_blank() take any alignment, the rounds
+ *       need 4 bytes aligned data: a buffer which isn't goes byte by byte.
+ */
+#ifndef __BOOT_CMP_H__
+#define __BOOT_CMP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+bool boot_cmp_equal(const void *a, const void *b, size_t size);
+bool boot_cmp_blank(const void *buf, size_t size);
+uint32_t boot_cmp_crc32(uint32_t crc, const void *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_CMP_H__ */
@@ -0,0 +1,63 @@
+/**
+ * @file boot_console.h
+ * @brief Service console on USART2, the flashes, their statistics, the benchmark, the boot profile and the slots.
+ *
+ * The console is a mode of boot_uart.h, entered the way the upload is, no
+ * boot waits for it: the host sends a CONSOLE frame instead of START while
+ * the board resets (the character match catches it), or the application
+ * writes BOOT_UART_CONSOLE_MAGIC to the request register and resets. The
+ * console then takes text lines at the link baud rate, from the RX DMA ring
+ * of the upload, and answers through elog_raw(), the log goes on around
+ * it:
+ *
+ *     read  <flash> <addr> <len>     CRC-32 and time of a sfud_read() of the range
+ *     dump  <flash> <addr> <len>     hex dump, BOOT_CONSOLE_DUMP_MAX bytes at most
+ *     erase <flash> <addr> <len>     the erase granules of the range
+ *     write <flash> <addr> <hex>     the bytes of the hex digits, a page at most
+ *     stats                          sfud_get_stats() of both flashes
+ *     bench                          boot_bench_run(), its areas are erased
+ *     bench mem                      boot_bench_mem_run(), the RAM banks and the XIP window
+ *     bench log                      boot_bench_log_run(), the elog_i() calls in each output mode
+ *     profile                        the stages of this boot, the stack peak
+ *     perf                           the boot time history of boot_perf.h
+ *     trace                          the DMA and interrupt latency of boot_trace.h
+ *     pcprof [hex]                   the PC profile of the application, boot_pcprof.h
+ *                                    with hex: its record, for Tools/xip_order.py
+ *     slot [a|b]                     the slot record, with a slot: switch to it
+ *     bridge [download]              USART2 passed to the ESP32 till reset, boot_bridge.h
+ *     upload                         the binary upload of boot_uart.h, START next
+ *     boot                           go on with the boot
+ *     reset
+ *
+ * <flash> is ext or main, the numbers are C literals (0x10000, 4096). The
+ * MAIN flash is in indirect mode, the addresses are flash offsets. An erase
+ * or a write of a slot is reported to boot_verify_dirty(). With no line for
+ * BOOT_CONSOLE_IDLE_MS the boot goes on.
+ */
+#ifndef __BOOT_CONSOLE_H__
+#define __BOOT_CONSOLE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define BOOT_CONSOLE_LINE_SIZE                   128
+#define BOOT_CONSOLE_DUMP_MAX                    4096
+#define BOOT_CONSOLE_IDLE_MS                     60000
+
+typedef enum {
+    BOOT_CONSOLE_EXIT_BOOT = 0,                  /**< boot, idle timeout */
+    BOOT_CONSOLE_EXIT_UPLOAD = 1,                /**< upload: a START frame comes next */
+    BOOT_CONSOLE_EXIT_BRIDGE = 2,                /**< bridge: the ESP32 UART, see boot_bridge.h */
+    BOOT_CONSOLE_EXIT_BRIDGE_DOWNLOAD = 3,       /**< bridge download: the same, the ESP32 in its ROM loader */
+} boot_console_exit;
+
+boot_console_exit boot_console_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_CONSOLE_H__ */
@@ -0,0 +1,27 @@
+/**
+ * @file boot_crc.h
+ * @brief CRC-32 of large memory blocks by the CRC unit, fed by the MDMA.
+ *
+ * Same CRC-32 as boot_image_crc32() (zlib), the MDMA reads the block and
+ * writes it word by word into CRC->DR, the CPU only waits. Suited for the
+ * memory-mapped OCTOSPI1 window and any SRAM, the TCMs included.
+ */
+#ifndef __BOOT_CRC_H__
+#define __BOOT_CRC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+bool boot_crc32_hw(const void *buf, size_t size, uint32_t *crc);
+bool boot_crc32_hw_continue(uint32_t crc, const void *buf, size_t size, uint32_t *next);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_CRC_H__ */
@@ -0,0 +1,61 @@
+/**
+ * @file boot_cryp.h
+ * @brief AES-128-CTR of the copies kept on the EXT flash by the CRYP unit, DMA in and out.
+ *
+ * The key is derived from the OTFDEC key of boot_otfdec.h, the one secret
+ * the device holds: the CRYP encrypts BOOT_CRYP_KEY_LABEL with it in ECB
+ * mode, the block is the staging key, loaded straight into the key
+ * registers: the copies never run on the OTFDEC key itself, and nothing of
+ * either key stays in RAM. No
+ * provisioned key, no encryption: boot_cryp_ready() is false and the copies
+ * stay plain.
+ *
+ * The counter block is the 64-bit nonce of the copy, then a 64-bit block
+ * count from 0 at the copy start. A run streams its whole 16 bytes blocks
+ * through the CRYP by two DMA2 streams, stream4 into DIN and stream5 out of
+ * DOUT; the CPU is free meanwhile and only pads the last partial block of
+ * the last run. The runs of a stream go on with the counter where the last
+ * one left it, so each run but the last is a multiple of 16 bytes:
+ *
+ *     boot_cryp_ctr_start(nonce);
+ *     boot_cryp_ctr_run(in, out, len);     ... read or program meanwhile ...
+ *     boot_cryp_ctr_wait();
+ *     ...
+ *     boot_cryp_ctr_stop();
+ *
+ * The CRYP takes a 16KB block in well under a millisecond, against ~40ms
+ * to page program it: the SPI2 transfers and the programs of
+ * boot_install.h and boot_rollback.h overlap with it and set the pace, not
+ * the cipher.
+ *
+ * @note in and out on 4 bytes, out on DMA_ALIGN as its lines are dropped
+ *       around the DMA; in may be out, or the XIP window.
+ */
+#ifndef __BOOT_CRYP_H__
+#define __BOOT_CRYP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sfud.h>
+
+/* 16 bytes, encrypted by the OTFDEC key into the staging key */
+#define BOOT_CRYP_KEY_LABEL                      "BOOT-STAGING-KEY"
+#define BOOT_CRYP_BLOCK_SIZE                     16
+#define BOOT_CRYP_NONCE_NUM                      2
+
+bool boot_cryp_ready(void);
+bool boot_cryp_ctr_start(const uint32_t nonce[BOOT_CRYP_NONCE_NUM]);
+sfud_err boot_cryp_ctr_run(const void *in, void *out, size_t len);
+sfud_err boot_cryp_ctr_wait(void);
+void boot_cryp_ctr_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_CRYP_H__ */
@@ -0,0 +1,74 @@
+/**
+ * @file boot_direct.h
+ * @brief Straight to the last booted slot after a warm reset, no elog, SFUD or UART on the way.
+ *
+ * A full boot which jumps to a slot image leaves a boot_direct record at
+ * BOOT_DIRECT_ADDR: the OCTOSPI1 registers of the memory-mapped read, the
+ * slot, the header CRC of its image and the flash address of the next
+ * slot-selection record. After a warm reset main() programs OCTOSPI1 from it,
+ * checks through the window that the slot header is the same one and that no
+ * slot record was appended since, and jumps. The image CRC and hash are not
+ * checked again, the boot which wrote the record did.
+ *
+ * The full path runs, with the UART and ESP updates, when
+ *  - the reset was a power-on or brown-out one, RAM_D3 is zeroed then
+ *  - the record doesn't check out, e.g. the application cleared the magic to
+ *    ask for an update:  ((boot_direct *) BOOT_DIRECT_ADDR)->magic = 0;
+ *  - a fault record or the update request of boot_uart.h waits
+ *  - the header or the slot record changed, or the flash doesn't answer the
+ *    stored read command, e.g. it was left in continuous read mode
+ *
+ * The record is cleared at the start of the full path and written again
+ * right before its jump.
+ *
+ * Built with BOOT_DIRECT_LL, main() checks the record before HAL_Init():
+ * boot_direct_enter_ll() sets the pins of MX_GPIO_Init(), the OCTOSPI1 pins,
+ * clocks and OCTOSPIM port by LL register writes, boot_clock_config_ll() the
+ * clock of SystemClock_Config(). HAL_Init(), the MX_ inits, the HAL state
+ * machines and their tick timeouts only run on the full path. When the
+ * checks fail OCTOSPI1 is reset and the full path starts as without the
+ * option. The HAL stays linked for the full path, the option cuts the time
+ * to the application, not the flash footprint.
+ */
+#ifndef __BOOT_DIRECT_H__
+#define __BOOT_DIRECT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sfud.h>
+#include "boot_slot.h"
+#include "boot_handoff.h"
+
+#define BOOT_DIRECT_ADDR                         0x38001120UL
+#define BOOT_DIRECT_MAGIC                        0x52494442UL /* 'BDIR' */
+#define BOOT_DIRECT_VERSION                      4
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_DIRECT_MAGIC when the record is valid */
+    uint16_t version;                            /**< BOOT_DIRECT_VERSION */
+    uint8_t slot;                                /**< boot_slot_id booted */
+    uint8_t reserved;                            /**< 0 */
+    boot_handoff_ospi ospi;                      /**< OCTOSPI1 registers of the memory-mapped read */
+    uint32_t xip_size;                           /**< MAIN flash capacity, the window the handoff opens */
+    uint32_t header_crc;                         /**< header_crc of the booted image */
+    uint32_t record_next;                        /**< MAIN flash address of the next slot record, erased */
+    uint32_t crc;                                /**< CRC-32 of all the fields above */
+} boot_direct;
+
+extern boot_direct boot_direct_record;
+
+void boot_direct_clear(void);
+void boot_direct_save(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header);
+const boot_direct *boot_direct_enter(void);
+#ifdef BOOT_DIRECT_LL
+const boot_direct *boot_direct_enter_ll(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_DIRECT_H__ */
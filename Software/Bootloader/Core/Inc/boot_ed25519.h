@@ -0,0 +1,46 @@
+/**
+ * @file boot_ed25519.h
+ * @brief Ed25519 signature verification (RFC 8032), field arithmetic for the Cortex-M7.
+ *
+ * The H730 has no public-key accelerator, the verification runs on the core:
+ *
+ *     S < L                      else the signature is malleable, refused
+ *     k = SHA-512(R || A || M)   software SHA-512, the HASH unit stops at SHA-256
+ *     R' = [S]B + [k](-A)        one joint double-and-add over the bits of S and k
+ *     R' encoded == R
+ *
+ * GF(2^255 - 19) elements are 8 words, kept below 2^256 and only reduced
+ * when encoded. A product is the 8x8 word schoolbook on UMAAL (the 64-bit
+ * multiply-accumulate-accumulate of the DSP extension, one instruction per
+ * word product), a square takes the 28 cross products once, both fold the
+ * high half back by 38. Points are extended twisted Edwards coordinates,
+ * the unified addition needs no special cases. A verification is about
+ * 4000 field products, boot_bench.h measures it in cycles.
+ *
+ * The stack stays under 2KB: the table of the double-and-add (B, -A, B - A)
+ * is 384 bytes, the hash and the 64 digits of the reduction of k mod L (512
+ * bytes) are on another frame, gone before it's built. Nothing is static,
+ * the calls are reentrant. The timing depends on the data, fine for public
+ * keys and signatures.
+ */
+#ifndef __BOOT_ED25519_H__
+#define __BOOT_ED25519_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BOOT_ED25519_KEY_SIZE                    32
+#define BOOT_ED25519_SIG_SIZE                    64
+
+bool boot_ed25519_verify(const uint8_t *sig, const uint8_t *msg, size_t len, const uint8_t *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_ED25519_H__ */
@@ -0,0 +1,113 @@
+/**
+ * @file boot_esp.h
+ * @brief Firmware download from the ESP32-C3 over the ESP-Hosted SPI link (SPI3).
+ *
+ * The bootloader is the ESP-Hosted SPI host over the transport of esp_spi.h:
+ * fixed size frames, each one starting with the esp_spi_header of ESP-Hosted.
+ *
+ * The download uses the serial interface number BOOT_ESP_IF_NUM, its payload
+ * is a boot_esp_msg and the data after it:
+ *
+ *     ESP32 -> host  START  offset: bytes to download, header area included
+ *                           data: optional 32-bit download id, see below
+ *     ESP32 -> host  DATA   offset: slot offset of the data, in order
+ *     ESP32 -> host  END
+ *     host -> ESP32  ACK    offset: slot offset the next DATA goes on from,
+ *                           status: boot_esp_status
+ *
+ * The RX frame of a chunk is held while the flash programs it straight from
+ * there, the next chunks wait in the RX queue of esp_spi.h and, once it is
+ * full, on the slave, so there's no window. The ack lags one chunk, the data of the chunk before
+ * is programmed while the next one comes in. Two tasks of boot_sched.h run
+ * it: the flash task moves the program on and frees its frame, the RX task,
+ * woken by esp_spi_set_notify(), takes the next message and sends the ACKs;
+ * with the program done and no frame in, the core sleeps till the next
+ * transaction.
+ *
+ * The download is looked for when DATA_READY is high at reset, the ESP32
+ * firmware offers START right after an OTA reset of the board. A packet of
+ * another interface read then is dropped; the application resets the ESP32 at
+ * its ESP-Hosted init anyway. Like the USART2 upload, the image goes to the
+ * slot which isn't booted and END selects it, see boot_uart.h.
+ *
+ * A download with an id resumes after a reset or a dropped link: each
+ * BOOT_ESP_CHUNK_SIZE chunk, programmed in full, sets its bit in the
+ * boot_esp_resume record under BOOT_ESP_KV_KEY with the CRC-32 of its
+ * data. A START of the same id, size and staging slot checks the CRC of
+ * the chunks kept against the slot, then the ACK offsets skip the ones
+ * that match: the ESP32 fetches the data from the ACK offset on. DATA
+ * before the ACK offset, sent ahead of the ACK, is dropped. The id is up
+ * to the ESP32, the same for the same image only, the ETag of the image
+ * or its CRC; END selecting the slot or failing its check drops the
+ * record. A START without id downloads it all, as before.
+ *
+ * With BOOT_LFS the ESP32 may offer BUNDLE in place of START, offset: the
+ * bytes of an update bundle, see boot_bundle.h. Its DATA goes to
+ * boot_bundle_feed() in order, the slot, the ESP32 firmware and the assets
+ * in one download; END commits it, DONE tells it's all in place. A bundle
+ * doesn't resume, the next offer takes it from the first byte again.
+ *
+ * From the offer on till the link is closed the log goes to the ESP32 too,
+ * on BOOT_NETLOG_IF_NUM, see boot_netlog.h.
+ */
+#ifndef __BOOT_ESP_H__
+#define __BOOT_ESP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sfud.h>
+#include "boot_slot.h"
+
+#define BOOT_ESP_IF_TYPE_SERIAL                  2
+#define BOOT_ESP_IF_NUM                          0x0F
+#define BOOT_ESP_MSG_MAGIC                       0x41544F42UL /* 'BOTA' */
+#define BOOT_ESP_TIMEOUT_MS                      3000
+/* the unit a download resumes by, the erase block of the slot */
+#define BOOT_ESP_CHUNK_SIZE                      0x10000UL
+#define BOOT_ESP_CHUNK_NUM                       ((BOOT_SLOT_SIZE + BOOT_ESP_CHUNK_SIZE - 1) / BOOT_ESP_CHUNK_SIZE)
+#define BOOT_ESP_KV_KEY                          "esp.resume"
+
+typedef enum {
+    BOOT_ESP_CMD_START = 1,
+    BOOT_ESP_CMD_DATA = 2,
+    BOOT_ESP_CMD_END = 3,
+    BOOT_ESP_CMD_ACK = 4,
+    BOOT_ESP_CMD_BUNDLE = 5,                     /**< in place of START: a bundle of boot_bundle.h, BOOT_LFS */
+} boot_esp_cmd;
+
+typedef enum {
+    BOOT_ESP_OK = 0,
+    BOOT_ESP_DONE = 1,                           /**< END accepted, the slot is selected */
+    BOOT_ESP_ERR_SIZE = 2,                       /**< out of order or doesn't fit the slot */
+    BOOT_ESP_ERR_FLASH = 3,                      /**< erase or program failed */
+    BOOT_ESP_ERR_IMAGE = 4,                      /**< END: the downloaded header is invalid */
+} boot_esp_status;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_ESP_MSG_MAGIC */
+    uint8_t cmd;                                 /**< boot_esp_cmd */
+    uint8_t status;                              /**< ACK: boot_esp_status */
+    uint16_t len;                                /**< DATA: bytes following the message */
+    uint32_t offset;                             /**< see the commands */
+} boot_esp_msg;
+
+typedef struct {
+    uint32_t id;                                 /**< download id of START */
+    uint32_t size;                               /**< bytes to download, START */
+    uint8_t slot;                                /**< boot_slot_id of the download */
+    uint8_t reserved[3];
+    uint32_t done[(BOOT_ESP_CHUNK_NUM + 31) / 32]; /**< bit per chunk, 1: programmed */
+    uint32_t crc[BOOT_ESP_CHUNK_NUM];            /**< CRC-32 of each chunk programmed */
+} boot_esp_resume;
+
+bool boot_esp_update(const sfud_flash *flash);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_ESP_H__ */
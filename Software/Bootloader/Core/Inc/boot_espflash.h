@@ -0,0 +1,78 @@
+/**
+ * @file boot_espflash.h
+ * @brief ESP32-C3 firmware flashing over its ROM serial loader (UART5).
+ *
+ * The ESP32 firmware comes as a bundle file on the littlefs of the EXT flash,
+ * BOOT_ESPFLASH_PATH: a boot_espflash_header, its boot_espflash_entry table,
+ * then the zlib stream of each entry. The bundle is packed on the host, the
+ * entries are compressed there, the bootloader only moves the bytes and the
+ * ROM of the ESP32 inflates them:
+ *
+ *     ESP_BOOT (PD5, IO9) low, ESP_EN (PD4) pulsed low: download mode
+ *     SYNC at 115200, CHANGE_BAUDRATE to BOOT_ESPFLASH_BAUD
+ *     SPI_ATTACH, SPI_SET_PARAMS
+ *     per entry: FLASH_DEFL_BEGIN, FLASH_DEFL_DATA of BOOT_ESPFLASH_BLOCK_SIZE
+ *                compressed bytes, SPI_FLASH_MD5 of the written area
+ *     FLASH_DEFL_END, ESP_BOOT released, ESP_EN pulsed: the new firmware runs
+ *
+ * Each command is a SLIP frame: direction 0, opcode, data length, the
+ * checksum of the data blocks (0xEF xor their bytes), the data. The ROM
+ * answers with direction 1, the opcode, a value, its data and the 4 status
+ * bytes of the ROM loader.
+ *
+ * boot_espflash_update() flashes the bundle when its crc isn't the one the
+ * key-value store holds with BOOT_ESPFLASH_KV_KEY, and records it on success,
+ * a bundle is flashed once.
+ *
+ * @note Builds with BOOT_LFS, see boot_lfs.h. UART5 (PB6 TX to the ESP32
+ *       RXD, PB5 RX from its TXD) is only set up while the bundle is flashed,
+ *       the strapping pins are the open-drain outputs of MX_GPIO_Init().
+ */
+#ifndef __BOOT_ESPFLASH_H__
+#define __BOOT_ESPFLASH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef BOOT_LFS
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <lfs.h>
+
+#define BOOT_ESPFLASH_PATH                       "/esp32/bundle.bin"
+#define BOOT_ESPFLASH_KV_KEY                     "espflash.crc"
+#define BOOT_ESPFLASH_MAGIC                      0x50534542UL /* 'BESP' */
+#define BOOT_ESPFLASH_MAX_ENTRIES                8
+/* the ROM loader takes 1KB per FLASH_DEFL_DATA */
+#define BOOT_ESPFLASH_BLOCK_SIZE                 1024
+/* the baud the ROM loader starts with, and the one the flashing runs at */
+#define BOOT_ESPFLASH_ROM_BAUD                   115200
+#define BOOT_ESPFLASH_BAUD                       2000000
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_ESPFLASH_MAGIC */
+    uint32_t num;                                /**< entries after the header */
+    uint32_t flash_size;                         /**< bytes of the ESP32 flash, SPI_SET_PARAMS */
+    uint32_t reserved;
+    uint32_t crc;                                /**< boot_image_crc32 of the header before it and the entries */
+} boot_espflash_header;
+
+typedef struct {
+    uint32_t addr;                               /**< ESP32 flash address, 4KB aligned */
+    uint32_t size;                               /**< bytes once inflated */
+    uint32_t comp_size;                          /**< bytes of the zlib stream */
+    uint32_t offset;                             /**< file offset of the zlib stream */
+    uint8_t md5[16];                             /**< MD5 of the inflated bytes */
+} boot_espflash_entry;
+
+bool boot_espflash_update(lfs_t *lfs);
+
+#endif /* BOOT_LFS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_ESPFLASH_H__ */
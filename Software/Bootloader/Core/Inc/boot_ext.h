@@ -0,0 +1,39 @@
+/**
+ * @file boot_ext.h
+ * @brief The EXT flash, SPI2 and what lives on them, brought up on their first use.
+ *
+ * A plain boot only reads the MAIN flash through OCTOSPI1, sfud_init()
+ * probes it alone (SFUD_INIT_FLASHES). The EXT flash holds the key-value
+ * store, the flash log, the rollback copy, the file system and the bench
+ * area; the first of them to be needed calls boot_ext_flash(), which runs
+ * once:
+ *
+ *     MX_SPI2_Init(), boot_clock_spi2()    SPI2 on the clock of the phase it's in
+ *     sfud_device_init()                   the probe of the EXT flash
+ *     elog_flash_init()                    the flash log, its RAM buffer held the lines so far
+ *     boot_kv_mount()                      the key-value store
+ *     boot_handoff_info_flash()            the EXT flash entry of the handoff record
+ *
+ * The callers are the update and rollback paths, the console, the fault
+ * record, the file system and the flash log of main(). A boot with none of
+ * them skips the SPI2 init and the probe, the handoff record then has the
+ * EXT flash entry invalid and the application probes it itself.
+ *
+ * @note The flash may be down after the call, init_ok tells.
+ */
+#ifndef __BOOT_EXT_H__
+#define __BOOT_EXT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sfud.h>
+
+sfud_flash *boot_ext_flash(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_EXT_H__ */
@@ -0,0 +1,80 @@
+/**
+ * @file boot_fault.h
+ * @brief Fault record in no-init RAM_D3, moved to the key-value store at the next boot.
+ *
+ * The fault handlers of stm32h7xx_it.c (NMI, HardFault, MemManage, BusFault,
+ * UsageFault) branch to boot_fault_capture() with the stacked frame and
+ * EXC_RETURN. It fills the boot_fault record at BOOT_FAULT_ADDR: the frame,
+ * the fault status and address registers, the words of the stack above the
+ * frame, and resets the MCU at once instead of spinning. The RAM range of
+ * the stack is checked before it's read, a corrupted SP adds no fault.
+ *
+ * The next full boot finds the record right after sfud_init(), brings up
+ * the key-value store for it (boot_ext_flash()), logs it and stores it
+ * under BOOT_FAULT_KV_KEY, one key-value record of less than a page, then
+ * drops it. The direct path of boot_direct.h is not taken while
+ * a record waits. The key holds the last fault, the application reads it
+ * with boot_kv_get() or the same record through BOOT_FAULT_ADDR; its own
+ * fault handlers may take BOOT_FAULT_CAPTURE() too, the bootloader stores
+ * the record alike.
+ *
+ * @note BOOT_FAULT_CAPTURE() is the first statement of a handler. The handlers
+ *       call nothing and return nothing, from -Og on they push nothing before
+ *       it, the SP is still the one of the frame.
+ */
+#ifndef __BOOT_FAULT_H__
+#define __BOOT_FAULT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BOOT_FAULT_ADDR                          0x38001400UL
+#define BOOT_FAULT_MAGIC                         0x544C4642UL /* 'BFLT' */
+#define BOOT_FAULT_VERSION                       1
+#define BOOT_FAULT_KV_KEY                        "fault"
+/* words of the stack above the exception frame */
+#define BOOT_FAULT_STACK_WORDS                   16
+
+/* the frame on the stack the exception came from, bit 2 of EXC_RETURN, and the branch to boot_fault_capture() */
+#define BOOT_FAULT_CAPTURE()                                                     \
+    __asm volatile("tst lr, #4\n"                                                \
+                   "ite eq\n"                                                    \
+                   "mrseq r0, msp\n"                                             \
+                   "mrsne r0, psp\n"                                             \
+                   "mov r1, lr\n"                                                \
+                   "b boot_fault_capture\n")
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_FAULT_MAGIC when the record is valid */
+    uint16_t version;                            /**< BOOT_FAULT_VERSION */
+    uint16_t size;                               /**< sizeof(boot_fault) */
+    uint32_t ipsr;                               /**< exception number, 2: NMI, 3: HardFault ... 6: UsageFault */
+    uint32_t exc_return;                         /**< LR at the entry, bit 2: the frame is on the PSP */
+    uint32_t sp;                                 /**< address of the exception frame */
+    uint32_t frame[8];                           /**< r0, r1, r2, r3, r12, lr, pc, xpsr, 0: sp out of RAM */
+    uint32_t cfsr;                               /**< SCB CFSR, MemManage, BusFault and UsageFault status */
+    uint32_t hfsr;                               /**< SCB HFSR */
+    uint32_t dfsr;                               /**< SCB DFSR */
+    uint32_t mmfar;                              /**< SCB MMFAR, valid with CFSR MMARVALID */
+    uint32_t bfar;                               /**< SCB BFAR, valid with CFSR BFARVALID */
+    uint32_t afsr;                               /**< SCB AFSR */
+    uint32_t stack_num;                          /**< words in stack, the RAM may end before */
+    uint32_t stack[BOOT_FAULT_STACK_WORDS];      /**< words from the end of the frame on */
+    uint32_t crc;                                /**< CRC-32 of all the fields above */
+} boot_fault;
+
+extern boot_fault boot_fault_record;
+
+void boot_fault_capture(const uint32_t *frame, uint32_t exc_return) __attribute__((noreturn));
+bool boot_fault_pending(void);
+void boot_fault_save(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_FAULT_H__ */
@@ -0,0 +1,244 @@
+/**
+ * @file boot_handoff.h
+ * @brief MPU and cache state handed over to the application.
+ *
+ * With BOOT_HANDOFF_CACHED the application is entered with the MPU enabled
+ * (privileged default map as background) and both caches on:
+ *
+ *     region  base         size            attributes
+ *     0       0x90000000   256MB           OCTOSPI1 window, no access, XN
+ *     1       0x90000000   flash capacity  XIP flash, RO, WB cacheable, executable
+ *     2       0x00000000   64KB            ITCM, RW, executable
+ *     3       0x20000000   128KB           DTCM, RW, XN
+ *     4       0x24000000   320KB           RAM_D1 (AXI SRAM), RW, WBWA cacheable, executable
+ *     5       0x30000000   32KB            RAM_D2, RW, WBWA cacheable, executable
+ *     6       0x38000000   16KB            RAM_D3, RW, non-cacheable, XN
+ *
+ * Contract for the application:
+ *  - the D-cache has been cleaned and invalidated, the I-cache invalidated,
+ *    so nothing written by the bootloader is lost and no stale XIP line is left
+ *  - SCB_EnableICache() / SCB_EnableDCache() return early when the cache is
+ *    already on (CMSIS 5.6+), the app's own startup can keep calling them
+ *  - the MPU regions 0~6 can be reprogrammed after HAL_MPU_Disable(), the
+ *    regions 7~15 are left disabled for the application
+ *  - coherence of DMA buffers in RAM_D1/RAM_D2 is up to the application,
+ *    RAM_D3 (boot records, BDMA) stays non-cacheable
+ *
+ * Without BOOT_HANDOFF_CACHED the MPU and both caches are disabled before the jump.
+ *
+ * The boot_handoff_info record at BOOT_HANDOFF_INFO_ADDR (RAM_D3, no-init)
+ * tells what the bootloader left running, it is published right before the
+ * jump. With a valid record the application may skip
+ *  - SystemClock_Config(): the PLL, bus dividers, flash latency and VOS are
+ *    the ones of clock, SystemCoreClockUpdate() and HAL_InitTick() are enough;
+ *    PLL2 may clock OCTOSPI1 (rcc_d1ccipr, ospi_hz), it must not be stopped
+ *  - the OCTOSPI1 setup: it's in memory-mapped mode by ospi, fill the HAL
+ *    handle without calling HAL_OSPI_Init() on the flash it runs from
+ *  - the SFDP discovery: flash[SFUD_xxx_FLASH] holds the resolved parameters,
+ *    of the flashes the boot brought up (the EXT flash only on its use,
+ *    boot_ext.h)
+ *
+ * With BOOT_HANDOFF_IMAGE_RAM the image runs from its RAM copy, the
+ * OCTOSPI1 is still memory-mapped but nothing of the image needs it: the
+ * application may abort the mode (HAL_OSPI_Abort()), send Power-down (B9h)
+ * and gate the OCTOSPI1 clock, or take the flash for its data.
+ *
+ * vector_addr is the VTOR the application is entered with: exec_addr, or the
+ * TCM copy of the vector table of BOOT_IMAGE_FLAG_VECTOR (see boot_image.h),
+ * made by the bootloader, which the application must not overwrite.
+ *
+ * A deferred count above 0 tells the image is started with that many of its
+ * sectors unchecked, verified has neither BOOT_HANDOFF_IMAGE_CRC nor
+ * BOOT_HANDOFF_IMAGE_HASH: the application calls the verify_step service of
+ * boot_svc.h until it returns SFUD_ERR_NOT_FOUND, see boot_verify.h.
+ *
+ * With bit 2 of read_flags the MAIN flash has Set Burst with Wrap (77h) at 32
+ * bytes: the line fills of the window are wrapped quad I/O reads (WPCCR),
+ * the regular read is the linear 1-1-4 one, and any quad I/O read the
+ * application sends itself wraps too until it sends 77h with the wrap bits
+ * off. A flash reset drops the wrap, a power-down and release keeps it.
+ *
+ *     const boot_handoff_info *info = (const boot_handoff_info *) BOOT_HANDOFF_INFO_ADDR;
+ *     if (info->magic == BOOT_HANDOFF_INFO_MAGIC && info->version == BOOT_HANDOFF_INFO_VERSION) {
+ *         // info->reset_flags, info->path, info->slot, info->verified ...
+ *     }
+ *
+ * MX_GPIO_Init() releases ESP_EN (PD4) with ESP_BOOT (PD5, IO9) high, the
+ * ESP32 boots its firmware while the bootloader runs. With esp_running set
+ * the application keeps both pins high instead of resetting the ESP32 again
+ * at its ESP-Hosted init, the ROM, second stage loader and Wi-Fi init are
+ * then done or under way.
+ *
+ * stats[SFUD_xxx_FLASH] are the SFUD operation counters of the boot (see
+ * sfud_get_stats()), all 0 on the direct path, which doesn't run SFUD. They
+ * tell a slow install apart: busy_us is the flash at work, total_us less
+ * busy_us the bus and the code, retries and bus_errors a flash or bus fault.
+ *
+ * mem holds the RAM high-water marks of the boot: the deepest stack of the
+ * painted area (boot_profile_stack_peak()), the most of each dma_alloc.h
+ * arena taken and the fewest free dma_pool.h blocks. The gap to the sizes is
+ * RAM the bootloader could give to its caches and buffers.
+ *
+ * perf_flags tells the boot was slower than the history of boot_perf.h:
+ * BOOT_PERF_FLAG_TOTAL for the total, (1 << BOOT_STAGE_xxx) for a stage, 0
+ * when in line or not compared. The application may report it, a flash
+ * wearing out or a marginal calibration shows up there first.
+ *
+ * trace has the latency of each channel of boot_trace.h in core cycles,
+ * the count, mean, median, 99th percentile and worst of the boot; the full
+ * histograms and the event ring are in boot_trace_record.
+ */
+#ifndef __BOOT_HANDOFF_H__
+#define __BOOT_HANDOFF_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sfud.h>
+#include "boot_slot.h"
+#include "dma_alloc.h"
+#include "boot_trace.h"
+
+/* jump to the application with the MPU and caches configured for XIP */
+#define BOOT_HANDOFF_CACHED
+
+/* memory-mapped window of OCTOSPI1 */
+#define BOOT_HANDOFF_XIP_WINDOW_SIZE             0x10000000UL
+
+#define BOOT_HANDOFF_INFO_ADDR                   0x38001180UL
+#define BOOT_HANDOFF_INFO_MAGIC                  0x444E4842UL /* 'BHND' */
+#define BOOT_HANDOFF_INFO_VERSION                9
+
+/* boot_handoff_info.verified, the checks the image passed at this boot */
+#define BOOT_HANDOFF_IMAGE_HEADER                (1U << 0)
+#define BOOT_HANDOFF_IMAGE_CRC                   (1U << 1)
+#define BOOT_HANDOFF_IMAGE_HASH                  (1U << 2)
+#define BOOT_HANDOFF_IMAGE_DECRYPTED             (1U << 3) /**< the OTFDEC region is enabled and locked */
+#define BOOT_HANDOFF_IMAGE_SAMPLED               (1U << 4) /**< CRC and hash by an earlier boot, sectors sampled by this one */
+#define BOOT_HANDOFF_IMAGE_RAM                   (1U << 5) /**< copied to ram_addr, see BOOT_IMAGE_FLAG_RAM */
+#define BOOT_HANDOFF_IMAGE_SIGNED                (1U << 6) /**< header signature good, built with BOOT_SIGN_KEY */
+#define BOOT_HANDOFF_IMAGE_TRIAL                 (1U << 7) /**< on trial, boot_trial.h: the confirm service ends it */
+
+/* boot_handoff_info.updates */
+#define BOOT_HANDOFF_UPDATE_UART                 (1U << 0)
+#define BOOT_HANDOFF_UPDATE_ESP                  (1U << 1)
+#define BOOT_HANDOFF_UPDATE_USB                  (1U << 2)
+
+typedef enum {
+    BOOT_HANDOFF_PATH_FULL = 0,                  /**< elog, SFUD and the update windows ran */
+    BOOT_HANDOFF_PATH_DIRECT = 1,                /**< warm reset straight to the last slot, see boot_direct.h */
+} boot_handoff_path;
+
+/* OCTOSPI1 registers of a memory-mapped read */
+typedef struct {
+    uint32_t cr;                                 /**< CR, FMODE is memory-mapped */
+    uint32_t dcr[4];                             /**< DCR1~DCR4, the prescaler is in DCR2 */
+    uint32_t ccr;                                /**< CCR of the read command */
+    uint32_t tcr;                                /**< TCR of the read command, dummy cycles and sampling */
+    uint32_t ir;                                 /**< IR of the read command */
+    uint32_t abr;                                /**< ABR, the continuous read mode bits */
+    uint32_t wpccr;                              /**< WPCCR of the wrapped read, used when DCR2 WRAPSIZE is set */
+    uint32_t wptcr;                              /**< WPTCR of the wrapped read */
+    uint32_t wpir;                               /**< WPIR of the wrapped read */
+    uint32_t wpabr;                              /**< WPABR of the wrapped read */
+    uint32_t dlyb_cr;                            /**< DLYB_OCTOSPI1 CR, used when DCR1 DLYBYP is clear */
+    uint32_t dlyb_cfgr;                          /**< DLYB_OCTOSPI1 CFGR, the SEL and UNIT of boot_ospi_cal.h */
+} boot_handoff_ospi;
+
+typedef struct {
+    uint32_t sysclk_hz;                          /**< HAL_RCC_GetSysClockFreq() */
+    uint32_t hclk_hz;                            /**< AHB */
+    uint32_t pclk1_hz;                           /**< APB1 (D2) */
+    uint32_t pclk2_hz;                           /**< APB2 (D2) */
+    uint32_t pclk3_hz;                           /**< APB3 (D1) */
+    uint32_t pclk4_hz;                           /**< APB4 (D3) */
+    uint32_t rcc_cr;                             /**< RCC CR, the oscillators on */
+    uint32_t rcc_d1cfgr;                         /**< RCC D1CFGR */
+    uint32_t rcc_d2cfgr;                         /**< RCC D2CFGR */
+    uint32_t rcc_d3cfgr;                         /**< RCC D3CFGR */
+    uint32_t rcc_pllckselr;                      /**< RCC PLLCKSELR */
+    uint32_t rcc_pllcfgr;                        /**< RCC PLLCFGR */
+    uint32_t rcc_pll1divr;                       /**< RCC PLL1DIVR */
+    uint32_t rcc_pll1fracr;                      /**< RCC PLL1FRACR */
+    uint32_t rcc_d1ccipr;                        /**< RCC D1CCIPR, the OCTOSPI1 kernel clock source */
+    uint32_t rcc_pll2divr;                       /**< RCC PLL2DIVR, SPI2 and maybe OCTOSPI1 */
+    uint32_t rcc_pll2fracr;                      /**< RCC PLL2FRACR */
+    uint32_t ospi_hz;                            /**< OCTOSPI1 kernel clock, HCLK or PLL2R */
+    uint32_t flash_acr;                          /**< FLASH ACR, the latency */
+    uint32_t pwr_d3cr;                           /**< PWR D3CR, the voltage scale */
+} boot_handoff_clock;
+
+/* resolved SFUD parameters of one flash */
+typedef struct {
+    uint8_t valid;                               /**< 1: probed at this or a previous boot, the fields are good */
+    uint8_t mf_id;                               /**< JEDEC manufacturer ID */
+    uint8_t type_id;                             /**< JEDEC memory type ID */
+    uint8_t capacity_id;                         /**< JEDEC capacity ID */
+    uint32_t capacity;                           /**< bytes */
+    uint32_t erase_gran;                         /**< bytes of the smallest erase */
+    uint8_t erase_gran_cmd;                      /**< its command */
+    uint8_t addr_in_4_byte;                      /**< 1: the flash is in 4-byte addressing */
+    uint16_t write_mode;                         /**< sfud_write_mode bits */
+    uint8_t read_instruction;                    /**< sfud_qspi_read_cmd_format of the fast read, 0: not set */
+    uint8_t read_instruction_lines;
+    uint8_t read_address_size;
+    uint8_t read_address_lines;
+    uint8_t read_alternate_bytes_lines;
+    uint8_t read_dummy_cycles;
+    uint8_t read_data_lines;
+    uint8_t read_flags;                          /**< bit 0: DTR, bit 1: continuous read, bit 2: wrapped read */
+} boot_handoff_flash;
+
+/* RAM high-water marks of the boot */
+typedef struct {
+    uint32_t stack_size;                         /**< bytes of the painted stack area, see boot_profile.h */
+    uint32_t stack_peak;                         /**< bytes of it used at most, stack_size: overflowed */
+    uint32_t arena_size[DMA_REGION_NUM];         /**< bytes of the dma_alloc.h arenas, by dma_region */
+    uint32_t arena_peak[DMA_REGION_NUM];         /**< bytes of them taken at most */
+    uint32_t pool_free_min;                      /**< fewest free blocks of dma_pool.h */
+} boot_handoff_mem;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_HANDOFF_INFO_MAGIC when the record is valid */
+    uint16_t version;                            /**< BOOT_HANDOFF_INFO_VERSION */
+    uint16_t size;                               /**< sizeof(boot_handoff_info) */
+    uint32_t reset_flags;                        /**< RCC->RSR at reset, see boot_profile.h */
+    uint8_t path;                                /**< boot_handoff_path */
+    uint8_t slot;                                /**< boot_slot_id booted, BOOT_SLOT_NONE: legacy layout */
+    uint8_t verified;                            /**< BOOT_HANDOFF_IMAGE_xxx */
+    uint8_t updates;                             /**< BOOT_HANDOFF_UPDATE_xxx done at this boot */
+    uint32_t image_version;                      /**< image_version of the booted header, 0: legacy layout */
+    uint32_t vector_addr;                        /**< SCB->VTOR at the entry, the TCM copy of BOOT_IMAGE_FLAG_VECTOR */
+    uint8_t ospi_mapped;                         /**< 1: ospi is the memory-mapped mode in force */
+    uint8_t esp_running;                         /**< 1: the ESP32 boots its firmware since MX_GPIO_Init() */
+    uint8_t deferred;                            /**< image sectors left to the verify_step service, boot_verify.h */
+    uint8_t reserved;                            /**< 0 */
+    boot_handoff_ospi ospi;                      /**< OCTOSPI1 registers */
+    boot_handoff_clock clock;                    /**< clock tree */
+    boot_handoff_flash flash[SFUD_FLASH_DEVICE_NUM]; /**< indexed by SFUD_xxx_FLASH */
+    sfud_stats stats[SFUD_FLASH_DEVICE_NUM];     /**< SFUD counters of this boot, indexed by SFUD_xxx_FLASH */
+    boot_handoff_mem mem;                        /**< RAM high-water marks */
+    uint32_t perf_flags;                         /**< stages slower than the last boots, see boot_perf.h */
+    boot_trace_summary trace[BOOT_TRACE_CH_NUM]; /**< DMA and interrupt latency, see boot_trace.h */
+    uint32_t crc;                                /**< CRC-32 of all the fields above */
+} boot_handoff_info;
+
+extern boot_handoff_info boot_handoff_record;
+
+void boot_handoff_prepare(uint32_t xip_base, uint32_t xip_size);
+void boot_handoff_info_init(boot_handoff_path path);
+void boot_handoff_info_flash(const sfud_flash *flash);
+void boot_handoff_info_slot(boot_slot_id slot, const boot_image_header *header, uint8_t verified);
+void boot_handoff_info_deferred(uint8_t sectors);
+void boot_handoff_info_update(uint8_t updates);
+void boot_handoff_ospi_save(boot_handoff_ospi *ospi);
+void boot_handoff_ospi_load(const boot_handoff_ospi *ospi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_HANDOFF_H__ */
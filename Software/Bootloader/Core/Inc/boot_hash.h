@@ -0,0 +1,40 @@
+/**
+ * @file boot_hash.h
+ * @brief SHA-256 of flash regions by the HASH unit, reading and hashing overlap.
+ *
+ * The DMA2 feeds HASH->DIN in the background. For the MAIN flash in
+ * memory-mapped mode it reads the XIP window directly; otherwise the region
+ * is read in blocks into two buffers, and the next block is read while the
+ * previous one is hashed. hash_memory() takes a block of RAM_D1 the same way
+ * as the XIP window.
+ *
+ * hash_stream_start(), hash_stream_feed() and hash_stream_finish() hash data
+ * as it comes, e.g. the frames of an upload: each piece is fed where it is,
+ * the HASH keeps the state in between and the bytes short of a word wait for
+ * the next piece. Nothing else may use the HASH till the stream is finished.
+ */
+#ifndef __BOOT_HASH_H__
+#define __BOOT_HASH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sfud.h>
+
+#define BOOT_HASH_SIZE                           32
+
+sfud_err hash_region(const sfud_flash *flash, uint32_t addr, size_t len, uint8_t *digest);
+sfud_err hash_memory(const void *buf, size_t len, uint8_t *digest);
+bool hash_stream_start(void);
+sfud_err hash_stream_feed(const void *buf, size_t len);
+sfud_err hash_stream_finish(uint8_t *digest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_HASH_H__ */
@@ -0,0 +1,49 @@
+/**
+ * @file boot_heatshrink.h
+ * @brief Streaming decoder of the heatshrink (LZSS) compressed format.
+ *
+ * The stream is the one of `heatshrink -e -w <window_sz2> -l <lookahead_sz2>`:
+ * a 1 bit tags a literal byte, a 0 bit a back-reference of window_sz2 bits
+ * index and lookahead_sz2 bits count, all bits MSB first. Both parameters are
+ * not in the stream, the producer and the decoder must agree on them.
+ *
+ * Input and output are taken in pieces of any size, the decoder only keeps
+ * its 2^window_sz2 bytes window, so neither side needs a whole-image buffer.
+ */
+#ifndef __BOOT_HEATSHRINK_H__
+#define __BOOT_HEATSHRINK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* 4KB window at most */
+#define BOOT_HEATSHRINK_WINDOW_SZ2_MAX           12
+
+typedef struct {
+    uint8_t window_sz2;
+    uint8_t lookahead_sz2;
+    uint8_t state;
+    uint8_t in_byte;                             /**< input byte being read */
+    uint8_t in_mask;                             /**< next bit of in_byte, 0: a new byte is needed */
+    uint8_t acc_bits;                            /**< bits of the field read so far */
+    uint16_t acc;                                /**< field read so far */
+    uint16_t index;                              /**< back-reference distance */
+    uint16_t count;                              /**< back-reference bytes left */
+    uint16_t head;                               /**< window write position */
+    uint8_t window[1 << BOOT_HEATSHRINK_WINDOW_SZ2_MAX];
+} boot_heatshrink_decoder;
+
+bool boot_heatshrink_init(boot_heatshrink_decoder *dec, uint8_t window_sz2, uint8_t lookahead_sz2);
+size_t boot_heatshrink_decode(boot_heatshrink_decoder *dec, const uint8_t **in, size_t *in_len,
+                              uint8_t *out, size_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_HEATSHRINK_H__ */
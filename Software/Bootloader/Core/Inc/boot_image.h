@@ -0,0 +1,192 @@
+/**
+ * @file boot_image.h
+ * @brief Versioned header in front of every application image.
+ *
+ * An application slot starts with a BOOT_IMAGE_HEADER_SIZE bytes header area,
+ * the image (vector table first) follows it:
+ *
+ *     slot + 0x000   boot_image_header, padded with 0xFF to BOOT_IMAGE_HEADER_SIZE
+ *     slot + 0x400   image, image_size bytes, linked to run at load_addr
+ *
+ * The header area keeps the vector table 1KB aligned as SCB->VTOR requires.
+ * With BOOT_IMAGE_FLAG_SECTIONS (header version 2) the header area also
+ * holds section_num boot_image_section entries at BOOT_IMAGE_SECTION_OFFSET,
+ * the parts of the image the bootloader moves to the RAM before the jump
+ * (ISRs and hot loops into the ITCM, tables into the DTCM), see
+ * boot_scatter.h. The sections stay in the image, its CRC and hash cover
+ * them as stored.
+ *
+ * With BOOT_IMAGE_FLAG_RAM the whole image is linked to run at ram_addr, in
+ * RAM_D1 or the ITCM: the bootloader copies it there right before the jump
+ * and sets VTOR to the copy, exec_addr is inside the copy. No cache miss of
+ * the XIP is left on its timing, the application may leave the memory-mapped
+ * mode and put the flash in power-down, see boot_handoff.h. load_addr stays
+ * the memory-mapped address the image is stored at, the checks read it there.
+ *
+ * With BOOT_IMAGE_FLAG_LZ4 as well the image is stored compressed: a 32 bits
+ * little-endian decoded size, then one LZ4 block of it, see boot_lz4.h.
+ * image_size, image_crc and image_hash are those of the stored bytes. The
+ * CPU decodes the block through the XIP window straight to ram_addr while
+ * boot_scatter_prepare() runs, so the decoded range must be RAM the
+ * bootloader no longer uses (see boot_scatter.h); exec_addr is checked
+ * against the decoded size there. The RAM image gets there in less time than
+ * the OSPI takes for the raw bytes, and the slot holds fewer of them. Such an
+ * image has no section table.
+ *
+ * With BOOT_IMAGE_FLAG_VECTOR the vector_size bytes of the vector table at
+ * exec_addr are copied to vector_addr, in the ITCM or the DTCM, with the
+ * scatter list and VTOR is set to the copy: an exception entry fetches its
+ * vector zero-wait instead of through the XIP window and the cache. The
+ * application keeps the range for the table, aligned as VTOR requires (the
+ * table size rounded up to a power of 2, 128 bytes at least), and its
+ * startup doesn't move VTOR again. boot_handoff_info.vector_addr tells where
+ * it is.
+ *
+ * With BOOT_IMAGE_FLAG_SECTOR_HASH (header version 2) the image is followed
+ * by its sector table: the SHA-256 of each BOOT_IMAGE_SECTOR_SIZE sector of
+ * the image, the last one short, at boot_image_sector_table() of the slot,
+ * and sector_hash is the SHA-256 of that table. The signature and header_crc
+ * cover sector_hash, so each sector is checked on its own: after a delta or
+ * partial install the bootloader only hashes the sectors written since the
+ * last full check of the slot (see boot_verify.h), the others keep the
+ * digest it found then. image_hash and image_crc are still filled, tools
+ * and the application check them, the bootloader doesn't read the whole
+ * image of such a slot.
+ *
+ * With BOOT_IMAGE_FLAG_PIC (header version 2) the image is built
+ * position-independent (-fpic -msingle-pic-base -mpic-register=r9) and runs
+ * in place from either slot: one build, one signed header, installed to
+ * whichever slot is free. load_addr is then the address the image is
+ * linked at, not the one it's stored at; the step from one to the other is
+ * boot_image_delta(). Such an image has BOOT_IMAGE_FLAG_SECTIONS with one
+ * BOOT_IMAGE_SECTION_GOT entry and BOOT_IMAGE_FLAG_VECTOR: the bootloader
+ * copies the GOT and the vector table to their RAM addresses, moves each of
+ * their words which points into the linked image by the delta, sets r9 to
+ * the GOT copy and VTOR to the table copy. The application reaches its
+ * link-time addresses through the GOT only, its startup included (the .data
+ * initializers and the .bss bounds as GOT entries, not literal pools); a
+ * pointer to code or constants stored in initialized data is not moved. It
+ * is not encrypted, the OTFDEC keystream depends on the address, and not a
+ * RAM image, that one runs at its ram_addr anyway.
+ *
+ * A bootloader built with BOOT_SIGN_KEY (the Ed25519 public key, see
+ * CMakeLists.txt) only boots signed images: the BOOT_ED25519_SIG_SIZE bytes
+ * at BOOT_IMAGE_SIGNATURE_OFFSET of the header area are the Ed25519
+ * signature of the BOOT_IMAGE_SIGNATURE_OFFSET bytes of the header area in
+ * front of it, see boot_ed25519.h: the header with image_hash, the section
+ * table and the 0xFF padding, as the packer (Tools/image_pack.py) writes
+ * them.
+ *
+ * All CRCs are the CRC-32 of zlib/IEEE 802.3 (reflected 0x04C11DB7, initial and
+ * final XOR 0xFFFFFFFF), host tools can use zlib.crc32().
+ */
+#ifndef __BOOT_IMAGE_H__
+#define __BOOT_IMAGE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define BOOT_IMAGE_MAGIC                         0x474D4942UL /* 'BIMG' */
+#define BOOT_IMAGE_HEADER_VERSION                2
+/* oldest header still booted, version 1 has no section table */
+#define BOOT_IMAGE_HEADER_VERSION_MIN            1
+#define BOOT_IMAGE_HEADER_SIZE                   0x400UL
+
+/* the image is AES-128 encrypted for the OTFDEC, see boot_otfdec.h */
+#define BOOT_IMAGE_FLAG_ENCRYPTED                (1UL << 0)
+/* the header area holds a section table, header version 2 */
+#define BOOT_IMAGE_FLAG_SECTIONS                 (1UL << 1)
+/* the image runs from a copy at ram_addr, header version 2 */
+#define BOOT_IMAGE_FLAG_RAM                      (1UL << 2)
+/* the vector table runs from a copy at vector_addr, header version 2 */
+#define BOOT_IMAGE_FLAG_VECTOR                   (1UL << 3)
+/* a SHA-256 per image sector after the image, sector_hash is the SHA-256 of that table */
+#define BOOT_IMAGE_FLAG_SECTOR_HASH              (1UL << 4)
+/* the RAM image is stored LZ4 compressed after its decoded size, with BOOT_IMAGE_FLAG_RAM */
+#define BOOT_IMAGE_FLAG_LZ4                      (1UL << 5)
+/* position-independent, runs from either slot through its GOT copy, header version 2 */
+#define BOOT_IMAGE_FLAG_PIC                      (1UL << 6)
+
+/* decoded size ahead of the LZ4 block, and its upper bound, RAM_D1 */
+#define BOOT_IMAGE_LZ4_PREFIX_SIZE               4
+#define BOOT_IMAGE_LZ4_SIZE_MAX                  (320 * 1024UL)
+
+/* largest vector table copy, 16 system and 150 STM32H730 interrupt vectors fit */
+#define BOOT_IMAGE_VECTOR_MAX                    0x400UL
+
+/* largest GOT of a PIC image, 512 entries */
+#define BOOT_IMAGE_GOT_MAX                       0x800UL
+
+/* section table, from the start of the header area */
+#define BOOT_IMAGE_SECTION_OFFSET                0x100UL
+#define BOOT_IMAGE_SECTION_MAX                   12
+
+/* sector of the sector table, the verify sector of boot_verify.h */
+#define BOOT_IMAGE_SECTOR_SIZE                   0x10000UL
+#define BOOT_IMAGE_SECTOR_HASH_SIZE              32
+
+/* Ed25519 signature of the header area in front of it, the last 64 bytes of the header area */
+#define BOOT_IMAGE_SIGNATURE_OFFSET              0x3C0UL
+
+/* image version, 8 bits major, 8 bits minor, 16 bits patch */
+#define BOOT_IMAGE_VERSION(major, minor, patch)  (((uint32_t) (major) << 24) | ((uint32_t) (minor) << 16) | (patch))
+
+typedef enum {
+    BOOT_IMAGE_SECTION_COPY = 0,                 /**< load_size bytes copied, run_size == load_size */
+    BOOT_IMAGE_SECTION_HEATSHRINK = 1,           /**< heatshrink stream of load_size bytes decoded into run_size bytes */
+    BOOT_IMAGE_SECTION_ZERO = 2,                 /**< run_size bytes cleared, nothing stored, load_size is 0 */
+    BOOT_IMAGE_SECTION_GOT = 3,                  /**< GOT of a PIC image, copied, its image words moved */
+} boot_image_section_type;
+
+typedef struct {
+    uint32_t load_offset;                        /**< from the image start, 4 bytes aligned */
+    uint32_t load_size;                          /**< bytes stored in the image */
+    uint32_t run_addr;                           /**< in the ITCM, the DTCM or RAM_D1, 4 bytes aligned */
+    uint32_t run_size;                           /**< bytes at run_addr, a multiple of 4 */
+    uint8_t type;                                /**< boot_image_section_type */
+    uint8_t window_sz2;                          /**< heatshrink parameters of a compressed section, else 0 */
+    uint8_t lookahead_sz2;
+    uint8_t reserved;                            /**< 0 */
+} boot_image_section;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_IMAGE_MAGIC */
+    uint16_t header_version;                     /**< BOOT_IMAGE_HEADER_VERSION */
+    uint16_t header_size;                        /**< offset of the image from the header, BOOT_IMAGE_HEADER_SIZE */
+    uint32_t image_version;                      /**< BOOT_IMAGE_VERSION() */
+    uint32_t image_size;                         /**< bytes of the image after the header area */
+    uint32_t load_addr;                          /**< memory-mapped address of the image, the link one if PIC */
+    uint32_t exec_addr;                          /**< vector table, inside the loaded image or its RAM copy */
+    uint32_t flags;                              /**< BOOT_IMAGE_FLAG_xxx, 0: plain XIP image */
+    uint32_t image_crc;                          /**< CRC-32 of the image_size bytes of the image, as stored */
+    uint8_t image_hash[32];                      /**< SHA-256 of the image, as stored */
+    uint32_t otfdec_nonce[2];                    /**< OTFDEC nonce of an encrypted image, [0] is NONCER0 */
+    uint16_t otfdec_version;                     /**< OTFDEC region version of an encrypted image */
+    uint16_t section_num;                        /**< entries of the section table, with BOOT_IMAGE_FLAG_SECTIONS */
+    uint32_t section_crc;                        /**< CRC-32 of the section_num entries */
+    uint32_t ram_addr;                           /**< where the image runs from, with BOOT_IMAGE_FLAG_RAM */
+    uint32_t vector_addr;                        /**< VTOR of the application, with BOOT_IMAGE_FLAG_VECTOR */
+    uint32_t vector_size;                        /**< bytes of the vector table, with BOOT_IMAGE_FLAG_VECTOR */
+    uint8_t sector_hash[32];                     /**< SHA-256 of the sector table, else 0xFF */
+    uint32_t header_crc;                         /**< CRC-32 of all the fields above */
+} boot_image_header;
+
+uint32_t boot_image_crc32(uint32_t crc, const void *buf, size_t size);
+void boot_image_header_seal(boot_image_header *header);
+bool boot_image_header_check(const boot_image_header *header, uint32_t slot_mapped_addr, uint32_t slot_size);
+uint32_t boot_image_delta(const boot_image_header *header, uint32_t slot_mapped_addr);
+uint32_t boot_image_vector(const boot_image_header *header, uint32_t slot_mapped_addr);
+uint32_t boot_image_vtor(const boot_image_header *header);
+uint32_t boot_image_sector_count(const boot_image_header *header);
+uint32_t boot_image_sector_table(const boot_image_header *header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_IMAGE_H__ */
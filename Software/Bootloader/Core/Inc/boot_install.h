@@ -0,0 +1,92 @@
+/**
+ * @file boot_install.h
+ * @brief Install engine, copies a staged image from one flash to another.
+ *
+ * The copy runs in blocks through two buffers. While a block is page
+ * programmed into the destination, and its sectors are erased, the next
+ * block is read from the source in the background (sfud_read_async()). The
+ * two flashes sit on their own buses with their own locks, DMA channels and
+ * async state, so neither bus waits for the other one. The destination side
+ * is staged into two more buffers and erased and programmed in the
+ * background as well (sfud_erase_async(), sfud_write_async()), the CPU only
+ * waits when both staging buffers are full, so an install takes about the
+ * time of the slower flash. Source and destination on the same flash
+ * program synchronously.
+ *
+ * boot_install_heatshrink() takes a heatshrink compressed range instead, the
+ * blocks are decoded straight into a page buffer which is handed over page by
+ * page, the decoding also overlaps the read of the next block.
+ *
+ * boot_install_delta() rebuilds a slot from the other slot and a bsdiff style
+ * patch. After the boot_delta_header the patch body, heatshrink compressed or
+ * not, is a sequence of
+ *
+ *     u32 diff_len, u32 extra_len, s32 seek     little-endian
+ *     diff_len bytes     new = old + diff, byte by byte, from the old position
+ *     extra_len bytes    copied as they are
+ *
+ * the old position moves by diff_len, then by seek. It goes on till new_size
+ * bytes are written. Old and new cover the whole slot, header area included.
+ * The MAIN flash is in indirect mode meanwhile, so the old slot is read by
+ * qspi_read(), not through the XIP window.
+ *
+ * With boot_install_skip_unchanged() every destination sector is compared
+ * with the new data first, matching sectors are neither erased nor
+ * programmed, so re-installing a mostly identical image costs the changed
+ * sectors only. Every destination erase is reported to boot_verify_dirty()
+ * before it starts, the sectors skipped stay clean for the next check of an
+ * image with a sector table, see boot_verify.h.
+ *
+ * With boot_install_decrypt() boot_install() takes an AES-CTR encrypted
+ * source, boot_cryp.h: each block is decrypted in place by the CRYP DMA
+ * while the next one is read over SPI2, before it's handed to the
+ * destination.
+ */
+#ifndef __BOOT_INSTALL_H__
+#define __BOOT_INSTALL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sfud.h>
+
+/* block of the copy, a multiple of the page and of the cache line */
+#define BOOT_INSTALL_BLOCK_SIZE                  (16 * 1024)
+
+#define BOOT_DELTA_MAGIC                         0x544C4442UL /* 'BDLT' */
+
+typedef enum {
+    BOOT_DELTA_COMPRESSION_NONE = 0,
+    BOOT_DELTA_COMPRESSION_HEATSHRINK = 1,
+} boot_delta_compression;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_DELTA_MAGIC */
+    uint8_t compression;                         /**< boot_delta_compression of the body */
+    uint8_t window_sz2;                          /**< heatshrink window size, log2 */
+    uint8_t lookahead_sz2;                       /**< heatshrink lookahead size, log2 */
+    uint8_t reserved;
+    uint32_t old_image_crc;                      /**< image_crc of the image the patch applies to */
+    uint32_t old_size;                           /**< bytes of the old slot the patch may read */
+    uint32_t new_size;                           /**< bytes of the new slot */
+    uint32_t header_crc;                         /**< CRC-32 of all the fields above */
+} boot_delta_header;
+
+void boot_install_skip_unchanged(bool enable);
+void boot_install_decrypt(const uint32_t *nonce);
+sfud_err boot_install(const sfud_flash *src, uint32_t src_addr, const sfud_flash *dst, uint32_t dst_addr, size_t size);
+sfud_err boot_install_heatshrink(const sfud_flash *src, uint32_t src_addr, size_t src_size,
+                                 const sfud_flash *dst, uint32_t dst_addr, size_t dst_size,
+                                 uint8_t window_sz2, uint8_t lookahead_sz2);
+sfud_err boot_install_delta(const sfud_flash *patch_flash, uint32_t patch_addr, size_t patch_size,
+                            const sfud_flash *flash, uint32_t old_addr, uint32_t new_addr, size_t new_max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_INSTALL_H__ */
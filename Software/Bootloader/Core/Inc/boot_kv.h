@@ -0,0 +1,85 @@
+/**
+ * @file boot_kv.h
+ * @brief Log-structured key-value store on the EXT flash.
+ *
+ * Slot metadata, boot counters, calibration results and the configuration of
+ * the application go to BOOT_KV_SECTOR_NUM sectors at BOOT_KV_ADDR, used as
+ * a ring like the log area of elog_flash.h. A sector starts with a header
+ * (magic, sequence number), then come the records back to back, 4-byte
+ * aligned: an update or a delete appends one record, no sector is erased or
+ * rewritten for it.
+ *
+ *     magic  key_len  value_len  crc  key  value  (0xFF padding)
+ *
+ * boot_kv_mount() builds a RAM hash index from key to the newest record. It
+ * reads the sector headers and the header and key of each record only, the
+ * value and CRC are checked in the head sector, the one a reset may have
+ * cut a record of, and by each boot_kv_get().
+ *
+ * Compaction keeps BOOT_KV_FREE_SECTORS sectors free: boot_kv_poll() moves
+ * up to BOOT_KV_COMPACT_STEP records the index still points to from the
+ * oldest sector to the head, drops the rest and the deletes, then erases
+ * the sector in the background. A boot_kv_set() only waits for it when the
+ * head is full and the free ones are used up.
+ *
+ * @note The store shares the EXT flash with the elog sink, it calls
+ *       elog_flash_flush() before using the flash. Like the sink it owns the
+ *       flash while its erase runs, call boot_kv_flush() before anything else
+ *       uses it. The records of a boot_kv_set() may wait in the write buffer
+ *       of SFUD, boot_kv_flush() programs them too.
+ */
+#ifndef __BOOT_KV_H__
+#define __BOOT_KV_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sfud.h>
+
+/* EXT flash sectors at the start, the log area is at its end */
+#define BOOT_KV_ADDR                             0x000000UL
+#define BOOT_KV_SECTOR_SIZE                      0x1000UL
+#define BOOT_KV_SECTOR_NUM                       16
+#define BOOT_KV_SECTOR_MAGIC                     0x53564B42UL /* 'BKVS' */
+#define BOOT_KV_ENTRY_MAGIC                      0xA5
+
+#define BOOT_KV_KEY_MAX                          31
+#define BOOT_KV_VALUE_MAX                        1024
+/* records of the RAM index, a power of 2, a quarter of it stays empty for short probes */
+#define BOOT_KV_INDEX_SIZE                       128
+#define BOOT_KV_KEY_NUM                          (BOOT_KV_INDEX_SIZE * 3 / 4)
+/* live bytes the compaction can always pack: the sectors less the head, the free ones and a spare, each one
+   less its header and the padding of the longest record at its end */
+#define BOOT_KV_CAPACITY                         ((BOOT_KV_SECTOR_NUM - BOOT_KV_FREE_SECTORS - 2) \
+                                                  * (BOOT_KV_SECTOR_SIZE - 16 - BOOT_KV_KEY_MAX - BOOT_KV_VALUE_MAX))
+
+/* compaction runs while fewer sectors are free */
+#define BOOT_KV_FREE_SECTORS                     2
+/* records moved by a boot_kv_poll() */
+#define BOOT_KV_COMPACT_STEP                     8
+
+/* boot_kv_entry.value_len of a delete */
+#define BOOT_KV_DELETED                          0xFFFF
+
+typedef struct {
+    uint8_t magic;                               /**< BOOT_KV_ENTRY_MAGIC, 0xFF: erased, the end of the sector */
+    uint8_t key_len;                             /**< 1~BOOT_KV_KEY_MAX, no terminating 0 */
+    uint16_t value_len;                          /**< 0~BOOT_KV_VALUE_MAX or BOOT_KV_DELETED */
+    uint32_t crc;                                /**< CRC-32 of the 4 bytes above, the key and the value */
+} boot_kv_entry;
+
+sfud_err boot_kv_mount(const sfud_flash *flash);
+sfud_err boot_kv_get(const char *key, void *value, size_t size, size_t *len);
+sfud_err boot_kv_set(const char *key, const void *value, size_t len);
+sfud_err boot_kv_delete(const char *key);
+void boot_kv_poll(void);
+void boot_kv_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_KV_H__ */
@@ -0,0 +1,72 @@
+/**
+ * @file boot_lfs.h
+ * @brief littlefs block device over the SFUD flashes.
+ *
+ * boot_lfs_config() fills a struct lfs_config for a block aligned area of a
+ * SFUD flash: a block is the erase granule of the part (chip.erase_gran), the
+ * read and the program caches are one page (SFUD_WRITE_MAX_PAGE_SIZE) and the
+ * lookahead buffer is in the DTCM. littlefs packs small files into the
+ * metadata blocks and programs BOOT_LFS_PROG_SIZE units, the ESP32 blobs, the
+ * certificates and the assets then take no erase per small write.
+ *
+ * boot_lfs_mount() mounts the file system of the EXT flash between the
+ * rollback copy and the bench area before the log area, see boot_rollback.h
+ * and boot_bench.h. It formats the area when no file system is found.
+ *
+ * boot_lfs_poll() erases the free blocks ahead of need, one block in the
+ * background per call: the blocks no file or directory takes, from
+ * lfs_fs_traverse() after the file system has changed, which don't read
+ * back as erased. The erase callback skips a block erased that way, so a
+ * file written later programs at once. The bitmaps are in RAM, a reset
+ * loses them and the next pass reads the blocks back instead of erasing
+ * them again.
+ *
+ * littlefs itself is not part of this tree: the block device builds with
+ * BOOT_LFS defined and lfs.h on the include path, with the littlefs sources
+ * added to the target.
+ *
+ * @note The caches and the lookahead buffer are static, one file system at a
+ *       time. The callbacks call elog_flash_flush() and boot_kv_flush() before
+ *       using the flash, like the key-value store does. The flash is owned
+ *       by the block device while its erase runs in the background, call
+ *       boot_lfs_flush() before anything else uses it.
+ */
+#ifndef __BOOT_LFS_H__
+#define __BOOT_LFS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef BOOT_LFS
+
+#include <stdint.h>
+#include <sfud.h>
+#include <lfs.h>
+#include "boot_rollback.h"
+
+/* EXT flash after the rollback copy */
+#define BOOT_LFS_ADDR                            BOOT_ROLLBACK_END
+/* smallest read and program, NOR parts program any byte count */
+#define BOOT_LFS_READ_SIZE                       16
+#define BOOT_LFS_PROG_SIZE                       16
+#define BOOT_LFS_CACHE_SIZE                      SFUD_WRITE_MAX_PAGE_SIZE
+/* one bit per block, 2048 blocks of 4KB cover 8MB */
+#define BOOT_LFS_LOOKAHEAD_SIZE                  256
+/* erases of a metadata block before littlefs moves it */
+#define BOOT_LFS_BLOCK_CYCLES                    500
+/* blocks the pre-erase tracks, littlefs erases the ones after them when it takes them */
+#define BOOT_LFS_PRE_ERASE_BLOCKS                (BOOT_LFS_LOOKAHEAD_SIZE * 8)
+
+int boot_lfs_config(struct lfs_config *cfg, const sfud_flash *flash, uint32_t addr, uint32_t size);
+int boot_lfs_mount(lfs_t *lfs, struct lfs_config *cfg);
+void boot_lfs_poll(lfs_t *lfs);
+void boot_lfs_flush(void);
+
+#endif /* BOOT_LFS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_LFS_H__ */
@@ -0,0 +1,64 @@
+/**
+ * @file boot_log.h
+ * @brief Copy of the elog output in a no-init RAM_D3 ring, kept over warm resets.
+ *
+ * The elog port appends every line it outputs, see ELOG_PORT_BOOT_LOG_ENABLE in
+ * elog_cfg.h; with ELOG_PORT_UART_ENABLE off the ring is the only output. The
+ * record lives at BOOT_LOG_ADDR, after the boot profile. A warm reset keeps it,
+ * a power-on or a record from another layout starts it over.
+ *
+ * write and read count bytes since the record was created, the data is at
+ * write % BOOT_LOG_SIZE. The bootloader moves read up when it overwrites
+ * unread data and counts the bytes in lost. The application takes the unread
+ * part and moves read itself:
+ *
+ *     boot_log *log = (boot_log *) BOOT_LOG_ADDR;
+ *     if (log->magic == BOOT_LOG_MAGIC && log->version == BOOT_LOG_VERSION) {
+ *         while (log->read != log->write) {
+ *             // send log->data[log->read % BOOT_LOG_SIZE], e.g. over ESP-Hosted
+ *             log->read++;
+ *         }
+ *     }
+ *
+ * @note the bootloader cleans every write out of the D-cache, RAM_D3 is
+ *       non-cacheable for the application, see boot_handoff.h
+ */
+#ifndef __BOOT_LOG_H__
+#define __BOOT_LOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BOOT_LOG_ADDR                            0x38000100UL
+#define BOOT_LOG_MAGIC                           0x4C544F42UL /* 'BOTL' */
+#define BOOT_LOG_VERSION                         1
+/* a power of two */
+#define BOOT_LOG_SIZE                            4096
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_LOG_MAGIC when the record is valid */
+    uint16_t version;                            /**< BOOT_LOG_VERSION */
+    uint16_t reserved;                           /**< 0 */
+    uint32_t size;                               /**< BOOT_LOG_SIZE */
+    uint32_t boots;                              /**< bootloader runs since the record was created */
+    uint32_t write;                              /**< bytes written */
+    uint32_t read;                               /**< bytes taken by the application */
+    uint32_t lost;                               /**< bytes overwritten before they were read */
+    uint32_t reserved2;                          /**< 0 */
+    char data[BOOT_LOG_SIZE];                    /**< the ring */
+} boot_log;
+
+extern boot_log boot_log_record;
+
+void boot_log_init(void);
+void boot_log_write(const char *log, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_LOG_H__ */
@@ -0,0 +1,35 @@
+/**
+ * @file boot_lz4.h
+ * @brief Decoder of the LZ4 block format, whole block in, whole output out.
+ *
+ * The block is the one of LZ4_compress_default() or LZ4_compress_HC() of
+ * lz4.h (python: lz4.block.compress(data, store_size=False)): sequences of
+ * a token (4 bits literal count, 4 bits match length - 4), the literals, a
+ * 16 bits little-endian match offset and the length extensions, the last
+ * sequence is literals only. Neither the decoded size nor a checksum is in
+ * the block, BOOT_IMAGE_FLAG_LZ4 of boot_image.h stores the size ahead of
+ * it, the image CRC and hash cover both.
+ *
+ * Input and output are both addressable at once (the XIP window, the RAM),
+ * the decoder needs no window of its own and no state between calls. Every
+ * offset and length is checked against both buffers, a corrupt block can't
+ * read or write out of them.
+ */
+#ifndef __BOOT_LZ4_H__
+#define __BOOT_LZ4_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+bool boot_lz4_decode(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_LZ4_H__ */
@@ -0,0 +1,54 @@
+/**
+ * @file boot_mem.h
+ * @brief Memory copy and fill by the MDMA in the background, a task of boot_sched.h is posted at the end.
+ *
+ * A bulk copy (from the XIP window of the MAIN flash, between the SRAMs) or
+ * fill runs on MDMA channel 3 while the CPU hashes, decodes or serves the
+ * other tasks:
+ *
+ *     boot_mem_copy(dst, src, len, task)     starts the copy, no overlap
+ *     boot_mem_fill(dst, value, len, task)   starts the fill with a byte
+ *     boot_mem_busy()                        true: still running
+ *     boot_mem_wait()                        waits for the end, WFI
+ *
+ * One transfer runs at a time, a new one waits for the one before. At its
+ * end task (NULL: none) is posted from the MDMA interrupt, a copy of less
+ * than BOOT_MEM_DMA_MIN bytes is done by the CPU at once and task posted
+ * right away. The MDMA blocks are 64KB at most, the interrupt chains them.
+ *
+ * The D-Cache is taken care of: the source lines are written back, the
+ * destination lines dropped before and after the transfer. The MDMA only
+ * writes whole lines of dst, the bytes before its first line boundary and
+ * after its last one are copied by the CPU at the start. The TCMs are
+ * reached over the AHBS, the OCTOSPI1 window must be memory-mapped for the
+ * whole transfer.
+ *
+ * @note DMA2D would do the same work over the AXI bus only, without the
+ *       TCMs, the MDMA covers all the RAM and the flash window.
+ */
+#ifndef __BOOT_MEM_H__
+#define __BOOT_MEM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "boot_sched.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* below it the CPU copies, the MDMA setup and the cache upkeep cost more */
+#define BOOT_MEM_DMA_MIN                         1024
+
+void boot_mem_copy(void *dst, const void *src, size_t len, boot_task *task);
+void boot_mem_fill(void *dst, uint8_t value, size_t len, boot_task *task);
+bool boot_mem_busy(void);
+bool boot_mem_wait(void);
+void boot_mem_irq_handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_MEM_H__ */
@@ -0,0 +1,76 @@
+/**
+ * @file boot_netlog.h
+ * @brief Copy of the elog output to the ESP32-C3 over the ESP-Hosted link, for UDP syslog or MQTT.
+ *
+ * The elog port hands every output to boot_netlog_write(), see
+ * ELOG_PORT_ESP_ENABLE in elog_cfg.h. While the link of esp_spi.h is up
+ * (boot_netlog_start() to boot_netlog_stop()) the lines are batched into the
+ * TX frames of esp_spi.h, blocks of dma_pool.h the transport sends as they
+ * are: no copy besides the one from the elog output. The frame uses the
+ * serial interface number BOOT_NETLOG_IF_NUM, its payload is a
+ * boot_netlog_msg and the text of whole lines after it; the ESP32 firmware
+ * forwards them as it is set up to.
+ *
+ * One frame is open at a time. It goes out at the end of a line as soon as
+ * no frame waits in the TX queue, so an idle link carries each line at once
+ * and a busy one many lines per transaction. While the queue is backed up
+ * the open frame fills and the lines are dropped by their level, the first
+ * letter of the elog prefix, colour sequence skipped:
+ *
+ *     debug, verbose    up to BOOT_NETLOG_LOW_FILL bytes of the frame
+ *     info              up to BOOT_NETLOG_INFO_FILL bytes
+ *     assert to warn    up to the end of the frame
+ *
+ * A line that doesn't fit the rest of the frame goes on in the next one,
+ * taken only with the queue empty and BOOT_NETLOG_POOL_RESERVE blocks left
+ * in the pool for the RX side. The lines dropped are counted in the next
+ * frame sent. Nothing waits on the link, the cost of a line is its copy.
+ *
+ * @note The elog output lock is held, or it's the DMA interrupt of elog_port.c.
+ *       Text output only, a binary output line (ELOG_BIN_OUTPUT_ENABLE) is
+ *       taken as info.
+ */
+#ifndef __BOOT_NETLOG_H__
+#define __BOOT_NETLOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_spi.h"
+
+#define BOOT_NETLOG_IF_NUM                       0x0E
+#define BOOT_NETLOG_MSG_MAGIC                    0x474F4C42UL /* 'BLOG' */
+/* text bytes of a frame */
+#define BOOT_NETLOG_TEXT_SIZE                    (ESP_SPI_FRAME_SIZE - sizeof(esp_spi_header) - sizeof(boot_netlog_msg))
+#define BOOT_NETLOG_LOW_FILL                     (BOOT_NETLOG_TEXT_SIZE / 2)
+#define BOOT_NETLOG_INFO_FILL                    (BOOT_NETLOG_TEXT_SIZE * 3 / 4)
+/* free pool blocks below which no frame is taken */
+#define BOOT_NETLOG_POOL_RESERVE                 4
+/* boot_netlog_stop() waits that long for the last frame to go */
+#define BOOT_NETLOG_STOP_TIMEOUT_MS              10
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_NETLOG_MSG_MAGIC */
+    uint32_t dropped;                            /**< lines dropped since the frame before */
+} boot_netlog_msg;
+
+typedef struct {
+    uint32_t frames;                             /**< frames queued */
+    uint32_t lines;                              /**< lines sent */
+    uint32_t dropped;                            /**< lines dropped */
+} boot_netlog_stats;
+
+void boot_netlog_start(void);
+void boot_netlog_stop(void);
+void boot_netlog_write(const char *log, size_t size);
+void boot_netlog_flush(void);
+void boot_netlog_get_stats(boot_netlog_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_NETLOG_H__ */
@@ -0,0 +1,90 @@
+/**
+ * @file boot_ospi_cal.h
+ * @brief OCTOSPI1 read timing calibration of the MAIN flash.
+ *
+ * MX_OCTOSPI1_Init() and boot_clock_retime() run the flash at a safe
+ * BOOT_CLOCK_OSPI_MAX_HZ, half-cycle sample shift and no delay block. The
+ * calibration searches the fastest point the board really reads right:
+ *
+ *     prescaler      from the kernel clock / BOOT_OSPI_CAL_MAX_HZ up to the
+ *                    default one, see boot_clock_ospi_hz()
+ *     sampling       half-cycle shift or none, for the STR reads
+ *     delay block    bypassed, or each output clock phase of DLYB_OCTOSPI1
+ *                    with its unit sized to one clock period
+ *
+ * Each point reads BOOT_OSPI_CAL_PATTERN_SIZE bytes of a known pattern in the
+ * reserved sector at BOOT_OSPI_CAL_ADDR BOOT_OSPI_CAL_PASSES times, by the
+ * indirect read command in force and through the memory-mapped window. The
+ * fastest prescaler with a stable point wins: the middle of a run of at
+ * least 2 * BOOT_OSPI_CAL_MARGIN + 1 good delay block phases, else the
+ * bypassed delay block when both sample shifts read right, the default
+ * shift is taken then.
+ *
+ * The dummy cycles are not swept: in the SPI modes the Winbond and the SFDP
+ * parts fix them per command, another count only moves the data.
+ *
+ * The result record follows the pattern in the sector, keyed by the JEDEC
+ * ID, the OCTOSPI1 kernel clock and the read instruction. boot_ospi_cal_apply() sets it at each
+ * boot after a read of the pattern, it calibrates again when the record is
+ * missing or out of date, or that read fails. The delay block registers go
+ * to boot_handoff_ospi, so the direct boot and the application keep them.
+ *
+ * The sector is only erased and programmed once a slot record or a valid
+ * slot header shows the flash in the layout of boot_slot.h. An image of the
+ * pre-slot layout runs from the flash start and may have code at
+ * BOOT_OSPI_CAL_ADDR, the flash stays at the default timing for it.
+ */
+#ifndef __BOOT_OSPI_CAL_H__
+#define __BOOT_OSPI_CAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sfud.h>
+
+/* MAIN flash sector between the slot records and slot A */
+#define BOOT_OSPI_CAL_ADDR                       0x008000UL
+#define BOOT_OSPI_CAL_SECTOR_SIZE                0x1000UL
+#define BOOT_OSPI_CAL_PATTERN_SIZE               0x800UL
+#define BOOT_OSPI_CAL_RECORD_ADDR                (BOOT_OSPI_CAL_ADDR + BOOT_OSPI_CAL_PATTERN_SIZE)
+#define BOOT_OSPI_CAL_MAGIC                      0x4C414342UL /* 'BCAL' */
+#define BOOT_OSPI_CAL_VERSION                    1
+
+/* fastest clock tried, the rating of the Winbond quad parts */
+#define BOOT_OSPI_CAL_MAX_HZ                     133000000UL
+#define BOOT_OSPI_CAL_PASSES                     4
+/* good delay block phases kept on each side of the one taken */
+#define BOOT_OSPI_CAL_MARGIN                     1
+
+typedef struct {
+    uint8_t prescaler;                           /**< DCR2 PRESCALER + 1 */
+    uint8_t sample_shift;                        /**< 1: half a cycle (STR) */
+    uint8_t dlyb;                                /**< 1: sampled by the delay block, 0: bypassed */
+    uint8_t dlyb_sel;                            /**< DLYB CFGR SEL, the output clock phase */
+    uint8_t dlyb_unit;                           /**< DLYB CFGR UNIT, one clock period in SEL_MAX phases */
+    uint8_t dlyb_window;                         /**< good phases around dlyb_sel */
+    uint8_t reserved[2];                         /**< 0 */
+} boot_ospi_cal_point;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_OSPI_CAL_MAGIC when the record is valid */
+    uint16_t version;                            /**< BOOT_OSPI_CAL_VERSION */
+    uint16_t size;                               /**< sizeof(boot_ospi_cal_record) */
+    uint32_t kernel_hz;                          /**< OCTOSPI1 kernel clock of the calibration */
+    uint8_t jedec_id[3];                         /**< manufacturer, memory type, capacity */
+    uint8_t read_instruction;                    /**< read command of the calibration */
+    boot_ospi_cal_point point;                   /**< the timing taken */
+    uint32_t crc;                                /**< CRC-32 of all the fields above */
+} boot_ospi_cal_record;
+
+bool boot_ospi_cal_apply(sfud_flash *flash);
+bool boot_ospi_cal_run(sfud_flash *flash, boot_ospi_cal_point *point);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_OSPI_CAL_H__ */
@@ -0,0 +1,89 @@
+/**
+ * @file boot_ospi_chain.h
+ * @brief Page programs of the MAIN flash run by an MDMA linked list on the OCTOSPI1 registers, one interrupt a chain.
+ *
+ * A page program is four commands: WREN, the page program with its data,
+ * the status reads until BUSY clears. Issued by the CPU each one is a few
+ * register writes and a wait, the gaps between them are the CPU's. The
+ * chain runs them from a list of MDMA nodes instead, up to
+ * BOOT_OSPI_CHAIN_PAGES pages a list, each node one register write driven
+ * by a request of the OCTOSPI1:
+ *
+ *     FIFO_TH   set in indirect write mode while the FIFO has room, so the
+ *               node runs at once: the register writes of a command, and
+ *               the data, BOOT_OSPI_CHAIN_BEAT bytes a request
+ *     TC        the command before is over: WREN done, the page sent, the
+ *               automatic-polling matched (BUSY clear, stopped by APMS)
+ *
+ * The post-request mask write of a node, made to clear the flag of its
+ * request, is a second register write for free: the TC nodes clear TCF
+ * with it, the others write IR behind the CCR or CR of their block, which
+ * starts the command. TCF is only cleared by a node which starts nothing,
+ * so the TC of the next command can't be lost. Per page:
+ *
+ *     FIFO_TH   CCR  WREN           mask  IR = WREN, runs
+ *     TC        CCR  page program   mask  FCR = CTCF
+ *     FIFO_TH   DLR  page - 1       mask  IR = PP, waits for AR
+ *     FIFO_TH   AR   page address   runs
+ *     FIFO_TH   DR   page data, in beats
+ *     TC        CCR  status read    mask  FCR = CTCF
+ *     FIFO_TH   DLR  0
+ *     FIFO_TH   CR   auto-polling   mask  IR = RDSR, runs
+ *     TC        CR   indirect write mask  FCR = CTCF | CSMF
+ *
+ * TCR, PSMKR, PSMAR and PIR are the same for all the commands, the CPU sets
+ * them before the start. The list is built once, a chain only patches the
+ * addresses and lengths of its pages and ends the list after its last. The
+ * CPU sleeps to the channel transfer complete interrupt of the MDMA.
+ *
+ * The data is read by the MDMA: word aligned, in a RAM it reaches (the
+ * D-Cache lines are written back) or the internal flash, whole words. A
+ * chain which doesn't end in time is aborted, the MDMA channel and the
+ * OCTOSPI1 both, SFUD_ERR_TIMEOUT tells the caller to program the pages
+ * again by the CPU: a page programmed twice with the same data is the same.
+ *
+ * @note The TC after the automatic-polling is the TCF the automatic stop
+ *       sets with SMF. A part whose chain times out this way keeps the CPU
+ *       path, see boot_part.cpp.
+ */
+#ifndef __BOOT_OSPI_CHAIN_H__
+#define __BOOT_OSPI_CHAIN_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sfud.h>
+
+/* pages of one list, a 4KB sector of 256 byte pages */
+#define BOOT_OSPI_CHAIN_PAGES                    16
+/* bytes of a FIFO_TH request, CR FTHRES + 1 */
+#define BOOT_OSPI_CHAIN_BEAT                     16
+/* largest page, the block length of a data node */
+#define BOOT_OSPI_CHAIN_PAGE_MAX                 256
+
+/* the commands of a part, as their OCTOSPI register images */
+typedef struct {
+    uint32_t cr;                                 /**< CR of the indirect write: FTHRES of the beat, FMODE 0 */
+    uint32_t tcr;                                /**< TCR of all the commands, no dummy cycles */
+    uint32_t ccr_cmd;                            /**< CCR of WREN, instruction only */
+    uint32_t ccr_program;                        /**< CCR of the page program */
+    uint32_t ccr_status;                         /**< CCR of the status read, one data byte */
+    uint8_t program_cmd;                         /**< page program instruction */
+    uint32_t page_size;                          /**< page, BOOT_OSPI_CHAIN_PAGE_MAX at most */
+} boot_ospi_chain_desc;
+
+bool boot_ospi_chain_fits(const boot_ospi_chain_desc *desc, uint32_t addr, size_t size, const uint8_t *data);
+sfud_err boot_ospi_chain_program(OCTOSPI_TypeDef *ospi, const boot_ospi_chain_desc *desc, uint32_t addr,
+                                 size_t size, const uint8_t *data, uint32_t timeout_ms);
+void boot_ospi_chain_irq_handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_OSPI_CHAIN_H__ */
@@ -0,0 +1,48 @@
+/**
+ * @file boot_otfdec.h
+ * @brief On-the-fly decryption of encrypted XIP images by OTFDEC1.
+ *
+ * An image flagged BOOT_IMAGE_FLAG_ENCRYPTED is stored AES-128-CTR encrypted
+ * the way OTFDEC1 expects it: the keystream depends on the AHB address, the
+ * nonce and the version of the region, the last two come from its header.
+ * The region covers the whole slot from its start, 4KB granularity, so the
+ * packer encrypts the image at its XIP addresses and leaves the header in
+ * plain text. image_crc and image_hash cover the encrypted image, they are
+ * checked before the region is enabled.
+ *
+ * The key is provisioned once into the last flash word of the internal flash
+ * (BOOT_OTFDEC_KEY_ADDR, kept free by the linker script), either by the
+ * production programmer or by boot_otfdec_key_provision(). RDP level 1 or
+ * higher is needed to keep it secret. The region and key registers are locked
+ * until the next reset before the application starts.
+ */
+#ifndef __BOOT_OTFDEC_H__
+#define __BOOT_OTFDEC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "boot_image.h"
+
+#define BOOT_OTFDEC_KEY_ADDR                     0x0801FFE0UL
+#define BOOT_OTFDEC_KEY_MAGIC                    0x59454B4FUL /* 'OKEY' */
+
+/* one 256 bits flash word, programmed once */
+typedef struct {
+    uint32_t key[4];                             /**< AES-128 key, [0] is KEYR0 */
+    uint32_t magic;                              /**< BOOT_OTFDEC_KEY_MAGIC */
+    uint32_t key_crc;                            /**< KEYCRC the OTFDEC computes for the key */
+    uint32_t reserved[2];                        /**< 0xFFFFFFFF */
+} boot_otfdec_key_record;
+
+bool boot_otfdec_key_provision(const uint32_t key[4]);
+bool boot_otfdec_enable(const boot_image_header *header, uint32_t slot_mapped_addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_OTFDEC_H__ */
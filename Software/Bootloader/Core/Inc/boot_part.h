@@ -0,0 +1,42 @@
+/**
+ * @file boot_part.h
+ * @brief Driver of the board's MAIN flash part made at compile time, SFUD serves the other parts.
+ *
+ * The production boards carry one known part on OCTOSPI1. boot_part.cpp
+ * instantiates the template of boot_part.hpp for its descriptor: every
+ * OCTOSPI register image of its commands is a constant, the reads, page
+ * programs, erases and busy polls run inline on the registers, with no
+ * command assembly, SFDP lookup or bus function pointer on the way.
+ *
+ * boot_part_attach() checks the JEDEC ID and the state SFUD has put the part
+ * in (quad enabled by the fast read setup, 3-Byte addressing, STR), then
+ * hooks the driver in flash->part: sfud_read(), sfud_write() and sfud_erase()
+ * hand their work to it (SFUD_USING_PART_DRIVER). Another part, or the
+ * memory-mapped mode, keeps the generic SFUD paths. sfud_device_init()
+ * drops the driver, the attach comes after it.
+ *
+ * boot_part_svc_read(), boot_part_svc_write() and boot_part_svc_erase() are
+ * the flash services of boot_svc.h, run by the application: they know the
+ * part from the handoff record and keep no state in RAM.
+ */
+#ifndef __BOOT_PART_H__
+#define __BOOT_PART_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <sfud.h>
+
+bool boot_part_attach(sfud_flash *flash);
+sfud_err boot_part_svc_read(uint32_t addr, size_t size, uint8_t *data);
+sfud_err boot_part_svc_write(uint32_t addr, size_t size, const uint8_t *data);
+sfud_err boot_part_svc_erase(uint32_t addr, size_t size);
+void boot_part_svc_xip_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_PART_H__ */
@@ -0,0 +1,379 @@
+/**
+ * @file boot_part.hpp
+ * @brief OCTOSPI driver of one flash part, made at compile time from its descriptor, see boot_part.h.
+ *
+ * A boot_part_desc holds all a driver needs to know of a part, as constants:
+ * the JEDEC ID, the capacity, the opcodes and line widths of the read and
+ * the page program, the mode bits and dummy cycles of the read, the page
+ * size, the erase commands with their units and the maximum busy times.
+ * boot_part_driver<desc, base> turns it into the CCR images of each command,
+ * the erase plan into a walk over a constant table, so a read is a few
+ * register writes and a FIFO loop, with no switch, lookup or indirect call:
+ *
+ *     read     one indirect read of the whole range, 16 bytes per FIFO
+ *              threshold, words out of the FIFO
+ *     write    per page: WREN, WEL polled, the page program, BUSY polled
+ *     erase    the units covering the range, the largest aligned one at
+ *              each step, like sfud_erase_plan()
+ *
+ * The status polls are the OCTOSPI auto-polling with automatic stop, the
+ * timeout is twice the maximum time of the descriptor. The commands keep
+ * the sampling of the TCR in force (STR, boot_ospi_cal.h) and put the CR
+ * back at the end, so SFUD and the port find the OCTOSPI as they left it.
+ * The driver takes the indirect mode only, ready() hands the memory-mapped
+ * mode back to SFUD, which pauses the XIP for its commands.
+ *
+ * The timeouts count on the Clock of the template, HAL_GetTick() by
+ * default; the services of boot_svc.h, called by the application, keep
+ * time on the DWT cycle counter instead.
+ */
+#ifndef __BOOT_PART_HPP__
+#define __BOOT_PART_HPP__
+
+#include "main.h"
+#include <sfud.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define BOOT_PART_ERASER_MAX_NUM                 3
+/* FIFO threshold of the reads and the programs, a multiple of a word */
+#define BOOT_PART_FIFO_CHUNK                     16
+/* OCTOSPI clocks between the status reads of the auto-polling */
+#define BOOT_PART_POLL_INTERVAL                  0x10
+
+/* one erase command of a part */
+struct boot_part_eraser {
+    uint32_t size;                               /**< erase unit, a power of two, 0: none */
+    uint8_t cmd;                                 /**< instruction */
+    uint32_t time_max_ms;                        /**< maximum erase time (ms) */
+};
+
+/* a flash part, all the driver knows of it */
+struct boot_part_desc {
+    const char *name;                            /**< part name */
+    uint8_t mf_id;                               /**< JEDEC manufacturer ID */
+    uint8_t type_id;                             /**< JEDEC memory type ID */
+    uint8_t capacity_id;                         /**< JEDEC capacity ID */
+    uint32_t capacity;                           /**< bytes */
+    uint8_t addr_size;                           /**< address bytes of the commands, 3 or 4 */
+    uint8_t read_cmd;                            /**< fast read instruction, sent on 1 line */
+    uint8_t read_addr_lines;                     /**< address lines of the read */
+    uint8_t read_mode_lines;                     /**< lines of the 8 mode bits, 0: none */
+    uint8_t read_mode_bits;                      /**< mode bits of a read that doesn't stay in continuous read */
+    uint8_t read_dummy_cycles;                   /**< dummy cycles after the mode bits */
+    uint8_t read_data_lines;                     /**< data lines of the read */
+    uint8_t program_cmd;                         /**< page program instruction, sent on 1 line */
+    uint8_t program_addr_lines;                  /**< address lines of the page program */
+    uint8_t program_data_lines;                  /**< data lines of the page program */
+    uint32_t page_size;                          /**< page of the program, a power of two */
+    uint32_t program_time_max_us;                /**< maximum page program time (us) */
+    boot_part_eraser eraser[BOOT_PART_ERASER_MAX_NUM]; /**< largest unit first */
+};
+
+/* CCR field of a line width */
+constexpr uint32_t boot_part_lines_mode(uint8_t lines) {
+    return lines == 8 ? 4 : lines == 4 ? 3 : lines == 2 ? 2 : lines == 1 ? 1 : 0;
+}
+
+/**
+ * CCR image of a command, 8 bits instruction on 1 line, STR, 8 bits alternate bytes
+ *
+ * @param addr_lines 0: no address phase
+ * @param ab_lines 0: no alternate bytes phase
+ * @param data_lines 0: no data phase
+ */
+constexpr uint32_t boot_part_ccr(uint8_t addr_size, uint8_t addr_lines, uint8_t ab_lines, uint8_t data_lines) {
+    return (boot_part_lines_mode(1) << OCTOSPI_CCR_IMODE_Pos)
+            | (boot_part_lines_mode(addr_lines) << OCTOSPI_CCR_ADMODE_Pos)
+            | (addr_lines ? (uint32_t) (addr_size - 1) << OCTOSPI_CCR_ADSIZE_Pos : 0)
+            | (boot_part_lines_mode(ab_lines) << OCTOSPI_CCR_ABMODE_Pos)
+            | (boot_part_lines_mode(data_lines) << OCTOSPI_CCR_DMODE_Pos);
+}
+
+/* timeout of a status poll, twice the maximum time */
+constexpr uint32_t boot_part_timeout_ms(uint32_t time_max_us) {
+    return time_max_us / 500 + 2;
+}
+
+/* the clock of the status poll timeouts: the SysTick count of the HAL, started at the construction */
+struct boot_part_tick_clock {
+    uint32_t start = HAL_GetTick();
+
+    uint32_t elapsed_ms() const {
+        return HAL_GetTick() - start;
+    }
+};
+
+template <const boot_part_desc &Part, uintptr_t Base, typename Clock = boot_part_tick_clock>
+struct boot_part_driver {
+    static_assert(Part.addr_size == 3 || Part.addr_size == 4, "3 or 4 address bytes");
+    static_assert(Part.page_size && !(Part.page_size & (Part.page_size - 1)), "the page is a power of two");
+    static_assert(Part.eraser[0].size, "one eraser at least");
+
+    static constexpr uint32_t ccr_read = boot_part_ccr(Part.addr_size, Part.read_addr_lines, Part.read_mode_lines,
+                                                       Part.read_data_lines);
+    static constexpr uint32_t ccr_program = boot_part_ccr(Part.addr_size, Part.program_addr_lines, 0,
+                                                          Part.program_data_lines);
+    static constexpr uint32_t ccr_erase = boot_part_ccr(Part.addr_size, 1, 0, 0);
+    static constexpr uint32_t ccr_cmd = boot_part_ccr(Part.addr_size, 0, 0, 0);
+    static constexpr uint32_t ccr_status = boot_part_ccr(Part.addr_size, 0, 0, 1);
+    static constexpr uint32_t cr_fthres = (BOOT_PART_FIFO_CHUNK - 1) << OCTOSPI_CR_FTHRES_Pos;
+
+    /* the smallest erase unit, the start of an erase is rounded down to it */
+    static constexpr uint32_t erase_min() {
+        uint32_t size = Part.eraser[0].size;
+
+        for (const boot_part_eraser &e : Part.eraser) {
+            if (e.size && e.size < size) {
+                size = e.size;
+            }
+        }
+        return size;
+    }
+
+    static inline OCTOSPI_TypeDef *ospi() {
+        return reinterpret_cast<OCTOSPI_TypeDef *>(Base);
+    }
+
+    /**
+     * start an indirect command, it runs from the write of IR, or of AR when it has an address
+     *
+     * @param fmode 0: indirect write, OCTOSPI_CR_FMODE_0: indirect read
+     * @param tcr TCR without the dummy cycles
+     */
+    template <uint32_t Ccr, uint32_t Dummy>
+    static inline __attribute__((always_inline)) void issue(OCTOSPI_TypeDef *o, uint32_t cr, uint32_t fmode,
+                                                            uint32_t tcr, uint8_t ir, uint32_t addr, size_t size) {
+        while (o->SR & OCTOSPI_SR_BUSY) {
+        }
+        o->CR = (cr & ~(OCTOSPI_CR_FMODE | OCTOSPI_CR_FTHRES)) | fmode | cr_fthres;
+        if constexpr ((Ccr & OCTOSPI_CCR_DMODE) != 0) {
+            o->DLR = size - 1;
+        }
+        o->TCR = tcr | Dummy;
+        o->CCR = Ccr;
+        if constexpr ((Ccr & OCTOSPI_CCR_ABMODE) != 0) {
+            o->ABR = Part.read_mode_bits;
+        }
+        o->IR = ir;
+        if constexpr ((Ccr & OCTOSPI_CCR_ADMODE) != 0) {
+            o->AR = addr;
+        }
+    }
+
+    /* wait the end of the command, false: a transfer error */
+    static inline bool complete(OCTOSPI_TypeDef *o) {
+        uint32_t sr;
+
+        while (!((sr = o->SR) & (OCTOSPI_SR_TCF | OCTOSPI_SR_TEF))) {
+        }
+        o->FCR = OCTOSPI_FCR_CTCF | OCTOSPI_FCR_CTEF;
+        return !(sr & OCTOSPI_SR_TEF);
+    }
+
+    /* wait a FIFO threshold: BOOT_PART_FIFO_CHUNK bytes in or room for them, or the rest at the end of a read */
+    static inline bool fifo_wait(OCTOSPI_TypeDef *o) {
+        uint32_t sr;
+
+        while (!((sr = o->SR) & (OCTOSPI_SR_FTF | OCTOSPI_SR_TEF))) {
+        }
+        return !(sr & OCTOSPI_SR_TEF);
+    }
+
+    static inline bool fifo_read(OCTOSPI_TypeDef *o, uint8_t *buf, size_t size) {
+        volatile uint32_t *dr = &o->DR;
+        uint32_t word;
+        size_t n;
+
+        while (size) {
+            if (!fifo_wait(o)) {
+                return false;
+            }
+            n = size < BOOT_PART_FIFO_CHUNK ? size : BOOT_PART_FIFO_CHUNK;
+            size -= n;
+            for (; n >= 4; n -= 4, buf += 4) {
+                word = *dr;
+                memcpy(buf, &word, 4);
+            }
+            for (; n; n--) {
+                *buf++ = *(volatile uint8_t *) dr;
+            }
+        }
+        return true;
+    }
+
+    static inline bool fifo_write(OCTOSPI_TypeDef *o, const uint8_t *buf, size_t size) {
+        volatile uint32_t *dr = &o->DR;
+        uint32_t word;
+        size_t n;
+
+        while (size) {
+            if (!fifo_wait(o)) {
+                return false;
+            }
+            n = size < BOOT_PART_FIFO_CHUNK ? size : BOOT_PART_FIFO_CHUNK;
+            size -= n;
+            for (; n >= 4; n -= 4, buf += 4) {
+                memcpy(&word, buf, 4);
+                *dr = word;
+            }
+            for (; n; n--) {
+                *(volatile uint8_t *) dr = *buf++;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * poll the status register by the auto-polling until (status & mask) == match
+     *
+     * @return SFUD_ERR_TIMEOUT: no match in timeout_ms, the polling is aborted
+     */
+    static sfud_err poll(OCTOSPI_TypeDef *o, uint32_t cr, uint32_t tcr, uint8_t mask, uint8_t match,
+                         uint32_t timeout_ms) {
+        uint32_t sr;
+
+        while (o->SR & OCTOSPI_SR_BUSY) {
+        }
+        o->CR = (cr & ~(OCTOSPI_CR_FMODE | OCTOSPI_CR_FTHRES | OCTOSPI_CR_PMM)) | OCTOSPI_CR_FMODE_1
+                | OCTOSPI_CR_APMS;
+        o->PSMKR = mask;
+        o->PSMAR = match;
+        o->PIR = BOOT_PART_POLL_INTERVAL;
+        o->DLR = 0;
+        o->TCR = tcr;
+        o->CCR = ccr_status;
+        o->IR = SFUD_CMD_READ_STATUS_REGISTER;
+
+        Clock clock;
+        while (!((sr = o->SR) & (OCTOSPI_SR_SMF | OCTOSPI_SR_TEF))) {
+            if (clock.elapsed_ms() > timeout_ms) {
+                o->CR |= OCTOSPI_CR_ABORT;
+                while (o->CR & OCTOSPI_CR_ABORT) {
+                }
+                return SFUD_ERR_TIMEOUT;
+            }
+        }
+        o->FCR = OCTOSPI_FCR_CSMF | OCTOSPI_FCR_CTCF | OCTOSPI_FCR_CTEF;
+        return sr & OCTOSPI_SR_TEF ? SFUD_ERR_READ : SFUD_SUCCESS;
+    }
+
+    /* WREN, then WEL polled, as SFUD checks it */
+    static inline sfud_err write_enable(OCTOSPI_TypeDef *o, uint32_t cr, uint32_t tcr) {
+        issue<ccr_cmd, 0>(o, cr, 0, tcr, SFUD_CMD_WRITE_ENABLE, 0, 0);
+        if (!complete(o)
+                || poll(o, cr, tcr, SFUD_STATUS_REGISTER_WEL, SFUD_STATUS_REGISTER_WEL, boot_part_timeout_ms(0))
+                   != SFUD_SUCCESS) {
+            return SFUD_ERR_WRITE;
+        }
+        return SFUD_SUCCESS;
+    }
+
+    /* the TCR of the commands: the sampling in force, no dummy cycles */
+    static inline uint32_t tcr_base(OCTOSPI_TypeDef *o) {
+        while (o->SR & OCTOSPI_SR_BUSY) {
+        }
+        return o->TCR & ~OCTOSPI_TCR_DCYC;
+    }
+
+    /**
+     * the driver takes the flash in indirect mode only, SFUD pauses the memory-mapped mode for its commands
+     */
+    static bool ready(const sfud_flash *flash) {
+        (void) flash;
+        return (ospi()->CR & OCTOSPI_CR_FMODE) != OCTOSPI_CR_FMODE;
+    }
+
+    static sfud_err read(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data) {
+        OCTOSPI_TypeDef *o = ospi();
+        uint32_t tcr, cr;
+        bool ok;
+
+        (void) flash;
+        if (size == 0) {
+            return SFUD_SUCCESS;
+        }
+        tcr = tcr_base(o);
+        cr = o->CR;
+        issue<ccr_read, Part.read_dummy_cycles>(o, cr, OCTOSPI_CR_FMODE_0, tcr, Part.read_cmd, addr, size);
+        ok = fifo_read(o, data, size);
+        ok = complete(o) && ok;
+        o->CR = cr;
+
+        return ok ? SFUD_SUCCESS : SFUD_ERR_READ;
+    }
+
+    static sfud_err write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+        OCTOSPI_TypeDef *o = ospi();
+        uint32_t tcr = tcr_base(o), cr = o->CR;
+        sfud_err result = SFUD_SUCCESS;
+        size_t n;
+
+        (void) flash;
+        while (size && result == SFUD_SUCCESS) {
+            n = Part.page_size - (addr & (Part.page_size - 1));
+            if (n > size) {
+                n = size;
+            }
+            result = write_enable(o, cr, tcr);
+            if (result == SFUD_SUCCESS) {
+                issue<ccr_program, 0>(o, cr, 0, tcr, Part.program_cmd, addr, n);
+                if (!fifo_write(o, data, n) || !complete(o)) {
+                    result = SFUD_ERR_WRITE;
+                }
+            }
+            if (result == SFUD_SUCCESS) {
+                result = poll(o, cr, tcr, SFUD_STATUS_REGISTER_BUSY, 0, boot_part_timeout_ms(Part.program_time_max_us));
+            }
+            addr += n;
+            data += n;
+            size -= n;
+        }
+        o->CR = cr;
+
+        return result;
+    }
+
+    static sfud_err erase(const sfud_flash *flash, uint32_t addr, size_t size) {
+        OCTOSPI_TypeDef *o = ospi();
+        uint32_t tcr = tcr_base(o), cr = o->CR, end = addr + size;
+        sfud_err result = SFUD_SUCCESS;
+        const boot_part_eraser *eraser;
+
+        (void) flash;
+        addr &= ~(erase_min() - 1);
+        while (addr < end && result == SFUD_SUCCESS) {
+            /* the largest unit aligned and within the range, the smallest is the last of the table */
+            eraser = &Part.eraser[0];
+            for (const boot_part_eraser &e : Part.eraser) {
+                if (e.size == 0) {
+                    break;
+                }
+                eraser = &e;
+                if (!(addr & (e.size - 1)) && end - addr >= e.size) {
+                    break;
+                }
+            }
+            result = write_enable(o, cr, tcr);
+            if (result == SFUD_SUCCESS) {
+                issue<ccr_erase, 0>(o, cr, 0, tcr, eraser->cmd, addr, 0);
+                if (!complete(o)) {
+                    result = SFUD_ERR_WRITE;
+                }
+            }
+            if (result == SFUD_SUCCESS) {
+                result = poll(o, cr, tcr, SFUD_STATUS_REGISTER_BUSY, 0,
+                              boot_part_timeout_ms(eraser->time_max_ms * 1000));
+            }
+            addr += eraser->size;
+        }
+        o->CR = cr;
+
+        return result;
+    }
+
+    static constexpr sfud_part ops = {Part.name, ready, read, write, erase};
+};
+
+#endif /* __BOOT_PART_HPP__ */
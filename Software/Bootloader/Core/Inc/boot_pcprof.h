@@ -0,0 +1,128 @@
+/**
+ * @file boot_pcprof.h
+ * @brief PC sampling profiler of the application, a histogram of the sampled PC and the DWT event counts in RAM_D3.
+ *
+ * The application runs it through the services of boot_svc.h, in its own
+ * context:
+ *
+ *     prof_start(base, size)      clear the record, the histogram covers base ~ base + size
+ *     prof_sample(frame)          one sample, from a periodic interrupt
+ *     prof_stop()                 end of the run, the record is kept for the bootloader
+ *
+ * The core reads DWT->PCSR as the PC of its own read, so the sample is the
+ * PC the interrupt stacked. The application gives a timer of its own a few
+ * kHz, any rate which isn't a multiple of its periodic work, and ends its
+ * handler by BOOT_PCPROF_SAMPLE(): the flag of the timer cleared, no call
+ * before it, the frame is still the one of the interrupt. A handler which
+ * has the frame in hand may call prof_sample() itself.
+ *
+ * A sample counts the PC in the bucket BOOT_PCPROF_BUCKET_NUM of the range
+ * it falls in, 2^shift bytes wide, the smallest power of 2 which covers
+ * the range, and in the memory it runs from: ITCM, the internal flash, the
+ * XIP window of OCTOSPI1, the RAMs or elsewhere. The share of the XIP time
+ * and its hot buckets tell what code is worth a move to the ITCM.
+ *
+ * The CPI, EXC, SLEEP, LSU and FOLD counters of the DWT run from the start,
+ * each sample adds what they moved since the sample before, and the cycles
+ * of CYCCNT between the two. They are 8 bits wide: a counter which moves
+ * 256 or more between two samples loses the wraps, the sums are exact at a
+ * sample rate above the stalls. The stalls per 1000 cycles compare runs of
+ * the same rate, e.g. before and after a move to the ITCM.
+ *
+ * The record at BOOT_PCPROF_ADDR (RAM_D3, no-init) stays over a warm reset.
+ * The next full boot logs the one stopped since, on the USART2 log and the
+ * ESP32 one of boot_netlog.h while the link is up; the console prints it
+ * with the "pcprof" command, "pcprof hex" dumps it for Tools/xip_order.py,
+ * which orders the code of the next link by it. Like the fault record of
+ * boot_fault.h it's the one record the application writes, the services
+ * keep nothing else.
+ */
+#ifndef __BOOT_PCPROF_H__
+#define __BOOT_PCPROF_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "boot_svc.h"
+
+#define BOOT_PCPROF_ADDR                         0x38002000UL
+#define BOOT_PCPROF_MAGIC                        0x46504342UL /* 'BCPF' */
+#define BOOT_PCPROF_VERSION                      1
+#define BOOT_PCPROF_BUCKET_NUM                   1024
+/* 4 bytes a bucket at least, two Thumb instructions */
+#define BOOT_PCPROF_SHIFT_MIN                    2
+/* buckets printed, the most sampled first */
+#define BOOT_PCPROF_TOP_NUM                      16
+
+/* the tail of a sampling handler: the frame of the interrupt, and the branch to prof_sample() of the table */
+#define BOOT_PCPROF_SAMPLE()                                                     \
+    __asm volatile("tst lr, #4\n"                                                \
+                   "ite eq\n"                                                    \
+                   "mrseq r0, msp\n"                                             \
+                   "mrsne r0, psp\n"                                             \
+                   "movw r1, #:lower16:%c0\n"                                    \
+                   "movt r1, #:upper16:%c0\n"                                    \
+                   "ldr r1, [r1]\n"                                              \
+                   "bx r1\n"                                                     \
+                   : : "i" (BOOT_SVC_TABLE_ADDR + offsetof(boot_svc_table, prof_sample)))
+
+typedef enum {
+    BOOT_PCPROF_STATE_RUNNING = 1,               /**< prof_start() to prof_stop() */
+    BOOT_PCPROF_STATE_STOPPED = 2,               /**< stopped, the next boot logs it */
+    BOOT_PCPROF_STATE_LOGGED = 3,                /**< logged at a boot, for the console only */
+} boot_pcprof_state;
+
+typedef enum {
+    BOOT_PCPROF_MEM_ITCM = 0,
+    BOOT_PCPROF_MEM_FLASH,
+    BOOT_PCPROF_MEM_XIP,
+    BOOT_PCPROF_MEM_RAM,
+    BOOT_PCPROF_MEM_OTHER,
+    BOOT_PCPROF_MEM_NUM,
+} boot_pcprof_mem;
+
+typedef enum {
+    BOOT_PCPROF_CNT_CPI = 0,                     /**< cycles of the multi-cycle instructions and their stalls */
+    BOOT_PCPROF_CNT_EXC,                         /**< cycles of the exception entries and returns */
+    BOOT_PCPROF_CNT_SLEEP,                       /**< cycles asleep */
+    BOOT_PCPROF_CNT_LSU,                         /**< cycles of the loads and stores beyond the first */
+    BOOT_PCPROF_CNT_FOLD,                        /**< instructions folded, no cycle */
+    BOOT_PCPROF_CNT_NUM,
+} boot_pcprof_cnt;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_PCPROF_MAGIC when the record is valid */
+    uint16_t version;                            /**< BOOT_PCPROF_VERSION */
+    uint16_t size;                               /**< sizeof(boot_pcprof) */
+    uint32_t state;                              /**< boot_pcprof_state */
+    uint32_t base;                               /**< first address of bucket 0 */
+    uint32_t range;                              /**< bytes of the range */
+    uint32_t shift;                              /**< a bucket is 2^shift bytes */
+    uint32_t core_clock_hz;                      /**< core clock of the RCC registers at the start */
+    uint32_t samples;                            /**< prof_sample() calls */
+    uint32_t last_cycles;                        /**< DWT->CYCCNT at the last sample */
+    uint8_t last_cnt[BOOT_PCPROF_CNT_NUM];       /**< DWT counters at the last sample */
+    uint8_t reserved[7];                         /**< 0 */
+    uint64_t cycles;                             /**< cycles from the start to the last sample */
+    uint32_t cnt[BOOT_PCPROF_CNT_NUM];           /**< sums of the DWT counter moves, by boot_pcprof_cnt */
+    uint32_t mem[BOOT_PCPROF_MEM_NUM];           /**< samples by boot_pcprof_mem */
+    uint32_t outside;                            /**< samples out of the range */
+    uint16_t hist[BOOT_PCPROF_BUCKET_NUM];       /**< samples per bucket, 0xFFFF: saturated */
+} boot_pcprof;
+
+extern boot_pcprof boot_pcprof_record;
+
+void boot_pcprof_svc_start(uint32_t base, uint32_t size);
+void boot_pcprof_svc_sample(const uint32_t *frame);
+void boot_pcprof_svc_stop(void);
+void boot_pcprof_report(void);
+void boot_pcprof_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_PCPROF_H__ */
@@ -0,0 +1,75 @@
+/**
+ * @file boot_perf.h
+ * @brief History of the boot profiles in the key-value store, the boots slower than the last ones are flagged.
+ *
+ * boot_perf_record() runs at the jump, after boot_profile_finish(). It turns
+ * the profile of the boot into a boot_perf_entry: the time of each stage in
+ * BOOT_PERF_UNIT_US units, the total, the OCTOSPI1 read timing the
+ * calibration left (prescaler, sample shift, delay block) and the version
+ * of the booted image. The last BOOT_PERF_HISTORY_NUM entries are one
+ * boot_perf_history value under BOOT_PERF_KV_KEY, the newest one replaces
+ * the oldest.
+ *
+ * The baseline of a stage is the mean of the unflagged entries of the
+ * history, BOOT_PERF_BASELINE_MIN of them at least. A stage, or the total,
+ * longer than its baseline by BOOT_PERF_THRESHOLD_PCT percent plus
+ * BOOT_PERF_SLACK_US is flagged in the entry, in
+ * boot_handoff_info.perf_flags and by a warning on the log. A lasting
+ * slowdown stays flagged until the history holds too few unflagged
+ * entries, then it's the new baseline: the warnings stop after
+ * BOOT_PERF_HISTORY_NUM - BOOT_PERF_BASELINE_MIN + 1 boots.
+ *
+ * Only the plain full boots are compared: the direct path, the updates and
+ * the warm entry of boot_warm.h run other stages, they are not recorded.
+ * The store is on the EXT flash, which the flash log brings up on a plain
+ * boot; without it nothing is recorded either. The console prints the
+ * history with the "perf" command.
+ */
+#ifndef __BOOT_PERF_H__
+#define __BOOT_PERF_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "boot_profile.h"
+
+#define BOOT_PERF_KV_KEY                         "perf"
+#define BOOT_PERF_VERSION                        1
+#define BOOT_PERF_HISTORY_NUM                    8
+#define BOOT_PERF_BASELINE_MIN                   4
+#define BOOT_PERF_THRESHOLD_PCT                  25
+/* the jitter of a short stage, a few lines of the log */
+#define BOOT_PERF_SLACK_US                       200
+/* boot_perf_entry.stage_time, 655ms at most */
+#define BOOT_PERF_UNIT_US                        10
+/* boot_perf_entry.flags: the total, the stages are (1 << boot_stage) */
+#define BOOT_PERF_FLAG_TOTAL                     (1UL << 31)
+
+typedef struct {
+    uint32_t image_version;                      /**< image_version of the booted header, 0: legacy layout */
+    uint32_t total_us;                           /**< main() to the jump */
+    uint32_t flags;                              /**< stages over the baseline, BOOT_PERF_FLAG_TOTAL */
+    uint8_t ospi_prescaler;                      /**< OCTOSPI1 DCR2 PRESCALER + 1 */
+    uint8_t ospi_sshift;                         /**< 1: TCR SSHIFT, half-cycle sample shift */
+    uint8_t dlyb_sel;                            /**< DLYB_OCTOSPI1 CFGR SEL, 0xFF: bypassed */
+    uint8_t dlyb_unit;                           /**< DLYB_OCTOSPI1 CFGR UNIT */
+    uint16_t stage_time[BOOT_STAGE_NUM];         /**< BOOT_PERF_UNIT_US units, 0xFFFF: longer */
+} boot_perf_entry;
+
+typedef struct {
+    uint16_t version;                            /**< BOOT_PERF_VERSION */
+    uint16_t stage_num;                          /**< BOOT_STAGE_NUM of the bootloader which wrote it */
+    uint32_t count;                              /**< boots recorded, the newest is entry[(count - 1) % NUM] */
+    boot_perf_entry entry[BOOT_PERF_HISTORY_NUM];
+} boot_perf_history;
+
+uint32_t boot_perf_record(void);
+void boot_perf_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_PERF_H__ */
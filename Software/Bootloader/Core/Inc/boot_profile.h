@@ -0,0 +1,89 @@
+/**
+ * @file boot_profile.h
+ * @brief Boot-stage timing profile kept in no-init RAM_D3.
+ *
+ * The bootloader stamps DWT->CYCCNT at the end of every boot stage. The record
+ * lives at the start of RAM_D3 (BOOT_PROFILE_ADDR) and is not touched by the C
+ * runtime, so the application can read it after the handoff.
+ *
+ * Application side:
+ *
+ *     const boot_profile *p = (const boot_profile *) BOOT_PROFILE_ADDR;
+ *     if (p->magic == BOOT_PROFILE_MAGIC && p->version == BOOT_PROFILE_VERSION) {
+ *         // p->cycles[BOOT_STAGE_xxx] is the CYCCNT value at the end of that stage
+ *     }
+ *
+ * Reset_Handler paints the stack area, from the end of the DTCM sections (the
+ * unused newlib heap included) to _estack, with BOOT_PROFILE_STACK_PAINT.
+ * boot_profile_stack_peak() finds the deepest word that changed since, the
+ * stack the boot took at most, interrupts included. _Min_Stack_Size is only
+ * the reserve the link checks, the stack may grow over the whole area.
+ *
+ * boot_profile_stage_us() turns the stamps into the time of each stage, the
+ * console prints it and boot_perf.h keeps a history of it.
+ *
+ * @note Stages up to BOOT_STAGE_SFUD_FAST_READ run on HSI (64MHz), the rest on the PLL,
+ *       see boot_clock.h. Converting cycles to time therefore needs core_clock_hz for the
+ *       later stages only. After boot_warm_enter() all of them run on the PLL.
+ */
+#ifndef __BOOT_PROFILE_H__
+#define __BOOT_PROFILE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define BOOT_PROFILE_ADDR                        0x38000000UL
+#define BOOT_PROFILE_MAGIC                       0x50544F42UL /* 'BOTP' */
+#define BOOT_PROFILE_VERSION                     9
+/* 'STAK', the same word is in the startup file */
+#define BOOT_PROFILE_STACK_PAINT                 0x5354414BUL
+
+/* boot stages, every entry is the time stamp at the END of this stage */
+typedef enum {
+    BOOT_STAGE_HAL_INIT = 0,
+    BOOT_STAGE_GPIO_INIT,
+    BOOT_STAGE_OCTOSPI1_INIT,
+    BOOT_STAGE_USART2_INIT,
+    BOOT_STAGE_SPI2_INIT,
+    BOOT_STAGE_ELOG_INIT,
+    BOOT_STAGE_ELOG_START,
+    BOOT_STAGE_SFUD_INIT,
+    BOOT_STAGE_SFUD_FAST_READ,
+    BOOT_STAGE_SYSTEM_CLOCK,
+    BOOT_STAGE_OSPI_CAL,
+    BOOT_STAGE_UART_UPDATE,
+    BOOT_STAGE_USB_UPDATE,
+    BOOT_STAGE_ESP_UPDATE,
+    BOOT_STAGE_MEMORY_MAPPED,
+    BOOT_STAGE_SLOT_SELECT,
+    BOOT_STAGE_JUMP,
+    BOOT_STAGE_NUM,
+} boot_stage;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_PROFILE_MAGIC when the record is valid */
+    uint16_t version;                            /**< BOOT_PROFILE_VERSION */
+    uint16_t stage_num;                          /**< BOOT_STAGE_NUM of the bootloader which wrote it */
+    uint32_t core_clock_hz;                      /**< SystemCoreClock at the jump */
+    uint32_t reset_flags;                        /**< RCC->RSR at reset, cleared by the bootloader */
+    uint32_t cycles[BOOT_STAGE_NUM];             /**< DWT->CYCCNT at the end of each stage, 0: not reached */
+} boot_profile;
+
+extern boot_profile boot_profile_record;
+
+void boot_profile_init(void);
+void boot_profile_mark(boot_stage stage);
+void boot_profile_finish(void);
+const char *boot_profile_stage_name(boot_stage stage);
+uint32_t boot_profile_stage_us(boot_stage stage);
+uint32_t boot_profile_stack_size(void);
+uint32_t boot_profile_stack_peak(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_PROFILE_H__ */
@@ -0,0 +1,47 @@
+/**
+ * @file boot_recv.h
+ * @brief SHA-256, CRC-32 and sector CRCs of an upload, taken as its frames are received.
+ *
+ * The receivers (boot_uart.h, boot_usb.h, boot_esp.h) hand each frame to
+ * boot_recv_feed() once its program is started. The HASH unit takes it by
+ * the DMA2 straight from the receive buffer, the CRC unit by the MDMA into
+ * the CRC-32 of the image and into the one of the BOOT_VERIFY_SECTOR_SIZE
+ * sector it falls in; the header area is kept as it passes, the image size
+ * comes from it. Without this the first boot of the slot reads the whole
+ * image back for its CRC-32 and SHA-256, and seals it with one more read
+ * for the sector CRCs.
+ *
+ * boot_slot_commit() takes the result with boot_recv_take(): the header read
+ * back from the slot has to be the one which passed, the CRC-32 and the
+ * SHA-256 have to be its image_crc and image_hash, then with BOOT_SIGN_KEY
+ * the signature of the header is checked over the digest already there. A
+ * good upload is sealed with its sector CRCs at once (boot_verify_seal_crcs()),
+ * its first boot only samples it as any later one does.
+ *
+ * Anything else leaves the image to the full checks of its first boot:
+ *  - a frame fed out of order, e.g. a resumed ESP32 download
+ *  - an image with a sector table (BOOT_IMAGE_FLAG_SECTOR_HASH)
+ *  - a HASH or CRC unit error
+ *
+ * @note Nothing else may use the HASH unit during the upload, the digest would not match.
+ */
+#ifndef __BOOT_RECV_H__
+#define __BOOT_RECV_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "boot_slot.h"
+
+void boot_recv_start(boot_slot_id slot);
+void boot_recv_feed(uint32_t offset, const void *data, size_t len);
+const uint32_t *boot_recv_take(boot_slot_id slot, const boot_image_header *header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_RECV_H__ */
@@ -0,0 +1,77 @@
+/**
+ * @file boot_rollback.h
+ * @brief Rollback copy of a bootable slot on the EXT flash.
+ *
+ * An update overwrites the staging slot, which may still hold a good image,
+ * the one the device falls back to. boot_rollback_save() copies that image
+ * to the EXT flash first: the slot is read straight out of the
+ * memory-mapped OCTOSPI1 window and written through a sfud_stream, so the
+ * copy runs at the page program rate of the EXT flash, its erase ahead
+ * included. A copy of the same image is kept as it is.
+ *
+ * Layout of the EXT flash after the key-value store:
+ *
+ *     0x010000   4KB      record sector, boot_rollback_record
+ *     0x011000   4032KB   the slot from its header on, header area included
+ *
+ * The record is erased before the copy and programmed after it, a reset in
+ * between leaves no record. boot_rollback_restore() installs the copy back
+ * into the slot it came from, main() does it when no slot holds a valid
+ * image.
+ *
+ * With the OTFDEC key provisioned the copy is encrypted at rest, AES-CTR
+ * of boot_cryp.h under the image_crc and image_version of the header as
+ * nonce: the CRYP DMA encrypts the next block out of the window while the
+ * stream programs the last one, and boot_install() decrypts it back the
+ * same way on the restore. Without a key the copy stays plain, the cipher
+ * field of the record tells which.
+ *
+ * @note The copy takes the EXT flash like the key-value store, after
+ *       elog_flash_flush(), boot_kv_flush() and boot_lfs_flush().
+ */
+#ifndef __BOOT_ROLLBACK_H__
+#define __BOOT_ROLLBACK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sfud.h>
+#include "boot_kv.h"
+#include "boot_slot.h"
+
+/* EXT flash after the key-value store, the file system follows */
+#define BOOT_ROLLBACK_ADDR                       (BOOT_KV_ADDR + BOOT_KV_SECTOR_NUM * BOOT_KV_SECTOR_SIZE)
+#define BOOT_ROLLBACK_RECORD_SIZE                0x1000UL
+#define BOOT_ROLLBACK_IMAGE_ADDR                 (BOOT_ROLLBACK_ADDR + BOOT_ROLLBACK_RECORD_SIZE)
+#define BOOT_ROLLBACK_END                        (BOOT_ROLLBACK_IMAGE_ADDR + BOOT_SLOT_SIZE)
+#define BOOT_ROLLBACK_MAGIC                      0x4B425242UL /* 'BRBK' */
+/* the block encrypted while the last one is programmed */
+#define BOOT_ROLLBACK_CRYP_BLOCK_SIZE            (16 * 1024)
+
+typedef enum {
+    BOOT_ROLLBACK_CIPHER_AES_CTR = 1,            /**< boot_cryp.h, nonce of the record */
+    BOOT_ROLLBACK_CIPHER_PLAIN = 0xFF,
+} boot_rollback_cipher;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_ROLLBACK_MAGIC */
+    uint32_t size;                               /**< bytes of the copy, header area included */
+    uint32_t image_crc;                          /**< image_crc of the header copied */
+    uint32_t image_version;                      /**< image_version of the header copied */
+    uint8_t slot;                                /**< boot_slot_id the copy was taken from */
+    uint8_t cipher;                              /**< boot_rollback_cipher */
+    uint8_t reserved[2];                         /**< 0xFF */
+    uint32_t nonce[2];                           /**< AES-CTR nonce, image_crc and image_version; 0xFF: plain */
+    uint32_t crc;                                /**< CRC-32 of all the fields above */
+} boot_rollback_record;
+
+sfud_err boot_rollback_save(boot_slot_id slot);
+sfud_err boot_rollback_restore(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_ROLLBACK_H__ */
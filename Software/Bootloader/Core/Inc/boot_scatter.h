@@ -0,0 +1,52 @@
+/**
+ * @file boot_scatter.h
+ * @brief Scatter loader of the image sections, see BOOT_IMAGE_FLAG_SECTIONS,
+ *        BOOT_IMAGE_FLAG_RAM, BOOT_IMAGE_FLAG_LZ4 and BOOT_IMAGE_FLAG_VECTOR.
+ *
+ * boot_scatter_prepare() checks the section table of the image to boot and
+ * gets the sections ready, the whole image of BOOT_IMAGE_FLAG_RAM and the
+ * vector table of BOOT_IMAGE_FLAG_VECTOR are two more copies, to ram_addr
+ * and to vector_addr, ahead of them:
+ *  - a compressed section, or the whole image of BOOT_IMAGE_FLAG_LZ4, is
+ *    decoded by the CPU right away, so its run range must be outside
+ *    everything the bootloader still uses: the ITCM above _eitcm or RAM_D1
+ *    above _ebss. The LZ4 image is read through the XIP window, the
+ *    OSPI prefetch streams it in, the vector table copy then comes from
+ *    the decoded image
+ *  - copies and clears become one MDMA linked list (64KB per node, nodes in
+ *    RAM_D3), they may cover the bootloader's ITCM code, its DTCM data and
+ *    stack or its RAM_D1 data, nothing of them is used once the list runs
+ *  - the GOT and the vector table of BOOT_IMAGE_FLAG_PIC are moved to the
+ *    slot the image is stored in right away, into RAM_D3 buffers the list
+ *    copies from
+ *
+ * boot_scatter_jump() runs the list in place of the last steps of the jump:
+ * from the start of the MDMA on the CPU runs on registers only, it waits
+ * for the list, invalidates the I-Cache, sets VTOR, MSP, CONTROL and r9,
+ * the GOT copy of a PIC image, and branches to the reset handler. A transfer error resets the MCU, the
+ * bootloader's RAM can't be trusted any more.
+ *
+ * The application needs no copy loop of its own for these sections, the
+ * ITCM code runs zero-wait from its first instruction on. Its startup must
+ * not clear or copy them again.
+ */
+#ifndef __BOOT_SCATTER_H__
+#define __BOOT_SCATTER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "boot_image.h"
+
+bool boot_scatter_prepare(const boot_image_header *header, uint32_t slot_mapped_addr);
+bool boot_scatter_pending(void);
+void boot_scatter_jump(uint32_t stack_top, uint32_t vector_addr, uint32_t entry_addr) __attribute__((noreturn));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_SCATTER_H__ */
@@ -0,0 +1,72 @@
+/**
+ * @file boot_sched.h
+ * @brief Cooperative run-to-completion scheduler of the update mode, the core sleeps when nothing is ready.
+ *
+ * A stage of an update (a transport, the flash, an ACK to send) is a task.
+ * A task runs when it's ready, does what it can without waiting and
+ * returns; nothing is preempted, the tasks share the stack and no data needs
+ * a lock against another task, only against the interrupt handlers:
+ *
+ *     boot_sched_add(&task)          into the run list, in priority order, ready
+ *     boot_sched_post(&task)         ready, from a task or an interrupt handler
+ *     boot_sched_run(done, arg)      runs the ready tasks till done(arg) is true
+ *
+ * What wakes a task is an event of its source: an interrupt handler or
+ * callback of a transport (esp_spi_set_notify()), the done callback of a
+ * sfud_async, another task. A task whose source has no interrupt, a flash
+ * operation moved on by sfud_async_poll(), returns true: it's ready again
+ * right away, the core doesn't sleep while it has work. With no task ready
+ * the core waits in WFI for the next interrupt, the SysTick included, so
+ * done() is checked at least every millisecond and may hold a timeout.
+ *
+ * The ready tasks run in the order of boot_sched_add(), a pass starts over
+ * at the first one, the first task of a pipeline should be the one which
+ * frees a buffer for the others. boot_sched_run() empties the run list at
+ * its return, the tasks of one update don't outlive it.
+ *
+ * @note The counters count DWT cycles, CYCCNT must be running
+ *       (boot_profile_init()).
+ */
+#ifndef __BOOT_SCHED_H__
+#define __BOOT_SCHED_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct boot_task boot_task;
+
+/**
+ * @return true: run again as soon as possible, false: wait for a boot_sched_post()
+ */
+typedef bool (*boot_task_fn)(boot_task *task);
+
+struct boot_task {
+    boot_task_fn run;                            /**< the work of the task */
+    void *user_data;                             /**< some user data of run */
+    boot_task *next;                             /**< run list, set by boot_sched_add() */
+    volatile bool ready;                         /**< run on the next pass */
+};
+
+/* counters of the last boot_sched_run() */
+typedef struct {
+    uint32_t passes;                             /**< passes over the run list */
+    uint32_t runs;                               /**< task runs */
+    uint32_t sleeps;                             /**< WFI with no task ready */
+    uint32_t busy_cycles;                        /**< cycles in the tasks */
+    uint32_t idle_cycles;                        /**< cycles in WFI, handlers included */
+} boot_sched_stats;
+
+void boot_sched_add(boot_task *task);
+void boot_sched_post(boot_task *task);
+void boot_sched_run(bool (*done)(void *arg), void *arg);
+void boot_sched_get_stats(boot_sched_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_SCHED_H__ */
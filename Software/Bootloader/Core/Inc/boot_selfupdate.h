@@ -0,0 +1,64 @@
+/**
+ * @file boot_selfupdate.h
+ * @brief Update of the bootloader itself from an image staged on the littlefs of the EXT flash.
+ *
+ * The new bootloader comes as BOOT_SELFUPDATE_PATH: a boot_image_header
+ * area, then the raw binary linked at BOOT_SELFUPDATE_ADDR, the internal
+ * flash. load_addr and exec_addr are BOOT_SELFUPDATE_ADDR, flags 0, the
+ * image at most BOOT_SELFUPDATE_SIZE_MAX bytes: the last flash word holds
+ * the OTFDEC key record of boot_otfdec.h.
+ *
+ * boot_selfupdate_run() skips a file whose header_crc the key-value store
+ * holds with BOOT_SELFUPDATE_KV_KEY. Otherwise the whole image is read into
+ * the RAM_D1 after the .bss and checked there: header, CRC-32, SHA-256 and,
+ * with BOOT_SIGN_KEY, the Ed25519 signature of the header area, as for an
+ * application image. An image the internal flash already holds is only
+ * recorded. For another one the RAM copy is padded with 0xFF to the sector,
+ * the OTFDEC key record goes to its last flash word, and from then on
+ * nothing runs from the internal flash:
+ *
+ *     interrupts masked, D-cache off, ITCM code only (.itcm_text)
+ *     FLASH_CR1 sector erase of the one 128KB sector
+ *     FLASH_CR1 PG, 8 words per 256-bit flash word, blank words skipped
+ *     read back against the RAM copy, erase and program again on a mismatch
+ *     system reset, the new bootloader runs
+ *
+ * The STM32H730VB has one sector, "erasing where the content differs" is
+ * the sector or nothing. The time the device can't boot is the sector erase
+ * and the program of the words the image takes, no littlefs, log or HAL
+ * call is left in it.
+ *
+ * @note Builds with BOOT_LFS, see boot_lfs.h. A power loss between the erase
+ *       and the end of the program leaves no bootloader, the debugger has to
+ *       flash it again.
+ */
+#ifndef __BOOT_SELFUPDATE_H__
+#define __BOOT_SELFUPDATE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef BOOT_LFS
+
+#include <stdbool.h>
+#include <lfs.h>
+#include "boot_otfdec.h"
+
+#define BOOT_SELFUPDATE_PATH                     "/boot/bootloader.bin"
+#define BOOT_SELFUPDATE_KV_KEY                   "self.crc"
+/* the internal flash, where the bootloader is linked */
+#define BOOT_SELFUPDATE_ADDR                     0x08000000UL
+#define BOOT_SELFUPDATE_SIZE_MAX                 (BOOT_OTFDEC_KEY_ADDR - BOOT_SELFUPDATE_ADDR)
+/* erase and program rounds before the reset gives up */
+#define BOOT_SELFUPDATE_TRIES                    3
+
+bool boot_selfupdate_run(lfs_t *lfs);
+
+#endif /* BOOT_LFS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_SELFUPDATE_H__ */
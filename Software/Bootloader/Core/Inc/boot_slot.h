@@ -0,0 +1,76 @@
+/**
+ * @file boot_slot.h
+ * @brief A/B application slots on the MAIN (OCTOSPI1) flash and the slot-selection record.
+ *
+ * Layout of the 8MB MAIN flash:
+ *
+ *     0x000000   4KB      slot-selection record sector 0
+ *     0x001000   4KB      slot-selection record sector 1
+ *     0x002000   4KB      trial sector, see boot_trial.h
+ *     0x003000   20KB     reserved
+ *     0x008000   4KB      read timing calibration sector, see boot_ospi_cal.h
+ *     0x009000   28KB     reserved
+ *     0x010000   4032KB   slot A, boot_image_header + image
+ *     0x400000   4032KB   slot B, boot_image_header + image
+ *     0x7F0000   64KB     reserved
+ *
+ * The record sectors are an append-only log of boot_slot_record entries. The
+ * entry with the highest sequence number and a good CRC selects the slot to
+ * boot. Switching slots therefore programs one 32 bytes entry, a sector is only
+ * erased when the other one is full, so a power loss at any point leaves the
+ * previous selection intact.
+ *
+ * An image is linked to run from its own slot, e.g. slot B images have their
+ * vector table at 0x90400400.
+ */
+#ifndef __BOOT_SLOT_H__
+#define __BOOT_SLOT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sfud.h>
+#include "boot_image.h"
+
+#define BOOT_SLOT_RECORD_ADDR                    0x000000UL
+#define BOOT_SLOT_RECORD_SECTOR_SIZE             0x1000UL
+#define BOOT_SLOT_RECORD_SECTOR_NUM              2
+#define BOOT_SLOT_A_ADDR                         0x010000UL
+#define BOOT_SLOT_B_ADDR                         0x400000UL
+#define BOOT_SLOT_SIZE                           0x3F0000UL
+
+/* check the SHA-256 of the image as well as its CRC before booting it */
+#define BOOT_SLOT_VERIFY_HASH
+
+#define BOOT_SLOT_RECORD_MAGIC                   0x544C5342UL /* 'BSLT' */
+
+typedef enum {
+    BOOT_SLOT_A = 0,
+    BOOT_SLOT_B = 1,
+    BOOT_SLOT_NUM,
+    BOOT_SLOT_NONE = 0xFF,
+} boot_slot_id;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_SLOT_RECORD_MAGIC */
+    uint32_t seq;                                /**< sequence number, the highest one is in force */
+    uint8_t active;                              /**< boot_slot_id to boot */
+    uint8_t reserved[19];                        /**< 0xFF */
+    uint32_t crc;                                /**< CRC-32 of all the fields above */
+} boot_slot_record;
+
+uint32_t boot_slot_addr(boot_slot_id slot);
+sfud_err boot_slot_record_read(const sfud_flash *flash, boot_slot_record *record);
+sfud_err boot_slot_record_next(const sfud_flash *flash, uint32_t *addr);
+sfud_err boot_slot_switch(const sfud_flash *flash, boot_slot_id slot);
+boot_slot_id boot_slot_staging(const sfud_flash *flash);
+sfud_err boot_slot_commit(const sfud_flash *flash, boot_slot_id slot, uint32_t size);
+boot_slot_id boot_slot_select(const sfud_flash *flash, boot_image_header *header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_SLOT_H__ */
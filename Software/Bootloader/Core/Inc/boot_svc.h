@@ -0,0 +1,99 @@
+/**
+ * @file boot_svc.h
+ * @brief Service table of the bootloader at a fixed address, the application calls the flash, CRC and hash code.
+ *
+ * The bootloader keeps its flash driver, CRC-32 and SHA-256 in the internal
+ * flash, the application calls them through the table at
+ * BOOT_SVC_TABLE_ADDR instead of linking its own SFUD and running the SFDP
+ * discovery again:
+ *
+ *     const boot_svc_table *svc = (const boot_svc_table *) BOOT_SVC_TABLE_ADDR;
+ *     if (svc->magic == BOOT_SVC_MAGIC && svc->version >= 1) {
+ *         svc->flash_erase(addr, 4096);
+ *         svc->flash_write(addr, size, data);
+ *     }
+ *
+ * The entries only grow at the end of the table, version counts them and
+ * size is sizeof(boot_svc_table) of the bootloader which made it.
+ *
+ * The services run in the context of the application, after the jump, so
+ * they take nothing of the bootloader RAM: no SFUD state, no ITCM copy, no
+ * SysTick count. All the code is in the .text of the internal flash, the
+ * caller's stack is the only RAM used, besides the record of the profiler
+ * in RAM_D3 and the verify base in the backup SRAM; the timeouts count on the DWT cycle counter and the clock of
+ * the RCC registers (see boot_part.h):
+ *
+ *     flash_read   the MAIN flash, from the window in memory-mapped mode
+ *     flash_write  page programs of erased bytes, data not in the window
+ *     flash_erase  the erase units covering the range
+ *     crc32        boot_image_crc32() by the CRC unit, crc 0 to start
+ *     sha256       one SHA-256 of a buffer by the HASH unit
+ *     update_enter the UART update mode without a reset, boot_warm.h
+ *     confirm      ends the trial of a new image, boot_trial.h
+ *     prof_start   starts the PC sampling profiler of boot_pcprof.h
+ *     prof_sample  one PC sample, from an interrupt of the application
+ *     prof_stop    ends the run, the next boot logs it
+ *     verify_step  hashes one sector the boot left unchecked, boot_verify.h
+ *
+ * The flash services serve the part of boot_part.cpp, as found at this boot
+ * by the boot_handoff_info record. The record at BOOT_HANDOFF_INFO_ADDR must
+ * be left as it is, SFUD_ERR_NOT_FOUND otherwise or for another part. In
+ * memory-mapped mode the write and erase pause the XIP like the SFUD port:
+ * the interrupts are masked to the end of the command, a 64KB erase
+ * included (2s at most), and the OCTOSPI1 registers are put back. The
+ * window lines of the range are then dropped from the caches.
+ *
+ * crc32 and sha256 take the CRC and HASH units for the call, the CPU feeds
+ * them, their setup of the application is lost. None of the services is
+ * reentrant, a caller from an interrupt must not preempt another call.
+ *
+ * @note The KV store of boot_kv.h is not in the table: its index is in the
+ *       bootloader RAM and it sits on the EXT flash, whose SPI2 driver is
+ *       the SFUD one. The application reads its records by itself.
+ */
+#ifndef __BOOT_SVC_H__
+#define __BOOT_SVC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sfud_def.h>
+
+/* after the vector table, see the linker script */
+#define BOOT_SVC_TABLE_ADDR                      0x08000400UL
+#define BOOT_SVC_MAGIC                           0x43565342UL /* 'BSVC' */
+#define BOOT_SVC_VERSION                         5
+#define BOOT_SVC_SHA256_SIZE                     32
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_SVC_MAGIC */
+    uint16_t version;                            /**< BOOT_SVC_VERSION */
+    uint16_t size;                               /**< sizeof(boot_svc_table) */
+    /* version 1 */
+    sfud_err (*flash_read)(uint32_t addr, size_t size, uint8_t *data); /**< MAIN flash read */
+    sfud_err (*flash_write)(uint32_t addr, size_t size, const uint8_t *data); /**< MAIN flash program */
+    sfud_err (*flash_erase)(uint32_t addr, size_t size); /**< MAIN flash erase */
+    uint32_t (*crc32)(uint32_t crc, const void *buf, size_t size); /**< zlib CRC-32, continues crc */
+    void (*sha256)(const void *buf, size_t size, uint8_t *digest); /**< BOOT_SVC_SHA256_SIZE bytes digest */
+    /* version 2 */
+    void (*update_enter)(void);                  /**< boot_warm_enter(), no return */
+    /* version 3 */
+    sfud_err (*confirm)(void);                   /**< boot_trial_svc_confirm() */
+    /* version 4 */
+    void (*prof_start)(uint32_t base, uint32_t size); /**< boot_pcprof_svc_start() */
+    void (*prof_sample)(const uint32_t *frame);  /**< boot_pcprof_svc_sample(), see BOOT_PCPROF_SAMPLE() */
+    void (*prof_stop)(void);                     /**< boot_pcprof_svc_stop() */
+    /* version 5 */
+    sfud_err (*verify_step)(void);               /**< boot_verify_svc_step() */
+} boot_svc_table;
+
+extern const boot_svc_table boot_svc;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_SVC_H__ */
@@ -0,0 +1,49 @@
+/**
+ * @file boot_time.h
+ * @brief Monotonic microsecond time of the bootloader, DWT->CYCCNT kept in step by SysTick.
+ *
+ * One clock for the HAL timeouts, the waits of the SFUD port and the log
+ * time:
+ *
+ *     boot_time_us()                  microseconds since boot_profile_init()
+ *     boot_time_deadline(us)          the time us microseconds from now
+ *     boot_time_expired(deadline)     true: the deadline has passed
+ *     boot_time_delay_us(us)          busy wait, the interrupts may be masked
+ *
+ * The time is the one of the last SysTick plus the cycles counted by
+ * DWT->CYCCNT since. CYCCNT stops while
+ * the core sleeps in WFI, SysTick doesn't: each SysTick moves the time on
+ * by its period at least, so a sleep is counted there. With the interrupts
+ * masked, and so no sleep and no SysTick, CYCCNT alone counts, the time
+ * moves on. The readings never go back. The cycles count at the
+ * SystemCoreClock they ran at: a new value is taken at the first reading
+ * after SystemCoreClockUpdate(), the cycles before it at the old one.
+ *
+ * The cycles since the last SysTick must stay below the CYCCNT wrap, 7.8s at
+ * 550MHz: no section keeps the interrupts masked that long.
+ *
+ * HAL_GetTick() and HAL_Delay() are on this clock too, so the HAL timeouts
+ * run with the interrupts masked and HAL_Delay() waits the milliseconds
+ * asked, not one more.
+ */
+#ifndef __BOOT_TIME_H__
+#define __BOOT_TIME_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+uint64_t boot_time_us(void);
+uint64_t boot_time_deadline(uint32_t us);
+bool boot_time_expired(uint64_t deadline);
+void boot_time_delay_us(uint32_t us);
+void boot_time_tick(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_TIME_H__ */
@@ -0,0 +1,116 @@
+/**
+ * @file boot_trace.h
+ * @brief Latency trace of the DMA transfers and the interrupts, a RAM ring of events and a histogram per channel.
+ *
+ * A channel is a pair of events, the begin stamped where a transfer or a
+ * wait starts, the end where its interrupt or completion callback sees it
+ * over. Both push a DWT->CYCCNT stamp and their event ID into the ring of
+ * the record; the end adds the cycles between the two to the count, min,
+ * max and sum of the channel and to its histogram:
+ *
+ *     ospi dma     HAL_OSPI_Receive_DMA() to HAL_OSPI_RxCpltCallback()
+ *     spi2 dma     a DMA transfer of the EXT flash to its SPI2 callback
+ *     usart2 dma   a span of the log to DMA1 stream5 to its completion
+ *     mdma copy    a block of boot_mem.h to its MDMA interrupt
+ *     esp event    HANDSHAKE / DATA_READY EXTI to the SPI3 transaction start
+ *     esp xfer     the SPI3 transaction start to its end
+ *
+ * The histogram has 4 buckets per octave of cycles, the first 4 are 8
+ * cycles wide, the last one takes all above 2^28 (half a second on the
+ * PLL): the percentiles come out within 25 percent, the upper edge of the
+ * bucket the rank falls in. The time spent by the handlers themselves is
+ * in the stamps of the ring, an end right after its begin is the cost of
+ * the call.
+ *
+ * A begin and an end take a few dozen cycles, the interrupts are masked
+ * while the event goes into the ring. A channel has one transfer at a
+ * time, a second begin restarts it. Cycles count the core clock: the HSI
+ * phase of the boot (boot_clock.h) runs at 64MHz.
+ *
+ * The record at BOOT_TRACE_ADDR (RAM_D3, no-init) is cleared at each boot
+ * and published with the other records at the jump; the application reads
+ * it as it reads the profile, boot_handoff_info.trace has the percentiles.
+ * The console prints it with the "trace" command.
+ */
+#ifndef __BOOT_TRACE_H__
+#define __BOOT_TRACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define BOOT_TRACE_ADDR                          0x38001500UL
+#define BOOT_TRACE_MAGIC                         0x43525442UL /* 'BTRC' */
+#define BOOT_TRACE_VERSION                       1
+#define BOOT_TRACE_RING_NUM                      128
+/* octaves of the histogram, the first one is linear */
+#define BOOT_TRACE_HIST_OCTAVES                  24
+#define BOOT_TRACE_HIST_NUM                      (BOOT_TRACE_HIST_OCTAVES * 4)
+/* boot_trace_entry.event: the channel, and the end */
+#define BOOT_TRACE_EVENT_END                     0x80U
+
+typedef enum {
+    BOOT_TRACE_OSPI_DMA = 0,
+    BOOT_TRACE_SPI2_DMA,
+    BOOT_TRACE_USART2_DMA,
+    BOOT_TRACE_MDMA_COPY,
+    BOOT_TRACE_ESP_EVENT,
+    BOOT_TRACE_ESP_XFER,
+    BOOT_TRACE_CH_NUM,
+} boot_trace_ch;
+
+typedef struct {
+    uint32_t cycles;                             /**< DWT->CYCCNT of the event */
+    uint8_t event;                               /**< boot_trace_ch, | BOOT_TRACE_EVENT_END */
+    uint8_t reserved;                            /**< 0 */
+    uint16_t arg;                                /**< bytes of the transfer, 0xFFFF: more */
+} boot_trace_entry;
+
+typedef struct {
+    uint32_t count;                              /**< pairs ended */
+    uint32_t min;                                /**< cycles of the shortest pair */
+    uint32_t max;                                /**< cycles of the longest pair */
+    uint32_t begin;                              /**< DWT->CYCCNT of the open begin */
+    uint64_t sum;                                /**< cycles of all the pairs */
+    uint8_t open;                                /**< 1: begin waits for its end */
+    uint8_t reserved[3];                         /**< 0 */
+    uint16_t hist[BOOT_TRACE_HIST_NUM];          /**< pairs per bucket, 0xFFFF: saturated */
+} boot_trace_stat;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_TRACE_MAGIC when the record is published */
+    uint16_t version;                            /**< BOOT_TRACE_VERSION */
+    uint16_t ch_num;                             /**< BOOT_TRACE_CH_NUM of the bootloader which wrote it */
+    uint32_t core_clock_hz;                      /**< SystemCoreClock at the jump */
+    uint32_t head;                               /**< events pushed, the newest is ring[(head - 1) % NUM] */
+    boot_trace_stat stat[BOOT_TRACE_CH_NUM];     /**< by boot_trace_ch */
+    boot_trace_entry ring[BOOT_TRACE_RING_NUM];
+} boot_trace;
+
+/* the figures of a channel in cycles, see boot_handoff_info.trace */
+typedef struct {
+    uint32_t count;                              /**< pairs ended */
+    uint32_t avg;
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t max;
+} boot_trace_summary;
+
+extern boot_trace boot_trace_record;
+
+void boot_trace_init(void);
+void boot_trace_begin(boot_trace_ch ch, uint32_t arg);
+void boot_trace_end(boot_trace_ch ch, uint32_t arg);
+uint32_t boot_trace_percentile(boot_trace_ch ch, uint32_t pct);
+void boot_trace_summarize(boot_trace_ch ch, boot_trace_summary *summary);
+const char *boot_trace_ch_name(boot_trace_ch ch);
+void boot_trace_finish(void);
+void boot_trace_print(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_TRACE_H__ */
@@ -0,0 +1,77 @@
+/**
+ * @file boot_trial.h
+ * @brief Trial boots of a new image, counted by clearing bits: no erase per boot.
+ *
+ * boot_slot_commit() puts the image it selects on trial. The application
+ * confirms it by the confirm service of boot_svc.h once it runs well; an
+ * image not confirmed after BOOT_TRIAL_BOOTS boots gives way to the other
+ * slot when that one holds a valid image, see boot_slot_select().
+ *
+ * The trial sector of the MAIN flash is an append-only log of
+ * boot_trial_entry, like the slot records: a trial programs one entry, the
+ * sector is only erased when all BOOT_TRIAL_ENTRY_NUM of them are used. The
+ * entry belongs to the slot record of its seq, the one appended by the same
+ * commit right after it, a trial of another selection is over.
+ *
+ * NOR flash programs clear bits and leave the cleared ones as they are, so
+ * the entry is changed in place without an erase:
+ *
+ *     boot      clears the lowest set bit of count, one word programmed;
+ *               the boots taken are the cleared bits (a popcount)
+ *     confirm   clears confirmed, one word programmed
+ *
+ * A boot on trial costs one page program of a few microseconds. A reset in
+ * the middle of it counts the boot or not, both are fine.
+ *
+ * The boot on trial doesn't leave the record of boot_direct.h, a warm reset
+ * takes the full path and so counts as well. The application is told by
+ * BOOT_HANDOFF_IMAGE_TRIAL of boot_handoff.h.
+ */
+#ifndef __BOOT_TRIAL_H__
+#define __BOOT_TRIAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sfud.h>
+#include "boot_slot.h"
+
+/* MAIN flash sector after the slot records */
+#define BOOT_TRIAL_ADDR                          0x002000UL
+#define BOOT_TRIAL_SECTOR_SIZE                   0x1000UL
+#define BOOT_TRIAL_MAGIC                         0x4C525442UL /* 'BTRL' */
+/* boots of a new image before it gives way, unconfirmed */
+#define BOOT_TRIAL_BOOTS                         3
+#define BOOT_TRIAL_COUNT_WORDS                   3
+#define BOOT_TRIAL_ENTRY_NUM                     (BOOT_TRIAL_SECTOR_SIZE / sizeof(boot_trial_entry))
+
+typedef enum {
+    BOOT_TRIAL_NONE = 0,                         /**< no trial for the record in force, or confirmed */
+    BOOT_TRIAL_COUNTED = 1,                      /**< on trial, this boot is counted */
+    BOOT_TRIAL_FAILED = 2,                       /**< all the boots of the trial taken, not confirmed */
+} boot_trial_state;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_TRIAL_MAGIC */
+    uint32_t seq;                                /**< seq of the slot record the trial is for */
+    uint8_t slot;                                /**< boot_slot_id on trial */
+    uint8_t boots;                               /**< boots allowed, BOOT_TRIAL_BOOTS */
+    uint8_t reserved[2];                         /**< 0xFF */
+    uint32_t crc;                                /**< CRC-32 of all the fields above */
+    uint32_t confirmed;                          /**< 0xFFFFFFFF: on trial, 0: confirmed */
+    uint32_t count[BOOT_TRIAL_COUNT_WORDS];      /**< a bit cleared per boot, from bit 0 of count[0] on */
+} boot_trial_entry;
+
+sfud_err boot_trial_start(const sfud_flash *flash, boot_slot_id slot, uint32_t seq);
+boot_trial_state boot_trial_take(const sfud_flash *flash, const boot_slot_record *record);
+bool boot_trial_pending(void);
+sfud_err boot_trial_svc_confirm(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_TRIAL_H__ */
@@ -0,0 +1,148 @@
+/**
+ * @file boot_uart.h
+ * @brief Firmware upload over USART2, windowed binary protocol at multi-megabaud rates.
+ *
+ * No boot waits for a host. boot_uart_arm(), right after the USART2 init,
+ * sets the USART2 character match on the first byte of BOOT_UART_MAGIC; the
+ * match interrupt notes that a frame started and turns itself off. Only
+ * then boot_uart_update() listens BOOT_UART_WAIT_MS for a START frame at the
+ * elog baud rate, a host tool keeps sending START while the board resets.
+ * The interrupt catches the byte whatever the boot does meanwhile, no RX
+ * buffer or DMA runs for it, RDR is simply overwritten.
+ *
+ * The application asks for the update mode by writing BOOT_UART_REQUEST_MAGIC
+ * to the RTC backup register BOOT_UART_REQUEST_BKP and resetting, the direct
+ * path of boot_direct.h steps aside for it. The bootloader clears it and
+ * waits up to BOOT_UART_TIMEOUT_MS for the START frame then:
+ *
+ *     HAL_PWR_EnableBkUpAccess();
+ *     (&RTC->BKP0R)[BOOT_UART_REQUEST_BKP] = BOOT_UART_REQUEST_MAGIC;
+ *     NVIC_SystemReset();
+ *
+ * boot_warm.h gets there without the reset, the clock tree kept.
+ *
+ * A CONSOLE frame in place of START, or BOOT_UART_CONSOLE_MAGIC in the
+ * register, opens the service console of boot_console.h at the link baud
+ * rate; its upload command goes on with the binary upload below.
+ *
+ * The link starts at BOOT_UART_BAUD_DEFAULT. A BAUD frame before START or
+ * CONSOLE raises it for the rest of the boot, the console, the upload and
+ * the log after them, up to BOOT_UART_BAUD_MAX:
+ *
+ *     host                                device
+ *     BAUD arg: rate, len 0       --->
+ *                                 <---    ack OK at the old rate, or ERR_BAUD
+ *     switches after the ack plus BOOT_UART_BAUD_SWITCH_MS
+ *     BAUD arg: rate, pattern     --->    at the new rate
+ *                                 <---    ack OK at the new rate
+ *
+ * The pattern is BOOT_UART_BAUD_PATTERN_SIZE bytes, byte i is i ^ 0x55.
+ * The device picks the oversampling (16, else 8) and the USART2 kernel
+ * clock prescaler with the closest BRR, the TX and RX FIFOs are on from
+ * then on. Without the pattern, a good CRC and its ack within
+ * BOOT_UART_BAUD_CONFIRM_MS both sides go back to the old rate; the host
+ * may try a lower one. A host that misses the last ack resets the board.
+ * The application sets USART2 up again at the jump.
+ *
+ * Every frame is a boot_uart_frame header, len bytes of payload and the CRC-32
+ * (zlib) of the header and the payload, little-endian:
+ *
+ *     START  offset: bytes to upload, header area included; arg: baud rate of the transfer, 0: the link one
+ *     DATA   seq counts up from 0, offset: slot offset of the payload, in order
+ *     END    seq: the next DATA seq, all the data is acknowledged
+ *
+ * The device answers with boot_uart_ack. START is acknowledged at the old baud
+ * rate, the host switches to the new one when it has the ack plus
+ * BOOT_UART_BAUD_SWITCH_MS. The host may send up to ack.window DATA frames
+ * after the last acknowledged one; the device acknowledges every
+ * BOOT_UART_ACK_BATCH frames, and whenever the line goes idle. A NAK carries
+ * the seq to go back to, the frames up to it are taken already. The
+ * staging slot is erased ahead in 64KB blocks, so an acknowledge may take a
+ * block erase time (~1s worst case) to come.
+ *
+ * The data goes to the slot which isn't booted, see boot_slot.h. END checks
+ * the uploaded header and makes the slot the selected one, the image itself is
+ * checked by boot_slot_select() on the way to it, a bad one falls back to the
+ * other slot.
+ */
+#ifndef __BOOT_UART_H__
+#define __BOOT_UART_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sfud.h>
+
+#define BOOT_UART_MAGIC                          0x5542U /* 'BU' */
+#define BOOT_UART_CHUNK_SIZE                     1024
+#define BOOT_UART_WINDOW                         8
+#define BOOT_UART_ACK_BATCH                      4
+#define BOOT_UART_WAIT_MS                        20
+#define BOOT_UART_TIMEOUT_MS                     3000
+#define BOOT_UART_BAUD_SWITCH_MS                 2
+/* MX_USART2_UART_Init(), the rate of the match and of the elog output till a BAUD frame */
+#define BOOT_UART_BAUD_DEFAULT                   115200
+#define BOOT_UART_BAUD_MAX                       4000000
+/* the BRR rounding error, the receiver of either side takes about twice it */
+#define BOOT_UART_BAUD_TOLERANCE_PERMILLE        20
+#define BOOT_UART_BAUD_CONFIRM_MS                100
+#define BOOT_UART_BAUD_PATTERN_SIZE              256
+/* RTC->BKP27R, right below the ones of boot_verify.h */
+#define BOOT_UART_REQUEST_BKP                    27
+#define BOOT_UART_REQUEST_MAGIC                  0x44505542UL /* 'BUPD' */
+/* the service console of boot_console.h instead */
+#define BOOT_UART_CONSOLE_MAGIC                  0x4E4F4342UL /* 'BCON' */
+/* BOOT_USB_REQUEST_MAGIC of boot_usb.h, the USB update mode, is left to it */
+/* the character match only notes a flag */
+#define BOOT_UART_IRQ_PRIORITY                   7
+
+typedef enum {
+    BOOT_UART_CMD_START = 1,
+    BOOT_UART_CMD_DATA = 2,
+    BOOT_UART_CMD_END = 3,
+    BOOT_UART_CMD_CONSOLE = 4,                   /**< in place of START: the service console, boot_console.h */
+    BOOT_UART_CMD_BAUD = 5,                      /**< before START or CONSOLE: the link baud rate */
+} boot_uart_cmd;
+
+typedef enum {
+    BOOT_UART_OK = 0,
+    BOOT_UART_NAK = 1,                           /**< resend from ack.seq */
+    BOOT_UART_ERR_SIZE = 2,                      /**< the upload doesn't fit the slot */
+    BOOT_UART_ERR_FLASH = 3,                     /**< erase or program failed, the upload is aborted */
+    BOOT_UART_ERR_IMAGE = 4,                     /**< END: the uploaded header is invalid */
+    BOOT_UART_ERR_BAUD = 5,                      /**< BAUD: the rate can't be made from PCLK1 */
+} boot_uart_status;
+
+typedef struct {
+    uint16_t magic;                              /**< BOOT_UART_MAGIC */
+    uint8_t cmd;                                 /**< boot_uart_cmd */
+    uint8_t reserved;                            /**< 0 */
+    uint16_t seq;                                /**< DATA sequence number */
+    uint16_t len;                                /**< payload bytes, BOOT_UART_CHUNK_SIZE at most */
+    uint32_t offset;                             /**< see the commands */
+    uint32_t arg;                                /**< see the commands */
+} boot_uart_frame;
+
+typedef struct {
+    uint16_t magic;                              /**< BOOT_UART_MAGIC */
+    uint8_t status;                              /**< boot_uart_status */
+    uint8_t window;                              /**< DATA frames the host may have unacknowledged */
+    uint16_t seq;                                /**< next DATA seq expected, the ones before are written */
+    uint16_t reserved;                           /**< 0 */
+} boot_uart_ack;
+
+void boot_uart_arm(void);
+bool boot_uart_request_pending(void);
+bool boot_uart_update(const sfud_flash *flash);
+size_t boot_uart_read(void *buf, size_t len);
+void boot_uart_irq_handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_UART_H__ */
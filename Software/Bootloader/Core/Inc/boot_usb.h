@@ -0,0 +1,68 @@
+/**
+ * @file boot_usb.h
+ * @brief Firmware upload over USB, a vendor bulk interface of OTG_HS on its full-speed PHY.
+ *
+ * OTG_HS runs the embedded full-speed PHY (PA11 DM, PA12 DP), the board has
+ * no ULPI PHY: 12Mbit/s, about a megabyte a second of bulk data against
+ * the 115200 baud of the default UART link, and a USB cable is all the
+ * production line needs. The kernel clock is HSI48, trimmed by the CRS on
+ * the SOF of the host. No VBUS pin is sensed, the B-session is forced valid.
+ * The driver is polled, register level, the HAL PCD is not part of the
+ * tree.
+ *
+ * No boot attaches by itself, the enumeration takes the host too long for
+ * every boot. The application asks for it like for the UART update, with
+ * BOOT_USB_REQUEST_MAGIC in the request register of boot_uart.h and a
+ * reset; the direct path steps aside for it:
+ *
+ *     HAL_PWR_EnableBkUpAccess();
+ *     (&RTC->BKP0R)[BOOT_UART_REQUEST_BKP] = BOOT_USB_REQUEST_MAGIC;
+ *     NVIC_SystemReset();
+ *
+ * The device is BOOT_USB_VID:BOOT_USB_PID, one interface of class 0xFF
+ * with bulk OUT endpoint 0x01 and bulk IN endpoint 0x81, the MS OS 2.0
+ * descriptors bind WinUSB to it without a driver package. The serial
+ * number is the 96-bit device UID in hex.
+ *
+ * The frames and acks are the boot_uart.h ones, START, DATA and END, CRC
+ * included, one frame per bulk OUT transfer: the host ends it with a short
+ * packet, a zero-length one when the frame size is a multiple of 64. The
+ * device acknowledges START and END on the bulk IN endpoint, and stops at
+ * the first error with its ack; the DATA frames take no ack, the USB
+ * handshake is the flow control. Two frame buffers take turns: the next
+ * frame comes in while the flash programs the payload of the last one
+ * straight from its buffer, and the endpoint NAKs while both are taken,
+ * the erase ahead of the data included (~1s for a 64KB block worst case).
+ *
+ * The data goes to the slot which isn't booted and END selects it, see
+ * boot_uart.h; a compressed or delta image is expanded by the install
+ * engine of boot_install.h from the slot, the same as an UART upload.
+ */
+#ifndef __BOOT_USB_H__
+#define __BOOT_USB_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <sfud.h>
+
+/* the pid.codes test pair, a product gets its own */
+#define BOOT_USB_VID                             0x1209
+#define BOOT_USB_PID                             0x0001
+/* the request register of boot_uart.h, BOOT_UART_REQUEST_BKP */
+#define BOOT_USB_REQUEST_MAGIC                   0x42535542UL /* 'BUSB' */
+/* the enumeration and the START frame, then each frame */
+#define BOOT_USB_TIMEOUT_MS                      5000
+/* bRequest of the MS OS 2.0 descriptor set */
+#define BOOT_USB_MS_VENDOR_CODE                  0x01
+
+bool boot_usb_request_pending(void);
+bool boot_usb_update(const sfud_flash *flash);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_USB_H__ */
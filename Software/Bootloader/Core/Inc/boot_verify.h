@@ -0,0 +1,123 @@
+/**
+ * @file boot_verify.h
+ * @brief Cache of the last fully verified image, later boots check a rotating sample of it.
+ *
+ * After boot_slot_select() checked the CRC and the SHA-256 of an image it
+ * seals the result: the CRC-32 of every BOOT_VERIFY_SECTOR_SIZE sector of the
+ * image goes to the backup SRAM, the slot, the header CRC, the next sector to
+ * sample and the CRC of it all to the RTC backup registers
+ * BOOT_VERIFY_BKP_FIRST and on. A later boot of the same slot with the same
+ * header only checks the header and BOOT_VERIFY_SAMPLE_SECTORS sectors, the
+ * sample moves on each boot, so every sector gets checked again within
+ * sectors / BOOT_VERIFY_SAMPLE_SECTORS boots. An upload checked as it was
+ * received (boot_recv.h) is sealed by boot_slot_commit() already, with the
+ * sector CRCs taken on the way, its first boot is a sampled one.
+ *
+ * The full checks run again when
+ *  - the seal doesn't check out, e.g. the backup domain lost VBAT
+ *  - a tamper event was flagged, it also erases the backup registers
+ *  - an update committed a slot which wasn't checked as received
+ *  - the slot or the header of the image to boot is another one
+ *  - a sampled sector doesn't match, the image is checked in full then
+ *
+ * An image with BOOT_IMAGE_FLAG_SECTOR_HASH (see boot_image.h) is tracked
+ * per sector and per slot instead. Its full check seals a boot_verify_base
+ * for the slot in the backup SRAM: the first BOOT_VERIFY_DIGEST_SIZE bytes
+ * of the SHA-256 of each sector, all marked clean. Whatever erases a range
+ * of the MAIN flash calls boot_verify_dirty() first (the install engine, the
+ * UART and ESP downloads, the agent), which marks the sectors of the range
+ * dirty. The next check of the slot, after boot_slot_commit(), hashes the
+ * dirty sectors and those whose digest in the new sector table is another
+ * one; a clean sector with the same digest is taken as it is. A delta or
+ * partial install is then checked at the cost of what it wrote. The sample
+ * of such an image hashes its sectors against the base, no sector CRC is
+ * kept for it.
+ *
+ * Built with BOOT_VERIFY_DEFER the full check of such an image hashes the
+ * sectors the boot needs at once only: the first one, with the vector table
+ * and the startup code, the one of the vector table and those the section
+ * table loads to the RAM. The others are left out of the base, their clean
+ * bits clear, and the base is sealed with deferred BOOT_VERIFY_DEFER_PENDING:
+ * the application hashes them in the background by the verify_step service
+ * of boot_svc.h, one sector a call, each one marked clean as it passes. The
+ * last one sets deferred back to BOOT_VERIFY_DEFER_NONE, the next boot finds
+ * all the sectors clean and seals the image. A sector which doesn't pass
+ * sets BOOT_VERIFY_DEFER_FAILED. A boot which finds the base of the slot
+ * still pending or failed defers nothing, it hashes what's left: a bad
+ * sector fails the slot and the boot falls back to the other one, see
+ * boot_slot_select(). An image is only booted sampled once the application
+ * ran its check to the end, and no warm reset takes the direct path to it
+ * before. RAM and encrypted images are checked in full, the whole RAM copy
+ * is read anyway and the window shows an encrypted image decrypted.
+ *
+ * @note An application which erases or programs a slot itself invalidates
+ *       the base of the slot, writing 0 to its magic (boot_verify_base_addr()),
+ *       or the next boot trusts sectors it didn't hash.
+ */
+#ifndef __BOOT_VERIFY_H__
+#define __BOOT_VERIFY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sfud.h>
+#include "boot_slot.h"
+
+#define BOOT_VERIFY_MAGIC                        0x46525642UL /* 'BVRF' */
+#define BOOT_VERIFY_VERSION                      1
+#define BOOT_VERIFY_BASE_MAGIC                   0x53425642UL /* 'BVBS' */
+#define BOOT_VERIFY_SECTOR_SIZE                  BOOT_IMAGE_SECTOR_SIZE
+#define BOOT_VERIFY_SECTOR_NUM                   ((BOOT_SLOT_SIZE - BOOT_IMAGE_HEADER_SIZE + BOOT_VERIFY_SECTOR_SIZE - 1) / BOOT_VERIFY_SECTOR_SIZE)
+#define BOOT_VERIFY_SAMPLE_SECTORS               4
+/* RTC->BKP28R..BKP31R, BKP27R is the update request of boot_uart.h, the ones below are left to the application */
+#define BOOT_VERIFY_BKP_FIRST                    28
+/* bytes of each sector SHA-256 a base keeps, what tells two digests of the sector table apart */
+#define BOOT_VERIFY_DIGEST_SIZE                  16
+#define BOOT_VERIFY_CLEAN_WORDS                  ((BOOT_VERIFY_SECTOR_NUM + 31) / 32)
+
+/* boot_verify_base.deferred */
+#define BOOT_VERIFY_DEFER_NONE                   0
+#define BOOT_VERIFY_DEFER_PENDING                1
+#define BOOT_VERIFY_DEFER_FAILED                 2
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_VERIFY_MAGIC */
+    uint8_t version;                             /**< BOOT_VERIFY_VERSION */
+    uint8_t slot;                                /**< boot_slot_id verified */
+    uint8_t sample;                              /**< first sector of the next sample */
+    uint8_t reserved;                            /**< 0 */
+    uint32_t header_crc;                         /**< header_crc of the verified image */
+    uint32_t crc;                                /**< CRC-32 of the fields above and of the sector table */
+} boot_verify_seal;
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_VERIFY_BASE_MAGIC */
+    uint32_t sectors;                            /**< sectors of the image the base was sealed for */
+    uint32_t clean[BOOT_VERIFY_CLEAN_WORDS];     /**< bit per sector, not erased since */
+    uint8_t digest[BOOT_VERIFY_SECTOR_NUM][BOOT_VERIFY_DIGEST_SIZE]; /**< SHA-256 of each sector, truncated */
+    uint32_t deferred;                           /**< BOOT_VERIFY_DEFER_xxx, the clean bits clear are left to the app */
+    uint32_t crc;                                /**< CRC-32 of all the fields above */
+} boot_verify_base;
+
+void boot_verify_clear(void);
+bool boot_verify_cached(boot_slot_id slot, const boot_image_header *header);
+bool boot_verify_sample(const boot_image_header *header);
+void boot_verify_seal_image(boot_slot_id slot, const boot_image_header *header);
+void boot_verify_seal_crcs(boot_slot_id slot, const boot_image_header *header, const uint32_t *sector_crc);
+bool boot_verify_sampled(void);
+void boot_verify_dirty(const sfud_flash *flash, uint32_t addr, size_t size);
+bool boot_verify_sector_clean(boot_slot_id slot, uint32_t sector, const uint8_t *digest);
+void boot_verify_base_seal(boot_slot_id slot, const uint8_t *table, uint32_t sectors, const uint32_t *pending);
+uint32_t boot_verify_base_deferred(boot_slot_id slot);
+uint32_t boot_verify_deferred(void);
+boot_verify_base *boot_verify_base_addr(boot_slot_id slot);
+sfud_err boot_verify_svc_step(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_VERIFY_H__ */
@@ -0,0 +1,56 @@
+/**
+ * @file boot_warm.h
+ * @brief Update mode entered from the application without a reset, the clock tree of the boot is kept.
+ *
+ * The update request of boot_uart.h resets the MCU: the next boot runs its
+ * first stages on the 64MHz HSI and waits the HSE start and the PLL lock in
+ * boot_clock_switch(). boot_warm_enter() gets there without the reset, from
+ * the service table of boot_svc.h:
+ *
+ *     const boot_svc_table *svc = (const boot_svc_table *) BOOT_SVC_TABLE_ADDR;
+ *     if (svc->magic == BOOT_SVC_MAGIC && svc->version >= 2) {
+ *         svc->update_enter();            // no return
+ *     }
+ *
+ * It writes the update request, then checks the clock tree is still the one
+ * the boot handed over (the RCC registers of boot_handoff_info.clock, SYSCLK
+ * on PLL1). If so it takes the MCU back to the state of a reset but for the
+ * clocks: the interrupts and SysTick off, the MAIN flash out of
+ * memory-mapped mode and continuous read, the peripherals of the AHB and
+ * APB buses reset, the caches and the MPU off, VTOR on the bootloader. It
+ * leaves BOOT_WARM_MAGIC in boot_warm_flag and branches to Reset_Handler.
+ * SystemInit() keeps the RCC as it is for the flag, the startup sets the
+ * RAM up as after a warm reset, and main() runs the full path on the PLL
+ * from the start: boot_clock_switch() only re-times the peripherals, the
+ * SFUD probe cache skips the SFDP discovery and boot_uart_update() waits
+ * for the host. Otherwise, or when called from an interrupt handler, it
+ * falls back to NVIC_SystemReset() with the request written.
+ *
+ * The watchdogs keep running through the entry: an IWDG1 started by the
+ * application resets the MCU in the middle of the update, which then takes
+ * the reset path.
+ */
+#ifndef __BOOT_WARM_H__
+#define __BOOT_WARM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BOOT_WARM_MAGIC                          0x4D525742UL /* 'BWRM' */
+
+extern uint32_t boot_warm_flag;
+
+void boot_warm_enter(void) __attribute__((noreturn));
+bool boot_warm_pending(void);
+void boot_warm_take(uint32_t reset_flags);
+bool boot_warm_entered(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOOT_WARM_H__ */
@@ -0,0 +1,97 @@
+/**
+ * @file dma_alloc.h
+ * @brief DMA buffer allocation per RAM bank, and the D-cache upkeep around a transfer.
+ *
+ * main() turns the D-cache on before anything else, a DMA buffer in a
+ * cacheable bank needs its lines written back before the DMA reads it and
+ * dropped before the CPU reads what the DMA wrote. dma_alloc() hands out
+ * buffers on DMA_ALIGN (the cache line), whole lines, from a static arena per
+ * bank, so the upkeep of one buffer never touches another one:
+ *
+ *     region            bank                  reached by               cached
+ *     DMA_REGION_DTCM   DTCM 0x20000000       CPU, MDMA (AHBS)         no
+ *     DMA_REGION_AXI    RAM_D1 0x24000000     MDMA, DMA1/2             WBWA
+ *     DMA_REGION_D2     RAM_D2 0x30000000     MDMA, DMA1/2             WBWA
+ *     DMA_REGION_D3     RAM_D3 0x38000000     MDMA, DMA1/2, BDMA       WBWA
+ *
+ * RAM_D3 is cached in the bootloader, which runs without the MPU, and
+ * non-cacheable in the application (boot_handoff.h); the upkeep is right for
+ * both.
+ *
+ * dma_alloc() buffers are taken once, at the setup of their driver, and never
+ * returned. A phase that needs large buffers for a while only, an install or
+ * the benchmark, takes them from the other end of the arena, in a scope:
+ *
+ *     mark = dma_alloc_mark(region)      opens a scope
+ *     buf = dma_alloc_temp(size, region) from the top of the arena, NULL: used up
+ *     dma_alloc_release(region, mark)    returns all temp buffers taken since
+ *
+ * Scopes nest, the permanent buffers of a driver set up inside one aren't
+ * touched by its release. The contents are undefined, a temp buffer holds
+ * what the last scope left. For packets handed around at run time see
+ * dma_pool.h. dma_alloc_get_stats() keeps the high-water mark of each arena,
+ * the sizes below are set from it.
+ *
+ *     dma_prepare_tx(buf, len)      before a DMA reads buf: the lines are written back
+ *     dma_prepare_rx(buf, len)      before a DMA writes buf: no dirty line is evicted over it
+ *     dma_complete_rx(buf, len)     after it's done: the CPU reads the new data
+ *
+ * The calls work on any buffer, not only allocated ones; a buffer in the
+ * TCMs needs nothing. dma_prepare_rx() and dma_complete_rx() refuse a buffer
+ * that doesn't start and end on a line, dropping the lines would drop a
+ * neighbour's data as well.
+ *
+ * @note The SCB_CleanInvalidateDCache() left in the port (after a chip
+ *       erase through the XIP window), the handoff and the scatter jump
+ *       cover the whole RAM on purpose, they're not the upkeep of a DMA
+ *       buffer.
+ */
+#ifndef __DMA_ALLOC_H__
+#define __DMA_ALLOC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DMA_ALIGN                                32
+/* arena bytes per bank, what isn't taken by the sections of the banks */
+#define DMA_ARENA_DTCM_SIZE                      (4 * 1024)
+/* the permanent buffers and the temp ones of boot_install.c, the largest scope */
+#define DMA_ARENA_AXI_SIZE                       (88 * 1024)
+#define DMA_ARENA_D2_SIZE                        (4 * 1024)
+#define DMA_ARENA_D3_SIZE                        (2 * 1024)
+
+typedef enum {
+    DMA_REGION_DTCM = 0,
+    DMA_REGION_AXI = 1,
+    DMA_REGION_D2 = 2,
+    DMA_REGION_D3 = 3,
+    DMA_REGION_NUM,
+} dma_region;
+
+typedef struct {
+    size_t size;                                 /**< arena bytes */
+    size_t used;                                 /**< bytes taken now, permanent and temp */
+    size_t peak;                                 /**< most bytes taken so far */
+    uint32_t fails;                              /**< dma_alloc() and dma_alloc_temp() that found no room */
+} dma_alloc_stats;
+
+void *dma_alloc(size_t size, dma_region region);
+size_t dma_alloc_left(dma_region region);
+size_t dma_alloc_mark(dma_region region);
+void *dma_alloc_temp(size_t size, dma_region region);
+void dma_alloc_release(dma_region region, size_t mark);
+void dma_alloc_get_stats(dma_region region, dma_alloc_stats *stats);
+void dma_prepare_tx(const void *buf, size_t len);
+bool dma_prepare_rx(void *buf, size_t len);
+bool dma_complete_rx(void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DMA_ALLOC_H__ */
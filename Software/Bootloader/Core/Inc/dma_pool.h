@@ -0,0 +1,55 @@
+/**
+ * @file dma_pool.h
+ * @brief Fixed-block pool of DMA buffers in RAM_D2, handed around by reference.
+ *
+ * DMA_POOL_BLOCKS blocks of DMA_POOL_BLOCK_SIZE bytes in the .ram_d2 section,
+ * which the DMA1/DMA2 masters and the MDMA reach. A block starts on a cache
+ * line and takes whole lines, the maintenance of one block never touches
+ * another one. A block is passed around as its pointer: the ESP-Hosted
+ * transport fills it, the download programs the flash straight from it, a
+ * holder that keeps it longer than its caller takes a reference:
+ *
+ *     buf = dma_pool_alloc()        one reference, NULL: the pool is empty
+ *     dma_pool_ref(buf)             one more holder
+ *     dma_pool_free(buf)            one holder less, the last one returns it
+ *
+ * RAM_D2 stays cacheable, in the bootloader (no MPU) as in the application
+ * (region 5 of boot_handoff.h), the upkeep around a transfer is the one of
+ * dma_alloc.h: dma_prepare_tx(), dma_prepare_rx() and dma_complete_rx().
+ *
+ * @note The calls mask the interrupts for a few instructions, an interrupt
+ *       handler may allocate and free too. Like esp_spi.h, no boot module is
+ *       used, the application links the pool alike.
+ */
+#ifndef __DMA_POOL_H__
+#define __DMA_POOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* an ESP-Hosted frame, 50 cache lines */
+#define DMA_POOL_BLOCK_SIZE                      1600
+/* 25KB of the 32KB of RAM_D2 */
+#define DMA_POOL_BLOCKS                          16
+
+typedef struct {
+    uint32_t allocs;                             /**< blocks handed out */
+    uint32_t fails;                              /**< dma_pool_alloc() with the pool empty */
+    uint32_t free_min;                           /**< fewest free blocks so far */
+} dma_pool_stats;
+
+void *dma_pool_alloc(void);
+void dma_pool_ref(void *block);
+void dma_pool_free(void *block);
+uint32_t dma_pool_free_count(void);
+void dma_pool_get_stats(dma_pool_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DMA_POOL_H__ */
@@ -0,0 +1,104 @@
+/**
+ * @file esp_spi.h
+ * @brief ESP-Hosted SPI host transport to the ESP32-C3 (SPI3), interrupt driven.
+ *
+ * Every transaction is one full-duplex DMA transfer of ESP_SPI_FRAME_SIZE
+ * bytes, mode 3. Each frame starts with the esp_spi_header of ESP-Hosted, the
+ * sum of all bytes of header and payload is its checksum, a frame with len 0
+ * is empty. The slave raises HANDSHAKE (PD2) when it can take a transaction,
+ * DATA_READY (PD3) when it has something to send; both are EXTI rising edges.
+ *
+ * The interrupts start the next transaction as soon as HANDSHAKE is high and
+ * either a TX frame is queued or DATA_READY is high, and the RX queue has room.
+ * Nothing is copied, the frames are blocks of dma_pool.h, the caller fills and
+ * reads them where the DMA does:
+ *
+ *     frame = esp_spi_tx_get()      a free TX frame, NULL: ESP_SPI_TX_FRAMES are taken
+ *     esp_spi_tx_put(frame)         header and payload filled, the checksum is set here
+ *     frame = esp_spi_rx_get()      the oldest frame received, checksum good, not empty
+ *     esp_spi_rx_release(frame)     drops the reference of esp_spi_rx_get()
+ *
+ * With no TX frame queued an empty frame is sent. A received frame may be
+ * kept as long as needed, e.g. by a background flash program reading it, or
+ * passed on with dma_pool_ref(). The slave waits on DATA_READY while
+ * ESP_SPI_RX_FRAMES frames wait for esp_spi_rx_get(), or the pool is empty,
+ * that's the flow control. The callback of esp_spi_set_notify() runs in the
+ * handlers after every transaction, a caller sleeping between frames (e.g.
+ * a task of boot_sched.h) wakes on it instead of polling.
+ *
+ * The owner of the vector table calls esp_spi_exti_irq_handler() from
+ * EXTI2_IRQHandler() and EXTI3_IRQHandler(), esp_spi_dma_rx_irq_handler()
+ * from DMA1_Stream3_IRQHandler(), esp_spi_dma_tx_irq_handler() from
+ * DMA1_Stream4_IRQHandler() and esp_spi_irq_handler() from SPI3_IRQHandler().
+ * No HAL callback is used, the bootloader and the application link the
+ * module alike.
+ *
+ * @note The counters count DWT cycles, CYCCNT must be running
+ *       (boot_profile_init()).
+ */
+#ifndef __ESP_SPI_H__
+#define __ESP_SPI_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* whole cache lines, DMA_POOL_BLOCK_SIZE at most */
+#define ESP_SPI_FRAME_SIZE                       1600
+/* TX frames taken by the caller or queued, RX frames waiting for esp_spi_rx_get() */
+#define ESP_SPI_TX_FRAMES                        4
+#define ESP_SPI_RX_FRAMES                        2
+/* below the SysTick, the frames are turned around in the handlers */
+#define ESP_SPI_IRQ_PRIORITY                     6
+
+/* esp_payload_header of ESP-Hosted */
+typedef struct __attribute__((packed)) {
+    uint8_t if_type_num;                         /**< if_type in the low nibble, if_num in the high one */
+    uint8_t flags;                               /**< 0 */
+    uint16_t len;                                /**< payload bytes */
+    uint16_t offset;                             /**< payload offset from the header start */
+    uint16_t checksum;                           /**< sum of the header and payload bytes, this field as 0 */
+    uint16_t seq_num;                            /**< packet sequence number */
+    uint8_t reserved2;                           /**< 0 */
+    uint8_t reserved3;                           /**< 0 */
+} esp_spi_header;
+
+typedef struct {
+    uint32_t xfers;                              /**< transactions clocked */
+    uint32_t tx_frames;                          /**< queued frames sent */
+    uint32_t rx_frames;                          /**< frames handed to esp_spi_rx_get() */
+    uint32_t tx_bytes;                           /**< header and payload bytes of tx_frames */
+    uint32_t rx_bytes;                           /**< header and payload bytes of rx_frames */
+    uint32_t rx_dropped;                         /**< received frames with a bad length or checksum */
+    uint32_t errors;                             /**< failed transactions, their TX frame is dropped */
+    uint32_t stalls;                             /**< times the slave had data but no RX frame was free */
+    uint32_t busy_cycles;                        /**< cycles with a transaction on, CS low to its end */
+    uint32_t start_cycles;                       /**< cycles from the event allowing a transaction to its start */
+    uint32_t start_cycles_max;                   /**< longest of them */
+} esp_spi_stats;
+
+bool esp_spi_init(void);
+void esp_spi_deinit(void);
+bool esp_spi_data_ready(void);
+bool esp_spi_tx_busy(void);
+uint32_t esp_spi_tx_pending(void);
+uint8_t *esp_spi_tx_get(void);
+void esp_spi_tx_put(uint8_t *frame);
+uint8_t *esp_spi_rx_get(void);
+void esp_spi_rx_release(uint8_t *frame);
+void esp_spi_set_notify(void (*notify)(void));
+void esp_spi_get_stats(esp_spi_stats *stats);
+uint16_t esp_spi_checksum(const uint8_t *frame);
+void esp_spi_exti_irq_handler(void);
+void esp_spi_dma_rx_irq_handler(void);
+void esp_spi_dma_tx_irq_handler(void);
+void esp_spi_irq_handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ESP_SPI_H__ */
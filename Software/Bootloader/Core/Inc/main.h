@@ -59,6 +59,10 @@ void Error_Handler(void);
 /* Private defines -----------------------------------------------------------*/
 #define FLASH_CS_Pin GPIO_PIN_12
 #define FLASH_CS_GPIO_Port GPIOB
+#define ESP_EN_Pin GPIO_PIN_4
+#define ESP_EN_GPIO_Port GPIOD
+#define ESP_BOOT_Pin GPIO_PIN_5
+#define ESP_BOOT_GPIO_Port GPIOD
 
 /* USER CODE BEGIN Private defines */
 
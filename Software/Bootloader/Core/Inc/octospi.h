@@ -35,7 +35,7 @@ extern "C" {
 extern OSPI_HandleTypeDef hospi1;
 
 /* USER CODE BEGIN Private defines */
-
+extern MDMA_HandleTypeDef hmdma_octospi1_fifo_th;
 /* USER CODE END Private defines */
 
 void MX_OCTOSPI1_Init(void);
@@ -0,0 +1,69 @@
+/**
+ * @file spsc_ring.h
+ * @brief Single-producer single-consumer byte ring, lock-free between a handler and the thread, and DMA spans.
+ *
+ * The ring is a power of two bytes. Head and tail count bytes put and taken
+ * since the init, they run free and wrap at 2^32, their difference is the
+ * fill; the position in the buffer is the count masked by size - 1. All the
+ * bytes are usable, there's no full flag to share. The producer only writes
+ * head, the consumer only tail, each one reads the other once per call: a
+ * handler on one side and the thread on the other need no interrupt
+ * masking. The data goes in before head moves, and is read before tail
+ * moves (a DMB each, the DMA sees the same order).
+ *
+ *     spsc_ring_write(ring, data, len)    producer, copies what fits
+ *     spsc_ring_read(ring, data, len)     consumer, copies what is there
+ *     spsc_ring_peek(ring, off, data, n)  consumer, copies without taking
+ *
+ * A DMA works on the ring in place, one contiguous span at a time:
+ *
+ *     n = spsc_ring_read_span(ring, 0, &p)     bytes at p, up to the buffer end
+ *     ... DMA sends p[0..n) ...
+ *     spsc_ring_consume(ring, n)               at its completion
+ *
+ *     n = spsc_ring_write_span(ring, &p)       free bytes at p, up to the buffer end
+ *     ... filled in place ...
+ *     spsc_ring_commit(ring, n)
+ *
+ * A circular DMA filling the whole buffer is a producer which doesn't
+ * look at tail: spsc_ring_dma_head() moves head up to its position. An
+ * overrun isn't seen there, the data of such a ring needs its own check
+ * (the frame CRC of boot_uart.h).
+ *
+ * @note The ring doesn't touch the D-cache. A DMA buffer takes the upkeep of
+ *       dma_alloc.h on its spans, the buffer on DMA_ALIGN.
+ */
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    uint8_t *buf;                                /**< size bytes */
+    uint32_t mask;                               /**< size - 1, size a power of two */
+    volatile uint32_t head;                      /**< bytes put, the producer's */
+    volatile uint32_t tail;                      /**< bytes taken, the consumer's */
+} spsc_ring;
+
+void spsc_ring_init(spsc_ring *ring, void *buf, size_t size);
+size_t spsc_ring_used(const spsc_ring *ring);
+size_t spsc_ring_free(const spsc_ring *ring);
+size_t spsc_ring_write(spsc_ring *ring, const void *data, size_t len);
+size_t spsc_ring_read(spsc_ring *ring, void *data, size_t len);
+size_t spsc_ring_peek(const spsc_ring *ring, size_t offset, void *data, size_t len);
+size_t spsc_ring_write_span(const spsc_ring *ring, uint8_t **data);
+void spsc_ring_commit(spsc_ring *ring, size_t len);
+size_t spsc_ring_read_span(const spsc_ring *ring, size_t offset, uint8_t **data);
+void spsc_ring_consume(spsc_ring *ring, size_t len);
+void spsc_ring_dma_head(spsc_ring *ring, size_t pos);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SPSC_RING_H__ */
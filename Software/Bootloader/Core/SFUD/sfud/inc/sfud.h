@@ -92,6 +92,35 @@ const sfud_flash *sfud_get_device_table(void);
  * @return result
  */
 sfud_err sfud_qspi_fast_read_enable(sfud_flash *flash, uint8_t data_line_width);
+
+/**
+ * make sure the QE bit the quad reads and programs need is set, a volatile one is set again after a power cycle
+ *
+ * @param flash flash device, indirect mode
+ *
+ * @return result, SFUD_ERR_WRITE: the QE bit can't be set
+ */
+sfud_err sfud_qspi_quad_check(const sfud_flash *flash);
+
+#ifdef SFUD_USING_QSPI_QPI
+/**
+ * put the flash in QPI (4-4-4) mode by its SFDP basic table, after sfud_qspi_fast_read_enable(flash, 4)
+ *
+ * @param flash flash device, indirect mode
+ *
+ * @return result, SFUD_ERR_NOT_FOUND: no QPI mode on this flash
+ */
+sfud_err sfud_qspi_qpi_enable(sfud_flash *flash);
+
+/**
+ * leave the QPI mode, the quad read of sfud_qspi_fast_read_enable(flash, 4) is back
+ *
+ * @param flash flash device, indirect mode
+ *
+ * @return result
+ */
+sfud_err sfud_qspi_qpi_disable(sfud_flash *flash);
+#endif
 #endif /* SFUD_USING_QSPI */
 
 /**
@@ -106,10 +135,61 @@ sfud_err sfud_qspi_fast_read_enable(sfud_flash *flash, uint8_t data_line_width);
  */
 sfud_err sfud_read(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data);
 
+/**
+ * read several ranges in one go: the bus is locked and the busy status checked once, a range which goes on where
+ * the one before it ends, in the flash and in memory, is read by the same command
+ *
+ * @note On the flashes of SFUD_READ_CACHE_FLASHES a range in a cached line is copied from it, the other ones don't
+ *       fill lines.
+ *
+ * @param flash flash device
+ * @param ranges ranges to read
+ * @param n number of ranges
+ *
+ * @return result, the first error stops the reads
+ */
+sfud_err sfud_read_multi(const sfud_flash *flash, const sfud_iovec *ranges, size_t n);
+
+/**
+ * start reading flash data in the background, the bus stays locked until sfud_read_async_wait()
+ *
+ * @note The read is synchronous when the port has no wr_async() for the flash, or the flash uses the QSPI fast read.
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size read size
+ * @param data read data pointer, it must not be touched until sfud_read_async_wait() returns
+ *
+ * @return result of the start
+ */
+sfud_err sfud_read_async(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data);
+
+/**
+ * wait the read started by sfud_read_async()
+ *
+ * @param flash flash device
+ *
+ * @return result of the read
+ */
+sfud_err sfud_read_async_wait(const sfud_flash *flash);
+
+/**
+ * plan the erase of a range, the largest erase types the alignment allows, the chip erase for the whole chip
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size erase size
+ * @param runs SFUD_ERASE_PLAN_MAX_RUNS runs at most, in address order
+ *
+ * @return number of runs, 0: nothing to erase or out of bound
+ */
+size_t sfud_erase_plan(const sfud_flash *flash, uint32_t addr, size_t size,
+                       sfud_erase_run runs[SFUD_ERASE_PLAN_MAX_RUNS]);
+
 /**
  * erase flash data
  *
- * @note It will erase align by erase granularity.
+ * @note It will erase align by erase granularity, in the order of sfud_erase_plan().
  *
  * @param flash flash device
  * @param addr start address
@@ -131,6 +211,18 @@ sfud_err sfud_erase(const sfud_flash *flash, uint32_t addr, size_t size);
  */
 sfud_err sfud_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data);
 
+/**
+ * program the writes the write buffer holds for a flash (SFUD_USING_WRITE_BUFFER)
+ *
+ * @note The reads, the erases and the background operations flush the buffer themselves, a reset before the flush
+ *       loses the pending writes.
+ *
+ * @param flash flash device
+ *
+ * @return result of the pending page program
+ */
+sfud_err sfud_write_flush(const sfud_flash *flash);
+
 /**
  * erase and write flash data
  *
@@ -143,6 +235,123 @@ sfud_err sfud_write(const sfud_flash *flash, uint32_t addr, size_t size, const u
  */
 sfud_err sfud_erase_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data);
 
+/**
+ * start erasing flash data in the background
+ *
+ * @note Only one operation per flash, the flash must not be used by anything else until it ends. The commands go
+ *       out in sfud_async_poll(), between two calls the flash erases and the SPI bus is free.
+ *
+ * @param flash flash device
+ * @param op operation, its done and user_data are kept
+ * @param addr start address
+ * @param size erase size, it will erase align by erase granularity
+ *
+ * @return result of the start, SFUD_SUCCESS: the operation runs or has ended already, see op->result
+ */
+sfud_err sfud_erase_async(const sfud_flash *flash, sfud_async *op, uint32_t addr, size_t size);
+
+/**
+ * start writing flash data (no erase operate) in the background
+ *
+ * @note The write is synchronous when the flash has no 256 bytes page program.
+ *
+ * @param flash flash device
+ * @param op operation, its done and user_data are kept
+ * @param addr start address
+ * @param size write size
+ * @param data write data, it must not be touched until the operation ends
+ *
+ * @return result of the start, see sfud_erase_async()
+ */
+sfud_err sfud_write_async(const sfud_flash *flash, sfud_async *op, uint32_t addr, size_t size, const uint8_t *data);
+
+/**
+ * start erasing and writing flash data in the background
+ *
+ * @param flash flash device
+ * @param op operation, its done and user_data are kept
+ * @param addr start address
+ * @param size write size
+ * @param data write data, it must not be touched until the operation ends
+ *
+ * @return result of the start, see sfud_erase_async()
+ */
+sfud_err sfud_erase_write_async(const sfud_flash *flash, sfud_async *op, uint32_t addr, size_t size,
+                                const uint8_t *data);
+
+/**
+ * check the flash once and send the next command of the operation when it's idle, never waits
+ *
+ * @param op operation
+ *
+ * @return SFUD_ERR_BUSY: still running, otherwise the result of the ended operation, op->done has been called
+ */
+sfud_err sfud_async_poll(sfud_async *op);
+
+/**
+ * wait the operation to end
+ *
+ * @param op operation
+ *
+ * @return result of the operation
+ */
+sfud_err sfud_async_wait(sfud_async *op);
+
+/**
+ * read flash data while an operation runs, the erase or program in flight is suspended for the read and resumed
+ *
+ * @note The SFDP basic table (JESD216A and later) has the suspend and resume instructions. A flash without them,
+ *       or no operation running, makes it a sfud_read() which waits the flash. The flash needs some time
+ *       between a resume and the next suspend to get on with the erase, reads back to back can stall it. A chip
+ *       erase can't be suspended, and the sector or page being erased or programmed reads undefined.
+ *
+ * @param op operation, running or ended, on the flash to read
+ * @param addr start address
+ * @param size read size
+ * @param data read data pointer
+ *
+ * @return result of the read
+ */
+sfud_err sfud_async_read(sfud_async *op, uint32_t addr, size_t size, uint8_t *data);
+
+/**
+ * open a sequential writer of a flash range, which takes chunks of any size
+ *
+ * @note The chunks go into two page buffers, a full page is programmed in the background while the other one
+ *       fills. Once the write pointer is in the last erased granule, the flash after it is erased in the
+ *       background as well, up to the next 64KB boundary, by whole granules, the last one may go past the end of
+ *       the range. Like the operations, the stream owns the flash until sfud_stream_close(). The page buffers
+ *       are in the stream, keep it where the DMA reaches.
+ *
+ * @param stream stream
+ * @param flash flash device
+ * @param start start address, erase granularity aligned
+ * @param max_len bytes the stream may write at most
+ *
+ * @return result of the start of the first erase
+ */
+sfud_err sfud_stream_open(sfud_stream *stream, const sfud_flash *flash, uint32_t start, size_t max_len);
+
+/**
+ * write the next chunk of a stream, it's copied before the return
+ *
+ * @param stream stream
+ * @param chunk data
+ * @param len bytes of the chunk, any count
+ *
+ * @return SFUD_ERR_ADDR_OUT_OF_BOUND: past max_len, nothing is taken, otherwise the first error of the stream
+ */
+sfud_err sfud_stream_write(sfud_stream *stream, const void *chunk, size_t len);
+
+/**
+ * program the rest of a stream and wait for the flash
+ *
+ * @param stream stream
+ *
+ * @return the first error of the stream
+ */
+sfud_err sfud_stream_close(sfud_stream *stream);
+
 /**
  * erase all flash data
  *
@@ -173,6 +382,27 @@ sfud_err sfud_read_status(const sfud_flash *flash, uint8_t *status);
  */
 sfud_err sfud_write_status(const sfud_flash *flash, bool is_volatile, uint8_t status);
 
+#ifdef SFUD_USING_STATS
+/**
+ * get the operation statistics of a flash device
+ *
+ * @note The times come from sfud_port_time_us(). An operation nested in another one (the status reads of a
+ *       write) adds its own counters, its busy time and retries go to the outer one as well.
+ *
+ * @param flash flash device
+ *
+ * @return statistics, NULL: not a device of the flash table
+ */
+const sfud_stats *sfud_get_stats(const sfud_flash *flash);
+
+/**
+ * clear the operation statistics of a flash device
+ *
+ * @param flash flash device
+ */
+void sfud_reset_stats(const sfud_flash *flash);
+#endif /* SFUD_USING_STATS */
+
 #ifdef __cplusplus
 }
 #endif
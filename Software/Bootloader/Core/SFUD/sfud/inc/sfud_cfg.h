@@ -37,9 +37,17 @@
 
 //#define SFUD_USING_FLASH_INFO_TABLE
 
+/* reuse the chip parameters found on the last boot when the JEDEC ID is the same */
+#define SFUD_USING_PROBE_CACHE
+
+/* count calls, bytes, time, busy time, retries and bus errors of each operation type, see sfud_get_stats(),
+ * the port gives the time by sfud_port_time_us() */
+#define SFUD_USING_STATS
+
 enum {
     SFUD_EXT_FLASH = 0,
     SFUD_MAIN_FLASH = 1,
+    SFUD_FLASH_DEVICE_NUM,
 };
 
 #define SFUD_FLASH_DEVICE_TABLE                                                \
@@ -48,6 +56,88 @@ enum {
     [SFUD_MAIN_FLASH] = {.name = "MAIN", .spi.name = "OSPI"},       \
 }
 
+/* the flashes sfud_init() brings up, the others wait for their first sfud_device_init(), see boot_ext.h */
+#define SFUD_INIT_FLASHES                       (1UL << SFUD_MAIN_FLASH)
+
 #define SFUD_USING_QSPI
 
+/* OCTOSPI1 in dual-quad mode on the board revision with two quad parts of the same kind, IO0 ~ IO3 and IO4 ~ IO7
+ * (PE7 ~ PE10) on one NCS: the MAIN flash is both, twice the capacity and the erase units, every other byte in each
+ * part, see qspi_dual_xfer() of the port; the part driver of boot_part.h keeps off it */
+//#define SFUD_USING_QSPI_DUALQUAD
+
+/* the MAIN flash runs its commands in QPI (4-4-4) mode between sfud_qspi_qpi_enable() and sfud_qspi_qpi_disable(),
+ * on the parts whose SFDP basic table has the QPI enable and disable sequences and the 4-4-4 read: the instruction,
+ * address and status bytes go over the four lines too; the W25Q64JV of the board has no QPI mode */
+//#define SFUD_USING_QSPI_QPI
+
+/* use the DTR quad read (0xED) for memory-mapped XIP on the parts flagged QUAD_IO_DTR in SFUD_FLASH_EXT_INFO_TABLE */
+#define SFUD_USING_QSPI_DTR
+
+/* memory-mapped XIP sends the read instruction only once, the parts flagged CONTINUOUS_READ stay in continuous read */
+#define SFUD_USING_QSPI_CONTINUOUS_READ
+
+/* memory-mapped XIP fills the 32-byte D-Cache lines critical word first on the parts flagged WRAP_READ, the
+ * quad I/O read wraps then, they give up the continuous read for it */
+#define SFUD_USING_QSPI_WRAP_READ
+
+/* indirect reads of at least SFUD_QSPI_DMA_MIN_SIZE bytes are moved by the MDMA instead of polling the FIFO */
+#define SFUD_USING_QSPI_DMA
+#define SFUD_QSPI_DMA_MIN_SIZE                  512
+
+/* commands in memory-mapped mode leave it for the time of the command by ITCM code (.itcm_text), the
+ * interrupts are masked meanwhile, the ones at SFUD_QSPI_XIP_IRQ_PRIORITY and below when it's defined */
+#define SFUD_USING_QSPI_XIP_WRITE
+//#define SFUD_QSPI_XIP_IRQ_PRIORITY              1
+
+/* SPI transfers of at least SFUD_SPI_DMA_MIN_SIZE bytes are moved by the DMA1, none of the transfers use the heap */
+#define SFUD_USING_SPI_DMA
+#define SFUD_SPI_DMA_MIN_SIZE                   64
+
+/* SPI2 transfers run on the registers: the SPI drives the NSS of FLASH_CS (PB12) for the whole command, the FIFO
+ * moves 4 frames per 32-bit access, the DMA1 reads in words; off: HAL transfers and FLASH_CS by the CPU */
+#define SFUD_USING_SPI_ENGINE
+
+/* sfud_read() of less than a line on the flashes of SFUD_READ_CACHE_FLASHES goes through a LRU cache of
+ * SFUD_READ_CACHE_LINES lines in SFUD_READ_CACHE_SECTION, the writes and erases drop the lines they touch */
+#define SFUD_USING_READ_CACHE
+#define SFUD_READ_CACHE_FLASHES                 (1UL << SFUD_EXT_FLASH)
+#define SFUD_READ_CACHE_LINE_SIZE               4096
+#define SFUD_READ_CACHE_LINES                   4
+#define SFUD_READ_CACHE_SECTION                 ".dtcm"
+
+/* sfud_write() of less than a page on the page program flashes of SFUD_WRITE_BUFFER_FLASHES merges into a RAM page,
+ * programmed once a write goes to another page or reaches the end of the page, and by sfud_write_flush(), the reads,
+ * erases and background operations; the memory-mapped reads don't see it, so no XIP flash here */
+#define SFUD_USING_WRITE_BUFFER
+#define SFUD_WRITE_BUFFER_FLASHES               (1UL << SFUD_EXT_FLASH)
+
+/* each page program (sfud_write(), the async operations and streams, the part drivers) is read back once the flash
+ * is idle, by the memory-mapped window or the DMA read of the port, and its CRC-32 (sfud_port_crc32()) checked
+ * against the one of the data; a mismatch programs the page again, SFUD_WRITE_VERIFY_RETRIES times, then the write
+ * fails with SFUD_ERR_WRITE */
+#define SFUD_USING_WRITE_VERIFY
+#define SFUD_WRITE_VERIFY_RETRIES               2
+
+/* sfud_erase() on the flashes of SFUD_BLANK_CHECK_FLASHES only erases the erase units (chip.erase_gran) which don't
+ * read blank, a run of them by one erase plan, and an async erase skips the blank units ahead of its next command; a
+ * unit is read in place through the memory-mapped window by 64-bit loads (sfud_port_mapped()) or by the reads of the
+ * port, up to its first programmed word. The first SFUD_BLANK_MAP_UNITS units erased or read blank are known blank in
+ * RAM till a write goes to them or sfud_device_init(). A unit whose erase was cut off late may read blank with weakly
+ * erased cells, the write verify fails a page which doesn't take its data then */
+#define SFUD_USING_BLANK_CHECK
+#define SFUD_BLANK_CHECK_FLASHES                (1UL << SFUD_MAIN_FLASH)
+#define SFUD_BLANK_MAP_UNITS                    2048
+
+/* the reads skip the busy poll of a flash known idle: a poll saw it idle and no write enable, status write or resume
+ * went to it since */
+#define SFUD_USING_IDLE_TRACK
+
+/* the flashes whose part has a driver made at compile time (boot_part.hpp) hand their reads, writes and erases to it
+ * once it's attached, the generic paths serve the other parts and the memory-mapped mode */
+#define SFUD_USING_PART_DRIVER
+
+/* section of the flash device table, it's on the path of every operation; off: .data */
+#define SFUD_FLASH_TABLE_SECTION                ".dtcm_data"
+
 #endif /* _SFUD_CFG_H_ */
@@ -41,21 +41,21 @@ extern "C" {
 #endif
 
 #include "elog.h"
-#define SFUD_INFO(...) elog_i("SFUD", __VA_ARGS__)
+#if ELOG_TAG_LVL_SFUD >= ELOG_LVL_INFO
+#define SFUD_INFO(...) elog_info(ELOG_TAG("SFUD"), __VA_ARGS__)
+#else
+#define SFUD_INFO(...)
+#endif
 
-/* debug print function. Must be implement by user. */
-#ifdef SFUD_DEBUG_MODE
+/* debug print, an elog line under the SFUD tag too, filtered before it is formatted */
+#if defined(SFUD_DEBUG_MODE) && ELOG_TAG_LVL_SFUD >= ELOG_LVL_DEBUG
 #ifndef SFUD_DEBUG
-#define SFUD_DEBUG(...) sfud_log_debug(__FILE__, __LINE__, __VA_ARGS__)
+#define SFUD_DEBUG(...) elog_debug(ELOG_TAG("SFUD"), __VA_ARGS__)
 #endif /* SFUD_DEBUG */
 #else
 #define SFUD_DEBUG(...)
 #endif /* SFUD_DEBUG_MODE */
 
-#ifndef SFUD_INFO
-#define SFUD_INFO(...)  sfud_log_info(__VA_ARGS__)
-#endif
-
 /* assert for developer. */
 #ifdef SFUD_DEBUG_MODE
 #define SFUD_ASSERT(EXPR)                                                      \
@@ -105,6 +105,14 @@ if (!(EXPR))                                                                   \
 #define SFUD_CMD_WRITE_STATUS_REGISTER                 0x01
 #endif
 
+#ifndef SFUD_CMD_READ_STATUS_REGISTER_2
+#define SFUD_CMD_READ_STATUS_REGISTER_2                0x35
+#endif
+
+#ifndef SFUD_CMD_WRITE_STATUS_REGISTER_2
+#define SFUD_CMD_WRITE_STATUS_REGISTER_2               0x31
+#endif
+
 #ifndef SFUD_CMD_PAGE_PROGRAM
 #define SFUD_CMD_PAGE_PROGRAM                          0x02
 #endif
@@ -137,6 +145,10 @@ if (!(EXPR))                                                                   \
 #define SFUD_CMD_QUAD_IO_READ_DATA                     0xEB
 #endif
 
+#ifndef SFUD_CMD_QUAD_IO_DTR_READ_DATA
+#define SFUD_CMD_QUAD_IO_DTR_READ_DATA                 0xED
+#endif
+
 #ifndef SFUD_CMD_QUAD_OUTPUT_READ_DATA
 #define SFUD_CMD_QUAD_OUTPUT_READ_DATA                 0x6B
 #endif
@@ -165,6 +177,10 @@ if (!(EXPR))                                                                   \
 #define SFUD_CMD_RESET                                 0x99
 #endif
 
+#ifndef SFUD_CMD_SET_BURST_WITH_WRAP
+#define SFUD_CMD_SET_BURST_WITH_WRAP                   0x77
+#endif
+
 #ifndef SFUD_CMD_ENTER_4B_ADDRESS_MODE
 #define SFUD_CMD_ENTER_4B_ADDRESS_MODE                 0xB7
 #endif
@@ -173,10 +189,63 @@ if (!(EXPR))                                                                   \
 #define SFUD_CMD_EXIT_4B_ADDRESS_MODE                  0xE9
 #endif
 
+#ifndef SFUD_CMD_READ_DATA_4B
+#define SFUD_CMD_READ_DATA_4B                          0x13
+#endif
+
+#ifndef SFUD_CMD_FAST_READ_DATA_4B
+#define SFUD_CMD_FAST_READ_DATA_4B                     0x0C
+#endif
+
+#ifndef SFUD_CMD_QUAD_PAGE_PROGRAM
+#define SFUD_CMD_QUAD_PAGE_PROGRAM                     0x32
+#endif
+
+#ifndef SFUD_CMD_QUAD_IO_PAGE_PROGRAM
+#define SFUD_CMD_QUAD_IO_PAGE_PROGRAM                  0x38
+#endif
+
+#ifndef SFUD_CMD_QUAD_PAGE_PROGRAM_4B
+#define SFUD_CMD_QUAD_PAGE_PROGRAM_4B                  0x34
+#endif
+
+#ifndef SFUD_CMD_QUAD_IO_PAGE_PROGRAM_4B
+#define SFUD_CMD_QUAD_IO_PAGE_PROGRAM_4B               0x3E
+#endif
+
+#ifndef SFUD_CMD_PAGE_PROGRAM_4B
+#define SFUD_CMD_PAGE_PROGRAM_4B                       0x12
+#endif
+
+/* QPI (4-4-4) mode enable and disable, bits 8:4 and 3:0 of the 15th DWORD of the SFDP basic table tell which */
+#ifndef SFUD_CMD_ENABLE_QPI
+#define SFUD_CMD_ENABLE_QPI                            0x38
+#endif
+
+#ifndef SFUD_CMD_ENABLE_QPI_35
+#define SFUD_CMD_ENABLE_QPI_35                         0x35
+#endif
+
+#ifndef SFUD_CMD_DISABLE_QPI
+#define SFUD_CMD_DISABLE_QPI                           0xFF
+#endif
+
+#ifndef SFUD_CMD_DISABLE_QPI_F5
+#define SFUD_CMD_DISABLE_QPI_F5                        0xF5
+#endif
+
 #ifndef SFUD_WRITE_MAX_PAGE_SIZE
 #define SFUD_WRITE_MAX_PAGE_SIZE                        256
 #endif
 
+/* status poll interval after the typical time of an operation, see retry.sleep of sfud_flash (us) */
+#ifndef SFUD_BUSY_POLL_MIN_US
+#define SFUD_BUSY_POLL_MIN_US                          10
+#endif
+#ifndef SFUD_BUSY_POLL_MAX_US
+#define SFUD_BUSY_POLL_MAX_US                          5000
+#endif
+
 /* send dummy data for read data */
 #ifndef SFUD_DUMMY_DATA
 #define SFUD_DUMMY_DATA                                0xFF
@@ -213,6 +282,7 @@ typedef enum {
     SFUD_ERR_READ = 3,                                     /**< read error */
     SFUD_ERR_TIMEOUT = 4,                                  /**< timeout error */
     SFUD_ERR_ADDR_OUT_OF_BOUND = 5,                        /**< address is out of flash bound */
+    SFUD_ERR_BUSY = 6,                                     /**< asynchronous operation is still running */
 } sfud_err;
 
 #ifdef SFUD_USING_QSPI
@@ -227,13 +297,66 @@ typedef struct {
     uint8_t alternate_bytes_lines;
     uint8_t dummy_cycles;
     uint8_t data_lines;
+    bool dtr;                                    /**< address, alternate bytes and data are sampled on both edges */
+    bool continuous;                             /**< the mode bits in the alternate bytes can keep the flash in continuous read */
+    bool wrap;                                   /**< the read wraps in 32 bytes after Set Burst with Wrap, for the XIP line fills */
 } sfud_qspi_read_cmd_format;
+
+/**
+ * QSPI flash page program cmd format
+ */
+typedef struct {
+    uint8_t instruction;                         /**< page program instruction, 0: SFUD_CMD_PAGE_PROGRAM on one line */
+    uint8_t address_lines;
+    uint8_t data_lines;
+} sfud_qspi_write_cmd_format;
+
+/* mode bits of the quad I/O read (Winbond M5-4 = 10b, Macronix P7-4 != P3-0), the next read skips the instruction */
+#define SFUD_QSPI_MODE_BITS_CONTINUOUS                 0xA5
+/* mode bits which leave the continuous read, the next read needs the instruction again */
+#define SFUD_QSPI_MODE_BITS_NORMAL                     0xFF
+/* wrap bits of Set Burst with Wrap (Winbond W6-4): 16 and 32-byte wrap of the quad I/O read, no wrap (the reset
+ * value) */
+#define SFUD_QSPI_WRAP_BITS_16                         0x20
+#define SFUD_QSPI_WRAP_BITS_32                         0x40
+#define SFUD_QSPI_WRAP_BITS_OFF                        0x70
 #endif /* SFUD_USING_QSPI */
 
 /* SPI bus write read data function type */
 typedef sfud_err (*spi_write_read_func)(const uint8_t *write_buf, size_t write_size, uint8_t *read_buf, size_t read_size);
 
 #ifdef SFUD_USING_SFDP
+/* fast reads of the SFDP basic table, index of sfud_sfdp.fast_read */
+enum {
+    SFUD_SFDP_READ_1_1_2,
+    SFUD_SFDP_READ_1_2_2,
+    SFUD_SFDP_READ_1_1_4,
+    SFUD_SFDP_READ_1_4_4,
+    SFUD_SFDP_READ_4_4_4,
+    SFUD_SFDP_READ_NUM,
+};
+
+/* quad enable requirement of the SFDP basic table (JESD216A and later), bits 22:20 of the 15th DWORD */
+enum {
+    SFUD_SFDP_QE_NONE = 0,                       /**< no QE bit, the quad modes always work */
+    SFUD_SFDP_QE_SR2_BIT1_NO_READ = 1,           /**< bit 1 of SR2, written with SR1 by 01h, SR2 can't be read */
+    SFUD_SFDP_QE_SR1_BIT6 = 2,                   /**< bit 6 of SR1, 01h with one byte */
+    SFUD_SFDP_QE_SR2_BIT7 = 3,                   /**< bit 7 of SR2, written by 3Eh, read by 3Fh */
+    SFUD_SFDP_QE_SR2_BIT1 = 4,                   /**< bit 1 of SR2, written with SR1 by 01h, read by 35h */
+    SFUD_SFDP_QE_SR2_BIT1_35 = 5,                /**< same as SFUD_SFDP_QE_SR2_BIT1 */
+    SFUD_SFDP_QE_SR2_BIT1_31 = 6,                /**< bit 1 of SR2, written by 31h, read by 35h */
+    SFUD_SFDP_QE_UNKNOWN = 0xFF,                 /**< the basic table is too short to tell */
+};
+
+/* QPI (4-4-4) mode sequences of the SFDP basic table (JESD216A and later), sfud_sfdp.qpi_enable and qpi_disable */
+enum {
+    SFUD_SFDP_QPI_ENABLE_QE_38 = (1 << 0),       /**< bit 4 of the 15th DWORD: the QE bit set, then 38h */
+    SFUD_SFDP_QPI_ENABLE_38 = (1 << 1),          /**< bit 5: 38h */
+    SFUD_SFDP_QPI_ENABLE_35 = (1 << 2),          /**< bit 6: 35h */
+    SFUD_SFDP_QPI_DISABLE_FF = (1 << 0),         /**< bit 0: FFh */
+    SFUD_SFDP_QPI_DISABLE_F5 = (1 << 1),         /**< bit 1: F5h */
+};
+
 /**
  * the SFDP (Serial Flash Discoverable Parameters) parameter info which used on this library
  */
@@ -248,15 +371,103 @@ typedef struct {
     uint8_t vola_sr_we_cmd;                      /**< volatile status register write enable command */
     bool addr_3_byte;                            /**< supports 3-Byte addressing */
     bool addr_4_byte;                            /**< supports 4-Byte addressing */
+    uint8_t header_num;                          /**< number of parameter headers, the basic one included */
+    uint32_t inst_4_byte;                        /**< 1st DWORD of the 4-Byte address instruction table, 0: no table */
+    uint8_t suspend_cmd;                         /**< erase suspend instruction, 0x00: not available */
+    uint8_t resume_cmd;                          /**< erase resume instruction */
+    uint8_t program_suspend_cmd;                 /**< program suspend instruction, 0x00: not available */
+    uint8_t program_resume_cmd;                  /**< program resume instruction */
     uint32_t capacity;                           /**< flash capacity (bytes) */
     struct {
         uint32_t size;                           /**< erase sector size (bytes). 0x00: not available */
         uint8_t cmd;                             /**< erase command */
+        uint8_t cmd_4b;                          /**< erase command with 4-Byte address, 0x00: not available */
+        uint32_t time_typ;                       /**< typical erase time (us), 0: not known */
+        uint32_t time_max;                       /**< maximum erase time (us) */
     } eraser[SFUD_SFDP_ERASE_TYPE_MAX_NUM];      /**< supported eraser types table */
-    //TODO lots of fast read-related stuff (like modes supported and number of wait states/dummy cycles needed in each)
+    struct {
+        uint8_t cmd;                             /**< read instruction, 0x00: not supported */
+        uint8_t dummy_cycles;                    /**< wait states (dummy clocks) */
+        uint8_t mode_cycles;                     /**< mode bit clocks, they go before the dummy clocks */
+    } fast_read[SFUD_SFDP_READ_NUM];             /**< supported fast reads */
+    uint8_t quad_enable;                         /**< quad enable requirement, SFUD_SFDP_QE_xxx */
+    uint8_t qe_vola_we_cmd;                      /**< write enable of a volatile QE write (16th DWORD), 0: none */
+    uint8_t qpi_enable;                          /**< QPI enable sequences, SFUD_SFDP_QPI_ENABLE_xxx, 0: no QPI */
+    uint8_t qpi_disable;                         /**< QPI disable sequences, SFUD_SFDP_QPI_DISABLE_xxx */
+    uint32_t program_time_typ;                   /**< typical page program time (us), 0: not known */
+    uint32_t program_time_max;                   /**< maximum page program time (us) */
+    uint32_t chip_erase_time_typ;                /**< typical chip erase time (ms), 0: not known */
+    uint32_t chip_erase_time_max;                /**< maximum chip erase time (ms) */
 } sfud_sfdp, *sfud_sfdp_t;
 #endif
 
+#ifdef SFUD_USING_PROBE_CACHE
+/* magic of a valid probe cache descriptor */
+#define SFUD_PROBE_CACHE_MAGIC                         0x53465543 /* 'SFUC' */
+/* bump it when the layout of sfud_probe_cache changes, a warm reset may keep the old one */
+#define SFUD_PROBE_CACHE_VERSION                       10
+
+/**
+ * compact descriptor of the resolved flash chip parameters, keyed by JEDEC ID
+ */
+typedef struct {
+    uint32_t magic;                              /**< SFUD_PROBE_CACHE_MAGIC */
+    uint8_t mf_id;                               /**< manufacturer ID */
+    uint8_t type_id;                             /**< memory type ID */
+    uint8_t capacity_id;                         /**< capacity ID */
+    uint8_t erase_gran_cmd;                      /**< erase granularity size block command */
+    uint32_t capacity;                           /**< flash capacity (bytes) */
+    uint32_t erase_gran;                         /**< erase granularity (bytes) */
+    uint16_t write_mode;                         /**< write mode @see sfud_write_mode */
+    uint8_t sfdp_available;                      /**< the eraser table below comes from SFDP */
+    uint8_t read_data_lines;                     /**< data_line_width of read_cmd_format, 0: not set */
+    uint32_t inst_4_byte;                        /**< 1st DWORD of the SFDP 4-Byte address instruction table */
+    uint8_t suspend_cmd;                         /**< SFDP erase suspend instruction */
+    uint8_t resume_cmd;                          /**< SFDP erase resume instruction */
+    uint8_t program_suspend_cmd;                 /**< SFDP program suspend instruction */
+    uint8_t program_resume_cmd;                  /**< SFDP program resume instruction */
+    uint8_t quad_enable;                         /**< SFDP quad enable requirement, a volatile QE bit is set again */
+    uint8_t qe_vola_we_cmd;                      /**< SFDP write enable of a volatile QE write */
+    uint8_t qpi_enable;                          /**< SFDP QPI enable sequences */
+    uint8_t qpi_disable;                         /**< SFDP QPI disable sequences */
+    uint8_t qpi_read_cmd;                        /**< SFDP 4-4-4 read instruction, 0x00: none */
+    uint8_t qpi_read_dummy_cycles;               /**< its wait states */
+    uint8_t qpi_read_mode_cycles;                /**< its mode bit clocks */
+    struct {
+        uint8_t size_shift;                      /**< erase sector size is (1 << size_shift), 0: not available */
+        uint8_t cmd;                             /**< erase command */
+        uint8_t cmd_4b;                          /**< erase command with 4-Byte address */
+        uint32_t time_typ;                       /**< SFDP typical erase time (us) */
+        uint32_t time_max;                       /**< SFDP maximum erase time (us) */
+    } eraser[SFUD_SFDP_ERASE_TYPE_MAX_NUM];
+    uint32_t program_time_typ;                   /**< SFDP typical page program time (us) */
+    uint32_t program_time_max;                   /**< SFDP maximum page program time (us) */
+    uint32_t chip_erase_time_typ;                /**< SFDP typical chip erase time (ms) */
+    uint32_t chip_erase_time_max;                /**< SFDP maximum chip erase time (ms) */
+#ifdef SFUD_USING_QSPI
+    sfud_qspi_read_cmd_format read_cmd_format;   /**< fast read cmd format */
+    sfud_qspi_write_cmd_format write_cmd_format; /**< page program cmd format */
+#endif
+    uint32_t check;                              /**< check value of all the fields above */
+} sfud_probe_cache;
+#endif /* SFUD_USING_PROBE_CACHE */
+
+/**
+ * one flash command with its phases apart, the data is moved from or to the caller's buffer
+ */
+typedef struct {
+    uint8_t instruction;                         /**< opcode */
+    uint8_t addr_size;                           /**< address bytes, 3 or 4, 0: no address phase */
+    uint8_t dummy_size;                          /**< dummy bytes after the address */
+    uint8_t instruction_lines;                   /**< lines of the instruction phase, 0: 1 line */
+    uint8_t addr_lines;                          /**< lines of the address phase, 0: 1 line */
+    uint8_t data_lines;                          /**< lines of the data phase, 0: 1 line */
+    uint32_t addr;                               /**< address */
+    const uint8_t *write_buf;                    /**< data to send, NULL: none */
+    uint8_t *read_buf;                           /**< data to receive, NULL: none */
+    size_t data_size;                            /**< data bytes */
+} sfud_spi_xfer;
+
 /**
  * SPI device
  */
@@ -266,11 +477,20 @@ typedef struct __sfud_spi {
     /* SPI bus write read data function */
     sfud_err (*wr)(const struct __sfud_spi *spi, const uint8_t *write_buf, size_t write_size, uint8_t *read_buf,
                    size_t read_size);
+    /* run a command from its phases (optional), the core packs it for wr() otherwise */
+    sfud_err (*xfer)(const struct __sfud_spi *spi, const sfud_spi_xfer *xfer);
 #ifdef SFUD_USING_QSPI
     /* QSPI fast read function */
     sfud_err (*qspi_read)(const struct __sfud_spi *spi, uint32_t addr, sfud_qspi_read_cmd_format *qspi_read_cmd_format,
                           uint8_t *read_buf, size_t read_size);
 #endif
+    /* start a write then read whose read part runs in the background (optional), wr_async_wait() ends it */
+    sfud_err (*wr_async)(const struct __sfud_spi *spi, const uint8_t *write_buf, size_t write_size, uint8_t *read_buf,
+                         size_t read_size);
+    /* wait the read started by wr_async() */
+    sfud_err (*wr_async_wait)(const struct __sfud_spi *spi);
+    /* wait the flash is not busy by the bus itself (optional), it replaces the status register polling loop */
+    sfud_err (*wait_busy)(const struct __sfud_spi *spi);
     /* lock SPI bus */
     void (*lock)(const struct __sfud_spi *spi);
     /* unlock SPI bus */
@@ -279,32 +499,155 @@ typedef struct __sfud_spi {
     void *user_data;
 } sfud_spi, *sfud_spi_t;
 
+#ifdef SFUD_USING_PART_DRIVER
+struct __sfud_flash;
+
 /**
- * serial flash device
+ * driver of one known part, made for it at compile time, see boot_part.hpp
+ *
+ * The core hands the whole read, write or erase of an attached part to it, with the SPI locked and the flash idle,
+ * the call leaves the flash idle again. ready() tells when the part driver can't take the flash as it is now
+ * (memory-mapped mode), the generic paths serve it then.
  */
 typedef struct {
+    const char *name;                            /**< part name */
+    bool (*ready)(const struct __sfud_flash *flash);
+    sfud_err (*read)(const struct __sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data);
+    sfud_err (*write)(const struct __sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data);
+    sfud_err (*erase)(const struct __sfud_flash *flash, uint32_t addr, size_t size);
+} sfud_part;
+#endif
+
+/**
+ * serial flash device
+ */
+typedef struct __sfud_flash {
     char *name;                                  /**< serial flash name */
     size_t index;                                /**< index of flash device information table  @see flash_table */
     sfud_flash_chip chip;                        /**< flash chip information */
     sfud_spi spi;                                /**< SPI device */
     bool init_ok;                                /**< initialize OK flag */
     bool addr_in_4_byte;                         /**< flash is in 4-Byte addressing */
+    bool addr_4_byte_inst;                       /**< 4-Byte address instructions are used instead of the 4-Byte addressing mode */
     struct {
         void (*delay)(void);                     /**< every retry's delay */
         size_t times;                            /**< default times for error retry */
+        void (*sleep)(uint32_t us);              /**< waits about us off the bus, the CPU may sleep, NULL: none */
     } retry;
     void *user_data;                             /**< some user data */
 
 #ifdef SFUD_USING_QSPI
     sfud_qspi_read_cmd_format read_cmd_format;   /**< fast read cmd format */
+    sfud_qspi_write_cmd_format write_cmd_format; /**< page program cmd format, quad input when the bus reads in quad */
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    bool dual_quad;                              /**< two parts side by side in dual-quad mode, every other byte each */
+#endif
+#ifdef SFUD_USING_QSPI_QPI
+    bool qpi;                                    /**< in QPI mode, every phase of a command on four lines */
+#endif
 #endif
 
 #ifdef SFUD_USING_SFDP
     sfud_sfdp sfdp;                              /**< serial flash discoverable parameters by JEDEC standard */
 #endif
 
+#ifdef SFUD_USING_PART_DRIVER
+    const sfud_part *part;                       /**< driver of the part, NULL: the generic paths */
+#endif
+
 } sfud_flash, *sfud_flash_t;
 
+/**
+ * one range of sfud_read_multi()
+ */
+typedef struct {
+    uint32_t addr;                               /**< flash address */
+    size_t size;                                 /**< bytes */
+    uint8_t *data;                               /**< read data pointer */
+} sfud_iovec;
+
+/* runs of an erase plan: up and down the erase types around the largest one */
+#define SFUD_ERASE_PLAN_MAX_RUNS                          (2 * SFUD_SFDP_ERASE_TYPE_MAX_NUM - 1)
+
+/**
+ * run of equal erases in an erase plan, see sfud_erase_plan()
+ */
+typedef struct {
+    uint8_t cmd;                                 /**< 3-Byte address erase instruction, SFUD_CMD_ERASE_CHIP: whole chip */
+    uint32_t addr;                               /**< start address, aligned by size */
+    uint32_t size;                               /**< erase unit of cmd (bytes) */
+    uint32_t count;                              /**< erases in the run */
+} sfud_erase_run;
+
+/**
+ * erase and/or write in the background, sfud_async_poll() moves it on
+ */
+typedef struct __sfud_async {
+    const sfud_flash *flash;                     /**< flash device */
+    uint32_t erase_addr;                         /**< next erase address */
+    size_t erase_size;                           /**< bytes left to erase, they go before the write */
+    uint32_t addr;                               /**< next write address */
+    size_t size;                                 /**< bytes left to write */
+    const uint8_t *data;                         /**< next write data, it must stay until the operation ends */
+    sfud_err result;                             /**< SFUD_ERR_BUSY while running */
+    bool erasing;                                /**< the command in flight is an erase, otherwise a program */
+    bool suspended;                              /**< suspended by sfud_async_read(), the poll leaves it */
+#ifdef SFUD_USING_WRITE_VERIFY
+    uint32_t verify_addr;                        /**< page programmed last, read back before the next command */
+    size_t verify_size;                          /**< its bytes, 0: none to read back */
+    uint32_t verify_crc;                         /**< CRC-32 of its data, sfud_port_crc32() */
+    uint8_t verify_tries;                        /**< programs of it again */
+#endif
+    void (*done)(struct __sfud_async *op, sfud_err result); /**< completion callback or NULL, set it before the start */
+    void *user_data;                             /**< some user data of the callback */
+} sfud_async;
+
+/**
+ * sequential writer of a flash range, see sfud_stream_open()
+ */
+typedef struct {
+    const sfud_flash *flash;                     /**< flash device */
+    uint32_t pos;                                /**< address of the next byte */
+    uint32_t end;                                /**< end of the range */
+    uint32_t erased;                             /**< the range is erased or being erased up to here */
+    uint32_t page;                               /**< address of the first byte of the buffer being filled */
+    uint8_t cur;                                 /**< buffer being filled */
+    sfud_err result;                             /**< first error, the stream takes no more data after it */
+    sfud_async op;                               /**< program of the other buffer or the erase ahead */
+    uint8_t buf[2][SFUD_WRITE_MAX_PAGE_SIZE];    /**< a page each, the one of op must stay until it ends */
+} sfud_stream;
+
+/**
+ * operation types of the statistics, see sfud_get_stats()
+ */
+typedef enum {
+    SFUD_STATS_READ = 0,                         /**< sfud_read(), sfud_read_async() and the reads of sfud_async_read() */
+    SFUD_STATS_WRITE = 1,                        /**< sfud_write(), the page programs sent by the async operations */
+    SFUD_STATS_ERASE = 2,                        /**< sfud_erase(), sfud_chip_erase(), the erases sent by the async operations */
+    SFUD_STATS_STATUS = 3,                       /**< sfud_read_status(), every busy poll is one */
+    SFUD_STATS_OP_NUM,
+} sfud_stats_op;
+
+/**
+ * counters of one operation type, they wrap around
+ */
+typedef struct {
+    uint32_t count;                              /**< calls */
+    uint32_t bytes;                              /**< bytes read, written or erased, 1 per status read */
+    uint32_t total_us;                           /**< time in the calls */
+    uint32_t max_us;                             /**< longest call */
+    uint32_t busy_us;                            /**< part of total_us in wait_busy(), the flash at work */
+    uint32_t retries;                            /**< SFUD_RETRY_PROCESS delays of the busy polls */
+    uint32_t bus_errors;                         /**< bus calls which failed, e.g. a HAL_OSPI_xxx error in the port */
+} sfud_stats_entry;
+
+/**
+ * statistics of a flash device, since the start or sfud_reset_stats()
+ */
+typedef struct {
+    sfud_stats_entry op[SFUD_STATS_OP_NUM];      /**< indexed by sfud_stats_op */
+} sfud_stats;
+
 #ifdef __cplusplus
 }
 #endif
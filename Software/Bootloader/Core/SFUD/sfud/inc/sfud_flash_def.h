@@ -70,7 +70,7 @@ typedef struct {
     uint8_t mf_id;                               /**< manufacturer ID */
     uint8_t type_id;                             /**< memory type ID */
     uint8_t capacity_id;                         /**< capacity ID */
-    uint8_t read_mode;                           /**< supported read mode on this qspi flash chip */
+    uint16_t read_mode;                          /**< supported read and page program modes on this qspi flash chip */
 } sfud_qspi_flash_ext_info;
 #endif
 
@@ -172,13 +172,19 @@ typedef struct {
     /* W25Q16BV */                                                                                 \
     {SFUD_MF_ID_WINBOND, 0x40, 0x15, NORMAL_SPI_READ|DUAL_OUTPUT},                                 \
     /* W25Q32BV */                                                                                 \
-    {SFUD_MF_ID_WINBOND, 0x40, 0x16, NORMAL_SPI_READ|DUAL_OUTPUT|QUAD_OUTPUT|QUAD_IO},             \
+    {SFUD_MF_ID_WINBOND, 0x40, 0x16, NORMAL_SPI_READ|DUAL_OUTPUT|QUAD_OUTPUT|QUAD_IO|CONTINUOUS_READ|WRAP_READ|QUAD_PROGRAM}, \
     /* W25Q64JV */                                                                                 \
-    {SFUD_MF_ID_WINBOND, 0x40, 0x17, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO},     \
+    {SFUD_MF_ID_WINBOND, 0x40, 0x17, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO|CONTINUOUS_READ|WRAP_READ|QUAD_PROGRAM}, \
     /* W25Q128JV */                                                                                \
-    {SFUD_MF_ID_WINBOND, 0x40, 0x18, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO},     \
+    {SFUD_MF_ID_WINBOND, 0x40, 0x18, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO|CONTINUOUS_READ|WRAP_READ|QUAD_PROGRAM}, \
     /* W25Q256FV */                                                                                \
-    {SFUD_MF_ID_WINBOND, 0x40, 0x19, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO},     \
+    {SFUD_MF_ID_WINBOND, 0x40, 0x19, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO|CONTINUOUS_READ|WRAP_READ|QUAD_PROGRAM}, \
+    /* W25Q64JV-IM/JM (DTR) */                                                                     \
+    {SFUD_MF_ID_WINBOND, 0x70, 0x17, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO|QUAD_IO_DTR|CONTINUOUS_READ|WRAP_READ|QUAD_PROGRAM}, \
+    /* W25Q128JV-IM/JM (DTR) */                                                                    \
+    {SFUD_MF_ID_WINBOND, 0x70, 0x18, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO|QUAD_IO_DTR|CONTINUOUS_READ|WRAP_READ|QUAD_PROGRAM}, \
+    /* W25Q256JV-IM/JM (DTR) */                                                                    \
+    {SFUD_MF_ID_WINBOND, 0x70, 0x19, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO|QUAD_IO_DTR|CONTINUOUS_READ|WRAP_READ|QUAD_PROGRAM}, \
     /* EN25Q32B */                                                                                 \
     {SFUD_MF_ID_EON, 0x30, 0x16, NORMAL_SPI_READ|DUAL_OUTPUT|QUAD_IO},                             \
     /* S25FL216K */                                                                                \
@@ -190,7 +196,7 @@ typedef struct {
     /* MX25L3206E and KH25L3206E */                                                                \
     {SFUD_MF_ID_MACRONIX, 0x20, 0x16, NORMAL_SPI_READ|DUAL_OUTPUT},                                \
     /* MX25L51245G */                                                                              \
-    {SFUD_MF_ID_MACRONIX, 0x20, 0x1A, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO},    \
+    {SFUD_MF_ID_MACRONIX, 0x20, 0x1A, NORMAL_SPI_READ|DUAL_OUTPUT|DUAL_IO|QUAD_OUTPUT|QUAD_IO|CONTINUOUS_READ|QUAD_IO_PROGRAM}, \
     /* GD25Q64B */                                                                                 \
     {SFUD_MF_ID_GIGADEVICE, 0x40, 0x17, NORMAL_SPI_READ|DUAL_OUTPUT},                              \
     /* NM25Q128EVB */                                                                              \
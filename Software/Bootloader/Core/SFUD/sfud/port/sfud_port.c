@@ -27,15 +27,16 @@
  */
 
 #include <sfud.h>
-#include <stdarg.h>
-#include <stdio.h>
 #include <stm32h7xx_hal.h>
 #include <stm32h7xx_hal_gpio.h>
 #include "octospi.h"
 #include "spi.h"
+#include "boot_time.h"
+#include "boot_trace.h"
 #include <string.h>
+#include <stddef.h>
 
-static const char *const TAG = "SFUD";
+ELOG_TAG_DEFINE(TAG, "SFUD");
 
 sfud_err qspi_write_read(
     const sfud_spi *spi,
@@ -49,6 +50,18 @@ sfud_err qspi_read(
     uint8_t *read_buf, size_t read_size
 );
 
+/* one indirect command as OCTOSPI register values, for the register-level paths which bypass the HAL */
+typedef struct {
+    uint32_t ccr;                                /**< CCR, the phases and their line modes */
+    uint32_t tcr;                                /**< TCR with the dummy cycles of the command */
+    uint32_t ir;                                 /**< instruction */
+    uint32_t ar;                                 /**< address, when CCR has an address phase */
+    uint32_t abr;                                /**< alternate bytes, when CCR has an alternate bytes phase */
+    uint32_t size;                               /**< data bytes, 0: no data phase */
+    const uint8_t *write_buf;                    /**< data to send */
+    uint8_t *read_buf;                           /**< data to receive, a read when not NULL */
+} qspi_reg_cmd;
+
 typedef struct {
     union {
         OSPI_HandleTypeDef *ospi_handle;
@@ -57,14 +70,43 @@ typedef struct {
     uint32_t memory_mapped_addr;
     GPIO_TypeDef *cs_gpiox;
     uint16_t cs_gpio_pin;
+    volatile uint8_t owned;                      /**< the bus is owned by a SFUD operation */
+    volatile bool dma_busy;                      /**< a DMA read is in flight */
+    volatile bool poll_busy;                     /**< the auto-polling has not matched yet */
+    volatile sfud_err dma_result;                /**< result of the last DMA read */
+    uint8_t *async_buf;                          /**< buffer of the background read, NULL: none */
+    size_t async_size;                           /**< size of the background read */
+    bool read_valid;                             /**< the read command below is made */
+    sfud_qspi_read_cmd_format read_format;       /**< read_cmd_format the read command is made of */
+    OSPI_RegularCmdTypeDef read_cmd;             /**< HAL command of the read, address and size left */
+    qspi_reg_cmd read_reg;                       /**< register images of the read, TCR holds the dummy cycles */
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    bool dual_quad;                              /**< the OCTOSPI is in dual-quad mode, see qspi_dual_xfer() */
+#endif
 } spi_user_data, *spi_user_data_t;
 
+/* commands with at most this many data bytes go by qspi_reg_command_run(): WREN, status, IDs */
+#define QSPI_REG_CMD_MAX_SIZE           4
+
+#ifdef SFUD_USING_QSPI_DMA
+/* the MDMA moves whole cache lines, the buffer must not share a line with other data */
+#define QSPI_DMA_ALIGN                  32
+/* MDMA block data length is 17 bits */
+#define QSPI_DMA_MAX_SIZE               (64 * 1024)
+
+sfud_err qspi_read_async(sfud_flash *flash, uint32_t addr, uint8_t *read_buf, size_t read_size);
+
+sfud_err qspi_read_async_wait(sfud_flash *flash);
+#endif
+
 sfud_err qspi_send_then_recv(
     const sfud_spi *spi,
     const void *send_buf, size_t send_length,
     void *recv_buf, size_t recv_length
 );
 
+sfud_err qspi_xfer(const sfud_spi *spi, const sfud_spi_xfer *xfer);
+
 sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash);
 
 sfud_err qspi_exit_memory_mapped_mode(sfud_flash *flash);
@@ -82,204 +124,326 @@ spi_user_data spi2 = {
     .cs_gpio_pin = 0
 };
 
-static char log_buf[256];
-
-void sfud_log_info(const char *format, ...);
-
-void sfud_log_debug(const char *file, const long line, const char *format, ...);
+#ifdef SFUD_USING_PROBE_CACHE
+/* probe cache of every flash device, kept over warm resets */
+static sfud_probe_cache probe_cache[SFUD_FLASH_DEVICE_NUM] __attribute__((section(".noinit_d3")));
+#endif
 
+/**
+ * take the ownership of the bus, the interrupts keep running during long erase and write
+ *
+ * @note bare metal, the flash must not be used from an interrupt handler, it would spin here forever
+ */
 static void spi_lock(const sfud_spi *spi) {
-    __disable_irq();
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+
+    do {
+        while (__LDREXB(&spi_dev->owned) != 0);
+    } while (__STREXB(1, &spi_dev->owned) != 0);
+    __DMB();
 }
 
 static void spi_unlock(const sfud_spi *spi) {
-    __enable_irq();
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+
+    __DMB();
+    spi_dev->owned = 0;
+}
+
+/* the sfud_spi is always the spi member of its flash device */
+static inline const sfud_flash *qspi_flash_of(const sfud_spi *spi) {
+    return (const sfud_flash *) ((const uint8_t *) spi - offsetof(sfud_flash, spi));
 }
 
 /**
- * SPI write data then read data
+ * set the memory-mapped window to the flash capacity, the OCTOSPI init only knows the board's default part
+ *
+ * @note the DCR1 register can only be written while the OCTOSPI is not busy
  */
-sfud_err qspi_write_read(
-    const sfud_spi *spi,
-    const uint8_t *write_buf, size_t write_size,
-    uint8_t *read_buf, size_t read_size
-) {
-    sfud_err result = SFUD_SUCCESS;
-
-    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+static void qspi_set_device_size(OSPI_HandleTypeDef *hospi, uint32_t capacity) {
+    /* Init.DeviceSize is the number of address bits, DCR1.DEVSIZE is one less */
+    uint32_t dev_size = capacity > 2 ? 32 - __CLZ(capacity - 1) : 1;
 
-    if (write_size) {
-        SFUD_ASSERT(write_buf);
-    }
-    if (read_size) {
-        SFUD_ASSERT(read_buf);
+    if (capacity == 0 || hospi->Init.DeviceSize == dev_size) {
+        return;
     }
+    while (hospi->Instance->SR & OCTOSPI_SR_BUSY);
+    MODIFY_REG(hospi->Instance->DCR1, OCTOSPI_DCR1_DEVSIZE, (dev_size - 1) << OCTOSPI_DCR1_DEVSIZE_Pos);
+    hospi->Init.DeviceSize = dev_size;
+}
 
-    bool in_memory_mapping = (spi_dev->ospi_handle->Instance->CR & OCTOSPI_CR_FMODE_Msk) == OCTOSPI_CR_FMODE;
-//    uint8_t *write_ram_buf = NULL;
-    if (in_memory_mapping) {
-////        log_d("Memory Mapped Mode, Exit it");
-//        // check the data to trans is in ext flash or not
-//        if ((uint32_t) write_buf > spi_dev->memory_mapped_addr) {
-//            return SFUD_ERR_WRITE;
-////            log_d("write_buf is in ext flash, copy it to ram");
-////            write_ram_buf = malloc(write_size);
-////            memcpy(write_ram_buf, write_buf, write_size);
-////            write_buf = write_ram_buf;
-//        }
-//        qspi_exit_memory_mapped_mode(spi_dev->ospi_handle);
-        elog_e(TAG, "should not write when in memory mapping mode");
-        return SFUD_ERR_WRITE;
-    }
+/* sample shift of the STR commands, the timing calibration drops it for a point of the delay block */
+static uint32_t qspi_str_sshift = OCTOSPI_TCR_SSHIFT;
 
-    /* reset cs pin */
-    if (spi_dev->cs_gpiox != NULL)
-        HAL_GPIO_WritePin(spi_dev->cs_gpiox, spi_dev->cs_gpio_pin, GPIO_PIN_RESET);
+/**
+ * set the OCTOSPI sampling timing for the STR or DTR read
+ *
+ * @note the TCR register can only be written while the OCTOSPI is not busy
+ */
+static void qspi_set_dtr_timing(OSPI_HandleTypeDef *hospi, bool dtr) {
+    /* DTR: no sample shifting, the output data is held a quarter cycle (AN5050) */
+    uint32_t timing = dtr ? OCTOSPI_TCR_DHQC : qspi_str_sshift;
 
-    if (write_size && read_size) {        /* read data */
-        qspi_send_then_recv(spi, write_buf, write_size, read_buf, read_size);
-    } else if (write_size) {        /* send data */
-        qspi_send_then_recv(spi, write_buf, write_size, NULL, 0);
+    if ((hospi->Instance->TCR & (OCTOSPI_TCR_SSHIFT | OCTOSPI_TCR_DHQC)) == timing) {
+        return;
     }
+    while (hospi->Instance->SR & OCTOSPI_SR_BUSY);
+    MODIFY_REG(hospi->Instance->TCR, OCTOSPI_TCR_SSHIFT | OCTOSPI_TCR_DHQC, timing);
+    /* keep the handle in sync, HAL_OSPI_Init() writes it back */
+    hospi->Init.SampleShifting = timing & OCTOSPI_TCR_SSHIFT ? HAL_OSPI_SAMPLE_SHIFTING_HALFCYCLE
+                                                             : HAL_OSPI_SAMPLE_SHIFTING_NONE;
+    hospi->Init.DelayHoldQuarterCycle = dtr ? HAL_OSPI_DHQC_ENABLE : HAL_OSPI_DHQC_DISABLE;
+}
 
-    /* set cs pin */
-    if (spi_dev->cs_gpiox != NULL)
-        HAL_GPIO_WritePin(spi_dev->cs_gpiox, spi_dev->cs_gpio_pin, GPIO_PIN_SET);
+/**
+ * OSPI line modes of the sfud_spi_xfer lines, 0: 1 line
+ */
+static uint32_t qspi_instruction_lines(uint8_t lines) {
+    switch (lines) {
+    case 4: return HAL_OSPI_INSTRUCTION_4_LINES;
+    case 2: return HAL_OSPI_INSTRUCTION_2_LINES;
+    default: return HAL_OSPI_INSTRUCTION_1_LINE;
+    }
+}
+
+static uint32_t qspi_address_lines(uint8_t lines) {
+    switch (lines) {
+    case 4: return HAL_OSPI_ADDRESS_4_LINES;
+    case 2: return HAL_OSPI_ADDRESS_2_LINES;
+    default: return HAL_OSPI_ADDRESS_1_LINE;
+    }
+}
 
-//    if (in_memory_mapping) {
-////        log_d("Enter Memory Mapped Mode");
-//        qspi_entry_memory_mapped_mode(0);
-//    }
+static uint32_t qspi_data_lines(uint8_t lines) {
+    switch (lines) {
+    case 4: return HAL_OSPI_DATA_4_LINES;
+    case 2: return HAL_OSPI_DATA_2_LINES;
+    default: return HAL_OSPI_DATA_1_LINE;
+    }
+}
 
-//    if (write_ram_buf) {
-//        free(write_ram_buf);
-//    }
+/* clocks of the dummy bytes, 8 a byte, 2 on the four lines of the QPI mode */
+static uint32_t qspi_dummy_cycles(const sfud_spi_xfer *xfer) {
+    return xfer->dummy_size * (xfer->instruction_lines == 4 ? 2U : 8U);
+}
 
-    return result;
+static void qspi_reg_cmd_make(qspi_reg_cmd *cmd, uint32_t tcr, const sfud_spi_xfer *xfer, uint32_t imode) {
+    memset(cmd, 0, sizeof(qspi_reg_cmd));
+    cmd->ccr = imode | HAL_OSPI_INSTRUCTION_8_BITS;
+    if (xfer->addr_size) {
+        cmd->ccr |= qspi_address_lines(xfer->addr_lines)
+                | (xfer->addr_size == 4 ? HAL_OSPI_ADDRESS_32_BITS : HAL_OSPI_ADDRESS_24_BITS);
+    }
+    if (xfer->data_size) {
+        cmd->ccr |= qspi_data_lines(xfer->data_lines);
+    }
+    /* register access is always STR, undo the timing left by a DTR read */
+    cmd->tcr = (tcr & ~(OCTOSPI_TCR_DCYC | OCTOSPI_TCR_DHQC | OCTOSPI_TCR_SSHIFT)) | qspi_str_sshift
+            | qspi_dummy_cycles(xfer);
+    cmd->ir = xfer->instruction;
+    cmd->ar = xfer->addr;
+    cmd->size = xfer->data_size;
+    cmd->write_buf = xfer->write_buf;
+    cmd->read_buf = xfer->read_buf;
 }
 
 /**
- * QSPI fast read data
+ * run one indirect command by polling the registers, inlined into the ITCM code
+ *
+ * @param cr CR with the mode bits the command leaves in, FMODE and FTHRES are set here
  */
-sfud_err qspi_read(
-    const struct __sfud_spi *spi, uint32_t addr,
-    sfud_qspi_read_cmd_format *qspi_read_cmd_format,
-    uint8_t *read_buf, size_t read_size
-) {
-    sfud_err result = SFUD_SUCCESS;
-    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
-
-    if ((spi_dev->ospi_handle->Instance->CR & OCTOSPI_CR_FMODE_Msk) == OCTOSPI_CR_FMODE) {
-        // in memory-mapping mode, just read it
-        memcpy(read_buf, (uint8_t *) (spi_dev->memory_mapped_addr + addr), read_size);
-        return result;
+static inline __attribute__((always_inline)) bool qspi_reg_cmd_run(OCTOSPI_TypeDef *ospi, uint32_t cr,
+                                                                    const qspi_reg_cmd *cmd) {
+    uint32_t i;
+    bool result;
+
+    /* indirect read or write, FIFO threshold of one byte */
+    ospi->CR = (cr & ~(OCTOSPI_CR_FMODE | OCTOSPI_CR_FTHRES)) | (cmd->read_buf ? OCTOSPI_CR_FMODE_0 : 0);
+    if (cmd->size) {
+        ospi->DLR = cmd->size - 1;
+    }
+    ospi->TCR = cmd->tcr;
+    ospi->CCR = cmd->ccr;
+    if (cmd->ccr & OCTOSPI_CCR_ABMODE) {
+        ospi->ABR = cmd->abr;
+    }
+    /* the command starts at the last of IR and AR it needs */
+    ospi->IR = cmd->ir;
+    if (cmd->ccr & OCTOSPI_CCR_ADMODE) {
+        ospi->AR = cmd->ar;
+    }
+    for (i = 0; i < cmd->size; i++) {
+        while (!(ospi->SR & (OCTOSPI_SR_FTF | OCTOSPI_SR_TEF))) {
+        }
+        if (ospi->SR & OCTOSPI_SR_TEF) {
+            break;
+        }
+        if (cmd->read_buf) {
+            cmd->read_buf[i] = *(volatile uint8_t *) &ospi->DR;
+        } else {
+            *(volatile uint8_t *) &ospi->DR = cmd->write_buf[i];
+        }
     }
+    while (!(ospi->SR & (OCTOSPI_SR_TCF | OCTOSPI_SR_TEF))) {
+    }
+    result = !(ospi->SR & OCTOSPI_SR_TEF);
+    ospi->FCR = OCTOSPI_FCR_CTCF | OCTOSPI_FCR_CTEF;
 
-    OSPI_RegularCmdTypeDef Cmdhandler;
-    memset(&Cmdhandler, 0, sizeof(Cmdhandler));
+    return result;
+}
 
-    Cmdhandler.OperationType = HAL_OSPI_OPTYPE_COMMON_CFG;             // 通用配置
-    Cmdhandler.FlashId = HAL_OSPI_FLASH_ID_1;                    // flash ID
+/**
+ * fill the OSPI regular command by the read cmd format, address and data size are left to the caller
+ *
+ * @param cmd OSPI regular command
+ * @param format read cmd format @see sfud_qspi_fast_read_enable
+ */
+static void qspi_read_cmd_setup(OSPI_RegularCmdTypeDef *cmd, const sfud_qspi_read_cmd_format *format) {
+    cmd->OperationType = HAL_OSPI_OPTYPE_COMMON_CFG;             // 通用配置
+    cmd->FlashId = HAL_OSPI_FLASH_ID_1;                    // flash ID
 
-    /* set cmd struct */
-    Cmdhandler.Instruction = qspi_read_cmd_format->instruction;
-    switch (qspi_read_cmd_format->instruction_lines) {
+    cmd->Instruction = format->instruction;
+    switch (format->instruction_lines) {
     case 0:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_NONE;
+        cmd->InstructionMode = HAL_OSPI_INSTRUCTION_NONE;
         break;
     case 1:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_1_LINE;
+        cmd->InstructionMode = HAL_OSPI_INSTRUCTION_1_LINE;
         break;
     case 2:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_2_LINES;
+        cmd->InstructionMode = HAL_OSPI_INSTRUCTION_2_LINES;
         break;
     case 4:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_4_LINES;
+        cmd->InstructionMode = HAL_OSPI_INSTRUCTION_4_LINES;
         break;
     case 8:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_8_LINES;
+        cmd->InstructionMode = HAL_OSPI_INSTRUCTION_8_LINES;
         break;
     default:
         break;
     }
-    Cmdhandler.InstructionSize = HAL_OSPI_INSTRUCTION_8_BITS;            // 指令长度8位
-    Cmdhandler.InstructionDtrMode = HAL_OSPI_INSTRUCTION_DTR_DISABLE;       // 禁止指令DTR模式
-
+    cmd->InstructionSize = HAL_OSPI_INSTRUCTION_8_BITS;            // 指令长度8位
+    /* the instruction of the quad DTR read (1-4D-4D) is still sent in STR */
+    cmd->InstructionDtrMode = HAL_OSPI_INSTRUCTION_DTR_DISABLE;       // 禁止指令DTR模式
 
-    Cmdhandler.Address = addr;
-    switch (qspi_read_cmd_format->address_lines) {
+    switch (format->address_lines) {
     case 0:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_NONE;
+        cmd->AddressMode = HAL_OSPI_ADDRESS_NONE;
         break;
     case 1:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_1_LINE;
+        cmd->AddressMode = HAL_OSPI_ADDRESS_1_LINE;
         break;
     case 2:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_2_LINES;
+        cmd->AddressMode = HAL_OSPI_ADDRESS_2_LINES;
         break;
     case 4:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_4_LINES;
+        cmd->AddressMode = HAL_OSPI_ADDRESS_4_LINES;
         break;
     case 8:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_8_LINES;
+        cmd->AddressMode = HAL_OSPI_ADDRESS_8_LINES;
         break;
     default:
         break;
     }
-    Cmdhandler.AddressSize = HAL_OSPI_ADDRESS_24_BITS;
-    Cmdhandler.AddressDtrMode = HAL_OSPI_ADDRESS_DTR_DISABLE;
+    cmd->AddressSize = format->address_size == 32 ? HAL_OSPI_ADDRESS_32_BITS : HAL_OSPI_ADDRESS_24_BITS;
+    cmd->AddressDtrMode = format->dtr ? HAL_OSPI_ADDRESS_DTR_ENABLE : HAL_OSPI_ADDRESS_DTR_DISABLE;
 
-    Cmdhandler.AlternateBytes = 0;
-    Cmdhandler.AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_NONE;
-    Cmdhandler.AlternateBytesSize = 0;
-    Cmdhandler.AlternateBytesDtrMode = HAL_OSPI_ALTERNATE_BYTES_DTR_DISABLE;   // 禁止替字节DTR模式
+    /* the mode bits, the memory-mapped mode may replace them to stay in continuous read */
+    cmd->AlternateBytes = SFUD_QSPI_MODE_BITS_NORMAL;
+    switch (format->alternate_bytes_lines) {
+    case 1:
+        cmd->AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_1_LINE;
+        break;
+    case 2:
+        cmd->AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_2_LINES;
+        break;
+    case 4:
+        cmd->AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_4_LINES;
+        break;
+    case 8:
+        cmd->AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_8_LINES;
+        break;
+    default:
+        cmd->AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_NONE;
+        break;
+    }
+    cmd->AlternateBytesSize = HAL_OSPI_ALTERNATE_BYTES_8_BITS;
+    cmd->AlternateBytesDtrMode = format->dtr ? HAL_OSPI_ALTERNATE_BYTES_DTR_ENABLE
+                                             : HAL_OSPI_ALTERNATE_BYTES_DTR_DISABLE;
 
-    switch (qspi_read_cmd_format->data_lines) {
+    switch (format->data_lines) {
     case 0:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_NONE;
+        cmd->DataMode = HAL_OSPI_DATA_NONE;
         break;
     case 1:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_1_LINE;
+        cmd->DataMode = HAL_OSPI_DATA_1_LINE;
         break;
     case 2:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_2_LINES;
+        cmd->DataMode = HAL_OSPI_DATA_2_LINES;
         break;
     case 4:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_4_LINES;
+        cmd->DataMode = HAL_OSPI_DATA_4_LINES;
         break;
     case 8:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_8_LINES;
+        cmd->DataMode = HAL_OSPI_DATA_8_LINES;
         break;
     default:
         break;
     }
-    Cmdhandler.NbData = read_size;
-    Cmdhandler.DataDtrMode = HAL_OSPI_DATA_DTR_DISABLE;
+    cmd->DataDtrMode = format->dtr ? HAL_OSPI_DATA_DTR_ENABLE : HAL_OSPI_DATA_DTR_DISABLE;
 
-    Cmdhandler.DummyCycles = qspi_read_cmd_format->dummy_cycles;
-
-    Cmdhandler.DQSMode = HAL_OSPI_DQS_DISABLE;                   // 不使用DQS
-    Cmdhandler.SIOOMode = HAL_OSPI_SIOO_INST_EVERY_CMD;
+    cmd->DummyCycles = format->dummy_cycles;
 
-    // 写配置
-    if (HAL_OSPI_Command(spi_dev->ospi_handle, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-//        sfud_log_info("qspi send cmd failed(%d)!", spi_dev->ospi_handle->ErrorCode);
-        return SFUD_ERR_READ;
-    }
+    cmd->DQSMode = HAL_OSPI_DQS_DISABLE;                   // 不使用DQS
+    cmd->SIOOMode = HAL_OSPI_SIOO_INST_EVERY_CMD;
+}
 
-    if (HAL_OSPI_Receive(spi_dev->ospi_handle, read_buf, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-//        sfud_log_info("qspi recv data failed(%d)!", spi_dev->ospi_handle->ErrorCode);
-        result = SFUD_ERR_READ;
+/**
+ * the read command of the format, made again only when the format differs from the last one
+ *
+ * sfud_qspi_fast_read_enable(), the probe cache and the 4-Byte address switch all change the format of the
+ * core, the port compares it at each read instead of rebuilding the command with the four switches above.
+ *
+ * @param spi_dev OSPI device, its timing is switched for the DTR read
+ * @param format read cmd format
+ *
+ * @return HAL command of the read, spi_dev->read_reg has the same as register images
+ */
+static const OSPI_RegularCmdTypeDef *qspi_read_cmd_get(spi_user_data_t spi_dev,
+                                                       const sfud_qspi_read_cmd_format *format) {
+    OSPI_RegularCmdTypeDef *cmd = &spi_dev->read_cmd;
+    qspi_reg_cmd *reg = &spi_dev->read_reg;
+
+    if (!spi_dev->read_valid || memcmp(&spi_dev->read_format, format, sizeof(sfud_qspi_read_cmd_format))) {
+        memset(cmd, 0, sizeof(OSPI_RegularCmdTypeDef));
+        qspi_read_cmd_setup(cmd, format);
+        /* the HAL modes are the CCR fields */
+        memset(reg, 0, sizeof(qspi_reg_cmd));
+        reg->ccr = cmd->InstructionMode | cmd->InstructionSize | cmd->InstructionDtrMode
+                | cmd->AddressMode | cmd->AddressSize | cmd->AddressDtrMode
+                | cmd->AlternateBytesMode | cmd->AlternateBytesSize | cmd->AlternateBytesDtrMode
+                | cmd->DataMode | cmd->DataDtrMode | cmd->DQSMode | cmd->SIOOMode;
+        reg->tcr = cmd->DummyCycles;
+        reg->ir = cmd->Instruction;
+        reg->abr = cmd->AlternateBytes;
+        spi_dev->read_format = *format;
+        spi_dev->read_valid = true;
     }
+    qspi_set_dtr_timing(spi_dev->ospi_handle, format->dtr);
 
-    return result;
+    return cmd;
 }
 
-static sfud_err spi_write_read(
+/**
+ * SPI write data then read data
+ */
+sfud_err qspi_write_read(
     const sfud_spi *spi,
     const uint8_t *write_buf, size_t write_size,
-    uint8_t *read_buf, size_t read_size) {
+    uint8_t *read_buf, size_t read_size
+) {
     sfud_err result = SFUD_SUCCESS;
+
     spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
 
     if (write_size) {
@@ -289,161 +453,1278 @@ static sfud_err spi_write_read(
         SFUD_ASSERT(read_buf);
     }
 
-    uint32_t buf_size = write_size + read_size;
-
-    if (buf_size == 0) {
+#ifndef SFUD_USING_QSPI_XIP_WRITE
+    if ((spi_dev->ospi_handle->Instance->CR & OCTOSPI_CR_FMODE_Msk) == OCTOSPI_CR_FMODE) {
+        elog_e(TAG, "should not write when in memory mapping mode");
         return SFUD_ERR_WRITE;
     }
+#endif
 
-    uint8_t *send_buf = (uint8_t *) malloc(buf_size);
-    uint8_t *recv_buf = (uint8_t *) malloc(buf_size);
+    /* reset cs pin */
+    if (spi_dev->cs_gpiox != NULL)
+        HAL_GPIO_WritePin(spi_dev->cs_gpiox, spi_dev->cs_gpio_pin, GPIO_PIN_RESET);
 
-    if (!send_buf || !recv_buf) {
-        elog_e("SFUD", "malloc failed");
-        return SFUD_ERR_WRITE;
+    if (write_size && read_size) {        /* read data */
+        result = qspi_send_then_recv(spi, write_buf, write_size, read_buf, read_size);
+    } else if (write_size) {        /* send data */
+        result = qspi_send_then_recv(spi, write_buf, write_size, NULL, 0);
     }
 
-    memset(send_buf, SFUD_DUMMY_DATA, buf_size);
-    memcpy(send_buf, write_buf, write_size);
+    /* set cs pin */
+    if (spi_dev->cs_gpiox != NULL)
+        HAL_GPIO_WritePin(spi_dev->cs_gpiox, spi_dev->cs_gpio_pin, GPIO_PIN_SET);
+
+    return result;
+}
 
-    HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
+/**
+ * QSPI fast read data by polling the FIFO, straight on the registers
+ */
+static sfud_err qspi_read_blocking(
+    spi_user_data_t spi_dev, uint32_t addr,
+    const sfud_qspi_read_cmd_format *qspi_read_cmd_format,
+    uint8_t *read_buf, size_t read_size
+) {
+    OCTOSPI_TypeDef *ospi = spi_dev->ospi_handle->Instance;
+    qspi_reg_cmd cmd;
+    uint32_t cr;
+    bool result;
 
-    if (HAL_OK != HAL_SPI_TransmitReceive(spi_dev->spi_handle, send_buf, recv_buf, buf_size, 1000)) {
-        free(send_buf);
-        free(recv_buf);
-        return SFUD_ERR_TIMEOUT;
+    qspi_read_cmd_get(spi_dev, qspi_read_cmd_format);
+    while (ospi->SR & OCTOSPI_SR_BUSY) {
     }
+    cmd = spi_dev->read_reg;
+    /* the sampling timing is the one qspi_read_cmd_get() left */
+    cmd.tcr = (ospi->TCR & ~OCTOSPI_TCR_DCYC) | spi_dev->read_reg.tcr;
+    cmd.ar = addr;
+    cmd.size = read_size;
+    cmd.read_buf = read_buf;
+    cr = ospi->CR;
+    result = qspi_reg_cmd_run(ospi, cr, &cmd);
+    /* the FIFO threshold of the HAL transfers */
+    ospi->CR = cr;
+
+    return result ? SFUD_SUCCESS : SFUD_ERR_READ;
+}
 
-    HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
+#ifdef SFUD_USING_QSPI_DMA
+/**
+ * start a QSPI fast read moved by the MDMA, the buffer and size must be QSPI_DMA_ALIGN aligned
+ */
+static sfud_err qspi_read_dma_start(
+    spi_user_data_t spi_dev, uint32_t addr,
+    const sfud_qspi_read_cmd_format *qspi_read_cmd_format,
+    uint8_t *read_buf, size_t read_size
+) {
+    OSPI_RegularCmdTypeDef Cmdhandler = *qspi_read_cmd_get(spi_dev, qspi_read_cmd_format);
+
+    Cmdhandler.Address = addr;
+    Cmdhandler.NbData = read_size;
 
-    memcpy(read_buf, recv_buf + write_size, read_size);
+    /* drop the lines of the buffer, no eviction may overwrite the DMA data */
+    SCB_InvalidateDCache_by_Addr(read_buf, (int32_t) read_size);
 
-    free(send_buf);
-    free(recv_buf);
+    if (HAL_OSPI_Command(spi_dev->ospi_handle, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return SFUD_ERR_READ;
+    }
 
-    return result;
+    spi_dev->dma_result = SFUD_SUCCESS;
+    spi_dev->dma_busy = true;
+    boot_trace_begin(BOOT_TRACE_OSPI_DMA, read_size);
+    if (HAL_OSPI_Receive_DMA(spi_dev->ospi_handle, read_buf) != HAL_OK) {
+        spi_dev->dma_busy = false;
+        return SFUD_ERR_READ;
+    }
+
+    return SFUD_SUCCESS;
 }
 
-/* about 100 microsecond delay */
-static void retry_delay_100us(void) {
-    uint32_t delay = 2400;
-    while (delay--);
+/**
+ * wait the DMA read started by qspi_read_dma_start()
+ */
+static sfud_err qspi_read_dma_wait(spi_user_data_t spi_dev, uint8_t *read_buf, size_t read_size) {
+    OSPI_HandleTypeDef *hospi = spi_dev->ospi_handle;
+
+    while (spi_dev->dma_busy) {
+        /* called with the interrupts masked, serve the handlers here */
+        if (__get_PRIMASK()) {
+            HAL_MDMA_IRQHandler(hospi->hmdma);
+            HAL_OSPI_IRQHandler(hospi);
+        }
+    }
+    /* the CPU may have fetched the lines speculatively during the transfer */
+    SCB_InvalidateDCache_by_Addr(read_buf, (int32_t) read_size);
+
+    return spi_dev->dma_result;
 }
 
-sfud_err sfud_spi_port_init(sfud_flash *flash) {
-    // peripheral is inited by `MX_XXX_Init()`
+void HAL_OSPI_RxCpltCallback(OSPI_HandleTypeDef *hospi) {
+    if (hospi == ospi1.ospi_handle) {
+        boot_trace_end(BOOT_TRACE_OSPI_DMA, 0);
+        ospi1.dma_busy = false;
+    }
+}
+
+void HAL_OSPI_ErrorCallback(OSPI_HandleTypeDef *hospi) {
+    if (hospi == ospi1.ospi_handle && ospi1.dma_busy) {
+        boot_trace_end(BOOT_TRACE_OSPI_DMA, 0);
+        ospi1.dma_result = SFUD_ERR_READ;
+        ospi1.dma_busy = false;
+    }
+}
+#endif /* SFUD_USING_QSPI_DMA */
+
+#ifdef SFUD_USING_QSPI_DUALQUAD
+/* a read of qspi_dual_read_pairs(), whole byte pairs of the array */
+typedef struct {
+    const sfud_spi *spi;
+    const sfud_spi_xfer *xfer;                   /**< qspi_xfer() read, NULL: qspi_read() */
+    sfud_qspi_read_cmd_format *format;           /**< read format of qspi_read() */
+} qspi_dual_read_ctx;
+
+typedef sfud_err (*qspi_dual_read_fn)(const qspi_dual_read_ctx *ctx, uint32_t addr, uint8_t *buf, size_t size);
+
+/**
+ * read a range of the array of a dual-quad flash: an odd head or tail is read as the whole pair of the two parts
+ */
+static sfud_err qspi_dual_read_pairs(qspi_dual_read_fn read, const qspi_dual_read_ctx *ctx, uint32_t addr,
+                                     uint8_t *buf, size_t size) {
+    uint8_t pair[2];
+    size_t even;
     sfud_err result = SFUD_SUCCESS;
 
-    switch (flash->index) {
-    case SFUD_MAIN_FLASH: {
-        /* set the interfaces and data */
-        flash->spi.wr = qspi_write_read;
-        flash->spi.qspi_read = qspi_read;
-        flash->spi.lock = spi_lock;
-        flash->spi.unlock = spi_unlock;
-        flash->spi.user_data = &ospi1;
-        /* about 100 microsecond delay */
-        flash->retry.delay = retry_delay_100us;
-        /* adout 60 seconds timeout */
-        flash->retry.times = 60 * 10000;
-        break;
+    if (size && (addr & 1)) {
+        result = read(ctx, addr - 1, pair, 2);
+        buf[0] = pair[1];
+        addr++;
+        buf++;
+        size--;
     }
-    case SFUD_EXT_FLASH: {
-        /* set the interfaces and data */
-        flash->spi.wr = spi_write_read;
-        flash->spi.lock = spi_lock;
-        flash->spi.unlock = spi_unlock;
-        flash->spi.user_data = &spi2;
-        /* about 100 microsecond delay */
-        flash->retry.delay = retry_delay_100us;
-        /* adout 60 seconds timeout */
-        flash->retry.times = 60 * 10000;
-        break;
+    even = size & ~(size_t) 1;
+    if (result == SFUD_SUCCESS && even) {
+        result = read(ctx, addr, buf, even);
+        addr += even;
+        buf += even;
     }
+    if (result == SFUD_SUCCESS && (size & 1)) {
+        result = read(ctx, addr, pair, 2);
+        buf[0] = pair[0];
     }
-
     return result;
 }
 
+static sfud_err qspi_dual_read_array(const qspi_dual_read_ctx *ctx, uint32_t addr, uint8_t *buf, size_t size) {
+    return qspi_read(ctx->spi, addr, ctx->format, buf, size);
+}
+#endif /* SFUD_USING_QSPI_DUALQUAD */
+
 /**
- * This function is print debug info.
+ * QSPI fast read data
  *
- * @param file the file which has call this function
- * @param line the line number which has call this function
- * @param format output format
- * @param ... args
+ * The cache line aligned middle part of a large read is moved by the MDMA, the unaligned head and tail are polled.
  */
-void sfud_log_debug(const char *file, const long line, const char *format, ...) {
-    va_list args;
+sfud_err qspi_read(
+    const struct __sfud_spi *spi, uint32_t addr,
+    sfud_qspi_read_cmd_format *qspi_read_cmd_format,
+    uint8_t *read_buf, size_t read_size
+) {
+    sfud_err result = SFUD_SUCCESS;
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+
+    if ((spi_dev->ospi_handle->Instance->CR & OCTOSPI_CR_FMODE_Msk) == OCTOSPI_CR_FMODE) {
+        // in memory-mapping mode, just read it
+        memcpy(read_buf, (uint8_t *) (spi_dev->memory_mapped_addr + addr), read_size);
+        return result;
+    }
+
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    if (spi_dev->dual_quad && ((addr | read_size) & 1)) {
+        qspi_dual_read_ctx ctx = { spi, NULL, qspi_read_cmd_format };
+
+        return qspi_dual_read_pairs(qspi_dual_read_array, &ctx, addr, read_buf, read_size);
+    }
+#endif
+#ifdef SFUD_USING_QSPI_DMA
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    /* the polled head of an odd buffer would leave the DMA an odd address */
+    if (read_size >= SFUD_QSPI_DMA_MIN_SIZE && !(spi_dev->dual_quad && ((uintptr_t) read_buf & 1))) {
+#else
+    if (read_size >= SFUD_QSPI_DMA_MIN_SIZE) {
+#endif
+        size_t head = (QSPI_DMA_ALIGN - ((uintptr_t) read_buf % QSPI_DMA_ALIGN)) % QSPI_DMA_ALIGN, size;
+
+        if (head) {
+            result = qspi_read_blocking(spi_dev, addr, qspi_read_cmd_format, read_buf, head);
+            addr += head;
+            read_buf += head;
+            read_size -= head;
+        }
+        while (result == SFUD_SUCCESS && read_size >= QSPI_DMA_ALIGN) {
+            size = read_size > QSPI_DMA_MAX_SIZE ? QSPI_DMA_MAX_SIZE : read_size - read_size % QSPI_DMA_ALIGN;
+            result = qspi_read_dma_start(spi_dev, addr, qspi_read_cmd_format, read_buf, size);
+            if (result == SFUD_SUCCESS) {
+                result = qspi_read_dma_wait(spi_dev, read_buf, size);
+            }
+            addr += size;
+            read_buf += size;
+            read_size -= size;
+        }
+        if (result != SFUD_SUCCESS || read_size == 0) {
+            return result;
+        }
+    }
+#endif
 
-    /* args point to the first variable parameter */
-    va_start(args, format);
-    elog_raw_output("[SFUD](%s:%ld) ", file, line);
-    /* must use vprintf to print */
-    vsnprintf(log_buf, sizeof(log_buf), format, args);
-    elog_raw_output("%s\r\n", log_buf);
-    va_end(args);
+    return qspi_read_blocking(spi_dev, addr, qspi_read_cmd_format, read_buf, read_size);
 }
 
+#ifdef SFUD_USING_QSPI_DMA
 /**
- * This function is print routine info.
+ * start a QSPI fast read in the background, the CPU can process the previous block meanwhile
+ *
+ * @note the read buffer and size must be 32 bytes aligned, the size must be 64KB at most
+ *
+ * @param flash flash device, the fast read must be enabled
+ * @param addr flash address
+ * @param read_buf read buffer, it must not be touched until qspi_read_async_wait() returns
+ * @param read_size read size
  *
- * @param format output format
- * @param ... args
+ * @return result
  */
-void sfud_log_info(const char *format, ...) {
-    va_list args;
+sfud_err qspi_read_async(sfud_flash *flash, uint32_t addr, uint8_t *read_buf, size_t read_size) {
+    const sfud_spi *spi = &flash->spi;
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+    sfud_err result;
+
+    if (spi->qspi_read != qspi_read || spi_dev->dma_busy || read_size == 0 || read_size > QSPI_DMA_MAX_SIZE
+            || (uintptr_t) read_buf % QSPI_DMA_ALIGN || read_size % QSPI_DMA_ALIGN
+            || addr + read_size > flash->chip.capacity
+#ifdef SFUD_USING_QSPI_DUALQUAD
+            || (spi_dev->dual_quad && (addr & 1))
+#endif
+            || (spi_dev->ospi_handle->Instance->CR & OCTOSPI_CR_FMODE_Msk) == OCTOSPI_CR_FMODE) {
+        return SFUD_ERR_READ;
+    }
+
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+    result = qspi_read_dma_start(spi_dev, addr, &flash->read_cmd_format, read_buf, read_size);
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
 
-    /* args point to the first variable parameter */
-    va_start(args, format);
-    elog_raw_output("[SFUD]");
-    /* must use vprintf to print */
-    vsnprintf(log_buf, sizeof(log_buf), format, args);
-    elog_raw_output("%s\r\n", log_buf);
-    va_end(args);
+    return result;
 }
 
 /**
- * This function can send or send then receive QSPI data.
+ * wait the background read started by qspi_read_async()
+ *
+ * @param flash flash device
+ *
+ * @return result of the read
+ */
+sfud_err qspi_read_async_wait(sfud_flash *flash) {
+    spi_user_data_t spi_dev = (spi_user_data_t) flash->spi.user_data;
+    OSPI_HandleTypeDef *hospi = spi_dev->ospi_handle;
+
+    return qspi_read_dma_wait(spi_dev, hospi->pBuffPtr, hospi->XferSize);
+}
+#endif /* SFUD_USING_QSPI_DMA */
+
+/* no SPI transfer may stall longer, same as the old blocking transfer */
+#define SPI_TIMEOUT_MS                  1000
+/* the HAL takes 16 bits sizes, NDTR of the DMA streams is 16 bits as well */
+#define SPI_DMA_MAX_SIZE                0xFFE0
+
+#ifdef SFUD_USING_SPI_DMA
+/* the cache maintenance works on whole lines */
+#define SPI_DMA_ALIGN                   32
+
+/**
+ * the DMA1 is a D2 master, it can't reach the ITCM and DTCM
+ */
+static bool spi_dma_reachable(const void *buf, size_t size) {
+    uintptr_t addr = (uintptr_t) buf;
+
+    if (addr < 0x00010000 || (addr < 0x20020000 && addr + size > 0x20000000)) {
+        return false;
+    }
+    return true;
+}
+
+#ifndef SFUD_USING_SPI_ENGINE
+/**
+ * wait the DMA transfer of the SPI bus
+ */
+static sfud_err spi_dma_wait(spi_user_data_t spi_dev) {
+    SPI_HandleTypeDef *hspi = spi_dev->spi_handle;
+    uint32_t start = HAL_GetTick();
+
+    while (spi_dev->dma_busy) {
+        /* called with the interrupts masked, serve the handlers here */
+        if (__get_PRIMASK()) {
+            if (hspi->hdmarx) {
+                HAL_DMA_IRQHandler(hspi->hdmarx);
+            }
+            if (hspi->hdmatx) {
+                HAL_DMA_IRQHandler(hspi->hdmatx);
+            }
+            HAL_SPI_IRQHandler(hspi);
+        }
+        /* HAL_GetTick() moves on with the interrupts masked too, see boot_time.h */
+        if (HAL_GetTick() - start > SPI_TIMEOUT_MS) {
+            HAL_SPI_Abort(hspi);
+            spi_dev->dma_busy = false;
+            return SFUD_ERR_TIMEOUT;
+        }
+    }
+
+    return spi_dev->dma_result;
+}
+#endif /* SFUD_USING_SPI_ENGINE */
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi == spi2.spi_handle) {
+        boot_trace_end(BOOT_TRACE_SPI2_DMA, 0);
+        spi2.dma_busy = false;
+    }
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi == spi2.spi_handle) {
+        boot_trace_end(BOOT_TRACE_SPI2_DMA, 0);
+        spi2.dma_busy = false;
+    }
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi == spi2.spi_handle && spi2.dma_busy) {
+        boot_trace_end(BOOT_TRACE_SPI2_DMA, 0);
+        spi2.dma_result = SFUD_ERR_TIMEOUT;
+        spi2.dma_busy = false;
+    }
+}
+#endif /* SFUD_USING_SPI_DMA */
+
+#ifndef SFUD_USING_SPI_ENGINE
+/**
+ * send on the SPI bus, the received data is dropped
+ */
+static sfud_err spi_transmit(spi_user_data_t spi_dev, const uint8_t *buf, size_t size) {
+    SPI_HandleTypeDef *hspi = spi_dev->spi_handle;
+    size_t len;
+
+    while (size) {
+        len = size > SPI_DMA_MAX_SIZE ? SPI_DMA_MAX_SIZE : size;
+#ifdef SFUD_USING_SPI_DMA
+        if (len >= SFUD_SPI_DMA_MIN_SIZE && spi_dma_reachable(buf, len)) {
+            /* the DMA reads the memory, write the dirty lines back first */
+            SCB_CleanDCache_by_Addr((uint32_t *) ((uintptr_t) buf & ~(uintptr_t) (SPI_DMA_ALIGN - 1)),
+                                    (int32_t) (len + (uintptr_t) buf % SPI_DMA_ALIGN));
+            spi_dev->dma_result = SFUD_SUCCESS;
+            spi_dev->dma_busy = true;
+            boot_trace_begin(BOOT_TRACE_SPI2_DMA, len);
+            if (HAL_SPI_Transmit_DMA(hspi, (uint8_t *) buf, (uint16_t) len) != HAL_OK) {
+                spi_dev->dma_busy = false;
+                return SFUD_ERR_WRITE;
+            }
+            if (spi_dma_wait(spi_dev) != SFUD_SUCCESS) {
+                return SFUD_ERR_WRITE;
+            }
+        } else
+#endif
+        if (HAL_SPI_Transmit(hspi, (uint8_t *) buf, (uint16_t) len, SPI_TIMEOUT_MS) != HAL_OK) {
+            return SFUD_ERR_TIMEOUT;
+        }
+        buf += len;
+        size -= len;
+    }
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * receive from the SPI bus straight into the buffer, the DMA moves the cache line aligned middle of a large read
+ */
+static sfud_err spi_receive(spi_user_data_t spi_dev, uint8_t *buf, size_t size) {
+    SPI_HandleTypeDef *hspi = spi_dev->spi_handle;
+    size_t len;
+
+    while (size) {
+        len = size > SPI_DMA_MAX_SIZE ? SPI_DMA_MAX_SIZE : size;
+#ifdef SFUD_USING_SPI_DMA
+        if (len >= SFUD_SPI_DMA_MIN_SIZE && spi_dma_reachable(buf, len)) {
+            size_t head = (SPI_DMA_ALIGN - ((uintptr_t) buf % SPI_DMA_ALIGN)) % SPI_DMA_ALIGN;
+
+            if (head) {
+                /* the head shares its cache line with other data, poll it */
+                len = head;
+            } else if (len >= SPI_DMA_ALIGN) {
+                len -= len % SPI_DMA_ALIGN;
+                /* drop the lines of the buffer, no eviction may overwrite the DMA data */
+                SCB_InvalidateDCache_by_Addr(buf, (int32_t) len);
+                spi_dev->dma_result = SFUD_SUCCESS;
+                spi_dev->dma_busy = true;
+                boot_trace_begin(BOOT_TRACE_SPI2_DMA, len);
+                if (HAL_SPI_Receive_DMA(hspi, buf, (uint16_t) len) != HAL_OK) {
+                    spi_dev->dma_busy = false;
+                    return SFUD_ERR_READ;
+                }
+                if (spi_dma_wait(spi_dev) != SFUD_SUCCESS) {
+                    return SFUD_ERR_READ;
+                }
+                /* the CPU may have fetched the lines speculatively during the transfer */
+                SCB_InvalidateDCache_by_Addr(buf, (int32_t) len);
+                buf += len;
+                size -= len;
+                continue;
+            }
+        }
+#endif
+        if (HAL_SPI_Receive(hspi, buf, (uint16_t) len, SPI_TIMEOUT_MS) != HAL_OK) {
+            return SFUD_ERR_TIMEOUT;
+        }
+        buf += len;
+        size -= len;
+    }
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * SPI write then read, the command and data are sent from the caller's buffers and the
+ * data is received straight into the read buffer, nothing is allocated
+ */
+static sfud_err spi_write_read(
+    const sfud_spi *spi,
+    const uint8_t *write_buf, size_t write_size,
+    uint8_t *read_buf, size_t read_size) {
+    sfud_err result = SFUD_SUCCESS;
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+
+    if (write_size) {
+        SFUD_ASSERT(write_buf);
+    }
+    if (read_size) {
+        SFUD_ASSERT(read_buf);
+    }
+
+    if (write_size + read_size == 0) {
+        return SFUD_ERR_WRITE;
+    }
+
+    HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
+
+    if (write_size) {
+        result = spi_transmit(spi_dev, write_buf, write_size);
+    }
+    if (result == SFUD_SUCCESS && read_size) {
+        result = spi_receive(spi_dev, read_buf, read_size);
+    }
+
+    /* release the flash on errors as well, a selected flash ignores every later command */
+    HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
+
+    return result;
+}
+
+/**
+ * structured transfer of the SPI2 flash, the command is sent from the stack and the data from or to the
+ * caller's buffer, in the same CS cycle
+ */
+static sfud_err spi_xfer(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+    uint8_t cmd[1 + 4 + 8];
+    size_t cmd_size = 0, i;
+    sfud_err result;
+
+    /* SPI2 has the single data line only */
+    if (xfer->dummy_size > sizeof(cmd) - 5 || xfer->addr_lines > 1 || xfer->data_lines > 1) {
+        return SFUD_ERR_WRITE;
+    }
+    cmd[cmd_size++] = xfer->instruction;
+    for (i = xfer->addr_size; i > 0; i--) {
+        cmd[cmd_size++] = (xfer->addr >> ((i - 1) * 8)) & 0xFF;
+    }
+    for (i = 0; i < xfer->dummy_size; i++) {
+        cmd[cmd_size++] = SFUD_DUMMY_DATA;
+    }
+
+    HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
+    result = spi_transmit(spi_dev, cmd, cmd_size);
+    if (result == SFUD_SUCCESS && xfer->data_size && xfer->read_buf) {
+        result = spi_receive(spi_dev, xfer->read_buf, xfer->data_size);
+    } else if (result == SFUD_SUCCESS && xfer->data_size) {
+        result = spi_transmit(spi_dev, xfer->write_buf, xfer->data_size);
+    }
+    HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
+
+    return result;
+}
+
+/**
+ * SPI write then read, the read runs in the background by the DMA, spi_write_read_async_wait() ends it
+ *
+ * A read the DMA can't take (not cache line aligned, in the TCMs, too large) is done right here.
+ */
+static sfud_err spi_write_read_async(
+    const sfud_spi *spi,
+    const uint8_t *write_buf, size_t write_size,
+    uint8_t *read_buf, size_t read_size) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+
+#ifdef SFUD_USING_SPI_DMA
+    if (read_size && read_size <= SPI_DMA_MAX_SIZE && (uintptr_t) read_buf % SPI_DMA_ALIGN == 0
+            && read_size % SPI_DMA_ALIGN == 0 && spi_dma_reachable(read_buf, read_size)) {
+        sfud_err result = SFUD_SUCCESS;
+
+        HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
+        if (write_size) {
+            result = spi_transmit(spi_dev, write_buf, write_size);
+        }
+        if (result == SFUD_SUCCESS) {
+            /* drop the lines of the buffer, no eviction may overwrite the DMA data */
+            SCB_InvalidateDCache_by_Addr(read_buf, (int32_t) read_size);
+            spi_dev->async_buf = read_buf;
+            spi_dev->async_size = read_size;
+            spi_dev->dma_result = SFUD_SUCCESS;
+            spi_dev->dma_busy = true;
+            boot_trace_begin(BOOT_TRACE_SPI2_DMA, read_size);
+            if (HAL_SPI_Receive_DMA(spi_dev->spi_handle, read_buf, (uint16_t) read_size) != HAL_OK) {
+                spi_dev->dma_busy = false;
+                spi_dev->async_buf = NULL;
+                result = SFUD_ERR_READ;
+            }
+        }
+        if (result != SFUD_SUCCESS) {
+            HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
+        }
+        return result;
+    }
+#endif
+
+    /* the wait reports the result */
+    spi_dev->async_buf = NULL;
+    spi_dev->dma_result = spi_write_read(spi, write_buf, write_size, read_buf, read_size);
+
+    return SFUD_SUCCESS;
+}
+
+static sfud_err spi_write_read_async_wait(const sfud_spi *spi) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+    sfud_err result = spi_dev->dma_result;
+
+#ifdef SFUD_USING_SPI_DMA
+    if (spi_dev->async_buf) {
+        result = spi_dma_wait(spi_dev);
+        HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
+        /* the CPU may have fetched the lines speculatively during the transfer */
+        SCB_InvalidateDCache_by_Addr(spi_dev->async_buf, (int32_t) spi_dev->async_size);
+        spi_dev->async_buf = NULL;
+    }
+#endif
+
+    return result;
+}
+#else /* SFUD_USING_SPI_ENGINE */
+/* frames sent ahead of the ones received, the RxFIFO of SPI2 takes 16, it can't overrun however late the loop is */
+#define SPI_ENGINE_AHEAD                8
+/* the FIFO threshold, a 32-bit access to TXDR or RXDR moves a packet of 4 frames */
+#define SPI_ENGINE_PACKET               4
+
+#ifdef SFUD_USING_SPI_DMA
+/* TX data of the DMA reads, the flash ignores what comes in during the data phase */
+static uint32_t spi_engine_dummy __attribute__((aligned(SPI_DMA_ALIGN)));
+#endif
+
+/**
+ * switch SPI2 to the engine: NSS on PB12 by the SPI for as long as SPE is set, a 4-frame FIFO threshold, the DMA
+ * streams in words, the TX one sends spi_engine_dummy over and over
+ *
+ * @note CFG1 and CFG2 are locked while SPE is set, so the DMA requests stay enabled, the streams are only started
+ *       for the data phase of the large reads
+ */
+static sfud_err spi_engine_init(spi_user_data_t spi_dev) {
+    SPI_HandleTypeDef *hspi = spi_dev->spi_handle;
+    GPIO_InitTypeDef gpio = {0};
+
+    hspi->Init.NSS = SPI_NSS_HARD_OUTPUT;
+    hspi->Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+    hspi->Init.FifoThreshold = SPI_FIFO_THRESHOLD_04DATA;
+    /* tSLCH of the flash, one SCK period from NSS low to the first edge */
+    hspi->Init.MasterSSIdleness = SPI_MASTER_SS_IDLENESS_01CYCLE;
+    /* NSS stays driven high while SPE is off */
+    hspi->Init.MasterKeepIOState = SPI_MASTER_KEEP_IO_STATE_ENABLE;
+    if (HAL_SPI_Init(hspi) != HAL_OK) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+
+    /* FLASH_CS is SPI2_NSS from now on */
+    gpio.Pin = FLASH_CS_Pin;
+    gpio.Mode = GPIO_MODE_AF_PP;
+    gpio.Pull = GPIO_PULLUP;
+    gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    gpio.Alternate = GPIO_AF5_SPI2;
+    HAL_GPIO_Init(FLASH_CS_GPIO_Port, &gpio);
+
+#ifdef SFUD_USING_SPI_DMA
+    spi_engine_dummy = 0xFFFFFFFFUL;
+    SCB_CleanDCache_by_Addr(&spi_engine_dummy, sizeof(spi_engine_dummy));
+    hspi->hdmarx->Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hspi->hdmarx->Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hspi->hdmatx->Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hspi->hdmatx->Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hspi->hdmatx->Init.MemInc = DMA_MINC_DISABLE;
+    if (HAL_DMA_Init(hspi->hdmarx) != HAL_OK || HAL_DMA_Init(hspi->hdmatx) != HAL_OK) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    SET_BIT(hspi->Instance->CFG1, SPI_CFG1_RXDMAEN | SPI_CFG1_TXDMAEN);
+#endif
+    spi_dev->async_buf = NULL;
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * select the flash: an endless transfer, its length is the frames sent
+ */
+static void spi_engine_begin(SPI_TypeDef *spi) {
+    MODIFY_REG(spi->CR2, SPI_CR2_TSIZE, 0);
+    SET_BIT(spi->CR1, SPI_CR1_SPE);
+    SET_BIT(spi->CR1, SPI_CR1_CSTART);
+}
+
+/**
+ * release the flash, all the frames sent are received by now and the clock stands
+ */
+static sfud_err spi_engine_end(SPI_TypeDef *spi) {
+    sfud_err result = SFUD_SUCCESS;
+    uint32_t start = HAL_GetTick();
+
+    SET_BIT(spi->CR1, SPI_CR1_CSUSP);
+    while (!(spi->SR & SPI_SR_SUSP)) {
+        if (HAL_GetTick() - start > SPI_TIMEOUT_MS) {
+            result = SFUD_ERR_TIMEOUT;
+            break;
+        }
+    }
+    if (spi->SR & SPI_SR_OVR) {
+        result = SFUD_ERR_READ;
+    }
+    spi->IFCR = SPI_IFCR_SUSPC | SPI_IFCR_EOTC | SPI_IFCR_TXTFC | SPI_IFCR_OVRC;
+    /* NSS goes high, the FIFOs are flushed */
+    CLEAR_BIT(spi->CR1, SPI_CR1_SPE);
+
+    return result;
+}
+
+/**
+ * send and receive frames by the CPU, a packet per 32-bit access while 4 or more are left, then frame by frame
+ *
+ * @param spi SPI2
+ * @param tx frames to send, NULL: SFUD_DUMMY_DATA
+ * @param rx received frames, NULL: dropped
+ * @param size frames
+ */
+static sfud_err spi_engine_stream(SPI_TypeDef *spi, const uint8_t *tx, uint8_t *rx, size_t size) {
+    size_t tx_i = 0, rx_i = 0;
+    uint32_t start = HAL_GetTick(), word, sr;
+
+    while (rx_i < size) {
+        sr = spi->SR;
+        if (tx_i < size && tx_i - rx_i <= SPI_ENGINE_AHEAD - SPI_ENGINE_PACKET && (sr & SPI_SR_TXP)) {
+            if (size - tx_i >= SPI_ENGINE_PACKET) {
+                word = 0xFFFFFFFFUL;
+                if (tx) {
+                    memcpy(&word, tx + tx_i, SPI_ENGINE_PACKET);
+                }
+                spi->TXDR = word;
+                tx_i += SPI_ENGINE_PACKET;
+            } else {
+                *(__IO uint8_t *) &spi->TXDR = tx ? tx[tx_i] : SFUD_DUMMY_DATA;
+                tx_i++;
+            }
+        }
+        if (size - rx_i >= SPI_ENGINE_PACKET) {
+            if (sr & SPI_SR_RXP) {
+                word = spi->RXDR;
+                if (rx) {
+                    memcpy(rx + rx_i, &word, SPI_ENGINE_PACKET);
+                }
+                rx_i += SPI_ENGINE_PACKET;
+            }
+        } else if (sr & (SPI_SR_RXWNE | SPI_SR_RXPLVL)) {
+            word = *(__IO uint8_t *) &spi->RXDR;
+            if (rx) {
+                rx[rx_i] = (uint8_t) word;
+            }
+            rx_i++;
+        }
+        if (HAL_GetTick() - start > SPI_TIMEOUT_MS) {
+            return SFUD_ERR_TIMEOUT;
+        }
+    }
+
+    return SFUD_SUCCESS;
+}
+
+#ifdef SFUD_USING_SPI_DMA
+/**
+ * start the DMA of a data phase read, whole cache lines of a buffer the DMA1 reaches
+ */
+static sfud_err spi_engine_dma_start(spi_user_data_t spi_dev, uint8_t *buf, size_t size) {
+    SPI_HandleTypeDef *hspi = spi_dev->spi_handle;
+    uint32_t words = size / SPI_ENGINE_PACKET;
+
+    /* drop the lines of the buffer, no eviction may overwrite the DMA data */
+    SCB_InvalidateDCache_by_Addr(buf, (int32_t) size);
+    if (HAL_DMA_Start(hspi->hdmarx, (uint32_t) (uintptr_t) &hspi->Instance->RXDR, (uint32_t) (uintptr_t) buf,
+                      words) != HAL_OK) {
+        return SFUD_ERR_READ;
+    }
+    if (HAL_DMA_Start(hspi->hdmatx, (uint32_t) (uintptr_t) &spi_engine_dummy,
+                      (uint32_t) (uintptr_t) &hspi->Instance->TXDR, words) != HAL_OK) {
+        HAL_DMA_Abort(hspi->hdmarx);
+        return SFUD_ERR_READ;
+    }
+    spi_dev->async_buf = buf;
+    spi_dev->async_size = size;
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * wait the DMA of a data phase read
+ */
+static sfud_err spi_engine_dma_wait(spi_user_data_t spi_dev) {
+    SPI_HandleTypeDef *hspi = spi_dev->spi_handle;
+    sfud_err result = SFUD_SUCCESS;
+
+    /* the TX stream is done before the last frames are in */
+    if (HAL_DMA_PollForTransfer(hspi->hdmarx, HAL_DMA_FULL_TRANSFER, SPI_TIMEOUT_MS) != HAL_OK
+            || HAL_DMA_PollForTransfer(hspi->hdmatx, HAL_DMA_FULL_TRANSFER, SPI_TIMEOUT_MS) != HAL_OK) {
+        HAL_DMA_Abort(hspi->hdmarx);
+        HAL_DMA_Abort(hspi->hdmatx);
+        result = SFUD_ERR_READ;
+    }
+    /* the CPU may have fetched the lines speculatively during the transfer */
+    SCB_InvalidateDCache_by_Addr(spi_dev->async_buf, (int32_t) spi_dev->async_size);
+    spi_dev->async_buf = NULL;
+
+    return result;
+}
+#endif /* SFUD_USING_SPI_DMA */
+
+/**
+ * receive the data phase, the DMA moves the cache line aligned middle of a large read
+ */
+static sfud_err spi_engine_read(spi_user_data_t spi_dev, uint8_t *buf, size_t size) {
+    SPI_TypeDef *spi = spi_dev->spi_handle->Instance;
+    sfud_err result = SFUD_SUCCESS;
+    size_t len;
+
+    while (result == SFUD_SUCCESS && size) {
+        len = size;
+#ifdef SFUD_USING_SPI_DMA
+        if (size >= SFUD_SPI_DMA_MIN_SIZE && spi_dma_reachable(buf, size)) {
+            size_t head = (SPI_DMA_ALIGN - ((uintptr_t) buf % SPI_DMA_ALIGN)) % SPI_DMA_ALIGN;
+
+            if (head) {
+                /* the head shares its cache line with other data, poll it */
+                len = head;
+            } else {
+                len = size > SPI_DMA_MAX_SIZE ? SPI_DMA_MAX_SIZE : size - size % SPI_DMA_ALIGN;
+                result = spi_engine_dma_start(spi_dev, buf, len);
+                if (result == SFUD_SUCCESS) {
+                    result = spi_engine_dma_wait(spi_dev);
+                }
+                buf += len;
+                size -= len;
+                continue;
+            }
+        }
+#endif
+        result = spi_engine_stream(spi, NULL, buf, len);
+        buf += len;
+        size -= len;
+    }
+
+    return result;
+}
+
+/**
+ * SPI write then read in one NSS cycle, the command and data are sent from the caller's buffers and the data is
+ * received straight into the read buffer
+ */
+static sfud_err spi_write_read(
+    const sfud_spi *spi,
+    const uint8_t *write_buf, size_t write_size,
+    uint8_t *read_buf, size_t read_size) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+    SPI_TypeDef *instance = spi_dev->spi_handle->Instance;
+    sfud_err result = SFUD_SUCCESS, end;
+
+    if (write_size) {
+        SFUD_ASSERT(write_buf);
+    }
+    if (read_size) {
+        SFUD_ASSERT(read_buf);
+    }
+
+    if (write_size + read_size == 0) {
+        return SFUD_ERR_WRITE;
+    }
+
+    spi_engine_begin(instance);
+    if (write_size) {
+        result = spi_engine_stream(instance, write_buf, NULL, write_size);
+    }
+    if (result == SFUD_SUCCESS && read_size) {
+        result = spi_engine_read(spi_dev, read_buf, read_size);
+    }
+    /* release the flash on errors as well, a selected flash ignores every later command */
+    end = spi_engine_end(instance);
+
+    return result == SFUD_SUCCESS ? end : result;
+}
+
+/**
+ * structured transfer of the SPI2 flash, the command is sent from the stack and the data from or to the
+ * caller's buffer, in the same NSS cycle
+ */
+static sfud_err spi_xfer(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+    SPI_TypeDef *instance = spi_dev->spi_handle->Instance;
+    uint8_t cmd[1 + 4 + 8];
+    size_t cmd_size = 0, i;
+    sfud_err result, end;
+
+    /* SPI2 has the single data line only */
+    if (xfer->dummy_size > sizeof(cmd) - 5 || xfer->addr_lines > 1 || xfer->data_lines > 1) {
+        return SFUD_ERR_WRITE;
+    }
+    cmd[cmd_size++] = xfer->instruction;
+    for (i = xfer->addr_size; i > 0; i--) {
+        cmd[cmd_size++] = (xfer->addr >> ((i - 1) * 8)) & 0xFF;
+    }
+    for (i = 0; i < xfer->dummy_size; i++) {
+        cmd[cmd_size++] = SFUD_DUMMY_DATA;
+    }
+
+    spi_engine_begin(instance);
+    result = spi_engine_stream(instance, cmd, NULL, cmd_size);
+    if (result == SFUD_SUCCESS && xfer->data_size && xfer->read_buf) {
+        result = spi_engine_read(spi_dev, xfer->read_buf, xfer->data_size);
+    } else if (result == SFUD_SUCCESS && xfer->data_size) {
+        result = spi_engine_stream(instance, xfer->write_buf, NULL, xfer->data_size);
+    }
+    end = spi_engine_end(instance);
+
+    return result == SFUD_SUCCESS ? end : result;
+}
+
+/**
+ * SPI write then read, the read runs in the background by the DMA, spi_write_read_async_wait() ends it
+ *
+ * A read the DMA can't take (not cache line aligned, in the TCMs, too large) is done right here.
+ */
+static sfud_err spi_write_read_async(
+    const sfud_spi *spi,
+    const uint8_t *write_buf, size_t write_size,
+    uint8_t *read_buf, size_t read_size) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+
+#ifdef SFUD_USING_SPI_DMA
+    if (read_size && read_size <= SPI_DMA_MAX_SIZE && (uintptr_t) read_buf % SPI_DMA_ALIGN == 0
+            && read_size % SPI_DMA_ALIGN == 0 && spi_dma_reachable(read_buf, read_size)) {
+        SPI_TypeDef *instance = spi_dev->spi_handle->Instance;
+        sfud_err result = SFUD_SUCCESS;
+
+        spi_engine_begin(instance);
+        if (write_size) {
+            result = spi_engine_stream(instance, write_buf, NULL, write_size);
+        }
+        if (result == SFUD_SUCCESS) {
+            result = spi_engine_dma_start(spi_dev, read_buf, read_size);
+        }
+        if (result != SFUD_SUCCESS) {
+            spi_engine_end(instance);
+        }
+        return result;
+    }
+#endif
+
+    /* the wait reports the result */
+    spi_dev->async_buf = NULL;
+    spi_dev->dma_result = spi_write_read(spi, write_buf, write_size, read_buf, read_size);
+
+    return SFUD_SUCCESS;
+}
+
+static sfud_err spi_write_read_async_wait(const sfud_spi *spi) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+    sfud_err result = spi_dev->dma_result, end;
+
+#ifdef SFUD_USING_SPI_DMA
+    if (spi_dev->async_buf) {
+        result = spi_engine_dma_wait(spi_dev);
+        end = spi_engine_end(spi_dev->spi_handle->Instance);
+        if (result == SFUD_SUCCESS) {
+            result = end;
+        }
+    }
+#else
+    (void) end;
+#endif
+
+    return result;
+}
+#endif /* SFUD_USING_SPI_ENGINE */
+
+/* 100 microsecond delay between the retries */
+static void retry_delay_100us(void) {
+    boot_time_delay_us(100);
+}
+
+/**
+ * wait us microseconds off the bus, the busy wait of the EXT flash between its status polls
+ *
+ * While a millisecond or more is left the core sleeps by WFI, SysTick wakes it each one at the latest and the
+ * clock counts the sleep, the rest is a busy wait. With the interrupts masked nothing would wake the core, all of
+ * it is a busy wait.
+ */
+static void port_sleep(uint32_t us) {
+    uint64_t deadline = boot_time_deadline(us), now;
+
+    while ((now = boot_time_us()) < deadline) {
+        if (deadline - now >= 1000U && !__get_PRIMASK()) {
+            __WFI();
+        }
+    }
+}
+
+#ifdef SFUD_USING_STATS
+/**
+ * microseconds for the SFUD statistics, the low 32 bits of boot_time_us()
+ */
+uint32_t sfud_port_time_us(void) {
+    return (uint32_t) boot_time_us();
+}
+#endif /* SFUD_USING_STATS */
+
+#ifdef SFUD_USING_WRITE_VERIFY
+/**
+ * zlib CRC-32 of a page read back, by the CRC unit fed by the CPU: a page is too short for the MDMA setup
+ *
+ * @param crc CRC of the bytes before, 0 to start
+ */
+uint32_t sfud_port_crc32(uint32_t crc, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *) buf;
+    uint32_t word;
+
+    __HAL_RCC_CRC_CLK_ENABLE();
+    /* as boot_crc32_hw(), the register holds the bit reversed running CRC */
+    CRC->POL = 0x04C11DB7;
+    CRC->INIT = __RBIT(~crc);
+    CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_IN_1 | CRC_CR_REV_OUT;
+    CRC->CR |= CRC_CR_RESET;
+
+    for (; size >= 4; size -= 4, p += 4) {
+        memcpy(&word, p, 4);
+        CRC->DR = word;
+    }
+    /* a byte write is reversed in itself */
+    CRC->CR = (CRC->CR & ~CRC_CR_REV_IN) | CRC_CR_REV_IN_0;
+    for (; size; size--) {
+        *(volatile uint8_t *) &CRC->DR = *p++;
+    }
+    return ~CRC->DR;
+}
+#endif /* SFUD_USING_WRITE_VERIFY */
+
+#ifdef SFUD_USING_BLANK_CHECK
+/**
+ * a range of the MAIN flash in the memory-mapped window, for the blank check of the core
+ *
+ * The window is read-only to the CPU, so its lines are never dirty: they are dropped, the loads see the array as it
+ * is even after a change in indirect mode.
+ *
+ * @return its address in the window, NULL: the flash isn't memory-mapped now, the core reads the range
+ */
+const void *sfud_port_mapped(const sfud_flash *flash, uint32_t addr, size_t size) {
+    spi_user_data_t spi_dev = (spi_user_data_t) flash->spi.user_data;
+    void *window;
+
+    if (flash->index != SFUD_MAIN_FLASH || addr + size > flash->chip.capacity
+            || (spi_dev->ospi_handle->Instance->CR & OCTOSPI_CR_FMODE_Msk) != OCTOSPI_CR_FMODE) {
+        return NULL;
+    }
+    window = (void *) (spi_dev->memory_mapped_addr + addr);
+    SCB_InvalidateDCache_by_Addr(window, (int32_t) size);
+
+    return window;
+}
+#endif /* SFUD_USING_BLANK_CHECK */
+
+/* same as retry.times * 100us */
+#define QSPI_WAIT_BUSY_TIMEOUT_MS       (60 * 1000)
+
+/**
+ * wait the flash is not busy by the OCTOSPI auto-polling, the CPU sleeps until the status match interrupt
+ */
+static sfud_err qspi_wait_busy(const sfud_spi *spi) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+    OSPI_HandleTypeDef *hospi = spi_dev->ospi_handle;
+    OSPI_RegularCmdTypeDef Cmdhandler = {0};
+    OSPI_AutoPollingTypeDef sConfig = {0};
+    uint32_t start;
+
+    if ((hospi->Instance->CR & OCTOSPI_CR_FMODE_Msk) == OCTOSPI_CR_FMODE) {
+        /* the flash can't be busy while it is read by XIP */
+        return SFUD_SUCCESS;
+    }
+
+    qspi_set_dtr_timing(hospi, false);
+
+    Cmdhandler.OperationType = HAL_OSPI_OPTYPE_COMMON_CFG;
+    Cmdhandler.FlashId = HAL_OSPI_FLASH_ID_1;
+    Cmdhandler.Instruction = SFUD_CMD_READ_STATUS_REGISTER;
+    Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_1_LINE;
+    Cmdhandler.InstructionSize = HAL_OSPI_INSTRUCTION_8_BITS;
+    Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_NONE;
+    Cmdhandler.AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_NONE;
+    Cmdhandler.DataMode = HAL_OSPI_DATA_1_LINE;
+    Cmdhandler.NbData = 1;
+    Cmdhandler.DummyCycles = 0;
+    Cmdhandler.DQSMode = HAL_OSPI_DQS_DISABLE;
+    Cmdhandler.SIOOMode = HAL_OSPI_SIOO_INST_EVERY_CMD;
+#ifdef SFUD_USING_QSPI_QPI
+    if (qspi_flash_of(spi)->qpi) {
+        /* each poll is 4 clocks instead of 16 */
+        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_4_LINES;
+        Cmdhandler.DataMode = HAL_OSPI_DATA_4_LINES;
+    }
+#endif
+    sConfig.Mask = SFUD_STATUS_REGISTER_BUSY;
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    if (spi_dev->dual_quad) {
+        /* a status byte of each part, both idle */
+        Cmdhandler.NbData = 2;
+        sConfig.Mask = SFUD_STATUS_REGISTER_BUSY * 0x0101U;
+    }
+#endif
+    if (HAL_OSPI_Command(hospi, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return SFUD_ERR_READ;
+    }
+
+    sConfig.Match = 0;
+    sConfig.MatchMode = HAL_OSPI_MATCH_MODE_AND;
+    sConfig.AutomaticStop = HAL_OSPI_AUTOMATIC_STOP_ENABLE;
+    sConfig.Interval = 0x10;
+    spi_dev->poll_busy = true;
+    if (HAL_OSPI_AutoPolling_IT(hospi, &sConfig) != HAL_OK) {
+        spi_dev->poll_busy = false;
+        return SFUD_ERR_READ;
+    }
+
+    start = HAL_GetTick();
+    while (spi_dev->poll_busy) {
+        if (__get_PRIMASK()) {
+            /* called with the interrupts masked, serve the handler here */
+            HAL_OSPI_IRQHandler(hospi);
+        } else {
+            __WFI();
+        }
+        if (spi_dev->poll_busy && HAL_GetTick() - start > QSPI_WAIT_BUSY_TIMEOUT_MS) {
+            HAL_OSPI_Abort(hospi);
+            spi_dev->poll_busy = false;
+            return SFUD_ERR_TIMEOUT;
+        }
+    }
+
+    return SFUD_SUCCESS;
+}
+
+void HAL_OSPI_StatusMatchCallback(OSPI_HandleTypeDef *hospi) {
+    if (hospi == ospi1.ospi_handle) {
+        ospi1.poll_busy = false;
+    }
+}
+
+#ifdef SFUD_USING_QSPI_QPI
+/**
+ * leave the QPI mode of sfud_qspi_qpi_enable() whatever the flash is in, FFh then F5h on the four lines
+ *
+ * The reset of the MCU doesn't reach the flash, one which skips sfud_qspi_qpi_disable() (a fault, the debugger)
+ * leaves it in QPI mode. A flash in SPI mode sees two clocks of each instruction on IO0, no command, and ignores
+ * them.
+ */
+static void qspi_qpi_reset(OSPI_HandleTypeDef *hospi) {
+    static const uint8_t cmds[] = { SFUD_CMD_DISABLE_QPI, SFUD_CMD_DISABLE_QPI_F5 };
+    OSPI_RegularCmdTypeDef Cmdhandler = {0};
+
+    qspi_set_dtr_timing(hospi, false);
+
+    Cmdhandler.OperationType = HAL_OSPI_OPTYPE_COMMON_CFG;
+    Cmdhandler.FlashId = HAL_OSPI_FLASH_ID_1;
+    Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_4_LINES;
+    Cmdhandler.InstructionSize = HAL_OSPI_INSTRUCTION_8_BITS;
+    Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_NONE;
+    Cmdhandler.AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_NONE;
+    Cmdhandler.DataMode = HAL_OSPI_DATA_NONE;
+    Cmdhandler.DummyCycles = 0;
+    Cmdhandler.DQSMode = HAL_OSPI_DQS_DISABLE;
+    Cmdhandler.SIOOMode = HAL_OSPI_SIOO_INST_EVERY_CMD;
+    for (size_t i = 0; i < sizeof(cmds); i++) {
+        Cmdhandler.Instruction = cmds[i];
+        HAL_OSPI_Command(hospi, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE);
+    }
+}
+#endif
+
+sfud_err sfud_spi_port_init(sfud_flash *flash) {
+    // peripheral is inited by `MX_XXX_Init()`
+    sfud_err result = SFUD_SUCCESS;
+
+    switch (flash->index) {
+    case SFUD_MAIN_FLASH: {
+        /* set the interfaces and data */
+        flash->spi.wr = qspi_write_read;
+        flash->spi.xfer = qspi_xfer;
+        flash->spi.qspi_read = qspi_read;
+        flash->spi.wait_busy = qspi_wait_busy;
+        flash->spi.lock = spi_lock;
+        flash->spi.unlock = spi_unlock;
+        flash->spi.user_data = &ospi1;
+#ifdef SFUD_USING_QSPI_DUALQUAD
+        flash->dual_quad = true;
+        ospi1.dual_quad = true;
+#endif
+#ifdef SFUD_USING_QSPI_QPI
+        /* the probe is 1-line, a flash a reset left in QPI mode must leave it first */
+        flash->qpi = false;
+        qspi_qpi_reset(ospi1.ospi_handle);
+#endif
+        /* about 100 microsecond delay */
+        flash->retry.delay = retry_delay_100us;
+        /* adout 60 seconds timeout */
+        flash->retry.times = 60 * 10000;
+        break;
+    }
+    case SFUD_EXT_FLASH: {
+#ifdef SFUD_USING_SPI_ENGINE
+        result = spi_engine_init(&spi2);
+#endif
+        /* set the interfaces and data */
+        flash->spi.wr = spi_write_read;
+        flash->spi.xfer = spi_xfer;
+        flash->spi.wr_async = spi_write_read_async;
+        flash->spi.wr_async_wait = spi_write_read_async_wait;
+        flash->spi.lock = spi_lock;
+        flash->spi.unlock = spi_unlock;
+        flash->spi.user_data = &spi2;
+        /* about 100 microsecond delay */
+        flash->retry.delay = retry_delay_100us;
+        /* adout 60 seconds timeout */
+        flash->retry.times = 60 * 10000;
+        /* no auto-polling on SPI: the SFDP program and erase times are slept before the status polls */
+        flash->retry.sleep = port_sleep;
+        break;
+    }
+    }
+
+    return result;
+}
+
+#ifdef SFUD_USING_PROBE_CACHE
+/**
+ * read the probe cache descriptor of the flash device
+ *
+ * @param flash flash device
+ * @param cache read descriptor, it must be validated by caller
+ *
+ * @return true: there is a descriptor slot for this device
+ */
+bool sfud_port_probe_cache_read(const sfud_flash *flash, sfud_probe_cache *cache) {
+    if (flash->index >= SFUD_FLASH_DEVICE_NUM) {
+        return false;
+    }
+    memcpy(cache, &probe_cache[flash->index], sizeof(sfud_probe_cache));
+    return true;
+}
+
+/**
+ * write the probe cache descriptor of the flash device
+ *
+ * @param flash flash device
+ * @param cache descriptor to write
  */
-sfud_err qspi_send_then_recv(
-    const sfud_spi *spi,
-    const void *send_buf, size_t send_length,
-    void *recv_buf, size_t recv_length
-) {
-    assert_param(send_buf);
-    assert_param(recv_buf);
-    assert_param(send_length != 0);
+void sfud_port_probe_cache_write(const sfud_flash *flash, const sfud_probe_cache *cache) {
+    if (flash->index >= SFUD_FLASH_DEVICE_NUM) {
+        return;
+    }
+    memcpy(&probe_cache[flash->index], cache, sizeof(sfud_probe_cache));
+    /* a reset drops the D-Cache, so push it to the SRAM now */
+    SCB_CleanDCache_by_Addr((uint32_t *) &probe_cache[flash->index], sizeof(sfud_probe_cache));
+}
+#endif /* SFUD_USING_PROBE_CACHE */
+
+/**
+ * run a short command straight on the registers, no HAL state checks or tick timeouts
+ *
+ * WREN, WRDI, the status reads between the programs and the like are most of the OSPI commands of a
+ * program, HAL_OSPI_Command() and HAL_OSPI_Receive() cost about as much as the transfer itself there.
+ */
+static sfud_err qspi_reg_command_run(OSPI_HandleTypeDef *hospi, const sfud_spi_xfer *xfer) {
+    OCTOSPI_TypeDef *ospi = hospi->Instance;
+    qspi_reg_cmd cmd;
+    uint32_t cr;
+    bool result;
+
+    /* register access is always STR, undo the timing left by a DTR read */
+    qspi_set_dtr_timing(hospi, false);
+    while (ospi->SR & OCTOSPI_SR_BUSY) {
+    }
+    cr = ospi->CR;
+    qspi_reg_cmd_make(&cmd, ospi->TCR, xfer, qspi_instruction_lines(xfer->instruction_lines));
+    result = qspi_reg_cmd_run(ospi, cr, &cmd);
+    /* the FIFO threshold of the HAL transfers */
+    ospi->CR = cr;
+
+    if (!result) {
+        return xfer->read_buf ? SFUD_ERR_READ : SFUD_ERR_WRITE;
+    }
+    return SFUD_SUCCESS;
+}
 
+/**
+ * run one command on the OSPI from its phases, the data goes straight from or to the caller's buffer
+ */
+static sfud_err qspi_command_run(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
     OSPI_RegularCmdTypeDef Cmdhandler;
-    memset(&Cmdhandler, 0, sizeof(Cmdhandler));
-    unsigned char *ptr = (unsigned char *) send_buf;
-    size_t count = 0;
     spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
-    sfud_err result = SFUD_SUCCESS;
+
+    if (xfer->data_size <= QSPI_REG_CMD_MAX_SIZE) {
+        return qspi_reg_command_run(spi_dev->ospi_handle, xfer);
+    }
+
+    memset(&Cmdhandler, 0, sizeof(Cmdhandler));
+    /* register access is always STR, undo the timing left by a DTR read */
+    qspi_set_dtr_timing(spi_dev->ospi_handle, false);
 
     Cmdhandler.OperationType = HAL_OSPI_OPTYPE_COMMON_CFG;             // 通用配置
     Cmdhandler.FlashId = HAL_OSPI_FLASH_ID_1;                    // flash ID
 
-    /* get instruction */
-    Cmdhandler.Instruction = ptr[0];
-    Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_1_LINE;
+    Cmdhandler.Instruction = xfer->instruction;
+    Cmdhandler.InstructionMode = qspi_instruction_lines(xfer->instruction_lines);
     Cmdhandler.InstructionSize = HAL_OSPI_INSTRUCTION_8_BITS;            // 指令长度8位
     Cmdhandler.InstructionDtrMode = HAL_OSPI_INSTRUCTION_DTR_DISABLE;       // 禁止指令DTR模式
 
-    count++;
-
-    /* get address */
-    if (send_length > 1) {
-        if (send_length >= 4) {
-            /* address size is 3 Byte */
-            Cmdhandler.Address = (ptr[1] << 16) | (ptr[2] << 8) | (ptr[3]);
-            Cmdhandler.AddressSize = HAL_OSPI_ADDRESS_24_BITS;
-            count += 3;
-        } else {
-            return SFUD_ERR_READ;
-        }
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_1_LINE;
+    if (xfer->addr_size) {
+        Cmdhandler.Address = xfer->addr;
+        Cmdhandler.AddressSize = xfer->addr_size == 4 ? HAL_OSPI_ADDRESS_32_BITS : HAL_OSPI_ADDRESS_24_BITS;
+        Cmdhandler.AddressMode = qspi_address_lines(xfer->addr_lines);
     } else {
         /* no address stage */
         Cmdhandler.Address = 0;
@@ -460,151 +1741,567 @@ sfud_err qspi_send_then_recv(
     Cmdhandler.DQSMode = HAL_OSPI_DQS_DISABLE;                   // 不使用DQS
     Cmdhandler.SIOOMode = HAL_OSPI_SIOO_INST_EVERY_CMD;
 
-    if (send_buf && recv_buf) {
-        /* recv data */
-        /* set dummy cycles */
-        if (count != send_length) {
-            Cmdhandler.DummyCycles = (send_length - count) * 8;
-        } else {
-            Cmdhandler.DummyCycles = 0;
-        }
-
-        /* set recv size */
-        Cmdhandler.DataMode = HAL_OSPI_DATA_1_LINE;
-        Cmdhandler.NbData = recv_length;
+    Cmdhandler.DummyCycles = qspi_dummy_cycles(xfer);
+    Cmdhandler.DataMode = xfer->data_size ? qspi_data_lines(xfer->data_lines) : HAL_OSPI_DATA_NONE;
+    Cmdhandler.NbData = xfer->data_size;
 
-        if (HAL_OSPI_Command(spi_dev->ospi_handle, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-//            sfud_log_info("qspi send cmd failed(%d)!", spi_dev->ospi_handle->ErrorCode);
+    if (HAL_OSPI_Command(spi_dev->ospi_handle, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return xfer->read_buf ? SFUD_ERR_READ : SFUD_ERR_WRITE;
+    }
+    if (xfer->data_size && xfer->read_buf) {
+        if (HAL_OSPI_Receive(spi_dev->ospi_handle, xfer->read_buf, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
             return SFUD_ERR_READ;
         }
-
-        if (recv_length != 0) {
-            if (HAL_OSPI_Receive(spi_dev->ospi_handle, recv_buf, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-//                sfud_log_info("qspi recv data failed(%d)!", spi_dev->ospi_handle->ErrorCode);
-                result = SFUD_ERR_READ;
-            }
+    } else if (xfer->data_size) {
+        if (HAL_OSPI_Transmit(spi_dev->ospi_handle, (uint8_t *) xfer->write_buf, HAL_OSPI_TIMEOUT_DEFAULT_VALUE)
+                != HAL_OK) {
+            return SFUD_ERR_WRITE;
         }
+    }
 
-        return result;
-    } else {
-        /* send data */
-        /* set dummy cycles */
-        Cmdhandler.DummyCycles = 0;
+    return SFUD_SUCCESS;
+}
 
-        /* determine if there is data to send */
-        if (send_length - count > 0) {
-            Cmdhandler.DataMode = HAL_OSPI_DATA_1_LINE;
-        } else {
-            Cmdhandler.DataMode = HAL_OSPI_DATA_NONE;
+#ifdef SFUD_USING_QSPI_XIP_WRITE
+/* a larger change drops the whole D-Cache: the chip erase, the lines of the window are fewer than the range */
+#define QSPI_XIP_INVALIDATE_MAX         (64 * 1024)
+/* qspi_xip_run() size: the whole caches */
+#define QSPI_XIP_INVALIDATE_ALL         SIZE_MAX
+
+/**
+ * leave the memory-mapped mode, run the commands, wait the flash is idle, enter the memory-mapped mode again
+ *
+ * It runs from the ITCM and calls nothing outside, the CPU must not fetch from the flash meanwhile.
+ *
+ * @param ospi OCTOSPI registers, memory-mapped mode
+ * @param cmds commands to run in order
+ * @param cmd_num number of commands
+ * @param status read status register command, its read_buf is set here
+ * @param window the first byte the commands change, in the memory-mapped window
+ * @param size bytes changed from it, their cached lines are dropped, 0: none, QSPI_XIP_INVALIDATE_ALL: the caches
+ *
+ * @return false: a transfer error
+ */
+__attribute__((section(".itcm_text"), noinline))
+static bool qspi_xip_run(OCTOSPI_TypeDef *ospi, const qspi_reg_cmd *cmds, size_t cmd_num, qspi_reg_cmd status,
+                         uintptr_t window, size_t size) {
+    uint32_t cr = ospi->CR, ccr = ospi->CCR, tcr = ospi->TCR, ir = ospi->IR, abr = ospi->ABR, dlr = ospi->DLR;
+#ifdef SFUD_QSPI_XIP_IRQ_PRIORITY
+    uint32_t basepri = __get_BASEPRI();
+#else
+    uint32_t primask = __get_PRIMASK();
+#endif
+    /* a status byte of each part in dual-quad mode */
+    uint8_t status_reg[2] = {0};
+    bool result = true;
+    size_t i;
+
+    /* mask the interrupts, their handlers may be in the flash */
+#ifdef SFUD_QSPI_XIP_IRQ_PRIORITY
+    __set_BASEPRI_MAX(SFUD_QSPI_XIP_IRQ_PRIORITY << (8U - __NVIC_PRIO_BITS));
+#else
+    __disable_irq();
+#endif
+    __DSB();
+    __ISB();
+
+    /* leave the memory-mapped mode */
+    ospi->CR = cr | OCTOSPI_CR_ABORT;
+    while (ospi->CR & OCTOSPI_CR_ABORT) {
+    }
+    while (ospi->SR & OCTOSPI_SR_BUSY) {
+    }
+
+    for (i = 0; i < cmd_num && result; i++) {
+        result = qspi_reg_cmd_run(ospi, cr, &cmds[i]);
+    }
+    /* the XIP can't read a busy flash, an erase keeps the interrupts masked to its end */
+    status.read_buf = status_reg;
+    do {
+        if (!qspi_reg_cmd_run(ospi, cr, &status)) {
+            result = false;
+            break;
         }
+    } while ((status_reg[0] | status_reg[1]) & SFUD_STATUS_REGISTER_BUSY);
+
+    /* enter the memory-mapped mode again, the read command of it first */
+    ospi->DLR = dlr;
+    ospi->TCR = tcr;
+    ospi->CCR = ccr;
+    ospi->IR = ir;
+    ospi->ABR = abr;
+    ospi->CR = cr;
+
+    if (size == QSPI_XIP_INVALIDATE_ALL) {
+        /* the dirty lines are RAM ones, they are written back, the lines of the flash go */
+        SCB_CleanInvalidateDCache();
+        SCB_InvalidateICache();
+    } else if (size) {
+        /* the window is read-only to the CPU, its lines are never dirty; the RAM lines stay */
+        SCB_InvalidateDCache_by_Addr((void *) window, (int32_t) size);
+        SCB_InvalidateICache_by_Addr((void *) window, (int32_t) size);
+    }
+    __DSB();
+    __ISB();
 
-        /* set send buf and send size */
-        Cmdhandler.NbData = send_length - count;
+#ifdef SFUD_QSPI_XIP_IRQ_PRIORITY
+    __set_BASEPRI(basepri);
+#else
+    __set_PRIMASK(primask);
+#endif
 
-        if (HAL_OSPI_Command(spi_dev->ospi_handle, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-//            sfud_log_info("qspi send cmd failed(%d)!", spi_dev->ospi_handle->ErrorCode);
-            return SFUD_ERR_READ;
+    return result;
+}
+
+/**
+ * the flash bytes a command of the XIP write path changes: the page of a program, the unit of an erase
+ *
+ * @param addr the first one, set when the result is not 0
+ *
+ * @return bytes, 0: the array is not changed, QSPI_XIP_INVALIDATE_ALL: the chip erase or an unknown erase command
+ */
+static size_t qspi_xip_changed(const sfud_flash *flash, const sfud_spi_xfer *xfer, uint32_t *addr) {
+    uint32_t unit = 0;
+
+    if (xfer->read_buf) {
+        return 0;
+    }
+    if (!xfer->addr_size) {
+        return xfer->instruction == SFUD_CMD_ERASE_CHIP ? QSPI_XIP_INVALIDATE_ALL : 0;
+    }
+    if (xfer->data_size) {
+        *addr = xfer->addr;
+        return xfer->data_size;
+    }
+    for (size_t i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM && !unit; i++) {
+        uint8_t cmd = flash->sfdp.eraser[i].cmd, cmd_4b = flash->sfdp.eraser[i].cmd_4b;
+
+        if (flash->sfdp.eraser[i].size && (xfer->instruction == cmd || xfer->instruction == cmd_4b)) {
+            unit = flash->sfdp.eraser[i].size;
         }
+    }
+    if (!unit && xfer->instruction == flash->chip.erase_gran_cmd) {
+        unit = flash->chip.erase_gran;
+    }
+    if (!unit || unit > QSPI_XIP_INVALIDATE_MAX || (unit & (unit - 1))) {
+        return QSPI_XIP_INVALIDATE_ALL;
+    }
+    /* the erase takes the unit holding the address */
+    *addr = xfer->addr & ~(unit - 1);
+    return unit;
+}
+
+/**
+ * run a command while the flash is in memory-mapped mode, the XIP is paused for it
+ */
+static sfud_err qspi_xip_xfer(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+    OCTOSPI_TypeDef *ospi = spi_dev->ospi_handle->Instance;
+    uintptr_t start = spi_dev->memory_mapped_addr, end = start + qspi_flash_of(spi)->chip.capacity;
+    uintptr_t buf = (uintptr_t) (xfer->read_buf ? (const void *) xfer->read_buf : (const void *) xfer->write_buf);
+    sfud_spi_xfer status_xfer;
+    qspi_reg_cmd cmds[2], status;
+    size_t cmd_num = 0, changed;
+    uint32_t addr = 0;
+
+    /* the data can't be in the flash which is out of memory-mapped mode */
+    if (xfer->data_size && buf < end && buf + xfer->data_size > start) {
+        elog_e(TAG, "the data of a command in memory mapping mode must not be in the flash");
+        return xfer->read_buf ? SFUD_ERR_READ : SFUD_ERR_WRITE;
+    }
+
+#ifdef SFUD_USING_QSPI_CONTINUOUS_READ
+    if (ospi->CCR & OCTOSPI_CCR_SIOO) {
+        /* leave the continuous read first, see qspi_continuous_read_reset() */
+        memset(&status_xfer, 0, sizeof(status_xfer));
+        status_xfer.instruction = 0xFF;
+        status_xfer.addr_size = 4;
+        status_xfer.addr_lines = 4;
+        status_xfer.addr = 0xFFFFFFFF;
+        qspi_reg_cmd_make(&cmds[cmd_num++], ospi->TCR, &status_xfer, HAL_OSPI_INSTRUCTION_4_LINES);
+    }
+#endif
+    qspi_reg_cmd_make(&cmds[cmd_num++], ospi->TCR, xfer, qspi_instruction_lines(xfer->instruction_lines));
+
+    memset(&status_xfer, 0, sizeof(status_xfer));
+    status_xfer.instruction = SFUD_CMD_READ_STATUS_REGISTER;
+    /* on the lines of the command, four in QPI mode */
+    status_xfer.instruction_lines = xfer->instruction_lines;
+    status_xfer.data_lines = xfer->instruction_lines;
+    status_xfer.data_size = 1;
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    status_xfer.data_size += spi_dev->dual_quad;
+#endif
+    qspi_reg_cmd_make(&status, ospi->TCR, &status_xfer, qspi_instruction_lines(status_xfer.instruction_lines));
+
+    /* the memcpy() of qspi_read() goes on from the window, only the changed lines of it are dropped */
+    changed = qspi_xip_changed(qspi_flash_of(spi), xfer, &addr);
+
+    if (!qspi_xip_run(ospi, cmds, cmd_num, status, start + addr, changed)) {
+        return xfer->read_buf ? SFUD_ERR_READ : SFUD_ERR_WRITE;
+    }
+    return SFUD_SUCCESS;
+}
+#endif /* SFUD_USING_QSPI_XIP_WRITE */
+
+/**
+ * run a command of qspi_xfer(), in memory-mapped mode or not
+ */
+static sfud_err qspi_xfer_run(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+
+    if ((spi_dev->ospi_handle->Instance->CR & OCTOSPI_CR_FMODE_Msk) == OCTOSPI_CR_FMODE) {
+#ifdef SFUD_USING_QSPI_XIP_WRITE
+        return qspi_xip_xfer(spi, xfer);
+#else
+        elog_e(TAG, "should not write when in memory mapping mode");
+        return SFUD_ERR_WRITE;
+#endif
+    }
+    return qspi_command_run(spi, xfer);
+}
+
+#ifdef SFUD_USING_QSPI_DUALQUAD
+/* data bytes per part of one register command, the SFDP reads of the core are shorter */
+#define QSPI_DUAL_REG_MAX_SIZE          64
+
+/* a page program of the core with its odd edges padded */
+static uint8_t qspi_dual_page[SFUD_WRITE_MAX_PAGE_SIZE + 2];
+
+static sfud_err qspi_dual_xfer_read(const qspi_dual_read_ctx *ctx, uint32_t addr, uint8_t *buf, size_t size) {
+    sfud_spi_xfer pair = *ctx->xfer;
+
+    pair.addr = addr;
+    pair.data_size = size;
+    pair.read_buf = buf;
+    return qspi_xfer_run(ctx->spi, &pair);
+}
+
+/**
+ * a register command on both parts: each byte sent to both, or read from both and merged
+ *
+ * The status bits of the two are ANDed, BUSY ORed: WEL and QE set on both, busy while one is. The IDs and the
+ * SFDP must be the same in both parts.
+ */
+static sfud_err qspi_dual_reg(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
+    uint8_t pair[2 * QSPI_DUAL_REG_MAX_SIZE], a, b;
+    sfud_spi_xfer cmd = *xfer;
+    sfud_err result = SFUD_SUCCESS;
+    size_t done, n, i;
 
-        if (send_length - count > 0) {
-            if (HAL_OSPI_Transmit(spi_dev->ospi_handle, ptr + count, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-//                sfud_log_info("qspi send data failed(%d)!", spi_dev->ospi_handle->ErrorCode);
-                result = SFUD_ERR_WRITE;
+    /* only an addressed read goes on in several commands */
+    if (xfer->data_size > QSPI_DUAL_REG_MAX_SIZE && !(xfer->addr_size && xfer->read_buf)) {
+        return xfer->read_buf ? SFUD_ERR_READ : SFUD_ERR_WRITE;
+    }
+    for (done = 0; done < xfer->data_size && result == SFUD_SUCCESS; done += n) {
+        n = xfer->data_size - done > QSPI_DUAL_REG_MAX_SIZE ? QSPI_DUAL_REG_MAX_SIZE : xfer->data_size - done;
+        cmd.data_size = 2 * n;
+        /* the parts get half the address, so each one reads the SFDP at the one of the core */
+        cmd.addr = (xfer->addr + done) * 2;
+        if (!xfer->read_buf) {
+            for (i = 0; i < n; i++) {
+                pair[2 * i] = pair[2 * i + 1] = xfer->write_buf[done + i];
+            }
+            cmd.write_buf = pair;
+            result = qspi_xfer_run(spi, &cmd);
+            continue;
+        }
+        cmd.read_buf = pair;
+        result = qspi_xfer_run(spi, &cmd);
+        for (i = 0; i < n && result == SFUD_SUCCESS; i++) {
+            a = pair[2 * i];
+            b = pair[2 * i + 1];
+            if (xfer->instruction == SFUD_CMD_READ_STATUS_REGISTER
+                    || xfer->instruction == SFUD_CMD_READ_STATUS_REGISTER_2) {
+                xfer->read_buf[done + i] = (a & b) | ((a | b) & SFUD_STATUS_REGISTER_BUSY);
+            } else if (a == b) {
+                xfer->read_buf[done + i] = a;
+            } else {
+                elog_e(TAG, "dual-quad: the parts differ on command 0x%02X", xfer->instruction);
+                result = SFUD_ERR_READ;
             }
         }
+    }
+    return result;
+}
 
-        return result;
+/**
+ * run a command of the core on both parts of a dual-quad flash
+ *
+ * The OCTOSPI sends the instruction, half the address and the dummy cycles to both parts, then each part moves
+ * every other data byte: the even ones on IO0 ~ IO3, the odd ones on IO4 ~ IO7. The commands without data and the
+ * array ones take the address of the core as it is:
+ *
+ *     erase           the units of both parts holding half the address, an erase unit of the core
+ *     page program    an odd head or tail padded with 0xFF, which programs nothing
+ *     array read      an odd head or tail read as a pair
+ *     register        status, IDs and SFDP made per part, see qspi_dual_reg()
+ */
+static sfud_err qspi_dual_xfer(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
+    sfud_spi_xfer cmd = *xfer;
+    qspi_dual_read_ctx ctx = { spi, xfer, NULL };
+    uint32_t head = xfer->addr & 1;
+
+    if (!xfer->data_size) {
+        return qspi_xfer_run(spi, xfer);
+    }
+    if (!xfer->addr_size || xfer->instruction == SFUD_CMD_READ_SFDP_REGISTER) {
+        return qspi_dual_reg(spi, xfer);
+    }
+    if (xfer->read_buf) {
+        return qspi_dual_read_pairs(qspi_dual_xfer_read, &ctx, xfer->addr, xfer->read_buf, xfer->data_size);
+    }
+    if (!head && !(xfer->data_size & 1)) {
+        return qspi_xfer_run(spi, xfer);
     }
+    /* even bounds never cross a page of the core */
+    if (xfer->data_size > SFUD_WRITE_MAX_PAGE_SIZE) {
+        return SFUD_ERR_WRITE;
+    }
+    cmd.addr = xfer->addr - head;
+    cmd.data_size = (head + xfer->data_size + 1) & ~(size_t) 1;
+    memset(qspi_dual_page, 0xFF, cmd.data_size);
+    memcpy(qspi_dual_page + head, xfer->write_buf, xfer->data_size);
+    cmd.write_buf = qspi_dual_page;
+    return qspi_xfer_run(spi, &cmd);
 }
+#endif /* SFUD_USING_QSPI_DUALQUAD */
 
-sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash) {
-    OSPI_RegularCmdTypeDef Cmdhandler = {0};         // QSPI传输配置
-    OSPI_MemoryMappedTypeDef sMemMappedCfg = {0};    // 内存映射访问参数
+/**
+ * structured transfer of the OSPI flash, nothing is copied or parsed
+ */
+sfud_err qspi_xfer(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
+#ifdef SFUD_USING_QSPI_QPI
+    sfud_spi_xfer qpi;
+
+    if (qspi_flash_of(spi)->qpi) {
+        /* the core makes its commands 1-line, the flash in QPI mode takes every phase on the four lines */
+        qpi = *xfer;
+        qpi.instruction_lines = 4;
+        qpi.addr_lines = 4;
+        qpi.data_lines = 4;
+        return qspi_xfer_run(spi, &qpi);
+    }
+#endif
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    if (((spi_user_data_t) spi->user_data)->dual_quad) {
+        return qspi_dual_xfer(spi, xfer);
+    }
+#endif
+    return qspi_xfer_run(spi, xfer);
+}
 
+/**
+ * This function can send or send then receive QSPI data.
+ *
+ * The packed command of spi->wr() is taken apart here, the core uses qspi_xfer() for the bulk commands.
+ */
+sfud_err qspi_send_then_recv(
+    const sfud_spi *spi,
+    const void *send_buf, size_t send_length,
+    void *recv_buf, size_t recv_length
+) {
+    assert_param(send_buf);
+    assert_param(send_length != 0);
 
-    Cmdhandler.OperationType = HAL_OSPI_OPTYPE_COMMON_CFG;             // 通用配置
-    Cmdhandler.FlashId = HAL_OSPI_FLASH_ID_1;                    // flash ID
+    const unsigned char *ptr = (const unsigned char *) send_buf;
+    size_t count = 1;
+    sfud_spi_xfer xfer;
 
-    /* set cmd struct */
-    Cmdhandler.Instruction = flash->read_cmd_format.instruction;
-    switch (flash->read_cmd_format.instruction_lines) {
-    case 0:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_NONE;
-        break;
-    case 1:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_1_LINE;
-        break;
-    case 2:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_2_LINES;
-        break;
-    case 4:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_4_LINES;
-        break;
-    case 8:
-        Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_8_LINES;
-        break;
-    default:
-        break;
-    }
-    Cmdhandler.InstructionSize = HAL_OSPI_INSTRUCTION_8_BITS;            // 指令长度8位
-    Cmdhandler.InstructionDtrMode = HAL_OSPI_INSTRUCTION_DTR_DISABLE;       // 禁止指令DTR模式
+    memset(&xfer, 0, sizeof(xfer));
+    /* get instruction */
+    xfer.instruction = ptr[0];
 
+    /* get address */
+    if (send_length > 1) {
+        /* the SFDP read always has a 3-Byte address */
+        if (qspi_flash_of(spi)->addr_in_4_byte && ptr[0] != SFUD_CMD_READ_SFDP_REGISTER && send_length >= 5) {
+            /* address size is 4 Byte */
+            xfer.addr = ((uint32_t) ptr[1] << 24) | (ptr[2] << 16) | (ptr[3] << 8) | (ptr[4]);
+            xfer.addr_size = 4;
+        } else if (send_length >= 4) {
+            /* address size is 3 Byte */
+            xfer.addr = (ptr[1] << 16) | (ptr[2] << 8) | (ptr[3]);
+            xfer.addr_size = 3;
+        } else {
+            return SFUD_ERR_READ;
+        }
+        count += xfer.addr_size;
+    }
 
-    switch (flash->read_cmd_format.address_lines) {
-    case 0:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_NONE;
-        break;
-    case 1:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_1_LINE;
-        break;
-    case 2:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_2_LINES;
-        break;
-    case 4:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_4_LINES;
-        break;
-    case 8:
-        Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_8_LINES;
-        break;
-    default:
-        break;
+    if (recv_buf) {
+        /* whatever follows the address is dummy */
+        xfer.dummy_size = (uint8_t) (send_length - count);
+        xfer.read_buf = recv_buf;
+        xfer.data_size = recv_length;
+    } else {
+        xfer.write_buf = ptr + count;
+        xfer.data_size = send_length - count;
     }
-    Cmdhandler.AddressSize = HAL_OSPI_ADDRESS_24_BITS;
-    Cmdhandler.AddressDtrMode = HAL_OSPI_ADDRESS_DTR_DISABLE;
 
-    Cmdhandler.AlternateBytes = 0;
+    return qspi_xfer(spi, &xfer);
+}
+
+#ifdef SFUD_USING_QSPI_CONTINUOUS_READ
+/**
+ * leave the continuous read by clocking 0xFF on all IO lines
+ *
+ * The flash in continuous read takes the first clocks as address, then the mode bits 0xFF make it wait
+ * for an instruction again. A flash which is not in continuous read sees the instruction 0xFF on IO0,
+ * which is ignored.
+ */
+static sfud_err qspi_continuous_read_reset(OSPI_HandleTypeDef *hospi) {
+    OSPI_RegularCmdTypeDef Cmdhandler = {0};
+
+    qspi_set_dtr_timing(hospi, false);
+
+    Cmdhandler.OperationType = HAL_OSPI_OPTYPE_COMMON_CFG;
+    Cmdhandler.FlashId = HAL_OSPI_FLASH_ID_1;
+    /* 2 + 8 clocks, enough for a 4-Byte address and the mode bits */
+    Cmdhandler.Instruction = 0xFF;
+    Cmdhandler.InstructionMode = HAL_OSPI_INSTRUCTION_4_LINES;
+    Cmdhandler.InstructionSize = HAL_OSPI_INSTRUCTION_8_BITS;
+    Cmdhandler.Address = 0xFFFFFFFF;
+    Cmdhandler.AddressMode = HAL_OSPI_ADDRESS_4_LINES;
+    Cmdhandler.AddressSize = HAL_OSPI_ADDRESS_32_BITS;
     Cmdhandler.AlternateBytesMode = HAL_OSPI_ALTERNATE_BYTES_NONE;
-    Cmdhandler.AlternateBytesSize = 0;
-    Cmdhandler.AlternateBytesDtrMode = HAL_OSPI_ALTERNATE_BYTES_DTR_DISABLE;   // 禁止替字节DTR模式
+    Cmdhandler.DataMode = HAL_OSPI_DATA_NONE;
+    Cmdhandler.DummyCycles = 0;
+    Cmdhandler.DQSMode = HAL_OSPI_DQS_DISABLE;
+    Cmdhandler.SIOOMode = HAL_OSPI_SIOO_INST_EVERY_CMD;
 
-    switch (flash->read_cmd_format.data_lines) {
-    case 0:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_NONE;
-        break;
-    case 1:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_1_LINE;
-        break;
-    case 2:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_2_LINES;
-        break;
-    case 4:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_4_LINES;
-        break;
-    case 8:
-        Cmdhandler.DataMode = HAL_OSPI_DATA_8_LINES;
-        break;
-    default:
-        break;
+    if (HAL_OSPI_Command(hospi, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return SFUD_ERR_WRITE;
     }
-    Cmdhandler.NbData = 0;
-    Cmdhandler.DataDtrMode = HAL_OSPI_DATA_DTR_DISABLE;
+    return SFUD_SUCCESS;
+}
+#endif
 
-    Cmdhandler.DummyCycles = flash->read_cmd_format.dummy_cycles;
+#ifdef SFUD_USING_QSPI_WRAP_READ
+/**
+ * Set Burst with Wrap (77h): 24 dummy bits then the wrap bits, on the four lines like the quad I/O read
+ */
+static sfud_err qspi_wrap_set(OSPI_HandleTypeDef *hospi, uint8_t wrap_bits) {
+    sfud_spi_xfer xfer;
+
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.instruction = SFUD_CMD_SET_BURST_WITH_WRAP;
+    xfer.addr = wrap_bits;
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    if (hospi == ospi1.ospi_handle && ospi1.dual_quad) {
+        /* the parts get half the address, the wrap bits one place up */
+        xfer.addr <<= 1;
+    }
+#endif
+    xfer.addr_size = 4;
+    xfer.addr_lines = 4;
+    return qspi_reg_command_run(hospi, &xfer);
+}
 
-    Cmdhandler.DQSMode = HAL_OSPI_DQS_DISABLE;                   // 不使用DQS
-    Cmdhandler.SIOOMode = HAL_OSPI_SIOO_INST_EVERY_CMD;
+/**
+ * wrap the quad I/O read in 32 bytes, the D-Cache line, and make it the wrap command of the memory-mapped mode
+ *
+ * The flash wraps each quad I/O read from now on, so the regular command becomes the 1-1-4 read, which it
+ * doesn't wrap: the linear accesses of the window, the MDMA and the uncached ones, take that one.
+ *
+ * @param hospi OSPI handle
+ * @param cmd the quad I/O read in, the linear read of the regular command out
+ *
+ * @return result
+ */
+static sfud_err qspi_wrap_read_setup(OSPI_HandleTypeDef *hospi, OSPI_RegularCmdTypeDef *cmd,
+                                     const sfud_qspi_read_cmd_format *format) {
+    sfud_qspi_read_cmd_format linear = *format;
+    uint8_t wrap_bits = SFUD_QSPI_WRAP_BITS_32;
+
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    if (hospi == ospi1.ospi_handle && ospi1.dual_quad) {
+        /* each part fills half of the line */
+        wrap_bits = SFUD_QSPI_WRAP_BITS_16;
+    }
+#endif
+    if (qspi_wrap_set(hospi, wrap_bits) != SFUD_SUCCESS) {
+        return SFUD_ERR_READ;
+    }
+    while (hospi->Instance->SR & OCTOSPI_SR_BUSY);
+    MODIFY_REG(hospi->Instance->DCR2, OCTOSPI_DCR2_WRAPSIZE, HAL_OSPI_WRAP_32_BYTES);
+    hospi->Init.WrapSize = HAL_OSPI_WRAP_32_BYTES;
+
+    cmd->OperationType = HAL_OSPI_OPTYPE_WRAP_CFG;
+    if (HAL_OSPI_Command(hospi, cmd, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return SFUD_ERR_READ;
+    }
+    /* HAL_OSPI_Init() only sets the sampling of TCR, the line fills sample like the regular read */
+    MODIFY_REG(hospi->Instance->WPTCR, OCTOSPI_TCR_SSHIFT, qspi_str_sshift);
+
+    /* 6Bh, 6Ch with a 4-Byte address like ECh, 8 dummy cycles on the Winbond parts */
+    linear.instruction = format->instruction == SFUD_CMD_QUAD_IO_READ_DATA + 1 ? SFUD_CMD_QUAD_OUTPUT_READ_DATA + 1
+                                                                              : SFUD_CMD_QUAD_OUTPUT_READ_DATA;
+    linear.address_lines = 1;
+    linear.alternate_bytes_lines = 0;
+    linear.dummy_cycles = 8;
+    memset(cmd, 0, sizeof(OSPI_RegularCmdTypeDef));
+    qspi_read_cmd_setup(cmd, &linear);
+    cmd->NbData = 0;
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * undo qspi_wrap_read_setup() once the memory-mapped mode is left, the indirect reads are linear again
+ */
+static sfud_err qspi_wrap_read_reset(OSPI_HandleTypeDef *hospi) {
+    while (hospi->Instance->SR & OCTOSPI_SR_BUSY);
+    CLEAR_BIT(hospi->Instance->DCR2, OCTOSPI_DCR2_WRAPSIZE);
+    hospi->Init.WrapSize = HAL_OSPI_WRAP_NOT_SUPPORTED;
+    return qspi_wrap_set(hospi, SFUD_QSPI_WRAP_BITS_OFF);
+}
+#endif /* SFUD_USING_QSPI_WRAP_READ */
+
+/**
+ * set the sample shift of the STR commands, see boot_ospi_cal.h, the OCTOSPI is in indirect mode
+ *
+ * @param shift true: half a cycle, the default
+ */
+void qspi_set_sample_shift(sfud_flash *flash, bool shift) {
+    spi_user_data_t spi_dev = (spi_user_data_t) flash->spi.user_data;
+    OSPI_HandleTypeDef *hospi = spi_dev->ospi_handle;
+
+    qspi_str_sshift = shift ? OCTOSPI_TCR_SSHIFT : 0;
+    if (!(hospi->Instance->TCR & OCTOSPI_TCR_DHQC)) {
+        /* the STR timing is in force, force it again */
+        while (hospi->Instance->SR & OCTOSPI_SR_BUSY);
+        MODIFY_REG(hospi->Instance->TCR, OCTOSPI_TCR_SSHIFT, qspi_str_sshift);
+        hospi->Init.SampleShifting = shift ? HAL_OSPI_SAMPLE_SHIFTING_HALFCYCLE : HAL_OSPI_SAMPLE_SHIFTING_NONE;
+    }
+}
+
+sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash) {
+    OSPI_RegularCmdTypeDef Cmdhandler;               // QSPI传输配置
+    OSPI_MemoryMappedTypeDef sMemMappedCfg = {0};    // 内存映射访问参数
 
     spi_user_data_t spi_dev = (spi_user_data_t) flash->spi.user_data;
+    /* a quad read with the QE bit clear fetches garbage, and the CPU executes it */
+    if (sfud_qspi_quad_check(flash) != SFUD_SUCCESS) {
+        return SFUD_ERR_READ;
+    }
+    qspi_set_device_size(spi_dev->ospi_handle, flash->chip.capacity);
+    Cmdhandler = *qspi_read_cmd_get(spi_dev, &flash->read_cmd_format);
+    Cmdhandler.NbData = 0;
+#ifdef SFUD_USING_QSPI_CONTINUOUS_READ
+    if (flash->read_cmd_format.continuous) {
+        /* only the first fetch sends the instruction, the flash stays in continuous read */
+        Cmdhandler.AlternateBytes = SFUD_QSPI_MODE_BITS_CONTINUOUS;
+        Cmdhandler.SIOOMode = HAL_OSPI_SIOO_INST_ONLY_FIRST_CMD;
+    }
+#endif
+#ifdef SFUD_USING_QSPI_WRAP_READ
+    if (flash->read_cmd_format.wrap
+            && qspi_wrap_read_setup(spi_dev->ospi_handle, &Cmdhandler, &flash->read_cmd_format) != SFUD_SUCCESS) {
+        return SFUD_ERR_READ;
+    }
+#endif
+
     if (HAL_OSPI_Command(spi_dev->ospi_handle, &Cmdhandler, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
 //        sfud_log_info("QSPI Command Error!");
         return SFUD_ERR_READ;
@@ -621,6 +2318,21 @@ sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash) {
 
 sfud_err qspi_exit_memory_mapped_mode(sfud_flash *flash) {
     spi_user_data_t spi_dev = (spi_user_data_t) flash->spi.user_data;
+    bool continuous = READ_BIT(spi_dev->ospi_handle->Instance->CCR, OCTOSPI_CCR_SIOO) != 0;
+
     HAL_OSPI_Abort(spi_dev->ospi_handle);
+
+#ifdef SFUD_USING_QSPI_WRAP_READ
+    if (READ_BIT(spi_dev->ospi_handle->Instance->DCR2, OCTOSPI_DCR2_WRAPSIZE)) {
+        return qspi_wrap_read_reset(spi_dev->ospi_handle);
+    }
+#endif
+#ifdef SFUD_USING_QSPI_CONTINUOUS_READ
+    if (continuous) {
+        return qspi_continuous_read_reset(spi_dev->ospi_handle);
+    }
+#else
+    (void) continuous;
+#endif
     return SFUD_SUCCESS;
 }
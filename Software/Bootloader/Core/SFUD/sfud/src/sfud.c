@@ -27,6 +27,7 @@
  */
 
 #include "sfud.h"
+#include <stddef.h>
 #include <string.h>
 
 /* send dummy data for read data */
@@ -36,8 +37,16 @@
 #error "Please configure the flash device information table in (in sfud_cfg.h)."
 #endif
 
+#if defined(SFUD_USING_QSPI_QPI) && !defined(SFUD_USING_SFDP)
+#error "The QPI mode needs the SFDP basic table, please define SFUD_USING_SFDP (in sfud_cfg.h)."
+#endif
+
 /* user configured flash device information table */
+#ifdef SFUD_FLASH_TABLE_SECTION
+static sfud_flash flash_table[] __attribute__((section(SFUD_FLASH_TABLE_SECTION))) = SFUD_FLASH_DEVICE_TABLE;
+#else
 static sfud_flash flash_table[] = SFUD_FLASH_DEVICE_TABLE;
+#endif
 /* supported manufacturer information table */
 static const sfud_mf mf_table[] = SFUD_MF_TABLE;
 
@@ -56,12 +65,64 @@ enum sfud_qspi_read_mode {
     DUAL_IO = 1 << 2,                       /**< qspi fast read dual input/output */
     QUAD_OUTPUT = 1 << 3,                   /**< qspi fast read quad output */
     QUAD_IO = 1 << 4,                       /**< qspi fast read quad input/output */
+    QUAD_IO_DTR = 1 << 5,                   /**< qspi fast read quad input/output, double transfer rate */
+    CONTINUOUS_READ = 1 << 6,               /**< quad input/output read can skip the instruction by the mode bits */
+    QUAD_PROGRAM = 1 << 7,                  /**< quad input page program, 1-1-4 (32h) */
+    QUAD_IO_PROGRAM = 1 << 8,               /**< quad input/output page program, 1-4-4 (38h) */
+    WRAP_READ = 1 << 9,                     /**< quad input/output read wraps after Set Burst with Wrap (77h) */
 };
 
 /* QSPI flash chip's extended information table */
 static const sfud_qspi_flash_ext_info qspi_flash_ext_info_table[] = SFUD_FLASH_EXT_INFO_TABLE;
 #endif /* SFUD_USING_QSPI */
 
+#ifdef SFUD_USING_READ_CACHE
+/* a line of the read cache, flash NULL: empty */
+typedef struct {
+    const sfud_flash *flash;
+    uint32_t addr;
+    uint32_t used;                               /**< read_cache_clock at the last hit, the least one goes first */
+    uint8_t data[SFUD_READ_CACHE_LINE_SIZE];
+} read_cache_line;
+
+static read_cache_line read_cache[SFUD_READ_CACHE_LINES] __attribute__((section(SFUD_READ_CACHE_SECTION)));
+static uint32_t read_cache_clock;
+#endif /* SFUD_USING_READ_CACHE */
+
+#ifdef SFUD_USING_WRITE_BUFFER
+/* the pending sub-page writes of one page, flash NULL: empty */
+typedef struct {
+    const sfud_flash *flash;
+    uint32_t addr;                               /**< page address */
+    uint16_t start;                              /**< first pending byte in the page */
+    uint16_t end;                                /**< byte after the last pending one */
+    uint8_t data[SFUD_WRITE_MAX_PAGE_SIZE];      /**< the bytes of the page, 0xFF: not programmed */
+} write_buffer_page;
+
+static write_buffer_page write_buffer __attribute__((aligned(32)));
+#endif /* SFUD_USING_WRITE_BUFFER */
+
+#ifdef SFUD_USING_STATS
+#define STATS_DEVICE_NUM                         (sizeof(flash_table) / sizeof(sfud_flash))
+/* counters of each device, and the outermost operation running on it, NULL: none */
+static sfud_stats flash_stats[STATS_DEVICE_NUM];
+static sfud_stats_entry *stats_active[STATS_DEVICE_NUM];
+#endif /* SFUD_USING_STATS */
+
+#ifdef SFUD_USING_IDLE_TRACK
+#define IDLE_DEVICE_NUM                          (sizeof(flash_table) / sizeof(sfud_flash))
+/* the flash of each device is known idle, the device is const on the paths that change it, so it's kept here */
+static bool flash_idle[IDLE_DEVICE_NUM];
+#endif /* SFUD_USING_IDLE_TRACK */
+
+#ifdef SFUD_USING_BLANK_CHECK
+#define BLANK_DEVICE_NUM                         (sizeof(flash_table) / sizeof(sfud_flash))
+/* bytes the blank check reads at a time when the flash isn't memory-mapped */
+#define BLANK_READ_SIZE                          1024
+/* erase units of each device known blank, bit per chip.erase_gran unit */
+static uint32_t blank_map[BLANK_DEVICE_NUM][(SFUD_BLANK_MAP_UNITS + 31) / 32];
+#endif /* SFUD_USING_BLANK_CHECK */
+
 static sfud_err software_init(const sfud_flash *flash);
 
 static sfud_err hardware_init(sfud_flash *flash);
@@ -71,8 +132,28 @@ static sfud_err page256_or_1_byte_write(const sfud_flash *flash, uint32_t addr,
 
 static sfud_err aai_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data);
 
+static sfud_err page_program(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data);
+
+static sfud_err page_program_wait(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data);
+
+#ifdef SFUD_USING_WRITE_VERIFY
+static sfud_err page_verify(const sfud_flash *flash, uint32_t addr, size_t size, uint32_t crc);
+
+static sfud_err page_program_verified(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data);
+#endif
+
+static void eraser_get(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *cmd, size_t *erase_size);
+
 static sfud_err wait_busy(const sfud_flash *flash);
 
+static sfud_err wait_busy_timed(const sfud_flash *flash, uint32_t time_typ, uint32_t time_max);
+
+static uint32_t erase_time(const sfud_flash *flash, uint32_t size, uint32_t *time_max);
+
+static sfud_err wait_idle(const sfud_flash *flash);
+
+static void idle_set(const sfud_flash *flash, bool idle);
+
 static sfud_err reset(const sfud_flash *flash);
 
 static sfud_err read_jedec_id(sfud_flash *flash);
@@ -83,10 +164,82 @@ static sfud_err set_4_byte_address_mode(sfud_flash *flash, bool enabled);
 
 static void make_address_byte_array(const sfud_flash *flash, uint32_t addr, uint8_t *array);
 
-/* ../port/sfup_port.c */
-extern void sfud_log_debug(const char *file, const long line, const char *format, ...);
+static bool addr_4_byte_inst_available(const sfud_flash *flash);
+
+static uint8_t addr_4_byte_cmd(const sfud_flash *flash, uint8_t cmd);
+
+static void xfer_make(const sfud_flash *flash, sfud_spi_xfer *xfer, uint8_t cmd, uint32_t addr);
+
+static sfud_err spi_xfer(const sfud_flash *flash, const sfud_spi_xfer *xfer);
+
+static sfud_err read_data(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data);
+
+#ifdef SFUD_USING_PART_DRIVER
+static const sfud_part *part_get(const sfud_flash *flash);
+
+static sfud_err part_program(const sfud_flash *flash, const sfud_part *part, uint32_t addr, size_t size,
+                             const uint8_t *data);
+#endif
+
+#ifdef SFUD_USING_READ_CACHE
+static void read_cache_drop(const sfud_flash *flash, uint32_t addr, size_t size);
+#endif
+
+#ifdef SFUD_USING_BLANK_CHECK
+static bool blank_unit(const sfud_flash *flash, uint32_t addr);
+
+static void blank_map_mark(const sfud_flash *flash, uint32_t addr, size_t size, bool blank);
+#endif
+
+#ifdef SFUD_USING_WRITE_BUFFER
+static sfud_err write_buffer_flush(const sfud_flash *flash, uint32_t addr, size_t size);
+
+static void write_buffer_drop(const sfud_flash *flash, uint32_t addr, size_t size);
+#endif
+
+#ifdef SFUD_USING_PROBE_CACHE
+static bool probe_cache_get(const sfud_flash *flash, sfud_probe_cache *cache);
+
+static bool probe_cache_load(sfud_flash *flash);
 
-extern void sfud_log_info(const char *format, ...);
+static void probe_cache_save(const sfud_flash *flash, uint8_t read_data_lines);
+#endif
+
+#ifdef SFUD_USING_STATS
+static uint32_t stats_begin(const sfud_flash *flash, sfud_stats_op op);
+
+static void stats_end(const sfud_flash *flash, sfud_stats_op op, uint32_t start, size_t bytes);
+
+static void stats_busy(const sfud_flash *flash, sfud_stats_op op, uint32_t start, uint32_t retries);
+
+static sfud_err stats_bus(const sfud_flash *flash, sfud_err result);
+
+#define stats_now()                              sfud_port_time_us()
+#else
+#define stats_begin(flash, op)                   0
+#define stats_end(flash, op, start, bytes)       ((void) (start))
+#define stats_busy(flash, op, start, retries)    ((void) (start))
+#define stats_bus(flash, result)                 (result)
+#define stats_now()                              0
+#endif
+
+#ifdef SFUD_USING_PROBE_CACHE
+extern bool sfud_port_probe_cache_read(const sfud_flash *flash, sfud_probe_cache *cache);
+
+extern void sfud_port_probe_cache_write(const sfud_flash *flash, const sfud_probe_cache *cache);
+#endif
+
+#ifdef SFUD_USING_STATS
+extern uint32_t sfud_port_time_us(void);
+#endif
+
+#ifdef SFUD_USING_WRITE_VERIFY
+extern uint32_t sfud_port_crc32(uint32_t crc, const void *buf, size_t size);
+#endif
+
+#ifdef SFUD_USING_BLANK_CHECK
+extern const void *sfud_port_mapped(const sfud_flash *flash, uint32_t addr, size_t size);
+#endif
 
 /**
  * SFUD initialize by flash device
@@ -98,6 +251,12 @@ extern void sfud_log_info(const char *format, ...);
 sfud_err sfud_device_init(sfud_flash *flash) {
     sfud_err result = SFUD_SUCCESS;
 
+    /* the flash may still be busy from before, the first read polls it */
+    idle_set(flash, false);
+#ifdef SFUD_USING_PART_DRIVER
+    /* the part may be another one now, its driver is attached again after the probe */
+    flash->part = NULL;
+#endif
     /* hardware initialize */
     result = hardware_init(flash);
     if (result != SFUD_SUCCESS) {
@@ -110,6 +269,15 @@ sfud_err sfud_device_init(sfud_flash *flash) {
     }
     flash->init_ok = true;
 //    SFUD_INFO("%s flash device init successfully.", flash->name);
+#ifdef SFUD_USING_READ_CACHE
+    read_cache_drop(flash, 0, flash->chip.capacity);
+#endif
+#ifdef SFUD_USING_WRITE_BUFFER
+    write_buffer_drop(flash, 0, flash->chip.capacity);
+#endif
+#ifdef SFUD_USING_BLANK_CHECK
+    blank_map_mark(flash, 0, flash->chip.capacity, false);
+#endif
 
     __failed:
     if (result != SFUD_SUCCESS) {
@@ -124,12 +292,19 @@ sfud_err sfud_device_deinit(sfud_flash *flash) {
 
     // turn to power save mode
     const sfud_spi *spi = &flash->spi;
+#ifdef SFUD_USING_WRITE_BUFFER
+    /* the pending writes go to the flash before it sleeps */
+    result = write_buffer_flush(flash, 0, flash->chip.capacity);
+    if (result != SFUD_SUCCESS) {
+        goto __failed;
+    }
+#endif
     /* lock SPI */
     if (spi->lock) {
         spi->lock(spi);
     }
 
-    result = wait_busy(flash);
+    result = wait_idle(flash);
 
     if (result != SFUD_SUCCESS) {
         goto __failed;
@@ -138,6 +313,8 @@ sfud_err sfud_device_deinit(sfud_flash *flash) {
     uint8_t cmd_data[1];
     cmd_data[0] = 0xB9; // deep power done
     result = spi->wr(spi, cmd_data, 1, NULL, 0);
+    /* no status reads in deep power-down, the next init polls again */
+    idle_set(flash, false);
 
     /* unlock SPI */
     if (spi->unlock) {
@@ -152,6 +329,9 @@ sfud_err sfud_device_deinit(sfud_flash *flash) {
     }
 
     flash->init_ok = false;
+#ifdef SFUD_USING_PART_DRIVER
+    flash->part = NULL;
+#endif
 
     return result;
 
@@ -171,10 +351,22 @@ sfud_err sfud_init(void) {
 
     SFUD_DEBUG("Start initialize Serial Flash Universal Driver(SFUD) V%s.", SFUD_SW_VERSION);
     SFUD_DEBUG("You can get the latest version on https://github.com/armink/SFUD .");
+#ifdef SFUD_USING_READ_CACHE
+    /* the lines aren't zeroed by the startup */
+    memset(read_cache, 0, sizeof(read_cache));
+#endif
+#ifdef SFUD_USING_WRITE_BUFFER
+    write_buffer.flash = NULL;
+#endif
     /* initialize all flash device in flash device table */
     for (i = 0; i < sizeof(flash_table) / sizeof(sfud_flash); i++) {
         /* initialize flash device index of flash device information table */
         flash_table[i].index = i;
+#ifdef SFUD_INIT_FLASHES
+        if (!(SFUD_INIT_FLASHES & (1UL << i))) {
+            continue;
+        }
+#endif
         cur_flash_result = sfud_device_init(&flash_table[i]);
 
         if (cur_flash_result != SFUD_SUCCESS) {
@@ -239,20 +431,284 @@ const sfud_flash *sfud_get_device_table(void) {
 }
 
 #ifdef SFUD_USING_QSPI
+#ifdef SFUD_USING_SFDP
+/**
+ * check the 4-Byte address read instruction is in the SFDP 4-Byte address instruction table
+ */
+static bool qspi_4_byte_read_supported(const sfud_flash *flash, uint8_t ins) {
+    /* bit of the 1st DWORD for 13h 0Ch 3Ch BCh 6Ch ECh, EEh is bit 17 */
+    static const uint8_t read_ins[] = { 0x13, 0x0C, 0x3C, 0xBC, 0x6C, 0xEC };
+    size_t i;
+
+    if (ins == 0xEE) {
+        return (flash->sfdp.inst_4_byte & (1UL << 17)) != 0;
+    }
+    for (i = 0; i < sizeof(read_ins); i++) {
+        if (read_ins[i] == ins) {
+            return (flash->sfdp.inst_4_byte & (1UL << i)) != 0;
+        }
+    }
+    return false;
+}
+
+/**
+ * read modes of an unlisted flash from its SFDP basic table
+ */
+static uint16_t qspi_sfdp_read_mode(const sfud_flash *flash) {
+    uint16_t read_mode = NORMAL_SPI_READ;
+
+    if (flash->sfdp.fast_read[SFUD_SFDP_READ_1_1_2].cmd == SFUD_CMD_DUAL_OUTPUT_READ_DATA) {
+        read_mode |= DUAL_OUTPUT;
+    }
+    if (flash->sfdp.fast_read[SFUD_SFDP_READ_1_2_2].cmd == SFUD_CMD_DUAL_IO_READ_DATA) {
+        read_mode |= DUAL_IO;
+    }
+    if (flash->sfdp.fast_read[SFUD_SFDP_READ_1_1_4].cmd == SFUD_CMD_QUAD_OUTPUT_READ_DATA) {
+        read_mode |= QUAD_OUTPUT;
+    }
+    if (flash->sfdp.fast_read[SFUD_SFDP_READ_1_4_4].cmd == SFUD_CMD_QUAD_IO_READ_DATA) {
+        read_mode |= QUAD_IO;
+    }
+    /* the basic table has no quad page program, the 4-Byte address table has: bit 7 34h, bit 8 3Eh */
+    if (flash->sfdp.inst_4_byte & (1UL << 7)) {
+        read_mode |= QUAD_PROGRAM;
+    } else if (flash->sfdp.inst_4_byte & (1UL << 8)) {
+        read_mode |= QUAD_IO_PROGRAM;
+    }
+
+    return read_mode;
+}
+
+/**
+ * wait states of a fast read, mode clocks included, the SFDP ones when it has the read
+ *
+ * @param index SFUD_SFDP_READ_xxx
+ * @param ins standard instruction of the read
+ * @param dummy_cycles wait states without SFDP
+ */
+static uint8_t qspi_sfdp_dummy_cycles(const sfud_flash *flash, uint8_t index, uint8_t ins, uint8_t dummy_cycles) {
+    if (flash->sfdp.available && flash->sfdp.fast_read[index].cmd == ins) {
+        dummy_cycles = flash->sfdp.fast_read[index].mode_cycles + flash->sfdp.fast_read[index].dummy_cycles;
+    }
+    return dummy_cycles;
+}
+
+/**
+ * read the QE bit by the SFDP quad enable requirement, and the registers a write of it goes to
+ *
+ * @param set the QE bit is set; always false on SFUD_SFDP_QE_SR2_BIT1_NO_READ parts, SR2 can't be read
+ * @param data the status register write setting the bit
+ * @param size bytes of data, 0: no QE bit, or not known
+ */
+static sfud_err qspi_quad_read(const sfud_flash *flash, bool *set, uint8_t data[3], uint8_t *size) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    uint8_t cmd, sr1 = 0, sr2 = 0;
+
+    *set = true;
+    *size = 0;
+    switch (flash->sfdp.quad_enable) {
+    case SFUD_SFDP_QE_SR1_BIT6:
+        result = sfud_read_status(flash, &sr1);
+        *set = (sr1 & (1 << 6)) != 0;
+        *size = 2;
+        data[0] = SFUD_CMD_WRITE_STATUS_REGISTER;
+        data[1] = sr1 | (1 << 6);
+        break;
+    case SFUD_SFDP_QE_SR2_BIT7:
+        /* 3Fh reads and 3Eh writes the SR2 */
+        cmd = 0x3F;
+        result = spi->wr(spi, &cmd, 1, &sr2, 1);
+        *set = (sr2 & (1 << 7)) != 0;
+        *size = 2;
+        data[0] = 0x3E;
+        data[1] = sr2 | (1 << 7);
+        break;
+    case SFUD_SFDP_QE_SR2_BIT1_NO_READ:
+        result = sfud_read_status(flash, &sr1);
+        *set = false;
+        *size = 3;
+        data[0] = SFUD_CMD_WRITE_STATUS_REGISTER;
+        data[1] = sr1;
+        data[2] = 1 << 1;
+        break;
+    case SFUD_SFDP_QE_SR2_BIT1:
+    case SFUD_SFDP_QE_SR2_BIT1_35:
+        cmd = SFUD_CMD_READ_STATUS_REGISTER_2;
+        result = sfud_read_status(flash, &sr1);
+        if (result == SFUD_SUCCESS) {
+            result = spi->wr(spi, &cmd, 1, &sr2, 1);
+        }
+        *set = (sr2 & (1 << 1)) != 0;
+        *size = 3;
+        data[0] = SFUD_CMD_WRITE_STATUS_REGISTER;
+        data[1] = sr1;
+        data[2] = sr2 | (1 << 1);
+        break;
+    case SFUD_SFDP_QE_SR2_BIT1_31:
+        cmd = SFUD_CMD_READ_STATUS_REGISTER_2;
+        result = spi->wr(spi, &cmd, 1, &sr2, 1);
+        *set = (sr2 & (1 << 1)) != 0;
+        *size = 2;
+        data[0] = SFUD_CMD_WRITE_STATUS_REGISTER_2;
+        data[1] = sr2 | (1 << 1);
+        break;
+    default:
+        /* no QE bit, or not known */
+        break;
+    }
+
+    return result;
+}
+
+/**
+ * write the status registers of qspi_quad_read()
+ *
+ * @param we_cmd write enable: SFUD_VOLATILE_SR_WRITE_ENABLE for a volatile write, else SFUD_CMD_WRITE_ENABLE
+ */
+static sfud_err qspi_quad_write(const sfud_flash *flash, uint8_t we_cmd, const uint8_t *data, uint8_t size) {
+    const sfud_spi *spi = &flash->spi;
+    sfud_err result;
+
+    if (we_cmd == SFUD_VOLATILE_SR_WRITE_ENABLE) {
+        /* 50h sets no WEL, there's nothing to check */
+        result = spi->wr(spi, &we_cmd, 1, NULL, 0);
+    } else {
+        result = set_write_enabled(flash, true);
+    }
+    if (result == SFUD_SUCCESS) {
+        result = spi->wr(spi, data, size, NULL, 0);
+    }
+    if (result == SFUD_SUCCESS) {
+        result = wait_busy(flash);
+    }
+    if (we_cmd != SFUD_VOLATILE_SR_WRITE_ENABLE) {
+        set_write_enabled(flash, false);
+    }
+    return result;
+}
+
+/**
+ * set the QE bit by the SFDP quad enable requirement if it's clear, and read it back
+ *
+ * The volatile write of the 16th DWORD goes first, the non-volatile bit isn't worn by a write per boot then and
+ * the parts shipped with QE=0 get it all the same; the set is checked again before each memory-mapped entry,
+ * sfud_qspi_quad_check(), as a power cycle or a reset of the flash drops it. A part with a non-volatile status
+ * register only, or whose volatile write doesn't read back, gets the non-volatile write, once in its life.
+ *
+ * @note SR2 can't be read on SFUD_SFDP_QE_SR2_BIT1_NO_READ parts, those get the write every time, unchecked.
+ *
+ * @return result, SFUD_SUCCESS when the requirement isn't known; SFUD_ERR_WRITE: the bit doesn't read back set
+ */
+static sfud_err qspi_quad_enable(const sfud_flash *flash) {
+    sfud_err result;
+    const sfud_spi *spi = &flash->spi;
+    uint8_t data[3], size, we_cmd = flash->sfdp.qe_vola_we_cmd;
+    bool set, readable = flash->sfdp.quad_enable != SFUD_SFDP_QE_SR2_BIT1_NO_READ;
+
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+    result = qspi_quad_read(flash, &set, data, &size);
+    if (result == SFUD_SUCCESS && size && !set) {
+        if (we_cmd) {
+            result = qspi_quad_write(flash, we_cmd, data, size);
+            if (result == SFUD_SUCCESS && readable) {
+                result = qspi_quad_read(flash, &set, data, &size);
+            }
+        }
+        if (result == SFUD_SUCCESS && !set && (!we_cmd || readable)) {
+            we_cmd = SFUD_CMD_WRITE_ENABLE;
+            result = qspi_quad_write(flash, we_cmd, data, size);
+            if (result == SFUD_SUCCESS && readable) {
+                result = qspi_quad_read(flash, &set, data, &size);
+            }
+        }
+        if (result == SFUD_SUCCESS && readable && !set) {
+            result = SFUD_ERR_WRITE;
+        }
+        SFUD_DEBUG("%s quad enable requirement %d, the QE bit is set, %s.", flash->name, flash->sfdp.quad_enable,
+                   we_cmd == SFUD_VOLATILE_SR_WRITE_ENABLE ? "volatile" : "non-volatile");
+    }
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+    if (result != SFUD_SUCCESS) {
+        SFUD_INFO("Error: %s quad enable failed.", flash->name);
+    }
+
+    return result;
+}
+#endif
+
+#ifdef SFUD_USING_SFDP
+#define QSPI_DUMMY_CYCLES(flash, index, ins, dummy_cycles) qspi_sfdp_dummy_cycles(flash, index, ins, dummy_cycles)
+#else
+#define QSPI_DUMMY_CYCLES(flash, index, ins, dummy_cycles) (dummy_cycles)
+#endif
+
+/**
+ * pick the quad page program of the flash, the 1-line one stays when there's none
+ *
+ * @param flash flash device
+ * @param read_mode modes of qspi_flash_ext_info_table
+ */
+static void qspi_set_write_cmd_format(sfud_flash *flash, uint16_t read_mode) {
+    uint8_t ins, addr_lines;
+
+    if (read_mode & QUAD_PROGRAM) {
+        ins = SFUD_CMD_QUAD_PAGE_PROGRAM;
+        addr_lines = 1;
+    } else if (read_mode & QUAD_IO_PROGRAM) {
+        ins = SFUD_CMD_QUAD_IO_PAGE_PROGRAM;
+        addr_lines = 4;
+    } else {
+        return;
+    }
+#ifdef SFUD_USING_SFDP
+    /* without the 4-Byte addressing mode only the instructions in the SFDP 4-Byte address table work */
+    if (flash->addr_4_byte_inst) {
+        /* bit 7: 1-1-4 34h, bit 8: 1-4-4 3Eh of the 1st DWORD */
+        if (ins == SFUD_CMD_QUAD_PAGE_PROGRAM && (flash->sfdp.inst_4_byte & (1UL << 7))) {
+            ins = SFUD_CMD_QUAD_PAGE_PROGRAM_4B;
+        } else if (ins == SFUD_CMD_QUAD_IO_PAGE_PROGRAM && (flash->sfdp.inst_4_byte & (1UL << 8))) {
+            ins = SFUD_CMD_QUAD_IO_PAGE_PROGRAM_4B;
+        } else {
+            return;
+        }
+    }
+#endif
+
+    flash->write_cmd_format.instruction = ins;
+    flash->write_cmd_format.address_lines = addr_lines;
+    flash->write_cmd_format.data_lines = 4;
+}
+
 static void qspi_set_read_cmd_format(sfud_flash *flash, uint8_t ins, uint8_t ins_lines, uint8_t addr_lines,
-        uint8_t dummy_cycles, uint8_t data_lines) {
+        uint8_t dummy_cycles, uint8_t data_lines, bool dtr) {
     /* if medium size greater than 16Mb, use 4-Byte address, instruction should be added one */
     if (flash->chip.capacity <= 0x1000000) {
         flash->read_cmd_format.instruction = ins;
         flash->read_cmd_format.address_size = 24;
     } else {
         if(ins == SFUD_CMD_READ_DATA){
-            flash->read_cmd_format.instruction = ins + 0x10;
+            flash->read_cmd_format.instruction = SFUD_CMD_READ_DATA_4B;
         }
         else{
             flash->read_cmd_format.instruction = ins + 1;
         }
         flash->read_cmd_format.address_size = 32;
+#ifdef SFUD_USING_SFDP
+        /* without the 4-Byte addressing mode only the instructions in the SFDP 4-Byte address table work */
+        if (flash->addr_4_byte_inst && !qspi_4_byte_read_supported(flash, flash->read_cmd_format.instruction)) {
+            flash->read_cmd_format.instruction = SFUD_CMD_READ_DATA_4B;
+            ins_lines = addr_lines = data_lines = 1;
+            dummy_cycles = 0;
+            dtr = false;
+        }
+#endif
     }
 
     flash->read_cmd_format.instruction_lines = ins_lines;
@@ -260,13 +716,102 @@ static void qspi_set_read_cmd_format(sfud_flash *flash, uint8_t ins, uint8_t ins
     flash->read_cmd_format.alternate_bytes_lines = 0;
     flash->read_cmd_format.dummy_cycles = dummy_cycles;
     flash->read_cmd_format.data_lines = data_lines;
+    flash->read_cmd_format.dtr = dtr;
+    flash->read_cmd_format.continuous = false;
+    flash->read_cmd_format.wrap = false;
+}
+
+#ifdef SFUD_USING_QSPI_CONTINUOUS_READ
+/**
+ * send the mode bits of the quad I/O read in the alternate bytes phase instead of the dummy cycles,
+ * so the port can keep the flash in continuous read when it is memory-mapped
+ *
+ * @param flash flash device
+ */
+static void qspi_set_continuous_read(sfud_flash *flash) {
+    sfud_qspi_read_cmd_format *format = &flash->read_cmd_format;
+
+    /* the read may have fallen back to the 1-1-1 read */
+    if (format->address_lines != 4) {
+        return;
+    }
+    /* 8 mode bits on 4 lines: 2 clocks, 1 clock in DTR */
+    format->alternate_bytes_lines = format->address_lines;
+    format->dummy_cycles -= format->dtr ? 1 : 2;
+    format->continuous = true;
+}
+#endif
+
+#ifdef SFUD_USING_QSPI_QPI
+/**
+ * send the QPI disable sequence of the SFDP basic table, the commands are 1-line again from here on
+ *
+ * @note the read and page program formats are still the 4-4-4 ones, the caller makes them again
+ */
+static sfud_err qspi_qpi_exit(sfud_flash *flash) {
+    const sfud_spi *spi = &flash->spi;
+    uint8_t cmd = flash->sfdp.qpi_disable & SFUD_SFDP_QPI_DISABLE_FF ? SFUD_CMD_DISABLE_QPI : SFUD_CMD_DISABLE_QPI_F5;
+    sfud_err result;
+
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+    /* on four lines, as the flash is in QPI mode */
+    result = spi->wr(spi, &cmd, 1, NULL, 0);
+    flash->qpi = false;
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+    if (result != SFUD_SUCCESS) {
+        SFUD_INFO("Error: %s QPI disable failed.", flash->name);
+    }
+
+    return result;
+}
+#endif
+
+/**
+ * make sure the QE bit the quad reads and programs of the flash need is set, set it again when a power cycle or
+ * a reset of the flash dropped a volatile one
+ *
+ * @note the OCTOSPI must be in indirect mode, the port calls it before each memory-mapped entry
+ *
+ * @param flash flash device
+ *
+ * @return result, SFUD_SUCCESS without a 1-line quad format or a known quad enable requirement;
+ *         SFUD_ERR_WRITE: the bit doesn't read back set, no quad transfer works
+ */
+sfud_err sfud_qspi_quad_check(const sfud_flash *flash) {
+    SFUD_ASSERT(flash);
+
+#ifdef SFUD_USING_SFDP
+#ifdef SFUD_USING_QSPI_QPI
+    /* the QE bit was set for the QPI mode, a power cycle which drops it drops the QPI mode as well */
+    if (flash->qpi) {
+        return SFUD_SUCCESS;
+    }
+#endif
+    /* SR2 can't be read back there, a non-volatile write per call would wear the bit */
+    if (flash->sfdp.quad_enable == SFUD_SFDP_QE_SR2_BIT1_NO_READ && !flash->sfdp.qe_vola_we_cmd) {
+        return SFUD_SUCCESS;
+    }
+    /* the status register reads of the check are 1-line commands */
+    if ((flash->read_cmd_format.data_lines == 4 && flash->read_cmd_format.instruction_lines == 1)
+            || flash->write_cmd_format.data_lines == 4) {
+        return qspi_quad_enable(flash);
+    }
+#endif
+    return SFUD_SUCCESS;
 }
 
 /**
  * Enbale the fast read mode in QSPI flash mode. Default read mode is normal SPI mode.
  *
  * it will find the appropriate fast-read instruction to replace the read instruction(0x03)
- * fast-read instruction @see SFUD_FLASH_EXT_INFO_TABLE
+ * fast-read instruction @see SFUD_FLASH_EXT_INFO_TABLE, a flash which isn't in the table gets the fast reads
+ * of its SFDP basic table, the wait states come from SFDP whenever it has the read
  *
  * @note When Flash is in QSPI mode, the method must be called after sfud_device_init().
  *
@@ -277,54 +822,264 @@ static void qspi_set_read_cmd_format(sfud_flash *flash, uint8_t ins, uint8_t ins
  */
 sfud_err sfud_qspi_fast_read_enable(sfud_flash *flash, uint8_t data_line_width) {
     size_t i = 0;
-    uint8_t read_mode = NORMAL_SPI_READ;
+    uint16_t read_mode = NORMAL_SPI_READ;
+    bool listed = false;
     sfud_err result = SFUD_SUCCESS;
 
     SFUD_ASSERT(flash);
     SFUD_ASSERT(data_line_width == 1 || data_line_width == 2 || data_line_width == 4);
 
+#ifdef SFUD_USING_QSPI_QPI
+    /* the 4-4-4 read is the quad one while the flash is in QPI mode, another width leaves the mode first */
+    if (flash->qpi) {
+        if (data_line_width == 4) {
+            return result;
+        }
+        result = qspi_qpi_exit(flash);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+    }
+#endif
+
+#ifdef SFUD_USING_PROBE_CACHE
+    sfud_probe_cache cache;
+    /* the same width was resolved on the last boot */
+    if (probe_cache_get(flash, &cache) && cache.read_data_lines == data_line_width) {
+        flash->read_cmd_format = cache.read_cmd_format;
+        flash->write_cmd_format = cache.write_cmd_format;
+        /* a volatile QE bit is gone after a power cycle, set it again; or resolve the reads again without it */
+        if (sfud_qspi_quad_check(flash) == SFUD_SUCCESS) {
+            return result;
+        }
+    }
+#endif
+
     /* get read_mode, If don't found, the default is SFUD_QSPI_NORMAL_SPI_READ */
     for (i = 0; i < sizeof(qspi_flash_ext_info_table) / sizeof(sfud_qspi_flash_ext_info); i++) {
         if ((qspi_flash_ext_info_table[i].mf_id == flash->chip.mf_id)
                 && (qspi_flash_ext_info_table[i].type_id == flash->chip.type_id)
                 && (qspi_flash_ext_info_table[i].capacity_id == flash->chip.capacity_id)) {
             read_mode = qspi_flash_ext_info_table[i].read_mode;
+            listed = true;
         }
     }
+#ifdef SFUD_USING_SFDP
+    /* an unlisted part gets the fast reads its SFDP tells, and its quad enable requirement is met */
+    if (!listed && flash->sfdp.available) {
+        read_mode = qspi_sfdp_read_mode(flash);
+    }
+    if (data_line_width == 4 && (read_mode & (QUAD_OUTPUT | QUAD_IO)) && qspi_quad_enable(flash) != SFUD_SUCCESS) {
+        read_mode = NORMAL_SPI_READ;
+    }
+#endif
+
+    /* the page program goes over four lines only where the reads do */
+    memset(&flash->write_cmd_format, 0, sizeof(flash->write_cmd_format));
+    if (data_line_width == 4) {
+        qspi_set_write_cmd_format(flash, read_mode);
+    }
 
     /* determine qspi supports which read mode and set read_cmd_format struct */
     switch (data_line_width) {
     case 1:
-        qspi_set_read_cmd_format(flash, SFUD_CMD_READ_DATA, 1, 1, 0, 1);
+        qspi_set_read_cmd_format(flash, SFUD_CMD_READ_DATA, 1, 1, 0, 1, false);
         break;
     case 2:
         if (read_mode & DUAL_IO) {
-            qspi_set_read_cmd_format(flash, SFUD_CMD_DUAL_IO_READ_DATA, 1, 2, 4, 2);
+            qspi_set_read_cmd_format(flash, SFUD_CMD_DUAL_IO_READ_DATA, 1, 2,
+                    QSPI_DUMMY_CYCLES(flash, SFUD_SFDP_READ_1_2_2, SFUD_CMD_DUAL_IO_READ_DATA, 4), 2, false);
         } else if (read_mode & DUAL_OUTPUT) {
-            qspi_set_read_cmd_format(flash, SFUD_CMD_DUAL_OUTPUT_READ_DATA, 1, 1, 8, 2);
+            qspi_set_read_cmd_format(flash, SFUD_CMD_DUAL_OUTPUT_READ_DATA, 1, 1,
+                    QSPI_DUMMY_CYCLES(flash, SFUD_SFDP_READ_1_1_2, SFUD_CMD_DUAL_OUTPUT_READ_DATA, 8), 2, false);
         } else {
-            qspi_set_read_cmd_format(flash, SFUD_CMD_READ_DATA, 1, 1, 0, 1);
+            qspi_set_read_cmd_format(flash, SFUD_CMD_READ_DATA, 1, 1, 0, 1, false);
         }
         break;
     case 4:
+#ifdef SFUD_USING_QSPI_DTR
+        if (read_mode & QUAD_IO_DTR) {
+            /* 1-4D-4D, the mode bits are not driven, so they are counted in the dummy cycles */
+            qspi_set_read_cmd_format(flash, SFUD_CMD_QUAD_IO_DTR_READ_DATA, 1, 4, 8, 4, true);
+#ifdef SFUD_USING_QSPI_CONTINUOUS_READ
+            if (read_mode & CONTINUOUS_READ) {
+                qspi_set_continuous_read(flash);
+            }
+#endif
+            break;
+        }
+#endif
         if (read_mode & QUAD_IO) {
-            qspi_set_read_cmd_format(flash, SFUD_CMD_QUAD_IO_READ_DATA, 1, 4, 6, 4);
+            qspi_set_read_cmd_format(flash, SFUD_CMD_QUAD_IO_READ_DATA, 1, 4,
+                    QSPI_DUMMY_CYCLES(flash, SFUD_SFDP_READ_1_4_4, SFUD_CMD_QUAD_IO_READ_DATA, 6), 4, false);
+#ifdef SFUD_USING_QSPI_WRAP_READ
+            /* the flash wraps every quad I/O read then, the port keeps a linear read for the rest */
+            flash->read_cmd_format.wrap = (read_mode & WRAP_READ) && flash->read_cmd_format.address_lines == 4;
+#endif
+#ifdef SFUD_USING_QSPI_CONTINUOUS_READ
+            /* the linear read of the wrapped mode sends its instruction, it would end the continuous read */
+            if ((read_mode & CONTINUOUS_READ) && !flash->read_cmd_format.wrap) {
+                qspi_set_continuous_read(flash);
+            }
+#endif
         } else if (read_mode & QUAD_OUTPUT) {
-            qspi_set_read_cmd_format(flash, SFUD_CMD_QUAD_OUTPUT_READ_DATA, 1, 1, 8, 4);
+            qspi_set_read_cmd_format(flash, SFUD_CMD_QUAD_OUTPUT_READ_DATA, 1, 1,
+                    QSPI_DUMMY_CYCLES(flash, SFUD_SFDP_READ_1_1_4, SFUD_CMD_QUAD_OUTPUT_READ_DATA, 8), 4, false);
         } else {
-            qspi_set_read_cmd_format(flash, SFUD_CMD_READ_DATA, 1, 1, 0, 1);
+            qspi_set_read_cmd_format(flash, SFUD_CMD_READ_DATA, 1, 1, 0, 1, false);
         }
         break;
     }
 
+#ifdef SFUD_USING_PROBE_CACHE
+    probe_cache_save(flash, data_line_width);
+#endif
+
     return result;
 }
-#endif /* SFUD_USING_QSPI */
 
+#ifdef SFUD_USING_QSPI_QPI
 /**
- * hardware initialize
+ * put the flash in QPI (4-4-4) mode by the enable sequence of its SFDP basic table
+ *
+ * Every command goes over the four lines from now on: the instruction, the address and the data, the status reads
+ * and the auto-polling of the programs and erases too, in indirect and memory-mapped mode. The reads take the
+ * 4-4-4 read of the table, the page program is 02h on the four lines; the wrapped and the continuous read are
+ * given up for it.
+ *
+ * @note call it after sfud_qspi_fast_read_enable(flash, 4), the OCTOSPI in indirect mode. The application and a
+ *       reset find the flash in SPI mode: sfud_qspi_qpi_disable() goes before the handoff and the resets of the
+ *       bootloader, the port sends the disable sequences at its init for the resets which skip it.
+ *
+ * @param flash flash device
+ *
+ * @return result, SFUD_ERR_NOT_FOUND: no QPI mode, or not on this flash (a part driver, the dual-quad mode, the
+ *         4-Byte address instructions); SFUD_ERR_WRITE: the flash didn't take it, it's left in SPI mode
  */
-static sfud_err hardware_init(sfud_flash *flash) {
+sfud_err sfud_qspi_qpi_enable(sfud_flash *flash) {
+    const sfud_spi *spi = &flash->spi;
+    sfud_qspi_read_cmd_format *format = &flash->read_cmd_format;
+    uint8_t enable = flash->sfdp.qpi_enable, read_cmd = flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].cmd;
+    uint8_t mode_cycles = flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].mode_cycles, cmd, status = 0xFF;
+    sfud_err result;
+
+    SFUD_ASSERT(flash);
+
+    if (flash->qpi) {
+        return SFUD_SUCCESS;
+    }
+    /* the quad read is in force, its QE bit set; the 4-4-4 read of the table has a 3-Byte address instruction */
+    if (!flash->sfdp.available || !enable || !flash->sfdp.qpi_disable || !read_cmd || !spi->xfer
+            || format->data_lines != 4 || flash->addr_4_byte_inst
+#ifdef SFUD_USING_QSPI_DUALQUAD
+            || flash->dual_quad
+#endif
+#ifdef SFUD_USING_PART_DRIVER
+            || flash->part
+#endif
+            ) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+
+    cmd = enable & (SFUD_SFDP_QPI_ENABLE_QE_38 | SFUD_SFDP_QPI_ENABLE_38) ? SFUD_CMD_ENABLE_QPI : SFUD_CMD_ENABLE_QPI_35;
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+    result = spi->wr(spi, &cmd, 1, NULL, 0);
+    if (result == SFUD_SUCCESS) {
+        flash->qpi = true;
+        /* a part still in SPI mode sees two clocks of the status read and drives nothing, nothing is running now */
+        result = sfud_read_status(flash, &status);
+        if (result == SFUD_SUCCESS && (status & (SFUD_STATUS_REGISTER_BUSY | SFUD_STATUS_REGISTER_WEL))) {
+            result = SFUD_ERR_WRITE;
+        }
+    }
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+    if (result != SFUD_SUCCESS) {
+        if (flash->qpi) {
+            qspi_qpi_exit(flash);
+        }
+        SFUD_INFO("Error: %s QPI enable failed, status 0x%02X.", flash->name, status);
+        return SFUD_ERR_WRITE;
+    }
+
+    format->instruction = read_cmd;
+    format->instruction_lines = 4;
+    format->address_size = flash->addr_in_4_byte ? 32 : 24;
+    format->address_lines = 4;
+    format->alternate_bytes_lines = 0;
+    format->dummy_cycles = flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].dummy_cycles + mode_cycles;
+    if (mode_cycles == 2) {
+        /* 8 mode bits are the alternate bytes 0xFF, the lines left floating could start the continuous read */
+        format->alternate_bytes_lines = 4;
+        format->dummy_cycles -= mode_cycles;
+    }
+    format->data_lines = 4;
+    format->dtr = false;
+    format->continuous = false;
+    format->wrap = false;
+    flash->write_cmd_format.instruction = SFUD_CMD_PAGE_PROGRAM;
+    flash->write_cmd_format.address_lines = 4;
+    flash->write_cmd_format.data_lines = 4;
+    SFUD_DEBUG("%s is in QPI mode, 4-4-4 read 0x%02X with %d dummy clocks.", flash->name, read_cmd,
+               format->dummy_cycles);
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * leave the QPI mode of sfud_qspi_qpi_enable(), the quad read of sfud_qspi_fast_read_enable(flash, 4) is back
+ *
+ * @note the OCTOSPI must be in indirect mode
+ *
+ * @param flash flash device
+ *
+ * @return result, SFUD_SUCCESS when the flash isn't in QPI mode
+ */
+sfud_err sfud_qspi_qpi_disable(sfud_flash *flash) {
+    sfud_err result;
+
+    SFUD_ASSERT(flash);
+
+    if (!flash->qpi) {
+        return SFUD_SUCCESS;
+    }
+    result = qspi_qpi_exit(flash);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    return sfud_qspi_fast_read_enable(flash, 4);
+}
+#endif /* SFUD_USING_QSPI_QPI */
+#endif /* SFUD_USING_QSPI */
+
+#ifdef SFUD_USING_QSPI_DUALQUAD
+/**
+ * the geometry of a dual-quad flash from the one of a part, each part holds every other byte
+ *
+ * The capacity and the erase units double: an erase sends half its address to both parts, each one erases its unit
+ * holding it. The page program stays at 256 bytes, 128 to each part in one of its pages.
+ */
+static void dual_quad_geometry(sfud_flash *flash) {
+    flash->chip.capacity *= 2;
+    flash->chip.erase_gran *= 2;
+#ifdef SFUD_USING_SFDP
+    flash->sfdp.capacity *= 2;
+    for (size_t i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        flash->sfdp.eraser[i].size *= 2;
+    }
+#endif
+}
+#endif /* SFUD_USING_QSPI_DUALQUAD */
+
+/**
+ * hardware initialize
+ */
+static sfud_err hardware_init(sfud_flash *flash) {
     extern sfud_err sfud_spi_port_init(sfud_flash *flash);
 
     sfud_err result = SFUD_SUCCESS;
@@ -353,6 +1108,11 @@ static sfud_err hardware_init(sfud_flash *flash) {
             return result;
         }
 
+#ifdef SFUD_USING_PROBE_CACHE
+        /* the JEDEC ID is the same as the last boot, skip the discovery */
+        if (!probe_cache_load(flash)) {
+#endif
+
 #ifdef SFUD_USING_SFDP
         extern bool sfud_read_sfdp(sfud_flash *flash);
         /* read SFDP parameters */
@@ -397,6 +1157,17 @@ static sfud_err hardware_init(sfud_flash *flash) {
         }
 #endif
 
+#ifdef SFUD_USING_QSPI_DUALQUAD
+            /* the reads of the port gave the parameters of one part, the cache keeps the ones of both */
+            if (flash->dual_quad) {
+                dual_quad_geometry(flash);
+            }
+#endif
+
+#ifdef SFUD_USING_PROBE_CACHE
+            probe_cache_save(flash, 0);
+        }
+#endif
     }
 
     if (flash->chip.capacity == 0 || flash->chip.write_mode == 0 || flash->chip.erase_gran == 0
@@ -445,9 +1216,16 @@ static sfud_err hardware_init(sfud_flash *flash) {
         return result;
     }
 
-    /* if the flash is large than 16MB (256Mb) then enter in 4-Byte addressing mode */
+    /* if the flash is large than 16MB (256Mb) then use the 4-Byte address instructions or enter in 4-Byte addressing mode */
+    flash->addr_4_byte_inst = false;
     if (flash->chip.capacity > (1L << 24)) {
-        result = set_4_byte_address_mode(flash, true);
+        if (addr_4_byte_inst_available(flash)) {
+            flash->addr_in_4_byte = true;
+            flash->addr_4_byte_inst = true;
+            SFUD_DEBUG("Use the 4-Byte address instructions.");
+        } else {
+            result = set_4_byte_address_mode(flash, true);
+        }
     } else {
         flash->addr_in_4_byte = false;
     }
@@ -471,140 +1249,277 @@ static sfud_err software_init(const sfud_flash *flash) {
 }
 
 /**
- * read flash data
+ * make the SPI read command
  *
  * @param flash flash device
  * @param addr start address
- * @param size read size
- * @param data read data pointer
+ * @param cmd_data command, 5 + SFUD_READ_DUMMY_BYTE_CNT bytes at most
  *
- * @return result
+ * @return command size
  */
-sfud_err sfud_read(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data) {
-    sfud_err result = SFUD_SUCCESS;
-    const sfud_spi *spi = &flash->spi;
-    uint8_t cmd_data[5 + SFUD_READ_DUMMY_BYTE_CNT];
+static uint8_t read_cmd_make(const sfud_flash *flash, uint32_t addr, uint8_t *cmd_data) {
     uint8_t cmd_size;
     uint8_t i;
 
-    SFUD_ASSERT(flash);
-    SFUD_ASSERT(data);
-    /* must be call this function after initialize OK */
-    SFUD_ASSERT(flash->init_ok);
-    /* check the flash address bound */
-    if (addr + size > flash->chip.capacity) {
-        SFUD_INFO("Error: Flash address is out of bound.");
-        return SFUD_ERR_ADDR_OUT_OF_BOUND;
-    }
-    /* lock SPI */
-    if (spi->lock) {
-        spi->lock(spi);
+#ifdef SFUD_USING_FAST_READ
+    cmd_data[0] = addr_4_byte_cmd(flash, SFUD_CMD_FAST_READ_DATA);
+#else
+    cmd_data[0] = addr_4_byte_cmd(flash, SFUD_CMD_READ_DATA);
+#endif
+    make_address_byte_array(flash, addr, &cmd_data[1]);
+    cmd_size = flash->addr_in_4_byte ? 5 : 4;
+    for (i = 0; i < SFUD_READ_DUMMY_BYTE_CNT; i++) {
+        cmd_data[cmd_size] = SFUD_DUMMY_DATA;
+        cmd_size++;
     }
 
-    result = wait_busy(flash);
+    return cmd_size;
+}
+
+/**
+ * read flash data, the SPI is locked and the flash is idle
+ */
+static sfud_err read_idle(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data) {
+    const sfud_spi *spi = &flash->spi;
+    uint8_t cmd_data[5 + SFUD_READ_DUMMY_BYTE_CNT];
+    uint8_t cmd_size;
 
-    if (result == SFUD_SUCCESS) {
 #ifdef SFUD_USING_QSPI
-        if (flash->read_cmd_format.instruction != SFUD_CMD_READ_DATA) {
-            result = spi->qspi_read(spi, addr, (sfud_qspi_read_cmd_format *)&flash->read_cmd_format, data, size);
-        } else
+    if (flash->read_cmd_format.instruction != SFUD_CMD_READ_DATA) {
+        return stats_bus(flash, spi->qspi_read(spi, addr, (sfud_qspi_read_cmd_format *)&flash->read_cmd_format,
+                                               data, size));
+    }
 #endif
-        {
+    if (spi->xfer) {
+        sfud_spi_xfer xfer;
+
 #ifdef SFUD_USING_FAST_READ
-            cmd_data[0] = SFUD_CMD_FAST_READ_DATA;
+        xfer_make(flash, &xfer, SFUD_CMD_FAST_READ_DATA, addr);
 #else
-            cmd_data[0] = SFUD_CMD_READ_DATA;
+        xfer_make(flash, &xfer, SFUD_CMD_READ_DATA, addr);
 #endif
-            make_address_byte_array(flash, addr, &cmd_data[1]);
-            cmd_size = flash->addr_in_4_byte ? 5 : 4;
-            for (i = 0; i < SFUD_READ_DUMMY_BYTE_CNT; i++) {
-                cmd_data[cmd_size] = SFUD_DUMMY_DATA;
-                cmd_size++;
-            }
-            result = spi->wr(spi, cmd_data, cmd_size, data, size);
-        }
+        xfer.dummy_size = SFUD_READ_DUMMY_BYTE_CNT;
+        xfer.read_buf = data;
+        xfer.data_size = size;
+        return stats_bus(flash, spi->xfer(spi, &xfer));
     }
-    /* unlock SPI */
-    if (spi->unlock) {
-        spi->unlock(spi);
+    cmd_size = read_cmd_make(flash, addr, cmd_data);
+    return stats_bus(flash, spi->wr(spi, cmd_data, cmd_size, data, size));
+}
+
+/**
+ * read flash data, the SPI is locked
+ */
+static sfud_err read_data(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data) {
+    sfud_err result = wait_idle(flash);
+
+    if (result == SFUD_SUCCESS) {
+        result = read_idle(flash, addr, size, data);
     }
 
     return result;
 }
 
+#ifdef SFUD_USING_READ_CACHE
 /**
- * erase all flash data
- *
- * @param flash flash device
- *
- * @return result
+ * read flash data through the read cache, a missing line is filled in place of the least recently used one,
+ * the SPI is locked
  */
-sfud_err sfud_chip_erase(const sfud_flash *flash) {
+static sfud_err read_cache_read(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data) {
     sfud_err result = SFUD_SUCCESS;
-    const sfud_spi *spi = &flash->spi;
-    uint8_t cmd_data[4];
+    read_cache_line *line;
+    uint32_t line_addr;
+    size_t i, offset, len;
+
+    while (result == SFUD_SUCCESS && size) {
+        line_addr = addr - addr % SFUD_READ_CACHE_LINE_SIZE;
+        line = NULL;
+        for (i = 0; i < SFUD_READ_CACHE_LINES; i++) {
+            if (read_cache[i].flash == flash && read_cache[i].addr == line_addr) {
+                line = &read_cache[i];
+                break;
+            }
+        }
+        if (!line) {
+            /* the empty lines have the least clock */
+            line = &read_cache[0];
+            for (i = 1; i < SFUD_READ_CACHE_LINES && line->flash; i++) {
+                if (!read_cache[i].flash || read_cache[i].used < line->used) {
+                    line = &read_cache[i];
+                }
+            }
+            line->flash = NULL;
+            result = read_data(flash, line_addr, SFUD_READ_CACHE_LINE_SIZE, line->data);
+            if (result != SFUD_SUCCESS) {
+                break;
+            }
+            line->flash = flash;
+            line->addr = line_addr;
+        }
+        line->used = ++read_cache_clock;
 
-    SFUD_ASSERT(flash);
-    /* must be call this function after initialize OK */
-    SFUD_ASSERT(flash->init_ok);
-    /* lock SPI */
-    if (spi->lock) {
-        spi->lock(spi);
+        offset = addr - line_addr;
+        len = SFUD_READ_CACHE_LINE_SIZE - offset > size ? size : SFUD_READ_CACHE_LINE_SIZE - offset;
+        memcpy(data, line->data + offset, len);
+        addr += len;
+        size -= len;
+        data += len;
     }
 
-    /* set the flash write enable */
-    result = set_write_enabled(flash, true);
-    if (result != SFUD_SUCCESS) {
-        goto __exit;
+    return result;
+}
+
+/**
+ * copy a range out of the read cache when one line holds all of it
+ *
+ * @return true: copied
+ */
+static bool read_cache_hit(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data) {
+    uint32_t line_addr = addr - addr % SFUD_READ_CACHE_LINE_SIZE;
+    size_t i;
+
+    if (addr + size > line_addr + SFUD_READ_CACHE_LINE_SIZE) {
+        return false;
+    }
+    for (i = 0; i < SFUD_READ_CACHE_LINES; i++) {
+        if (read_cache[i].flash == flash && read_cache[i].addr == line_addr) {
+            read_cache[i].used = ++read_cache_clock;
+            memcpy(data, read_cache[i].data + (addr - line_addr), size);
+            return true;
+        }
     }
 
-    cmd_data[0] = SFUD_CMD_ERASE_CHIP;
-    /* dual-buffer write, like AT45DB series flash chip erase operate is different for other flash */
-    if (flash->chip.write_mode & SFUD_WM_DUAL_BUFFER) {
-        cmd_data[1] = 0x94;
-        cmd_data[2] = 0x80;
-        cmd_data[3] = 0x9A;
-        result = spi->wr(spi, cmd_data, 4, NULL, 0);
-    } else {
-        result = spi->wr(spi, cmd_data, 1, NULL, 0);
+    return false;
+}
+
+/**
+ * drop the read cache lines of a range, after its content changes
+ */
+static void read_cache_drop(const sfud_flash *flash, uint32_t addr, size_t size) {
+    size_t i;
+
+    for (i = 0; i < SFUD_READ_CACHE_LINES; i++) {
+        if (read_cache[i].flash == flash && read_cache[i].addr < addr + size
+                && read_cache[i].addr + SFUD_READ_CACHE_LINE_SIZE > addr) {
+            read_cache[i].flash = NULL;
+        }
     }
-    if (result != SFUD_SUCCESS) {
-        SFUD_INFO("Error: Flash chip erase SPI communicate error.");
-        goto __exit;
+}
+#endif /* SFUD_USING_READ_CACHE */
+
+#ifdef SFUD_USING_BLANK_CHECK
+/**
+ * the known blank map of a flash of SFUD_BLANK_CHECK_FLASHES
+ *
+ * @return NULL: the flash isn't blank checked
+ */
+static uint32_t *blank_map_get(const sfud_flash *flash) {
+    if (flash->index >= BLANK_DEVICE_NUM || &flash_table[flash->index] != flash
+            || !(SFUD_BLANK_CHECK_FLASHES & (1UL << flash->index)) || flash->chip.erase_gran == 0) {
+        return NULL;
     }
-    result = wait_busy(flash);
+    return blank_map[flash->index];
+}
 
-    __exit:
-    /* set the flash write disable */
-    set_write_enabled(flash, false);
-    /* unlock SPI */
-    if (spi->unlock) {
-        spi->unlock(spi);
+/**
+ * note the units of a range known blank after their erase, or no longer known blank once a write goes to them
+ */
+static void blank_map_mark(const sfud_flash *flash, uint32_t addr, size_t size, bool blank) {
+    uint32_t *map = blank_map_get(flash);
+    uint32_t i, end;
+
+    if (!map || size == 0) {
+        return;
+    }
+    i = addr / flash->chip.erase_gran;
+    end = (uint32_t) ((addr + size - 1) / flash->chip.erase_gran + 1);
+    for (; i < end && i < SFUD_BLANK_MAP_UNITS; i++) {
+        if (blank) {
+            map[i / 32] |= 1UL << (i % 32);
+        } else {
+            map[i / 32] &= ~(1UL << (i % 32));
+        }
     }
+}
 
-    return result;
+/**
+ * all 64-bit words of a range are 0xFF, it stops at the first one which isn't
+ */
+static bool blank_words(const uint64_t *p, size_t num) {
+    for (; num >= 4; num -= 4, p += 4) {
+        if ((p[0] & p[1] & p[2] & p[3]) != UINT64_MAX) {
+            return false;
+        }
+    }
+    for (; num; num--, p++) {
+        if (*p != UINT64_MAX) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /**
- * erase flash data
+ * the erase unit holding an address reads blank, the SPI is locked
  *
- * @note It will erase align by erase granularity.
+ * A unit known blank isn't read. The others are read in place through the memory-mapped window when the port gives
+ * one (the XIP write path leaves the flash idle), by the reads of the port otherwise, they wait for it.
+ *
+ * @return true: blank, the unit is noted known blank; false: programmed, a read error or not blank checked
+ */
+static bool blank_unit(const sfud_flash *flash, uint32_t addr) {
+    static uint64_t blank_buf[BLANK_READ_SIZE / sizeof(uint64_t)] __attribute__((aligned(32)));
+    const uint32_t *map = blank_map_get(flash);
+    uint32_t unit, index, offset;
+    const void *mapped;
+    size_t len;
+
+    if (!map) {
+        return false;
+    }
+    unit = flash->chip.erase_gran;
+    addr -= addr % unit;
+    index = addr / unit;
+    if (index < SFUD_BLANK_MAP_UNITS && (map[index / 32] & (1UL << (index % 32)))) {
+        return true;
+    }
+    mapped = sfud_port_mapped(flash, addr, unit);
+    if (mapped) {
+        if (!blank_words((const uint64_t *) mapped, unit / sizeof(uint64_t))) {
+            return false;
+        }
+    } else {
+        for (offset = 0; offset < unit; offset += len) {
+            len = unit - offset < BLANK_READ_SIZE ? unit - offset : BLANK_READ_SIZE;
+            if (read_data(flash, addr + offset, len, (uint8_t *) blank_buf) != SFUD_SUCCESS
+                    || !blank_words(blank_buf, len / sizeof(uint64_t))) {
+                return false;
+            }
+        }
+    }
+    blank_map_mark(flash, addr, unit, true);
+
+    return true;
+}
+#endif /* SFUD_USING_BLANK_CHECK */
+
+/**
+ * read flash data
  *
  * @param flash flash device
  * @param addr start address
- * @param size erase size
+ * @param size read size
+ * @param data read data pointer
  *
  * @return result
  */
-sfud_err sfud_erase(const sfud_flash *flash, uint32_t addr, size_t size) {
-    extern size_t sfud_sfdp_get_suitable_eraser(const sfud_flash *flash, uint32_t addr, size_t erase_size);
-
+sfud_err sfud_read(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data) {
     sfud_err result = SFUD_SUCCESS;
     const sfud_spi *spi = &flash->spi;
-    uint8_t cmd_data[5], cmd_size, cur_erase_cmd;
-    size_t cur_erase_size;
+    uint32_t start;
 
     SFUD_ASSERT(flash);
+    SFUD_ASSERT(data);
     /* must be call this function after initialize OK */
     SFUD_ASSERT(flash->init_ok);
     /* check the flash address bound */
@@ -612,159 +1527,173 @@ sfud_err sfud_erase(const sfud_flash *flash, uint32_t addr, size_t size) {
         SFUD_INFO("Error: Flash address is out of bound.");
         return SFUD_ERR_ADDR_OUT_OF_BOUND;
     }
-
-    if (addr == 0 && size == flash->chip.capacity) {
-        return sfud_chip_erase(flash);
+#ifdef SFUD_USING_WRITE_BUFFER
+    /* a pending write of the range goes first, the read sees it */
+    result = write_buffer_flush(flash, addr, size);
+    if (result != SFUD_SUCCESS) {
+        return result;
     }
-
+#endif
+    start = stats_begin(flash, SFUD_STATS_READ);
     /* lock SPI */
     if (spi->lock) {
         spi->lock(spi);
     }
 
-    /* loop erase operate. erase unit is erase granularity */
-    while (size) {
-        /* if this flash is support SFDP parameter, then used SFDP parameter supplies eraser */
-#ifdef SFUD_USING_SFDP
-        size_t eraser_index;
-        if (flash->sfdp.available) {
-            /* get the suitable eraser for erase process from SFDP parameter */
-            eraser_index = sfud_sfdp_get_suitable_eraser(flash, addr, size);
-            cur_erase_cmd = flash->sfdp.eraser[eraser_index].cmd;
-            cur_erase_size = flash->sfdp.eraser[eraser_index].size;
-        } else {
-#else
-            {
+#ifdef SFUD_USING_READ_CACHE
+    /* the small reads only, a large one would evict all the lines */
+    if ((SFUD_READ_CACHE_FLASHES & (1UL << flash->index)) && size < SFUD_READ_CACHE_LINE_SIZE) {
+        result = read_cache_read(flash, addr, size, data);
+    } else
 #endif
-            cur_erase_cmd = flash->chip.erase_gran_cmd;
-            cur_erase_size = flash->chip.erase_gran;
-        }
-        /* set the flash write enable */
-        result = set_write_enabled(flash, true);
-        if (result != SFUD_SUCCESS) {
-            goto __exit;
-        }
-
-        cmd_data[0] = cur_erase_cmd;
-        make_address_byte_array(flash, addr, &cmd_data[1]);
-        cmd_size = flash->addr_in_4_byte ? 5 : 4;
-        result = spi->wr(spi, cmd_data, cmd_size, NULL, 0);
-        if (result != SFUD_SUCCESS) {
-            SFUD_INFO("Error: Flash erase SPI communicate error.");
-            goto __exit;
-        }
-        result = wait_busy(flash);
-        if (result != SFUD_SUCCESS) {
-            goto __exit;
-        }
-        /* make erase align and calculate next erase address */
-        if (addr % cur_erase_size != 0) {
-            if (size > cur_erase_size - (addr % cur_erase_size)) {
-                size -= cur_erase_size - (addr % cur_erase_size);
-                addr += cur_erase_size - (addr % cur_erase_size);
-            } else {
-                goto __exit;
-            }
-        } else {
-            if (size > cur_erase_size) {
-                size -= cur_erase_size;
-                addr += cur_erase_size;
-            } else {
-                goto __exit;
+    {
+#ifdef SFUD_USING_PART_DRIVER
+        const sfud_part *part = part_get(flash);
+
+        if (part) {
+            result = wait_idle(flash);
+            if (result == SFUD_SUCCESS) {
+                result = part->read(flash, addr, size, data);
             }
-        }
+        } else
+#endif
+        result = read_data(flash, addr, size, data);
     }
-
-    __exit:
-    /* set the flash write disable */
-    set_write_enabled(flash, false);
     /* unlock SPI */
     if (spi->unlock) {
         spi->unlock(spi);
     }
+    stats_end(flash, SFUD_STATS_READ, start, size);
 
     return result;
 }
 
-/**
- * write flash data (no erase operate) for write 1 to 256 bytes per page mode or byte write mode
- *
- * @param flash flash device
- * @param addr start address
- * @param size write size
- * @param write_gran write granularity bytes, only support 1 or 256
- * @param data write data
- *
- * @return result
- */
-static sfud_err page256_or_1_byte_write(const sfud_flash *flash, uint32_t addr, size_t size, uint16_t write_gran,
-                                        const uint8_t *data) {
+sfud_err sfud_read_multi(const sfud_flash *flash, const sfud_iovec *ranges, size_t n) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    uint32_t start, addr;
+    size_t i, j, size, total = 0;
+    uint8_t *data;
+
+    SFUD_ASSERT(flash);
+    SFUD_ASSERT(ranges || n == 0);
+    /* must be call this function after initialize OK */
+    SFUD_ASSERT(flash->init_ok);
+    for (i = 0; i < n; i++) {
+        SFUD_ASSERT(ranges[i].data || ranges[i].size == 0);
+        /* check the flash address bound */
+        if (ranges[i].addr + ranges[i].size > flash->chip.capacity) {
+            SFUD_INFO("Error: Flash address is out of bound.");
+            return SFUD_ERR_ADDR_OUT_OF_BOUND;
+        }
+#ifdef SFUD_USING_WRITE_BUFFER
+        result = write_buffer_flush(flash, ranges[i].addr, ranges[i].size);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+#endif
+        total += ranges[i].size;
+    }
+    start = stats_begin(flash, SFUD_STATS_READ);
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+
+    /* the reads don't make the flash busy, one check does for all */
+    result = wait_idle(flash);
+    for (i = 0; result == SFUD_SUCCESS && i < n; i = j) {
+        addr = ranges[i].addr;
+        size = ranges[i].size;
+        data = ranges[i].data;
+        for (j = i + 1; j < n && ranges[j].addr == addr + size && ranges[j].data == data + size; j++) {
+            size += ranges[j].size;
+        }
+        if (size == 0) {
+            continue;
+        }
+#ifdef SFUD_USING_READ_CACHE
+        if ((SFUD_READ_CACHE_FLASHES & (1UL << flash->index)) && read_cache_hit(flash, addr, size, data)) {
+            continue;
+        }
+#endif
+        result = read_idle(flash, addr, size, data);
+    }
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+    stats_end(flash, SFUD_STATS_READ, start, total);
+
+    return result;
+}
+
+sfud_err sfud_read_async(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *data) {
     sfud_err result = SFUD_SUCCESS;
     const sfud_spi *spi = &flash->spi;
-    static uint8_t cmd_data[5 + SFUD_WRITE_MAX_PAGE_SIZE];
+    uint8_t cmd_data[5 + SFUD_READ_DUMMY_BYTE_CNT];
     uint8_t cmd_size;
-    size_t data_size;
+    uint32_t start;
 
     SFUD_ASSERT(flash);
-    /* only support 1 or 256 */
-    SFUD_ASSERT(write_gran == 1 || write_gran == 256);
+    SFUD_ASSERT(data);
     /* must be call this function after initialize OK */
     SFUD_ASSERT(flash->init_ok);
+
+    if (!spi->wr_async || !spi->wr_async_wait
+#ifdef SFUD_USING_QSPI
+            || flash->read_cmd_format.instruction != SFUD_CMD_READ_DATA
+#endif
+            ) {
+        return sfud_read(flash, addr, size, data);
+    }
     /* check the flash address bound */
     if (addr + size > flash->chip.capacity) {
         SFUD_INFO("Error: Flash address is out of bound.");
         return SFUD_ERR_ADDR_OUT_OF_BOUND;
     }
-    /* lock SPI */
+#ifdef SFUD_USING_WRITE_BUFFER
+    result = write_buffer_flush(flash, addr, size);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+#endif
+    /* the start only, the transfer goes on in the background */
+    start = stats_begin(flash, SFUD_STATS_READ);
+    /* lock SPI, till the read is waited */
     if (spi->lock) {
         spi->lock(spi);
     }
 
-    /* loop write operate. write unit is write granularity */
-    while (size) {
-        /* set the flash write enable */
-        result = set_write_enabled(flash, true);
-        if (result != SFUD_SUCCESS) {
-            goto __exit;
-        }
-        cmd_data[0] = SFUD_CMD_PAGE_PROGRAM;
-        make_address_byte_array(flash, addr, &cmd_data[1]);
-        cmd_size = flash->addr_in_4_byte ? 5 : 4;
+    result = wait_idle(flash);
 
-        /* make write align and calculate next write address */
-        if (addr % write_gran != 0) {
-            if (size > write_gran - (addr % write_gran)) {
-                data_size = write_gran - (addr % write_gran);
-            } else {
-                data_size = size;
-            }
-        } else {
-            if (size > write_gran) {
-                data_size = write_gran;
-            } else {
-                data_size = size;
-            }
-        }
-        size -= data_size;
-        addr += data_size;
+    if (result == SFUD_SUCCESS) {
+        cmd_size = read_cmd_make(flash, addr, cmd_data);
+        result = stats_bus(flash, spi->wr_async(spi, cmd_data, cmd_size, data, size));
+    }
+    if (result != SFUD_SUCCESS && spi->unlock) {
+        spi->unlock(spi);
+    }
+    stats_end(flash, SFUD_STATS_READ, start, size);
 
-        memcpy(&cmd_data[cmd_size], data, data_size);
+    return result;
+}
 
-        result = spi->wr(spi, cmd_data, cmd_size + data_size, NULL, 0);
-        if (result != SFUD_SUCCESS) {
-            SFUD_INFO("Error: Flash write SPI communicate error.");
-            goto __exit;
-        }
-        result = wait_busy(flash);
-        if (result != SFUD_SUCCESS) {
-            goto __exit;
-        }
-        data += data_size;
+sfud_err sfud_read_async_wait(const sfud_flash *flash) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+
+    SFUD_ASSERT(flash);
+
+    if (!spi->wr_async || !spi->wr_async_wait
+#ifdef SFUD_USING_QSPI
+            || flash->read_cmd_format.instruction != SFUD_CMD_READ_DATA
+#endif
+            ) {
+        return SFUD_SUCCESS;
     }
 
-    __exit:
-    /* set the flash write disable */
-    set_write_enabled(flash, false);
+    result = spi->wr_async_wait(spi);
     /* unlock SPI */
     if (spi->unlock) {
         spi->unlock(spi);
@@ -774,363 +1703,2041 @@ static sfud_err page256_or_1_byte_write(const sfud_flash *flash, uint32_t addr,
 }
 
 /**
- * write flash data (no erase operate) for auto address increment mode
- *
- * If the address is odd number, it will place one 0xFF before the start of data for protect the old data.
- * If the latest remain size is 1, it will append one 0xFF at the end of data for protect the old data.
+ * erase all flash data
  *
  * @param flash flash device
- * @param addr start address
- * @param size write size
- * @param data write data
  *
  * @return result
  */
-static sfud_err aai_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+sfud_err sfud_chip_erase(const sfud_flash *flash) {
     sfud_err result = SFUD_SUCCESS;
     const sfud_spi *spi = &flash->spi;
-    uint8_t cmd_data[8], cmd_size;
-    bool first_write = true;
+    uint8_t cmd_data[4];
+    uint32_t start;
 
     SFUD_ASSERT(flash);
+    /* must be call this function after initialize OK */
     SFUD_ASSERT(flash->init_ok);
-    /* check the flash address bound */
-    if (addr + size > flash->chip.capacity) {
-        SFUD_INFO("Error: Flash address is out of bound.");
-        return SFUD_ERR_ADDR_OUT_OF_BOUND;
-    }
+#ifdef SFUD_USING_READ_CACHE
+    read_cache_drop(flash, 0, flash->chip.capacity);
+#endif
+#ifdef SFUD_USING_WRITE_BUFFER
+    write_buffer_drop(flash, 0, flash->chip.capacity);
+#endif
+    start = stats_begin(flash, SFUD_STATS_ERASE);
     /* lock SPI */
     if (spi->lock) {
         spi->lock(spi);
     }
-    /* The address must be even for AAI write mode. So it must write one byte first when address is odd. */
-    if (addr % 2 != 0) {
-        result = page256_or_1_byte_write(flash, addr++, 1, 1, data++);
-        if (result != SFUD_SUCCESS) {
-            goto __exit;
-        }
-        size--;
-    }
+
     /* set the flash write enable */
     result = set_write_enabled(flash, true);
     if (result != SFUD_SUCCESS) {
         goto __exit;
     }
-    /* loop write operate. */
-    cmd_data[0] = SFUD_CMD_AAI_WORD_PROGRAM;
-    while (size >= 2) {
-        if (first_write) {
-            make_address_byte_array(flash, addr, &cmd_data[1]);
-            cmd_size = flash->addr_in_4_byte ? 5 : 4;
-            cmd_data[cmd_size] = *data;
-            cmd_data[cmd_size + 1] = *(data + 1);
-            first_write = false;
+
+    cmd_data[0] = SFUD_CMD_ERASE_CHIP;
+    /* dual-buffer write, like AT45DB series flash chip erase operate is different for other flash */
+    if (flash->chip.write_mode & SFUD_WM_DUAL_BUFFER) {
+        cmd_data[1] = 0x94;
+        cmd_data[2] = 0x80;
+        cmd_data[3] = 0x9A;
+        result = stats_bus(flash, spi->wr(spi, cmd_data, 4, NULL, 0));
+    } else {
+        result = stats_bus(flash, spi->wr(spi, cmd_data, 1, NULL, 0));
+    }
+    if (result != SFUD_SUCCESS) {
+        SFUD_INFO("Error: Flash chip erase SPI communicate error.");
+        goto __exit;
+    }
+#ifdef SFUD_USING_SFDP
+    /* the SFDP chip erase times are in ms */
+    result = wait_busy_timed(flash, flash->sfdp.chip_erase_time_typ < UINT32_MAX / 1000 ?
+            flash->sfdp.chip_erase_time_typ * 1000 : UINT32_MAX, flash->sfdp.chip_erase_time_max < UINT32_MAX / 1000 ?
+            flash->sfdp.chip_erase_time_max * 1000 : UINT32_MAX);
+#else
+    result = wait_busy(flash);
+#endif
+
+    __exit:
+    /* set the flash write disable */
+    set_write_enabled(flash, false);
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+    stats_end(flash, SFUD_STATS_ERASE, start, flash->chip.capacity);
+#ifdef SFUD_USING_BLANK_CHECK
+    /* a failed chip erase leaves nothing known */
+    blank_map_mark(flash, 0, flash->chip.capacity, result == SFUD_SUCCESS);
+#endif
+
+    return result;
+}
+
+/**
+ * plan the erase of a range
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size erase size
+ * @param runs plan output
+ *
+ * @return number of runs
+ */
+size_t sfud_erase_plan(const sfud_flash *flash, uint32_t addr, size_t size,
+                       sfud_erase_run runs[SFUD_ERASE_PLAN_MAX_RUNS]) {
+    uint32_t end = addr + size;
+    size_t run_num = 0;
+    uint8_t cmd;
+    size_t erase_size;
+
+    SFUD_ASSERT(flash);
+    SFUD_ASSERT(runs);
+
+    if (size == 0 || end > flash->chip.capacity) {
+        return 0;
+    }
+    if (addr == 0 && size == flash->chip.capacity) {
+        runs[0].cmd = SFUD_CMD_ERASE_CHIP;
+        runs[0].addr = 0;
+        runs[0].size = flash->chip.capacity;
+        runs[0].count = 1;
+        return 1;
+    }
+
+    /* an unaligned start gets the smallest eraser, the erase begins at its unit then */
+    eraser_get(flash, addr, size, &cmd, &erase_size);
+    addr -= addr % erase_size;
+    /* the eraser fits the alignment of the address, so the sizes go up to the largest and down again */
+    while (addr < end) {
+        eraser_get(flash, addr, end - addr, &cmd, &erase_size);
+        if (run_num && runs[run_num - 1].cmd == cmd) {
+            runs[run_num - 1].count++;
         } else {
-            cmd_size = 1;
-            cmd_data[1] = *data;
-            cmd_data[2] = *(data + 1);
+            SFUD_ASSERT(run_num < SFUD_ERASE_PLAN_MAX_RUNS);
+            runs[run_num].cmd = cmd;
+            runs[run_num].addr = addr;
+            runs[run_num].size = erase_size;
+            runs[run_num].count = 1;
+            run_num++;
         }
+        addr += erase_size;
+    }
 
-        result = spi->wr(spi, cmd_data, cmd_size + 2, NULL, 0);
-        if (result != SFUD_SUCCESS) {
-            SFUD_INFO("Error: Flash write SPI communicate error.");
-            goto __exit;
-        }
+    return run_num;
+}
 
-        result = wait_busy(flash);
-        if (result != SFUD_SUCCESS) {
-            goto __exit;
-        }
+#if defined(SFUD_USING_READ_CACHE) || defined(SFUD_USING_WRITE_BUFFER)
+/**
+ * the end of the range an erase plan covers, the plan rounds the requested one out to whole erase units
+ */
+static uint32_t erase_plan_end(const sfud_erase_run *runs, size_t run_num) {
+    return runs[run_num - 1].addr + runs[run_num - 1].count * runs[run_num - 1].size;
+}
+#endif
 
-        size -= 2;
-        addr += 2;
-        data += 2;
+/**
+ * erase a range by its erase plan
+ */
+static sfud_err erase_range(const sfud_flash *flash, uint32_t addr, size_t size) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    sfud_erase_run runs[SFUD_ERASE_PLAN_MAX_RUNS];
+    sfud_spi_xfer xfer;
+    size_t run_num, i, j;
+    uint32_t start, time_typ, time_max;
+#ifdef SFUD_USING_PART_DRIVER
+    const sfud_part *part;
+#endif
+
+    SFUD_ASSERT(flash);
+    /* must be call this function after initialize OK */
+    SFUD_ASSERT(flash->init_ok);
+    /* check the flash address bound */
+    if (addr + size > flash->chip.capacity) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
     }
-    /* set the flash write disable for exit AAI mode */
-    result = set_write_enabled(flash, false);
-    /* write last one byte data when origin write size is odd */
-    if (result == SFUD_SUCCESS && size == 1) {
-        result = page256_or_1_byte_write(flash, addr, 1, 1, data);
+
+    run_num = sfud_erase_plan(flash, addr, size, runs);
+    if (run_num == 0) {
+        return SFUD_SUCCESS;
+    }
+#ifdef SFUD_USING_READ_CACHE
+    read_cache_drop(flash, runs[0].addr, erase_plan_end(runs, run_num) - runs[0].addr);
+#endif
+#ifdef SFUD_USING_WRITE_BUFFER
+    /* the erase takes whole erase units, so the pages it touches are gone, beyond the range too */
+    write_buffer_drop(flash, runs[0].addr, erase_plan_end(runs, run_num) - runs[0].addr);
+#endif
+    if (runs[0].cmd == SFUD_CMD_ERASE_CHIP) {
+        return sfud_chip_erase(flash);
+    }
+    start = stats_begin(flash, SFUD_STATS_ERASE);
+#ifdef SFUD_USING_PART_DRIVER
+    part = part_get(flash);
+    if (part) {
+        result = part_program(flash, part, addr, size, NULL);
+        stats_end(flash, SFUD_STATS_ERASE, start, size);
+        return result;
     }
+#endif
 
-    __exit:
-    if (result != SFUD_SUCCESS) {
-        set_write_enabled(flash, false);
+    /* lock SPI, the whole plan goes in one sequence */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+
+    for (i = 0; i < run_num; i++) {
+        for (j = 0; j < runs[i].count; j++) {
+            /* set the flash write enable */
+            result = set_write_enabled(flash, true);
+            if (result != SFUD_SUCCESS) {
+                goto __exit;
+            }
+            xfer_make(flash, &xfer, runs[i].cmd, runs[i].addr + j * runs[i].size);
+            result = spi_xfer(flash, &xfer);
+            if (result != SFUD_SUCCESS) {
+                SFUD_INFO("Error: Flash erase SPI communicate error.");
+                goto __exit;
+            }
+            time_typ = erase_time(flash, runs[i].size, &time_max);
+            result = wait_busy_timed(flash, time_typ, time_max);
+            if (result != SFUD_SUCCESS) {
+                goto __exit;
+            }
+        }
     }
+
+    __exit:
+    /* set the flash write disable */
+    set_write_enabled(flash, false);
     /* unlock SPI */
     if (spi->unlock) {
         spi->unlock(spi);
     }
+    stats_end(flash, SFUD_STATS_ERASE, start, size);
+
+    return result;
+}
+
+#ifdef SFUD_USING_BLANK_CHECK
+/**
+ * erase the units of a range which don't read blank, a run of them by one erase plan, see SFUD_USING_BLANK_CHECK
+ */
+static sfud_err erase_blank_checked(const sfud_flash *flash, uint32_t addr, size_t size) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    uint32_t unit = flash->chip.erase_gran, end = addr + size, run = 0;
+    bool blank, in_run = false;
+
+    /* the range rounded out to whole units, as the erase takes them */
+    addr -= addr % unit;
+#ifdef SFUD_USING_READ_CACHE
+    read_cache_drop(flash, addr, end - addr + (unit - end % unit) % unit);
+#endif
+#ifdef SFUD_USING_WRITE_BUFFER
+    /* the pending bytes go with the erase, a unit skipped must not get them later */
+    write_buffer_drop(flash, addr, end - addr + (unit - end % unit) % unit);
+#endif
+    for (; result == SFUD_SUCCESS && addr < end; addr += unit) {
+        if (spi->lock) {
+            spi->lock(spi);
+        }
+        blank = blank_unit(flash, addr);
+        if (spi->unlock) {
+            spi->unlock(spi);
+        }
+        if (!blank && !in_run) {
+            run = addr;
+            in_run = true;
+        } else if (blank && in_run) {
+            result = erase_range(flash, run, addr - run);
+            blank_map_mark(flash, run, addr - run, result == SFUD_SUCCESS);
+            in_run = false;
+        }
+    }
+    if (result == SFUD_SUCCESS && in_run) {
+        result = erase_range(flash, run, end - run);
+        blank_map_mark(flash, run, end - run, result == SFUD_SUCCESS);
+    }
+
+    return result;
+}
+#endif /* SFUD_USING_BLANK_CHECK */
+
+/**
+ * erase flash data
+ *
+ * @note It will erase align by erase granularity. With SFUD_USING_BLANK_CHECK the units which read blank are skipped.
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size erase size
+ *
+ * @return result
+ */
+sfud_err sfud_erase(const sfud_flash *flash, uint32_t addr, size_t size) {
+    SFUD_ASSERT(flash);
+#ifdef SFUD_USING_BLANK_CHECK
+    /* a chip erase takes one command, it isn't split */
+    if ((SFUD_BLANK_CHECK_FLASHES & (1UL << flash->index)) && flash->init_ok && flash->chip.erase_gran
+            && size && addr + size <= flash->chip.capacity && !(addr == 0 && size == flash->chip.capacity)) {
+        return erase_blank_checked(flash, addr, size);
+    }
+#endif
+    return erase_range(flash, addr, size);
+}
+
+/**
+ * write flash data (no erase operate) for write 1 to 256 bytes per page mode or byte write mode
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size write size
+ * @param write_gran write granularity bytes, only support 1 or 256
+ * @param data write data
+ *
+ * @return result
+ */
+static sfud_err page256_or_1_byte_write(const sfud_flash *flash, uint32_t addr, size_t size, uint16_t write_gran,
+                                        const uint8_t *data) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    size_t data_size;
+
+    SFUD_ASSERT(flash);
+    /* only support 1 or 256 */
+    SFUD_ASSERT(write_gran == 1 || write_gran == 256);
+    /* must be call this function after initialize OK */
+    SFUD_ASSERT(flash->init_ok);
+    /* check the flash address bound */
+    if (addr + size > flash->chip.capacity) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+
+    /* loop write operate. write unit is write granularity */
+    while (size) {
+        /* make write align and calculate next write address */
+        if (addr % write_gran != 0) {
+            if (size > write_gran - (addr % write_gran)) {
+                data_size = write_gran - (addr % write_gran);
+            } else {
+                data_size = size;
+            }
+        } else {
+            if (size > write_gran) {
+                data_size = write_gran;
+            } else {
+                data_size = size;
+            }
+        }
+#ifdef SFUD_USING_WRITE_VERIFY
+        result = page_program_verified(flash, addr, data_size, data);
+#else
+        result = page_program_wait(flash, addr, data_size, data);
+#endif
+        if (result != SFUD_SUCCESS) {
+            goto __exit;
+        }
+        size -= data_size;
+        addr += data_size;
+        data += data_size;
+    }
+
+    __exit:
+    /* set the flash write disable */
+    set_write_enabled(flash, false);
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+
+    return result;
+}
+
+/**
+ * write flash data (no erase operate) for auto address increment mode
+ *
+ * If the address is odd number, it will place one 0xFF before the start of data for protect the old data.
+ * If the latest remain size is 1, it will append one 0xFF at the end of data for protect the old data.
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size write size
+ * @param data write data
+ *
+ * @return result
+ */
+static sfud_err aai_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    uint8_t cmd_data[8], cmd_size;
+    bool first_write = true;
+
+    SFUD_ASSERT(flash);
+    SFUD_ASSERT(flash->init_ok);
+    /* check the flash address bound */
+    if (addr + size > flash->chip.capacity) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+    /* The address must be even for AAI write mode. So it must write one byte first when address is odd. */
+    if (addr % 2 != 0) {
+        result = page256_or_1_byte_write(flash, addr++, 1, 1, data++);
+        if (result != SFUD_SUCCESS) {
+            goto __exit;
+        }
+        size--;
+    }
+    /* set the flash write enable */
+    result = set_write_enabled(flash, true);
+    if (result != SFUD_SUCCESS) {
+        goto __exit;
+    }
+    /* loop write operate. */
+    cmd_data[0] = SFUD_CMD_AAI_WORD_PROGRAM;
+    while (size >= 2) {
+        if (first_write) {
+            make_address_byte_array(flash, addr, &cmd_data[1]);
+            cmd_size = flash->addr_in_4_byte ? 5 : 4;
+            cmd_data[cmd_size] = *data;
+            cmd_data[cmd_size + 1] = *(data + 1);
+            first_write = false;
+        } else {
+            cmd_size = 1;
+            cmd_data[1] = *data;
+            cmd_data[2] = *(data + 1);
+        }
+
+        result = spi->wr(spi, cmd_data, cmd_size + 2, NULL, 0);
+        if (result != SFUD_SUCCESS) {
+            SFUD_INFO("Error: Flash write SPI communicate error.");
+            goto __exit;
+        }
+
+        result = wait_busy(flash);
+        if (result != SFUD_SUCCESS) {
+            goto __exit;
+        }
+
+        size -= 2;
+        addr += 2;
+        data += 2;
+    }
+    /* set the flash write disable for exit AAI mode */
+    result = set_write_enabled(flash, false);
+    /* write last one byte data when origin write size is odd */
+    if (result == SFUD_SUCCESS && size == 1) {
+        result = page256_or_1_byte_write(flash, addr, 1, 1, data);
+    }
+
+    __exit:
+    if (result != SFUD_SUCCESS) {
+        set_write_enabled(flash, false);
+    }
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+
+    return result;
+}
+
+#ifdef SFUD_USING_WRITE_BUFFER
+/**
+ * program the pending bytes when they overlap a range
+ */
+static sfud_err write_buffer_flush(const sfud_flash *flash, uint32_t addr, size_t size) {
+    sfud_err result;
+
+    if (write_buffer.flash != flash || write_buffer.addr + write_buffer.end <= addr
+            || write_buffer.addr + write_buffer.start >= addr + size) {
+        return SFUD_SUCCESS;
+    }
+    /* the buffer is empty even when the program fails, its error goes to this caller */
+    write_buffer.flash = NULL;
+    result = page256_or_1_byte_write(flash, write_buffer.addr + write_buffer.start,
+                                     write_buffer.end - write_buffer.start, 256, write_buffer.data + write_buffer.start);
+#ifdef SFUD_USING_READ_CACHE
+    /* a line filled while the bytes were pending holds the page without them */
+    read_cache_drop(flash, write_buffer.addr, SFUD_WRITE_MAX_PAGE_SIZE);
+#endif
+#ifdef SFUD_USING_BLANK_CHECK
+    blank_map_mark(flash, write_buffer.addr, SFUD_WRITE_MAX_PAGE_SIZE, false);
+#endif
+
+    return result;
+}
+
+/**
+ * drop the pending bytes of a range which is erased
+ */
+static void write_buffer_drop(const sfud_flash *flash, uint32_t addr, size_t size) {
+    if (write_buffer.flash == flash && write_buffer.addr < addr + size
+            && write_buffer.addr + SFUD_WRITE_MAX_PAGE_SIZE > addr) {
+        write_buffer.flash = NULL;
+    }
+}
+
+/**
+ * write flash data through the write buffer: the parts of less than a page merge into it, the buffer is programmed
+ * when a part goes to another page or it reaches the end of its page, the whole pages are programmed at once
+ */
+static sfud_err write_buffer_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+    sfud_err result = SFUD_SUCCESS;
+    uint32_t page;
+    size_t offset, len, i;
+
+    /* check the flash address bound */
+    if (addr + size > flash->chip.capacity) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+
+    while (result == SFUD_SUCCESS && size) {
+        page = addr - addr % SFUD_WRITE_MAX_PAGE_SIZE;
+        offset = addr - page;
+        len = SFUD_WRITE_MAX_PAGE_SIZE - offset > size ? size : SFUD_WRITE_MAX_PAGE_SIZE - offset;
+        if (write_buffer.flash && (write_buffer.flash != flash || write_buffer.addr != page)) {
+            result = write_buffer_flush(write_buffer.flash, 0, write_buffer.flash->chip.capacity);
+            if (result != SFUD_SUCCESS) {
+                break;
+            }
+        }
+        if (!write_buffer.flash && len == SFUD_WRITE_MAX_PAGE_SIZE) {
+            result = page256_or_1_byte_write(flash, addr, len, 256, data);
+        } else {
+            if (!write_buffer.flash) {
+                memset(write_buffer.data, 0xFF, sizeof(write_buffer.data));
+                write_buffer.flash = flash;
+                write_buffer.addr = page;
+                write_buffer.start = offset;
+                write_buffer.end = offset + len;
+            } else {
+                if (offset < write_buffer.start) {
+                    write_buffer.start = offset;
+                }
+                if (offset + len > write_buffer.end) {
+                    write_buffer.end = offset + len;
+                }
+            }
+            /* a byte written twice keeps the 0 bits of both, like the flash cells; the 0xFF gaps program nothing */
+            for (i = 0; i < len; i++) {
+                write_buffer.data[offset + i] &= data[i];
+            }
+            if (write_buffer.end == SFUD_WRITE_MAX_PAGE_SIZE) {
+                result = write_buffer_flush(flash, 0, flash->chip.capacity);
+            }
+        }
+        addr += len;
+        size -= len;
+        data += len;
+    }
+
+    return result;
+}
+
+/**
+ * program the pending bytes of the write buffer of a flash
+ *
+ * @param flash flash device
+ *
+ * @return result
+ */
+sfud_err sfud_write_flush(const sfud_flash *flash) {
+    SFUD_ASSERT(flash);
+
+    return write_buffer_flush(flash, 0, flash->chip.capacity);
+}
+#else
+sfud_err sfud_write_flush(const sfud_flash *flash) {
+    (void) flash;
+
+    return SFUD_SUCCESS;
+}
+#endif /* SFUD_USING_WRITE_BUFFER */
+
+/**
+ * write flash data (no erase operate)
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size write size
+ * @param data write data
+ *
+ * @return result
+ */
+sfud_err sfud_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+    sfud_err result = SFUD_SUCCESS;
+    uint32_t start;
+#ifdef SFUD_USING_PART_DRIVER
+    const sfud_part *part;
+#endif
+
+#ifdef SFUD_USING_READ_CACHE
+    read_cache_drop(flash, addr, size);
+#endif
+#ifdef SFUD_USING_BLANK_CHECK
+    blank_map_mark(flash, addr, size, false);
+#endif
+    start = stats_begin(flash, SFUD_STATS_WRITE);
+#ifdef SFUD_USING_WRITE_BUFFER
+    if ((SFUD_WRITE_BUFFER_FLASHES & (1UL << flash->index)) && (flash->chip.write_mode & SFUD_WM_PAGE_256B)) {
+        result = write_buffer_write(flash, addr, size, data);
+    } else
+#endif
+#ifdef SFUD_USING_PART_DRIVER
+    if ((part = part_get(flash)) != NULL) {
+        result = part_program(flash, part, addr, size, data);
+    } else
+#endif
+    if (flash->chip.write_mode & SFUD_WM_PAGE_256B) {
+        result = page256_or_1_byte_write(flash, addr, size, 256, data);
+    } else if (flash->chip.write_mode & SFUD_WM_AAI) {
+        result = aai_write(flash, addr, size, data);
+    } else if (flash->chip.write_mode & SFUD_WM_DUAL_BUFFER) {
+        //TODO dual-buffer write mode
+    }
+    stats_end(flash, SFUD_STATS_WRITE, start, size);
+
+    return result;
+}
+
+/**
+ * erase and write flash data
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size write size
+ * @param data write data
+ *
+ * @return result
+ */
+sfud_err sfud_erase_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+    sfud_err result = SFUD_SUCCESS;
+
+    result = sfud_erase(flash, addr, size);
+
+    if (result == SFUD_SUCCESS) {
+        result = sfud_write(flash, addr, size, data);
+    }
+
+    return result;
+}
+
+static void async_end(sfud_async *op, sfud_err result) {
+#ifdef SFUD_USING_READ_CACHE
+    /* a line filled meanwhile may hold the content before the operation, the range is gone by now */
+    read_cache_drop(op->flash, 0, op->flash->chip.capacity);
+#endif
+    op->result = result;
+    if (op->done) {
+        op->done(op, result);
+    }
+}
+
+/**
+ * send the next command of an operation, the flash is idle and the SPI is locked
+ *
+ * @param op operation
+ *
+ * @return SFUD_ERR_BUSY: a command is sent, SFUD_SUCCESS: nothing is left
+ */
+static sfud_err async_step(sfud_async *op) {
+    const sfud_flash *flash = op->flash;
+    sfud_err result;
+    sfud_spi_xfer xfer;
+    uint8_t cmd;
+    size_t size;
+    uint32_t start;
+
+#ifdef SFUD_USING_WRITE_VERIFY
+    /* the page programmed last is read back first, a mismatch programs it again */
+    if (op->verify_size) {
+        result = page_verify(flash, op->verify_addr, op->verify_size, op->verify_crc);
+        if (result == SFUD_ERR_WRITE && op->verify_tries < SFUD_WRITE_VERIFY_RETRIES) {
+            op->verify_tries++;
+            result = page_program(flash, op->verify_addr, op->verify_size, op->data - op->verify_size);
+            return result == SFUD_SUCCESS ? SFUD_ERR_BUSY : result;
+        }
+        op->verify_size = 0;
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+    }
+#endif
+#ifdef SFUD_USING_BLANK_CHECK
+    /* the units which read blank are skipped, the next command erases from the first one which doesn't */
+    while (op->erase_size && !(op->erase_addr == 0 && op->erase_size == flash->chip.capacity)
+            && blank_unit(flash, op->erase_addr)) {
+        size = flash->chip.erase_gran - op->erase_addr % flash->chip.erase_gran;
+        if (size > op->erase_size) {
+            size = op->erase_size;
+        }
+        op->erase_addr += size;
+        op->erase_size -= size;
+    }
+#endif
+    if (op->erase_size) {
+        if (op->erase_addr == 0 && op->erase_size == flash->chip.capacity) {
+            memset(&xfer, 0, sizeof(xfer));
+            xfer.instruction = SFUD_CMD_ERASE_CHIP;
+            size = op->erase_size;
+        } else {
+            eraser_get(flash, op->erase_addr, op->erase_size, &cmd, &size);
+            xfer_make(flash, &xfer, cmd, op->erase_addr);
+            /* make erase align, the rest of the erase unit the address is in */
+            size -= op->erase_addr % size;
+            if (size > op->erase_size) {
+                size = op->erase_size;
+            }
+        }
+        /* the command only, the flash erases after the unlock */
+        start = stats_begin(flash, SFUD_STATS_ERASE);
+        result = set_write_enabled(flash, true);
+        if (result == SFUD_SUCCESS) {
+            result = spi_xfer(flash, &xfer);
+            if (result != SFUD_SUCCESS) {
+                SFUD_INFO("Error: Flash erase SPI communicate error.");
+            }
+        }
+        stats_end(flash, SFUD_STATS_ERASE, start, size);
+        op->erasing = true;
+        op->erase_addr += size;
+        op->erase_size -= size;
+    } else if (op->size) {
+        size = 256 - op->addr % 256;
+        if (size > op->size) {
+            size = op->size;
+        }
+        start = stats_begin(flash, SFUD_STATS_WRITE);
+#ifdef SFUD_USING_WRITE_VERIFY
+        op->verify_addr = op->addr;
+        op->verify_size = size;
+        op->verify_crc = sfud_port_crc32(0, op->data, size);
+        op->verify_tries = 0;
+#endif
+        result = page_program(flash, op->addr, size, op->data);
+        stats_end(flash, SFUD_STATS_WRITE, start, size);
+        op->erasing = false;
+        op->addr += size;
+        op->size -= size;
+        op->data += size;
+    } else {
+        return SFUD_SUCCESS;
+    }
+
+    return result == SFUD_SUCCESS ? SFUD_ERR_BUSY : result;
+}
+
+/**
+ * set up an operation and send its first command, the erase part goes first
+ */
+static sfud_err async_start(const sfud_flash *flash, sfud_async *op, uint32_t erase_addr, size_t erase_size,
+                            uint32_t addr, size_t size, const uint8_t *data) {
+    sfud_err result = SFUD_SUCCESS;
+
+    SFUD_ASSERT(flash);
+    SFUD_ASSERT(op);
+    /* must be call this function after initialize OK */
+    SFUD_ASSERT(flash->init_ok);
+    /* check the flash address bound */
+    if (erase_addr + erase_size > flash->chip.capacity || addr + size > flash->chip.capacity) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+
+#ifdef SFUD_USING_READ_CACHE
+    if (erase_size) {
+        sfud_erase_run runs[SFUD_ERASE_PLAN_MAX_RUNS];
+        size_t run_num = sfud_erase_plan(flash, erase_addr, erase_size, runs);
+
+        /* the erase part takes whole erase units */
+        if (run_num) {
+            read_cache_drop(flash, runs[0].addr, erase_plan_end(runs, run_num) - runs[0].addr);
+        }
+    }
+    read_cache_drop(flash, addr, size);
+#endif
+#ifdef SFUD_USING_BLANK_CHECK
+    /* a unit known blank stays so through the erase part */
+    blank_map_mark(flash, addr, size, false);
+#endif
+#ifdef SFUD_USING_WRITE_BUFFER
+    /* the flash belongs to the operation until it ends, nothing may stay pending */
+    result = write_buffer_flush(flash, 0, flash->chip.capacity);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+#endif
+    op->flash = flash;
+    op->erase_addr = erase_addr;
+    op->erase_size = erase_size;
+    op->addr = addr;
+    op->size = size;
+    op->data = data;
+    op->result = SFUD_ERR_BUSY;
+    op->erasing = false;
+    op->suspended = false;
+#ifdef SFUD_USING_WRITE_VERIFY
+    op->verify_size = 0;
+#endif
+
+    /* AAI and dual-buffer write, dual-buffer chip erase aren't split in page commands */
+    if ((size && !(flash->chip.write_mode & SFUD_WM_PAGE_256B))
+            || (erase_addr == 0 && erase_size == flash->chip.capacity
+                    && (flash->chip.write_mode & SFUD_WM_DUAL_BUFFER))) {
+        if (erase_size) {
+            result = sfud_erase(flash, erase_addr, erase_size);
+        }
+        if (result == SFUD_SUCCESS && size) {
+            result = sfud_write(flash, addr, size, data);
+        }
+        async_end(op, result);
+        return result;
+    }
+
+    result = sfud_async_poll(op);
+
+    return result == SFUD_ERR_BUSY ? SFUD_SUCCESS : result;
+}
+
+sfud_err sfud_erase_async(const sfud_flash *flash, sfud_async *op, uint32_t addr, size_t size) {
+    return async_start(flash, op, addr, size, 0, 0, NULL);
+}
+
+sfud_err sfud_write_async(const sfud_flash *flash, sfud_async *op, uint32_t addr, size_t size, const uint8_t *data) {
+    return async_start(flash, op, 0, 0, addr, size, data);
+}
+
+sfud_err sfud_erase_write_async(const sfud_flash *flash, sfud_async *op, uint32_t addr, size_t size,
+                                const uint8_t *data) {
+    return async_start(flash, op, addr, size, addr, size, data);
+}
+
+sfud_err sfud_async_poll(sfud_async *op) {
+    sfud_err result;
+    const sfud_spi *spi;
+    uint8_t status;
+
+    SFUD_ASSERT(op);
+
+    if (op->result != SFUD_ERR_BUSY) {
+        return op->result;
+    }
+    spi = &op->flash->spi;
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+
+    if (op->suspended) {
+        /* the flash is idle for a read of sfud_async_read() */
+        result = SFUD_ERR_BUSY;
+    } else {
+        result = sfud_read_status(op->flash, &status);
+        if (result == SFUD_SUCCESS && !(status & SFUD_STATUS_REGISTER_BUSY)) {
+            idle_set(op->flash, true);
+            result = async_step(op);
+        } else if (result == SFUD_SUCCESS) {
+            result = SFUD_ERR_BUSY;
+        }
+    }
+    if (result != SFUD_ERR_BUSY) {
+        /* set the flash write disable */
+        set_write_enabled(op->flash, false);
+    }
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+
+    if (result != SFUD_ERR_BUSY) {
+        async_end(op, result);
+    }
+
+    return result;
+}
+
+sfud_err sfud_async_wait(sfud_async *op) {
+    sfud_err result;
+    size_t retry_times, left;
+    uint32_t start, retries = 0;
+
+    SFUD_ASSERT(op);
+
+    if (op->result != SFUD_ERR_BUSY) {
+        return op->result;
+    }
+    start = stats_now();
+    retry_times = op->flash->retry.times;
+    left = op->erase_size + op->size;
+
+    while ((result = sfud_async_poll(op)) == SFUD_ERR_BUSY) {
+        /* every command gets the retry times of wait_busy() */
+        if (op->erase_size + op->size != left) {
+            left = op->erase_size + op->size;
+            retry_times = op->flash->retry.times;
+        }
+        SFUD_RETRY_PROCESS(op->flash->retry.delay, retry_times, result);
+        retries++;
+    }
+    /* the waits of an operation go to the erase or the program it ended with */
+    stats_busy(op->flash, op->erasing ? SFUD_STATS_ERASE : SFUD_STATS_WRITE, start, retries);
+    if (result == SFUD_ERR_TIMEOUT) {
+        SFUD_INFO("Error: Flash wait busy has an error.");
+        async_end(op, result);
+    }
+
+    return result;
+}
+
+/**
+ * send a suspend or resume instruction of the flash
+ */
+static sfud_err suspend_cmd_send(const sfud_flash *flash, uint8_t cmd) {
+    sfud_spi_xfer xfer;
+
+    memset(&xfer, 0, sizeof(xfer));
+    xfer.instruction = cmd;
+
+    return spi_xfer(flash, &xfer);
+}
+
+sfud_err sfud_async_read(sfud_async *op, uint32_t addr, size_t size, uint8_t *data) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_flash *flash;
+    const sfud_spi *spi;
+    uint8_t status, suspend = 0, resume = 0;
+
+    SFUD_ASSERT(op);
+    SFUD_ASSERT(op->flash);
+
+    flash = op->flash;
+    spi = &flash->spi;
+#ifdef SFUD_USING_SFDP
+    if (op->result == SFUD_ERR_BUSY) {
+        suspend = op->erasing ? flash->sfdp.suspend_cmd : flash->sfdp.program_suspend_cmd;
+        resume = op->erasing ? flash->sfdp.resume_cmd : flash->sfdp.program_resume_cmd;
+    }
+#endif
+    /* no operation or nothing to suspend it by, the read waits the flash */
+    if (!suspend) {
+        return sfud_read(flash, addr, size, data);
+    }
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+    result = sfud_read_status(flash, &status);
+    if (result == SFUD_SUCCESS && (status & SFUD_STATUS_REGISTER_BUSY)) {
+        result = suspend_cmd_send(flash, suspend);
+        /* the flash is ready once it's suspended, within the suspend latency */
+        if (result == SFUD_SUCCESS) {
+            result = wait_busy(flash);
+        }
+        op->suspended = true;
+    } else {
+        /* the command is done, the next one isn't sent yet */
+        resume = 0;
+    }
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+
+    if (result == SFUD_SUCCESS) {
+        result = sfud_read(flash, addr, size, data);
+    }
+
+    if (resume) {
+        if (spi->lock) {
+            spi->lock(spi);
+        }
+        /* resume even after a failed read, a suspended flash takes no other erase or program */
+        if (suspend_cmd_send(flash, resume) != SFUD_SUCCESS && result == SFUD_SUCCESS) {
+            result = SFUD_ERR_WRITE;
+        }
+        idle_set(flash, false);
+        op->suspended = false;
+        if (spi->unlock) {
+            spi->unlock(spi);
+        }
+    }
+
+    return result;
+}
+
+/* a stream erases up to the next 64KB boundary at a time, the block erases take much less time a byte */
+#define STREAM_ERASE_BLOCK                       0x10000UL
+
+/**
+ * bytes of the next erase of a stream, from stream->erased to a block boundary or the granule of the end
+ */
+static uint32_t stream_erase_size(const sfud_stream *stream) {
+    uint32_t gran = stream->flash->chip.erase_gran;
+    uint32_t size = STREAM_ERASE_BLOCK - stream->erased % STREAM_ERASE_BLOCK;
+    uint32_t left = (stream->end - stream->erased + gran - 1) / gran * gran;
+
+    return size < left ? size : left;
+}
+
+/**
+ * move the operation of a stream on, an error of it sticks to the stream
+ *
+ * @param wait wait the program or the erase in flight to end
+ *
+ * @return SFUD_ERR_BUSY: still running
+ */
+static sfud_err stream_op_end(sfud_stream *stream, bool wait) {
+    sfud_err result = wait ? sfud_async_wait(&stream->op) : sfud_async_poll(&stream->op);
+
+    if (result != SFUD_SUCCESS && result != SFUD_ERR_BUSY && stream->result == SFUD_SUCCESS) {
+        stream->result = result;
+    }
+
+    return result;
+}
+
+/**
+ * start the next erase once the flash is free and the write pointer is in the last erased granule
+ */
+static void stream_erase_ahead(sfud_stream *stream) {
+    uint32_t gran = stream->flash->chip.erase_gran, size;
+    sfud_err result;
+
+    if (stream->result != SFUD_SUCCESS || stream->erased >= stream->end || stream->erased >= stream->pos + gran
+            || stream_op_end(stream, false) != SFUD_SUCCESS) {
+        return;
+    }
+    size = stream_erase_size(stream);
+    stream->op.done = NULL;
+    result = sfud_erase_async(stream->flash, &stream->op, stream->erased, size);
+    if (result != SFUD_SUCCESS) {
+        stream->result = result;
+        return;
+    }
+    stream->erased += size;
+}
+
+/**
+ * program the buffer being filled in the background, the other one takes the next bytes
+ */
+static sfud_err stream_page_program(sfud_stream *stream) {
+    uint32_t size;
+    sfud_err result;
+
+    if (stream->pos == stream->page) {
+        return stream->result;
+    }
+    /* the page goes after the program of the other buffer or the erase ahead */
+    if (stream_op_end(stream, true) != SFUD_SUCCESS) {
+        return stream->result;
+    }
+    /* the data came faster than the erase ahead, the rest of the page is erased here */
+    while (stream->erased < stream->pos) {
+        size = stream_erase_size(stream);
+        result = sfud_erase(stream->flash, stream->erased, size);
+        if (result != SFUD_SUCCESS) {
+            stream->result = result;
+            return result;
+        }
+        stream->erased += size;
+    }
+    stream->op.done = NULL;
+    result = sfud_write_async(stream->flash, &stream->op, stream->page, stream->pos - stream->page,
+                              stream->buf[stream->cur] + stream->page % SFUD_WRITE_MAX_PAGE_SIZE);
+    if (result != SFUD_SUCCESS) {
+        stream->result = result;
+        return result;
+    }
+    stream->cur ^= 1;
+    stream->page = stream->pos;
+
+    return SFUD_SUCCESS;
+}
+
+sfud_err sfud_stream_open(sfud_stream *stream, const sfud_flash *flash, uint32_t start, size_t max_len) {
+    SFUD_ASSERT(stream);
+    SFUD_ASSERT(flash);
+    /* must be call this function after initialize OK */
+    SFUD_ASSERT(flash->init_ok);
+
+    memset(stream, 0, offsetof(sfud_stream, buf));
+    stream->flash = flash;
+    stream->result = SFUD_ERR_ADDR_OUT_OF_BOUND;
+    /* check the flash address bound */
+    if (flash->chip.erase_gran == 0 || start % flash->chip.erase_gran || start + max_len > flash->chip.capacity
+            || start + max_len < start) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return stream->result;
+    }
+    stream->pos = stream->page = stream->erased = start;
+    stream->end = start + max_len;
+    stream->result = SFUD_SUCCESS;
+    stream_erase_ahead(stream);
+
+    return stream->result;
+}
+
+sfud_err sfud_stream_write(sfud_stream *stream, const void *chunk, size_t len) {
+    const uint8_t *data = chunk;
+    size_t size;
+
+    SFUD_ASSERT(stream);
+    SFUD_ASSERT(chunk || len == 0);
+
+    if (stream->result != SFUD_SUCCESS) {
+        return stream->result;
+    }
+    if (len > stream->end - stream->pos) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    while (len) {
+        size = SFUD_WRITE_MAX_PAGE_SIZE - stream->pos % SFUD_WRITE_MAX_PAGE_SIZE;
+        if (size > len) {
+            size = len;
+        }
+        memcpy(stream->buf[stream->cur] + stream->pos % SFUD_WRITE_MAX_PAGE_SIZE, data, size);
+        stream->pos += size;
+        data += size;
+        len -= size;
+        if (stream->pos % SFUD_WRITE_MAX_PAGE_SIZE == 0 && stream_page_program(stream) != SFUD_SUCCESS) {
+            break;
+        }
+        /* the erase waits for the page, and goes in while the next one fills */
+        stream_erase_ahead(stream);
+    }
+
+    return stream->result;
+}
+
+sfud_err sfud_stream_close(sfud_stream *stream) {
+    SFUD_ASSERT(stream);
+
+    if (stream->result == SFUD_SUCCESS) {
+        stream_page_program(stream);
+    }
+    /* an erase or a program may still run after an error */
+    stream_op_end(stream, true);
+
+    return stream->result;
+}
+
+static sfud_err reset(const sfud_flash *flash) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    uint8_t cmd_data[2];
+
+    SFUD_ASSERT(flash);
+
+    cmd_data[0] = SFUD_CMD_ENABLE_RESET;
+    result = spi->wr(spi, cmd_data, 1, NULL, 0);
+    if (result != SFUD_SUCCESS) {
+        goto __failed;
+    }
+
+    /* right after 66h, any other command in between (a status read too) drops the reset enable */
+    cmd_data[1] = SFUD_CMD_RESET;
+    result = spi->wr(spi, &cmd_data[1], 1, NULL, 0);
+
+    if (result == SFUD_SUCCESS) {
+        result = wait_busy(flash);
+    }
+
+    if (result != SFUD_SUCCESS) {
+        goto __failed;
+    }
+    SFUD_DEBUG("Flash device reset success.");
+
+    __failed:
+    if (result != SFUD_SUCCESS) {
+        SFUD_INFO("Error: Flash device reset failed.");
+    }
+
+    return result;
+}
+
+static sfud_err read_jedec_id(sfud_flash *flash) {
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    uint8_t cmd_data[1], recv_data[3];
+
+    SFUD_ASSERT(flash);
+
+    cmd_data[0] = SFUD_CMD_JEDEC_ID;
+    result = spi->wr(spi, cmd_data, sizeof(cmd_data), recv_data, sizeof(recv_data));
+    if (result == SFUD_SUCCESS) {
+        flash->chip.mf_id = recv_data[0];
+        flash->chip.type_id = recv_data[1];
+        flash->chip.capacity_id = recv_data[2];
+        SFUD_DEBUG("The flash device manufacturer ID is 0x%02X, memory type ID is 0x%02X, capacity ID is 0x%02X.",
+                   flash->chip.mf_id, flash->chip.type_id, flash->chip.capacity_id);
+    } else {
+        SFUD_INFO("Error: Read flash device JEDEC ID error.");
+    }
+
+    return result;
+}
+
+/**
+ * set the flash write enable or write disable
+ *
+ * @param flash flash device
+ * @param enabled true: enable  false: disable
+ *
+ * @return result
+ */
+static sfud_err set_write_enabled(const sfud_flash *flash, bool enabled) {
+    sfud_err result = SFUD_SUCCESS;
+    uint8_t cmd, register_status;
+
+    SFUD_ASSERT(flash);
+
+    if (enabled) {
+        cmd = SFUD_CMD_WRITE_ENABLE;
+    } else {
+        cmd = SFUD_CMD_WRITE_DISABLE;
+    }
+
+    result = stats_bus(flash, flash->spi.wr(&flash->spi, &cmd, 1, NULL, 0));
+    if (enabled) {
+        /* a program, erase or status write follows */
+        idle_set(flash, false);
+    }
+
+    if (result == SFUD_SUCCESS) {
+        result = sfud_read_status(flash, &register_status);
+    }
+
+    if (result == SFUD_SUCCESS) {
+        if (enabled && (register_status & SFUD_STATUS_REGISTER_WEL) == 0) {
+            SFUD_INFO("Error: Can't enable write status.");
+            return SFUD_ERR_WRITE;
+        } else if (!enabled && (register_status & SFUD_STATUS_REGISTER_WEL) != 0) {
+            SFUD_INFO("Error: Can't disable write status.");
+            return SFUD_ERR_WRITE;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * enable or disable 4-Byte addressing for flash
+ *
+ * @note The 4-Byte addressing just supported for the flash capacity which is large then 16MB (256Mb).
+ *
+ * @param flash flash device
+ * @param enabled true: enable   false: disable
+ *
+ * @return result
+ */
+static sfud_err set_4_byte_address_mode(sfud_flash *flash, bool enabled) {
+    sfud_err result = SFUD_SUCCESS;
+    uint8_t cmd;
+
+    SFUD_ASSERT(flash);
+
+    /* set the flash write enable */
+    result = set_write_enabled(flash, true);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+
+    if (enabled) {
+        cmd = SFUD_CMD_ENTER_4B_ADDRESS_MODE;
+    } else {
+        cmd = SFUD_CMD_EXIT_4B_ADDRESS_MODE;
+    }
+
+    result = flash->spi.wr(&flash->spi, &cmd, 1, NULL, 0);
+
+    if (result == SFUD_SUCCESS) {
+        flash->addr_in_4_byte = enabled ? true : false;
+        SFUD_DEBUG("%s 4-Byte addressing mode success.", enabled ? "Enter" : "Exit");
+    } else {
+        SFUD_INFO("Error: %s 4-Byte addressing mode failed.", enabled ? "Enter" : "Exit");
+    }
+
+    return result;
+}
+
+/**
+ * read flash register status
+ *
+ * @param flash flash device
+ * @param status register status
+ *
+ * @return result
+ */
+sfud_err sfud_read_status(const sfud_flash *flash, uint8_t *status) {
+    uint8_t cmd = SFUD_CMD_READ_STATUS_REGISTER;
+    sfud_err result;
+    uint32_t start;
+
+    SFUD_ASSERT(flash);
+    SFUD_ASSERT(status);
+
+    start = stats_begin(flash, SFUD_STATS_STATUS);
+    result = stats_bus(flash, flash->spi.wr(&flash->spi, &cmd, 1, status, 1));
+    stats_end(flash, SFUD_STATS_STATUS, start, 1);
+
+    return result;
+}
+
+static sfud_err wait_busy(const sfud_flash *flash) {
+    return wait_busy_timed(flash, 0, 0);
+}
+
+/**
+ * wait the flash is not busy
+ *
+ * SPI has no auto-polling, the status is read by the CPU. With the typical time of the operation and a
+ * retry.sleep of the port, the flash is left alone for that time (the CPU may sleep), then polled at a sixteenth of
+ * it, twice as long each time up to SFUD_BUSY_POLL_MAX_US, until twice the maximum time. Without them every poll
+ * is followed by a retry.delay, up to retry.times.
+ *
+ * @param time_typ typical time of the operation (us), 0: not known
+ * @param time_max maximum time of the operation (us)
+ */
+static sfud_err wait_busy_timed(const sfud_flash *flash, uint32_t time_typ, uint32_t time_max) {
+    sfud_err result = SFUD_SUCCESS;
+    uint8_t status;
+    size_t retry_times = flash->retry.times;
+    uint32_t start = stats_now(), retries = 0, interval, waited, limit;
+
+    SFUD_ASSERT(flash);
+
+    if (flash->spi.wait_busy) {
+        result = stats_bus(flash, flash->spi.wait_busy(&flash->spi));
+        stats_busy(flash, SFUD_STATS_OP_NUM, start, 0);
+        if (result != SFUD_SUCCESS) {
+            SFUD_INFO("Error: Flash wait busy has an error.");
+        }
+        idle_set(flash, result == SFUD_SUCCESS);
+        return result;
+    }
+
+    if (time_typ && flash->retry.sleep) {
+        flash->retry.sleep(time_typ);
+        waited = time_typ;
+        limit = time_max < (UINT32_MAX - SFUD_BUSY_POLL_MAX_US) / 2 ? time_max * 2 : UINT32_MAX - SFUD_BUSY_POLL_MAX_US;
+        interval = time_typ / 16 < SFUD_BUSY_POLL_MIN_US ? SFUD_BUSY_POLL_MIN_US : time_typ / 16;
+        while (true) {
+            result = sfud_read_status(flash, &status);
+            if (result == SFUD_SUCCESS && ((status & SFUD_STATUS_REGISTER_BUSY)) == 0) {
+                break;
+            }
+            if (waited >= limit) {
+                result = SFUD_ERR_TIMEOUT;
+                break;
+            }
+            if (interval > SFUD_BUSY_POLL_MAX_US) {
+                interval = SFUD_BUSY_POLL_MAX_US;
+            }
+            flash->retry.sleep(interval);
+            waited += interval;
+            interval *= 2;
+            retries++;
+        }
+    } else {
+        while (true) {
+            result = sfud_read_status(flash, &status);
+            if (result == SFUD_SUCCESS && ((status & SFUD_STATUS_REGISTER_BUSY)) == 0) {
+                break;
+            }
+            /* retry counts */
+            SFUD_RETRY_PROCESS(flash->retry.delay, retry_times, result);
+            retries++;
+        }
+    }
+    stats_busy(flash, SFUD_STATS_OP_NUM, start, retries);
+
+    if (result != SFUD_SUCCESS || ((status & SFUD_STATUS_REGISTER_BUSY)) != 0) {
+        SFUD_INFO("Error: Flash wait busy has an error.");
+    }
+    idle_set(flash, result == SFUD_SUCCESS && (status & SFUD_STATUS_REGISTER_BUSY) == 0);
+
+    return result;
+}
+
+/**
+ * @param time_max maximum SFDP time of the erase (us)
+ *
+ * @return typical SFDP time of an erase of size (us), 0: not known
+ */
+static uint32_t erase_time(const sfud_flash *flash, uint32_t size, uint32_t *time_max) {
+#ifdef SFUD_USING_SFDP
+    size_t i;
+
+    for (i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        if (flash->sfdp.eraser[i].size == size) {
+            *time_max = flash->sfdp.eraser[i].time_max;
+            return flash->sfdp.eraser[i].time_typ;
+        }
+    }
+#else
+    (void) flash;
+    (void) size;
+#endif
+    *time_max = 0;
+    return 0;
+}
+
+/**
+ * wait the flash before a read, a flash known idle isn't polled
+ */
+static sfud_err wait_idle(const sfud_flash *flash) {
+#ifdef SFUD_USING_IDLE_TRACK
+    if (flash->index < IDLE_DEVICE_NUM && &flash_table[flash->index] == flash && flash_idle[flash->index]) {
+        return SFUD_SUCCESS;
+    }
+#endif
+
+    return wait_busy(flash);
+}
+
+/**
+ * note the flash idle after a poll, or maybe busy after a command that can make it busy
+ */
+static void idle_set(const sfud_flash *flash, bool idle) {
+#ifdef SFUD_USING_IDLE_TRACK
+    if (flash->index < IDLE_DEVICE_NUM && &flash_table[flash->index] == flash) {
+        flash_idle[flash->index] = idle;
+    }
+#else
+    (void) flash;
+    (void) idle;
+#endif
+}
+
+#ifdef SFUD_USING_PART_DRIVER
+/**
+ * the part driver of the flash, when one is attached and it can take the flash as it is now
+ */
+static const sfud_part *part_get(const sfud_flash *flash) {
+    return flash->part && flash->part->ready(flash) ? flash->part : NULL;
+}
+
+#ifdef SFUD_USING_WRITE_VERIFY
+/**
+ * read back the pages a part driver programmed, a mismatch goes to the driver again, see page_program_verified()
+ */
+static sfud_err part_verify(const sfud_flash *flash, const sfud_part *part, uint32_t addr, size_t size,
+                            const uint8_t *data) {
+    sfud_err result = SFUD_SUCCESS;
+    uint32_t end = addr + size, crc;
+    uint8_t tries;
+    size_t len;
+
+    for (; result == SFUD_SUCCESS && addr < end; addr += len, data += len) {
+        len = SFUD_WRITE_MAX_PAGE_SIZE - addr % SFUD_WRITE_MAX_PAGE_SIZE;
+        if (len > end - addr) {
+            len = end - addr;
+        }
+        crc = sfud_port_crc32(0, data, len);
+        for (tries = 0; result == SFUD_SUCCESS; tries++) {
+            result = page_verify(flash, addr, len, crc);
+            if (result != SFUD_ERR_WRITE || tries == SFUD_WRITE_VERIFY_RETRIES) {
+                break;
+            }
+            result = part->write(flash, addr, len, data);
+        }
+    }
+
+    return result;
+}
+#endif
+
+/**
+ * write or erase by the part driver, with the SPI locked and the flash idle
+ *
+ * @param data write data, NULL: erase
+ */
+static sfud_err part_program(const sfud_flash *flash, const sfud_part *part, uint32_t addr, size_t size,
+                             const uint8_t *data) {
+    sfud_err result;
+    const sfud_spi *spi = &flash->spi;
+
+    SFUD_ASSERT(flash->init_ok);
+    if (addr + size > flash->chip.capacity) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+    result = wait_idle(flash);
+    if (result == SFUD_SUCCESS) {
+        result = data ? part->write(flash, addr, size, data) : part->erase(flash, addr, size);
+    }
+#ifdef SFUD_USING_WRITE_VERIFY
+    if (result == SFUD_SUCCESS && data) {
+        result = part_verify(flash, part, addr, size, data);
+    }
+#endif
+    /* the driver waits the flash idle at the end, a failure may leave it busy */
+    idle_set(flash, result == SFUD_SUCCESS);
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+
+    return result;
+}
+#endif /* SFUD_USING_PART_DRIVER */
+
+static void make_address_byte_array(const sfud_flash *flash, uint32_t addr, uint8_t *array) {
+    uint8_t len, i;
+
+    SFUD_ASSERT(flash);
+    SFUD_ASSERT(array);
+
+    len = flash->addr_in_4_byte ? 4 : 3;
+
+    for (i = 0; i < len; i++) {
+        array[i] = (addr >> ((len - (i + 1)) * 8)) & 0xFF;
+    }
+}
+
+/**
+ * send one page program, the write enable goes first
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size write size, it must stay in the page
+ * @param data write data
+ *
+ * @return result
+ */
+static sfud_err page_program(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+    sfud_err result;
+    sfud_spi_xfer xfer;
+
+    /* set the flash write enable */
+    result = set_write_enabled(flash, true);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    xfer_make(flash, &xfer, SFUD_CMD_PAGE_PROGRAM, addr);
+#ifdef SFUD_USING_QSPI
+    /* the packed commands of wr() are 1-line */
+    if (flash->write_cmd_format.instruction && flash->spi.xfer) {
+        xfer.instruction = flash->write_cmd_format.instruction;
+        xfer.addr_lines = flash->write_cmd_format.address_lines;
+        xfer.data_lines = flash->write_cmd_format.data_lines;
+    }
+#endif
+    xfer.write_buf = data;
+    xfer.data_size = size;
+    result = spi_xfer(flash, &xfer);
+    if (result != SFUD_SUCCESS) {
+        SFUD_INFO("Error: Flash write SPI communicate error.");
+    }
+
+    return result;
+}
+
+/**
+ * program a page and wait the flash, see page_program()
+ */
+static sfud_err page_program_wait(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+    sfud_err result = page_program(flash, addr, size, data);
+
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+#ifdef SFUD_USING_SFDP
+    return wait_busy_timed(flash, flash->sfdp.program_time_typ, flash->sfdp.program_time_max);
+#else
+    return wait_busy(flash);
+#endif
+}
+
+#ifdef SFUD_USING_WRITE_VERIFY
+/**
+ * read a programmed page back and check it against the CRC-32 of its data, the flash is idle
+ *
+ * @note the port reads it by the memory-mapped window or by the DMA, the buffer is static for the DMA
+ *
+ * @param crc sfud_port_crc32() of the data, taken before the program
+ *
+ * @return SFUD_ERR_WRITE: the page doesn't hold the data
+ */
+static sfud_err page_verify(const sfud_flash *flash, uint32_t addr, size_t size, uint32_t crc) {
+    static uint8_t verify_buf[SFUD_WRITE_MAX_PAGE_SIZE] __attribute__((aligned(32)));
+    sfud_err result = read_data(flash, addr, size, verify_buf);
+
+    if (result == SFUD_SUCCESS && sfud_port_crc32(0, verify_buf, size) != crc) {
+        SFUD_INFO("Warning: Flash page at 0x%08lX read back wrong.", (unsigned long) addr);
+        result = SFUD_ERR_WRITE;
+    }
+
+    return result;
+}
+
+/**
+ * program a page, read it back and program it again on a mismatch, SFUD_WRITE_VERIFY_RETRIES times at most
+ */
+static sfud_err page_program_verified(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+    uint32_t crc = sfud_port_crc32(0, data, size);
+    sfud_err result = page_program_wait(flash, addr, size, data);
+    uint8_t tries;
+
+    for (tries = 0; result == SFUD_SUCCESS; tries++) {
+        result = page_verify(flash, addr, size, crc);
+        if (result != SFUD_ERR_WRITE || tries == SFUD_WRITE_VERIFY_RETRIES) {
+            break;
+        }
+        result = page_program_wait(flash, addr, size, data);
+    }
+
+    return result;
+}
+#endif /* SFUD_USING_WRITE_VERIFY */
+
+/**
+ * get the erase instruction and unit for an erase
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size erase size
+ * @param cmd erase instruction, 3-Byte address one
+ * @param erase_size erase unit of the instruction
+ */
+static void eraser_get(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *cmd, size_t *erase_size) {
+    extern size_t sfud_sfdp_get_suitable_eraser(const sfud_flash *flash, uint32_t addr, size_t erase_size);
+
+    /* if this flash is support SFDP parameter, then used SFDP parameter supplies eraser */
+#ifdef SFUD_USING_SFDP
+    size_t eraser_index;
+    if (flash->sfdp.available) {
+        /* get the suitable eraser for erase process from SFDP parameter */
+        eraser_index = sfud_sfdp_get_suitable_eraser(flash, addr, size);
+        *cmd = flash->sfdp.eraser[eraser_index].cmd;
+        *erase_size = flash->sfdp.eraser[eraser_index].size;
+        return;
+    }
+#endif
+    *cmd = flash->chip.erase_gran_cmd;
+    *erase_size = flash->chip.erase_gran;
+}
 
-    return result;
+/**
+ * set up a command with an address phase and no data
+ *
+ * @param flash flash device
+ * @param xfer transfer to set up
+ * @param cmd 3-Byte address instruction, addr_4_byte_cmd() picks its 4-Byte variant
+ * @param addr address
+ */
+static void xfer_make(const sfud_flash *flash, sfud_spi_xfer *xfer, uint8_t cmd, uint32_t addr) {
+    memset(xfer, 0, sizeof(sfud_spi_xfer));
+    xfer->instruction = addr_4_byte_cmd(flash, cmd);
+    xfer->addr_size = flash->addr_in_4_byte ? 4 : 3;
+    xfer->addr = addr;
 }
 
 /**
- * write flash data (no erase operate)
+ * run a command by the structured transfer of the port, a port without it gets the command packed in front
+ * of the data
  *
  * @param flash flash device
- * @param addr start address
- * @param size write size
- * @param data write data
+ * @param xfer transfer, the write data is one page at most
  *
  * @return result
  */
-sfud_err sfud_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
-    sfud_err result = SFUD_SUCCESS;
+static sfud_err spi_xfer(const sfud_flash *flash, const sfud_spi_xfer *xfer) {
+    const sfud_spi *spi = &flash->spi;
+    static uint8_t cmd_data[5 + SFUD_READ_DUMMY_BYTE_CNT + SFUD_WRITE_MAX_PAGE_SIZE];
+    size_t cmd_size = 0, i;
 
-    if (flash->chip.write_mode & SFUD_WM_PAGE_256B) {
-        result = page256_or_1_byte_write(flash, addr, size, 256, data);
-    } else if (flash->chip.write_mode & SFUD_WM_AAI) {
-        result = aai_write(flash, addr, size, data);
-    } else if (flash->chip.write_mode & SFUD_WM_DUAL_BUFFER) {
-        //TODO dual-buffer write mode
+    if (spi->xfer) {
+        return stats_bus(flash, spi->xfer(spi, xfer));
     }
 
-    return result;
+    SFUD_ASSERT(xfer->dummy_size <= SFUD_READ_DUMMY_BYTE_CNT);
+    SFUD_ASSERT(!xfer->write_buf || xfer->data_size <= SFUD_WRITE_MAX_PAGE_SIZE);
+    cmd_data[cmd_size++] = xfer->instruction;
+    for (i = xfer->addr_size; i > 0; i--) {
+        cmd_data[cmd_size++] = (xfer->addr >> ((i - 1) * 8)) & 0xFF;
+    }
+    for (i = 0; i < xfer->dummy_size; i++) {
+        cmd_data[cmd_size++] = SFUD_DUMMY_DATA;
+    }
+    if (xfer->write_buf) {
+        memcpy(&cmd_data[cmd_size], xfer->write_buf, xfer->data_size);
+        return stats_bus(flash, spi->wr(spi, cmd_data, cmd_size + xfer->data_size, NULL, 0));
+    }
+    return stats_bus(flash, spi->wr(spi, cmd_data, cmd_size, xfer->read_buf, xfer->read_buf ? xfer->data_size : 0));
 }
 
 /**
- * erase and write flash data
+ * check the flash can be used with the 4-Byte address instructions only, it is found by the
+ * SFDP 4-Byte address instruction table
  *
  * @param flash flash device
- * @param addr start address
- * @param size write size
- * @param data write data
  *
- * @return result
+ * @return true: the 4-Byte addressing mode is not needed
  */
-sfud_err sfud_erase_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
-    sfud_err result = SFUD_SUCCESS;
+static bool addr_4_byte_inst_available(const sfud_flash *flash) {
+#ifdef SFUD_USING_SFDP
+    /* 13h, 0Ch and 12h */
+    const uint32_t required = (1UL << 0) | (1UL << 1) | (1UL << 6);
+    size_t i;
 
-    result = sfud_erase(flash, addr, size);
+    if (!flash->sfdp.available || (flash->sfdp.inst_4_byte & required) != required) {
+        return false;
+    }
+    /* every eraser must have its 4-Byte variant */
+    for (i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        if (flash->sfdp.eraser[i].size != 0 && flash->sfdp.eraser[i].cmd_4b == 0) {
+            return false;
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
 
-    if (result == SFUD_SUCCESS) {
-        result = sfud_write(flash, addr, size, data);
+/**
+ * get the 4-Byte address variant of the command when the 4-Byte address instructions are used
+ *
+ * @param flash flash device
+ * @param cmd command with 3-Byte address
+ *
+ * @return command to send
+ */
+static uint8_t addr_4_byte_cmd(const sfud_flash *flash, uint8_t cmd) {
+    if (!flash->addr_4_byte_inst) {
+        return cmd;
+    }
+
+    switch (cmd) {
+    case SFUD_CMD_READ_DATA:
+        return SFUD_CMD_READ_DATA_4B;
+    case SFUD_CMD_FAST_READ_DATA:
+        return SFUD_CMD_FAST_READ_DATA_4B;
+    case SFUD_CMD_PAGE_PROGRAM:
+        return SFUD_CMD_PAGE_PROGRAM_4B;
+    default:
+        break;
     }
+#ifdef SFUD_USING_SFDP
+    size_t i;
+    for (i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        if (flash->sfdp.eraser[i].size != 0 && flash->sfdp.eraser[i].cmd == cmd) {
+            return flash->sfdp.eraser[i].cmd_4b;
+        }
+    }
+#endif
 
-    return result;
+    return cmd;
 }
 
-static sfud_err reset(const sfud_flash *flash) {
+/**
+ * write status register
+ *
+ * @param flash flash device
+ * @param is_volatile true: volatile mode, false: non-volatile mode
+ * @param status register status
+ *
+ * @return result
+ */
+sfud_err sfud_write_status(const sfud_flash *flash, bool is_volatile, uint8_t status) {
     sfud_err result = SFUD_SUCCESS;
     const sfud_spi *spi = &flash->spi;
     uint8_t cmd_data[2];
 
     SFUD_ASSERT(flash);
 
-    cmd_data[0] = SFUD_CMD_ENABLE_RESET;
-    result = spi->wr(spi, cmd_data, 1, NULL, 0);
-    if (result != SFUD_SUCCESS) {
-        goto __failed;
+    if (is_volatile) {
+        cmd_data[0] = SFUD_VOLATILE_SR_WRITE_ENABLE;
+        result = spi->wr(spi, cmd_data, 1, NULL, 0);
+        idle_set(flash, false);
+    } else {
+        result = set_write_enabled(flash, true);
     }
-    result = wait_busy(flash);
-
-    cmd_data[1] = SFUD_CMD_RESET;
-    result = spi->wr(spi, &cmd_data[1], 1, NULL, 0);
 
     if (result == SFUD_SUCCESS) {
-        result = wait_busy(flash);
-    }
-
-    if (result != SFUD_SUCCESS) {
-        goto __failed;
+        cmd_data[0] = SFUD_CMD_WRITE_STATUS_REGISTER;
+        cmd_data[1] = status;
+        result = spi->wr(spi, cmd_data, 2, NULL, 0);
     }
-    SFUD_DEBUG("Flash device reset success.");
 
-    __failed:
     if (result != SFUD_SUCCESS) {
-        SFUD_INFO("Error: Flash device reset failed.");
+        SFUD_INFO("Error: Write_status register failed.");
     }
 
     return result;
 }
 
-static sfud_err read_jedec_id(sfud_flash *flash) {
-    sfud_err result = SFUD_SUCCESS;
-    const sfud_spi *spi = &flash->spi;
-    uint8_t cmd_data[1], recv_data[3];
+#ifdef SFUD_USING_PROBE_CACHE
+/**
+ * check value (FNV-1a) of the probe cache descriptor, the check field is not included
+ */
+static uint32_t probe_cache_check(const sfud_probe_cache *cache) {
+    const uint8_t *data = (const uint8_t *) cache;
+    uint32_t hash = 0x811C9DC5 ^ SFUD_PROBE_CACHE_VERSION;
+    size_t i;
 
-    SFUD_ASSERT(flash);
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    /* the geometry of both parts, the descriptor of a single part build doesn't check */
+    hash ^= 0x100;
+#endif
 
-    cmd_data[0] = SFUD_CMD_JEDEC_ID;
-    result = spi->wr(spi, cmd_data, sizeof(cmd_data), recv_data, sizeof(recv_data));
-    if (result == SFUD_SUCCESS) {
-        flash->chip.mf_id = recv_data[0];
-        flash->chip.type_id = recv_data[1];
-        flash->chip.capacity_id = recv_data[2];
-        SFUD_DEBUG("The flash device manufacturer ID is 0x%02X, memory type ID is 0x%02X, capacity ID is 0x%02X.",
-                   flash->chip.mf_id, flash->chip.type_id, flash->chip.capacity_id);
-    } else {
-        SFUD_INFO("Error: Read flash device JEDEC ID error.");
+    for (i = 0; i < offsetof(sfud_probe_cache, check); i++) {
+        hash = (hash ^ data[i]) * 0x01000193;
     }
 
-    return result;
+    return hash;
 }
 
 /**
- * set the flash write enable or write disable
+ * get the probe cache descriptor which matches the flash JEDEC ID
  *
- * @param flash flash device
- * @param enabled true: enable  false: disable
+ * @param flash flash device, JEDEC ID must be read
+ * @param cache the found descriptor
  *
- * @return result
+ * @return true: found
  */
-static sfud_err set_write_enabled(const sfud_flash *flash, bool enabled) {
-    sfud_err result = SFUD_SUCCESS;
-    uint8_t cmd, register_status;
-
-    SFUD_ASSERT(flash);
-
-    if (enabled) {
-        cmd = SFUD_CMD_WRITE_ENABLE;
-    } else {
-        cmd = SFUD_CMD_WRITE_DISABLE;
-    }
-
-    result = flash->spi.wr(&flash->spi, &cmd, 1, NULL, 0);
-
-    if (result == SFUD_SUCCESS) {
-        result = sfud_read_status(flash, &register_status);
+static bool probe_cache_get(const sfud_flash *flash, sfud_probe_cache *cache) {
+    if (!sfud_port_probe_cache_read(flash, cache)) {
+        return false;
     }
-
-    if (result == SFUD_SUCCESS) {
-        if (enabled && (register_status & SFUD_STATUS_REGISTER_WEL) == 0) {
-            SFUD_INFO("Error: Can't enable write status.");
-            return SFUD_ERR_WRITE;
-        } else if (!enabled && (register_status & SFUD_STATUS_REGISTER_WEL) != 0) {
-            SFUD_INFO("Error: Can't disable write status.");
-            return SFUD_ERR_WRITE;
-        }
+    if (cache->magic != SFUD_PROBE_CACHE_MAGIC || cache->check != probe_cache_check(cache)) {
+        return false;
     }
 
-    return result;
+    return cache->mf_id == flash->chip.mf_id && cache->type_id == flash->chip.type_id
+           && cache->capacity_id == flash->chip.capacity_id;
 }
 
 /**
- * enable or disable 4-Byte addressing for flash
- *
- * @note The 4-Byte addressing just supported for the flash capacity which is large then 16MB (256Mb).
+ * load the chip parameters from the probe cache descriptor
  *
- * @param flash flash device
- * @param enabled true: enable   false: disable
+ * @param flash flash device, JEDEC ID must be read
  *
- * @return result
+ * @return true: loaded, SFDP and flash chip table are not needed
  */
-static sfud_err set_4_byte_address_mode(sfud_flash *flash, bool enabled) {
-    sfud_err result = SFUD_SUCCESS;
-    uint8_t cmd;
-
-    SFUD_ASSERT(flash);
-
-    /* set the flash write enable */
-    result = set_write_enabled(flash, true);
-    if (result != SFUD_SUCCESS) {
-        return result;
-    }
+static bool probe_cache_load(sfud_flash *flash) {
+    sfud_probe_cache cache;
 
-    if (enabled) {
-        cmd = SFUD_CMD_ENTER_4B_ADDRESS_MODE;
-    } else {
-        cmd = SFUD_CMD_EXIT_4B_ADDRESS_MODE;
+    if (!probe_cache_get(flash, &cache)) {
+        return false;
     }
 
-    result = flash->spi.wr(&flash->spi, &cmd, 1, NULL, 0);
-
-    if (result == SFUD_SUCCESS) {
-        flash->addr_in_4_byte = enabled ? true : false;
-        SFUD_DEBUG("%s 4-Byte addressing mode success.", enabled ? "Enter" : "Exit");
-    } else {
-        SFUD_INFO("Error: %s 4-Byte addressing mode failed.", enabled ? "Enter" : "Exit");
-    }
+    flash->chip.name = NULL;
+    flash->chip.capacity = cache.capacity;
+    flash->chip.write_mode = cache.write_mode;
+    flash->chip.erase_gran = cache.erase_gran;
+    flash->chip.erase_gran_cmd = cache.erase_gran_cmd;
+#ifdef SFUD_USING_SFDP
+    size_t i;
+    flash->sfdp.available = cache.sfdp_available;
+    flash->sfdp.capacity = cache.capacity;
+    for (i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        flash->sfdp.eraser[i].size = cache.eraser[i].size_shift ? 1UL << cache.eraser[i].size_shift : 0;
+        flash->sfdp.eraser[i].cmd = cache.eraser[i].cmd;
+        flash->sfdp.eraser[i].cmd_4b = cache.eraser[i].cmd_4b;
+        flash->sfdp.eraser[i].time_typ = cache.eraser[i].time_typ;
+        flash->sfdp.eraser[i].time_max = cache.eraser[i].time_max;
+    }
+    flash->sfdp.program_time_typ = cache.program_time_typ;
+    flash->sfdp.program_time_max = cache.program_time_max;
+    flash->sfdp.chip_erase_time_typ = cache.chip_erase_time_typ;
+    flash->sfdp.chip_erase_time_max = cache.chip_erase_time_max;
+    flash->sfdp.inst_4_byte = cache.inst_4_byte;
+    flash->sfdp.suspend_cmd = cache.suspend_cmd;
+    flash->sfdp.resume_cmd = cache.resume_cmd;
+    flash->sfdp.program_suspend_cmd = cache.program_suspend_cmd;
+    flash->sfdp.program_resume_cmd = cache.program_resume_cmd;
+    flash->sfdp.quad_enable = cache.quad_enable;
+    flash->sfdp.qe_vola_we_cmd = cache.qe_vola_we_cmd;
+    flash->sfdp.qpi_enable = cache.qpi_enable;
+    flash->sfdp.qpi_disable = cache.qpi_disable;
+    flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].cmd = cache.qpi_read_cmd;
+    flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].dummy_cycles = cache.qpi_read_dummy_cycles;
+    flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].mode_cycles = cache.qpi_read_mode_cycles;
+#endif
+    SFUD_DEBUG("The %s flash device parameters are loaded from the probe cache.", flash->name);
 
-    return result;
+    return true;
 }
 
 /**
- * read flash register status
+ * save the resolved chip parameters to the probe cache descriptor
  *
  * @param flash flash device
- * @param status register status
- *
- * @return result
+ * @param read_data_lines data_line_width of the current read_cmd_format, 0: not set
  */
-sfud_err sfud_read_status(const sfud_flash *flash, uint8_t *status) {
-    uint8_t cmd = SFUD_CMD_READ_STATUS_REGISTER;
+static void probe_cache_save(const sfud_flash *flash, uint8_t read_data_lines) {
+    sfud_probe_cache cache;
 
-    SFUD_ASSERT(flash);
-    SFUD_ASSERT(status);
+    if (flash->chip.capacity == 0 || flash->chip.write_mode == 0 || flash->chip.erase_gran == 0
+        || flash->chip.erase_gran_cmd == 0) {
+        return;
+    }
+
+    /* clear the padding too, it is part of the check value */
+    memset(&cache, 0, sizeof(cache));
+    cache.magic = SFUD_PROBE_CACHE_MAGIC;
+    cache.mf_id = flash->chip.mf_id;
+    cache.type_id = flash->chip.type_id;
+    cache.capacity_id = flash->chip.capacity_id;
+    cache.erase_gran_cmd = flash->chip.erase_gran_cmd;
+    cache.capacity = flash->chip.capacity;
+    cache.erase_gran = flash->chip.erase_gran;
+    cache.write_mode = flash->chip.write_mode;
+#ifdef SFUD_USING_SFDP
+    size_t i;
+    uint8_t shift;
+    cache.sfdp_available = flash->sfdp.available;
+    for (i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        /* SFDP erase sizes are always power of 2 */
+        for (shift = 0; flash->sfdp.eraser[i].size > (1UL << shift) && shift < 31; shift++);
+        cache.eraser[i].size_shift = flash->sfdp.eraser[i].size ? shift : 0;
+        cache.eraser[i].cmd = flash->sfdp.eraser[i].cmd;
+        cache.eraser[i].cmd_4b = flash->sfdp.eraser[i].cmd_4b;
+        cache.eraser[i].time_typ = flash->sfdp.eraser[i].time_typ;
+        cache.eraser[i].time_max = flash->sfdp.eraser[i].time_max;
+    }
+    cache.program_time_typ = flash->sfdp.program_time_typ;
+    cache.program_time_max = flash->sfdp.program_time_max;
+    cache.chip_erase_time_typ = flash->sfdp.chip_erase_time_typ;
+    cache.chip_erase_time_max = flash->sfdp.chip_erase_time_max;
+    cache.inst_4_byte = flash->sfdp.inst_4_byte;
+    cache.suspend_cmd = flash->sfdp.suspend_cmd;
+    cache.resume_cmd = flash->sfdp.resume_cmd;
+    cache.program_suspend_cmd = flash->sfdp.program_suspend_cmd;
+    cache.program_resume_cmd = flash->sfdp.program_resume_cmd;
+    cache.quad_enable = flash->sfdp.quad_enable;
+    cache.qe_vola_we_cmd = flash->sfdp.qe_vola_we_cmd;
+    cache.qpi_enable = flash->sfdp.qpi_enable;
+    cache.qpi_disable = flash->sfdp.qpi_disable;
+    cache.qpi_read_cmd = flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].cmd;
+    cache.qpi_read_dummy_cycles = flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].dummy_cycles;
+    cache.qpi_read_mode_cycles = flash->sfdp.fast_read[SFUD_SFDP_READ_4_4_4].mode_cycles;
+#endif
+#ifdef SFUD_USING_QSPI
+    cache.read_data_lines = read_data_lines;
+    cache.read_cmd_format = flash->read_cmd_format;
+    cache.write_cmd_format = flash->write_cmd_format;
+#endif
+    cache.check = probe_cache_check(&cache);
 
-    return flash->spi.wr(&flash->spi, &cmd, 1, status, 1);
+    sfud_port_probe_cache_write(flash, &cache);
 }
+#endif /* SFUD_USING_PROBE_CACHE */
 
-static sfud_err wait_busy(const sfud_flash *flash) {
-    sfud_err result = SFUD_SUCCESS;
-    uint8_t status;
-    size_t retry_times = flash->retry.times;
-
-    SFUD_ASSERT(flash);
-
-    while (true) {
-        result = sfud_read_status(flash, &status);
-        if (result == SFUD_SUCCESS && ((status & SFUD_STATUS_REGISTER_BUSY)) == 0) {
-            break;
-        }
-        /* retry counts */
-        SFUD_RETRY_PROCESS(flash->retry.delay, retry_times, result);
+#ifdef SFUD_USING_STATS
+/**
+ * @return counters of the device, NULL: not a device of the flash table
+ */
+static sfud_stats *stats_of(const sfud_flash *flash) {
+    if (flash->index >= STATS_DEVICE_NUM || &flash_table[flash->index] != flash) {
+        return NULL;
     }
+    return &flash_stats[flash->index];
+}
 
-    if (result != SFUD_SUCCESS || ((status & SFUD_STATUS_REGISTER_BUSY)) != 0) {
-        SFUD_INFO("Error: Flash wait busy has an error.");
-    }
+/**
+ * start timing an operation, it becomes the one the busy time, the retries and the bus errors go to unless an
+ * outer one runs
+ *
+ * @return start time for stats_end()
+ */
+static uint32_t stats_begin(const sfud_flash *flash, sfud_stats_op op) {
+    sfud_stats *stats = stats_of(flash);
 
-    return result;
+    if (stats && !stats_active[flash->index]) {
+        stats_active[flash->index] = &stats->op[op];
+    }
+    return sfud_port_time_us();
 }
 
-static void make_address_byte_array(const sfud_flash *flash, uint32_t addr, uint8_t *array) {
-    uint8_t len, i;
+static void stats_end(const sfud_flash *flash, sfud_stats_op op, uint32_t start, size_t bytes) {
+    sfud_stats *stats = stats_of(flash);
+    sfud_stats_entry *entry;
+    uint32_t us = sfud_port_time_us() - start;
 
-    SFUD_ASSERT(flash);
-    SFUD_ASSERT(array);
+    if (!stats) {
+        return;
+    }
+    entry = &stats->op[op];
+    entry->count++;
+    entry->bytes += bytes;
+    entry->total_us += us;
+    if (us > entry->max_us) {
+        entry->max_us = us;
+    }
+    if (stats_active[flash->index] == entry) {
+        stats_active[flash->index] = NULL;
+    }
+}
 
-    len = flash->addr_in_4_byte ? 4 : 3;
+/**
+ * add a wait of the flash
+ *
+ * @param op operation type it goes to, SFUD_STATS_OP_NUM: the running one
+ * @param start stats_now() before the wait
+ * @param retries SFUD_RETRY_PROCESS delays of the wait
+ */
+static void stats_busy(const sfud_flash *flash, sfud_stats_op op, uint32_t start, uint32_t retries) {
+    sfud_stats *stats = stats_of(flash);
+    sfud_stats_entry *entry;
 
-    for (i = 0; i < len; i++) {
-        array[i] = (addr >> ((len - (i + 1)) * 8)) & 0xFF;
+    if (!stats) {
+        return;
+    }
+    entry = op < SFUD_STATS_OP_NUM ? &stats->op[op] : stats_active[flash->index];
+    if (entry) {
+        entry->busy_us += sfud_port_time_us() - start;
+        entry->retries += retries;
     }
 }
 
 /**
- * write status register
- *
- * @param flash flash device
- * @param is_volatile true: volatile mode, false: non-volatile mode
- * @param status register status
+ * count a failed bus call for the running operation
  *
  * @return result
  */
-sfud_err sfud_write_status(const sfud_flash *flash, bool is_volatile, uint8_t status) {
-    sfud_err result = SFUD_SUCCESS;
-    const sfud_spi *spi = &flash->spi;
-    uint8_t cmd_data[2];
+static sfud_err stats_bus(const sfud_flash *flash, sfud_err result) {
+    sfud_stats *stats;
+
+    if (result != SFUD_SUCCESS && (stats = stats_of(flash)) && stats_active[flash->index]) {
+        stats_active[flash->index]->bus_errors++;
+    }
+    return result;
+}
 
+const sfud_stats *sfud_get_stats(const sfud_flash *flash) {
     SFUD_ASSERT(flash);
 
-    if (is_volatile) {
-        cmd_data[0] = SFUD_VOLATILE_SR_WRITE_ENABLE;
-        result = spi->wr(spi, cmd_data, 1, NULL, 0);
-    } else {
-        result = set_write_enabled(flash, true);
-    }
+    return stats_of(flash);
+}
 
-    if (result == SFUD_SUCCESS) {
-        cmd_data[0] = SFUD_CMD_WRITE_STATUS_REGISTER;
-        cmd_data[1] = status;
-        result = spi->wr(spi, cmd_data, 2, NULL, 0);
-    }
+void sfud_reset_stats(const sfud_flash *flash) {
+    sfud_stats *stats;
 
-    if (result != SFUD_SUCCESS) {
-        SFUD_INFO("Error: Write_status register failed.");
-    }
+    SFUD_ASSERT(flash);
 
-    return result;
+    stats = stats_of(flash);
+    if (stats) {
+        memset(stats, 0, sizeof(sfud_stats));
+    }
 }
+#endif /* SFUD_USING_STATS */
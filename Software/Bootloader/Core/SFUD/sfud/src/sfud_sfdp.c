@@ -31,6 +31,7 @@
  */
 
 #include "sfud.h"
+#include <string.h>
 
 /**
  * JEDEC Standard JESD216 Terms and definitions:
@@ -50,6 +51,22 @@
 #define BASIC_TABLE_LEN                             9
 /* the smallest eraser in SFDP eraser table */
 #define SMALLEST_ERASER_INDEX                       0
+/* the 4-Byte address instruction table ID (MSB << 8 | LSB) and length (DWORDs) on JESD216B */
+#define INST_4_BYTE_TABLE_ID                        0xFF84
+#define INST_4_BYTE_TABLE_LEN                       2
+/* the erase types are on the 8th and 9th DWORD of the JEDEC basic flash parameter table */
+#define BASIC_TABLE_ERASE_TYPE_OFFSET               28
+/* the suspend and resume are on the 12th and 13th DWORD of the JEDEC basic flash parameter table on JESD216A */
+#define BASIC_TABLE_SUSPEND_OFFSET                  44
+#define BASIC_TABLE_SUSPEND_MIN_LEN                 13
+/* the quad enable requirement is on the 15th DWORD of the JEDEC basic flash parameter table on JESD216A */
+#define BASIC_TABLE_QE_OFFSET                       56
+#define BASIC_TABLE_QE_MIN_LEN                      15
+/* the 16th DWORD tells how the status register 1 is written, volatile or not */
+#define BASIC_TABLE_SR1_MIN_LEN                     16
+/* the erase, program and chip erase times are on the 10th and 11th DWORD of the JEDEC basic flash parameter table
+ * on JESD216A, the erase types of the 8th and 9th DWORD are read along */
+#define BASIC_TABLE_TIME_MIN_LEN                    11
 /**
  *  SFDP parameter header structure
  */
@@ -65,10 +82,10 @@ static sfud_err read_sfdp_data(const sfud_flash *flash, uint32_t addr, uint8_t *
 static bool read_sfdp_header(sfud_flash *flash);
 static bool read_basic_header(const sfud_flash *flash, sfdp_para_header *basic_header);
 static bool read_basic_table(sfud_flash *flash, sfdp_para_header *basic_header);
-
-/* ../port/sfup_port.c */
-extern void sfud_log_debug(const char *file, const long line, const char *format, ...);
-extern void sfud_log_info(const char *format, ...);
+static void read_4_byte_inst_table(sfud_flash *flash, sfdp_para_header *basic_header);
+static void read_suspend_inst(sfud_flash *flash, sfdp_para_header *basic_header);
+static void read_quad_enable_req(sfud_flash *flash, sfdp_para_header *basic_header);
+static void read_times(sfud_flash *flash, sfdp_para_header *basic_header);
 
 /**
  * Read SFDP parameter information
@@ -83,7 +100,14 @@ bool sfud_read_sfdp(sfud_flash *flash) {
     /* JEDEC basic flash parameter header */
     sfdp_para_header basic_header;
     if (read_sfdp_header(flash) && read_basic_header(flash, &basic_header)) {
-        return read_basic_table(flash, &basic_header);
+        if (!read_basic_table(flash, &basic_header)) {
+            return false;
+        }
+        read_4_byte_inst_table(flash, &basic_header);
+        read_suspend_inst(flash, &basic_header);
+        read_quad_enable_req(flash, &basic_header);
+        read_times(flash, &basic_header);
+        return true;
     } else {
         SFUD_INFO("Warning: Read SFDP parameter header information failed. The %s does not support JEDEC SFDP.", flash->name);
         return false;
@@ -124,6 +148,8 @@ static bool read_sfdp_header(sfud_flash *flash) {
     }
     sfdp->minor_rev = header[4];
     sfdp->major_rev = header[5];
+    /* NPH is 0-based */
+    sfdp->header_num = header[6] + 1;
     if (sfdp->major_rev > SUPPORT_MAX_SFDP_MAJOR_REV) {
         SFUD_INFO("Error: This reversion(V%d.%d) of SFDP is not supported.", sfdp->major_rev, sfdp->minor_rev);
         return false;
@@ -177,6 +203,24 @@ static bool read_basic_header(const sfud_flash *flash, sfdp_para_header *basic_h
     return true;
 }
 
+/**
+ * Get a fast read of the JEDEC basic flash parameter table, the 3rd and 4th DWORD have two of them each.
+ *
+ * @param sfdp SFDP parameter info
+ * @param index SFUD_SFDP_READ_xxx
+ * @param entry the half of the DWORD: wait states in bits 4:0, mode clocks in bits 7:5, then the instruction
+ */
+static void read_fast_read(sfud_sfdp *sfdp, uint8_t index, const uint8_t *entry) {
+    static const char *const name[SFUD_SFDP_READ_NUM] = { "1-1-2", "1-2-2", "1-1-4", "1-4-4", "4-4-4" };
+
+    sfdp->fast_read[index].cmd = entry[1];
+    sfdp->fast_read[index].dummy_cycles = entry[0] & 0x1F;
+    sfdp->fast_read[index].mode_cycles = entry[0] >> 5;
+    SFUD_DEBUG("Flash device supports %s fast read. Command is 0x%02X, %d mode and %d dummy clocks.",
+            name[index], entry[1], entry[0] >> 5, entry[0] & 0x1F);
+    (void) name;
+}
+
 /**
  * Read JEDEC basic parameter table
  *
@@ -286,6 +330,24 @@ static bool read_basic_table(sfud_flash *flash, sfdp_para_header *basic_header)
         SFUD_INFO("Error: Read address bytes error!");
         return false;
     }
+    /* get the fast reads, bit 16: 1-1-2, bit 20: 1-2-2, bit 21: 1-4-4, bit 22: 1-1-4 of the 1st DWORD */
+    memset(sfdp->fast_read, 0, sizeof(sfdp->fast_read));
+    if (table[2] & 0x01) {
+        read_fast_read(sfdp, SFUD_SFDP_READ_1_1_2, &table[12]);
+    }
+    if (table[2] & 0x10) {
+        read_fast_read(sfdp, SFUD_SFDP_READ_1_2_2, &table[14]);
+    }
+    if (table[2] & 0x40) {
+        read_fast_read(sfdp, SFUD_SFDP_READ_1_1_4, &table[10]);
+    }
+    if (table[2] & 0x20) {
+        read_fast_read(sfdp, SFUD_SFDP_READ_1_4_4, &table[8]);
+    }
+    /* bit 4 of the 5th DWORD: 4-4-4, the upper half of the 7th DWORD */
+    if (table[16] & 0x10) {
+        read_fast_read(sfdp, SFUD_SFDP_READ_4_4_4, &table[26]);
+    }
     /* get flash memory capacity */
     uint32_t table2_temp = ((long)table[7] << 24) | ((long)table[6] << 16) | ((long)table[5] << 8) | (long)table[4];
     switch ((table[7] & (0x01 << 7)) >> 7) {
@@ -308,6 +370,7 @@ static bool read_basic_table(sfud_flash *flash, sfdp_para_header *basic_header)
         if (table[28 + 2 * i] != 0x00) {
             sfdp->eraser[j].size = 1L << table[28 + 2 * i];
             sfdp->eraser[j].cmd = table[28 + 2 * i + 1];
+            sfdp->eraser[j].cmd_4b = 0;
             SFUD_DEBUG("Flash device supports %ldKB block erase. Command is 0x%02X.", sfdp->eraser[j].size / 1024,
                     sfdp->eraser[j].cmd);
             j++;
@@ -321,10 +384,13 @@ static bool read_basic_table(sfud_flash *flash, sfdp_para_header *basic_header)
                     /* swap the small eraser */
                     uint32_t temp_size = sfdp->eraser[i].size;
                     uint8_t temp_cmd = sfdp->eraser[i].cmd;
+                    uint8_t temp_cmd_4b = sfdp->eraser[i].cmd_4b;
                     sfdp->eraser[i].size = sfdp->eraser[j].size;
                     sfdp->eraser[i].cmd = sfdp->eraser[j].cmd;
+                    sfdp->eraser[i].cmd_4b = sfdp->eraser[j].cmd_4b;
                     sfdp->eraser[j].size = temp_size;
                     sfdp->eraser[j].cmd = temp_cmd;
+                    sfdp->eraser[j].cmd_4b = temp_cmd_4b;
                 }
             }
         }
@@ -334,6 +400,206 @@ static bool read_basic_table(sfud_flash *flash, sfdp_para_header *basic_header)
     return true;
 }
 
+/**
+ * Read the optional 4-Byte address instruction table, it is fine when the flash doesn't have it.
+ *
+ * @param flash flash device, the JEDEC basic parameter table must be read
+ * @param basic_header JEDEC basic flash parameter header
+ */
+static void read_4_byte_inst_table(sfud_flash *flash, sfdp_para_header *basic_header) {
+    sfud_sfdp *sfdp = &flash->sfdp;
+    /* each parameter header being 2 DWORDs (64-bit) */
+    uint8_t header[2 * 4] = { 0 };
+    uint8_t table[INST_4_BYTE_TABLE_LEN * 4] = { 0 }, erase_type[SFUD_SFDP_ERASE_TYPE_MAX_NUM * 2] = { 0 }, i, j;
+    uint32_t table_addr = 0;
+
+    sfdp->inst_4_byte = 0;
+    /* the basic parameter header is the first one */
+    for (i = 1; i < sfdp->header_num; i++) {
+        if (read_sfdp_data(flash, 8 + 8 * i, header, sizeof(header)) != SFUD_SUCCESS) {
+            return;
+        }
+        if ((header[7] << 8 | header[0]) == INST_4_BYTE_TABLE_ID && header[3] >= INST_4_BYTE_TABLE_LEN) {
+            table_addr = (long)header[4] | (long)header[5] << 8 | (long)header[6] << 16;
+            break;
+        }
+    }
+    if (table_addr == 0) {
+        return;
+    }
+    /* the 4-Byte erase commands are ordered by the erase types of the basic table, the eraser table is sorted */
+    if (read_sfdp_data(flash, table_addr, table, sizeof(table)) != SFUD_SUCCESS
+            || read_sfdp_data(flash, basic_header->ptp + BASIC_TABLE_ERASE_TYPE_OFFSET, erase_type,
+                    sizeof(erase_type)) != SFUD_SUCCESS) {
+        SFUD_INFO("Warning: Can't read 4-Byte address instruction table.");
+        return;
+    }
+    sfdp->inst_4_byte = ((long)table[3] << 24) | ((long)table[2] << 16) | ((long)table[1] << 8) | (long)table[0];
+    for (i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        /* erase type 1~4 are bit 9~12 */
+        if (erase_type[2 * i] == 0x00 || !(sfdp->inst_4_byte & (1UL << (9 + i)))) {
+            continue;
+        }
+        for (j = 0; j < SFUD_SFDP_ERASE_TYPE_MAX_NUM; j++) {
+            if (sfdp->eraser[j].size == 1L << erase_type[2 * i] && sfdp->eraser[j].cmd == erase_type[2 * i + 1]) {
+                sfdp->eraser[j].cmd_4b = table[4 + i];
+                SFUD_DEBUG("Flash device supports %ldKB block erase with 4-Byte address. Command is 0x%02X.",
+                        sfdp->eraser[j].size / 1024, sfdp->eraser[j].cmd_4b);
+            }
+        }
+    }
+    SFUD_DEBUG("Flash device has the 4-Byte address instruction table (0x%08lX).", sfdp->inst_4_byte);
+}
+
+/**
+ * Read the suspend and resume instructions of the JEDEC basic flash parameter table, newer than the JESD216 (V1.0)
+ * initial release one.
+ *
+ * @param flash flash device, the JEDEC basic parameter table must be read
+ * @param basic_header JEDEC basic flash parameter header
+ */
+static void read_suspend_inst(sfud_flash *flash, sfdp_para_header *basic_header) {
+    sfud_sfdp *sfdp = &flash->sfdp;
+    /* 12th and 13th DWORD */
+    uint8_t table[2 * 4] = { 0 };
+
+    sfdp->suspend_cmd = 0;
+    sfdp->resume_cmd = 0;
+    sfdp->program_suspend_cmd = 0;
+    sfdp->program_resume_cmd = 0;
+    if (basic_header->len < BASIC_TABLE_SUSPEND_MIN_LEN) {
+        return;
+    }
+    if (read_sfdp_data(flash, basic_header->ptp + BASIC_TABLE_SUSPEND_OFFSET, table, sizeof(table)) != SFUD_SUCCESS) {
+        SFUD_INFO("Warning: Can't read the suspend and resume instructions.");
+        return;
+    }
+    /* bit 31 of the 12th DWORD: 0 = suspend and resume supported */
+    if (table[3] & 0x80) {
+        return;
+    }
+    sfdp->program_resume_cmd = table[4];
+    sfdp->program_suspend_cmd = table[5];
+    sfdp->resume_cmd = table[6];
+    sfdp->suspend_cmd = table[7];
+    SFUD_DEBUG("Flash device supports suspend 0x%02X/0x%02X and resume 0x%02X/0x%02X (erase/program).",
+            sfdp->suspend_cmd, sfdp->program_suspend_cmd, sfdp->resume_cmd, sfdp->program_resume_cmd);
+}
+
+/**
+ * Read the quad enable requirement of the JEDEC basic flash parameter table, newer than the JESD216 (V1.0)
+ * initial release one.
+ *
+ * @param flash flash device, the JEDEC basic parameter table must be read
+ * @param basic_header JEDEC basic flash parameter header
+ */
+static void read_quad_enable_req(sfud_flash *flash, sfdp_para_header *basic_header) {
+    sfud_sfdp *sfdp = &flash->sfdp;
+    /* 15th and 16th DWORDs */
+    uint8_t table[8] = { 0 };
+    size_t len = basic_header->len < BASIC_TABLE_SR1_MIN_LEN ? 4 : 8;
+
+    sfdp->quad_enable = SFUD_SFDP_QE_UNKNOWN;
+    sfdp->qe_vola_we_cmd = 0;
+    sfdp->qpi_enable = 0;
+    sfdp->qpi_disable = 0;
+    if (basic_header->len < BASIC_TABLE_QE_MIN_LEN) {
+        return;
+    }
+    if (read_sfdp_data(flash, basic_header->ptp + BASIC_TABLE_QE_OFFSET, table, len) != SFUD_SUCCESS) {
+        SFUD_INFO("Warning: Can't read the quad enable requirement.");
+        return;
+    }
+    /* bits 22:20, the values past 6 are reserved */
+    sfdp->quad_enable = (table[2] >> 4) & 0x07;
+    if (sfdp->quad_enable > SFUD_SFDP_QE_SR2_BIT1_31) {
+        sfdp->quad_enable = SFUD_SFDP_QE_UNKNOWN;
+    }
+    /* bits 8:4 of the 15th DWORD enable the QPI mode, bits 3:0 disable it; the read-modify-write sequences of the
+       configuration registers (bits 8:7 and 2) aren't taken, nor the soft reset (bit 3), which drops the 4-Byte
+       addressing and a volatile QE bit along */
+    sfdp->qpi_enable = ((table[1] << 4) | (table[0] >> 4)) & (SFUD_SFDP_QPI_ENABLE_QE_38 | SFUD_SFDP_QPI_ENABLE_38
+            | SFUD_SFDP_QPI_ENABLE_35);
+    sfdp->qpi_disable = table[0] & (SFUD_SFDP_QPI_DISABLE_FF | SFUD_SFDP_QPI_DISABLE_F5);
+    /* bits 6:0 of the 16th DWORD: bit 2 volatile by 50h, bit 3 non-volatile with a volatile copy by 50h, bit 1
+       volatile by 06h; bit 0 alone, or bit 4 (a mix), is the non-volatile write */
+    if (table[4] & 0x0C) {
+        sfdp->qe_vola_we_cmd = SFUD_VOLATILE_SR_WRITE_ENABLE;
+    } else if (table[4] & 0x02) {
+        sfdp->qe_vola_we_cmd = SFUD_CMD_WRITE_ENABLE;
+    }
+    SFUD_DEBUG("Flash device quad enable requirement is %d, volatile write enable 0x%02X.", sfdp->quad_enable,
+               sfdp->qe_vola_we_cmd);
+    SFUD_DEBUG("Flash device QPI enable sequences 0x%02X, disable sequences 0x%02X.", sfdp->qpi_enable,
+               sfdp->qpi_disable);
+}
+
+/**
+ * Read the typical and maximum erase, page program and chip erase times of the JEDEC basic flash parameter table,
+ * newer than the JESD216 (V1.0) initial release one. wait_busy() of sfud.c sleeps for the typical time before it
+ * polls the status.
+ *
+ * @param flash flash device, the JEDEC basic parameter table must be read
+ * @param basic_header JEDEC basic flash parameter header
+ */
+static void read_times(sfud_flash *flash, sfdp_para_header *basic_header) {
+    /* erase time units of the 10th DWORD (ms), chip erase time units of the 11th DWORD (ms) */
+    static const uint16_t erase_unit[4] = { 1, 16, 128, 1000 }, chip_unit[4] = { 16, 256, 4000, 64000 };
+    sfud_sfdp *sfdp = &flash->sfdp;
+    /* 8th to 11th DWORD */
+    uint8_t table[4 * 4] = { 0 }, i, j, field;
+    uint32_t dw10, dw11, max_mul;
+
+    for (j = 0; j < SFUD_SFDP_ERASE_TYPE_MAX_NUM; j++) {
+        sfdp->eraser[j].time_typ = 0;
+        sfdp->eraser[j].time_max = 0;
+    }
+    sfdp->program_time_typ = 0;
+    sfdp->program_time_max = 0;
+    sfdp->chip_erase_time_typ = 0;
+    sfdp->chip_erase_time_max = 0;
+    if (basic_header->len < BASIC_TABLE_TIME_MIN_LEN) {
+        return;
+    }
+    if (read_sfdp_data(flash, basic_header->ptp + BASIC_TABLE_ERASE_TYPE_OFFSET, table, sizeof(table))
+            != SFUD_SUCCESS) {
+        SFUD_INFO("Warning: Can't read the erase and program times.");
+        return;
+    }
+    dw10 = ((uint32_t)table[11] << 24) | ((uint32_t)table[10] << 16) | ((uint32_t)table[9] << 8) | table[8];
+    dw11 = ((uint32_t)table[15] << 24) | ((uint32_t)table[14] << 16) | ((uint32_t)table[13] << 8) | table[12];
+    /* bits 3:0 of the 10th DWORD: maximum = typical * 2 * (count + 1), erase type n at bits (4 + 7n) up */
+    max_mul = 2 * ((dw10 & 0x0F) + 1);
+    for (i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        if (table[2 * i] == 0x00) {
+            continue;
+        }
+        /* count in bits 4:0, units in bits 6:5 */
+        field = (dw10 >> (4 + 7 * i)) & 0x7F;
+        /* the eraser table is sorted by size, the type is found by its size and command */
+        for (j = 0; j < SFUD_SFDP_ERASE_TYPE_MAX_NUM; j++) {
+            if (sfdp->eraser[j].size == 1UL << table[2 * i] && sfdp->eraser[j].cmd == table[2 * i + 1]) {
+                sfdp->eraser[j].time_typ = ((field & 0x1F) + 1) * erase_unit[field >> 5] * 1000UL;
+                sfdp->eraser[j].time_max = sfdp->eraser[j].time_typ * max_mul;
+                SFUD_DEBUG("Flash device %ldKB erase takes %ldus, %ldus at most.", sfdp->eraser[j].size / 1024,
+                        sfdp->eraser[j].time_typ, sfdp->eraser[j].time_max);
+            }
+        }
+    }
+    /* bits 3:0 of the 11th DWORD: the same for the program and chip erase times */
+    max_mul = 2 * ((dw11 & 0x0F) + 1);
+    /* page program: count in bits 12:8, units in bit 13, 8us or 64us */
+    field = (dw11 >> 8) & 0x3F;
+    sfdp->program_time_typ = ((field & 0x1F) + 1) * ((field & 0x20) ? 64 : 8);
+    sfdp->program_time_max = sfdp->program_time_typ * max_mul;
+    /* chip erase: count in bits 28:24, units in bits 30:29 */
+    field = (dw11 >> 24) & 0x7F;
+    sfdp->chip_erase_time_typ = ((field & 0x1F) + 1) * (uint32_t)chip_unit[field >> 5];
+    sfdp->chip_erase_time_max = sfdp->chip_erase_time_typ * max_mul;
+    SFUD_DEBUG("Flash device page program takes %ldus, %ldus at most, chip erase %ldms, %ldms at most.",
+            sfdp->program_time_typ, sfdp->program_time_max, sfdp->chip_erase_time_typ, sfdp->chip_erase_time_max);
+}
+
 static sfud_err read_sfdp_data(const sfud_flash *flash, uint32_t addr, uint8_t *read_buf, size_t size) {
     uint8_t cmd[] = {
             SFUD_CMD_READ_SFDP_REGISTER,
@@ -0,0 +1,147 @@
+/**
+ * @file boot_agent.c
+ * @brief RAM-resident programming agent, see boot_agent.h.
+ */
+#ifdef BOOT_AGENT
+
+#include "boot_agent.h"
+#include "boot_cmp.h"
+#include "boot_image.h"
+#include "boot_verify.h"
+#include "main.h"
+#include <elog.h>
+#include <sfud.h>
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "agent");
+
+boot_agent_mailbox boot_agent_box __attribute__((section(".boot_agent"), aligned(32)));
+
+/**
+ * program the pages of buf which aren't blank, a run of them in one sfud_write()
+ */
+static sfud_err agent_program(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *buf) {
+    size_t offset = 0, start, len;
+    sfud_err result;
+
+    if (size > BOOT_AGENT_BUF_SIZE) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    SCB_InvalidateDCache_by_Addr((void *) buf, (int32_t) ((size + 31) & ~(size_t) 31));
+    while (offset < size) {
+        /* split on the flash pages, the first one may be partial */
+        len = SFUD_WRITE_MAX_PAGE_SIZE - (addr + offset) % SFUD_WRITE_MAX_PAGE_SIZE;
+        if (len > size - offset) {
+            len = size - offset;
+        }
+        if (boot_cmp_blank(buf + offset, len)) {
+            offset += len;
+            continue;
+        }
+        start = offset;
+        while (offset < size && !boot_cmp_blank(buf + offset, len)) {
+            offset += len;
+            len = size - offset < SFUD_WRITE_MAX_PAGE_SIZE ? size - offset : SFUD_WRITE_MAX_PAGE_SIZE;
+        }
+        result = sfud_write(flash, addr + start, offset - start, buf + start);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+    }
+    return SFUD_SUCCESS;
+}
+
+/**
+ * CRC-32 of a flash range, read through the buffer of the slot by the MDMA / DMA1
+ */
+static sfud_err agent_crc(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t *buf, uint32_t *crc) {
+    size_t len;
+    sfud_err result;
+
+    *crc = 0;
+    while (size) {
+        len = size > BOOT_AGENT_BUF_SIZE ? BOOT_AGENT_BUF_SIZE : size;
+        result = sfud_read(flash, addr, len, buf);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+        *crc = boot_image_crc32(*crc, buf, len);
+        addr += len;
+        size -= len;
+    }
+    return SFUD_SUCCESS;
+}
+
+static sfud_err agent_command(boot_agent_slot *slot, uint8_t *buf) {
+    const sfud_flash *flash = sfud_get_device(slot->flash);
+    uint32_t crc;
+    sfud_err result;
+
+    if (!flash || !flash->init_ok) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    switch (slot->cmd) {
+    case BOOT_AGENT_CMD_ERASE:
+        boot_verify_dirty(flash, slot->addr, slot->size);
+        return sfud_erase(flash, slot->addr, slot->size);
+    case BOOT_AGENT_CMD_ERASE_CHIP:
+        boot_verify_dirty(flash, 0, flash->chip.capacity);
+        return sfud_chip_erase(flash);
+    case BOOT_AGENT_CMD_PROGRAM:
+        /* a program over data not erased by the agent changes it as well */
+        boot_verify_dirty(flash, slot->addr, slot->size);
+        return agent_program(flash, slot->addr, slot->size, buf);
+    case BOOT_AGENT_CMD_CRC:
+        result = agent_crc(flash, slot->addr, slot->size, buf, &crc);
+        /* no dirty line of buf left over the next data of the debugger */
+        SCB_CleanInvalidateDCache_by_Addr((uint32_t *) buf, BOOT_AGENT_BUF_SIZE);
+        slot->crc = crc;
+        return result;
+    default:
+        return SFUD_ERR_WRITE;
+    }
+}
+
+/**
+ * serve the mailbox, never returns
+ */
+void boot_agent_run(void) {
+    boot_agent_mailbox *box = &boot_agent_box;
+    boot_agent_slot *slot;
+    size_t next = 0;
+    sfud_err result;
+
+    memset(box, 0, offsetof(boot_agent_mailbox, buf));
+    box->version = BOOT_AGENT_VERSION;
+    box->buf_num = BOOT_AGENT_BUF_NUM;
+    box->buf_size = BOOT_AGENT_BUF_SIZE;
+    box->magic = BOOT_AGENT_MAGIC;
+    SCB_CleanDCache_by_Addr((uint32_t *) box, (int32_t) offsetof(boot_agent_mailbox, buf));
+    elog_i(TAG, "mailbox at 0x%08x, %u x %u bytes", (unsigned) (uintptr_t) box, BOOT_AGENT_BUF_NUM,
+           (unsigned) BOOT_AGENT_BUF_SIZE);
+
+    while (1) {
+        slot = &box->slot[next];
+        /* the debugger writes the slot behind the D-Cache */
+        SCB_InvalidateDCache_by_Addr((uint32_t *) slot, sizeof(boot_agent_slot));
+        if (slot->cmd == BOOT_AGENT_CMD_NONE) {
+            continue;
+        }
+        result = agent_command(slot, box->buf[next]);
+        slot->result = result;
+        box->done++;
+        if (result != SFUD_SUCCESS) {
+            box->errors++;
+            elog_w(TAG, "command %u at 0x%08x failed, error %d", (unsigned) slot->cmd, (unsigned) slot->addr, result);
+        }
+        /* the status first, then the slot is free */
+        SCB_CleanDCache_by_Addr((uint32_t *) box, (int32_t) offsetof(boot_agent_mailbox, slot));
+        SCB_CleanDCache_by_Addr((uint32_t *) slot, sizeof(boot_agent_slot));
+        __DSB();
+        slot->cmd = BOOT_AGENT_CMD_NONE;
+        SCB_CleanDCache_by_Addr((uint32_t *) slot, sizeof(boot_agent_slot));
+        next = (next + 1) % BOOT_AGENT_BUF_NUM;
+    }
+}
+
+#endif /* BOOT_AGENT */
@@ -0,0 +1,326 @@
+/**
+ * @file boot_bench.c
+ * @brief On-target benchmark of the two SFUD flashes, see boot_bench.h.
+ */
+#include "boot_bench.h"
+#include "boot_crc.h"
+#include "boot_ed25519.h"
+#include "boot_ext.h"
+#include "boot_hash.h"
+#include "boot_mem.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include "octospi.h"
+#include <elog.h>
+#include <elog_flash.h>
+#include <sfud.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_ROW_FMT                   "%-6s %-20s %10u %10u %9u.%03u\r\n"
+
+extern sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash);
+
+/* RFC 8032 test 1, the empty message */
+static const uint8_t ed25519_key[BOOT_ED25519_KEY_SIZE] = {
+    0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7, 0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,
+    0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25, 0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a,
+};
+static const uint8_t ed25519_sig[BOOT_ED25519_SIG_SIZE] = {
+    0xe5, 0x56, 0x43, 0x00, 0xc3, 0x60, 0xac, 0x72, 0x90, 0x86, 0xe2, 0xcc, 0x80, 0x6e, 0x82, 0x8a,
+    0x84, 0x87, 0x7f, 0x1e, 0xb8, 0xe5, 0xd9, 0x74, 0xd8, 0x73, 0xe0, 0x65, 0x22, 0x49, 0x01, 0x55,
+    0x5f, 0xb8, 0x82, 0x15, 0x90, 0xa3, 0x3b, 0xac, 0xc6, 0x1e, 0x39, 0x70, 0x1c, 0xf9, 0xb4, 0x6b,
+    0xd2, 0x5b, 0xf5, 0xf0, 0x59, 0x5b, 0xbe, 0x24, 0x65, 0x51, 0x41, 0x43, 0x8e, 0x7a, 0x10, 0x0b,
+};
+
+/* a temp buffer of the AXI arena while the bench runs, the MDMA and DMA1 both reach it */
+static uint8_t *bench_buf;
+
+static uint32_t bench_us(uint32_t start) {
+    return (uint32_t) ((uint64_t) (DWT->CYCCNT - start) * 1000000 / SystemCoreClock);
+}
+
+static void bench_row(const char *name, const char *test, uint32_t bytes, uint32_t us) {
+    /* bytes per us are MB/s */
+    uint32_t kbps = us ? (uint32_t) ((uint64_t) bytes * 1000 / us) : 0;
+
+    elog_raw(BENCH_ROW_FMT, name, test, bytes, us, kbps / 1000, kbps % 1000);
+}
+
+static void bench_fail(const char *name, const char *test, sfud_err result) {
+    elog_raw("%-6s %-20s failed, error %d\r\n", name, test, result);
+}
+
+static uint32_t bench_addr(const sfud_flash *flash) {
+    if (flash == sfud_get_device(SFUD_MAIN_FLASH)) {
+        return BOOT_BENCH_MAIN_ADDR;
+    }
+    return flash->chip.capacity - ELOG_FLASH_SECTOR_NUM * ELOG_FLASH_SECTOR_SIZE - BOOT_BENCH_AREA_SIZE;
+}
+
+/**
+ * erase the bench area a granule at a time, then in one go as SFUD picks the erase commands
+ */
+static bool bench_erase(const sfud_flash *flash, uint32_t addr) {
+    uint32_t gran = flash->chip.erase_gran, start, total = 0;
+    sfud_err result;
+    char test[24];
+
+    for (uint32_t offset = 0; offset < BOOT_BENCH_AREA_SIZE; offset += gran) {
+        start = DWT->CYCCNT;
+        result = sfud_erase(flash, addr + offset, gran);
+        total += bench_us(start);
+        if (result != SFUD_SUCCESS) {
+            bench_fail(flash->name, "erase", result);
+            return false;
+        }
+    }
+    snprintf(test, sizeof(test), "erase %uKB x%u", (unsigned) (gran / 1024), (unsigned) (BOOT_BENCH_AREA_SIZE / gran));
+    bench_row(flash->name, test, BOOT_BENCH_AREA_SIZE, total);
+
+    start = DWT->CYCCNT;
+    result = sfud_erase(flash, addr, BOOT_BENCH_AREA_SIZE);
+    if (result != SFUD_SUCCESS) {
+        bench_fail(flash->name, "erase", result);
+        return false;
+    }
+    snprintf(test, sizeof(test), "erase %uKB", (unsigned) (BOOT_BENCH_AREA_SIZE / 1024));
+    bench_row(flash->name, test, BOOT_BENCH_AREA_SIZE, bench_us(start));
+    return true;
+}
+
+static bool bench_program(const sfud_flash *flash, uint32_t addr) {
+    uint32_t start;
+    sfud_err result;
+
+    for (uint32_t i = 0; i < BOOT_BENCH_AREA_SIZE / sizeof(uint32_t); i++) {
+        ((uint32_t *) bench_buf)[i] = addr + i * sizeof(uint32_t);
+    }
+    start = DWT->CYCCNT;
+    result = sfud_write(flash, addr, BOOT_BENCH_AREA_SIZE, bench_buf);
+    if (result != SFUD_SUCCESS) {
+        bench_fail(flash->name, "program", result);
+        return false;
+    }
+    bench_row(flash->name, "program", BOOT_BENCH_AREA_SIZE, bench_us(start));
+    return true;
+}
+
+static void bench_read(sfud_flash *flash, uint32_t addr, uint8_t lines) {
+    uint32_t start;
+    sfud_err result;
+    char test[24];
+
+    snprintf(test, sizeof(test), "read x%u", lines);
+#ifdef SFUD_USING_QSPI
+    if (flash->spi.qspi_read && sfud_qspi_fast_read_enable(flash, lines) != SFUD_SUCCESS) {
+        bench_fail(flash->name, test, SFUD_ERR_READ);
+        return;
+    }
+#endif
+    boot_mem_fill(bench_buf, 0, BOOT_BENCH_AREA_SIZE, NULL);
+    boot_mem_wait();
+    start = DWT->CYCCNT;
+    result = sfud_read(flash, addr, BOOT_BENCH_AREA_SIZE, bench_buf);
+    if (result != SFUD_SUCCESS) {
+        bench_fail(flash->name, test, result);
+        return;
+    }
+    bench_row(flash->name, test, BOOT_BENCH_AREA_SIZE, bench_us(start));
+    if (((const uint32_t *) bench_buf)[BOOT_BENCH_AREA_SIZE / sizeof(uint32_t) - 1]
+            != addr + BOOT_BENCH_AREA_SIZE - sizeof(uint32_t)) {
+        elog_raw("%-6s %-20s read back mismatch\r\n", flash->name, test);
+    }
+}
+
+static void bench_hash(const sfud_flash *flash, uint32_t addr, uint32_t size) {
+    uint8_t digest[BOOT_HASH_SIZE];
+    uint32_t start = DWT->CYCCNT;
+    sfud_err result = hash_region(flash, addr, size, digest);
+
+    if (result != SFUD_SUCCESS) {
+        bench_fail(flash->name, "sha-256", result);
+        return;
+    }
+    bench_row(flash->name, "sha-256", size, bench_us(start));
+}
+
+/**
+ * one Ed25519 verification of a known good signature, in cycles, with the D-Cache warm
+ */
+static void bench_ed25519(void) {
+    uint32_t start = DWT->CYCCNT, cycles;
+    bool good = boot_ed25519_verify(ed25519_sig, NULL, 0, ed25519_key);
+
+    cycles = DWT->CYCCNT - start;
+    if (!good) {
+        elog_raw("%-6s %-20s failed, signature refused\r\n", "CPU", "ed25519 verify");
+        return;
+    }
+    elog_raw("%-6s %-20s %10s %10u %9u cycles\r\n", "CPU", "ed25519 verify", "-",
+             (unsigned) ((uint64_t) cycles * 1000000 / SystemCoreClock), (unsigned) cycles);
+}
+
+static void bench_crc(const char *name, const char *test, const void *buf, uint32_t size) {
+    uint32_t start = DWT->CYCCNT, crc;
+
+    if (!boot_crc32_hw(buf, size, &crc)) {
+        bench_fail(name, test, SFUD_ERR_READ);
+        return;
+    }
+    bench_row(name, test, size, bench_us(start));
+}
+
+/**
+ * the XIP window of the MAIN flash: memcpy, CRC and SHA-256
+ */
+static void bench_xip(sfud_flash *flash, uint32_t addr) {
+    const void *window = (const void *) (uintptr_t) (OCTOSPI1_BASE + addr);
+    uint32_t start;
+    sfud_err result = qspi_entry_memory_mapped_mode(flash);
+
+    if (result != SFUD_SUCCESS) {
+        bench_fail(flash->name, "memory-mapped", result);
+        return;
+    }
+
+    SCB_InvalidateDCache_by_Addr((void *) window, BOOT_BENCH_AREA_SIZE);
+    start = DWT->CYCCNT;
+    memcpy(bench_buf, window, BOOT_BENCH_AREA_SIZE);
+    bench_row(flash->name, "xip memcpy cold", BOOT_BENCH_AREA_SIZE, bench_us(start));
+    /* the window fits the 32KB D-Cache only in part, the warm figure is the cache at work */
+    start = DWT->CYCCNT;
+    memcpy(bench_buf, window, BOOT_BENCH_AREA_SIZE);
+    bench_row(flash->name, "xip memcpy warm", BOOT_BENCH_AREA_SIZE, bench_us(start));
+    /* the MDMA, the CPU free meanwhile; the window lines are clean, only bench_buf's get dropped */
+    start = DWT->CYCCNT;
+    boot_mem_copy(bench_buf, window, BOOT_BENCH_AREA_SIZE, NULL);
+    if (!boot_mem_wait()) {
+        bench_fail(flash->name, "xip mdma", SFUD_ERR_READ);
+    } else {
+        bench_row(flash->name, "xip mdma", BOOT_BENCH_AREA_SIZE, bench_us(start));
+    }
+
+    bench_crc(flash->name, "crc xip", (const void *) (uintptr_t) OCTOSPI1_BASE, BOOT_BENCH_XIP_SIZE);
+    bench_hash(flash, 0, BOOT_BENCH_XIP_SIZE);
+}
+
+static void bench_generic(sfud_flash *flash, uint32_t addr) {
+    elog_raw("%s: %s, JEDEC %02x %02x %02x, %uKB, %uKB erase granule, bench area 0x%06x\r\n", flash->name,
+             flash->chip.name ? flash->chip.name : "?", flash->chip.mf_id, flash->chip.type_id,
+             flash->chip.capacity_id, (unsigned) (flash->chip.capacity / 1024),
+             (unsigned) (flash->chip.erase_gran / 1024), (unsigned) addr);
+    if (!bench_erase(flash, addr) || !bench_program(flash, addr)) {
+        return;
+    }
+#ifdef SFUD_USING_QSPI
+    if (flash->spi.qspi_read) {
+        bench_read(flash, addr, 1);
+        bench_read(flash, addr, 2);
+        bench_read(flash, addr, 4);
+        return;
+    }
+#endif
+    bench_read(flash, addr, 1);
+    bench_hash(flash, addr, BOOT_BENCH_AREA_SIZE);
+}
+
+#ifdef SFUD_USING_PART_DRIVER
+/**
+ * erase, program and read the bench area again by the part driver of boot_part.h, at its quad read
+ */
+static void bench_part(sfud_flash *flash, uint32_t addr, const sfud_part *part) {
+    uint32_t start;
+    sfud_err result;
+
+    if (sfud_qspi_fast_read_enable(flash, 4) != SFUD_SUCCESS) {
+        bench_fail(flash->name, "part", SFUD_ERR_READ);
+        return;
+    }
+    flash->part = part;
+    start = DWT->CYCCNT;
+    result = sfud_erase(flash, addr, BOOT_BENCH_AREA_SIZE);
+    if (result != SFUD_SUCCESS) {
+        bench_fail(flash->name, "part erase", result);
+        return;
+    }
+    bench_row(flash->name, "part erase", BOOT_BENCH_AREA_SIZE, bench_us(start));
+
+    for (uint32_t i = 0; i < BOOT_BENCH_AREA_SIZE / sizeof(uint32_t); i++) {
+        ((uint32_t *) bench_buf)[i] = addr + i * sizeof(uint32_t);
+    }
+    start = DWT->CYCCNT;
+    result = sfud_write(flash, addr, BOOT_BENCH_AREA_SIZE, bench_buf);
+    if (result != SFUD_SUCCESS) {
+        bench_fail(flash->name, "part program", result);
+        return;
+    }
+    bench_row(flash->name, "part program", BOOT_BENCH_AREA_SIZE, bench_us(start));
+
+    boot_mem_fill(bench_buf, 0, BOOT_BENCH_AREA_SIZE, NULL);
+    boot_mem_wait();
+    start = DWT->CYCCNT;
+    result = sfud_read(flash, addr, BOOT_BENCH_AREA_SIZE, bench_buf);
+    if (result != SFUD_SUCCESS) {
+        bench_fail(flash->name, "part read", result);
+        return;
+    }
+    bench_row(flash->name, "part read", BOOT_BENCH_AREA_SIZE, bench_us(start));
+    if (((const uint32_t *) bench_buf)[BOOT_BENCH_AREA_SIZE / sizeof(uint32_t) - 1]
+            != addr + BOOT_BENCH_AREA_SIZE - sizeof(uint32_t)) {
+        elog_raw("%-6s %-20s read back mismatch\r\n", flash->name, "part read");
+    }
+}
+#endif /* SFUD_USING_PART_DRIVER */
+
+static void bench_flash(sfud_flash *flash) {
+    uint32_t addr = bench_addr(flash);
+#ifdef SFUD_USING_PART_DRIVER
+    const sfud_part *part = flash->part;
+
+    /* the generic SFUD paths first, then the part driver on the same area */
+    flash->part = NULL;
+    bench_generic(flash, addr);
+    if (part) {
+        bench_part(flash, addr, part);
+    }
+    flash->part = part;
+#else
+    bench_generic(flash, addr);
+#endif
+}
+
+/**
+ * measure both flashes and print the table, the MAIN flash is left in memory-mapped mode
+ */
+void boot_bench_run(void) {
+    sfud_flash *main_flash = sfud_get_device(SFUD_MAIN_FLASH), *ext_flash;
+    size_t mark = dma_alloc_mark(DMA_REGION_AXI);
+
+    bench_buf = dma_alloc_temp(BOOT_BENCH_AREA_SIZE, DMA_REGION_AXI);
+    if (!bench_buf) {
+        elog_raw("flash benchmark: no room for the %u bytes buffer\r\n", (unsigned) BOOT_BENCH_AREA_SIZE);
+        return;
+    }
+
+    /* up before the flush, it may start the flash log */
+    ext_flash = boot_ext_flash();
+#ifdef ELOG_PORT_FLASH_ENABLE
+    /* the log sink may be erasing the EXT flash */
+    elog_flash_flush();
+#endif
+    elog_raw("\r\nflash benchmark, SYSCLK %u MHz\r\n", (unsigned) (SystemCoreClock / 1000000U));
+    elog_raw("%-6s %-20s %10s %10s %13s\r\n", "flash", "test", "bytes", "us", "MB/s");
+
+    bench_flash(ext_flash);
+    bench_flash(main_flash);
+    /* the read width main() picked */
+    sfud_qspi_fast_read_enable(main_flash, 4);
+    bench_xip(main_flash, BOOT_BENCH_MAIN_ADDR);
+    bench_crc("SRAM", "crc", bench_buf, BOOT_BENCH_AREA_SIZE);
+    bench_ed25519();
+#ifdef ELOG_PORT_FLASH_ENABLE
+    elog_flash_flush();
+#endif
+    dma_alloc_release(DMA_REGION_AXI, mark);
+}
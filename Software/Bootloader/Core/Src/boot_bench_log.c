@@ -0,0 +1,224 @@
+/**
+ * @file boot_bench_log.c
+ * @brief Cost of an elog_i() call to its caller in each output mode of the build, see boot_bench.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_BENCH
+
+#include "boot_bench.h"
+#include "main.h"
+#include <elog.h>
+
+ELOG_TAG_DEFINE(TAG, "bench");
+
+#define LOG_ROW_FMT                     "%-10s %-6s %10u %10u %10u %10u\r\n"
+/* calls of the idle figure, each one with the output drained */
+#define LOG_IDLE_NUM                    8
+/* lines of a sustained run, above the 4KB of the port ring and of the async ring */
+#define LOG_RUN_LINES                   64
+
+enum {
+    LOG_MODE_SYNC = 0,
+    LOG_MODE_ASYNC,
+    LOG_MODE_BUF,
+    LOG_MODE_NUM,
+};
+
+enum {
+    LOG_CASE_CONST = 0,
+    LOG_CASE_INT,
+    LOG_CASE_HEX,
+    LOG_CASE_STR,
+    LOG_CASE_LONG,
+    LOG_CASE_NUM,
+};
+
+typedef struct {
+    uint32_t idle_cycles;                        /**< cycles of a call, the output drained before it */
+    uint32_t lines_per_sec;                      /**< LOG_RUN_LINES back to back, up to the last byte out */
+    uint32_t worst_us;                           /**< the longest call of the run */
+    uint32_t lost;                               /**< bytes the async ring dropped in the run */
+} log_result;
+
+#ifdef ELOG_BIN_OUTPUT_ENABLE
+#define LOG_MODE_SUFFIX                 " bin"
+#else
+#define LOG_MODE_SUFFIX                 ""
+#endif
+
+static const char *const log_mode_names[LOG_MODE_NUM] = {
+    "sync" LOG_MODE_SUFFIX, "async" LOG_MODE_SUFFIX, "buf" LOG_MODE_SUFFIX
+};
+static const char *const log_case_names[LOG_CASE_NUM] = { "const", "int", "hex", "str", "long" };
+
+/* the sinks elog_port.c copies every line to, besides the mode */
+static const char log_sinks[] = ""
+#ifdef ELOG_PORT_UART_ENABLE
+        " uart"
+#endif
+#ifdef ELOG_PORT_BOOT_LOG_ENABLE
+        " boot-log"
+#endif
+#ifdef ELOG_PORT_FLASH_ENABLE
+        " flash"
+#endif
+#ifdef ELOG_PORT_ITM_ENABLE
+        " itm"
+#endif
+#ifdef ELOG_PORT_RTT_ENABLE
+        " rtt"
+#endif
+#ifdef ELOG_PORT_ESP_ENABLE
+        " esp"
+#endif
+        ;
+
+/* a line of 160 characters, about the longest of the boot log */
+static const char log_long[] =
+        "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyz"
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrstuvwxyz";
+
+static log_result log_results[LOG_MODE_NUM][LOG_CASE_NUM];
+
+/* the modes line_out() of elog.c reaches in this build, async first */
+static bool log_mode_built(uint8_t mode) {
+    switch (mode) {
+    case LOG_MODE_SYNC:
+        return true;
+    case LOG_MODE_ASYNC:
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+        return true;
+#else
+        return false;
+#endif
+    default:
+#if defined(ELOG_BUF_OUTPUT_ENABLE) && !defined(ELOG_ASYNC_OUTPUT_ENABLE)
+        return true;
+#else
+        return false;
+#endif
+    }
+}
+
+static void log_mode_set(uint8_t mode) {
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+    elog_async_enabled(mode == LOG_MODE_ASYNC);
+#endif
+#ifdef ELOG_BUF_OUTPUT_ENABLE
+    elog_buf_enabled(mode == LOG_MODE_BUF);
+#endif
+    (void) mode;
+}
+
+/* every byte of the log out of USART2 and the other sinks */
+static void log_drain(void) {
+#ifdef ELOG_BUF_OUTPUT_ENABLE
+    elog_flush();
+#endif
+    elog_port_flush();
+}
+
+static uint32_t log_lost(void) {
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+    return elog_async_get_lost();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * one elog_i() call of a case
+ *
+ * @return cycles of the call, the output draining in the interrupts meanwhile included
+ */
+static uint32_t log_call(uint8_t log_case, uint32_t n) {
+    uint32_t start = DWT->CYCCNT;
+
+    switch (log_case) {
+    case LOG_CASE_CONST:
+        elog_i(TAG, "a line of the log benchmark");
+        break;
+    case LOG_CASE_INT:
+        elog_i(TAG, "line %u", (unsigned) n);
+        break;
+    case LOG_CASE_HEX:
+        elog_i(TAG, "read 0x%08x, %u bytes, result %d", (unsigned) (n * 256), (unsigned) n, -(int) n);
+        break;
+    case LOG_CASE_STR:
+        elog_i(TAG, "%s: %s in %s mode", "MAIN", "W25Q64JV", "quad");
+        break;
+    default:
+        elog_i(TAG, "%s", log_long);
+        break;
+    }
+    return DWT->CYCCNT - start;
+}
+
+static void log_case_run(uint8_t log_case, log_result *result) {
+    uint32_t total = 0, worst = 0, cycles, lost, start;
+
+    for (uint32_t i = 0; i < LOG_IDLE_NUM; i++) {
+        log_drain();
+        total += log_call(log_case, i);
+    }
+    result->idle_cycles = total / LOG_IDLE_NUM;
+
+    log_drain();
+    lost = log_lost();
+    start = DWT->CYCCNT;
+    for (uint32_t i = 0; i < LOG_RUN_LINES; i++) {
+        cycles = log_call(log_case, i);
+        if (cycles > worst) {
+            worst = cycles;
+        }
+    }
+    log_drain();
+    total = DWT->CYCCNT - start;
+    result->lines_per_sec = total ? (uint32_t) ((uint64_t) LOG_RUN_LINES * SystemCoreClock / total) : 0;
+    result->worst_us = (uint32_t) ((uint64_t) worst * 1000000 / SystemCoreClock);
+    result->lost = log_lost() - lost;
+}
+
+/**
+ * measure the elog_i() calls of each output mode built in and print the table, the modes of elog_start() after
+ */
+void boot_bench_log_run(void) {
+    const log_result *result;
+    uint8_t mode, log_case;
+
+    /* the bench lines are neither rate limited nor coalesced */
+    elog_set_rate_limit("bench", ELOG_LVL_ASSERT, 0, 0);
+    for (mode = 0; mode < LOG_MODE_NUM; mode++) {
+        if (!log_mode_built(mode)) {
+            continue;
+        }
+        log_mode_set(mode);
+        for (log_case = 0; log_case < LOG_CASE_NUM; log_case++) {
+            log_case_run(log_case, &log_results[mode][log_case]);
+        }
+    }
+#ifdef ELOG_RATE_LIMIT_ENABLE
+    elog_set_rate_limit("bench", ELOG_LVL_ASSERT, ELOG_RATE_LIMIT_BURST, ELOG_RATE_LIMIT_PER_SEC);
+#endif
+    /* both on, as elog_start() left them */
+#ifdef ELOG_ASYNC_OUTPUT_ENABLE
+    elog_async_enabled(true);
+#endif
+#ifdef ELOG_BUF_OUTPUT_ENABLE
+    elog_buf_enabled(true);
+#endif
+    log_drain();
+
+    elog_raw("\r\nlog benchmark, SYSCLK %u MHz, line buffer %u, sinks:%s\r\n",
+             (unsigned) (SystemCoreClock / 1000000U), (unsigned) ELOG_LINE_BUF_SIZE, log_sinks);
+    elog_raw("%-10s %-6s %10s %10s %10s %10s\r\n", "mode", "format", "cycles", "lines/s", "worst us", "lost");
+    for (mode = 0; mode < LOG_MODE_NUM; mode++) {
+        if (!log_mode_built(mode)) {
+            continue;
+        }
+        for (log_case = 0; log_case < LOG_CASE_NUM; log_case++) {
+            result = &log_results[mode][log_case];
+            elog_raw(LOG_ROW_FMT, log_mode_names[mode], log_case_names[log_case], (unsigned) result->idle_cycles,
+                     (unsigned) result->lines_per_sec, (unsigned) result->worst_us, (unsigned) result->lost);
+        }
+    }
+}
@@ -0,0 +1,323 @@
+/**
+ * @file boot_bench_mem.c
+ * @brief Bandwidth and latency of the RAM banks and the XIP window, see boot_bench.h.
+ */
+#include "boot_bench.h"
+#include "boot_mem.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include "octospi.h"
+#include <elog.h>
+#include <sfud.h>
+#include <string.h>
+
+#define MEM_ROW_FMT                     "%-6s %-6s %-8s %-4s %8u %10u %6u.%03u\r\n"
+/* the ITCM after the code, as boot_scatter.c */
+#define MEM_ITCM_ADDR                   0x00000000UL
+#define MEM_ITCM_SIZE                   (64 * 1024)
+/* accesses of a random case */
+#define MEM_RAND_NUM                    4096
+#define MEM_DMA2D_TIMEOUT_MS            10
+
+typedef struct {
+    const char *name;
+    uint8_t *buf;
+    uint32_t size;                               /**< a power of 2, 0: no room in the bank */
+    bool writable;                               /**< false: the XIP window */
+    bool dma2d;                                  /**< reached by the DMA2D, not by the TCMs */
+} mem_region;
+
+extern uint32_t _eitcm;
+extern sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash);
+
+/* the RAM_D1 end of the copies, a temp buffer of the AXI arena */
+static uint8_t *mem_scratch;
+/* the sums of the read loops go here, the loops stay */
+static volatile uint32_t mem_sink;
+
+static uint32_t mem_pow2(uint32_t size) {
+    return size ? 1UL << (31U - __CLZ(size)) : 0;
+}
+
+static void mem_take(mem_region *region, const char *name, dma_region bank, bool dma2d) {
+    size_t left = dma_alloc_left(bank);
+    uint32_t size = mem_pow2(left < BOOT_BENCH_MEM_SIZE ? (uint32_t) left : BOOT_BENCH_MEM_SIZE);
+
+    region->name = name;
+    region->buf = size ? dma_alloc_temp(size, bank) : NULL;
+    region->size = region->buf ? size : 0;
+    region->writable = true;
+    region->dma2d = dma2d;
+}
+
+static void mem_row(const mem_region *region, const char *engine, const char *test, bool cached, uint32_t bytes,
+                    uint32_t cycles) {
+    uint32_t mcpb = bytes ? (uint32_t) ((uint64_t) cycles * 1000 / bytes) : 0;
+
+    elog_raw(MEM_ROW_FMT, region->name, engine, test, cached ? "on" : "off", bytes, cycles, mcpb / 1000,
+             mcpb % 1000);
+    /* the log DMA reads RAM_D1 as well, it's done before the next case */
+    elog_port_flush();
+}
+
+/**
+ * start the case cold: no line of the buffers in the D-Cache
+ */
+static void mem_cold(const mem_region *region) {
+    if (region->writable) {
+        SCB_CleanInvalidateDCache_by_Addr((uint32_t *) region->buf, (int32_t) region->size);
+    } else {
+        SCB_InvalidateDCache_by_Addr((uint32_t *) region->buf, (int32_t) region->size);
+    }
+    SCB_CleanInvalidateDCache_by_Addr((uint32_t *) mem_scratch, BOOT_BENCH_MEM_SIZE);
+}
+
+static uint32_t mem_cpu_read(const uint8_t *buf, uint32_t size) {
+    const volatile uint32_t *p = (const volatile uint32_t *) buf;
+    uint32_t sum = 0, start, cycles, primask = __get_PRIMASK();
+
+    __disable_irq();
+    start = DWT->CYCCNT;
+    for (uint32_t i = 0; i < size / 4; i += 8) {
+        sum += p[i] + p[i + 1] + p[i + 2] + p[i + 3] + p[i + 4] + p[i + 5] + p[i + 6] + p[i + 7];
+    }
+    cycles = DWT->CYCCNT - start;
+    __set_PRIMASK(primask);
+    mem_sink = sum;
+    return cycles;
+}
+
+static uint32_t mem_cpu_write(uint8_t *buf, uint32_t size) {
+    volatile uint32_t *p = (volatile uint32_t *) buf;
+    uint32_t start, cycles, primask = __get_PRIMASK();
+
+    __disable_irq();
+    start = DWT->CYCCNT;
+    for (uint32_t i = 0; i < size / 4; i += 8) {
+        p[i] = i;
+        p[i + 1] = i;
+        p[i + 2] = i;
+        p[i + 3] = i;
+        p[i + 4] = i;
+        p[i + 5] = i;
+        p[i + 6] = i;
+        p[i + 7] = i;
+    }
+    cycles = DWT->CYCCNT - start;
+    __set_PRIMASK(primask);
+    return cycles;
+}
+
+/**
+ * words at xorshift32 offsets, each address takes the word read before: the cycles are the load latency
+ */
+static uint32_t mem_cpu_rand_read(const uint8_t *buf, uint32_t size) {
+    const volatile uint32_t *p = (const volatile uint32_t *) buf;
+    uint32_t mask = size / 4 - 1, x = 0x2545F491UL, v = 0, start, cycles, primask = __get_PRIMASK();
+
+    __disable_irq();
+    start = DWT->CYCCNT;
+    for (uint32_t n = 0; n < MEM_RAND_NUM; n++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        v = p[(x + v) & mask];
+    }
+    cycles = DWT->CYCCNT - start;
+    __set_PRIMASK(primask);
+    mem_sink = v;
+    return cycles;
+}
+
+/**
+ * words at xorshift32 offsets, independent stores: the write buffer and the line allocation at work
+ */
+static uint32_t mem_cpu_rand_write(uint8_t *buf, uint32_t size) {
+    volatile uint32_t *p = (volatile uint32_t *) buf;
+    uint32_t mask = size / 4 - 1, x = 0x2545F491UL, start, cycles, primask = __get_PRIMASK();
+
+    __disable_irq();
+    start = DWT->CYCCNT;
+    for (uint32_t n = 0; n < MEM_RAND_NUM; n++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        p[x & mask] = x;
+    }
+    cycles = DWT->CYCCNT - start;
+    __set_PRIMASK(primask);
+    return cycles;
+}
+
+static uint32_t mem_memcpy(void *dst, const void *src, uint32_t size) {
+    uint32_t start, cycles, primask = __get_PRIMASK();
+
+    __disable_irq();
+    start = DWT->CYCCNT;
+    memcpy(dst, src, size);
+    cycles = DWT->CYCCNT - start;
+    __set_PRIMASK(primask);
+    return cycles;
+}
+
+/**
+ * boot_mem_copy() and its wait, the cache upkeep of boot_mem.h included
+ *
+ * @return cycles, 0: the MDMA failed
+ */
+static uint32_t mem_mdma(void *dst, const void *src, uint32_t size) {
+    uint32_t start = DWT->CYCCNT;
+
+    boot_mem_copy(dst, src, size, NULL);
+    if (!boot_mem_wait()) {
+        return 0;
+    }
+    return DWT->CYCCNT - start;
+}
+
+/**
+ * memory-to-memory DMA2D copy as one line of ARGB8888 pixels, with the upkeep of dma_alloc.h
+ *
+ * @return cycles, 0: transfer error or timeout
+ */
+static uint32_t mem_dma2d(void *dst, const void *src, uint32_t size) {
+    uint32_t start = DWT->CYCCNT, tick = HAL_GetTick();
+
+    dma_prepare_tx(src, size);
+    dma_prepare_rx(dst, size);
+    DMA2D->IFCR = DMA2D_IFCR_CTCIF | DMA2D_IFCR_CTEIF;
+    DMA2D->FGMAR = (uint32_t) (uintptr_t) src;
+    DMA2D->FGOR = 0;
+    DMA2D->FGPFCCR = 0;
+    DMA2D->OMAR = (uint32_t) (uintptr_t) dst;
+    DMA2D->OOR = 0;
+    DMA2D->OPFCCR = 0;
+    DMA2D->NLR = (size / 4) << DMA2D_NLR_PL_Pos | 1U << DMA2D_NLR_NL_Pos;
+    DMA2D->CR = DMA2D_CR_START;
+    while (DMA2D->CR & DMA2D_CR_START) {
+        if (HAL_GetTick() - tick > MEM_DMA2D_TIMEOUT_MS) {
+            DMA2D->CR |= DMA2D_CR_ABORT;
+            return 0;
+        }
+    }
+    if (DMA2D->ISR & DMA2D_ISR_TEIF) {
+        return 0;
+    }
+    dma_complete_rx(dst, size);
+    return DWT->CYCCNT - start;
+}
+
+static void mem_copy_row(const mem_region *region, const char *engine, const char *test, bool cached,
+                         uint32_t cycles) {
+    if (cycles) {
+        mem_row(region, engine, test, cached, region->size, cycles);
+    } else {
+        elog_raw("%-6s %-6s %-8s %-4s failed\r\n", region->name, engine, test, cached ? "on" : "off");
+    }
+}
+
+/**
+ * the cases of a region with the D-Cache as it is
+ */
+static void mem_region_run(const mem_region *region, bool cached) {
+    uint32_t size = region->size;
+
+    mem_cold(region);
+    mem_row(region, "cpu", "seq rd", cached, size, mem_cpu_read(region->buf, size));
+    mem_cold(region);
+    mem_row(region, "cpu", "rand rd", cached, MEM_RAND_NUM * 4, mem_cpu_rand_read(region->buf, size));
+    if (region->writable) {
+        mem_cold(region);
+        mem_row(region, "cpu", "seq wr", cached, size, mem_cpu_write(region->buf, size));
+        mem_cold(region);
+        mem_row(region, "cpu", "rand wr", cached, MEM_RAND_NUM * 4, mem_cpu_rand_write(region->buf, size));
+    }
+
+    /* the copy engines between the region and the RAM_D1 scratch, rd: out of the region, wr: into it */
+    mem_cold(region);
+    mem_copy_row(region, "memcpy", "copy rd", cached, mem_memcpy(mem_scratch, region->buf, size));
+    mem_cold(region);
+    mem_copy_row(region, "mdma", "copy rd", cached, mem_mdma(mem_scratch, region->buf, size));
+    if (region->dma2d) {
+        mem_cold(region);
+        mem_copy_row(region, "dma2d", "copy rd", cached, mem_dma2d(mem_scratch, region->buf, size));
+    }
+    if (!region->writable) {
+        return;
+    }
+    mem_cold(region);
+    mem_copy_row(region, "memcpy", "copy wr", cached, mem_memcpy(region->buf, mem_scratch, size));
+    mem_cold(region);
+    mem_copy_row(region, "mdma", "copy wr", cached, mem_mdma(region->buf, mem_scratch, size));
+    if (region->dma2d) {
+        mem_cold(region);
+        mem_copy_row(region, "dma2d", "copy wr", cached, mem_dma2d(region->buf, mem_scratch, size));
+    }
+}
+
+/**
+ * measure the memories with the D-Cache on, then off, and print the table in cycles per byte
+ *
+ * @note the MAIN flash is left in memory-mapped mode, as by boot_bench_run()
+ */
+void boot_bench_mem_run(void) {
+    sfud_flash *flash = sfud_get_device(SFUD_MAIN_FLASH);
+    size_t axi_mark = dma_alloc_mark(DMA_REGION_AXI), dtcm_mark = dma_alloc_mark(DMA_REGION_DTCM);
+    size_t d2_mark = dma_alloc_mark(DMA_REGION_D2), d3_mark = dma_alloc_mark(DMA_REGION_D3);
+    uintptr_t itcm = ((uintptr_t) &_eitcm + DMA_ALIGN - 1) & ~(uintptr_t) (DMA_ALIGN - 1);
+    uint32_t itcm_left = (uint32_t) (MEM_ITCM_ADDR + MEM_ITCM_SIZE - itcm);
+    mem_region regions[6];
+    int num = 0;
+
+    mem_scratch = dma_alloc_temp(BOOT_BENCH_MEM_SIZE, DMA_REGION_AXI);
+    if (!mem_scratch) {
+        elog_raw("memory benchmark: no room for the %u bytes buffer\r\n", (unsigned) BOOT_BENCH_MEM_SIZE);
+        return;
+    }
+    regions[num].name = "ITCM";
+    regions[num].buf = (uint8_t *) itcm;
+    regions[num].size = mem_pow2(itcm_left < BOOT_BENCH_MEM_SIZE ? itcm_left : BOOT_BENCH_MEM_SIZE);
+    regions[num].writable = true;
+    regions[num++].dma2d = false;
+    mem_take(&regions[num++], "DTCM", DMA_REGION_DTCM, false);
+    mem_take(&regions[num++], "RAM_D1", DMA_REGION_AXI, true);
+    mem_take(&regions[num++], "RAM_D2", DMA_REGION_D2, true);
+    mem_take(&regions[num++], "RAM_D3", DMA_REGION_D3, true);
+    regions[num].name = "XIP";
+    regions[num].buf = (uint8_t *) (OCTOSPI1_BASE + BOOT_BENCH_MAIN_ADDR);
+    regions[num].size = BOOT_BENCH_MEM_SIZE;
+    regions[num].writable = false;
+    regions[num].dma2d = true;
+    if (qspi_entry_memory_mapped_mode(flash) == SFUD_SUCCESS) {
+        num++;
+    }
+    __HAL_RCC_DMA2D_CLK_ENABLE();
+
+    elog_raw("\r\nmemory benchmark, SYSCLK %u MHz, random cases %u words\r\n", (unsigned) (SystemCoreClock / 1000000U),
+             (unsigned) MEM_RAND_NUM);
+    for (int i = 0; i < num; i++) {
+        elog_raw("%-6s 0x%08x %u bytes\r\n", regions[i].name, (unsigned) (uintptr_t) regions[i].buf,
+                 (unsigned) regions[i].size);
+    }
+    elog_raw("%-6s %-6s %-8s %-4s %8s %10s %10s\r\n", "memory", "engine", "test", "dc", "bytes", "cycles", "cyc/byte");
+    elog_port_flush();
+
+    for (int cached = 1; cached >= 0; cached--) {
+        if (!cached) {
+            /* written back and dropped first, the DMA users see the RAM as it is */
+            SCB_DisableDCache();
+        }
+        for (int i = 0; i < num; i++) {
+            if (regions[i].size) {
+                mem_region_run(&regions[i], cached);
+            }
+        }
+    }
+    SCB_EnableDCache();
+
+    __HAL_RCC_DMA2D_CLK_DISABLE();
+    dma_alloc_release(DMA_REGION_D3, d3_mark);
+    dma_alloc_release(DMA_REGION_D2, d2_mark);
+    dma_alloc_release(DMA_REGION_DTCM, dtcm_mark);
+    dma_alloc_release(DMA_REGION_AXI, axi_mark);
+}
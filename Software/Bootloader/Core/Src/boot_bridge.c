@@ -0,0 +1,185 @@
+/**
+ * @file boot_bridge.c
+ * @brief USART2 to ESP32-C3 UART5 passthrough, see boot_bridge.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_BRIDGE
+
+#include "boot_bridge.h"
+#include "spsc_ring.h"
+#include "usart.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "bridge");
+
+/* UART5: PB6 TX to the ESP32 RXD, PB5 RX from its TXD, as boot_espflash.c */
+#define BRIDGE_UART_PORT                GPIOB
+#define BRIDGE_UART_PINS                (GPIO_PIN_5 | GPIO_PIN_6)
+/* the transfer is over when it's polled, the flag is only taken */
+#define BRIDGE_POLL_MS                  1
+
+typedef struct {
+    USART_TypeDef *rx_uart;
+    USART_TypeDef *tx_uart;
+    DMA_HandleTypeDef rx_dma;                    /**< circular, RDR of rx_uart into the ring */
+    DMA_HandleTypeDef tx_dma;                    /**< a span of the ring to TDR of tx_uart */
+    spsc_ring ring;
+    size_t sending;                              /**< bytes of tx_dma, 0: idle */
+    boot_bridge_stats *stats;
+} bridge_dir;
+
+/* the DMA2 can't reach the TCMs, the rings stay in RAM_D1 */
+static uint8_t host_ring[BOOT_BRIDGE_RING_SIZE] __attribute__((aligned(32)));
+static uint8_t esp_ring[BOOT_BRIDGE_RING_SIZE] __attribute__((aligned(32)));
+static UART_HandleTypeDef huart5;
+static bridge_dir bridge_dirs[2];
+/* host to ESP32, ESP32 to host */
+static boot_bridge_stats bridge_stats[2];
+
+static bool bridge_dma_init(DMA_HandleTypeDef *hdma, DMA_Stream_TypeDef *stream, uint32_t request,
+                            uint32_t direction) {
+    hdma->Instance = stream;
+    hdma->Init.Request = request;
+    hdma->Init.Direction = direction;
+    hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma->Init.MemInc = DMA_MINC_ENABLE;
+    hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma->Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma->Init.Mode = direction == DMA_PERIPH_TO_MEMORY ? DMA_CIRCULAR : DMA_NORMAL;
+    /* a late reception loses bytes, a late send only waits */
+    hdma->Init.Priority = direction == DMA_PERIPH_TO_MEMORY ? DMA_PRIORITY_VERY_HIGH : DMA_PRIORITY_HIGH;
+    hdma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    return HAL_DMA_Init(hdma) == HAL_OK;
+}
+
+/**
+ * UART5 on the settings of USART2, the same PCLK1 kernel clock gives the same rate
+ */
+static bool bridge_uart5_init(uint32_t baud) {
+    GPIO_InitTypeDef gpio = {0};
+
+    __HAL_RCC_GPIOB_CLK_ENABLE();
+    __HAL_RCC_UART5_CLK_ENABLE();
+
+    gpio.Pin = BRIDGE_UART_PINS;
+    gpio.Mode = GPIO_MODE_AF_PP;
+    gpio.Pull = GPIO_PULLUP;
+    gpio.Speed = GPIO_SPEED_FREQ_HIGH;
+    gpio.Alternate = GPIO_AF14_UART5;
+    HAL_GPIO_Init(BRIDGE_UART_PORT, &gpio);
+
+    huart5.Instance = UART5;
+    huart5.Init = huart2.Init;
+    huart5.Init.BaudRate = baud;
+    huart5.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+    return HAL_UART_Init(&huart5) == HAL_OK && HAL_UARTEx_EnableFifoMode(&huart5) == HAL_OK;
+}
+
+/**
+ * reset the ESP32 into its ROM loader; MX_GPIO_Init() left both pins released
+ */
+static void bridge_esp_download(void) {
+    HAL_GPIO_WritePin(ESP_BOOT_GPIO_Port, ESP_BOOT_Pin, GPIO_PIN_RESET);
+    HAL_GPIO_WritePin(ESP_EN_GPIO_Port, ESP_EN_Pin, GPIO_PIN_RESET);
+    HAL_Delay(BOOT_BRIDGE_RESET_MS);
+    HAL_GPIO_WritePin(ESP_EN_GPIO_Port, ESP_EN_Pin, GPIO_PIN_SET);
+    HAL_Delay(BOOT_BRIDGE_BOOT_MS);
+    /* IO9 is only sampled at reset */
+    HAL_GPIO_WritePin(ESP_BOOT_GPIO_Port, ESP_BOOT_Pin, GPIO_PIN_SET);
+}
+
+static bool dir_start(bridge_dir *dir, USART_TypeDef *rx_uart, USART_TypeDef *tx_uart, uint8_t *ring,
+                      boot_bridge_stats *stats) {
+    dir->rx_uart = rx_uart;
+    dir->tx_uart = tx_uart;
+    dir->sending = 0;
+    dir->stats = stats;
+    spsc_ring_init(&dir->ring, ring, BOOT_BRIDGE_RING_SIZE);
+    /* the CPU never reads nor writes the ring, no dirty line of the zeroing may be evicted over it later */
+    SCB_CleanInvalidateDCache_by_Addr((uint32_t *) ring, BOOT_BRIDGE_RING_SIZE);
+    if (HAL_DMA_Start(&dir->rx_dma, (uint32_t) (uintptr_t) &rx_uart->RDR, (uint32_t) (uintptr_t) ring,
+                      BOOT_BRIDGE_RING_SIZE) != HAL_OK) {
+        return false;
+    }
+    rx_uart->ICR = USART_ICR_ORECF | USART_ICR_FECF | USART_ICR_NECF;
+    SET_BIT(rx_uart->CR3, USART_CR3_DMAR);
+    SET_BIT(tx_uart->CR3, USART_CR3_DMAT);
+    return true;
+}
+
+/**
+ * take what the reception brought, send it on when the last span is out
+ */
+static void dir_poll(bridge_dir *dir) {
+    uint8_t *span;
+    size_t len;
+
+    if (dir->rx_uart->ISR & USART_ISR_ORE) {
+        dir->rx_uart->ICR = USART_ICR_ORECF;
+        dir->stats->overruns++;
+    }
+    spsc_ring_dma_head(&dir->ring, BOOT_BRIDGE_RING_SIZE - __HAL_DMA_GET_COUNTER(&dir->rx_dma));
+    if (dir->sending) {
+        if (__HAL_DMA_GET_COUNTER(&dir->tx_dma) != 0) {
+            return;
+        }
+        /* HAL_DMA_Start() again needs the handle ready, the poll sees the complete flag set and clears it */
+        HAL_DMA_PollForTransfer(&dir->tx_dma, HAL_DMA_FULL_TRANSFER, BRIDGE_POLL_MS);
+        spsc_ring_consume(&dir->ring, dir->sending);
+        dir->stats->bytes += dir->sending;
+        dir->sending = 0;
+    }
+    if ((len = spsc_ring_read_span(&dir->ring, 0, &span)) == 0) {
+        return;
+    }
+    dir->sending = len;
+    if (HAL_DMA_Start(&dir->tx_dma, (uint32_t) (uintptr_t) span, (uint32_t) (uintptr_t) &dir->tx_uart->TDR, len)
+            != HAL_OK) {
+        dir->sending = 0;
+    }
+}
+
+/**
+ * pass the bytes between the host and the ESP32 till the next reset
+ *
+ * @param baud link baud rate of boot_uart.h, USART2 runs it
+ * @param download reset the ESP32 into its ROM loader first
+ *
+ * @note the UART upload has stopped its reception, the log DMA is idle; returns only when the DMA or UART5 setup
+ *       fails, the boot goes on then
+ */
+void boot_bridge_run(uint32_t baud, bool download) {
+    bridge_dir *to_esp = &bridge_dirs[0], *to_host = &bridge_dirs[1];
+
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    memset(bridge_stats, 0, sizeof(bridge_stats));
+    if (!bridge_dma_init(&to_esp->rx_dma, DMA2_Stream0, DMA_REQUEST_USART2_RX, DMA_PERIPH_TO_MEMORY)
+            || !bridge_dma_init(&to_esp->tx_dma, DMA2_Stream1, DMA_REQUEST_UART5_TX, DMA_MEMORY_TO_PERIPH)
+            || !bridge_dma_init(&to_host->rx_dma, DMA2_Stream2, DMA_REQUEST_UART5_RX, DMA_PERIPH_TO_MEMORY)
+            || !bridge_dma_init(&to_host->tx_dma, DMA2_Stream3, DMA_REQUEST_USART2_TX, DMA_MEMORY_TO_PERIPH)
+            || !bridge_uart5_init(baud)) {
+        elog_e(TAG, "no bridge to the ESP32");
+        return;
+    }
+    elog_i(TAG, "USART2 to the ESP32 at %u baud%s, till reset", baud, download ? ", ROM loader" : "");
+    /* the log would go into the stream of the ESP32 */
+    elog_set_output_enabled(false);
+    elog_port_flush();
+    while (!(USART2->ISR & USART_ISR_TC)) {
+    }
+    HAL_UARTEx_EnableFifoMode(&huart2);
+
+    if (download) {
+        bridge_esp_download();
+    }
+    if (!dir_start(to_esp, USART2, UART5, host_ring, &bridge_stats[0])
+            || !dir_start(to_host, UART5, USART2, esp_ring, &bridge_stats[1])) {
+        /* the log is off already, a reset is the one sign the host gets */
+        NVIC_SystemReset();
+    }
+    while (1) {
+        dir_poll(to_esp);
+        dir_poll(to_host);
+    }
+}
@@ -0,0 +1,437 @@
+/**
+ * @file boot_bundle.c
+ * @brief Update bundle routed to the slot, the ESP32 flasher and the file system as it streams in, see boot_bundle.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_BUNDLE
+
+#include "boot_bundle.h"
+
+#ifdef BOOT_LFS
+
+#include "boot_ed25519.h"
+#include "boot_espflash.h"
+#include "boot_hash.h"
+#include "boot_heatshrink.h"
+#include "boot_image.h"
+#include "boot_lfs.h"
+#include "boot_rollback.h"
+#include "boot_slot.h"
+#include "boot_verify.h"
+#include "main.h"
+#include "elog.h"
+#include <stdio.h>
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "bundle");
+
+/* the staging slot is erased ahead of the data by that much */
+#define BUNDLE_ERASE_BLOCK_SIZE         0x10000UL
+/* decoded bytes handed to the destination at a time */
+#define BUNDLE_OUT_SIZE                 1024
+#define BUNDLE_META_SIZE                (sizeof(boot_bundle_header) + BOOT_BUNDLE_MAX_ENTRIES \
+                                         * sizeof(boot_bundle_entry) + BOOT_ED25519_SIG_SIZE)
+
+typedef struct {
+    const sfud_flash *flash;                     /**< MAIN flash, indirect mode */
+    boot_bundle_status status;                   /**< the first error, the bundle is over then */
+    boot_slot_id slot;                           /**< staging slot */
+    uint32_t meta_len;                           /**< bytes of meta taken */
+    uint32_t meta_size;                          /**< header, table and signature bytes, 0: the header isn't in yet */
+    uint32_t num;                                /**< entries, 0: the table isn't checked yet */
+    uint32_t entry;                              /**< entry being taken, num: all of them are in */
+    uint32_t entry_left;                         /**< its bytes still to come */
+    uint32_t out_done;                           /**< its bytes handed to the destination */
+    uint32_t out_fill;                           /**< decoded bytes in out_buf */
+    uint32_t erased_end;                         /**< slot offset the staging slot is erased up to */
+    bool mounted;
+    bool file_open;
+    uint8_t meta[BUNDLE_META_SIZE];              /**< header, table and signature as they came */
+} bundle_state;
+
+static bundle_state bundle;
+static lfs_t bundle_lfs;
+static struct lfs_config bundle_lfs_cfg;
+static uint8_t bundle_file_buf[BOOT_LFS_CACHE_SIZE];
+static lfs_file_t bundle_file;
+/* littlefs keeps it with the file till the close */
+static struct lfs_file_config bundle_file_cfg = {.buffer = bundle_file_buf};
+static boot_heatshrink_decoder bundle_decoder;
+static uint8_t bundle_out_buf[BUNDLE_OUT_SIZE] __attribute__((aligned(32)));
+#ifdef BOOT_SIGN_KEY
+static const uint8_t sign_key[BOOT_ED25519_KEY_SIZE] = {BOOT_SIGN_KEY};
+#endif
+
+static const boot_bundle_header *bundle_header(void) {
+    return (const boot_bundle_header *) bundle.meta;
+}
+
+static const boot_bundle_entry *bundle_entry(uint32_t index) {
+    return (const boot_bundle_entry *) (bundle.meta + sizeof(boot_bundle_header)) + index;
+}
+
+static void bundle_tmp_path(char *path, size_t size, uint32_t index) {
+    snprintf(path, size, "%s%u", BOOT_BUNDLE_TMP_PATH, (unsigned) index);
+}
+
+/**
+ * check the table once it's in: CRC-32, signature, entries, and the bundle size they add up to
+ */
+static boot_bundle_status bundle_meta_check(void) {
+    const boot_bundle_header *header = bundle_header();
+    uint32_t table = header->num * sizeof(boot_bundle_entry), size = bundle.meta_size, slots = 0, crc;
+    const boot_bundle_entry *entry;
+
+    crc = boot_image_crc32(0, header, offsetof(boot_bundle_header, crc));
+    if (boot_image_crc32(crc, bundle_entry(0), table) != header->crc) {
+        elog_e(TAG, "table CRC bad");
+        return BOOT_BUNDLE_ERR_FORMAT;
+    }
+#ifdef BOOT_SIGN_KEY
+    if (!boot_ed25519_verify(bundle.meta + sizeof(boot_bundle_header) + table, bundle.meta,
+                             sizeof(boot_bundle_header) + table, sign_key)) {
+        elog_e(TAG, "signature bad");
+        return BOOT_BUNDLE_ERR_SIGN;
+    }
+#endif
+    for (uint32_t i = 0; i < header->num; i++) {
+        entry = bundle_entry(i);
+        if (entry->compression > BOOT_BUNDLE_COMPRESSION_HEATSHRINK
+                || (entry->compression == BOOT_BUNDLE_COMPRESSION_NONE && entry->out_size != entry->size)
+                || (entry->dest == BOOT_BUNDLE_DEST_SLOT && (++slots > 1 || entry->out_size > BOOT_SLOT_SIZE))
+                || (entry->dest == BOOT_BUNDLE_DEST_FILE && (entry->path[0] != '/'
+                        || memchr(entry->path, '\0', BOOT_BUNDLE_PATH_SIZE) == NULL))
+                || entry->dest < BOOT_BUNDLE_DEST_SLOT || entry->dest > BOOT_BUNDLE_DEST_FILE
+                || entry->size > header->size - size) {
+            elog_e(TAG, "entry %u bad", (unsigned) i);
+            return BOOT_BUNDLE_ERR_FORMAT;
+        }
+        size += entry->size;
+    }
+    if (size != header->size) {
+        elog_e(TAG, "entries of %u bytes, bundle of %u", (unsigned) size, (unsigned) header->size);
+        return BOOT_BUNDLE_ERR_FORMAT;
+    }
+    return BOOT_BUNDLE_OK;
+}
+
+/**
+ * program decoded bytes of the slot entry, the staging slot is erased ahead of them
+ */
+static boot_bundle_status bundle_slot_write(const uint8_t *data, size_t len) {
+    uint32_t addr = boot_slot_addr(bundle.slot), size = bundle_entry(bundle.entry)->out_size, erase;
+
+    while (bundle.erased_end < bundle.out_done + len) {
+        erase = size - bundle.erased_end;
+        if (erase > BUNDLE_ERASE_BLOCK_SIZE) {
+            erase = BUNDLE_ERASE_BLOCK_SIZE;
+        }
+        boot_verify_dirty(bundle.flash, addr + bundle.erased_end, erase);
+        if (sfud_erase(bundle.flash, addr + bundle.erased_end, erase) != SFUD_SUCCESS) {
+            return BOOT_BUNDLE_ERR_FLASH;
+        }
+        bundle.erased_end += erase;
+    }
+    if (sfud_write(bundle.flash, addr + bundle.out_done, len, data) != SFUD_SUCCESS) {
+        return BOOT_BUNDLE_ERR_FLASH;
+    }
+    return BOOT_BUNDLE_OK;
+}
+
+/**
+ * hand decoded bytes of the current entry to its destination
+ */
+static boot_bundle_status bundle_out(const uint8_t *data, size_t len) {
+    const boot_bundle_entry *entry = bundle_entry(bundle.entry);
+    boot_bundle_status result = BOOT_BUNDLE_OK;
+
+    if (len > entry->out_size - bundle.out_done) {
+        return BOOT_BUNDLE_ERR_DIGEST;
+    }
+    if (entry->dest == BOOT_BUNDLE_DEST_SLOT) {
+        result = bundle_slot_write(data, len);
+    } else if (lfs_file_write(&bundle_lfs, &bundle_file, data, len) != (lfs_ssize_t) len) {
+        result = BOOT_BUNDLE_ERR_FLASH;
+    }
+    bundle.out_done += len;
+    return result;
+}
+
+/**
+ * decode a piece of a heatshrink entry, out_buf goes to the destination whenever it's full
+ */
+static boot_bundle_status bundle_decode(const uint8_t *in, size_t in_len) {
+    boot_bundle_status result;
+    size_t n;
+
+    do {
+        n = boot_heatshrink_decode(&bundle_decoder, &in, &in_len, bundle_out_buf + bundle.out_fill,
+                                   BUNDLE_OUT_SIZE - bundle.out_fill);
+        bundle.out_fill += n;
+        if (bundle.out_fill == BUNDLE_OUT_SIZE) {
+            bundle.out_fill = 0;
+            result = bundle_out(bundle_out_buf, BUNDLE_OUT_SIZE);
+            if (result != BOOT_BUNDLE_OK) {
+                return result;
+            }
+        }
+        /* a back-reference may still produce bytes without any input */
+    } while (in_len || n);
+    return BOOT_BUNDLE_OK;
+}
+
+static boot_bundle_status bundle_entry_open(void) {
+    const boot_bundle_entry *entry = bundle_entry(bundle.entry);
+    char path[BOOT_BUNDLE_PATH_SIZE];
+
+    bundle.entry_left = entry->size;
+    bundle.out_done = 0;
+    bundle.out_fill = 0;
+    if (entry->compression == BOOT_BUNDLE_COMPRESSION_HEATSHRINK
+            && !boot_heatshrink_init(&bundle_decoder, entry->window_sz2, entry->lookahead_sz2)) {
+        return BOOT_BUNDLE_ERR_FORMAT;
+    }
+    if (entry->dest == BOOT_BUNDLE_DEST_SLOT) {
+        /* the slot may hold the image to fall back to, keep it before the first byte; the copy uses the EXT flash */
+        boot_lfs_flush();
+        boot_rollback_save(bundle.slot);
+        bundle.erased_end = 0;
+    }
+    if (!hash_stream_start()) {
+        return BOOT_BUNDLE_ERR_FLASH;
+    }
+    if (entry->dest == BOOT_BUNDLE_DEST_SLOT) {
+        return BOOT_BUNDLE_OK;
+    }
+    bundle_tmp_path(path, sizeof(path), bundle.entry);
+    if (lfs_file_opencfg(&bundle_lfs, &bundle_file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC, &bundle_file_cfg)
+            != LFS_ERR_OK) {
+        return BOOT_BUNDLE_ERR_FLASH;
+    }
+    bundle.file_open = true;
+    return BOOT_BUNDLE_OK;
+}
+
+/**
+ * the last byte of the entry is in: the rest of the decoded bytes out, then its digest and size
+ */
+static boot_bundle_status bundle_entry_close(void) {
+    const boot_bundle_entry *entry = bundle_entry(bundle.entry);
+    uint8_t digest[BOOT_HASH_SIZE];
+    boot_bundle_status result = BOOT_BUNDLE_OK;
+
+    if (bundle.out_fill) {
+        result = bundle_out(bundle_out_buf, bundle.out_fill);
+        bundle.out_fill = 0;
+    }
+    if (hash_stream_finish(digest) != SFUD_SUCCESS) {
+        result = BOOT_BUNDLE_ERR_FLASH;
+    } else if (result == BOOT_BUNDLE_OK && (memcmp(digest, entry->digest, BOOT_HASH_SIZE) != 0
+            || bundle.out_done != entry->out_size)) {
+        elog_e(TAG, "entry %u doesn't match its digest", (unsigned) bundle.entry);
+        result = BOOT_BUNDLE_ERR_DIGEST;
+    }
+    if (bundle.file_open) {
+        bundle.file_open = false;
+        if (lfs_file_close(&bundle_lfs, &bundle_file) != LFS_ERR_OK && result == BOOT_BUNDLE_OK) {
+            result = BOOT_BUNDLE_ERR_FLASH;
+        }
+    }
+    elog_d(TAG, "entry %u: %u bytes, %u at the destination", (unsigned) bundle.entry, (unsigned) entry->size,
+           (unsigned) bundle.out_done);
+    return result;
+}
+
+/**
+ * go on to the next entry with data, the empty ones are opened and closed on the way
+ */
+static boot_bundle_status bundle_entry_next(void) {
+    boot_bundle_status result = BOOT_BUNDLE_OK;
+
+    for (; bundle.entry < bundle.num && result == BOOT_BUNDLE_OK; bundle.entry++) {
+        result = bundle_entry_open();
+        if (result != BOOT_BUNDLE_OK || bundle.entry_left) {
+            break;
+        }
+        result = bundle_entry_close();
+    }
+    return result;
+}
+
+/**
+ * take bytes of the header, table and signature, the table is checked once it's all in
+ *
+ * @return bytes taken
+ */
+static size_t bundle_meta_take(const uint8_t *data, size_t len) {
+    const boot_bundle_header *header = bundle_header();
+    uint32_t want = bundle.meta_size ? bundle.meta_size : sizeof(boot_bundle_header);
+    size_t n = want - bundle.meta_len < len ? want - bundle.meta_len : len;
+
+    memcpy(bundle.meta + bundle.meta_len, data, n);
+    bundle.meta_len += n;
+    if (bundle.meta_len < want) {
+        return n;
+    }
+    if (bundle.meta_size == 0) {
+        if (header->magic != BOOT_BUNDLE_MAGIC || header->version != BOOT_BUNDLE_VERSION || header->num == 0
+                || header->num > BOOT_BUNDLE_MAX_ENTRIES || header->size < sizeof(boot_bundle_header)
+                + header->num * sizeof(boot_bundle_entry) + BOOT_ED25519_SIG_SIZE) {
+            elog_e(TAG, "not a bundle");
+            bundle.status = BOOT_BUNDLE_ERR_FORMAT;
+            return n;
+        }
+        bundle.meta_size = sizeof(boot_bundle_header) + header->num * sizeof(boot_bundle_entry)
+                + BOOT_ED25519_SIG_SIZE;
+        return n;
+    }
+    bundle.status = bundle_meta_check();
+    if (bundle.status == BOOT_BUNDLE_OK) {
+        bundle.num = header->num;
+        elog_i(TAG, "%u entries, %u bytes", (unsigned) bundle.num, (unsigned) header->size);
+        bundle.status = bundle_entry_next();
+    }
+    return n;
+}
+
+/**
+ * make the directories of a path
+ */
+static void bundle_mkdirs(const char *path) {
+    char dir[BOOT_BUNDLE_PATH_SIZE];
+    const char *p = path;
+
+    while ((p = strchr(p + 1, '/')) != NULL) {
+        memcpy(dir, path, (size_t) (p - path));
+        dir[p - path] = '\0';
+        lfs_mkdir(&bundle_lfs, dir);
+    }
+}
+
+/**
+ * mount the file system and take a bundle from its first byte
+ *
+ * @param flash MAIN flash, indirect mode
+ *
+ * @return false: no file system
+ */
+bool boot_bundle_start(const sfud_flash *flash) {
+    memset(&bundle, 0, sizeof(bundle));
+    bundle.flash = flash;
+    bundle.slot = boot_slot_staging(flash);
+    if (boot_lfs_mount(&bundle_lfs, &bundle_lfs_cfg) != LFS_ERR_OK) {
+        bundle.status = BOOT_BUNDLE_ERR_FLASH;
+        return false;
+    }
+    bundle.mounted = true;
+    return true;
+}
+
+/**
+ * take the next piece of the bundle, in order
+ *
+ * @param data piece, any alignment
+ * @param len piece size, any
+ *
+ * @return BOOT_BUNDLE_OK: go on, anything else: the bundle is over, boot_bundle_finish() drops it
+ */
+boot_bundle_status boot_bundle_feed(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *) data;
+    size_t n;
+
+    while (len && bundle.status == BOOT_BUNDLE_OK) {
+        if (bundle.num == 0) {
+            n = bundle_meta_take(p, len);
+        } else if (bundle.entry == bundle.num) {
+            elog_e(TAG, "data past the last entry");
+            bundle.status = BOOT_BUNDLE_ERR_FORMAT;
+            break;
+        } else {
+            n = len < bundle.entry_left ? len : bundle.entry_left;
+            if (hash_stream_feed(p, n) != SFUD_SUCCESS) {
+                bundle.status = BOOT_BUNDLE_ERR_FLASH;
+                break;
+            }
+            bundle.status = bundle_entry(bundle.entry)->compression == BOOT_BUNDLE_COMPRESSION_HEATSHRINK
+                    ? bundle_decode(p, n) : bundle_out(p, n);
+            bundle.entry_left -= n;
+            if (bundle.status == BOOT_BUNDLE_OK && bundle.entry_left == 0) {
+                bundle.status = bundle_entry_close();
+                if (bundle.status == BOOT_BUNDLE_OK) {
+                    bundle.entry++;
+                    bundle.status = bundle_entry_next();
+                }
+            }
+        }
+        p += n;
+        len -= n;
+    }
+    return bundle.status;
+}
+
+/**
+ * end the bundle: with every entry in and good the slot is committed and the files are put in place, else
+ * they are dropped; the file system is unmounted
+ *
+ * @param selected true: the slot entry is committed, its slot is the selected one
+ *
+ * @return result
+ */
+boot_bundle_status boot_bundle_finish(bool *selected) {
+    char path[BOOT_BUNDLE_PATH_SIZE];
+    const boot_bundle_entry *entry;
+    sfud_err result;
+
+    *selected = false;
+    if (!bundle.mounted) {
+        return bundle.status;
+    }
+    if (bundle.status == BOOT_BUNDLE_OK && (bundle.num == 0 || bundle.entry < bundle.num)) {
+        elog_e(TAG, "bundle cut short");
+        bundle.status = BOOT_BUNDLE_ERR_FORMAT;
+    }
+    if (bundle.file_open) {
+        bundle.file_open = false;
+        lfs_file_close(&bundle_lfs, &bundle_file);
+    }
+    for (uint32_t i = 0; i < bundle.num && bundle.status == BOOT_BUNDLE_OK; i++) {
+        entry = bundle_entry(i);
+        if (entry->dest != BOOT_BUNDLE_DEST_SLOT) {
+            continue;
+        }
+        result = boot_slot_commit(bundle.flash, bundle.slot, entry->out_size);
+        if (result == SFUD_SUCCESS) {
+            *selected = true;
+        } else {
+            bundle.status = result == SFUD_ERR_NOT_FOUND ? BOOT_BUNDLE_ERR_IMAGE : BOOT_BUNDLE_ERR_FLASH;
+        }
+    }
+    /* the slot is in force, the files follow it */
+    for (uint32_t i = 0; i < bundle.num; i++) {
+        entry = bundle_entry(i);
+        if (entry->dest == BOOT_BUNDLE_DEST_SLOT) {
+            continue;
+        }
+        bundle_tmp_path(path, sizeof(path), i);
+        if (bundle.status != BOOT_BUNDLE_OK) {
+            lfs_remove(&bundle_lfs, path);
+            continue;
+        }
+        bundle_mkdirs(entry->dest == BOOT_BUNDLE_DEST_ESP ? BOOT_ESPFLASH_PATH : entry->path);
+        if (lfs_rename(&bundle_lfs, path, entry->dest == BOOT_BUNDLE_DEST_ESP ? BOOT_ESPFLASH_PATH : entry->path)
+                != LFS_ERR_OK) {
+            elog_e(TAG, "entry %u not put in place", (unsigned) i);
+            bundle.status = BOOT_BUNDLE_ERR_FLASH;
+        }
+    }
+    lfs_unmount(&bundle_lfs);
+    bundle.mounted = false;
+
+    if (bundle.status == BOOT_BUNDLE_OK) {
+        elog_i(TAG, "%u entries in place%s", (unsigned) bundle.num, *selected ? ", slot selected" : "");
+    } else {
+        elog_e(TAG, "bundle dropped(%d)", bundle.status);
+    }
+    return bundle.status;
+}
+
+#endif /* BOOT_LFS */
@@ -0,0 +1,248 @@
+/**
+ * @file boot_clock.c
+ * @brief Bring the flashes up on HSI while HSE starts, see boot_clock.h.
+ */
+#include "boot_clock.h"
+#include "main.h"
+#include <stdbool.h>
+#include <string.h>
+#include "octospi.h"
+#include "usart.h"
+#include "boot_warm.h"
+#include "elog.h"
+#ifdef BOOT_DIRECT_LL
+#include "stm32h7xx_ll_pwr.h"
+#include "stm32h7xx_ll_rcc.h"
+#include "stm32h7xx_ll_system.h"
+#endif
+
+/* PLL2 input, HSE / M, and the VCO range of RCC_PLL2VCOWIDE */
+#define CLOCK_PLL2_REF_HZ               (HSE_VALUE / BOOT_CLOCK_PLL2_M)
+#define CLOCK_PLL2_VCO_MIN_HZ           192000000UL
+#define CLOCK_PLL2_VCO_MAX_HZ           836000000UL
+#define CLOCK_PLL2_DIV_MAX              128
+#define CLOCK_PLL2_FRACN_ONE            8192
+
+void SystemClock_Config(void);
+
+/**
+ * the PLL2 of SPI2 alone, or with BOOT_CLOCK_OSPI_PLL2_HZ on PLL2R: the VCO is the multiple of the target with
+ * the fastest SPI2 kernel clock on PLL2P, N and FRACN round it down
+ */
+static void clock_pll2_params(RCC_PLL2InitTypeDef *pll2) {
+    memset(pll2, 0, sizeof(RCC_PLL2InitTypeDef));
+    pll2->PLL2M = BOOT_CLOCK_PLL2_M;
+    pll2->PLL2N = BOOT_CLOCK_PLL2_N;
+    pll2->PLL2P = BOOT_CLOCK_PLL2_P;
+    pll2->PLL2Q = 2;
+    pll2->PLL2R = 2;
+    pll2->PLL2RGE = RCC_PLL2VCIRANGE_2;
+    pll2->PLL2VCOSEL = RCC_PLL2VCOWIDE;
+#if BOOT_CLOCK_OSPI_PLL2_HZ
+    {
+        uint32_t vco, p, spi2, best = 0;
+
+        for (uint32_t r = 1; r <= CLOCK_PLL2_DIV_MAX && r * BOOT_CLOCK_OSPI_PLL2_HZ <= CLOCK_PLL2_VCO_MAX_HZ; r++) {
+            vco = r * BOOT_CLOCK_OSPI_PLL2_HZ;
+            p = (vco + BOOT_CLOCK_SPI2_KERNEL_MAX_HZ - 1) / BOOT_CLOCK_SPI2_KERNEL_MAX_HZ;
+            spi2 = vco / p;
+            if (vco < CLOCK_PLL2_VCO_MIN_HZ || p > CLOCK_PLL2_DIV_MAX || spi2 <= best) {
+                continue;
+            }
+            best = spi2;
+            pll2->PLL2N = vco / CLOCK_PLL2_REF_HZ;
+            pll2->PLL2FRACN = (uint32_t) ((uint64_t) (vco % CLOCK_PLL2_REF_HZ) * CLOCK_PLL2_FRACN_ONE
+                                          / CLOCK_PLL2_REF_HZ);
+            pll2->PLL2P = p;
+            pll2->PLL2R = r;
+        }
+    }
+#endif
+}
+
+/**
+ * start PLL2 from HSE, unless it runs as clock_pll2_params() has it already
+ *
+ * @note only on the PLL clock, HSE is ready then; no kernel clock of PLL2 may be in use when it's set up again
+ *
+ * @return false: no HSE reference
+ */
+static bool clock_pll2_start(void) {
+    RCC_PLL2InitTypeDef pll2;
+    uint32_t divr;
+
+    clock_pll2_params(&pll2);
+    divr = ((pll2.PLL2N - 1U) << RCC_PLL2DIVR_N2_Pos) | ((pll2.PLL2P - 1U) << RCC_PLL2DIVR_P2_Pos)
+           | ((pll2.PLL2Q - 1U) << RCC_PLL2DIVR_Q2_Pos) | ((pll2.PLL2R - 1U) << RCC_PLL2DIVR_R2_Pos);
+    if (__HAL_RCC_GET_PLL_OSCSOURCE() != RCC_PLLSOURCE_HSE) {
+        return false;
+    }
+    if (__HAL_RCC_GET_FLAG(RCC_FLAG_PLL2RDY) && RCC->PLL2DIVR == divr
+            && ((RCC->PLLCKSELR & RCC_PLLCKSELR_DIVM2) >> RCC_PLLCKSELR_DIVM2_Pos) == pll2.PLL2M
+            && ((RCC->PLL2FRACR & RCC_PLL2FRACR_FRACN2) >> RCC_PLL2FRACR_FRACN2_Pos) == pll2.PLL2FRACN
+            && READ_BIT(RCC->PLLCFGR, RCC_PLL2_DIVP | RCC_PLL2_DIVR) == (RCC_PLL2_DIVP | RCC_PLL2_DIVR)) {
+        return true;
+    }
+
+    /* as RCCEx_PLL2_Config(), both outputs at once and no tick: the direct path runs without the SysTick */
+    __HAL_RCC_PLL2_DISABLE();
+    while (__HAL_RCC_GET_FLAG(RCC_FLAG_PLL2RDY)) {
+    }
+    __HAL_RCC_PLL2_CONFIG(pll2.PLL2M, pll2.PLL2N, pll2.PLL2P, pll2.PLL2Q, pll2.PLL2R);
+    __HAL_RCC_PLL2_VCIRANGE(pll2.PLL2RGE);
+    __HAL_RCC_PLL2_VCORANGE(pll2.PLL2VCOSEL);
+    __HAL_RCC_PLL2FRACN_DISABLE();
+    __HAL_RCC_PLL2FRACN_CONFIG(pll2.PLL2FRACN);
+    __HAL_RCC_PLL2FRACN_ENABLE();
+    __HAL_RCC_PLL2CLKOUT_ENABLE(RCC_PLL2_DIVP | RCC_PLL2_DIVR);
+    __HAL_RCC_PLL2_ENABLE();
+    while (!__HAL_RCC_GET_FLAG(RCC_FLAG_PLL2RDY)) {
+    }
+    return true;
+}
+
+/**
+ * request VOS0 and start HSE, no wait for either
+ *
+ * @note call it right after HAL_Init(), SystemClock_Config() is not called by main() any more
+ */
+void boot_clock_start(void) {
+    HAL_PWREx_ConfigSupply(PWR_EXTERNAL_SOURCE_SUPPLY);
+    __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE0);
+    __HAL_RCC_HSE_CONFIG(RCC_HSE_ON);
+}
+
+/**
+ * set the SPI2 kernel clock for the current clock, MX_SPI2_Init() sets PLL1Q
+ *
+ * @note no SPI2 transfer may be on the way
+ */
+void boot_clock_spi2(void) {
+    /* PLL2 runs from HSE, so it is only there on the PLL clock, the SPI is disabled between the transfers */
+    if (__HAL_RCC_GET_SYSCLK_SOURCE() == RCC_SYSCLKSOURCE_STATUS_PLLCLK) {
+        /* else PLL1Q = 110MHz, the clock before PLL2 */
+        __HAL_RCC_SPI123_CONFIG(clock_pll2_start() ? RCC_SPI123CLKSOURCE_PLL2 : RCC_SPI123CLKSOURCE_PLL);
+    } else {
+        __HAL_RCC_SPI123_CONFIG(RCC_SPI123CLKSOURCE_CLKP);
+    }
+}
+
+/**
+ * set the OCTOSPI1 kernel clock for the current clock: PLL2R on the PLL clock with BOOT_CLOCK_OSPI_PLL2_HZ,
+ * HCLK otherwise; the prescaler is left as it is
+ *
+ * @note OCTOSPI1 must be idle, the direct path calls it after the switch to the PLL, before the jump
+ */
+void boot_clock_ospi(void) {
+#if BOOT_CLOCK_OSPI_PLL2_HZ
+    while (READ_BIT(OCTOSPI1->SR, OCTOSPI_SR_BUSY)) {
+    }
+    if (__HAL_RCC_GET_SYSCLK_SOURCE() == RCC_SYSCLKSOURCE_STATUS_PLLCLK && clock_pll2_start()) {
+        __HAL_RCC_OSPI_CONFIG(RCC_OSPICLKSOURCE_PLL2);
+    } else {
+        __HAL_RCC_OSPI_CONFIG(RCC_OSPICLKSOURCE_HCLK);
+    }
+#endif
+}
+
+/**
+ * @return the OCTOSPI1 kernel clock in force, its prescaler divides it
+ */
+uint32_t boot_clock_ospi_hz(void) {
+    PLL2_ClocksTypeDef pll2;
+
+    if (__HAL_RCC_GET_OSPI_SOURCE() == RCC_OSPICLKSOURCE_PLL2) {
+        HAL_RCCEx_GetPLL2ClockFreq(&pll2);
+        return pll2.PLL2_R_Frequency;
+    }
+    return HAL_RCC_GetHCLKFreq();
+}
+
+/**
+ * set the OCTOSPI1 kernel clock and prescaler, the SPI2 kernel clock and the USART2 baud rate for the current
+ * clock
+ *
+ * @note OCTOSPI1 must be in indirect mode and idle, no log may be on the way (elog_port_flush())
+ */
+void boot_clock_retime(void) {
+    uint32_t prescaler;
+
+    while (READ_BIT(hospi1.Instance->SR, OCTOSPI_SR_BUSY)) {
+    }
+    boot_clock_ospi();
+    prescaler = (boot_clock_ospi_hz() + BOOT_CLOCK_OSPI_MAX_HZ - 1) / BOOT_CLOCK_OSPI_MAX_HZ;
+    hospi1.Init.ClockPrescaler = prescaler;
+    MODIFY_REG(hospi1.Instance->DCR2, OCTOSPI_DCR2_PRESCALER, (prescaler - 1U) << OCTOSPI_DCR2_PRESCALER_Pos);
+
+    boot_clock_spi2();
+    /* the BRR is computed from PCLK1 */
+    HAL_UART_Init(&huart2);
+}
+
+/**
+ * wait the PLL lock, switch SYSCLK to it and re-time the peripherals
+ *
+ * @note after boot_warm_enter() the PLL is on, only the peripherals are re-timed
+ */
+void boot_clock_switch(void) {
+    elog_port_flush();
+    /* the warm entry runs on the PLL of SystemClock_Config() already, the HAL refuses to set it up again */
+    if (!boot_warm_entered()) {
+        SystemClock_Config();
+    }
+    boot_clock_retime();
+}
+
+#ifdef BOOT_DIRECT_LL
+/**
+ * SystemClock_Config() in register writes, for the direct path which runs without HAL_Init()
+ *
+ * @note no SysTick is started, SystemCoreClock is updated
+ */
+void boot_clock_config_ll(void) {
+    /* the supply is locked since the power-on, the same value is written again */
+    LL_PWR_ConfigSupply(LL_PWR_EXTERNAL_SOURCE_SUPPLY);
+    while (!LL_PWR_IsActiveFlag_ACTVOS()) {
+    }
+    LL_PWR_SetRegulVoltageScaling(LL_PWR_REGU_VOLTAGE_SCALE0);
+    LL_RCC_HSE_Enable();
+    while (!LL_PWR_IsActiveFlag_VOS()) {
+    }
+    while (!LL_RCC_HSE_IsReady()) {
+    }
+
+    /* HSE 25MHz / 5 = 5MHz, * 110 = 550MHz VCO, / 1 = 550MHz SYSCLK */
+    LL_RCC_PLL_SetSource(LL_RCC_PLLSOURCE_HSE);
+    LL_RCC_PLL1_SetVCOInputRange(LL_RCC_PLLINPUTRANGE_4_8);
+    LL_RCC_PLL1_SetVCOOutputRange(LL_RCC_PLLVCORANGE_WIDE);
+    LL_RCC_PLL1_SetM(5);
+    LL_RCC_PLL1_SetN(110);
+    LL_RCC_PLL1_SetP(1);
+    LL_RCC_PLL1_SetQ(5);
+    LL_RCC_PLL1_SetR(2);
+    LL_RCC_PLL1FRACN_Disable();
+    LL_RCC_PLL1_SetFRACN(0);
+    LL_RCC_PLL1P_Enable();
+    LL_RCC_PLL1Q_Enable();
+    LL_RCC_PLL1R_Enable();
+    LL_RCC_PLL1_Enable();
+    while (!LL_RCC_PLL1_IsReady()) {
+    }
+
+    /* the latency and the dividers before the faster clock, as HAL_RCC_ClockConfig() */
+    LL_FLASH_SetLatency(LL_FLASH_LATENCY_3);
+    while (LL_FLASH_GetLatency() != LL_FLASH_LATENCY_3) {
+    }
+    LL_RCC_SetAPB3Prescaler(LL_RCC_APB3_DIV_2);
+    LL_RCC_SetAPB1Prescaler(LL_RCC_APB1_DIV_2);
+    LL_RCC_SetAPB2Prescaler(LL_RCC_APB2_DIV_2);
+    LL_RCC_SetAPB4Prescaler(LL_RCC_APB4_DIV_2);
+    LL_RCC_SetAHBPrescaler(LL_RCC_AHB_DIV_2);
+    LL_RCC_SetSysPrescaler(LL_RCC_SYSCLK_DIV_1);
+    LL_RCC_SetSysClkSource(LL_RCC_SYS_CLKSOURCE_PLL1);
+    while (LL_RCC_GetSysClkSource() != LL_RCC_SYS_CLKSOURCE_STATUS_PLL1) {
+    }
+
+    SystemCoreClockUpdate();
+}
+#endif /* BOOT_DIRECT_LL */
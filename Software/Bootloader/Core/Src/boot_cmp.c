@@ -0,0 +1,145 @@
+/**
+ * @file boot_cmp.c
+ * @brief Compare, blank check and software CRC-32 of the verify paths, see boot_cmp.h.
+ */
+#include "boot_cmp.h"
+
+/* two LDRD pairs a round */
+#define CMP_ROUND_SIZE                  16
+#define CRC_POLY                        0xEDB88320UL
+
+/* a word aligned pair of words: the M7 loads it by one LDRD, which needs no more than 4 bytes alignment */
+typedef uint64_t cmp_pair __attribute__((aligned(4), may_alias));
+typedef uint32_t cmp_word __attribute__((may_alias));
+
+/* slicing by 4, crc_table[k][i]: the CRC of byte i followed by k zero bytes */
+static uint32_t crc_table[4][256] __attribute__((section(".dtcm_bss")));
+static volatile bool crc_table_ready;
+
+static void crc_table_init(void) {
+    uint32_t crc;
+
+    for (uint32_t i = 0; i < 256; i++) {
+        crc = i;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC_POLY & (0 - (crc & 1)));
+        }
+        crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (uint8_t k = 1; k < 4; k++) {
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xFF];
+        }
+    }
+    /* an interrupt taking a CRC before this builds the same tables again */
+    crc_table_ready = true;
+}
+
+/**
+ * the two blocks hold the same bytes, as memcmp(a, b, size) == 0
+ *
+ * @param a first block, e.g. the memory-mapped flash
+ * @param b second block
+ * @param size bytes to compare
+ *
+ * @return true: same bytes, false: a byte differs, the compare stops at the round holding it
+ */
+__attribute__((section(".itcm_text"), noinline))
+bool boot_cmp_equal(const void *a, const void *b, size_t size) {
+    const uint8_t *pa = (const uint8_t *) a, *pb = (const uint8_t *) b;
+    const cmp_pair *qa, *qb;
+    uint64_t a0, a1, b0, b1;
+
+    for (; size && (uintptr_t) pa % 4; size--) {
+        if (*pa++ != *pb++) {
+            return false;
+        }
+    }
+    if ((uintptr_t) pb % 4 == 0) {
+        qa = (const cmp_pair *) pa;
+        qb = (const cmp_pair *) pb;
+        for (; size >= CMP_ROUND_SIZE; size -= CMP_ROUND_SIZE, qa += 2, qb += 2) {
+            /* all four loads before the compare, the second pair of each block dual-issues with the first */
+            a0 = qa[0];
+            b0 = qb[0];
+            a1 = qa[1];
+            b1 = qb[1];
+            if ((a0 ^ b0) | (a1 ^ b1)) {
+                return false;
+            }
+        }
+        pa = (const uint8_t *) qa;
+        pb = (const uint8_t *) qb;
+    }
+    for (; size; size--) {
+        if (*pa++ != *pb++) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * all bytes of the block are 0xFF, the erased state of the NOR flashes
+ *
+ * @param buf block, e.g. the memory-mapped flash
+ * @param size bytes to check
+ *
+ * @return true: blank, false: a byte is programmed, the check stops at the round holding it
+ */
+__attribute__((section(".itcm_text"), noinline))
+bool boot_cmp_blank(const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *) buf;
+    const cmp_pair *q;
+
+    for (; size && (uintptr_t) p % 4; size--) {
+        if (*p++ != 0xFF) {
+            return false;
+        }
+    }
+    q = (const cmp_pair *) p;
+    for (; size >= CMP_ROUND_SIZE; size -= CMP_ROUND_SIZE, q += 2) {
+        if ((q[0] & q[1]) != UINT64_MAX) {
+            return false;
+        }
+    }
+    for (p = (const uint8_t *) q; size; size--) {
+        if (*p++ != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * CRC-32 of zlib by the tables, 4 bytes a round, same result as the CRC unit of boot_crc.h
+ *
+ * @param crc CRC of the previous part, 0 for the first one
+ * @param buf data, any alignment
+ * @param size data size
+ *
+ * @return CRC till this part
+ */
+__attribute__((section(".itcm_text"), noinline))
+uint32_t boot_cmp_crc32(uint32_t crc, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *) buf;
+
+    if (!crc_table_ready) {
+        crc_table_init();
+    }
+    crc = ~crc;
+    for (; size && (uintptr_t) p % 4; size--) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+    }
+    for (; size >= 4; size -= 4, p += 4) {
+        /* little-endian: the first byte of the word is the lowest one */
+        crc ^= *(const cmp_word *) p;
+        crc = crc_table[3][crc & 0xFF] ^ crc_table[2][(crc >> 8) & 0xFF] ^ crc_table[1][(crc >> 16) & 0xFF]
+                ^ crc_table[0][crc >> 24];
+    }
+    for (; size; size--) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+    }
+
+    return ~crc;
+}
@@ -0,0 +1,454 @@
+/**
+ * @file boot_console.c
+ * @brief Service console on USART2, see boot_console.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_CONSOLE
+
+#include "boot_console.h"
+#include "boot_bench.h"
+#include "boot_ext.h"
+#include "boot_image.h"
+#include "boot_pcprof.h"
+#include "boot_perf.h"
+#include "boot_profile.h"
+#include "boot_slot.h"
+#include "boot_trace.h"
+#include "boot_uart.h"
+#include "boot_verify.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include "elog.h"
+#include <stdlib.h>
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "console");
+
+#define CONSOLE_ARGS_MAX                4
+/* read and dump go through it, a temp buffer of the AXI arena the MDMA and DMA1 both reach */
+#define CONSOLE_BUF_SIZE                BOOT_CONSOLE_DUMP_MAX
+#define CONSOLE_DUMP_WIDTH              16
+
+extern sfud_err qspi_exit_memory_mapped_mode(sfud_flash *flash);
+
+static const char *const stats_names[SFUD_STATS_OP_NUM] = { "read", "write", "erase", "status" };
+
+typedef struct {
+    char line[BOOT_CONSOLE_LINE_SIZE];
+    size_t len;
+    char *argv[CONSOLE_ARGS_MAX + 1];
+    int argc;
+} console_state;
+
+static sfud_flash *console_flash(const char *name) {
+    if (!strcmp(name, "ext")) {
+        return boot_ext_flash();
+    } else if (!strcmp(name, "main")) {
+        return sfud_get_device(SFUD_MAIN_FLASH);
+    }
+    elog_raw("no flash '%s', ext or main\r\n", name);
+    return NULL;
+}
+
+static bool console_number(const char *arg, uint32_t *value) {
+    char *end;
+
+    *value = (uint32_t) strtoul(arg, &end, 0);
+    if (*arg == '\0' || *end != '\0') {
+        elog_raw("not a number: %s\r\n", arg);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * <flash> <addr> <len> of read, dump and erase, the range inside the flash
+ */
+static sfud_flash *console_range(const console_state *state, uint32_t *addr, uint32_t *len) {
+    sfud_flash *flash;
+
+    if (state->argc != 4) {
+        elog_raw("usage: %s <flash> <addr> <len>\r\n", state->argv[0]);
+        return NULL;
+    }
+    if ((flash = console_flash(state->argv[1])) == NULL || !console_number(state->argv[2], addr)
+            || !console_number(state->argv[3], len)) {
+        return NULL;
+    }
+    if (!flash->init_ok || *addr > flash->chip.capacity || *len > flash->chip.capacity - *addr) {
+        elog_raw("0x%08x + 0x%x is out of the %s flash\r\n", *addr, *len, flash->name);
+        return NULL;
+    }
+    return flash;
+}
+
+static uint32_t console_us(uint32_t start) {
+    return (uint32_t) ((uint64_t) (DWT->CYCCNT - start) * 1000000 / SystemCoreClock);
+}
+
+static void cmd_read(const console_state *state, uint8_t *buf) {
+    uint32_t addr, len, n, crc = 0, start, us;
+    sfud_flash *flash = console_range(state, &addr, &len);
+    sfud_err result = SFUD_SUCCESS;
+
+    if (!flash) {
+        return;
+    }
+    start = DWT->CYCCNT;
+    for (uint32_t done = 0; done < len && result == SFUD_SUCCESS; done += n) {
+        n = len - done < CONSOLE_BUF_SIZE ? len - done : CONSOLE_BUF_SIZE;
+        result = sfud_read(flash, addr + done, n, buf);
+        crc = boot_image_crc32(crc, buf, n);
+    }
+    us = console_us(start);
+    if (result != SFUD_SUCCESS) {
+        elog_raw("read failed, error %d\r\n", result);
+        return;
+    }
+    elog_raw("crc32 0x%08x, %u bytes in %u us, %u KB/s\r\n", crc, len, us,
+             us ? (unsigned) ((uint64_t) len * 1000000 / 1024 / us) : 0);
+}
+
+/**
+ * hex lines of CONSOLE_DUMP_WIDTH bytes, the address of the first one ahead
+ */
+static void console_hex(uint32_t addr, const uint8_t *buf, uint32_t len) {
+    static const char hex[] = "0123456789abcdef";
+    char text[CONSOLE_DUMP_WIDTH * 3 + 1], *p;
+    uint32_t i, j;
+
+    for (i = 0; i < len; i += CONSOLE_DUMP_WIDTH) {
+        for (j = i, p = text; j < len && j < i + CONSOLE_DUMP_WIDTH; j++) {
+            *p++ = ' ';
+            *p++ = hex[buf[j] >> 4];
+            *p++ = hex[buf[j] & 0xF];
+        }
+        *p = '\0';
+        elog_raw("%08x:%s\r\n", addr + i, text);
+    }
+}
+
+static void cmd_dump(const console_state *state, uint8_t *buf) {
+    uint32_t addr, len;
+    sfud_flash *flash = console_range(state, &addr, &len);
+    sfud_err result;
+
+    if (!flash) {
+        return;
+    }
+    if (len > BOOT_CONSOLE_DUMP_MAX) {
+        len = BOOT_CONSOLE_DUMP_MAX;
+    }
+    if ((result = sfud_read(flash, addr, len, buf)) != SFUD_SUCCESS) {
+        elog_raw("read failed, error %d\r\n", result);
+        return;
+    }
+    console_hex(addr, buf, len);
+}
+
+/**
+ * the PC profile, with hex: the record itself for Tools/xip_order.py
+ */
+static void cmd_pcprof(const console_state *state) {
+    if (state->argc == 2 && !strcmp(state->argv[1], "hex")) {
+        console_hex(BOOT_PCPROF_ADDR, (const uint8_t *) &boot_pcprof_record, sizeof(boot_pcprof));
+    } else if (state->argc == 1) {
+        boot_pcprof_print();
+    } else {
+        elog_raw("usage: pcprof [hex]\r\n");
+    }
+}
+
+static void cmd_erase(const console_state *state) {
+    uint32_t addr, len, start;
+    sfud_flash *flash = console_range(state, &addr, &len);
+    sfud_err result;
+
+    if (!flash) {
+        return;
+    }
+    boot_verify_dirty(flash, addr, len);
+    start = DWT->CYCCNT;
+    result = sfud_erase(flash, addr, len);
+    if (result != SFUD_SUCCESS) {
+        elog_raw("erase failed, error %d\r\n", result);
+        return;
+    }
+    elog_raw("erased in %u us\r\n", console_us(start));
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void cmd_write(const console_state *state, uint8_t *buf) {
+    const char *digits;
+    uint32_t addr, len, i;
+    sfud_flash *flash;
+    sfud_err result;
+    int hi, lo;
+
+    if (state->argc != 4) {
+        elog_raw("usage: write <flash> <addr> <hex>\r\n");
+        return;
+    }
+    digits = state->argv[3];
+    len = (uint32_t) strlen(digits) / 2;
+    if ((flash = console_flash(state->argv[1])) == NULL || !console_number(state->argv[2], &addr)) {
+        return;
+    }
+    if (strlen(digits) % 2 || len == 0 || len > SFUD_WRITE_MAX_PAGE_SIZE || !flash->init_ok
+            || addr > flash->chip.capacity || len > flash->chip.capacity - addr) {
+        elog_raw("1 to %u bytes inside the %s flash, two hex digits each\r\n", SFUD_WRITE_MAX_PAGE_SIZE, flash->name);
+        return;
+    }
+    for (i = 0; i < len; i++) {
+        if ((hi = hex_digit(digits[2 * i])) < 0 || (lo = hex_digit(digits[2 * i + 1])) < 0) {
+            elog_raw("not a hex digit at %u\r\n", 2 * i);
+            return;
+        }
+        buf[i] = (uint8_t) (hi << 4 | lo);
+    }
+    boot_verify_dirty(flash, addr, len);
+    if ((result = sfud_write(flash, addr, len, buf)) != SFUD_SUCCESS) {
+        elog_raw("write failed, error %d\r\n", result);
+        return;
+    }
+    elog_raw("%u bytes written\r\n", len);
+}
+
+static void cmd_stats(void) {
+    const sfud_stats *stats;
+    const sfud_stats_entry *entry;
+    sfud_flash *flash;
+    int i, op;
+
+    elog_raw("%-6s %-6s %10s %10s %12s %10s %12s %8s %6s\r\n", "flash", "op", "count", "bytes", "total us",
+             "max us", "busy us", "retries", "errors");
+    for (i = 0; i < SFUD_FLASH_DEVICE_NUM; i++) {
+        flash = sfud_get_device(i);
+        if (!flash->init_ok || (stats = sfud_get_stats(flash)) == NULL) {
+            continue;
+        }
+        for (op = 0; op < SFUD_STATS_OP_NUM; op++) {
+            entry = &stats->op[op];
+            elog_raw("%-6s %-6s %10u %10u %12u %10u %12u %8u %6u\r\n", flash->name, stats_names[op], entry->count,
+                     entry->bytes, entry->total_us, entry->max_us, entry->busy_us, entry->retries, entry->bus_errors);
+        }
+    }
+}
+
+static void cmd_bench(const console_state *state) {
+    sfud_flash *flash = sfud_get_device(SFUD_MAIN_FLASH);
+
+    if (state->argc == 2 && !strcmp(state->argv[1], "mem")) {
+        boot_bench_mem_run();
+    } else if (state->argc == 2 && !strcmp(state->argv[1], "log")) {
+        boot_bench_log_run();
+    } else {
+        boot_bench_run();
+    }
+    /* the bench leaves the MAIN flash memory-mapped, the console and the boot go on in indirect mode */
+    qspi_exit_memory_mapped_mode(flash);
+}
+
+static void cmd_profile(void) {
+    const boot_profile *profile = &boot_profile_record;
+    int i;
+
+    elog_raw("reset flags 0x%08x, stack %u of %u bytes\r\n", profile->reset_flags, boot_profile_stack_peak(),
+             boot_profile_stack_size());
+    elog_raw("%-16s %12s %10s\r\n", "stage", "cycles", "us");
+    for (i = 0; i < BOOT_STAGE_NUM; i++) {
+        if (profile->cycles[i]) {
+            elog_raw("%-16s %12u %10u\r\n", boot_profile_stage_name((boot_stage) i), profile->cycles[i],
+                     boot_profile_stage_us((boot_stage) i));
+        }
+    }
+}
+
+static void cmd_perf(void) {
+    /* the history is in the store of the EXT flash */
+    boot_ext_flash();
+    boot_perf_print();
+}
+
+static void cmd_slot(const console_state *state) {
+    sfud_flash *flash = sfud_get_device(SFUD_MAIN_FLASH);
+    boot_slot_record record;
+    boot_slot_id slot;
+    sfud_err result;
+
+    if (state->argc == 2) {
+        if (strcmp(state->argv[1], "a") && strcmp(state->argv[1], "b")) {
+            elog_raw("usage: slot [a|b]\r\n");
+            return;
+        }
+        slot = state->argv[1][0] == 'a' ? BOOT_SLOT_A : BOOT_SLOT_B;
+        if ((result = boot_slot_switch(flash, slot)) != SFUD_SUCCESS) {
+            elog_raw("switch failed, error %d\r\n", result);
+            return;
+        }
+        elog_i(TAG, "slot %c selected", 'A' + slot);
+    }
+    if ((result = boot_slot_record_read(flash, &record)) != SFUD_SUCCESS) {
+        elog_raw("no slot record, error %d\r\n", result);
+        return;
+    }
+    elog_raw("active slot %c, seq %u\r\n", 'A' + record.active, record.seq);
+}
+
+static void cmd_help(void) {
+    elog_raw("read|dump|erase <ext|main> <addr> <len>, write <ext|main> <addr> <hex>, stats, bench [mem|log], profile, "
+             "perf, trace, pcprof [hex], slot [a|b], bridge [download], upload, boot, reset\r\n");
+}
+
+/**
+ * split the line into argv at the spaces
+ */
+static void console_parse(console_state *state) {
+    char *p = state->line;
+
+    state->argc = 0;
+    while (*p && state->argc <= CONSOLE_ARGS_MAX) {
+        while (*p == ' ' || *p == '\t') {
+            *p++ = '\0';
+        }
+        if (*p) {
+            state->argv[state->argc++] = p;
+        }
+        while (*p && *p != ' ' && *p != '\t') {
+            p++;
+        }
+    }
+}
+
+/**
+ * run the line in state->line
+ *
+ * @return false: the console is over, *how says why
+ */
+static bool console_command(console_state *state, boot_console_exit *how) {
+    const char *cmd;
+    size_t mark = dma_alloc_mark(DMA_REGION_AXI);
+    uint8_t *buf = dma_alloc_temp(CONSOLE_BUF_SIZE, DMA_REGION_AXI);
+    bool more = true;
+
+    console_parse(state);
+    if (state->argc == 0) {
+        dma_alloc_release(DMA_REGION_AXI, mark);
+        return true;
+    }
+    cmd = state->argv[0];
+    if (!buf) {
+        elog_raw("no room for the %u bytes buffer\r\n", (unsigned) CONSOLE_BUF_SIZE);
+    } else if (!strcmp(cmd, "read")) {
+        cmd_read(state, buf);
+    } else if (!strcmp(cmd, "dump")) {
+        cmd_dump(state, buf);
+    } else if (!strcmp(cmd, "erase")) {
+        cmd_erase(state);
+    } else if (!strcmp(cmd, "write")) {
+        cmd_write(state, buf);
+    } else if (!strcmp(cmd, "stats")) {
+        cmd_stats();
+    } else if (!strcmp(cmd, "bench")) {
+        cmd_bench(state);
+    } else if (!strcmp(cmd, "profile")) {
+        cmd_profile();
+    } else if (!strcmp(cmd, "perf")) {
+        cmd_perf();
+    } else if (!strcmp(cmd, "trace")) {
+        boot_trace_print();
+    } else if (!strcmp(cmd, "pcprof")) {
+        cmd_pcprof(state);
+    } else if (!strcmp(cmd, "slot")) {
+        cmd_slot(state);
+    } else if (!strcmp(cmd, "bridge")) {
+        if (state->argc == 2 && strcmp(state->argv[1], "download")) {
+            elog_raw("usage: bridge [download]\r\n");
+        } else {
+            *how = state->argc == 2 ? BOOT_CONSOLE_EXIT_BRIDGE_DOWNLOAD : BOOT_CONSOLE_EXIT_BRIDGE;
+            more = false;
+        }
+    } else if (!strcmp(cmd, "upload")) {
+        *how = BOOT_CONSOLE_EXIT_UPLOAD;
+        more = false;
+    } else if (!strcmp(cmd, "boot")) {
+        *how = BOOT_CONSOLE_EXIT_BOOT;
+        more = false;
+    } else if (!strcmp(cmd, "reset")) {
+#ifdef SFUD_USING_QSPI_QPI
+        /* the reset doesn't reach the flash */
+        sfud_qspi_qpi_disable(sfud_get_device(SFUD_MAIN_FLASH));
+#endif
+        elog_port_flush();
+        NVIC_SystemReset();
+    } else {
+        cmd_help();
+    }
+    dma_alloc_release(DMA_REGION_AXI, mark);
+
+    return more;
+}
+
+/**
+ * take the input so far into the line, echoed
+ *
+ * @return true: a whole line is in state->line
+ */
+static bool console_line(console_state *state) {
+    char c;
+
+    while (boot_uart_read(&c, 1)) {
+        if (c == '\r' || c == '\n') {
+            if (state->len == 0) {
+                continue;
+            }
+            state->line[state->len] = '\0';
+            state->len = 0;
+            elog_raw("\r\n");
+            return true;
+        } else if ((c == '\b' || c == 0x7F) && state->len) {
+            state->len--;
+            elog_raw("\b \b");
+        } else if (c >= ' ' && c < 0x7F && state->len < sizeof(state->line) - 1) {
+            state->line[state->len++] = c;
+            elog_raw("%c", c);
+        }
+    }
+    return false;
+}
+
+/**
+ * run the commands of the host till boot, upload or BOOT_CONSOLE_IDLE_MS without a line
+ *
+ * @return how the console was left
+ */
+boot_console_exit boot_console_run(void) {
+    boot_console_exit how = BOOT_CONSOLE_EXIT_BOOT;
+    console_state state;
+    uint32_t last = HAL_GetTick();
+
+    memset(&state, 0, sizeof(state));
+    elog_i(TAG, "service console, help for the commands");
+    elog_raw("> ");
+    while (HAL_GetTick() - last < BOOT_CONSOLE_IDLE_MS) {
+        if (!console_line(&state)) {
+            continue;
+        }
+        last = HAL_GetTick();
+        if (!console_command(&state, &how)) {
+            break;
+        }
+        elog_raw("> ");
+    }
+    elog_i(TAG, how == BOOT_CONSOLE_EXIT_UPLOAD ? "upload" : how == BOOT_CONSOLE_EXIT_BOOT ? "boot" : "bridge");
+    return how;
+}
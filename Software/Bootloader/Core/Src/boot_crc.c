@@ -0,0 +1,103 @@
+/**
+ * @file boot_crc.c
+ * @brief CRC-32 of large memory blocks by the CRC unit, see boot_crc.h.
+ */
+#include "boot_crc.h"
+#include "main.h"
+
+/* MDMA block data length is 17 bits */
+#define CRC_DMA_MAX_SIZE                (64 * 1024)
+#define CRC_DMA_TIMEOUT_MS              100
+
+/* channel 0 serves the OCTOSPI1 FIFO */
+static MDMA_HandleTypeDef hmdma_crc;
+
+static bool crc_dma_init(void) {
+    if (hmdma_crc.Instance) {
+        return true;
+    }
+    __HAL_RCC_MDMA_CLK_ENABLE();
+
+    hmdma_crc.Instance = MDMA_Channel1;
+    hmdma_crc.Init.Request = MDMA_REQUEST_SW;
+    hmdma_crc.Init.TransferTriggerMode = MDMA_FULL_TRANSFER;
+    hmdma_crc.Init.Priority = MDMA_PRIORITY_HIGH;
+    hmdma_crc.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    hmdma_crc.Init.SourceInc = MDMA_SRC_INC_WORD;
+    hmdma_crc.Init.DestinationInc = MDMA_DEST_INC_DISABLE;
+    hmdma_crc.Init.SourceDataSize = MDMA_SRC_DATASIZE_WORD;
+    hmdma_crc.Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    hmdma_crc.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    hmdma_crc.Init.BufferTransferLength = 128;
+    /* bursts keep the OCTOSPI1 prefetching, CRC->DR takes single writes */
+    hmdma_crc.Init.SourceBurst = MDMA_SOURCE_BURST_16BEATS;
+    hmdma_crc.Init.DestBurst = MDMA_DEST_BURST_SINGLE;
+    hmdma_crc.Init.SourceBlockAddressOffset = 0;
+    hmdma_crc.Init.DestBlockAddressOffset = 0;
+    if (HAL_MDMA_Init(&hmdma_crc) != HAL_OK) {
+        hmdma_crc.Instance = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * CRC-32 (zlib) of a memory block
+ *
+ * @param buf block, 4 bytes aligned
+ * @param size block size
+ * @param crc CRC-32 of the block
+ *
+ * @return false: the MDMA failed, crc is not set
+ */
+bool boot_crc32_hw(const void *buf, size_t size, uint32_t *crc) {
+    return boot_crc32_hw_continue(0, buf, size, crc);
+}
+
+/**
+ * CRC-32 (zlib) of a memory block following the data of an earlier CRC, as boot_image_crc32(crc, buf, size)
+ *
+ * @param crc CRC-32 of the data before, 0: none
+ * @param buf block, 4 bytes aligned
+ * @param size block size
+ * @param next CRC-32 of the data before and the block
+ *
+ * @return false: the MDMA failed, next is not set
+ */
+bool boot_crc32_hw_continue(uint32_t crc, const void *buf, size_t size, uint32_t *next) {
+    const uint8_t *p = (const uint8_t *) buf;
+    size_t words = size & ~(size_t) 3, len;
+
+    if ((uintptr_t) buf % 4 || !crc_dma_init()) {
+        return false;
+    }
+
+    __HAL_RCC_CRC_CLK_ENABLE();
+    /* reflected in and out, the words are reversed as a whole so the lowest byte goes first */
+    CRC->POL = 0x04C11DB7;
+    /* the register holds the state unreflected and not inverted */
+    CRC->INIT = __RBIT(~crc);
+    CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_IN_1 | CRC_CR_REV_OUT;
+    CRC->CR |= CRC_CR_RESET;
+
+    while (words) {
+        len = words > CRC_DMA_MAX_SIZE ? CRC_DMA_MAX_SIZE : words;
+        if (HAL_MDMA_Start(&hmdma_crc, (uint32_t) (uintptr_t) p, (uint32_t) (uintptr_t) &CRC->DR, len, 1) != HAL_OK
+                || HAL_MDMA_PollForTransfer(&hmdma_crc, HAL_MDMA_FULL_TRANSFER, CRC_DMA_TIMEOUT_MS) != HAL_OK) {
+            HAL_MDMA_Abort(&hmdma_crc);
+            return false;
+        }
+        p += len;
+        words -= len;
+    }
+
+    /* a byte write is reversed in itself */
+    CRC->CR = (CRC->CR & ~CRC_CR_REV_IN) | CRC_CR_REV_IN_0;
+    for (size &= 3; size; size--) {
+        *(volatile uint8_t *) &CRC->DR = *p++;
+    }
+    *next = ~CRC->DR;
+
+    return true;
+}
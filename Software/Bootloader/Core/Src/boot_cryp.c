@@ -0,0 +1,216 @@
+/**
+ * @file boot_cryp.c
+ * @brief AES-128-CTR of the copies kept on the EXT flash by the CRYP unit, see boot_cryp.h.
+ */
+#include "boot_cryp.h"
+#include "boot_otfdec.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include <string.h>
+
+/* NDTR of the DMA streams counts 16 bits of words */
+#define CRYP_DMA_MAX_SIZE               (0xFFFF * 4 / BOOT_CRYP_BLOCK_SIZE * BOOT_CRYP_BLOCK_SIZE)
+#define CRYP_TIMEOUT_MS                 100
+/* 8 bits data, the byte stream goes through the AES in memory order */
+#define CRYP_CR_BYTES                   CRYP_CR_DATATYPE_1
+
+static DMA_HandleTypeDef hdma_cryp_in;
+static DMA_HandleTypeDef hdma_cryp_out;
+/* the partial block the last run leaves to the CPU */
+static const uint8_t *cryp_tail_in;
+static uint8_t *cryp_tail_out;
+static size_t cryp_tail_len;
+/* the DMA run being waited, 0: none */
+static size_t cryp_run_len;
+static uint8_t *cryp_run_out;
+
+static bool cryp_dma_init(DMA_HandleTypeDef *hdma, DMA_Stream_TypeDef *stream, uint32_t request, uint32_t direction) {
+    if (hdma->Instance) {
+        return true;
+    }
+    hdma->Instance = stream;
+    hdma->Init.Request = request;
+    hdma->Init.Direction = direction;
+    hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma->Init.MemInc = DMA_MINC_ENABLE;
+    hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma->Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma->Init.Mode = DMA_NORMAL;
+    /* the output first, a full output FIFO stalls the input */
+    hdma->Init.Priority = direction == DMA_PERIPH_TO_MEMORY ? DMA_PRIORITY_HIGH : DMA_PRIORITY_MEDIUM;
+    hdma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(hdma) != HAL_OK) {
+        hdma->Instance = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/* AES-128 key, [0] the low word as for the OTFDEC */
+static void cryp_key_load(const uint32_t key[4]) {
+    CRYP->K2LR = key[3];
+    CRYP->K2RR = key[2];
+    CRYP->K3LR = key[1];
+    CRYP->K3RR = key[0];
+}
+
+/**
+ * process one block by the CPU, the CRYP is enabled
+ */
+static bool cryp_block(const uint32_t in[4], uint32_t out[4]) {
+    uint32_t start = HAL_GetTick();
+
+    for (int i = 0; i < 4; i++) {
+        CRYP->DIN = in[i];
+    }
+    for (int i = 0; i < 4; i++) {
+        while (!(CRYP->SR & CRYP_SR_OFNE)) {
+            if (HAL_GetTick() - start > CRYP_TIMEOUT_MS) {
+                return false;
+            }
+        }
+        out[i] = CRYP->DOUT;
+    }
+    return true;
+}
+
+/**
+ * @return true: the OTFDEC key is provisioned, the copies are encrypted
+ */
+bool boot_cryp_ready(void) {
+    return ((const boot_otfdec_key_record *) BOOT_OTFDEC_KEY_ADDR)->magic == BOOT_OTFDEC_KEY_MAGIC;
+}
+
+/**
+ * derive the staging key and start a stream at block 0 of the nonce
+ *
+ * @param nonce the nonce of the copy, never the same for two copies of different data
+ *
+ * @return false: no key, or the CRYP didn't answer
+ */
+bool boot_cryp_ctr_start(const uint32_t nonce[BOOT_CRYP_NONCE_NUM]) {
+    const boot_otfdec_key_record *stored = (const boot_otfdec_key_record *) BOOT_OTFDEC_KEY_ADDR;
+    uint32_t label[4], key[4];
+    bool derived;
+
+    if (!boot_cryp_ready()) {
+        return false;
+    }
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    if (!cryp_dma_init(&hdma_cryp_in, DMA2_Stream4, DMA_REQUEST_CRYP_IN, DMA_MEMORY_TO_PERIPH)
+            || !cryp_dma_init(&hdma_cryp_out, DMA2_Stream5, DMA_REQUEST_CRYP_OUT, DMA_PERIPH_TO_MEMORY)) {
+        return false;
+    }
+    __HAL_RCC_CRYP_CLK_ENABLE();
+
+    /* the staging key: the label encrypted by the OTFDEC key */
+    memcpy(label, BOOT_CRYP_KEY_LABEL, sizeof(label));
+    CRYP->CR = CRYP_CR_ALGOMODE_AES_ECB | CRYP_CR_BYTES;
+    cryp_key_load(stored->key);
+    CRYP->CR |= CRYP_CR_FFLUSH;
+    CRYP->CR |= CRYP_CR_CRYPEN;
+    derived = cryp_block(label, key);
+    CLEAR_BIT(CRYP->CR, CRYP_CR_CRYPEN);
+    if (derived) {
+        CRYP->CR = CRYP_CR_ALGOMODE_AES_CTR | CRYP_CR_BYTES;
+        cryp_key_load(key);
+        CRYP->IV0LR = nonce[1];
+        CRYP->IV0RR = nonce[0];
+        CRYP->IV1LR = 0;
+        CRYP->IV1RR = 0;
+        CRYP->CR |= CRYP_CR_FFLUSH;
+        CRYP->CR |= CRYP_CR_CRYPEN;
+    }
+    memset(key, 0, sizeof(key));
+    cryp_tail_len = 0;
+    cryp_run_len = 0;
+
+    return derived;
+}
+
+/**
+ * start the DMA through the CRYP, the CPU is free till boot_cryp_ctr_wait()
+ *
+ * @param len bytes, a multiple of BOOT_CRYP_BLOCK_SIZE unless it's the last run of the stream
+ */
+sfud_err boot_cryp_ctr_run(const void *in, void *out, size_t len) {
+    size_t blocks = len / BOOT_CRYP_BLOCK_SIZE * BOOT_CRYP_BLOCK_SIZE;
+    uintptr_t start = (uintptr_t) out & ~(uintptr_t) (DMA_ALIGN - 1);
+    uintptr_t end = ((uintptr_t) out + blocks + DMA_ALIGN - 1) & ~(uintptr_t) (DMA_ALIGN - 1);
+
+    if (blocks > CRYP_DMA_MAX_SIZE) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    cryp_tail_in = (const uint8_t *) in + blocks;
+    cryp_tail_out = (uint8_t *) out + blocks;
+    cryp_tail_len = len - blocks;
+    cryp_run_len = blocks;
+    cryp_run_out = (uint8_t *) out;
+    if (blocks == 0) {
+        return SFUD_SUCCESS;
+    }
+
+    /* the DMA reads the memory, and its output must not meet a dirty line later; in may be out */
+    SCB_CleanDCache_by_Addr((uint32_t *) ((uintptr_t) in & ~(uintptr_t) (DMA_ALIGN - 1)),
+                            (int32_t) (blocks + (uintptr_t) in % DMA_ALIGN));
+    SCB_CleanInvalidateDCache_by_Addr((uint32_t *) start, (int32_t) (end - start));
+    if (HAL_DMA_Start(&hdma_cryp_out, (uint32_t) (uintptr_t) &CRYP->DOUT, (uint32_t) (uintptr_t) out, blocks / 4)
+            != HAL_OK) {
+        cryp_run_len = 0;
+        return SFUD_ERR_WRITE;
+    }
+    if (HAL_DMA_Start(&hdma_cryp_in, (uint32_t) (uintptr_t) in, (uint32_t) (uintptr_t) &CRYP->DIN, blocks / 4)
+            != HAL_OK) {
+        HAL_DMA_Abort(&hdma_cryp_out);
+        cryp_run_len = 0;
+        return SFUD_ERR_WRITE;
+    }
+    CRYP->DMACR = CRYP_DMACR_DIEN | CRYP_DMACR_DOEN;
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * wait the DMA of the run, then pad and process its partial block, the counter goes on after it
+ */
+sfud_err boot_cryp_ctr_wait(void) {
+    sfud_err result = SFUD_SUCCESS;
+    uint32_t block[4] = {0}, out[4];
+
+    if (cryp_run_len) {
+        if (HAL_DMA_PollForTransfer(&hdma_cryp_in, HAL_DMA_FULL_TRANSFER, CRYP_TIMEOUT_MS) != HAL_OK
+                || HAL_DMA_PollForTransfer(&hdma_cryp_out, HAL_DMA_FULL_TRANSFER, CRYP_TIMEOUT_MS) != HAL_OK) {
+            HAL_DMA_Abort(&hdma_cryp_in);
+            HAL_DMA_Abort(&hdma_cryp_out);
+            result = SFUD_ERR_TIMEOUT;
+        }
+        CRYP->DMACR = 0;
+        /* the CPU may have fetched the lines speculatively during the transfer */
+        SCB_InvalidateDCache_by_Addr(cryp_run_out, (int32_t) cryp_run_len);
+        cryp_run_len = 0;
+    }
+    if (result == SFUD_SUCCESS && cryp_tail_len) {
+        memcpy(block, cryp_tail_in, cryp_tail_len);
+        if (cryp_block(block, out)) {
+            memcpy(cryp_tail_out, out, cryp_tail_len);
+        } else {
+            result = SFUD_ERR_TIMEOUT;
+        }
+    }
+    cryp_tail_len = 0;
+
+    return result;
+}
+
+/**
+ * end the stream, the key registers are cleared
+ */
+void boot_cryp_ctr_stop(void) {
+    static const uint32_t zero_key[4] = {0};
+
+    CRYP->DMACR = 0;
+    CLEAR_BIT(CRYP->CR, CRYP_CR_CRYPEN);
+    cryp_key_load(zero_key);
+    __HAL_RCC_CRYP_CLK_DISABLE();
+}
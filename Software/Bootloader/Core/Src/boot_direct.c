@@ -0,0 +1,197 @@
+/**
+ * @file boot_direct.c
+ * @brief Straight to the last booted slot after a warm reset, see boot_direct.h.
+ */
+#include "boot_direct.h"
+#include "boot_cmp.h"
+#include "boot_fault.h"
+#include "boot_otfdec.h"
+#include "boot_profile.h"
+#include "boot_scatter.h"
+#include "boot_uart.h"
+#include "boot_usb.h"
+#include "main.h"
+#include "octospi.h"
+#include <string.h>
+#ifdef BOOT_DIRECT_LL
+#include "stm32h7xx_ll_bus.h"
+#include "stm32h7xx_ll_gpio.h"
+#include "stm32h7xx_ll_rcc.h"
+#endif
+
+/* placed after the boot log by the linker script, see BOOT_DIRECT_ADDR */
+boot_direct boot_direct_record __attribute__((section(".boot_direct")));
+
+static uint32_t direct_crc(const boot_direct *record) {
+    return boot_image_crc32(0, record, offsetof(boot_direct, crc));
+}
+
+/**
+ * drop the record, the next warm reset takes the full path
+ */
+void boot_direct_clear(void) {
+    boot_direct_record.magic = 0;
+    /* a reset drops the D-Cache, so push it to the SRAM now */
+    SCB_CleanDCache_by_Addr((uint32_t *) &boot_direct_record, sizeof(boot_direct_record));
+}
+
+/**
+ * record the boot of a slot for the next warm reset
+ *
+ * @note OCTOSPI1 must be in the memory-mapped mode the application gets, the image checked
+ *
+ * @param flash MAIN flash
+ * @param slot slot about to be booted
+ * @param header its image header
+ */
+void boot_direct_save(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header) {
+    boot_direct *record = &boot_direct_record;
+    uint32_t next;
+
+    /* a full record sector is erased by the next switch, that can't be told through the window */
+    if (boot_slot_record_next(flash, &next) != SFUD_SUCCESS) {
+        boot_direct_clear();
+        return;
+    }
+
+    memset(record, 0, sizeof(boot_direct));
+    record->version = BOOT_DIRECT_VERSION;
+    record->slot = slot;
+    boot_handoff_ospi_save(&record->ospi);
+    record->xip_size = flash->chip.capacity;
+    record->header_crc = header->header_crc;
+    record->record_next = next;
+    record->crc = direct_crc(record);
+    record->magic = BOOT_DIRECT_MAGIC;
+    SCB_CleanDCache_by_Addr((uint32_t *) record, sizeof(boot_direct));
+}
+
+static bool direct_record_ok(const boot_direct *record) {
+    return record->magic == BOOT_DIRECT_MAGIC && record->version == BOOT_DIRECT_VERSION
+            && record->slot < BOOT_SLOT_NUM && record->crc == direct_crc(record) && !boot_fault_pending()
+            && !boot_uart_request_pending() && !boot_usb_request_pending();
+}
+
+/**
+ * check through the window that the slot is still the one booted, OCTOSPI1 memory-mapped from the record
+ *
+ * @return false: take the full path, the lines read are dropped for it
+ */
+static bool direct_slot_ok(const boot_direct *record) {
+    uint32_t slot_addr = OCTOSPI1_BASE + boot_slot_addr((boot_slot_id) record->slot);
+    const boot_image_header *header = (const boot_image_header *) slot_addr;
+
+    if (header->header_crc == record->header_crc
+            && boot_image_header_check(header, slot_addr, BOOT_SLOT_SIZE)
+            && boot_cmp_blank((const void *) (OCTOSPI1_BASE + record->record_next), sizeof(boot_slot_record))
+            && (!(header->flags & BOOT_IMAGE_FLAG_ENCRYPTED) || boot_otfdec_enable(header, slot_addr))
+            && boot_scatter_prepare(header, slot_addr)) {
+        return true;
+    }
+
+    /* the full path reads them again, maybe after an update */
+    SCB_InvalidateDCache_by_Addr((void *) slot_addr, BOOT_IMAGE_HEADER_SIZE);
+    SCB_InvalidateDCache_by_Addr((void *) (OCTOSPI1_BASE + record->record_next), sizeof(boot_slot_record));
+
+    return false;
+}
+
+/**
+ * put OCTOSPI1 in memory-mapped mode from the record and check the slot is still the one booted
+ *
+ * @note OCTOSPI1 is as MX_OCTOSPI1_Init() left it, it's left so again when the checks fail
+ *
+ * @return the record, NULL: take the full path
+ */
+const boot_direct *boot_direct_enter(void) {
+    const boot_direct *record = &boot_direct_record;
+
+    if (!direct_record_ok(record)) {
+        return NULL;
+    }
+
+    boot_handoff_ospi_load(&record->ospi);
+    hospi1.State = HAL_OSPI_STATE_BUSY_MEM_MAPPED;
+
+    if (direct_slot_ok(record)) {
+        return record;
+    }
+    HAL_OSPI_Abort(&hospi1);
+    HAL_OSPI_Init(&hospi1);
+
+    return NULL;
+}
+
+#ifdef BOOT_DIRECT_LL
+static void ll_pin(GPIO_TypeDef *port, uint32_t pin, uint32_t mode, uint32_t type, uint32_t speed, uint32_t af) {
+    LL_GPIO_SetPinSpeed(port, pin, speed);
+    LL_GPIO_SetPinOutputType(port, pin, type);
+    LL_GPIO_SetPinPull(port, pin, LL_GPIO_PULL_NO);
+    if (mode == LL_GPIO_MODE_ALTERNATE) {
+        if (pin < LL_GPIO_PIN_8) {
+            LL_GPIO_SetAFPin_0_7(port, pin, af);
+        } else {
+            LL_GPIO_SetAFPin_8_15(port, pin, af);
+        }
+    }
+    LL_GPIO_SetPinMode(port, pin, mode);
+}
+
+/* MX_GPIO_Init() and HAL_OSPI_MspInit() less the MDMA, the direct path reads through the window only */
+static void ll_init(void) {
+    LL_AHB4_GRP1_EnableClock(LL_AHB4_GRP1_PERIPH_GPIOA | LL_AHB4_GRP1_PERIPH_GPIOB | LL_AHB4_GRP1_PERIPH_GPIOD
+                             | LL_AHB4_GRP1_PERIPH_GPIOE | LL_AHB4_GRP1_PERIPH_GPIOH);
+
+    LL_GPIO_ResetOutputPin(FLASH_CS_GPIO_Port, FLASH_CS_Pin);
+    LL_GPIO_SetOutputPin(GPIOD, ESP_EN_Pin | ESP_BOOT_Pin);
+    ll_pin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, LL_GPIO_MODE_OUTPUT, LL_GPIO_OUTPUT_PUSHPULL, LL_GPIO_SPEED_FREQ_VERY_HIGH, 0);
+    ll_pin(GPIOD, ESP_EN_Pin, LL_GPIO_MODE_OUTPUT, LL_GPIO_OUTPUT_OPENDRAIN, LL_GPIO_SPEED_FREQ_LOW, 0);
+    ll_pin(GPIOD, ESP_BOOT_Pin, LL_GPIO_MODE_OUTPUT, LL_GPIO_OUTPUT_OPENDRAIN, LL_GPIO_SPEED_FREQ_LOW, 0);
+    boot_profile_mark(BOOT_STAGE_GPIO_INIT);
+
+    LL_RCC_SetOSPIClockSource(LL_RCC_OSPI_CLKSOURCE_HCLK);
+    LL_AHB3_GRP1_EnableClock(LL_AHB3_GRP1_PERIPH_OCTOSPIM | LL_AHB3_GRP1_PERIPH_OSPI1);
+    /* PA6 IO3, PA7 IO2, PB0 IO1, PB1 IO0, PB2 CLK, PE11 NCS */
+    ll_pin(GPIOA, LL_GPIO_PIN_6, LL_GPIO_MODE_ALTERNATE, LL_GPIO_OUTPUT_PUSHPULL, LL_GPIO_SPEED_FREQ_VERY_HIGH, LL_GPIO_AF_6);
+    ll_pin(GPIOA, LL_GPIO_PIN_7, LL_GPIO_MODE_ALTERNATE, LL_GPIO_OUTPUT_PUSHPULL, LL_GPIO_SPEED_FREQ_VERY_HIGH, LL_GPIO_AF_10);
+    ll_pin(GPIOB, LL_GPIO_PIN_0, LL_GPIO_MODE_ALTERNATE, LL_GPIO_OUTPUT_PUSHPULL, LL_GPIO_SPEED_FREQ_VERY_HIGH, LL_GPIO_AF_4);
+    ll_pin(GPIOB, LL_GPIO_PIN_1, LL_GPIO_MODE_ALTERNATE, LL_GPIO_OUTPUT_PUSHPULL, LL_GPIO_SPEED_FREQ_VERY_HIGH, LL_GPIO_AF_4);
+    ll_pin(GPIOB, LL_GPIO_PIN_2, LL_GPIO_MODE_ALTERNATE, LL_GPIO_OUTPUT_PUSHPULL, LL_GPIO_SPEED_FREQ_VERY_HIGH, LL_GPIO_AF_9);
+    ll_pin(GPIOE, LL_GPIO_PIN_11, LL_GPIO_MODE_ALTERNATE, LL_GPIO_OUTPUT_PUSHPULL, LL_GPIO_SPEED_FREQ_VERY_HIGH, LL_GPIO_AF_11);
+    /* HAL_OSPIM_Config() of MX_OCTOSPI1_Init(): CLK, NCS and IO[3:0] of port 1 to OCTOSPI1, no DQS, no IO[7:4] */
+    OCTOSPIM->PCR[0] = OCTOSPIM_PCR_CLKEN | OCTOSPIM_PCR_NCSEN | OCTOSPIM_PCR_IOLEN;
+    boot_profile_mark(BOOT_STAGE_OCTOSPI1_INIT);
+}
+
+/* back to the reset state of OCTOSPI1, MX_OCTOSPI1_Init() of the full path starts from there */
+static void ll_deinit(void) {
+    LL_AHB3_GRP1_ForceReset(LL_AHB3_GRP1_PERIPH_OCTOSPIM | LL_AHB3_GRP1_PERIPH_OSPI1);
+    LL_AHB3_GRP1_ReleaseReset(LL_AHB3_GRP1_PERIPH_OCTOSPIM | LL_AHB3_GRP1_PERIPH_OSPI1);
+    LL_AHB3_GRP1_DisableClock(LL_AHB3_GRP1_PERIPH_OCTOSPIM | LL_AHB3_GRP1_PERIPH_OSPI1);
+}
+
+/**
+ * boot_direct_enter() before HAL_Init(), the pins and OCTOSPI1 set up by register writes
+ *
+ * @note the first thing of main() after boot_profile_init() and the caches, the record is checked before any
+ *       peripheral is touched
+ *
+ * @return the record, NULL: take the full path, OCTOSPI1 is back to its reset state
+ */
+const boot_direct *boot_direct_enter_ll(void) {
+    const boot_direct *record = &boot_direct_record;
+
+    if (!direct_record_ok(record)) {
+        return NULL;
+    }
+
+    ll_init();
+    boot_handoff_ospi_load(&record->ospi);
+    if (direct_slot_ok(record)) {
+        return record;
+    }
+    ll_deinit();
+
+    return NULL;
+}
+#endif /* BOOT_DIRECT_LL */
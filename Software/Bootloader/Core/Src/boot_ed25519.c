@@ -0,0 +1,643 @@
+/**
+ * @file boot_ed25519.c
+ * @brief Ed25519 signature verification, see boot_ed25519.h.
+ */
+#include "boot_ed25519.h"
+#include <string.h>
+
+/* GF(2^255 - 19), 8 little-endian words, below 2^256 */
+typedef uint32_t fe[8];
+
+/* extended coordinates, x = X/Z, y = Y/Z, xy = T/Z */
+typedef struct {
+    fe x;
+    fe y;
+    fe z;
+    fe t;
+} ge;
+
+typedef struct {
+    uint64_t h[8];
+    uint64_t len;                               /* bytes hashed */
+    uint8_t buf[128];
+    size_t fill;
+} sha512_ctx;
+
+static const uint64_t sha512_k[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+    0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+    0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+    0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+    0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+    0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+    0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+    0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+    0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+    0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+    0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+    0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+    0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+    0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static const uint64_t sha512_h0[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+/* -121665/121666 doubled, the k of the unified addition */
+static const fe ed_d2 = {0x26b2f159, 0xebd69b94, 0x8283b156, 0x00e0149a, 0xeef3d130, 0x198e80f2, 0x56dffce7, 0x2406d9dc};
+static const fe ed_d = {0x135978a3, 0x75eb4dca, 0x4141d8ab, 0x00700a4d, 0x7779e898, 0x8cc74079, 0x2b6ffe73, 0x52036cee};
+/* 2^((p - 1) / 4) */
+static const fe ed_sqrtm1 = {0x4a0ea0b0, 0xc4ee1b27, 0xad2fe478, 0x2f431806, 0x3dfbd7a7, 0x2b4d0099, 0x4fc1df0b, 0x2b832480};
+static const ge ed_base = {
+    .x = {0x8f25d51a, 0xc9562d60, 0x9525a7b2, 0x692cc760, 0xfdd6dc5c, 0xc0a4e231, 0xcd6e53fe, 0x216936d3},
+    .y = {0x66666658, 0x66666666, 0x66666666, 0x66666666, 0x66666666, 0x66666666, 0x66666666, 0x66666666},
+    .z = {1},
+    .t = {0xa5b7dda3, 0x6dde8ab3, 0x775152f5, 0x20f09f80, 0x64abe37d, 0x66ea4e8e, 0xd78b7665, 0x67875f0f},
+};
+/* the group order, 2^252 + 27742317777372353535851937790883648493 */
+static const uint8_t ed_l[32] = {
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+};
+
+static inline uint64_t ror64(uint64_t x, unsigned n) {
+    return (x >> n) | (x << (64 - n));
+}
+
+static uint64_t load64_be(const uint8_t *p) {
+    uint64_t x = 0;
+
+    for (size_t i = 0; i < 8; i++) {
+        x = (x << 8) | p[i];
+    }
+    return x;
+}
+
+/* a 16 word ring of the message schedule in place of the 80 words */
+static void sha512_block(sha512_ctx *ctx, const uint8_t *block) {
+    uint64_t w[16], s[8], t1, t2;
+
+    for (size_t i = 0; i < 16; i++) {
+        w[i] = load64_be(block + 8 * i);
+    }
+    memcpy(s, ctx->h, sizeof(s));
+    for (size_t i = 0; i < 80; i++) {
+        if (i >= 16) {
+            uint64_t w15 = w[(i + 1) & 15], w2 = w[(i + 14) & 15];
+
+            w[i & 15] += (ror64(w15, 1) ^ ror64(w15, 8) ^ (w15 >> 7)) + w[(i + 9) & 15]
+                    + (ror64(w2, 19) ^ ror64(w2, 61) ^ (w2 >> 6));
+        }
+        t1 = s[7] + (ror64(s[4], 14) ^ ror64(s[4], 18) ^ ror64(s[4], 41)) + ((s[4] & s[5]) ^ (~s[4] & s[6]))
+                + sha512_k[i] + w[i & 15];
+        t2 = (ror64(s[0], 28) ^ ror64(s[0], 34) ^ ror64(s[0], 39)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(s + 1, s, 7 * sizeof(uint64_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        ctx->h[i] += s[i];
+    }
+}
+
+static void sha512_init(sha512_ctx *ctx) {
+    memcpy(ctx->h, sha512_h0, sizeof(ctx->h));
+    ctx->len = 0;
+    ctx->fill = 0;
+}
+
+static void sha512_update(sha512_ctx *ctx, const uint8_t *data, size_t len) {
+    ctx->len += len;
+    while (len) {
+        size_t n = sizeof(ctx->buf) - ctx->fill;
+
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->buf + ctx->fill, data, n);
+        ctx->fill += n;
+        data += n;
+        len -= n;
+        if (ctx->fill == sizeof(ctx->buf)) {
+            sha512_block(ctx, ctx->buf);
+            ctx->fill = 0;
+        }
+    }
+}
+
+static void sha512_final(sha512_ctx *ctx, uint8_t *digest) {
+    uint64_t bits = ctx->len * 8;
+
+    ctx->buf[ctx->fill++] = 0x80;
+    if (ctx->fill > sizeof(ctx->buf) - 16) {
+        memset(ctx->buf + ctx->fill, 0, sizeof(ctx->buf) - ctx->fill);
+        sha512_block(ctx, ctx->buf);
+        ctx->fill = 0;
+    }
+    /* the 128-bit length, the high half is 0 */
+    memset(ctx->buf + ctx->fill, 0, sizeof(ctx->buf) - ctx->fill);
+    for (size_t i = 0; i < 8; i++) {
+        ctx->buf[127 - i] = (uint8_t) (bits >> (8 * i));
+    }
+    sha512_block(ctx, ctx->buf);
+    for (size_t i = 0; i < 64; i++) {
+        digest[i] = (uint8_t) (ctx->h[i / 8] >> (56 - 8 * (i % 8)));
+    }
+}
+
+/**
+ * *lo:*hi = a * b + *lo + *hi, it never overflows
+ */
+static inline void mac(uint32_t *lo, uint32_t *hi, uint32_t a, uint32_t b) {
+#if defined(__ARM_FEATURE_DSP)
+    __asm("umaal %0, %1, %2, %3" : "+r"(*lo), "+r"(*hi) : "r"(a), "r"(b));
+#else
+    uint64_t p = (uint64_t) a * b + *lo + *hi;
+
+    *lo = (uint32_t) p;
+    *hi = (uint32_t) (p >> 32);
+#endif
+}
+
+/**
+ * r += 38 * c, 2^256 is 38 mod p, the carry out of a small r is folded once more
+ */
+static void fe_fold(fe r, uint32_t c) {
+    uint64_t s = (uint64_t) c * 38;
+
+    for (size_t i = 0; i < 8; i++) {
+        s += r[i];
+        r[i] = (uint32_t) s;
+        s >>= 32;
+    }
+    r[0] += (uint32_t) s * 38;
+}
+
+static void fe_add(fe r, const fe a, const fe b) {
+    uint64_t s = 0;
+
+    for (size_t i = 0; i < 8; i++) {
+        s += (uint64_t) a[i] + b[i];
+        r[i] = (uint32_t) s;
+        s >>= 32;
+    }
+    fe_fold(r, (uint32_t) s);
+}
+
+/**
+ * r = a - b, a borrow out of 2^256 takes 38 off, a second one leaves r large
+ */
+static void fe_sub(fe r, const fe a, const fe b) {
+    int64_t s = 0;
+
+    for (size_t i = 0; i < 8; i++) {
+        s += (int64_t) a[i] - b[i];
+        r[i] = (uint32_t) s;
+        s >>= 32;
+    }
+    for (int pass = 0; pass < 2 && s; pass++) {
+        s = -38;
+        for (size_t i = 0; i < 8; i++) {
+            s += r[i];
+            r[i] = (uint32_t) s;
+            s >>= 32;
+        }
+    }
+}
+
+/**
+ * r = t mod p, folding the high half of the 512-bit t by 38
+ */
+static void fe_reduce(fe r, const uint32_t *t) {
+    uint32_t c = 0;
+
+    for (size_t i = 0; i < 8; i++) {
+        uint32_t lo = t[i];
+
+        mac(&lo, &c, t[i + 8], 38);
+        r[i] = lo;
+    }
+    fe_fold(r, c);
+}
+
+static void fe_mul(fe r, const fe a, const fe b) {
+    uint32_t t[16] = {0};
+
+    for (size_t i = 0; i < 8; i++) {
+        uint32_t c = 0;
+
+        for (size_t j = 0; j < 8; j++) {
+            mac(&t[i + j], &c, a[i], b[j]);
+        }
+        t[i + 8] = c;
+    }
+    fe_reduce(r, t);
+}
+
+/**
+ * the 28 cross products once and doubled, then the 8 squares
+ */
+static void fe_sq(fe r, const fe a) {
+    uint32_t t[16] = {0}, top = 0;
+    uint64_t s = 0;
+
+    for (size_t i = 0; i < 7; i++) {
+        uint32_t c = 0;
+
+        for (size_t j = i + 1; j < 8; j++) {
+            mac(&t[i + j], &c, a[i], a[j]);
+        }
+        t[i + 8] = c;
+    }
+    for (size_t i = 0; i < 16; i++) {
+        uint32_t word = t[i];
+
+        t[i] = (word << 1) | top;
+        top = word >> 31;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        uint64_t p = (uint64_t) a[i] * a[i];
+
+        s += (uint64_t) t[2 * i] + (uint32_t) p;
+        t[2 * i] = (uint32_t) s;
+        s >>= 32;
+        s += (uint64_t) t[2 * i + 1] + (uint32_t) (p >> 32);
+        t[2 * i + 1] = (uint32_t) s;
+        s >>= 32;
+    }
+    fe_reduce(r, t);
+}
+
+static void fe_sqn(fe r, const fe a, unsigned n) {
+    fe_sq(r, a);
+    while (--n) {
+        fe_sq(r, r);
+    }
+}
+
+/**
+ * r = a mod p, the unique value below p
+ */
+static void fe_canonical(fe r, const fe a) {
+    fe t;
+    uint64_t s;
+
+    memcpy(r, a, sizeof(fe));
+    /* below 2^255 + 19, then below p */
+    s = (uint64_t) (r[7] >> 31) * 19;
+    r[7] &= 0x7FFFFFFF;
+    for (size_t i = 0; i < 8; i++) {
+        s += r[i];
+        r[i] = (uint32_t) s;
+        s >>= 32;
+    }
+    s = 19;
+    for (size_t i = 0; i < 8; i++) {
+        s += r[i];
+        t[i] = (uint32_t) s;
+        s >>= 32;
+    }
+    if (t[7] >> 31) {
+        t[7] &= 0x7FFFFFFF;
+        memcpy(r, t, sizeof(fe));
+    }
+}
+
+static void fe_frombytes(fe r, const uint8_t *s) {
+    for (size_t i = 0; i < 8; i++) {
+        r[i] = (uint32_t) s[4 * i] | ((uint32_t) s[4 * i + 1] << 8) | ((uint32_t) s[4 * i + 2] << 16)
+                | ((uint32_t) s[4 * i + 3] << 24);
+    }
+    r[7] &= 0x7FFFFFFF;
+}
+
+static void fe_tobytes(uint8_t *s, const fe a) {
+    fe t;
+
+    fe_canonical(t, a);
+    for (size_t i = 0; i < 32; i++) {
+        s[i] = (uint8_t) (t[i / 4] >> (8 * (i % 4)));
+    }
+}
+
+static bool fe_equal(const fe a, const fe b) {
+    uint8_t sa[32], sb[32];
+
+    fe_tobytes(sa, a);
+    fe_tobytes(sb, b);
+    return memcmp(sa, sb, sizeof(sa)) == 0;
+}
+
+static bool fe_isnegative(const fe a) {
+    uint8_t s[32];
+
+    fe_tobytes(s, a);
+    return s[0] & 1;
+}
+
+/**
+ * the chain of the two exponents, z^(2^250 - 1) into r and z^11 into z11
+ */
+static void fe_pow2_250_1(fe r, fe z11, const fe z) {
+    fe t0, t1, t2;
+
+    fe_sq(t0, z);                   /* 2 */
+    fe_sqn(t1, t0, 2);              /* 8 */
+    fe_mul(t1, z, t1);              /* 9 */
+    fe_mul(z11, t0, t1);            /* 11 */
+    fe_sq(t0, z11);                 /* 22 */
+    fe_mul(t0, t1, t0);             /* 2^5 - 1 */
+    fe_sqn(t1, t0, 5);
+    fe_mul(t0, t1, t0);             /* 2^10 - 1 */
+    fe_sqn(t1, t0, 10);
+    fe_mul(t1, t1, t0);             /* 2^20 - 1 */
+    fe_sqn(t2, t1, 20);
+    fe_mul(t1, t2, t1);             /* 2^40 - 1 */
+    fe_sqn(t1, t1, 10);
+    fe_mul(t0, t1, t0);             /* 2^50 - 1 */
+    fe_sqn(t1, t0, 50);
+    fe_mul(t1, t1, t0);             /* 2^100 - 1 */
+    fe_sqn(t2, t1, 100);
+    fe_mul(t1, t2, t1);             /* 2^200 - 1 */
+    fe_sqn(t1, t1, 50);
+    fe_mul(r, t1, t0);              /* 2^250 - 1 */
+}
+
+/* z^(p - 2) = z^(2^255 - 21) */
+static void fe_invert(fe r, const fe z) {
+    fe t, z11;
+
+    fe_pow2_250_1(t, z11, z);
+    fe_sqn(t, t, 5);
+    fe_mul(r, t, z11);
+}
+
+/* z^((p - 5) / 8) = z^(2^252 - 3) */
+static void fe_pow22523(fe r, const fe z) {
+    fe t, z11;
+
+    fe_pow2_250_1(t, z11, z);
+    fe_sqn(t, t, 2);
+    fe_mul(r, t, z);
+}
+
+/**
+ * r = p + q, add-2008-hwcd-3, complete on the curve, r may be p or q
+ */
+static void ge_add(ge *r, const ge *p, const ge *q) {
+    fe a, b, c, d, e, t;
+
+    fe_sub(a, p->y, p->x);
+    fe_sub(t, q->y, q->x);
+    fe_mul(a, a, t);
+    fe_add(b, p->y, p->x);
+    fe_add(t, q->y, q->x);
+    fe_mul(b, b, t);
+    fe_mul(c, p->t, q->t);
+    fe_mul(c, c, ed_d2);
+    fe_mul(d, p->z, q->z);
+    fe_add(d, d, d);
+    fe_sub(e, b, a);                /* E */
+    fe_add(b, b, a);                /* H */
+    fe_sub(a, d, c);                /* F */
+    fe_add(d, d, c);                /* G */
+    fe_mul(r->x, e, a);
+    fe_mul(r->y, d, b);
+    fe_mul(r->t, e, b);
+    fe_mul(r->z, a, d);
+}
+
+/**
+ * r = 2p, dbl-2008-hwcd with the signs of a = -1 folded in, r may be p
+ */
+static void ge_dbl(ge *r, const ge *p) {
+    fe a, b, c, e, g;
+
+    fe_sq(a, p->x);
+    fe_sq(b, p->y);
+    fe_sq(c, p->z);
+    fe_add(c, c, c);
+    fe_add(e, p->x, p->y);
+    fe_sq(e, e);
+    fe_sub(g, a, b);                /* G */
+    fe_add(a, a, b);                /* H */
+    fe_sub(e, a, e);                /* E */
+    fe_add(c, c, g);                /* F */
+    fe_mul(r->x, e, c);
+    fe_mul(r->y, g, a);
+    fe_mul(r->t, e, a);
+    fe_mul(r->z, c, g);
+}
+
+/**
+ * decode a point and negate it, RFC 8032 5.1.3
+ *
+ * @return false: no point, or y not below p
+ */
+static bool ge_frombytes_neg(ge *r, const uint8_t *s) {
+    fe u, v, v3, vxx, t;
+    uint8_t y[32];
+
+    fe_frombytes(r->y, s);
+    fe_tobytes(y, r->y);
+    if (memcmp(y, s, 31) != 0 || y[31] != (s[31] & 0x7F)) {
+        return false;
+    }
+    memset(r->z, 0, sizeof(fe));
+    r->z[0] = 1;
+    /* u = y^2 - 1, v = d y^2 + 1, x = u v^3 (u v^7)^((p - 5) / 8) */
+    fe_sq(u, r->y);
+    fe_mul(v, u, ed_d);
+    fe_sub(u, u, r->z);
+    fe_add(v, v, r->z);
+    fe_sq(v3, v);
+    fe_mul(v3, v3, v);
+    fe_sq(t, v3);
+    fe_mul(t, t, v);
+    fe_mul(t, t, u);
+    fe_pow22523(t, t);
+    fe_mul(t, t, v3);
+    fe_mul(r->x, t, u);
+
+    fe_sq(vxx, r->x);
+    fe_mul(vxx, vxx, v);
+    if (!fe_equal(vxx, u)) {
+        fe_add(t, vxx, u);
+        memset(v, 0, sizeof(fe));
+        if (!fe_equal(t, v)) {
+            return false;
+        }
+        fe_mul(r->x, r->x, ed_sqrtm1);
+    }
+    /* x = 0 has no negative twin, the sign bit must be clear */
+    fe_canonical(t, r->x);
+    memset(v, 0, sizeof(fe));
+    if ((s[31] >> 7) && fe_equal(t, v)) {
+        return false;
+    }
+    /* the point of the sign bit, negated */
+    if (fe_isnegative(r->x) == (s[31] >> 7)) {
+        memset(v, 0, sizeof(fe));
+        fe_sub(r->x, v, r->x);
+    }
+    fe_mul(r->t, r->x, r->y);
+    return true;
+}
+
+static void ge_tobytes(uint8_t *s, const ge *p) {
+    fe zinv, x, y;
+
+    fe_invert(zinv, p->z);
+    fe_mul(x, p->x, zinv);
+    fe_mul(y, p->y, zinv);
+    fe_tobytes(s, y);
+    s[31] |= (uint8_t) (fe_isnegative(x) << 7);
+}
+
+/**
+ * @return true: s < L
+ */
+static bool sc_canonical(const uint8_t *s) {
+    for (int i = 31; i >= 0; i--) {
+        if (s[i] != ed_l[i]) {
+            return s[i] < ed_l[i];
+        }
+    }
+    return false;
+}
+
+/**
+ * r = x mod L, the 64 digits of x spread over signed 64-bit words, as TweetNaCl does
+ */
+static void sc_reduce(uint8_t *r, int64_t *x) {
+    int64_t carry;
+    size_t i, j;
+
+    for (i = 63; i >= 32; i--) {
+        carry = 0;
+        for (j = i - 32; j < i - 12; j++) {
+            x[j] += carry - 16 * x[i] * ed_l[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * 256;
+        }
+        x[j] += carry;
+        x[i] = 0;
+    }
+    carry = 0;
+    for (j = 0; j < 32; j++) {
+        x[j] += carry - (x[31] >> 4) * ed_l[j];
+        carry = x[j] >> 8;
+        x[j] &= 255;
+    }
+    for (j = 0; j < 32; j++) {
+        x[j] -= carry * ed_l[j];
+    }
+    for (i = 0; i < 32; i++) {
+        x[i + 1] += x[i] >> 8;
+        r[i] = (uint8_t) (x[i] & 255);
+    }
+}
+
+/**
+ * k = SHA-512(R || A || M) mod L, on its own frame, gone before the one of double_mul()
+ */
+static void __attribute__((noinline)) challenge(uint8_t *k, const uint8_t *sig, const uint8_t *key, const uint8_t *msg,
+                                                size_t len) {
+    sha512_ctx ctx;
+    uint8_t digest[64];
+    int64_t x[64];
+
+    sha512_init(&ctx);
+    sha512_update(&ctx, sig, 32);
+    sha512_update(&ctx, key, BOOT_ED25519_KEY_SIZE);
+    sha512_update(&ctx, msg, len);
+    sha512_final(&ctx, digest);
+    for (size_t i = 0; i < 64; i++) {
+        x[i] = digest[i];
+    }
+    sc_reduce(k, x);
+}
+
+static inline unsigned sc_bit(const uint8_t *s, unsigned i) {
+    return (s[i / 8] >> (i % 8)) & 1;
+}
+
+/**
+ * r = [s]B + [k](-A) encoded, Straus over the bits of both scalars
+ *
+ * @return false: key is no point
+ */
+static bool __attribute__((noinline)) double_mul(uint8_t *r, const uint8_t *s, const uint8_t *k, const uint8_t *key) {
+    /* [0] B, [1] -A, [2] B - A */
+    ge table[3], p;
+
+    if (!ge_frombytes_neg(&table[1], key)) {
+        return false;
+    }
+    table[0] = ed_base;
+    ge_add(&table[2], &table[0], &table[1]);
+    memset(&p, 0, sizeof(p));
+    p.y[0] = 1;
+    p.z[0] = 1;
+    /* s and k are below L < 2^253 */
+    for (int i = 252; i >= 0; i--) {
+        unsigned index = sc_bit(s, (unsigned) i) | (sc_bit(k, (unsigned) i) << 1);
+
+        ge_dbl(&p, &p);
+        if (index) {
+            ge_add(&p, &p, &table[index - 1]);
+        }
+    }
+    ge_tobytes(r, &p);
+    return true;
+}
+
+/**
+ * verify an Ed25519 signature
+ *
+ * @param sig R then S, BOOT_ED25519_SIG_SIZE bytes
+ * @param msg signed message
+ * @param len bytes of msg
+ * @param key public key A, BOOT_ED25519_KEY_SIZE bytes
+ *
+ * @return true: the signature of msg by key is good
+ */
+bool boot_ed25519_verify(const uint8_t *sig, const uint8_t *msg, size_t len, const uint8_t *key) {
+    uint8_t k[32], r[32];
+
+    if (!sc_canonical(sig + 32)) {
+        return false;
+    }
+    challenge(k, sig, key, msg, len);
+    return double_mul(r, sig + 32, k, key) && memcmp(r, sig, sizeof(r)) == 0;
+}
@@ -0,0 +1,599 @@
+/**
+ * @file boot_esp.c
+ * @brief Firmware download from the ESP32-C3 over the ESP-Hosted SPI link, see boot_esp.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_ESP
+
+#include "boot_esp.h"
+#include "esp_spi.h"
+#include "boot_bundle.h"
+#include "boot_crc.h"
+#include "boot_ext.h"
+#include "boot_kv.h"
+#include "boot_netlog.h"
+#include "boot_recv.h"
+#include "boot_rollback.h"
+#include "boot_sched.h"
+#include "boot_slot.h"
+#include "boot_verify.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "esp");
+
+#define ESP_LINK_TIMEOUT_MS             10
+#define ESP_ERASE_BLOCK_SIZE            BOOT_ESP_CHUNK_SIZE
+/* esp_session.closing of no chunk */
+#define ESP_CHUNK_NONE                  0xFFFFFFFFUL
+
+extern sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash);
+extern sfud_err qspi_exit_memory_mapped_mode(sfud_flash *flash);
+
+/* program of the last chunk, straight from its RX frame; the flash task moves it on */
+static sfud_async esp_write_op;
+/* the download on boot_sched.h: the flash task frees the RX frame of a chunk, the RX task takes the next one */
+static boot_task esp_flash_task, esp_rx_task;
+
+typedef struct {
+    const sfud_flash *flash;
+    boot_slot_id slot;                           /**< staging slot */
+    uint32_t size;                               /**< bytes to download, START */
+    uint32_t done;                               /**< bytes written or being written by op */
+    uint32_t erased_end;                         /**< slot offset the slot is erased up to */
+    uint8_t *writing;                            /**< RX frame the program of op reads, NULL: none */
+    uint16_t tx_seq;                             /**< seq_num of the next packet to the ESP32 */
+    boot_esp_status status;                      /**< status of the next ACK */
+    bool ack;                                    /**< an ACK is due */
+    bool over;                                   /**< END, an error: no more messages are taken */
+    uint32_t last;                               /**< HAL_GetTick() of the last frame */
+    bool resumable;                              /**< START had an id, the chunks are recorded */
+    uint32_t chunk_crc;                          /**< CRC-32 of the chunk being downloaded so far */
+    uint32_t closing;                            /**< chunk the program of op completes, ESP_CHUNK_NONE */
+    uint32_t closing_crc;                        /**< its CRC-32 */
+    boot_esp_resume resume;
+    bool bundle;                                 /**< BUNDLE: the data goes to boot_bundle.h, not finished yet */
+    bool selected;                               /**< the bundle committed a slot */
+} esp_session;
+
+static bool esp_chunk_done(const esp_session *session, uint32_t offset) {
+    uint32_t chunk = offset / BOOT_ESP_CHUNK_SIZE;
+
+    return session->resumable && (session->resume.done[chunk / 32] & (1UL << (chunk % 32)));
+}
+
+/**
+ * move the next offset past the chunks the slot holds already, from a chunk start
+ */
+static void esp_chunk_skip(esp_session *session) {
+    while (session->done < session->size && session->done % BOOT_ESP_CHUNK_SIZE == 0
+            && esp_chunk_done(session, session->done)) {
+        session->done += BOOT_ESP_CHUNK_SIZE;
+        if (session->done > session->size) {
+            session->done = session->size;
+        }
+    }
+    if (session->erased_end < session->done) {
+        session->erased_end = session->done;
+    }
+}
+
+/**
+ * add the data of a program to the CRC of its chunk, the chunk it completes is recorded once it's programmed
+ */
+static void esp_chunk_add(esp_session *session, uint32_t offset, const uint8_t *data, uint32_t len) {
+    uint32_t part;
+
+    while (len) {
+        part = BOOT_ESP_CHUNK_SIZE - offset % BOOT_ESP_CHUNK_SIZE;
+        if (part > len) {
+            part = len;
+        }
+        session->chunk_crc = boot_image_crc32(session->chunk_crc, data, part);
+        offset += part;
+        data += part;
+        len -= part;
+        if (offset % BOOT_ESP_CHUNK_SIZE == 0 || offset == session->size) {
+            session->closing = (offset - 1) / BOOT_ESP_CHUNK_SIZE;
+            session->closing_crc = session->chunk_crc;
+            session->chunk_crc = 0;
+        }
+    }
+}
+
+/**
+ * record the chunk the last program completed, a reset from here on resumes after it
+ */
+static void esp_chunk_record(esp_session *session) {
+    uint32_t chunk = session->closing;
+
+    session->closing = ESP_CHUNK_NONE;
+    if (!session->resumable || chunk == ESP_CHUNK_NONE) {
+        return;
+    }
+    session->resume.done[chunk / 32] |= 1UL << (chunk % 32);
+    session->resume.crc[chunk] = session->closing_crc;
+    if (boot_kv_set(BOOT_ESP_KV_KEY, &session->resume, sizeof(boot_esp_resume)) != SFUD_SUCCESS) {
+        elog_w(TAG, "chunk %u not recorded, a reset downloads it again", (unsigned) chunk);
+    }
+}
+
+/**
+ * take the chunks a download of the same id left, those the slot still holds
+ *
+ * @return chunks kept
+ */
+static uint32_t esp_resume_load(esp_session *session, uint32_t id) {
+    sfud_flash *flash = sfud_get_device(SFUD_MAIN_FLASH);
+    uint32_t addr = boot_slot_addr(session->slot), kept = 0, crc, len;
+    boot_esp_resume *resume = &session->resume;
+    size_t value_len;
+
+    session->resumable = true;
+    if (boot_kv_get(BOOT_ESP_KV_KEY, resume, sizeof(boot_esp_resume), &value_len) != SFUD_SUCCESS
+            || value_len != sizeof(boot_esp_resume) || resume->id != id || resume->size != session->size
+            || resume->slot != session->slot) {
+        memset(resume, 0, sizeof(boot_esp_resume));
+        resume->id = id;
+        resume->size = session->size;
+        resume->slot = (uint8_t) session->slot;
+        return 0;
+    }
+
+    /* another update may have written the slot since, or a reset cut a program: the window checks each chunk */
+    if (qspi_entry_memory_mapped_mode(flash) != SFUD_SUCCESS) {
+        memset(resume->done, 0, sizeof(resume->done));
+        return 0;
+    }
+    SCB_InvalidateDCache_by_Addr((void *) (OCTOSPI1_BASE + addr), (int32_t) session->size);
+    for (uint32_t chunk = 0; chunk * BOOT_ESP_CHUNK_SIZE < session->size; chunk++) {
+        if (!esp_chunk_done(session, chunk * BOOT_ESP_CHUNK_SIZE)) {
+            continue;
+        }
+        len = session->size - chunk * BOOT_ESP_CHUNK_SIZE;
+        if (len > BOOT_ESP_CHUNK_SIZE) {
+            len = BOOT_ESP_CHUNK_SIZE;
+        }
+        if (boot_crc32_hw((const void *) (OCTOSPI1_BASE + addr + chunk * BOOT_ESP_CHUNK_SIZE), len, &crc)
+                && crc == resume->crc[chunk]) {
+            kept++;
+        } else {
+            resume->done[chunk / 32] &= ~(1UL << (chunk % 32));
+        }
+    }
+    qspi_exit_memory_mapped_mode(flash);
+    esp_chunk_skip(session);
+
+    return kept;
+}
+
+/**
+ * get the download message of a received frame, esp_spi.h checked its length and checksum
+ *
+ * @return NULL: nothing for the download in it
+ */
+static const boot_esp_msg *esp_msg_parse(const uint8_t *rx) {
+    const esp_spi_header *header = (const esp_spi_header *) rx;
+    const boot_esp_msg *msg;
+
+    if (header->len < sizeof(boot_esp_msg)
+            || header->if_type_num != (BOOT_ESP_IF_TYPE_SERIAL | (BOOT_ESP_IF_NUM << 4))) {
+        return NULL;
+    }
+    msg = (const boot_esp_msg *) (rx + header->offset);
+    if (msg->magic != BOOT_ESP_MSG_MAGIC || sizeof(boot_esp_msg) + msg->len > header->len) {
+        return NULL;
+    }
+    return msg;
+}
+
+/**
+ * queue the ACK that is due, it stays due while no TX frame is free
+ */
+static void esp_ack_send(esp_session *session) {
+    uint8_t *tx;
+    esp_spi_header *header;
+    boot_esp_msg *msg;
+
+    if (!session->ack || (tx = esp_spi_tx_get()) == NULL) {
+        return;
+    }
+    header = (esp_spi_header *) tx;
+    msg = (boot_esp_msg *) (tx + sizeof(esp_spi_header));
+    memset(tx, 0, sizeof(esp_spi_header) + sizeof(boot_esp_msg));
+    header->if_type_num = BOOT_ESP_IF_TYPE_SERIAL | (BOOT_ESP_IF_NUM << 4);
+    header->len = sizeof(boot_esp_msg);
+    header->offset = sizeof(esp_spi_header);
+    header->seq_num = session->tx_seq++;
+    msg->magic = BOOT_ESP_MSG_MAGIC;
+    msg->cmd = BOOT_ESP_CMD_ACK;
+    msg->status = (uint8_t) session->status;
+    msg->offset = session->done;
+    esp_spi_tx_put(tx);
+    session->ack = false;
+}
+
+static boot_esp_status esp_data_write(esp_session *session, const boot_esp_msg *msg) {
+    uint32_t addr = boot_slot_addr(session->slot);
+    uint32_t offset = session->done, end = msg->offset + msg->len, chunk_end, len;
+    const uint8_t *data = (const uint8_t *) (msg + 1);
+
+    if (msg->offset > session->done || end > session->size) {
+        return BOOT_ESP_ERR_SIZE;
+    }
+    if (sfud_async_wait(&esp_write_op) != SFUD_SUCCESS) {
+        return BOOT_ESP_ERR_FLASH;
+    }
+    /* sent before the ESP32 got the ACK offset past the chunks kept, the slot has it */
+    if (end <= session->done) {
+        return BOOT_ESP_OK;
+    }
+    data += session->done - msg->offset;
+    chunk_end = (offset / BOOT_ESP_CHUNK_SIZE + 1) * BOOT_ESP_CHUNK_SIZE;
+    if (end > chunk_end && esp_chunk_done(session, chunk_end)) {
+        end = chunk_end;
+    }
+    while (session->erased_end < end) {
+        len = session->size - session->erased_end;
+        if (len > ESP_ERASE_BLOCK_SIZE) {
+            len = ESP_ERASE_BLOCK_SIZE;
+        }
+        boot_verify_dirty(session->flash, addr + session->erased_end, len);
+        if (sfud_erase(session->flash, addr + session->erased_end, len) != SFUD_SUCCESS) {
+            return BOOT_ESP_ERR_FLASH;
+        }
+        session->erased_end += len;
+    }
+    if (sfud_write_async(session->flash, &esp_write_op, addr + offset, end - offset, data) != SFUD_SUCCESS) {
+        return BOOT_ESP_ERR_FLASH;
+    }
+    /* hashed while it's programmed, a resumed download skips the frames kept and is checked at the boot */
+    boot_recv_feed(offset, data, end - offset);
+    esp_chunk_add(session, offset, data, end - offset);
+    session->done = end;
+    esp_chunk_skip(session);
+
+    return BOOT_ESP_OK;
+}
+
+#ifdef BOOT_LFS
+static boot_esp_status esp_bundle_status(boot_bundle_status status) {
+    switch (status) {
+    case BOOT_BUNDLE_OK:
+        return BOOT_ESP_OK;
+    case BOOT_BUNDLE_ERR_FLASH:
+        return BOOT_ESP_ERR_FLASH;
+    default:
+        return BOOT_ESP_ERR_IMAGE;
+    }
+}
+
+/**
+ * hand the data of a bundle on in order, boot_bundle_feed() does its flash work on the way
+ */
+static boot_esp_status esp_bundle_data(esp_session *session, const boot_esp_msg *msg) {
+    uint32_t end = msg->offset + msg->len;
+    const uint8_t *data = (const uint8_t *) (msg + 1);
+    boot_bundle_status status;
+
+    if (msg->offset > session->done || end > session->size) {
+        return BOOT_ESP_ERR_SIZE;
+    }
+    if (end <= session->done) {
+        return BOOT_ESP_OK;
+    }
+    status = boot_bundle_feed(data + (session->done - msg->offset), end - session->done);
+    session->done = end;
+    return esp_bundle_status(status);
+}
+
+/**
+ * END of a bundle: all of it in, its entries are put in place
+ */
+static boot_esp_status esp_bundle_end(esp_session *session) {
+    boot_bundle_status status;
+
+    if (session->done != session->size) {
+        return BOOT_ESP_ERR_SIZE;
+    }
+    session->bundle = false;
+    status = boot_bundle_finish(&session->selected);
+    return status == BOOT_BUNDLE_OK ? BOOT_ESP_DONE : esp_bundle_status(status);
+}
+#endif /* BOOT_LFS */
+
+/**
+ * handle one message of the ESP32
+ *
+ * @return false: the download is over, session->status tells how
+ */
+static bool esp_msg_handle(esp_session *session, const boot_esp_msg *msg) {
+    sfud_err result;
+
+#ifdef BOOT_LFS
+    if (session->bundle) {
+        if (msg->cmd == BOOT_ESP_CMD_DATA) {
+            session->status = esp_bundle_data(session, msg);
+        } else if (msg->cmd == BOOT_ESP_CMD_END) {
+            session->status = esp_bundle_end(session);
+        }
+        session->ack = true;
+        return session->status == BOOT_ESP_OK;
+    }
+#endif
+    switch (msg->cmd) {
+    case BOOT_ESP_CMD_DATA:
+        session->status = esp_data_write(session, msg);
+        break;
+    case BOOT_ESP_CMD_END:
+        if (sfud_async_wait(&esp_write_op) != SFUD_SUCCESS) {
+            session->status = BOOT_ESP_ERR_FLASH;
+            break;
+        }
+        if (session->done != session->size) {
+            session->status = BOOT_ESP_ERR_SIZE;
+            break;
+        }
+        result = boot_slot_commit(session->flash, session->slot, session->size);
+        if (result == SFUD_SUCCESS) {
+            session->status = BOOT_ESP_DONE;
+        } else {
+            session->status = result == SFUD_ERR_NOT_FOUND ? BOOT_ESP_ERR_IMAGE : BOOT_ESP_ERR_FLASH;
+        }
+        /* selected, or a bad image: a START again downloads it all */
+        if (session->resumable && session->status != BOOT_ESP_ERR_FLASH) {
+            session->resumable = false;
+            boot_kv_delete(BOOT_ESP_KV_KEY);
+        }
+        break;
+    default:
+        /* START again, the ESP32 didn't get the first ACK yet */
+        break;
+    }
+    session->ack = true;
+
+    return session->status == BOOT_ESP_OK;
+}
+
+/**
+ * end the program of the last chunk, its ACK tells how it went
+ *
+ * @return false: the program failed
+ */
+static bool esp_write_wait(esp_session *session) {
+    if (sfud_async_wait(&esp_write_op) != SFUD_SUCCESS) {
+        session->closing = ESP_CHUNK_NONE;
+        if (session->status == BOOT_ESP_OK) {
+            session->status = BOOT_ESP_ERR_FLASH;
+            session->ack = true;
+        }
+    }
+    esp_chunk_record(session);
+    if (session->writing) {
+        esp_spi_rx_release(session->writing);
+        session->writing = NULL;
+    }
+    return session->status == BOOT_ESP_OK || session->status == BOOT_ESP_DONE;
+}
+
+/**
+ * send the final status, for as long as the ESP32 takes to clock it
+ */
+static void esp_ack_flush(esp_session *session) {
+    uint32_t start = HAL_GetTick();
+
+    do {
+        esp_ack_send(session);
+    } while ((session->ack || esp_spi_tx_busy()) && HAL_GetTick() - start <= ESP_LINK_TIMEOUT_MS);
+}
+
+/**
+ * wait for the START frame of the ESP32
+ *
+ * @return NULL: none in time
+ */
+static uint8_t *esp_rx_wait(uint32_t timeout_ms) {
+    uint32_t start = HAL_GetTick();
+    uint8_t *rx;
+
+    while ((rx = esp_spi_rx_get()) == NULL) {
+        if (HAL_GetTick() - start > timeout_ms) {
+            break;
+        }
+    }
+    return rx;
+}
+
+/**
+ * move the program of the last chunk on, its RX frame goes back as soon as the flash has the data
+ */
+static bool esp_flash_run(boot_task *task) {
+    esp_session *session = (esp_session *) task->user_data;
+
+    if (!session->writing) {
+        return false;
+    }
+    if (sfud_async_poll(&esp_write_op) == SFUD_ERR_BUSY) {
+        return true;
+    }
+    if (!esp_write_wait(session)) {
+        session->over = true;
+    }
+    /* the ESP32 goes on with the next chunk, the RX task programs the one waiting */
+    boot_sched_post(&esp_rx_task);
+    return false;
+}
+
+/**
+ * handle the next message of the ESP32 and send the ACK due, one program at a time
+ */
+static bool esp_rx_run(boot_task *task) {
+    esp_session *session = (esp_session *) task->user_data;
+    const boot_esp_msg *msg;
+    uint8_t *rx;
+    bool more;
+
+    esp_ack_send(session);
+    /* the next chunk waits in the RX queue of esp_spi.h till the flash task frees the last one */
+    if (session->over || session->writing || (rx = esp_spi_rx_get()) == NULL) {
+        return false;
+    }
+    session->last = HAL_GetTick();
+    msg = esp_msg_parse(rx);
+    if (!msg) {
+        esp_spi_rx_release(rx);
+        return true;
+    }
+    more = esp_msg_handle(session, msg);
+    /* the data of a bundle is taken already */
+    if (more && msg->cmd == BOOT_ESP_CMD_DATA && !session->bundle) {
+        session->writing = rx;
+        boot_sched_post(&esp_flash_task);
+    } else {
+        esp_spi_rx_release(rx);
+    }
+    session->over = !more;
+    esp_ack_send(session);
+
+    return true;
+}
+
+static void esp_rx_notify(void) {
+    boot_sched_post(&esp_rx_task);
+}
+
+static bool esp_session_over(void *arg) {
+    const esp_session *session = (const esp_session *) arg;
+
+    return session->over || HAL_GetTick() - session->last > BOOT_ESP_TIMEOUT_MS;
+}
+
+/**
+ * run the messages of a download until END, an error or the timeout
+ */
+static bool esp_session_run(esp_session *session) {
+    esp_flash_task.run = esp_flash_run;
+    esp_flash_task.user_data = session;
+    esp_rx_task.run = esp_rx_run;
+    esp_rx_task.user_data = session;
+    boot_sched_add(&esp_flash_task);
+    boot_sched_add(&esp_rx_task);
+    session->last = HAL_GetTick();
+    esp_spi_set_notify(esp_rx_notify);
+
+    boot_sched_run(esp_session_over, session);
+
+    esp_spi_set_notify(NULL);
+    esp_write_wait(session);
+    esp_ack_flush(session);
+
+    return session->status == BOOT_ESP_DONE;
+}
+
+/**
+ * run the download when the ESP32 offers one at reset
+ *
+ * @param flash MAIN flash, indirect mode
+ *
+ * @return true: an image was downloaded and its slot is selected
+ */
+bool boot_esp_update(const sfud_flash *flash) {
+    const boot_esp_msg *msg = NULL;
+    esp_session session;
+    uint32_t start = HAL_GetTick(), kept = 0, id = 0;
+    bool result = false, has_id = false;
+    uint8_t *rx;
+
+    /* no offer pending, don't spend any boot time on the ESP32: one pin read, the link isn't brought up */
+    if (!esp_spi_data_ready()) {
+        return false;
+    }
+    if (!esp_spi_init()) {
+        return false;
+    }
+#ifdef ELOG_PORT_ESP_ENABLE
+    boot_netlog_start();
+#endif
+
+    memset(&session, 0, sizeof(session));
+    memset(&esp_write_op, 0, sizeof(esp_write_op));
+    rx = esp_rx_wait(ESP_LINK_TIMEOUT_MS);
+    if (rx && (msg = esp_msg_parse(rx)) != NULL && msg->cmd == BOOT_ESP_CMD_START) {
+        session.flash = flash;
+        session.slot = boot_slot_staging(flash);
+        boot_recv_start(session.slot);
+        session.size = msg->offset;
+        session.ack = true;
+        session.closing = ESP_CHUNK_NONE;
+        if (msg->len >= sizeof(id)) {
+            memcpy(&id, msg + 1, sizeof(id));
+            has_id = true;
+        }
+        esp_spi_rx_release(rx);
+        if (session.size == 0 || session.size > BOOT_SLOT_SIZE) {
+            session.status = BOOT_ESP_ERR_SIZE;
+            esp_ack_flush(&session);
+        } else {
+            /* the resume record (key-value store) and the rollback copy are on the EXT flash */
+            boot_ext_flash();
+            if (has_id) {
+                kept = esp_resume_load(&session, id);
+            }
+            if (kept) {
+                elog_i(TAG, "download of %u bytes into slot %c resumed, %u chunks kept, from 0x%08x", session.size,
+                       'A' + session.slot, (unsigned) kept, session.done);
+            } else {
+                elog_i(TAG, "download of %u bytes into slot %c", session.size, 'A' + session.slot);
+                /* the slot may hold the image to fall back to, keep it before the first chunk */
+                boot_rollback_save(session.slot);
+            }
+            result = esp_session_run(&session);
+        }
+        if (result) {
+            esp_spi_stats stats;
+            boot_sched_stats sched;
+
+            esp_spi_get_stats(&stats);
+            boot_sched_get_stats(&sched);
+            elog_i(TAG, "downloaded in %u ms, %u frames, %u stalls, %u%% idle", HAL_GetTick() - start,
+                   (unsigned) stats.rx_frames, (unsigned) stats.stalls,
+                   (unsigned) ((uint64_t) sched.idle_cycles * 100 / (sched.idle_cycles + sched.busy_cycles + 1)));
+        } else {
+            elog_e(TAG, "download failed(%d) at 0x%08x", session.status, session.done);
+        }
+#ifdef BOOT_LFS
+    } else if (msg && msg->cmd == BOOT_ESP_CMD_BUNDLE) {
+        session.flash = flash;
+        session.size = msg->offset;
+        session.ack = true;
+        session.closing = ESP_CHUNK_NONE;
+        esp_spi_rx_release(rx);
+        session.bundle = boot_bundle_start(flash);
+        if (!session.bundle) {
+            session.status = BOOT_ESP_ERR_FLASH;
+            esp_ack_flush(&session);
+        } else {
+            elog_i(TAG, "bundle of %u bytes", session.size);
+            esp_session_run(&session);
+            /* cut short: the entries taken so far are dropped */
+            if (session.bundle) {
+                boot_bundle_finish(&session.selected);
+            }
+        }
+        if (session.status == BOOT_ESP_DONE) {
+            elog_i(TAG, "bundle in place in %u ms", HAL_GetTick() - start);
+        } else {
+            elog_e(TAG, "bundle failed(%d) at 0x%08x", session.status, session.done);
+        }
+        result = session.selected;
+#endif
+    } else if (rx) {
+        esp_spi_rx_release(rx);
+    }
+#ifdef ELOG_PORT_ESP_ENABLE
+    boot_netlog_stop();
+#endif
+    esp_spi_deinit();
+
+    return result;
+}
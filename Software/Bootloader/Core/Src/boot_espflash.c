@@ -0,0 +1,467 @@
+/**
+ * @file boot_espflash.c
+ * @brief ESP32-C3 firmware flashing over its ROM serial loader, see boot_espflash.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_ESPFLASH
+
+#include "boot_espflash.h"
+
+#ifdef BOOT_LFS
+
+#include "boot_image.h"
+#include "boot_kv.h"
+#include "boot_lfs.h"
+#include "main.h"
+#include "elog.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "espflash");
+
+/* UART5: PB6 TX to the ESP32 RXD, PB5 RX from its TXD */
+#define ESPFLASH_UART_PORT              GPIOB
+#define ESPFLASH_UART_PINS              (GPIO_PIN_5 | GPIO_PIN_6)
+
+#define SLIP_END                        0xC0
+#define SLIP_ESC                        0xDB
+#define SLIP_ESC_END                    0xDC
+#define SLIP_ESC_ESC                    0xDD
+
+#define ESP_CMD_SYNC                    0x08
+#define ESP_CMD_SPI_SET_PARAMS          0x0B
+#define ESP_CMD_SPI_ATTACH              0x0D
+#define ESP_CMD_CHANGE_BAUDRATE         0x0F
+#define ESP_CMD_FLASH_DEFL_BEGIN        0x10
+#define ESP_CMD_FLASH_DEFL_DATA         0x11
+#define ESP_CMD_FLASH_DEFL_END          0x12
+#define ESP_CMD_SPI_FLASH_MD5           0x13
+
+#define ESP_CHECKSUM_SEED               0xEF
+/* status, error and two reserved bytes end every response of the ROM loader */
+#define ESP_STATUS_LEN                  4
+#define ESP_SYNC_TRIES                  10
+#define ESP_SYNC_TIMEOUT_MS             100
+#define ESP_TIMEOUT_MS                  3000
+/* per MB of the ESP32 flash, the ROM erases the whole area at FLASH_DEFL_BEGIN */
+#define ESP_ERASE_TIMEOUT_MS_PER_MB     30000
+#define ESP_MD5_TIMEOUT_MS_PER_MB       8000
+#define ESP_RESET_MS                    10
+#define ESP_BOOT_MS                     50
+
+static UART_HandleTypeDef huart5;
+/* the decoded response: header, data and status, the MD5 answer is the longest */
+static uint8_t espflash_rx[8 + 32 + ESP_STATUS_LEN];
+static uint8_t espflash_block[16 + BOOT_ESPFLASH_BLOCK_SIZE];
+static uint8_t espflash_file_buf[BOOT_LFS_CACHE_SIZE];
+static boot_espflash_entry espflash_entries[BOOT_ESPFLASH_MAX_ENTRIES];
+
+static bool espflash_uart_init(uint32_t baud) {
+    huart5.Instance = UART5;
+    huart5.Init.BaudRate = baud;
+    huart5.Init.WordLength = UART_WORDLENGTH_8B;
+    huart5.Init.StopBits = UART_STOPBITS_1;
+    huart5.Init.Parity = UART_PARITY_NONE;
+    huart5.Init.Mode = UART_MODE_TX_RX;
+    huart5.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+    huart5.Init.OverSampling = UART_OVERSAMPLING_16;
+    huart5.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
+    huart5.Init.ClockPrescaler = UART_PRESCALER_DIV1;
+    huart5.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+    /* the FIFO takes the bytes in while the CPU decodes the frame */
+    return HAL_UART_Init(&huart5) == HAL_OK && HAL_UARTEx_EnableFifoMode(&huart5) == HAL_OK;
+}
+
+static bool espflash_init(void) {
+    GPIO_InitTypeDef gpio = {0};
+
+    __HAL_RCC_GPIOB_CLK_ENABLE();
+    __HAL_RCC_GPIOD_CLK_ENABLE();
+    /* the kernel clock is the USART234578 one, PCLK1 as for USART2 */
+    __HAL_RCC_UART5_CLK_ENABLE();
+
+    gpio.Pin = ESPFLASH_UART_PINS;
+    gpio.Mode = GPIO_MODE_AF_PP;
+    gpio.Pull = GPIO_PULLUP;
+    gpio.Speed = GPIO_SPEED_FREQ_HIGH;
+    gpio.Alternate = GPIO_AF14_UART5;
+    HAL_GPIO_Init(ESPFLASH_UART_PORT, &gpio);
+
+    return espflash_uart_init(BOOT_ESPFLASH_ROM_BAUD);
+}
+
+static void espflash_deinit(void) {
+    HAL_UART_DeInit(&huart5);
+    __HAL_RCC_UART5_CLK_DISABLE();
+    HAL_GPIO_DeInit(ESPFLASH_UART_PORT, ESPFLASH_UART_PINS);
+    huart5.Instance = NULL;
+}
+
+/**
+ * reset the ESP32, into the ROM loader or into its firmware; MX_GPIO_Init() left both pins released
+ */
+static void espflash_reset(bool download) {
+    HAL_GPIO_WritePin(ESP_BOOT_GPIO_Port, ESP_BOOT_Pin, download ? GPIO_PIN_RESET : GPIO_PIN_SET);
+    HAL_GPIO_WritePin(ESP_EN_GPIO_Port, ESP_EN_Pin, GPIO_PIN_RESET);
+    HAL_Delay(ESP_RESET_MS);
+    HAL_GPIO_WritePin(ESP_EN_GPIO_Port, ESP_EN_Pin, GPIO_PIN_SET);
+    HAL_Delay(ESP_BOOT_MS);
+    /* IO9 is only sampled at reset */
+    HAL_GPIO_WritePin(ESP_BOOT_GPIO_Port, ESP_BOOT_Pin, GPIO_PIN_SET);
+}
+
+static void espflash_putc(uint8_t c) {
+    while (!(UART5->ISR & USART_ISR_TXE_TXFNF)) {
+    }
+    UART5->TDR = c;
+}
+
+static bool espflash_getc(uint8_t *c, uint32_t start, uint32_t timeout_ms) {
+    while (!(UART5->ISR & USART_ISR_RXNE_RXFNE)) {
+        if (UART5->ISR & (USART_ISR_ORE | USART_ISR_FE | USART_ISR_NE)) {
+            UART5->ICR = USART_ICR_ORECF | USART_ICR_FECF | USART_ICR_NECF;
+        }
+        if (HAL_GetTick() - start > timeout_ms) {
+            return false;
+        }
+    }
+    *c = (uint8_t) UART5->RDR;
+    return true;
+}
+
+/* drop the boot banner, or the answers of the ROM to the SYNC tries */
+static void espflash_drain(uint32_t quiet_ms) {
+    uint8_t c;
+
+    while (espflash_getc(&c, HAL_GetTick(), quiet_ms)) {
+    }
+}
+
+static void espflash_slip_write(const void *buf, size_t len) {
+    const uint8_t *p = buf;
+
+    while (len--) {
+        if (*p == SLIP_END) {
+            espflash_putc(SLIP_ESC);
+            espflash_putc(SLIP_ESC_END);
+        } else if (*p == SLIP_ESC) {
+            espflash_putc(SLIP_ESC);
+            espflash_putc(SLIP_ESC_ESC);
+        } else {
+            espflash_putc(*p);
+        }
+        p++;
+    }
+}
+
+static void put_le32(uint8_t *buf, uint32_t value) {
+    buf[0] = (uint8_t) value;
+    buf[1] = (uint8_t) (value >> 8);
+    buf[2] = (uint8_t) (value >> 16);
+    buf[3] = (uint8_t) (value >> 24);
+}
+
+/**
+ * read the response to a command, the frames of other commands are skipped
+ *
+ * @return data bytes of the response before the status, -1: none or failed
+ */
+static int espflash_response(uint8_t op, uint32_t timeout_ms) {
+    uint32_t start = HAL_GetTick();
+    size_t len, size;
+    uint8_t c;
+    bool esc;
+
+    while (1) {
+        do {
+            if (!espflash_getc(&c, start, timeout_ms)) {
+                return -1;
+            }
+        } while (c != SLIP_END);
+
+        len = 0;
+        esc = false;
+        while (1) {
+            if (!espflash_getc(&c, start, timeout_ms)) {
+                return -1;
+            }
+            if (c == SLIP_END) {
+                break;
+            }
+            if (esc) {
+                c = c == SLIP_ESC_END ? SLIP_END : c == SLIP_ESC_ESC ? SLIP_ESC : c;
+                esc = false;
+            } else if (c == SLIP_ESC) {
+                esc = true;
+                continue;
+            }
+            if (len < sizeof(espflash_rx)) {
+                espflash_rx[len] = c;
+            }
+            len++;
+        }
+        /* back to back delimiters, or a frame too long for any answer of ours */
+        if (len < 8 + ESP_STATUS_LEN || len > sizeof(espflash_rx) || espflash_rx[0] != 1 || espflash_rx[1] != op) {
+            continue;
+        }
+        size = espflash_rx[2] | espflash_rx[3] << 8;
+        if (size < ESP_STATUS_LEN || 8 + size > len) {
+            continue;
+        }
+        if (espflash_rx[8 + size - ESP_STATUS_LEN] != 0) {
+            elog_w(TAG, "command 0x%02x failed, error 0x%02x", op, espflash_rx[8 + size - ESP_STATUS_LEN + 1]);
+            return -1;
+        }
+        return (int) (size - ESP_STATUS_LEN);
+    }
+}
+
+/**
+ * send a command: its parameters, then the data the checksum covers
+ *
+ * @return see espflash_response()
+ */
+static int espflash_command(uint8_t op, const void *params, size_t params_len, const void *data, size_t data_len,
+                            uint32_t timeout_ms) {
+    const uint8_t *p = data;
+    uint8_t head[8];
+    uint8_t sum = ESP_CHECKSUM_SEED;
+    size_t i;
+
+    for (i = 0; i < data_len; i++) {
+        sum ^= p[i];
+    }
+    head[0] = 0;
+    head[1] = op;
+    head[2] = (uint8_t) (params_len + data_len);
+    head[3] = (uint8_t) ((params_len + data_len) >> 8);
+    put_le32(&head[4], data_len ? sum : 0);
+
+    espflash_putc(SLIP_END);
+    espflash_slip_write(head, sizeof(head));
+    espflash_slip_write(params, params_len);
+    espflash_slip_write(data, data_len);
+    espflash_putc(SLIP_END);
+
+    return espflash_response(op, timeout_ms);
+}
+
+static bool espflash_sync(void) {
+    uint8_t sync[36] = {0x07, 0x07, 0x12, 0x20};
+    int i;
+
+    memset(&sync[4], 0x55, sizeof(sync) - 4);
+    for (i = 0; i < ESP_SYNC_TRIES; i++) {
+        if (espflash_command(ESP_CMD_SYNC, sync, sizeof(sync), NULL, 0, ESP_SYNC_TIMEOUT_MS) >= 0) {
+            /* the ROM answers each SYNC a few times */
+            espflash_drain(ESP_BOOT_MS);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool espflash_baud(uint32_t baud) {
+    uint8_t params[8];
+
+    put_le32(&params[0], baud);
+    /* the old baud, 0 for the ROM loader */
+    put_le32(&params[4], 0);
+    if (espflash_command(ESP_CMD_CHANGE_BAUDRATE, params, sizeof(params), NULL, 0, ESP_TIMEOUT_MS) < 0) {
+        return false;
+    }
+    /* the ROM switches after its answer is out */
+    while (!(UART5->ISR & USART_ISR_TC)) {
+    }
+    if (!espflash_uart_init(baud)) {
+        return false;
+    }
+    espflash_drain(ESP_BOOT_MS);
+    return true;
+}
+
+static bool espflash_attach(uint32_t flash_size) {
+    uint8_t params[24] = {0};
+
+    /* the default SPI pins, then the 4 bytes the ROM loader takes in addition */
+    if (espflash_command(ESP_CMD_SPI_ATTACH, params, 8, NULL, 0, ESP_TIMEOUT_MS) < 0) {
+        return false;
+    }
+    put_le32(&params[0], 0);
+    put_le32(&params[4], flash_size);
+    put_le32(&params[8], 64 * 1024);
+    put_le32(&params[12], 4 * 1024);
+    put_le32(&params[16], 256);
+    put_le32(&params[20], 0xFFFF);
+    return espflash_command(ESP_CMD_SPI_SET_PARAMS, params, sizeof(params), NULL, 0, ESP_TIMEOUT_MS) >= 0;
+}
+
+static uint32_t timeout_per_mb(uint32_t ms_per_mb, uint32_t size) {
+    return ESP_TIMEOUT_MS + (uint32_t) (((uint64_t) ms_per_mb * size) >> 20);
+}
+
+static bool espflash_md5(const boot_espflash_entry *entry) {
+    uint8_t params[16] = {0};
+    char hex[3];
+    int i;
+
+    put_le32(&params[0], entry->addr);
+    put_le32(&params[4], entry->size);
+    /* the ROM loader answers with the digest in hex */
+    if (espflash_command(ESP_CMD_SPI_FLASH_MD5, params, sizeof(params), NULL, 0,
+                         timeout_per_mb(ESP_MD5_TIMEOUT_MS_PER_MB, entry->size)) != 32) {
+        return false;
+    }
+    for (i = 0; i < 16; i++) {
+        snprintf(hex, sizeof(hex), "%02x", entry->md5[i]);
+        if (memcmp(hex, &espflash_rx[8 + i * 2], 2) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * write one entry: FLASH_DEFL_BEGIN, its zlib stream in blocks, then the MD5 of the written area
+ */
+static bool espflash_entry(lfs_t *lfs, lfs_file_t *file, const boot_espflash_entry *entry) {
+    uint32_t blocks = (entry->comp_size + BOOT_ESPFLASH_BLOCK_SIZE - 1) / BOOT_ESPFLASH_BLOCK_SIZE;
+    uint32_t erase_size = (entry->size + BOOT_ESPFLASH_BLOCK_SIZE - 1) / BOOT_ESPFLASH_BLOCK_SIZE
+            * BOOT_ESPFLASH_BLOCK_SIZE;
+    uint32_t seq, done = 0, len;
+    uint8_t params[20];
+
+    put_le32(&params[0], erase_size);
+    put_le32(&params[4], blocks);
+    put_le32(&params[8], BOOT_ESPFLASH_BLOCK_SIZE);
+    put_le32(&params[12], entry->addr);
+    /* not encrypted */
+    put_le32(&params[16], 0);
+    if (espflash_command(ESP_CMD_FLASH_DEFL_BEGIN, params, sizeof(params), NULL, 0,
+                         timeout_per_mb(ESP_ERASE_TIMEOUT_MS_PER_MB, erase_size)) < 0) {
+        return false;
+    }
+    if (lfs_file_seek(lfs, file, (lfs_soff_t) entry->offset, LFS_SEEK_SET) < 0) {
+        return false;
+    }
+    for (seq = 0; seq < blocks; seq++) {
+        len = entry->comp_size - done < BOOT_ESPFLASH_BLOCK_SIZE ? entry->comp_size - done : BOOT_ESPFLASH_BLOCK_SIZE;
+        if (lfs_file_read(lfs, file, &espflash_block[16], len) != (lfs_ssize_t) len) {
+            return false;
+        }
+        put_le32(&espflash_block[0], len);
+        put_le32(&espflash_block[4], seq);
+        put_le32(&espflash_block[8], 0);
+        put_le32(&espflash_block[12], 0);
+        if (espflash_command(ESP_CMD_FLASH_DEFL_DATA, espflash_block, 16, &espflash_block[16], len,
+                             ESP_TIMEOUT_MS) < 0) {
+            elog_e(TAG, "block %u of 0x%06x failed", (unsigned) seq, (unsigned) entry->addr);
+            return false;
+        }
+        done += len;
+    }
+    if (!espflash_md5(entry)) {
+        elog_e(TAG, "MD5 of 0x%06x differs", (unsigned) entry->addr);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * read and check the header and the entries of the bundle
+ */
+static bool bundle_read(lfs_t *lfs, lfs_file_t *file, boot_espflash_header *header) {
+    lfs_soff_t file_size = lfs_file_size(lfs, file);
+    uint32_t crc, i;
+
+    if (lfs_file_read(lfs, file, header, sizeof(*header)) != (lfs_ssize_t) sizeof(*header)
+            || header->magic != BOOT_ESPFLASH_MAGIC || header->num == 0
+            || header->num > BOOT_ESPFLASH_MAX_ENTRIES) {
+        return false;
+    }
+    if (lfs_file_read(lfs, file, espflash_entries, header->num * sizeof(espflash_entries[0]))
+            != (lfs_ssize_t) (header->num * sizeof(espflash_entries[0]))) {
+        return false;
+    }
+    crc = boot_image_crc32(0, header, offsetof(boot_espflash_header, crc));
+    crc = boot_image_crc32(crc, espflash_entries, header->num * sizeof(espflash_entries[0]));
+    if (crc != header->crc) {
+        return false;
+    }
+    for (i = 0; i < header->num; i++) {
+        const boot_espflash_entry *entry = &espflash_entries[i];
+
+        if (entry->addr % 4096 || entry->size == 0 || entry->comp_size == 0 || file_size < 0
+                || entry->offset > (uint32_t) file_size || entry->comp_size > (uint32_t) file_size - entry->offset
+                || entry->addr + entry->size > header->flash_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * flash the ESP32 bundle of the file system when it hasn't been flashed yet
+ *
+ * @param lfs mounted file system of the EXT flash, see boot_lfs_mount()
+ *
+ * @return true: a bundle was flashed and the ESP32 restarted on it
+ */
+bool boot_espflash_update(lfs_t *lfs) {
+    struct lfs_file_config file_cfg = {.buffer = espflash_file_buf};
+    boot_espflash_header header;
+    uint32_t start = HAL_GetTick(), done_crc, i;
+    lfs_file_t file;
+    size_t len;
+    bool result;
+
+    if (lfs_file_opencfg(lfs, &file, BOOT_ESPFLASH_PATH, LFS_O_RDONLY, &file_cfg) != LFS_ERR_OK) {
+        return false;
+    }
+    if (!bundle_read(lfs, &file, &header)) {
+        elog_w(TAG, "%s is not a valid bundle", BOOT_ESPFLASH_PATH);
+        lfs_file_close(lfs, &file);
+        return false;
+    }
+    if (boot_kv_get(BOOT_ESPFLASH_KV_KEY, &done_crc, sizeof(done_crc), &len) == SFUD_SUCCESS
+            && len == sizeof(done_crc) && done_crc == header.crc) {
+        lfs_file_close(lfs, &file);
+        return false;
+    }
+
+    elog_i(TAG, "flashing the ESP32 bundle 0x%08x, %u entries", (unsigned) header.crc, (unsigned) header.num);
+    result = espflash_init();
+    if (result) {
+        espflash_reset(true);
+        espflash_drain(ESP_BOOT_MS);
+        result = espflash_sync() && espflash_baud(BOOT_ESPFLASH_BAUD) && espflash_attach(header.flash_size);
+        if (!result) {
+            elog_e(TAG, "no ROM loader on UART5");
+        }
+    }
+    for (i = 0; result && i < header.num; i++) {
+        result = espflash_entry(lfs, &file, &espflash_entries[i]);
+    }
+    if (result) {
+        uint8_t params[4];
+
+        /* stay in the loader, the reset below runs the new firmware */
+        put_le32(params, 1);
+        espflash_command(ESP_CMD_FLASH_DEFL_END, params, sizeof(params), NULL, 0, ESP_TIMEOUT_MS);
+    }
+    if (huart5.Instance) {
+        espflash_reset(false);
+        espflash_deinit();
+    }
+    lfs_file_close(lfs, &file);
+
+    if (!result) {
+        elog_e(TAG, "ESP32 flashing failed");
+        return false;
+    }
+    boot_kv_set(BOOT_ESPFLASH_KV_KEY, &header.crc, sizeof(header.crc));
+    elog_i(TAG, "ESP32 flashed in %u ms", (unsigned) (HAL_GetTick() - start));
+    return true;
+}
+
+#endif /* BOOT_LFS */
@@ -0,0 +1,49 @@
+/**
+ * @file boot_ext.c
+ * @brief The EXT flash, SPI2 and what lives on them, brought up on their first use, see boot_ext.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_EXT
+
+#include "boot_ext.h"
+#include "boot_clock.h"
+#include "boot_handoff.h"
+#include "boot_kv.h"
+#include "main.h"
+#include "spi.h"
+#include "elog.h"
+#include <elog_flash.h>
+
+ELOG_TAG_DEFINE(TAG, "ext");
+
+static bool ext_up;
+
+/**
+ * @return the EXT flash, SPI2 and the flash probed on the first call
+ */
+sfud_flash *boot_ext_flash(void) {
+    sfud_flash *flash = sfud_get_device(SFUD_EXT_FLASH);
+    uint32_t start = HAL_GetTick();
+
+    if (ext_up) {
+        return flash;
+    }
+    ext_up = true;
+    MX_SPI2_Init();
+    boot_clock_spi2();
+    if (sfud_device_init(flash) != SFUD_SUCCESS) {
+        elog_e(TAG, "EXT flash init failed");
+        return flash;
+    }
+#ifdef ELOG_PORT_FLASH_ENABLE
+    if (elog_flash_init(flash) != SFUD_SUCCESS) {
+        elog_w(TAG, "no flash log");
+    }
+#endif
+    if (boot_kv_mount(flash) != SFUD_SUCCESS) {
+        elog_w(TAG, "no key-value store");
+    }
+    boot_handoff_info_flash(flash);
+    elog_i(TAG, "EXT flash up in %u ms", (unsigned) (HAL_GetTick() - start));
+
+    return flash;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file boot_fault.c
+ * @brief Fault record in no-init RAM_D3, see boot_fault.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_FAULT
+
+#include "boot_fault.h"
+#include "boot_ext.h"
+#include "boot_image.h"
+#include "boot_kv.h"
+#include "main.h"
+#include "elog.h"
+#include <stddef.h>
+
+ELOG_TAG_DEFINE(TAG, "fault");
+
+/* RAM a stack may be in, the frame is only read there */
+#define FAULT_DTCM_ADDR                 0x20000000UL
+#define FAULT_DTCM_END                  0x20020000UL
+#define FAULT_RAM_D1_ADDR               0x24000000UL
+#define FAULT_RAM_D1_END                0x24050000UL
+
+/* placed after the handoff record by the linker script, see BOOT_FAULT_ADDR */
+boot_fault boot_fault_record __attribute__((section(".boot_fault")));
+
+static uint32_t fault_crc(const boot_fault *record) {
+    return boot_image_crc32(0, record, offsetof(boot_fault, crc));
+}
+
+/**
+ * @return bytes readable from addr on, 0: addr is not in a RAM a stack may be in
+ */
+static uint32_t ram_left(uint32_t addr) {
+    if (addr % 4) {
+        return 0;
+    }
+    if (addr >= FAULT_DTCM_ADDR && addr < FAULT_DTCM_END) {
+        return FAULT_DTCM_END - addr;
+    }
+    if (addr >= FAULT_RAM_D1_ADDR && addr < FAULT_RAM_D1_END) {
+        return FAULT_RAM_D1_END - addr;
+    }
+    return 0;
+}
+
+/**
+ * fill the record and reset, from a fault handler
+ *
+ * @param frame exception frame, the MSP or the PSP at the entry as bit 2 of exc_return tells
+ * @param exc_return LR at the entry
+ */
+void boot_fault_capture(const uint32_t *frame, uint32_t exc_return) {
+    boot_fault *record = &boot_fault_record;
+    uint32_t sp = (uint32_t) (uintptr_t) frame, left = ram_left(sp);
+
+    __disable_irq();
+    record->magic = 0;
+    record->version = BOOT_FAULT_VERSION;
+    record->size = sizeof(boot_fault);
+    record->ipsr = __get_IPSR();
+    record->exc_return = exc_return;
+    record->sp = sp;
+    record->cfsr = SCB->CFSR;
+    record->hfsr = SCB->HFSR;
+    record->dfsr = SCB->DFSR;
+    record->mmfar = SCB->MMFAR;
+    record->bfar = SCB->BFAR;
+    record->afsr = SCB->AFSR;
+    record->stack_num = 0;
+    for (size_t i = 0; i < 8; i++) {
+        record->frame[i] = left >= sizeof(record->frame) ? frame[i] : 0;
+    }
+    if (left >= sizeof(record->frame)) {
+        left -= sizeof(record->frame);
+        while (record->stack_num < BOOT_FAULT_STACK_WORDS && left >= sizeof(uint32_t)) {
+            record->stack[record->stack_num] = frame[8 + record->stack_num];
+            record->stack_num++;
+            left -= sizeof(uint32_t);
+        }
+    }
+    for (size_t i = record->stack_num; i < BOOT_FAULT_STACK_WORDS; i++) {
+        record->stack[i] = 0;
+    }
+    record->crc = fault_crc(record);
+    record->magic = BOOT_FAULT_MAGIC;
+    /* a reset drops the D-Cache */
+    SCB_CleanDCache_by_Addr((uint32_t *) record, sizeof(boot_fault));
+    NVIC_SystemReset();
+}
+
+/**
+ * @return true: a fault record waits for boot_fault_save()
+ */
+bool boot_fault_pending(void) {
+    const boot_fault *record = &boot_fault_record;
+
+    return record->magic == BOOT_FAULT_MAGIC && record->version == BOOT_FAULT_VERSION
+            && record->size == sizeof(boot_fault) && record->crc == fault_crc(record);
+}
+
+/**
+ * log a waiting fault record, store it under BOOT_FAULT_KV_KEY and drop it
+ *
+ * @note the record is dropped even when the store fails, a second fault overwrites it
+ */
+void boot_fault_save(void) {
+    boot_fault *record = &boot_fault_record;
+    sfud_err result;
+
+    if (!boot_fault_pending()) {
+        return;
+    }
+    /* the store is on the EXT flash, a plain boot doesn't bring it up */
+    boot_ext_flash();
+    elog_w(TAG, "exception %u at pc 0x%08x lr 0x%08x, sp 0x%08x", record->ipsr, record->frame[6],
+           record->frame[5], record->sp);
+    elog_w(TAG, "cfsr 0x%08x hfsr 0x%08x mmfar 0x%08x bfar 0x%08x", record->cfsr, record->hfsr, record->mmfar,
+           record->bfar);
+    result = boot_kv_set(BOOT_FAULT_KV_KEY, record, sizeof(boot_fault));
+    if (result != SFUD_SUCCESS) {
+        elog_e(TAG, "fault record not stored(%d)", result);
+    }
+    record->magic = 0;
+    SCB_CleanDCache_by_Addr((uint32_t *) record, sizeof(boot_fault));
+}
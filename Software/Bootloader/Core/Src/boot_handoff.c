@@ -0,0 +1,346 @@
+/**
+ * @file boot_handoff.c
+ * @brief MPU and cache state handed over to the application, see boot_handoff.h.
+ */
+#include "boot_handoff.h"
+#include "boot_clock.h"
+#include "boot_profile.h"
+#include "dma_pool.h"
+#include "main.h"
+#include <string.h>
+
+/* placed after the direct boot record by the linker script, see BOOT_HANDOFF_INFO_ADDR */
+boot_handoff_info boot_handoff_record __attribute__((section(".boot_handoff")));
+
+static uint32_t info_crc(const boot_handoff_info *info) {
+    return boot_image_crc32(0, info, offsetof(boot_handoff_info, crc));
+}
+
+static bool info_is_valid(const boot_handoff_info *info) {
+    return info->magic == BOOT_HANDOFF_INFO_MAGIC && info->version == BOOT_HANDOFF_INFO_VERSION
+            && info->size == sizeof(boot_handoff_info) && info->crc == info_crc(info);
+}
+
+static void info_mem(boot_handoff_mem *mem) {
+    dma_alloc_stats arena;
+    dma_pool_stats pool;
+
+    mem->stack_size = boot_profile_stack_size();
+    mem->stack_peak = boot_profile_stack_peak();
+    for (size_t i = 0; i < DMA_REGION_NUM; i++) {
+        dma_alloc_get_stats((dma_region) i, &arena);
+        mem->arena_size[i] = arena.size;
+        mem->arena_peak[i] = arena.peak;
+    }
+    dma_pool_get_stats(&pool);
+    mem->pool_free_min = pool.free_min;
+}
+
+static void info_clock(boot_handoff_clock *clock) {
+    clock->sysclk_hz = HAL_RCC_GetSysClockFreq();
+    clock->hclk_hz = HAL_RCC_GetHCLKFreq();
+    clock->pclk1_hz = HAL_RCC_GetPCLK1Freq();
+    clock->pclk2_hz = HAL_RCC_GetPCLK2Freq();
+    clock->pclk3_hz = HAL_RCCEx_GetD1PCLK1Freq();
+    clock->pclk4_hz = HAL_RCCEx_GetD3PCLK1Freq();
+    clock->rcc_cr = RCC->CR;
+    clock->rcc_d1cfgr = RCC->D1CFGR;
+    clock->rcc_d2cfgr = RCC->D2CFGR;
+    clock->rcc_d3cfgr = RCC->D3CFGR;
+    clock->rcc_pllckselr = RCC->PLLCKSELR;
+    clock->rcc_pllcfgr = RCC->PLLCFGR;
+    clock->rcc_pll1divr = RCC->PLL1DIVR;
+    clock->rcc_pll1fracr = RCC->PLL1FRACR;
+    clock->rcc_d1ccipr = RCC->D1CCIPR;
+    clock->rcc_pll2divr = RCC->PLL2DIVR;
+    clock->rcc_pll2fracr = RCC->PLL2FRACR;
+    clock->ospi_hz = boot_clock_ospi_hz();
+    clock->flash_acr = FLASH->ACR;
+    clock->pwr_d3cr = PWR->D3CR;
+}
+
+/**
+ * start the handoff record of this boot, it's invalid till boot_handoff_prepare()
+ *
+ * @param path boot path, the direct one keeps the flash parameters of the full boot before
+ */
+void boot_handoff_info_init(boot_handoff_path path) {
+    boot_handoff_info *info = &boot_handoff_record;
+    boot_handoff_flash flash[SFUD_FLASH_DEVICE_NUM];
+    bool keep = path == BOOT_HANDOFF_PATH_DIRECT && info_is_valid(info);
+
+    if (keep) {
+        memcpy(flash, info->flash, sizeof(flash));
+    }
+    memset(info, 0, sizeof(boot_handoff_info));
+    if (keep) {
+        memcpy(info->flash, flash, sizeof(flash));
+    }
+    info->path = path;
+    info->slot = BOOT_SLOT_NONE;
+    /* the legacy layout has its vector table at the flash start */
+    info->vector_addr = OCTOSPI1_BASE;
+    /* both paths run MX_GPIO_Init() first */
+    info->esp_running = 1;
+}
+
+/**
+ * record the resolved parameters of a flash
+ *
+ * @param flash flash device, after sfud_init() and the fast read setup
+ */
+void boot_handoff_info_flash(const sfud_flash *flash) {
+    boot_handoff_flash *entry;
+
+    if (flash->index >= SFUD_FLASH_DEVICE_NUM) {
+        return;
+    }
+    entry = &boot_handoff_record.flash[flash->index];
+    memset(entry, 0, sizeof(boot_handoff_flash));
+    if (!flash->init_ok) {
+        return;
+    }
+    entry->valid = 1;
+    entry->mf_id = flash->chip.mf_id;
+    entry->type_id = flash->chip.type_id;
+    entry->capacity_id = flash->chip.capacity_id;
+    entry->capacity = flash->chip.capacity;
+    entry->erase_gran = flash->chip.erase_gran;
+    entry->erase_gran_cmd = flash->chip.erase_gran_cmd;
+    entry->addr_in_4_byte = flash->addr_in_4_byte;
+    entry->write_mode = flash->chip.write_mode;
+#ifdef SFUD_USING_QSPI
+    entry->read_instruction = flash->read_cmd_format.instruction;
+    entry->read_instruction_lines = flash->read_cmd_format.instruction_lines;
+    entry->read_address_size = flash->read_cmd_format.address_size;
+    entry->read_address_lines = flash->read_cmd_format.address_lines;
+    entry->read_alternate_bytes_lines = flash->read_cmd_format.alternate_bytes_lines;
+    entry->read_dummy_cycles = flash->read_cmd_format.dummy_cycles;
+    entry->read_data_lines = flash->read_cmd_format.data_lines;
+    entry->read_flags = (flash->read_cmd_format.dtr ? 1U : 0U) | (flash->read_cmd_format.continuous ? 2U : 0U)
+            | (flash->read_cmd_format.wrap ? 4U : 0U);
+#endif
+}
+
+/**
+ * record the slot about to be booted
+ *
+ * @param slot slot, BOOT_SLOT_NONE: legacy layout
+ * @param header its image header, NULL for the legacy layout
+ * @param verified BOOT_HANDOFF_IMAGE_xxx the image passed
+ */
+void boot_handoff_info_slot(boot_slot_id slot, const boot_image_header *header, uint8_t verified) {
+    boot_handoff_record.slot = slot;
+    boot_handoff_record.image_version = header ? header->image_version : 0;
+    boot_handoff_record.vector_addr = header ? boot_image_vtor(header) : OCTOSPI1_BASE;
+    boot_handoff_record.verified = verified;
+}
+
+/**
+ * record the sectors of the image left to the verify_step service, see boot_verify.h
+ *
+ * @param sectors boot_verify_deferred(), 0: checked in full
+ */
+void boot_handoff_info_deferred(uint8_t sectors) {
+    boot_handoff_record.deferred = sectors;
+}
+
+/**
+ * record an update done at this boot
+ *
+ * @param updates BOOT_HANDOFF_UPDATE_xxx
+ */
+void boot_handoff_info_update(uint8_t updates) {
+    boot_handoff_record.updates |= updates;
+}
+
+/**
+ * read the OCTOSPI1 registers of the memory-mapped mode
+ */
+void boot_handoff_ospi_save(boot_handoff_ospi *ospi) {
+    ospi->cr = OCTOSPI1->CR;
+    ospi->dcr[0] = OCTOSPI1->DCR1;
+    ospi->dcr[1] = OCTOSPI1->DCR2;
+    ospi->dcr[2] = OCTOSPI1->DCR3;
+    ospi->dcr[3] = OCTOSPI1->DCR4;
+    ospi->ccr = OCTOSPI1->CCR;
+    ospi->tcr = OCTOSPI1->TCR;
+    ospi->ir = OCTOSPI1->IR;
+    ospi->abr = OCTOSPI1->ABR;
+    ospi->wpccr = OCTOSPI1->WPCCR;
+    ospi->wptcr = OCTOSPI1->WPTCR;
+    ospi->wpir = OCTOSPI1->WPIR;
+    ospi->wpabr = OCTOSPI1->WPABR;
+    ospi->dlyb_cr = DLYB_OCTOSPI1->CR;
+    ospi->dlyb_cfgr = DLYB_OCTOSPI1->CFGR & (DLYB_CFGR_SEL | DLYB_CFGR_UNIT);
+}
+
+/**
+ * Set Burst with Wrap (77h) at 32 bytes again, in the indirect write mode, the flash may have been reset
+ */
+static void ospi_wrap_set(void) {
+    OCTOSPI1->CCR = OCTOSPI_CCR_IMODE_0 | OCTOSPI_CCR_ADMODE_0 | OCTOSPI_CCR_ADMODE_1 | OCTOSPI_CCR_ADSIZE;
+    OCTOSPI1->TCR = 0;
+    OCTOSPI1->IR = SFUD_CMD_SET_BURST_WITH_WRAP;
+    /* the address starts the command, 24 dummy bits then the wrap bits */
+    OCTOSPI1->AR = SFUD_QSPI_WRAP_BITS_32;
+    while (!READ_BIT(OCTOSPI1->SR, OCTOSPI_SR_TCF)) {
+    }
+    WRITE_REG(OCTOSPI1->FCR, OCTOSPI_FCR_CTCF);
+}
+
+/**
+ * put OCTOSPI1 in the saved memory-mapped mode, its IO manager and pins are set up already
+ *
+ * @note the DCRs are written with the OCTOSPI disabled, the read command in the indirect mode like HAL does,
+ *       a wrapped read sends 77h to the flash first, the delay block is set before it samples
+ */
+void boot_handoff_ospi_load(const boot_handoff_ospi *ospi) {
+    while (READ_BIT(OCTOSPI1->SR, OCTOSPI_SR_BUSY)) {
+    }
+    CLEAR_BIT(OCTOSPI1->CR, OCTOSPI_CR_EN);
+    if (READ_BIT(ospi->dcr[0], OCTOSPI_DCR1_DLYBYP)) {
+        DLYB_OCTOSPI1->CR = 0;
+    } else {
+        /* CFGR only takes SEL and UNIT with SEN set */
+        DLYB_OCTOSPI1->CR = DLYB_CR_DEN | DLYB_CR_SEN;
+        DLYB_OCTOSPI1->CFGR = ospi->dlyb_cfgr;
+        DLYB_OCTOSPI1->CR = ospi->dlyb_cr & DLYB_CR_DEN;
+    }
+    OCTOSPI1->DCR1 = ospi->dcr[0];
+    OCTOSPI1->DCR2 = ospi->dcr[1];
+    OCTOSPI1->DCR3 = ospi->dcr[2];
+    OCTOSPI1->DCR4 = ospi->dcr[3];
+    OCTOSPI1->CR = ospi->cr & ~OCTOSPI_CR_FMODE;
+    if (READ_BIT(ospi->dcr[1], OCTOSPI_DCR2_WRAPSIZE)) {
+        ospi_wrap_set();
+    }
+    OCTOSPI1->CCR = ospi->ccr;
+    OCTOSPI1->TCR = ospi->tcr;
+    OCTOSPI1->ABR = ospi->abr;
+    OCTOSPI1->IR = ospi->ir;
+    OCTOSPI1->WPCCR = ospi->wpccr;
+    OCTOSPI1->WPTCR = ospi->wptcr;
+    OCTOSPI1->WPABR = ospi->wpabr;
+    OCTOSPI1->WPIR = ospi->wpir;
+    OCTOSPI1->CR = ospi->cr;
+}
+
+/**
+ * fill in the state left to the application and validate the record
+ */
+static void info_publish(void) {
+    boot_handoff_info *info = &boot_handoff_record;
+
+    info->version = BOOT_HANDOFF_INFO_VERSION;
+    info->size = sizeof(boot_handoff_info);
+    info->reset_flags = boot_profile_record.reset_flags;
+    boot_handoff_ospi_save(&info->ospi);
+    info->ospi_mapped = (info->ospi.cr & OCTOSPI_CR_FMODE) == OCTOSPI_CR_FMODE;
+    info_clock(&info->clock);
+    info_mem(&info->mem);
+#ifdef SFUD_USING_STATS
+    for (size_t i = 0; i < SFUD_FLASH_DEVICE_NUM; i++) {
+        const sfud_stats *stats = sfud_get_stats(sfud_get_device(i));
+
+        if (stats) {
+            memcpy(&info->stats[i], stats, sizeof(sfud_stats));
+        }
+    }
+#endif
+    for (int i = 0; i < BOOT_TRACE_CH_NUM; i++) {
+        boot_trace_summarize((boot_trace_ch) i, &info->trace[i]);
+    }
+    info->crc = info_crc(info);
+    info->magic = BOOT_HANDOFF_INFO_MAGIC;
+}
+
+#ifdef BOOT_HANDOFF_CACHED
+/**
+ * get the MPU region size encoding of the smallest region which covers the size
+ *
+ * @param size bytes, more than 0
+ *
+ * @return MPU_REGION_SIZE_xxx
+ */
+static uint8_t mpu_region_size(uint32_t size) {
+    /* 2^(RegionSize + 1) bytes, 32 bytes at least */
+    uint32_t order = size > 32 ? 32 - __CLZ(size - 1) : 5;
+
+    return (uint8_t) (order - 1);
+}
+
+static void mpu_config_region(uint8_t number, uint32_t base, uint8_t size, uint8_t subregion_disable,
+                              uint8_t access, uint8_t exec, uint8_t tex, uint8_t cacheable, uint8_t bufferable) {
+    MPU_Region_InitTypeDef region = {0};
+
+    region.Enable = MPU_REGION_ENABLE;
+    region.Number = number;
+    region.BaseAddress = base;
+    region.Size = size;
+    region.SubRegionDisable = subregion_disable;
+    region.TypeExtField = tex;
+    region.AccessPermission = access;
+    region.DisableExec = exec;
+    region.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+    region.IsCacheable = cacheable;
+    region.IsBufferable = bufferable;
+    HAL_MPU_ConfigRegion(&region);
+}
+#endif /* BOOT_HANDOFF_CACHED */
+
+/**
+ * publish the handoff record, set the MPU and caches to the state promised to the application,
+ * called right before the jump
+ *
+ * @param xip_base memory-mapped address of the application flash
+ * @param xip_size flash capacity, 0: unknown, the XIP region is not programmed
+ */
+void boot_handoff_prepare(uint32_t xip_base, uint32_t xip_size) {
+    info_publish();
+
+#ifdef BOOT_HANDOFF_CACHED
+    HAL_MPU_Disable();
+
+    /* speculative reads beyond the flash would stall the OCTOSPI */
+    mpu_config_region(MPU_REGION_NUMBER0, xip_base, mpu_region_size(BOOT_HANDOFF_XIP_WINDOW_SIZE), 0x00,
+                      MPU_REGION_NO_ACCESS, MPU_INSTRUCTION_ACCESS_DISABLE,
+                      MPU_TEX_LEVEL0, MPU_ACCESS_NOT_CACHEABLE, MPU_ACCESS_NOT_BUFFERABLE);
+    if (xip_size) {
+        mpu_config_region(MPU_REGION_NUMBER1, xip_base, mpu_region_size(xip_size), 0x00,
+                          MPU_REGION_PRIV_RO_URO, MPU_INSTRUCTION_ACCESS_ENABLE,
+                          MPU_TEX_LEVEL0, MPU_ACCESS_CACHEABLE, MPU_ACCESS_BUFFERABLE);
+    }
+    mpu_config_region(MPU_REGION_NUMBER2, 0x00000000, MPU_REGION_SIZE_64KB, 0x00,
+                      MPU_REGION_FULL_ACCESS, MPU_INSTRUCTION_ACCESS_ENABLE,
+                      MPU_TEX_LEVEL1, MPU_ACCESS_NOT_CACHEABLE, MPU_ACCESS_NOT_BUFFERABLE);
+    mpu_config_region(MPU_REGION_NUMBER3, 0x20000000, MPU_REGION_SIZE_128KB, 0x00,
+                      MPU_REGION_FULL_ACCESS, MPU_INSTRUCTION_ACCESS_DISABLE,
+                      MPU_TEX_LEVEL1, MPU_ACCESS_NOT_CACHEABLE, MPU_ACCESS_NOT_BUFFERABLE);
+    /* 320KB: 5 of the 8 subregions of 512KB */
+    mpu_config_region(MPU_REGION_NUMBER4, 0x24000000, MPU_REGION_SIZE_512KB, 0xE0,
+                      MPU_REGION_FULL_ACCESS, MPU_INSTRUCTION_ACCESS_ENABLE,
+                      MPU_TEX_LEVEL1, MPU_ACCESS_CACHEABLE, MPU_ACCESS_BUFFERABLE);
+    mpu_config_region(MPU_REGION_NUMBER5, 0x30000000, MPU_REGION_SIZE_32KB, 0x00,
+                      MPU_REGION_FULL_ACCESS, MPU_INSTRUCTION_ACCESS_ENABLE,
+                      MPU_TEX_LEVEL1, MPU_ACCESS_CACHEABLE, MPU_ACCESS_BUFFERABLE);
+    mpu_config_region(MPU_REGION_NUMBER6, 0x38000000, MPU_REGION_SIZE_16KB, 0x00,
+                      MPU_REGION_FULL_ACCESS, MPU_INSTRUCTION_ACCESS_DISABLE,
+                      MPU_TEX_LEVEL1, MPU_ACCESS_NOT_CACHEABLE, MPU_ACCESS_NOT_BUFFERABLE);
+
+    /* write back everything before RAM_D3 turns non-cacheable and the app takes over */
+    SCB_CleanInvalidateDCache();
+    HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+
+    SCB_EnableICache();
+    SCB_EnableDCache();
+    SCB_InvalidateICache();
+#else
+    (void) xip_base;
+    (void) xip_size;
+
+    HAL_MPU_Disable();
+    SCB_DisableDCache();
+    SCB_DisableICache();
+#endif /* BOOT_HANDOFF_CACHED */
+}
@@ -0,0 +1,319 @@
+/**
+ * @file boot_hash.c
+ * @brief SHA-256 of flash regions by the HASH unit, see boot_hash.h.
+ */
+#include "boot_hash.h"
+#include "main.h"
+#include <string.h>
+
+/* block of the buffered path, 64 bytes multiple as the HASH works on 512 bits blocks */
+#define HASH_BUF_SIZE                   (8 * 1024)
+/* NDTR of the DMA streams counts 16 bits of words, 64 bytes multiple */
+#define HASH_DMA_MAX_SIZE               (32 * 1024)
+#define HASH_TIMEOUT_MS                 100
+/* shorter pieces of a stream go by the CPU, the DMA setup takes longer */
+#define HASH_STREAM_DMA_MIN             64
+
+/* the DMA2 can't reach the TCMs, the buffers stay in RAM_D1 */
+static uint8_t hash_buf[2][HASH_BUF_SIZE] __attribute__((aligned(32)));
+static DMA_HandleTypeDef hdma_hash_in;
+/* bytes of a stream short of a whole word, in memory order */
+static uint32_t hash_carry;
+static uint8_t hash_carry_len;
+
+static bool hash_dma_init(void) {
+    if (hdma_hash_in.Instance) {
+        return true;
+    }
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    hdma_hash_in.Instance = DMA2_Stream7;
+    hdma_hash_in.Init.Request = DMA_REQUEST_HASH_IN;
+    hdma_hash_in.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_hash_in.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_hash_in.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_hash_in.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_hash_in.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma_hash_in.Init.Mode = DMA_NORMAL;
+    hdma_hash_in.Init.Priority = DMA_PRIORITY_HIGH;
+    /* bursts from the memory side, the HASH takes single words */
+    hdma_hash_in.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+    hdma_hash_in.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    hdma_hash_in.Init.MemBurst = DMA_MBURST_INC4;
+    hdma_hash_in.Init.PeriphBurst = DMA_PBURST_SINGLE;
+    if (HAL_DMA_Init(&hdma_hash_in) != HAL_OK) {
+        hdma_hash_in.Instance = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static void hash_start(void) {
+    __HAL_RCC_HASH_CLK_ENABLE();
+    /* SHA-256, 8 bits data so the byte stream is swapped into big-endian words */
+    HASH->CR = HASH_CR_ALGO_1 | HASH_CR_ALGO_0 | HASH_CR_DATATYPE_1;
+    HASH->CR |= HASH_CR_INIT;
+}
+
+/**
+ * start feeding a block to the HASH, the last block starts the digest calculation when it's done
+ *
+ * @param buf block, 4 bytes aligned, it's read in whole words
+ * @param len block size, 4 bytes multiple except for the last block
+ * @param last the last block of the region
+ */
+static sfud_err hash_feed_start(const void *buf, size_t len, bool last) {
+    if (last) {
+        /* valid bits of the last word */
+        HASH->STR = (len % 4) * 8;
+        HASH->CR = (HASH->CR & ~HASH_CR_MDMAT) | HASH_CR_DMAE;
+    } else {
+        HASH->CR |= HASH_CR_MDMAT | HASH_CR_DMAE;
+    }
+    if (HAL_DMA_Start(&hdma_hash_in, (uint32_t) (uintptr_t) buf, (uint32_t) (uintptr_t) &HASH->DIN,
+                      (len + 3) / 4) != HAL_OK) {
+        return SFUD_ERR_READ;
+    }
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * wait the DMA of a block, the HASH may still be working on its last words
+ */
+static sfud_err hash_feed_wait(void) {
+    if (HAL_DMA_PollForTransfer(&hdma_hash_in, HAL_DMA_FULL_TRANSFER, HASH_TIMEOUT_MS) != HAL_OK) {
+        HAL_DMA_Abort(&hdma_hash_in);
+        return SFUD_ERR_TIMEOUT;
+    }
+
+    return SFUD_SUCCESS;
+}
+
+static sfud_err hash_finish(uint8_t *digest) {
+    uint32_t start = HAL_GetTick(), word;
+
+    while (!(HASH->SR & HASH_SR_DCIS)) {
+        if (HAL_GetTick() - start > HASH_TIMEOUT_MS) {
+            return SFUD_ERR_TIMEOUT;
+        }
+    }
+    for (uint8_t i = 0; i < BOOT_HASH_SIZE / 4; i++) {
+        word = __REV(HASH_DIGEST->HR[i]);
+        memcpy(digest + i * 4, &word, 4);
+    }
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * hash straight from the XIP window, the region must be 4 bytes aligned
+ */
+static sfud_err hash_mapped(uint32_t mapped_addr, size_t len) {
+    sfud_err result = SFUD_SUCCESS;
+    size_t size;
+
+    while (result == SFUD_SUCCESS && len) {
+        size = len > HASH_DMA_MAX_SIZE ? HASH_DMA_MAX_SIZE : len;
+        result = hash_feed_start((const void *) (uintptr_t) mapped_addr, size, size == len);
+        if (result == SFUD_SUCCESS) {
+            result = hash_feed_wait();
+        }
+        mapped_addr += size;
+        len -= size;
+    }
+
+    return result;
+}
+
+/**
+ * read the region block by block, the next block is read while the HASH takes the previous one
+ */
+static sfud_err hash_buffered(const sfud_flash *flash, uint32_t addr, size_t len) {
+    sfud_err result;
+    size_t size = len > HASH_BUF_SIZE ? HASH_BUF_SIZE : len, next_size = 0;
+    uint8_t cur = 0;
+
+    result = sfud_read(flash, addr, size, hash_buf[cur]);
+    while (result == SFUD_SUCCESS && len) {
+        /* the CPU may have written the block through the cache */
+        SCB_CleanDCache_by_Addr((uint32_t *) hash_buf[cur], (int32_t) size);
+        result = hash_feed_start(hash_buf[cur], size, size == len);
+        if (result != SFUD_SUCCESS) {
+            break;
+        }
+        addr += size;
+        len -= size;
+        if (len) {
+            next_size = len > HASH_BUF_SIZE ? HASH_BUF_SIZE : len;
+            result = sfud_read(flash, addr, next_size, hash_buf[cur ^ 1]);
+        }
+        if (hash_feed_wait() != SFUD_SUCCESS) {
+            result = SFUD_ERR_TIMEOUT;
+        }
+        size = next_size;
+        cur ^= 1;
+    }
+
+    return result;
+}
+
+/**
+ * SHA-256 of a flash region
+ *
+ * @param flash flash device, the MAIN flash also in memory-mapped mode
+ * @param addr region address
+ * @param len region size
+ * @param digest BOOT_HASH_SIZE bytes SHA-256
+ *
+ * @return result
+ */
+sfud_err hash_region(const sfud_flash *flash, uint32_t addr, size_t len, uint8_t *digest) {
+    sfud_err result;
+
+    if (addr + len > flash->chip.capacity) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    if (!hash_dma_init()) {
+        return SFUD_ERR_READ;
+    }
+
+    hash_start();
+    if (len == 0) {
+        HASH->STR = HASH_STR_DCAL;
+        return hash_finish(digest);
+    }
+    if (flash->index == SFUD_MAIN_FLASH && addr % 4 == 0
+            && (OCTOSPI1->CR & OCTOSPI_CR_FMODE_Msk) == OCTOSPI_CR_FMODE) {
+        result = hash_mapped(OCTOSPI1_BASE + addr, len);
+    } else {
+        result = hash_buffered(flash, addr, len);
+    }
+    if (result == SFUD_SUCCESS) {
+        result = hash_finish(digest);
+    }
+
+    return result;
+}
+
+/**
+ * SHA-256 of a memory block the DMA2 reaches, RAM_D1 or the XIP window, not the TCMs
+ *
+ * @param buf block, 4 bytes aligned
+ * @param len block size
+ * @param digest BOOT_HASH_SIZE bytes SHA-256
+ *
+ * @return result
+ */
+sfud_err hash_memory(const void *buf, size_t len, uint8_t *digest) {
+    uintptr_t start = (uintptr_t) buf & ~(uintptr_t) 31;
+    sfud_err result;
+
+    if ((uintptr_t) buf % 4) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    if (!hash_dma_init()) {
+        return SFUD_ERR_READ;
+    }
+
+    hash_start();
+    if (len == 0) {
+        HASH->STR = HASH_STR_DCAL;
+        return hash_finish(digest);
+    }
+    /* the CPU may have written the block through the cache */
+    SCB_CleanDCache_by_Addr((uint32_t *) start, (int32_t) ((uintptr_t) buf + len - start));
+    result = hash_mapped((uint32_t) (uintptr_t) buf, len);
+    if (result == SFUD_SUCCESS) {
+        result = hash_finish(digest);
+    }
+
+    return result;
+}
+
+/**
+ * start a SHA-256 of data coming piece by piece, see hash_stream_feed()
+ *
+ * @return false: the DMA didn't set up
+ */
+bool hash_stream_start(void) {
+    if (!hash_dma_init()) {
+        return false;
+    }
+    hash_start();
+    hash_carry_len = 0;
+    return true;
+}
+
+/**
+ * hash the next piece of a stream, the DMA2 reads it straight where it is, the HASH keeps the state
+ *
+ * @note a piece in the TCMs, off 4 bytes or short goes by the CPU instead
+ *
+ * @param buf piece, any alignment
+ * @param len piece size, any
+ *
+ * @return result, the stream is over on an error
+ */
+sfud_err hash_stream_feed(const void *buf, size_t len) {
+    const uint8_t *p = (const uint8_t *) buf;
+    uintptr_t start;
+    sfud_err result;
+    size_t words;
+    uint32_t word;
+
+    /* the word the last piece left open first */
+    while (hash_carry_len && len) {
+        ((uint8_t *) &hash_carry)[hash_carry_len++] = *p++;
+        len--;
+        if (hash_carry_len == 4) {
+            HASH->DIN = hash_carry;
+            hash_carry_len = 0;
+        }
+    }
+    words = len & ~(size_t) 3;
+    if (words >= HASH_STREAM_DMA_MIN && (uintptr_t) p % 4 == 0 && (uintptr_t) p >= D1_AXISRAM_BASE) {
+        start = (uintptr_t) p & ~(uintptr_t) 31;
+        /* the CPU may have written the piece through the cache */
+        SCB_CleanDCache_by_Addr((uint32_t *) start, (int32_t) ((uintptr_t) p + words - start));
+        result = hash_feed_start(p, words, false);
+        if (result == SFUD_SUCCESS) {
+            result = hash_feed_wait();
+        }
+        HASH->CR &= ~HASH_CR_DMAE;
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+    } else {
+        for (size_t i = 0; i < words; i += 4) {
+            memcpy(&word, p + i, 4);
+            HASH->DIN = word;
+        }
+    }
+    p += words;
+    for (len -= words; len; len--) {
+        ((uint8_t *) &hash_carry)[hash_carry_len++] = *p++;
+    }
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * end a stream, the bytes short of a word go as the last one
+ *
+ * @param digest BOOT_HASH_SIZE bytes SHA-256 of all the pieces
+ *
+ * @return result
+ */
+sfud_err hash_stream_finish(uint8_t *digest) {
+    /* valid bits of the last word, 0: all of it */
+    uint32_t bits = hash_carry_len * 8U;
+
+    if (hash_carry_len) {
+        HASH->DIN = hash_carry;
+        hash_carry_len = 0;
+    }
+    HASH->STR = bits | HASH_STR_DCAL;
+    return hash_finish(digest);
+}
@@ -0,0 +1,135 @@
+/**
+ * @file boot_heatshrink.c
+ * @brief Streaming decoder of the heatshrink (LZSS) compressed format, see boot_heatshrink.h.
+ */
+#include "boot_heatshrink.h"
+#include <string.h>
+
+enum {
+    DEC_TAG = 0,
+    DEC_LITERAL,
+    DEC_INDEX,
+    DEC_COUNT,
+    DEC_COPY,
+};
+
+/**
+ * read a field of the stream, it can span several input pieces
+ *
+ * @return false: the input ran out, the bits read so far are kept
+ */
+static bool get_bits(boot_heatshrink_decoder *dec, uint8_t bits, const uint8_t **in, size_t *in_len, uint16_t *value) {
+    while (dec->acc_bits < bits) {
+        if (dec->in_mask == 0) {
+            if (*in_len == 0) {
+                return false;
+            }
+            dec->in_byte = *(*in)++;
+            (*in_len)--;
+            dec->in_mask = 0x80;
+        }
+        dec->acc = (uint16_t) ((dec->acc << 1) | ((dec->in_byte & dec->in_mask) ? 1 : 0));
+        dec->in_mask >>= 1;
+        dec->acc_bits++;
+    }
+    *value = dec->acc;
+    dec->acc = 0;
+    dec->acc_bits = 0;
+
+    return true;
+}
+
+static inline void window_put(boot_heatshrink_decoder *dec, uint8_t byte) {
+    dec->window[dec->head] = byte;
+    dec->head = (uint16_t) ((dec->head + 1) & ((1U << dec->window_sz2) - 1));
+}
+
+/**
+ * start a new stream
+ *
+ * @param dec decoder
+ * @param window_sz2 window size, log2, 4 ~ BOOT_HEATSHRINK_WINDOW_SZ2_MAX
+ * @param lookahead_sz2 lookahead size, log2, 3 ~ window_sz2 - 1
+ *
+ * @return false: the parameters are not supported
+ */
+bool boot_heatshrink_init(boot_heatshrink_decoder *dec, uint8_t window_sz2, uint8_t lookahead_sz2) {
+    if (window_sz2 < 4 || window_sz2 > BOOT_HEATSHRINK_WINDOW_SZ2_MAX || lookahead_sz2 < 3
+            || lookahead_sz2 >= window_sz2) {
+        return false;
+    }
+    memset(dec, 0, offsetof(boot_heatshrink_decoder, window));
+    /* references before the start of the stream read zeros, same as the encoder */
+    memset(dec->window, 0, 1U << window_sz2);
+    dec->window_sz2 = window_sz2;
+    dec->lookahead_sz2 = lookahead_sz2;
+    dec->state = DEC_TAG;
+
+    return true;
+}
+
+/**
+ * decode till the input runs out or the output is full
+ *
+ * @param dec decoder
+ * @param in input, moved past the consumed bytes
+ * @param in_len input size, decreased by the consumed bytes
+ * @param out output
+ * @param out_len output room
+ *
+ * @return bytes written to the output
+ */
+size_t boot_heatshrink_decode(boot_heatshrink_decoder *dec, const uint8_t **in, size_t *in_len,
+                              uint8_t *out, size_t out_len) {
+    uint16_t mask = (uint16_t) ((1U << dec->window_sz2) - 1), value;
+    size_t produced = 0;
+    uint8_t byte;
+
+    while (produced < out_len) {
+        switch (dec->state) {
+        case DEC_TAG:
+            if (!get_bits(dec, 1, in, in_len, &value)) {
+                return produced;
+            }
+            dec->state = value ? DEC_LITERAL : DEC_INDEX;
+            break;
+        case DEC_LITERAL:
+            if (!get_bits(dec, 8, in, in_len, &value)) {
+                return produced;
+            }
+            out[produced++] = (uint8_t) value;
+            window_put(dec, (uint8_t) value);
+            dec->state = DEC_TAG;
+            break;
+        case DEC_INDEX:
+            if (!get_bits(dec, dec->window_sz2, in, in_len, &value)) {
+                return produced;
+            }
+            dec->index = (uint16_t) (value + 1);
+            dec->state = DEC_COUNT;
+            break;
+        case DEC_COUNT:
+            if (!get_bits(dec, dec->lookahead_sz2, in, in_len, &value)) {
+                return produced;
+            }
+            dec->count = (uint16_t) (value + 1);
+            dec->state = DEC_COPY;
+            break;
+        case DEC_COPY:
+            while (dec->count && produced < out_len) {
+                byte = dec->window[(dec->head - dec->index) & mask];
+                out[produced++] = byte;
+                window_put(dec, byte);
+                dec->count--;
+            }
+            if (dec->count == 0) {
+                dec->state = DEC_TAG;
+            }
+            break;
+        default:
+            return produced;
+        }
+    }
+
+    return produced;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file boot_image.c
+ * @brief Versioned header in front of every application image, see boot_image.h.
+ */
+#include "boot_image.h"
+#include "boot_cmp.h"
+
+/**
+ * CRC-32 of zlib in software, for the records, the headers and the frames of the links, see boot_cmp_crc32()
+ *
+ * @param crc CRC of the previous part, 0 for the first one
+ * @param buf data
+ * @param size data size
+ *
+ * @return CRC till this part
+ */
+uint32_t boot_image_crc32(uint32_t crc, const void *buf, size_t size) {
+    return boot_cmp_crc32(crc, buf, size);
+}
+
+/**
+ * fill the header CRC after the other fields are set
+ *
+ * @param header image header
+ */
+void boot_image_header_seal(boot_image_header *header) {
+    header->header_crc = boot_image_crc32(0, header, offsetof(boot_image_header, header_crc));
+}
+
+/**
+ * the vector table copy holds the initial SP and reset vector, is within the image and aligned as VTOR requires
+ *
+ * @param offset offset of the vector table in the image
+ * @param run_size bytes of the image as it runs
+ */
+static bool vector_check(const boot_image_header *header, uint32_t offset, uint32_t run_size) {
+    uint32_t align = 128;
+
+    if (header->vector_size < 8 || header->vector_size % 4 || header->vector_size > BOOT_IMAGE_VECTOR_MAX
+            || header->vector_size > run_size - offset) {
+        return false;
+    }
+    while (align < header->vector_size) {
+        align <<= 1;
+    }
+    return header->vector_addr % align == 0;
+}
+
+/**
+ * a PIC image runs in place through its GOT and vector table copies, its words are moved by a delta
+ */
+static bool pic_check(const boot_image_header *header) {
+    return header->header_version >= 2 && (header->flags & BOOT_IMAGE_FLAG_SECTIONS)
+            && (header->flags & BOOT_IMAGE_FLAG_VECTOR)
+            && !(header->flags & (BOOT_IMAGE_FLAG_RAM | BOOT_IMAGE_FLAG_LZ4 | BOOT_IMAGE_FLAG_ENCRYPTED))
+            && header->load_addr % 4 == 0 && header->load_addr <= UINT32_MAX - header->image_size;
+}
+
+/**
+ * check the header of an XIP image, the image itself is not read
+ *
+ * @param header image header, read from the slot start
+ * @param slot_mapped_addr memory-mapped address of the slot
+ * @param slot_size slot size, header area included
+ *
+ * @return true: the header is intact and the image fits the slot it's stored in
+ */
+bool boot_image_header_check(const boot_image_header *header, uint32_t slot_mapped_addr, uint32_t slot_size) {
+    uint32_t image_addr = slot_mapped_addr + BOOT_IMAGE_HEADER_SIZE, run_addr, run_size, table;
+
+    if (header->magic != BOOT_IMAGE_MAGIC || header->header_version < BOOT_IMAGE_HEADER_VERSION_MIN
+            || header->header_version > BOOT_IMAGE_HEADER_VERSION || header->header_size != BOOT_IMAGE_HEADER_SIZE) {
+        return false;
+    }
+    if (header->header_crc != boot_image_crc32(0, header, offsetof(boot_image_header, header_crc))) {
+        return false;
+    }
+    /* the table itself is checked by boot_scatter_prepare() */
+    if ((header->flags & BOOT_IMAGE_FLAG_SECTIONS) && (header->header_version < 2 || header->section_num == 0
+            || header->section_num > BOOT_IMAGE_SECTION_MAX)) {
+        return false;
+    }
+    /* and the RAM range of a RAM image */
+    if ((header->flags & BOOT_IMAGE_FLAG_RAM) && header->header_version < 2) {
+        return false;
+    }
+    /* an image linked for the other slot would run its code from there, a PIC one runs where it's stored */
+    if (((header->flags & BOOT_IMAGE_FLAG_PIC) ? !pic_check(header) : header->load_addr != image_addr)
+            || header->image_size == 0
+            || header->image_size > slot_size - BOOT_IMAGE_HEADER_SIZE) {
+        return false;
+    }
+    /* a compressed RAM image, its decoded size is only known to boot_scatter_prepare(), RAM_D1 at most till then */
+    run_size = header->image_size;
+    if (header->flags & BOOT_IMAGE_FLAG_LZ4) {
+        if (!(header->flags & BOOT_IMAGE_FLAG_RAM) || (header->flags & BOOT_IMAGE_FLAG_SECTIONS)
+                || header->image_size <= BOOT_IMAGE_LZ4_PREFIX_SIZE) {
+            return false;
+        }
+        run_size = BOOT_IMAGE_LZ4_SIZE_MAX;
+    }
+    /* initial SP and reset vector must be inside the image */
+    run_addr = (header->flags & BOOT_IMAGE_FLAG_RAM) ? header->ram_addr : header->load_addr;
+    if (header->exec_addr < run_addr || header->exec_addr % 0x400
+            || header->exec_addr - run_addr > run_size - 8) {
+        return false;
+    }
+    /* the RAM range of the vector table copy is checked by boot_scatter_prepare() */
+    if ((header->flags & BOOT_IMAGE_FLAG_VECTOR) && (header->header_version < 2
+            || !vector_check(header, header->exec_addr - run_addr, run_size))) {
+        return false;
+    }
+    /* the sector table after the image, in the slot as well */
+    if (header->flags & BOOT_IMAGE_FLAG_SECTOR_HASH) {
+        table = boot_image_sector_table(header);
+        if (header->header_version < 2 || table > slot_size
+                || boot_image_sector_count(header) * BOOT_IMAGE_SECTOR_HASH_SIZE > slot_size - table) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * from where a PIC image is linked to where it's stored
+ *
+ * @param header image header, checked by boot_image_header_check()
+ * @param slot_mapped_addr memory-mapped address of its slot
+ *
+ * @return bytes to add to a link-time address into the image, 0 unless BOOT_IMAGE_FLAG_PIC
+ */
+uint32_t boot_image_delta(const boot_image_header *header, uint32_t slot_mapped_addr) {
+    if (!(header->flags & BOOT_IMAGE_FLAG_PIC)) {
+        return 0;
+    }
+    return slot_mapped_addr + BOOT_IMAGE_HEADER_SIZE - header->load_addr;
+}
+
+/**
+ * the vector table as stored in the slot, the one of a RAM image is only at exec_addr after the copy, the one of a
+ * compressed image only after boot_scatter_prepare() decoded it
+ *
+ * @param header image header, checked by boot_image_header_check()
+ * @param slot_mapped_addr memory-mapped address of its slot
+ *
+ * @return memory-mapped address of the vector table, exec_addr for BOOT_IMAGE_FLAG_LZ4
+ */
+uint32_t boot_image_vector(const boot_image_header *header, uint32_t slot_mapped_addr) {
+    if (header->flags & BOOT_IMAGE_FLAG_LZ4) {
+        return header->exec_addr;
+    }
+    if (header->flags & BOOT_IMAGE_FLAG_RAM) {
+        return header->load_addr + (header->exec_addr - header->ram_addr);
+    }
+    return header->exec_addr + boot_image_delta(header, slot_mapped_addr);
+}
+
+/**
+ * VTOR the application is entered with
+ *
+ * @param header image header, checked by boot_image_header_check()
+ *
+ * @return the vector table copy of BOOT_IMAGE_FLAG_VECTOR, or exec_addr
+ */
+uint32_t boot_image_vtor(const boot_image_header *header) {
+    return (header->flags & BOOT_IMAGE_FLAG_VECTOR) ? header->vector_addr : header->exec_addr;
+}
+
+/**
+ * @param header image header
+ *
+ * @return BOOT_IMAGE_SECTOR_SIZE sectors of the image, the last one short
+ */
+uint32_t boot_image_sector_count(const boot_image_header *header) {
+    return (header->image_size + BOOT_IMAGE_SECTOR_SIZE - 1) / BOOT_IMAGE_SECTOR_SIZE;
+}
+
+/**
+ * @param header image header, checked by boot_image_header_check()
+ *
+ * @return offset of the sector table from the slot start, the image end rounded up to 4 bytes
+ */
+uint32_t boot_image_sector_table(const boot_image_header *header) {
+    return BOOT_IMAGE_HEADER_SIZE + ((header->image_size + 3) & ~3UL);
+}
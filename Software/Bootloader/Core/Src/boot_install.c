@@ -0,0 +1,752 @@
+/**
+ * @file boot_install.c
+ * @brief Install engine, see boot_install.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_INSTALL
+
+#include "boot_install.h"
+#include "boot_cmp.h"
+#include "boot_cryp.h"
+#include "boot_heatshrink.h"
+#include "boot_image.h"
+#include "boot_verify.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "install");
+
+/* erase block used when the range fully covers it */
+#define INSTALL_ERASE_BLOCK_SIZE        (64 * 1024)
+
+/* program unit of the decoded data, the page of the SFUD page program */
+#define INSTALL_PAGE_SIZE               256
+/* largest erase granularity the skip_unchanged mode supports */
+#define INSTALL_SECTOR_MAX              (4 * 1024)
+/* staging buffer of the background program */
+#define INSTALL_STAGE_SIZE              BOOT_INSTALL_BLOCK_SIZE
+
+/* temp buffers of the AXI arena while an install runs, the DMA1 and MDMA both reach RAM_D1 */
+static uint8_t *install_buf[2];
+static boot_heatshrink_decoder install_decoder;
+/* sector being compared, skip_unchanged mode */
+static uint8_t *install_sector;
+static uint8_t *install_cmp;
+/* data programmed in the background, one buffer is filled while the other one is programmed */
+static uint8_t *install_stage[2];
+static bool install_skip_unchanged;
+/* nonce of the encrypted source of boot_install(), see boot_install_decrypt() */
+static uint32_t install_nonce[BOOT_CRYP_NONCE_NUM];
+static bool install_encrypted;
+
+/**
+ * erase the destination ahead of the data to program, up to the next 64KB boundary, sfud_erase_plan() picks
+ * the erase types, the erase runs in the background
+ *
+ * @param erased_end end of the erased range, moved forward
+ *
+ * @return result of the start, *erased_end stays when nothing is to erase
+ */
+static sfud_err install_erase_to(const sfud_flash *dst, sfud_async *op, uint32_t *erased_end, uint32_t end,
+                                 uint32_t range_end) {
+    sfud_err result;
+    uint32_t to;
+
+    if (*erased_end >= end) {
+        return SFUD_SUCCESS;
+    }
+    to = (end + INSTALL_ERASE_BLOCK_SIZE - 1) / INSTALL_ERASE_BLOCK_SIZE * INSTALL_ERASE_BLOCK_SIZE;
+    if (to > range_end) {
+        to = range_end;
+    }
+    boot_verify_dirty(dst, *erased_end, to - *erased_end);
+    result = sfud_erase_async(dst, op, *erased_end, to - *erased_end);
+    /* the last erase unit may reach past the range end */
+    *erased_end = to;
+
+    return result;
+}
+
+/* the destination side of an install, the data to program goes through it in order */
+typedef struct {
+    const sfud_flash *dst;
+    uint32_t addr;                               /**< next address to program */
+    uint32_t erased_end;                         /**< end of the range erased ahead */
+    uint32_t range_end;                          /**< end of the install range */
+    bool skip;                                   /**< compare the sectors, install_skip_unchanged */
+    bool async;                                  /**< the data is staged and programmed in the background */
+    size_t fill;                                 /**< bytes in install_sector, or in the staging buffer */
+    size_t sectors;                              /**< sectors compared */
+    size_t skipped;                              /**< sectors which already matched */
+    uint8_t stage;                               /**< staging buffer being filled */
+    sfud_async op;                               /**< erase or program of the other staging buffer */
+    uint32_t pending_addr;                       /**< program to start when the erase of op ends */
+    size_t pending_size;                         /**< 0: none */
+} install_writer;
+
+/**
+ * @param src flash read meanwhile, the background program needs it on another bus
+ */
+static void writer_init(install_writer *w, const sfud_flash *src, const sfud_flash *dst, uint32_t addr,
+                        size_t size) {
+    memset(w, 0, sizeof(install_writer));
+    w->dst = dst;
+    w->addr = addr;
+    w->erased_end = addr;
+    w->range_end = addr + size;
+    w->skip = install_skip_unchanged && dst->chip.erase_gran <= INSTALL_SECTOR_MAX;
+    w->async = !w->skip && src != dst;
+    /* nothing runs yet */
+    w->op.result = SFUD_SUCCESS;
+}
+
+/**
+ * move the background operation on, the program waiting for the erase ahead is started when it ends
+ *
+ * @param wait true: till everything handed over is programmed
+ *
+ * @return SFUD_ERR_BUSY: still running (wait false), otherwise the result
+ */
+static sfud_err writer_run(install_writer *w, bool wait) {
+    sfud_err result;
+
+    for (;;) {
+        result = wait ? sfud_async_wait(&w->op) : sfud_async_poll(&w->op);
+        if (result != SFUD_SUCCESS || w->pending_size == 0) {
+            return result;
+        }
+        result = sfud_write_async(w->dst, &w->op, w->pending_addr, w->pending_size, install_stage[w->stage ^ 1]);
+        w->pending_size = 0;
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+    }
+}
+
+/**
+ * hand the staging buffer over to the background, the other one is filled meanwhile
+ */
+static sfud_err writer_submit(install_writer *w) {
+    sfud_err result;
+    uint32_t erased_end = w->erased_end;
+
+    /* the other staging buffer is free once its program ends */
+    result = writer_run(w, true);
+    if (result == SFUD_SUCCESS) {
+        result = install_erase_to(w->dst, &w->op, &w->erased_end, w->addr + w->fill, w->range_end);
+    }
+    if (result == SFUD_SUCCESS && w->erased_end == erased_end) {
+        result = sfud_write_async(w->dst, &w->op, w->addr, w->fill, install_stage[w->stage]);
+    } else if (result == SFUD_SUCCESS) {
+        w->pending_addr = w->addr;
+        w->pending_size = w->fill;
+    }
+    w->addr += w->fill;
+    w->fill = 0;
+    w->stage ^= 1;
+
+    return result;
+}
+
+/**
+ * program the collected sector unless the flash already holds it
+ */
+static sfud_err writer_flush_sector(install_writer *w) {
+    sfud_err result = SFUD_SUCCESS;
+    bool same = true;
+    size_t len;
+
+    for (size_t offset = 0; result == SFUD_SUCCESS && same && offset < w->fill; offset += len) {
+        len = w->fill - offset > INSTALL_PAGE_SIZE ? INSTALL_PAGE_SIZE : w->fill - offset;
+        result = sfud_read(w->dst, w->addr + offset, len, install_cmp);
+        same = boot_cmp_equal(install_cmp, install_sector + offset, len);
+    }
+    if (result == SFUD_SUCCESS && same) {
+        w->skipped++;
+    } else if (result == SFUD_SUCCESS) {
+        boot_verify_dirty(w->dst, w->addr, w->dst->chip.erase_gran);
+        result = sfud_erase(w->dst, w->addr, w->dst->chip.erase_gran);
+        if (result == SFUD_SUCCESS) {
+            result = sfud_write(w->dst, w->addr, w->fill, install_sector);
+        }
+    }
+    w->sectors++;
+    w->addr += w->fill;
+    w->fill = 0;
+
+    return result;
+}
+
+static sfud_err writer_put(install_writer *w, const uint8_t *data, size_t size) {
+    sfud_err result = SFUD_SUCCESS;
+    size_t len;
+
+    if (w->async) {
+        while (result == SFUD_SUCCESS && size) {
+            len = INSTALL_STAGE_SIZE - w->fill;
+            if (len > size) {
+                len = size;
+            }
+            memcpy(install_stage[w->stage] + w->fill, data, len);
+            w->fill += len;
+            data += len;
+            size -= len;
+            if (w->fill == INSTALL_STAGE_SIZE) {
+                result = writer_submit(w);
+            }
+        }
+        if (result == SFUD_SUCCESS) {
+            /* the next page goes out as soon as the flash is idle */
+            result = writer_run(w, false);
+        }
+        return result == SFUD_ERR_BUSY ? SFUD_SUCCESS : result;
+    }
+    if (!w->skip) {
+        result = install_erase_to(w->dst, &w->op, &w->erased_end, w->addr + size, w->range_end);
+        if (result == SFUD_SUCCESS) {
+            result = sfud_async_wait(&w->op);
+        }
+        if (result == SFUD_SUCCESS) {
+            result = sfud_write(w->dst, w->addr, size, data);
+        }
+        w->addr += size;
+        return result;
+    }
+
+    while (result == SFUD_SUCCESS && size) {
+        len = w->dst->chip.erase_gran - w->fill;
+        if (len > size) {
+            len = size;
+        }
+        memcpy(install_sector + w->fill, data, len);
+        w->fill += len;
+        data += len;
+        size -= len;
+        if (w->fill == w->dst->chip.erase_gran) {
+            result = writer_flush_sector(w);
+        }
+    }
+
+    return result;
+}
+
+static sfud_err writer_finish(install_writer *w) {
+    sfud_err result = SFUD_SUCCESS;
+
+    if (w->async && w->fill) {
+        result = writer_submit(w);
+    }
+    if (w->async) {
+        sfud_err run_result = writer_run(w, true);
+
+        if (result == SFUD_SUCCESS) {
+            result = run_result;
+        }
+    }
+    if (w->skip && w->fill) {
+        result = writer_flush_sector(w);
+    }
+    if (w->skip) {
+        elog_i(TAG, "%u of %u sectors unchanged", w->skipped, w->sectors);
+    }
+
+    return result;
+}
+
+/**
+ * end the background operation of a failed install, the flash is left with whatever it has got
+ */
+static void writer_abort(install_writer *w) {
+    w->pending_size = 0;
+    (void) sfud_async_wait(&w->op);
+}
+
+/**
+ * compare every destination sector with the new data and leave the matching ones as they are
+ *
+ * @note the differing sectors are erased one by one then, in place of the 64KB block erases
+ *
+ * @param enable true: skip unchanged sectors in the next installs
+ */
+void boot_install_skip_unchanged(bool enable) {
+    install_skip_unchanged = enable;
+}
+
+/**
+ * decrypt the source of the next boot_install() calls, AES-CTR from block 0 of the nonce, see boot_cryp.h
+ *
+ * @param nonce nonce of the source, NULL: plain source
+ */
+void boot_install_decrypt(const uint32_t *nonce) {
+    install_encrypted = nonce != NULL;
+    if (nonce) {
+        memcpy(install_nonce, nonce, sizeof(install_nonce));
+    }
+}
+
+/**
+ * copy a range from one flash to another, the destination is erased on the way
+ *
+ * @param src source flash, e.g. the EXT flash with the staged image
+ * @param src_addr source address
+ * @param dst destination flash, in indirect mode
+ * @param dst_addr destination address, aligned to the erase granularity of the destination
+ * @param size bytes to copy
+ *
+ * @return result
+ */
+static sfud_err install_copy(const sfud_flash *src, uint32_t src_addr, const sfud_flash *dst, uint32_t dst_addr,
+                             size_t size) {
+    sfud_err result, read_result;
+    install_writer writer;
+    uint32_t start = HAL_GetTick(), ms;
+    size_t offset = 0, len, next_len;
+    uint8_t cur = 0;
+
+    if (dst_addr % dst->chip.erase_gran || dst_addr + size > dst->chip.capacity || src_addr + size > src->chip.capacity) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    if (size == 0) {
+        return SFUD_SUCCESS;
+    }
+
+    if (install_encrypted && !boot_cryp_ctr_start(install_nonce)) {
+        elog_e(TAG, "no key for the encrypted source");
+        return SFUD_ERR_READ;
+    }
+    writer_init(&writer, src, dst, dst_addr, size);
+    len = size > BOOT_INSTALL_BLOCK_SIZE ? BOOT_INSTALL_BLOCK_SIZE : size;
+    result = sfud_read_async(src, src_addr, len, install_buf[cur]);
+    if (result == SFUD_SUCCESS) {
+        result = sfud_read_async_wait(src);
+    }
+
+    while (result == SFUD_SUCCESS && offset < size) {
+        next_len = size - offset - len > BOOT_INSTALL_BLOCK_SIZE ? BOOT_INSTALL_BLOCK_SIZE : size - offset - len;
+        if (next_len) {
+            result = sfud_read_async(src, src_addr + offset + len, next_len, install_buf[cur ^ 1]);
+            if (result != SFUD_SUCCESS) {
+                break;
+            }
+        }
+        /* decrypt, erase and program the block while the next one is read, the blocks keep the counter going */
+        if (install_encrypted) {
+            result = boot_cryp_ctr_run(install_buf[cur], install_buf[cur], len);
+            if (result == SFUD_SUCCESS) {
+                result = boot_cryp_ctr_wait();
+            }
+        }
+        if (result == SFUD_SUCCESS) {
+            result = writer_put(&writer, install_buf[cur], len);
+        }
+        if (next_len) {
+            read_result = sfud_read_async_wait(src);
+            if (result == SFUD_SUCCESS) {
+                result = read_result;
+            }
+        }
+        offset += len;
+        len = next_len;
+        cur ^= 1;
+    }
+    if (result == SFUD_SUCCESS) {
+        result = writer_finish(&writer);
+    }
+    if (install_encrypted) {
+        boot_cryp_ctr_stop();
+    }
+
+    if (result != SFUD_SUCCESS) {
+        writer_abort(&writer);
+        elog_e(TAG, "install failed(%d) at 0x%08x", result, writer.addr);
+        return result;
+    }
+    ms = HAL_GetTick() - start;
+    elog_i(TAG, "installed %u bytes in %u ms, %u KB/s", size, ms, ms ? size / ms * 1000 / 1024 : 0);
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * install a heatshrink compressed range, the output is decoded into one page buffer and programmed page by page
+ *
+ * @param src source flash, e.g. the EXT flash with the staged payload
+ * @param src_addr address of the compressed data
+ * @param src_size compressed bytes
+ * @param dst destination flash, in indirect mode
+ * @param dst_addr destination address, aligned to the erase granularity of the destination
+ * @param dst_size decompressed bytes, the stream must produce exactly them
+ * @param window_sz2 window size of the compression, log2
+ * @param lookahead_sz2 lookahead size of the compression, log2
+ *
+ * @return result, SFUD_ERR_READ: the stream is corrupted or truncated
+ */
+static sfud_err install_heatshrink(const sfud_flash *src, uint32_t src_addr, size_t src_size,
+                                   const sfud_flash *dst, uint32_t dst_addr, size_t dst_size,
+                                   uint8_t window_sz2, uint8_t lookahead_sz2) {
+    sfud_err result, read_result;
+    install_writer writer;
+    uint32_t start = HAL_GetTick(), ms;
+    size_t in_offset = 0, in_len, len, next_len, out_done = 0, fill = 0;
+    uint8_t page[INSTALL_PAGE_SIZE] __attribute__((aligned(4)));
+    const uint8_t *in;
+    uint8_t cur = 0;
+
+    if (dst_addr % dst->chip.erase_gran || dst_addr + dst_size > dst->chip.capacity
+            || src_addr + src_size > src->chip.capacity) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    if (!boot_heatshrink_init(&install_decoder, window_sz2, lookahead_sz2)) {
+        return SFUD_ERR_READ;
+    }
+    if (dst_size == 0) {
+        return SFUD_SUCCESS;
+    }
+
+    writer_init(&writer, src, dst, dst_addr, dst_size);
+    len = src_size > BOOT_INSTALL_BLOCK_SIZE ? BOOT_INSTALL_BLOCK_SIZE : src_size;
+    result = sfud_read(src, src_addr, len, install_buf[cur]);
+
+    while (result == SFUD_SUCCESS && out_done < dst_size) {
+        if (len == 0) {
+            /* input ran out before the output is complete */
+            result = SFUD_ERR_READ;
+            break;
+        }
+        next_len = src_size - in_offset - len > BOOT_INSTALL_BLOCK_SIZE
+                   ? BOOT_INSTALL_BLOCK_SIZE : src_size - in_offset - len;
+        if (next_len) {
+            result = sfud_read_async(src, src_addr + in_offset + len, next_len, install_buf[cur ^ 1]);
+            if (result != SFUD_SUCCESS) {
+                break;
+            }
+        }
+
+        /* decode and program this block while the next one is read */
+        in = install_buf[cur];
+        in_len = len;
+        while (result == SFUD_SUCCESS && out_done < dst_size) {
+            size_t room = INSTALL_PAGE_SIZE - fill;
+
+            if (room > dst_size - out_done - fill) {
+                room = dst_size - out_done - fill;
+            }
+            fill += boot_heatshrink_decode(&install_decoder, &in, &in_len, page + fill, room);
+            if (fill < INSTALL_PAGE_SIZE && out_done + fill < dst_size) {
+                /* block consumed, the page is completed by the next one */
+                break;
+            }
+            result = writer_put(&writer, page, fill);
+            out_done += fill;
+            fill = 0;
+        }
+
+        if (next_len) {
+            read_result = sfud_read_async_wait(src);
+            if (result == SFUD_SUCCESS) {
+                result = read_result;
+            }
+        }
+        in_offset += len;
+        len = next_len;
+        cur ^= 1;
+    }
+    if (result == SFUD_SUCCESS) {
+        result = writer_finish(&writer);
+    }
+
+    if (result != SFUD_SUCCESS) {
+        writer_abort(&writer);
+        elog_e(TAG, "install failed(%d) at 0x%08x", result, dst_addr + out_done);
+        return result;
+    }
+    ms = HAL_GetTick() - start;
+    elog_i(TAG, "installed %u bytes from %u compressed in %u ms, %u KB/s", dst_size, src_size, ms,
+           ms ? dst_size / ms * 1000 / 1024 : 0);
+
+    return SFUD_SUCCESS;
+}
+
+/* reader of a patch body, double buffered, optionally through the heatshrink decoder */
+typedef struct {
+    const sfud_flash *flash;
+    uint32_t addr;                               /**< next address to read */
+    size_t left;                                 /**< bytes not read yet */
+    size_t pos;                                  /**< position in the current buffer */
+    size_t len;                                  /**< bytes in the current buffer */
+    size_t pending;                              /**< bytes being read into the other buffer */
+    uint8_t cur;                                 /**< current buffer */
+    bool compressed;
+} patch_reader;
+
+static sfud_err reader_prefetch(patch_reader *r) {
+    sfud_err result;
+    size_t len;
+
+    if (r->left == 0) {
+        return SFUD_SUCCESS;
+    }
+    len = r->left > BOOT_INSTALL_BLOCK_SIZE ? BOOT_INSTALL_BLOCK_SIZE : r->left;
+    result = sfud_read_async(r->flash, r->addr, len, install_buf[r->cur ^ 1]);
+    if (result == SFUD_SUCCESS) {
+        r->addr += len;
+        r->left -= len;
+        r->pending = len;
+    }
+
+    return result;
+}
+
+static sfud_err reader_next_block(patch_reader *r) {
+    sfud_err result;
+
+    if (r->pending == 0) {
+        /* the patch is truncated */
+        return SFUD_ERR_READ;
+    }
+    result = sfud_read_async_wait(r->flash);
+    r->cur ^= 1;
+    r->len = r->pending;
+    r->pos = 0;
+    r->pending = 0;
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+
+    return reader_prefetch(r);
+}
+
+static sfud_err reader_read(patch_reader *r, uint8_t *out, size_t size) {
+    sfud_err result;
+    size_t len;
+
+    while (size) {
+        if (r->compressed) {
+            const uint8_t *in = install_buf[r->cur] + r->pos;
+            size_t in_len = r->len - r->pos;
+
+            /* a back-reference may still produce bytes without any input */
+            len = boot_heatshrink_decode(&install_decoder, &in, &in_len, out, size);
+            r->pos = r->len - in_len;
+        } else {
+            len = r->len - r->pos > size ? size : r->len - r->pos;
+            memcpy(out, install_buf[r->cur] + r->pos, len);
+            r->pos += len;
+        }
+        if (len == 0) {
+            result = reader_next_block(r);
+            if (result != SFUD_SUCCESS) {
+                return result;
+            }
+        }
+        out += len;
+        size -= len;
+    }
+
+    return SFUD_SUCCESS;
+}
+
+static void reader_close(patch_reader *r) {
+    /* release the bus of the read ahead */
+    if (r->pending) {
+        sfud_read_async_wait(r->flash);
+        r->pending = 0;
+    }
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * build a slot from the other slot and a patch
+ *
+ * @param patch_flash flash with the staged patch, e.g. the EXT flash
+ * @param patch_addr patch address, the boot_delta_header first
+ * @param patch_size patch size, header included
+ * @param flash flash of both slots, in indirect mode
+ * @param old_addr start of the slot the patch applies to
+ * @param new_addr start of the slot to build, aligned to the erase granularity
+ * @param new_max size of the slot to build
+ *
+ * @return result, SFUD_ERR_READ: the patch is corrupted or does not apply to the old slot
+ */
+static sfud_err install_delta(const sfud_flash *patch_flash, uint32_t patch_addr, size_t patch_size,
+                              const sfud_flash *flash, uint32_t old_addr, uint32_t new_addr, size_t new_max) {
+    boot_delta_header header;
+    boot_image_header old_header;
+    patch_reader reader;
+    install_writer writer;
+    sfud_err result;
+    uint32_t start = HAL_GetTick(), ms, diff_len = 0, extra_len = 0;
+    int32_t old_pos = 0, seek = 0;
+    size_t out_done = 0, fill, len;
+    uint8_t page[INSTALL_PAGE_SIZE] __attribute__((aligned(4))), old[INSTALL_PAGE_SIZE], ctrl[12];
+
+    if (patch_size < sizeof(header) || new_addr % flash->chip.erase_gran) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    result = sfud_read(patch_flash, patch_addr, sizeof(header), (uint8_t *) &header);
+    if (result == SFUD_SUCCESS) {
+        result = sfud_read(flash, old_addr, sizeof(old_header), (uint8_t *) &old_header);
+    }
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    if (header.magic != BOOT_DELTA_MAGIC
+            || header.header_crc != boot_image_crc32(0, &header, offsetof(boot_delta_header, header_crc))
+            || header.new_size > new_max || old_addr + header.old_size > flash->chip.capacity) {
+        elog_e(TAG, "bad patch header");
+        return SFUD_ERR_READ;
+    }
+    if (old_header.magic != BOOT_IMAGE_MAGIC || old_header.image_crc != header.old_image_crc) {
+        elog_e(TAG, "the patch is not for the image in the old slot");
+        return SFUD_ERR_READ;
+    }
+
+    memset(&reader, 0, sizeof(reader));
+    reader.flash = patch_flash;
+    reader.addr = patch_addr + sizeof(header);
+    reader.left = patch_size - sizeof(header);
+    reader.cur = 1;
+    reader.compressed = header.compression == BOOT_DELTA_COMPRESSION_HEATSHRINK;
+    if ((reader.compressed && !boot_heatshrink_init(&install_decoder, header.window_sz2, header.lookahead_sz2))
+            || header.compression > BOOT_DELTA_COMPRESSION_HEATSHRINK) {
+        return SFUD_ERR_READ;
+    }
+    writer_init(&writer, patch_flash, flash, new_addr, header.new_size);
+    result = reader_prefetch(&reader);
+
+    while (result == SFUD_SUCCESS && out_done < header.new_size) {
+        fill = 0;
+        /* build one page from the diff and extra runs */
+        while (result == SFUD_SUCCESS && fill < INSTALL_PAGE_SIZE && out_done + fill < header.new_size) {
+            if (diff_len == 0 && extra_len == 0) {
+                result = reader_read(&reader, ctrl, sizeof(ctrl));
+                if (result != SFUD_SUCCESS) {
+                    break;
+                }
+                /* the seek of a triple applies after its diff and extra runs */
+                old_pos += seek;
+                diff_len = get_le32(&ctrl[0]);
+                extra_len = get_le32(&ctrl[4]);
+                seek = (int32_t) get_le32(&ctrl[8]);
+                if (old_pos < 0 || (uint32_t) old_pos + diff_len > header.old_size) {
+                    result = SFUD_ERR_READ;
+                    break;
+                }
+                continue;
+            }
+            len = INSTALL_PAGE_SIZE - fill;
+            if (len > header.new_size - out_done - fill) {
+                len = header.new_size - out_done - fill;
+            }
+            if (diff_len) {
+                if (len > diff_len) {
+                    len = diff_len;
+                }
+                result = sfud_read(flash, old_addr + (uint32_t) old_pos, len, old);
+                if (result == SFUD_SUCCESS) {
+                    result = reader_read(&reader, page + fill, len);
+                }
+                for (size_t i = 0; result == SFUD_SUCCESS && i < len; i++) {
+                    page[fill + i] = (uint8_t) (page[fill + i] + old[i]);
+                }
+                old_pos += (int32_t) len;
+                diff_len -= len;
+            } else {
+                if (len > extra_len) {
+                    len = extra_len;
+                }
+                result = reader_read(&reader, page + fill, len);
+                extra_len -= len;
+            }
+            fill += len;
+        }
+        if (result != SFUD_SUCCESS) {
+            break;
+        }
+
+        result = writer_put(&writer, page, fill);
+        out_done += fill;
+    }
+    reader_close(&reader);
+    if (result == SFUD_SUCCESS) {
+        result = writer_finish(&writer);
+    }
+
+    if (result != SFUD_SUCCESS) {
+        writer_abort(&writer);
+        elog_e(TAG, "patch failed(%d) at 0x%08x", result, new_addr + out_done);
+        return result;
+    }
+    ms = HAL_GetTick() - start;
+    elog_i(TAG, "patched %u bytes from a %u bytes patch in %u ms", header.new_size, patch_size, ms);
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * take the buffers of an install from the AXI arena, dma_alloc_release() of the mark returns them
+ */
+static bool install_take(size_t *mark) {
+    *mark = dma_alloc_mark(DMA_REGION_AXI);
+    for (size_t i = 0; i < 2; i++) {
+        install_buf[i] = dma_alloc_temp(BOOT_INSTALL_BLOCK_SIZE, DMA_REGION_AXI);
+        install_stage[i] = dma_alloc_temp(INSTALL_STAGE_SIZE, DMA_REGION_AXI);
+    }
+    install_sector = dma_alloc_temp(INSTALL_SECTOR_MAX, DMA_REGION_AXI);
+    install_cmp = dma_alloc_temp(INSTALL_PAGE_SIZE, DMA_REGION_AXI);
+    if (install_buf[0] && install_buf[1] && install_stage[0] && install_stage[1] && install_sector && install_cmp) {
+        return true;
+    }
+    dma_alloc_release(DMA_REGION_AXI, *mark);
+    elog_e(TAG, "no room for the install buffers, %u bytes left", dma_alloc_left(DMA_REGION_AXI));
+
+    return false;
+}
+
+/* the entry points below take the buffers around the installs above */
+
+sfud_err boot_install(const sfud_flash *src, uint32_t src_addr, const sfud_flash *dst, uint32_t dst_addr, size_t size) {
+    sfud_err result;
+    size_t mark;
+
+    if (!install_take(&mark)) {
+        return SFUD_ERR_WRITE;
+    }
+    result = install_copy(src, src_addr, dst, dst_addr, size);
+    dma_alloc_release(DMA_REGION_AXI, mark);
+
+    return result;
+}
+
+sfud_err boot_install_heatshrink(const sfud_flash *src, uint32_t src_addr, size_t src_size,
+                                 const sfud_flash *dst, uint32_t dst_addr, size_t dst_size,
+                                 uint8_t window_sz2, uint8_t lookahead_sz2) {
+    sfud_err result;
+    size_t mark;
+
+    if (!install_take(&mark)) {
+        return SFUD_ERR_WRITE;
+    }
+    result = install_heatshrink(src, src_addr, src_size, dst, dst_addr, dst_size, window_sz2, lookahead_sz2);
+    dma_alloc_release(DMA_REGION_AXI, mark);
+
+    return result;
+}
+
+sfud_err boot_install_delta(const sfud_flash *patch_flash, uint32_t patch_addr, size_t patch_size,
+                            const sfud_flash *flash, uint32_t old_addr, uint32_t new_addr, size_t new_max) {
+    sfud_err result;
+    size_t mark;
+
+    if (!install_take(&mark)) {
+        return SFUD_ERR_WRITE;
+    }
+    result = install_delta(patch_flash, patch_addr, patch_size, flash, old_addr, new_addr, new_max);
+    dma_alloc_release(DMA_REGION_AXI, mark);
+
+    return result;
+}
@@ -0,0 +1,632 @@
+/**
+ * @file boot_kv.c
+ * @brief Log-structured key-value store on the EXT flash, see boot_kv.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_KV
+
+#include "boot_kv.h"
+#include "boot_image.h"
+#include "boot_lfs.h"
+#include "elog.h"
+#ifdef ELOG_PORT_FLASH_ENABLE
+#include <elog_flash.h>
+#endif
+#include <stdbool.h>
+#include <string.h>
+
+#if BOOT_KV_SECTOR_NUM < BOOT_KV_FREE_SECTORS + 2 || BOOT_KV_SECTOR_NUM > 32
+    #error "The key-value store needs 2 sectors more than the free ones, 32 at most (in boot_kv.h)"
+#endif
+#if BOOT_KV_INDEX_SIZE & (BOOT_KV_INDEX_SIZE - 1)
+    #error "BOOT_KV_INDEX_SIZE must be a power of 2"
+#endif
+
+ELOG_TAG_DEFINE(TAG, "kv");
+
+#define KV_HEADER_SIZE                  sizeof(kv_sector)
+#define KV_ENTRY_SIZE                   sizeof(boot_kv_entry)
+#define KV_RECORD_MAX                   (KV_ENTRY_SIZE + BOOT_KV_KEY_MAX + BOOT_KV_VALUE_MAX)
+#define KV_ALIGN(size)                  (((size) + 3U) & ~(size_t) 3U)
+#define KV_INDEX_MASK                   (BOOT_KV_INDEX_SIZE - 1U)
+#define KV_SECTOR_BIT(sector)           (1UL << (sector))
+/* records of a whole sector, kv_compact() frees it in one go */
+#define KV_COMPACT_ALL                  (BOOT_KV_SECTOR_SIZE / KV_ENTRY_SIZE)
+
+typedef struct {
+    uint32_t magic;                              /**< BOOT_KV_SECTOR_MAGIC */
+    uint32_t seq;                                /**< counts up sector by sector */
+} kv_sector;
+
+/* RAM index entry, open addressing with linear probes */
+typedef struct {
+    uint32_t hash;                               /**< FNV-1a of the key */
+    uint32_t addr;                               /**< flash address of the newest record of the key, 0: empty */
+    uint16_t size;                               /**< flash bytes of that record, padding included */
+    uint16_t deleted;                            /**< 1: that record is a delete */
+} kv_slot;
+
+static struct {
+    const sfud_flash *flash;                     /**< NULL: not mounted */
+    uint32_t seq;                                /**< sequence number of the head sector */
+    size_t head;                                 /**< sector being written */
+    size_t used;                                 /**< sectors from the oldest one to the head */
+    uint32_t offset;                             /**< next record in the head sector */
+    size_t live;                                 /**< bytes of the records the index points to */
+    size_t keys;                                 /**< index entries, the deletes included */
+    uint32_t compact;                            /**< next record of the oldest sector to move, 0: none */
+    uint32_t dirty;                              /**< free sectors which may not be erased, bit per sector */
+    sfud_async op;                               /**< background erase of a dirty sector */
+    size_t erasing;                              /**< sector of op */
+} kv;
+static kv_slot kv_index[BOOT_KV_INDEX_SIZE];
+/* one record, its entry, key and value in a row */
+static uint8_t kv_buf[KV_ALIGN(KV_RECORD_MAX)] __attribute__((aligned(4)));
+
+static uint32_t sector_addr(size_t sector) {
+    return BOOT_KV_ADDR + (uint32_t) (sector % BOOT_KV_SECTOR_NUM) * BOOT_KV_SECTOR_SIZE;
+}
+
+static size_t kv_tail(void) {
+    return (kv.head + BOOT_KV_SECTOR_NUM + 1 - kv.used) % BOOT_KV_SECTOR_NUM;
+}
+
+static size_t kv_free(void) {
+    return BOOT_KV_SECTOR_NUM - kv.used;
+}
+
+/* bytes the head and the free sectors still take */
+static size_t kv_room(void) {
+    return BOOT_KV_SECTOR_SIZE - kv.offset + kv_free() * (BOOT_KV_SECTOR_SIZE - KV_HEADER_SIZE);
+}
+
+static uint32_t key_hash(const uint8_t *key, size_t len) {
+    uint32_t hash = 0x811C9DC5;
+
+    while (len--) {
+        hash = (hash ^ *key++) * 0x01000193;
+    }
+    return hash;
+}
+
+static size_t value_size(const boot_kv_entry *entry) {
+    return entry->value_len == BOOT_KV_DELETED ? 0 : entry->value_len;
+}
+
+static size_t record_len(const boot_kv_entry *entry) {
+    return KV_ENTRY_SIZE + entry->key_len + value_size(entry);
+}
+
+static bool entry_valid(const boot_kv_entry *entry, uint32_t offset) {
+    return entry->magic == BOOT_KV_ENTRY_MAGIC && entry->key_len && entry->key_len <= BOOT_KV_KEY_MAX
+            && (entry->value_len == BOOT_KV_DELETED || entry->value_len <= BOOT_KV_VALUE_MAX)
+            && offset + KV_ALIGN(record_len(entry)) <= BOOT_KV_SECTOR_SIZE;
+}
+
+/* data is the key followed by the value */
+static uint32_t record_crc(const boot_kv_entry *entry, const uint8_t *data) {
+    uint32_t crc = boot_image_crc32(0, entry, offsetof(boot_kv_entry, crc));
+
+    return boot_image_crc32(crc, data, entry->key_len + value_size(entry));
+}
+
+/* the elog sink and the littlefs block device erase the same flash in the background */
+static void kv_take(void) {
+#ifdef ELOG_PORT_FLASH_ENABLE
+    elog_flash_flush();
+#endif
+#ifdef BOOT_LFS
+    boot_lfs_flush();
+#endif
+}
+
+/* a read while the background erase runs suspends it, the erased sector is never read */
+static sfud_err kv_read(uint32_t addr, size_t size, void *data) {
+    if (kv.op.flash) {
+        return sfud_async_read(&kv.op, addr, size, data);
+    }
+    return sfud_read(kv.flash, addr, size, data);
+}
+
+/**
+ * move the background erase on, start the erase of the next free sector which may hold data
+ *
+ * @param wait wait the running erase to end
+ * @param start start a new erase
+ *
+ * @return true: no erase is running
+ */
+static bool kv_erase(bool wait, bool start) {
+    sfud_err result;
+    size_t i, sector;
+
+    if (kv.op.flash) {
+        result = wait ? sfud_async_wait(&kv.op) : sfud_async_poll(&kv.op);
+        if (result == SFUD_ERR_BUSY) {
+            return false;
+        }
+        kv.op.flash = NULL;
+        if (result == SFUD_SUCCESS) {
+            kv.dirty &= ~KV_SECTOR_BIT(kv.erasing);
+        }
+    }
+    if (!start) {
+        return true;
+    }
+    for (i = 1; i <= kv_free(); i++) {
+        sector = (kv.head + i) % BOOT_KV_SECTOR_NUM;
+        if (kv.dirty & KV_SECTOR_BIT(sector)) {
+            kv.op.done = NULL;
+            kv.erasing = sector;
+            if (sfud_erase_async(kv.flash, &kv.op, sector_addr(sector), BOOT_KV_SECTOR_SIZE) != SFUD_SUCCESS) {
+                kv.op.flash = NULL;
+                return true;
+            }
+            /* an erase which has ended already is counted by the next call */
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool key_equal(uint32_t addr, const uint8_t *key, size_t key_len) {
+    uint8_t record[KV_ENTRY_SIZE + BOOT_KV_KEY_MAX];
+    const boot_kv_entry *entry = (const boot_kv_entry *) record;
+
+    return kv_read(addr, KV_ENTRY_SIZE + key_len, record) == SFUD_SUCCESS && entry->key_len == key_len
+            && memcmp(&record[KV_ENTRY_SIZE], key, key_len) == 0;
+}
+
+/**
+ * the index entry of the key, or the empty one it goes to
+ *
+ * @param found true: the key is in it
+ *
+ * @return NULL: the index is full
+ */
+static kv_slot *index_find(const uint8_t *key, size_t key_len, uint32_t hash, bool *found) {
+    kv_slot *slot;
+
+    *found = false;
+    for (size_t i = 0; i < BOOT_KV_INDEX_SIZE; i++) {
+        slot = &kv_index[(hash + i) & KV_INDEX_MASK];
+        if (!slot->addr) {
+            return slot;
+        }
+        if (slot->hash == hash && key_equal(slot->addr, key, key_len)) {
+            *found = true;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* the index entry pointing to the record at addr, the keys are not read */
+static kv_slot *index_of(uint32_t addr, uint32_t hash) {
+    kv_slot *slot;
+
+    for (size_t i = 0; i < BOOT_KV_INDEX_SIZE; i++) {
+        slot = &kv_index[(hash + i) & KV_INDEX_MASK];
+        if (!slot->addr) {
+            break;
+        }
+        if (slot->addr == addr) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static void index_put(kv_slot *slot, bool found, uint32_t hash, uint32_t addr, const boot_kv_entry *entry) {
+    if (found) {
+        kv.live -= slot->size;
+    } else {
+        kv.keys++;
+    }
+    slot->hash = hash;
+    slot->addr = addr;
+    slot->size = (uint16_t) KV_ALIGN(record_len(entry));
+    slot->deleted = entry->value_len == BOOT_KV_DELETED;
+    kv.live += slot->size;
+}
+
+/* backward shift, the entries after the hole which may sit in it move up, no tombstones */
+static void index_remove(kv_slot *slot) {
+    size_t hole = (size_t) (slot - kv_index), i = hole, home;
+
+    kv.live -= slot->size;
+    kv.keys--;
+    for (;;) {
+        i = (i + 1) & KV_INDEX_MASK;
+        if (!kv_index[i].addr) {
+            break;
+        }
+        home = kv_index[i].hash & KV_INDEX_MASK;
+        if (((i - home) & KV_INDEX_MASK) >= ((i - hole) & KV_INDEX_MASK)) {
+            kv_index[hole] = kv_index[i];
+            hole = i;
+        }
+    }
+    kv_index[hole].addr = 0;
+}
+
+/**
+ * start the sector after the head, erased first when it may hold data
+ */
+static sfud_err kv_sector_open(void) {
+    size_t next = (kv.head + 1) % BOOT_KV_SECTOR_NUM;
+    kv_sector header = {.magic = BOOT_KV_SECTOR_MAGIC, .seq = kv.seq + 1};
+    sfud_err result;
+
+    kv_erase(true, false);
+    if (kv.dirty & KV_SECTOR_BIT(next)) {
+        result = sfud_erase(kv.flash, sector_addr(next), BOOT_KV_SECTOR_SIZE);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+        kv.dirty &= ~KV_SECTOR_BIT(next);
+    }
+    result = sfud_write(kv.flash, sector_addr(next), KV_HEADER_SIZE, (const uint8_t *) &header);
+    if (result != SFUD_SUCCESS) {
+        kv.dirty |= KV_SECTOR_BIT(next);
+        return result;
+    }
+    kv.head = next;
+    kv.seq = header.seq;
+    kv.used++;
+    kv.offset = KV_HEADER_SIZE;
+    return SFUD_SUCCESS;
+}
+
+/**
+ * program a record at the head, a new sector is started when it doesn't fit
+ *
+ * @param entry record entry, its CRC set
+ * @param data key and value, may be in kv_buf already
+ * @param reserve free sectors which must be left, the compaction needs one
+ * @param addr flash address of the record out
+ *
+ * @return result
+ */
+static sfud_err kv_append(const boot_kv_entry *entry, const uint8_t *data, size_t reserve, uint32_t *addr) {
+    size_t len = record_len(entry);
+    sfud_err result;
+
+    if (kv.offset + KV_ALIGN(len) > BOOT_KV_SECTOR_SIZE) {
+        if (kv_free() <= reserve) {
+            return SFUD_ERR_WRITE;
+        }
+        result = kv_sector_open();
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+    }
+    kv_erase(true, false);
+    memmove(&kv_buf[KV_ENTRY_SIZE], data, len - KV_ENTRY_SIZE);
+    memmove(kv_buf, entry, KV_ENTRY_SIZE);
+    *addr = sector_addr(kv.head) + kv.offset;
+    /* a failed program may have left some bytes, the next record goes after it anyway */
+    kv.offset += KV_ALIGN(len);
+    return sfud_write(kv.flash, *addr, len, kv_buf);
+}
+
+/**
+ * move up to max records of the oldest sector to the head, the sector is freed once it is done
+ *
+ * @return false: a record couldn't be moved, the compaction goes on from it next time
+ */
+static bool kv_compact(size_t max) {
+    size_t tail = kv_tail();
+    const boot_kv_entry *entry = (const boot_kv_entry *) kv_buf;
+    uint32_t addr, moved;
+    kv_slot *slot;
+
+    if (kv.used < 2) {
+        return true;
+    }
+    if (!kv.compact) {
+        kv.compact = KV_HEADER_SIZE;
+    }
+    for (; max && kv.compact + KV_ENTRY_SIZE <= BOOT_KV_SECTOR_SIZE; max--) {
+        addr = sector_addr(tail) + kv.compact;
+        if (kv_read(addr, KV_ENTRY_SIZE + BOOT_KV_KEY_MAX, kv_buf) != SFUD_SUCCESS) {
+            return false;
+        }
+        if (!entry_valid(entry, kv.compact)) {
+            /* erased or cut off, nothing after it was indexed */
+            kv.compact = BOOT_KV_SECTOR_SIZE;
+            break;
+        }
+        slot = index_of(addr, key_hash(&kv_buf[KV_ENTRY_SIZE], entry->key_len));
+        if (slot && slot->deleted) {
+            /* no older record of the key is left */
+            index_remove(slot);
+        } else if (slot) {
+            if (kv_read(addr, record_len(entry), kv_buf) != SFUD_SUCCESS
+                    || kv_append(entry, &kv_buf[KV_ENTRY_SIZE], 0, &moved) != SFUD_SUCCESS) {
+                return false;
+            }
+            slot->addr = moved;
+        }
+        kv.compact += KV_ALIGN(record_len(entry));
+    }
+    if (kv.compact + KV_ENTRY_SIZE > BOOT_KV_SECTOR_SIZE) {
+        kv.used--;
+        kv.dirty |= KV_SECTOR_BIT(tail);
+        kv.compact = 0;
+        elog_d(TAG, "sector %u compacted", (unsigned) tail);
+    }
+    return true;
+}
+
+/**
+ * index the records of a sector, the ones of the head are checked in full, a reset may have cut the last one
+ */
+static void kv_scan(size_t sector, bool head) {
+    const boot_kv_entry *entry = (const boot_kv_entry *) kv_buf;
+    uint32_t offset = KV_HEADER_SIZE, addr, hash;
+    kv_slot *slot;
+    bool found;
+
+    while (offset + KV_ENTRY_SIZE <= BOOT_KV_SECTOR_SIZE) {
+        addr = sector_addr(sector) + offset;
+        if (kv_read(addr, KV_ENTRY_SIZE + BOOT_KV_KEY_MAX, kv_buf) != SFUD_SUCCESS || entry->magic == 0xFF) {
+            break;
+        }
+        if (!entry_valid(entry, offset)) {
+            /* the sizes are wrong, nothing after it can be found */
+            offset = BOOT_KV_SECTOR_SIZE;
+            break;
+        }
+        if (head && (kv_read(addr, record_len(entry), kv_buf) != SFUD_SUCCESS
+                     || entry->crc != record_crc(entry, &kv_buf[KV_ENTRY_SIZE]))) {
+            elog_w(TAG, "record at 0x%06x is cut off", (unsigned) addr);
+            offset += KV_ALIGN(record_len(entry));
+            continue;
+        }
+        hash = key_hash(&kv_buf[KV_ENTRY_SIZE], entry->key_len);
+        slot = index_find(&kv_buf[KV_ENTRY_SIZE], entry->key_len, hash, &found);
+        if (slot && (found || kv.keys < BOOT_KV_KEY_NUM)) {
+            index_put(slot, found, hash, addr, entry);
+        }
+        offset += KV_ALIGN(record_len(entry));
+    }
+    if (head) {
+        kv.offset = offset;
+    }
+}
+
+/**
+ * take the store area of the flash, find its head and build the index
+ *
+ * @param flash flash device, initialized
+ *
+ * @return result
+ */
+sfud_err boot_kv_mount(const sfud_flash *flash) {
+    kv_sector headers[BOOT_KV_SECTOR_NUM];
+    sfud_iovec ranges[BOOT_KV_SECTOR_NUM];
+    uint32_t seq[BOOT_KV_SECTOR_NUM];
+    uint32_t valid = 0;
+    size_t sector;
+    bool found = false;
+    sfud_err result;
+
+    if (!flash || !flash->init_ok || flash->chip.erase_gran > BOOT_KV_SECTOR_SIZE
+            || flash->chip.capacity < BOOT_KV_ADDR + BOOT_KV_SECTOR_NUM * BOOT_KV_SECTOR_SIZE) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    kv_take();
+    memset(&kv, 0, sizeof(kv));
+    memset(kv_index, 0, sizeof(kv_index));
+    kv.flash = flash;
+    kv.op.result = SFUD_SUCCESS;
+
+    /* the head is the sector with the newest sequence number, the headers come in one batch */
+    for (sector = 0; sector < BOOT_KV_SECTOR_NUM; sector++) {
+        ranges[sector].addr = sector_addr(sector);
+        ranges[sector].size = KV_HEADER_SIZE;
+        ranges[sector].data = (uint8_t *) &headers[sector];
+    }
+    result = sfud_read_multi(flash, ranges, BOOT_KV_SECTOR_NUM);
+    if (result != SFUD_SUCCESS) {
+        kv.flash = NULL;
+        return result;
+    }
+    for (sector = 0; sector < BOOT_KV_SECTOR_NUM; sector++) {
+        if (headers[sector].magic == BOOT_KV_SECTOR_MAGIC) {
+            valid |= KV_SECTOR_BIT(sector);
+            seq[sector] = headers[sector].seq;
+            if (!found || (int32_t) (headers[sector].seq - kv.seq) > 0) {
+                kv.head = sector;
+                kv.seq = headers[sector].seq;
+                found = true;
+            }
+        }
+    }
+    if (!found) {
+        /* a new store, sector 0 is written first */
+        kv.head = BOOT_KV_SECTOR_NUM - 1;
+        kv.seq = UINT32_MAX;
+        kv.dirty = (uint32_t) (((uint64_t) 1 << BOOT_KV_SECTOR_NUM) - 1);
+        result = kv_sector_open();
+        if (result != SFUD_SUCCESS) {
+            kv.flash = NULL;
+            return result;
+        }
+        elog_i(TAG, "new store at 0x%06x", (unsigned) BOOT_KV_ADDR);
+        return SFUD_SUCCESS;
+    }
+
+    /* the sectors in use count down from the head, an erase cut off by a reset leaves a dirty one */
+    for (kv.used = 1; kv.used < BOOT_KV_SECTOR_NUM; kv.used++) {
+        sector = (kv.head + BOOT_KV_SECTOR_NUM - kv.used) % BOOT_KV_SECTOR_NUM;
+        if (!(valid & KV_SECTOR_BIT(sector)) || seq[sector] != kv.seq - kv.used) {
+            break;
+        }
+    }
+    for (size_t i = 1; i <= kv_free(); i++) {
+        kv.dirty |= KV_SECTOR_BIT((kv.head + i) % BOOT_KV_SECTOR_NUM);
+    }
+    for (size_t i = kv.used; i > 0; i--) {
+        sector = (kv.head + BOOT_KV_SECTOR_NUM + 1 - i) % BOOT_KV_SECTOR_NUM;
+        kv_scan(sector, sector == kv.head);
+    }
+    elog_i(TAG, "%u keys, %u of %u bytes, %u of %u sectors", (unsigned) kv.keys, (unsigned) kv.live,
+           (unsigned) BOOT_KV_CAPACITY, (unsigned) kv.used, (unsigned) BOOT_KV_SECTOR_NUM);
+    return SFUD_SUCCESS;
+}
+
+/**
+ * read the value of a key
+ *
+ * @param key key, 0-terminated
+ * @param value value buffer
+ * @param size size of it, a longer value is cut
+ * @param len length of the value out, may be NULL
+ *
+ * @return result, SFUD_ERR_NOT_FOUND: no such key, SFUD_ERR_READ: the record is corrupted
+ */
+sfud_err boot_kv_get(const char *key, void *value, size_t size, size_t *len) {
+    const boot_kv_entry *entry = (const boot_kv_entry *) kv_buf;
+    size_t key_len = key ? strlen(key) : 0;
+    kv_slot *slot;
+    bool found;
+    sfud_err result;
+
+    if (!kv.flash) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    if (key_len == 0 || key_len > BOOT_KV_KEY_MAX) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    kv_take();
+    slot = index_find((const uint8_t *) key, key_len, key_hash((const uint8_t *) key, key_len), &found);
+    if (!slot || !found || slot->deleted) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    result = kv_read(slot->addr, slot->size, kv_buf);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    if (entry->crc != record_crc(entry, &kv_buf[KV_ENTRY_SIZE])) {
+        elog_w(TAG, "record of %s at 0x%06x is corrupted", key, (unsigned) slot->addr);
+        return SFUD_ERR_READ;
+    }
+    memcpy(value, &kv_buf[KV_ENTRY_SIZE + key_len], size < entry->value_len ? size : entry->value_len);
+    if (len) {
+        *len = entry->value_len;
+    }
+    return SFUD_SUCCESS;
+}
+
+/**
+ * append the record of a set or a delete, compact in the foreground when no sector is left for it
+ */
+static sfud_err kv_put(const char *key, const void *value, uint16_t value_len) {
+    size_t key_len = key ? strlen(key) : 0, size, old;
+    boot_kv_entry entry = {.magic = BOOT_KV_ENTRY_MAGIC, .value_len = value_len};
+    kv_slot *slot;
+    uint32_t hash, addr;
+    bool found;
+    sfud_err result;
+
+    if (!kv.flash) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    if (key_len == 0 || key_len > BOOT_KV_KEY_MAX
+            || (value_len != BOOT_KV_DELETED && value_len > BOOT_KV_VALUE_MAX)) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    entry.key_len = (uint8_t) key_len;
+    size = KV_ALIGN(record_len(&entry));
+    kv_take();
+    /* the compaction under way must still find the rest of the oldest sector room at the head */
+    if (kv.compact && kv_room() < size + BOOT_KV_SECTOR_SIZE - kv.compact + KV_ALIGN(KV_RECORD_MAX)) {
+        kv_erase(true, false);
+        if (!kv_compact(KV_COMPACT_ALL)) {
+            return SFUD_ERR_WRITE;
+        }
+    }
+    if (kv.offset + size > BOOT_KV_SECTOR_SIZE) {
+        for (size_t i = 0; kv_free() < BOOT_KV_FREE_SECTORS && i < 2 * BOOT_KV_SECTOR_NUM; i++) {
+            kv_erase(true, false);
+            if (!kv_compact(KV_COMPACT_ALL)) {
+                return SFUD_ERR_WRITE;
+            }
+        }
+    }
+
+    /* the compaction moves the index entries, they are looked up after it */
+    hash = key_hash((const uint8_t *) key, key_len);
+    slot = index_find((const uint8_t *) key, key_len, hash, &found);
+    if (value_len == BOOT_KV_DELETED && (!found || slot->deleted)) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    old = found ? slot->size : 0;
+    if (!slot || (!found && kv.keys >= BOOT_KV_KEY_NUM)
+            || kv.live - old + size > BOOT_KV_CAPACITY) {
+        return SFUD_ERR_WRITE;
+    }
+    memcpy(&kv_buf[KV_ENTRY_SIZE], key, key_len);
+    if (value_len != BOOT_KV_DELETED) {
+        memcpy(&kv_buf[KV_ENTRY_SIZE + key_len], value, value_len);
+    }
+    entry.crc = record_crc(&entry, &kv_buf[KV_ENTRY_SIZE]);
+    result = kv_append(&entry, &kv_buf[KV_ENTRY_SIZE], 1, &addr);
+    if (result == SFUD_SUCCESS) {
+        index_put(slot, found, hash, addr, &entry);
+    }
+    return result;
+}
+
+/**
+ * set the value of a key, one record appended
+ *
+ * @param key key, 0-terminated, BOOT_KV_KEY_MAX characters at most
+ * @param value value
+ * @param len length of it, BOOT_KV_VALUE_MAX at most
+ *
+ * @return result, SFUD_ERR_WRITE: the store is full
+ */
+sfud_err boot_kv_set(const char *key, const void *value, size_t len) {
+    if (len > BOOT_KV_VALUE_MAX) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    return kv_put(key, value, (uint16_t) len);
+}
+
+/**
+ * delete a key, one record appended, the compaction drops it and the older ones
+ *
+ * @param key key, 0-terminated
+ *
+ * @return result, SFUD_ERR_NOT_FOUND: no such key
+ */
+sfud_err boot_kv_delete(const char *key) {
+    return kv_put(key, NULL, BOOT_KV_DELETED);
+}
+
+/**
+ * move the compaction and the background erase on, never waits for the flash
+ */
+void boot_kv_poll(void) {
+    if (!kv.flash || !kv_erase(false, false)) {
+        return;
+    }
+    kv_take();
+    if (kv_free() < BOOT_KV_FREE_SECTORS) {
+        kv_compact(BOOT_KV_COMPACT_STEP);
+    }
+    /* the erase of a freed sector runs till the next call */
+    kv_erase(false, true);
+}
+
+/**
+ * wait for the background erase, the flash is free for others then
+ */
+void boot_kv_flush(void) {
+    if (kv.flash) {
+        kv_erase(true, false);
+        sfud_write_flush(kv.flash);
+    }
+}
@@ -0,0 +1,313 @@
+/**
+ * @file boot_lfs.c
+ * @brief littlefs block device over the SFUD flashes, see boot_lfs.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_LFS
+
+#include "boot_kv.h"
+#include "boot_bench.h"
+#include "boot_cmp.h"
+#include "boot_ext.h"
+#include "boot_lfs.h"
+#include "elog.h"
+#include <elog_flash_cfg.h>
+
+#ifdef BOOT_LFS
+
+#ifdef ELOG_PORT_FLASH_ENABLE
+#include <elog_flash.h>
+#endif
+#include <stdbool.h>
+#include <string.h>
+
+#if BOOT_LFS_CACHE_SIZE % BOOT_LFS_READ_SIZE || BOOT_LFS_CACHE_SIZE % BOOT_LFS_PROG_SIZE
+    #error "BOOT_LFS_CACHE_SIZE must be a multiple of the read and the program size (in boot_lfs.h)"
+#endif
+#if BOOT_LFS_LOOKAHEAD_SIZE % 8
+    #error "BOOT_LFS_LOOKAHEAD_SIZE must be a multiple of 8 (in boot_lfs.h)"
+#endif
+
+ELOG_TAG_DEFINE(TAG, "lfs");
+
+#define BLOCK_BIT(bitmap, block)        ((bitmap)[(block) / 32] & (1UL << ((block) % 32)))
+#define BLOCK_SET(bitmap, block)        ((bitmap)[(block) / 32] |= 1UL << ((block) % 32))
+#define BLOCK_CLEAR(bitmap, block)      ((bitmap)[(block) / 32] &= ~(1UL << ((block) % 32)))
+
+static struct {
+    const sfud_flash *flash;                     /**< NULL: not configured */
+    uint32_t addr;                               /**< flash address of block 0 */
+    lfs_size_t block_size;
+    lfs_block_t blocks;                          /**< blocks of the pre-erase, BOOT_LFS_PRE_ERASE_BLOCKS at most */
+    lfs_block_t scan;                            /**< next block of the pass, blocks: the pass is over */
+    bool changed;                                /**< programmed or erased since the last traverse */
+    lfs_block_t erasing;                         /**< block of op */
+    sfud_async op;                               /**< background erase of a free block */
+} lfs_bd;
+/* blocks in use by the last traverse or taken since, and the free blocks known erased */
+static uint32_t lfs_used[BOOT_LFS_PRE_ERASE_BLOCKS / 32] __attribute__((section(".dtcm_bss")));
+static uint32_t lfs_erased[BOOT_LFS_PRE_ERASE_BLOCKS / 32] __attribute__((section(".dtcm_bss")));
+/* the caches stay out of the DTCM, SPI2 and OCTOSPI1 move them by DMA */
+static uint8_t lfs_read_buf[BOOT_LFS_CACHE_SIZE] __attribute__((aligned(32)));
+static uint8_t lfs_prog_buf[BOOT_LFS_CACHE_SIZE] __attribute__((aligned(32)));
+/* the read back of the pre-erase, the read cache of littlefs keeps its content */
+static uint8_t lfs_check_buf[BOOT_LFS_CACHE_SIZE] __attribute__((aligned(32)));
+static uint32_t lfs_lookahead_buf[BOOT_LFS_LOOKAHEAD_SIZE / 4] __attribute__((section(".dtcm_bss")));
+
+static int lfs_result(sfud_err result) {
+    switch (result) {
+    case SFUD_SUCCESS:
+        return LFS_ERR_OK;
+    case SFUD_ERR_ADDR_OUT_OF_BOUND:
+        return LFS_ERR_INVAL;
+    default:
+        return LFS_ERR_IO;
+    }
+}
+
+/**
+ * move the background erase on
+ *
+ * @param wait wait the running erase to end
+ *
+ * @return true: no erase is running
+ */
+static bool pre_erase_end(bool wait) {
+    sfud_err result = wait ? sfud_async_wait(&lfs_bd.op) : sfud_async_poll(&lfs_bd.op);
+
+    if (result == SFUD_ERR_BUSY) {
+        return false;
+    }
+    if (lfs_bd.op.flash) {
+        lfs_bd.op.flash = NULL;
+        /* littlefs may have taken the block meanwhile, it waited for the erase then */
+        if (result == SFUD_SUCCESS && !BLOCK_BIT(lfs_used, lfs_bd.erasing)) {
+            BLOCK_SET(lfs_erased, lfs_bd.erasing);
+        }
+    }
+    return true;
+}
+
+/* the log sink and the key-value store share the EXT flash, their background erases end first, and ours */
+static void lfs_take(void) {
+#ifdef ELOG_PORT_FLASH_ENABLE
+    elog_flash_flush();
+#endif
+    boot_kv_flush();
+    pre_erase_end(true);
+}
+
+/* a block littlefs programs or erases is in use till the next traverse, and no longer erased */
+static void block_taken(lfs_block_t block) {
+    lfs_bd.changed = true;
+    if (block < lfs_bd.blocks) {
+        BLOCK_SET(lfs_used, block);
+        BLOCK_CLEAR(lfs_erased, block);
+    }
+}
+
+static uint32_t block_addr(const struct lfs_config *c, lfs_block_t block, lfs_off_t off) {
+    return lfs_bd.addr + block * c->block_size + off;
+}
+
+static int lfs_bd_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer,
+        lfs_size_t size) {
+    lfs_take();
+    return lfs_result(sfud_read(lfs_bd.flash, block_addr(c, block, off), size, buffer));
+}
+
+static int lfs_bd_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer,
+        lfs_size_t size) {
+    lfs_take();
+    block_taken(block);
+    return lfs_result(sfud_write(lfs_bd.flash, block_addr(c, block, off), size, buffer));
+}
+
+/* a block erased ahead is taken as it is */
+static int lfs_bd_erase(const struct lfs_config *c, lfs_block_t block) {
+    bool erased;
+
+    lfs_take();
+    erased = block < lfs_bd.blocks && BLOCK_BIT(lfs_erased, block);
+    block_taken(block);
+    if (erased) {
+        return LFS_ERR_OK;
+    }
+    return lfs_result(sfud_erase(lfs_bd.flash, block_addr(c, block, 0), c->block_size));
+}
+
+/* lfs_fs_traverse() callback */
+static int block_used(void *data, lfs_block_t block) {
+    (void) data;
+    if (block < lfs_bd.blocks) {
+        BLOCK_SET(lfs_used, block);
+    }
+    return LFS_ERR_OK;
+}
+
+/* a block is erased when all its bytes are 0xFF, one cache at a time */
+static bool block_erased(lfs_block_t block) {
+    uint32_t addr = lfs_bd.addr + block * lfs_bd.block_size, off;
+
+    for (off = 0; off < lfs_bd.block_size; off += BOOT_LFS_CACHE_SIZE) {
+        if (sfud_read(lfs_bd.flash, addr + off, BOOT_LFS_CACHE_SIZE, lfs_check_buf) != SFUD_SUCCESS
+                || !boot_cmp_blank(lfs_check_buf, BOOT_LFS_CACHE_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the programs of less than a page may wait in the write buffer of SFUD */
+static int lfs_bd_sync(const struct lfs_config *c) {
+    (void) c;
+    return lfs_result(sfud_write_flush(lfs_bd.flash));
+}
+
+/**
+ * fill a littlefs configuration for an area of a flash
+ *
+ * @param cfg configuration to fill
+ * @param flash flash of the area
+ * @param addr start of the area, erase granule aligned
+ * @param size bytes of the area, whole erase granules
+ *
+ * @return LFS_ERR_OK, LFS_ERR_INVAL when the area does not fit the flash or the granule
+ */
+int boot_lfs_config(struct lfs_config *cfg, const sfud_flash *flash, uint32_t addr, uint32_t size) {
+    uint32_t block_size = flash->chip.erase_gran;
+
+    if (block_size == 0 || block_size % BOOT_LFS_CACHE_SIZE || addr % block_size || size % block_size
+            || size / block_size < 2 || addr + size > flash->chip.capacity || addr + size < addr) {
+        elog_e(TAG, "%s: no file system at 0x%06x, %u bytes, erase granule %u", flash->name, (unsigned) addr,
+                (unsigned) size, (unsigned) block_size);
+        return LFS_ERR_INVAL;
+    }
+
+    boot_lfs_flush();
+    memset(&lfs_bd, 0, sizeof(lfs_bd));
+    memset(lfs_used, 0, sizeof(lfs_used));
+    memset(lfs_erased, 0, sizeof(lfs_erased));
+    lfs_bd.flash = flash;
+    lfs_bd.addr = addr;
+    lfs_bd.block_size = block_size;
+    lfs_bd.blocks = size / block_size < BOOT_LFS_PRE_ERASE_BLOCKS ? size / block_size : BOOT_LFS_PRE_ERASE_BLOCKS;
+    lfs_bd.scan = lfs_bd.blocks;
+    lfs_bd.changed = true;
+    lfs_bd.op.result = SFUD_SUCCESS;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->context = &lfs_bd;
+    cfg->read = lfs_bd_read;
+    cfg->prog = lfs_bd_prog;
+    cfg->erase = lfs_bd_erase;
+    cfg->sync = lfs_bd_sync;
+    cfg->read_size = BOOT_LFS_READ_SIZE;
+    cfg->prog_size = BOOT_LFS_PROG_SIZE;
+    cfg->block_size = block_size;
+    cfg->block_count = size / block_size;
+    cfg->block_cycles = BOOT_LFS_BLOCK_CYCLES;
+    cfg->cache_size = BOOT_LFS_CACHE_SIZE;
+    cfg->lookahead_size = BOOT_LFS_LOOKAHEAD_SIZE;
+    cfg->read_buffer = lfs_read_buf;
+    cfg->prog_buffer = lfs_prog_buf;
+    cfg->lookahead_buffer = lfs_lookahead_buf;
+
+    return LFS_ERR_OK;
+}
+
+/**
+ * mount the file system of the EXT flash, format the area first when it holds none
+ *
+ * @param lfs file system
+ * @param cfg configuration, filled here, it must stay while the file system is mounted
+ *
+ * @return LFS_ERR_OK or the littlefs error
+ */
+int boot_lfs_mount(lfs_t *lfs, struct lfs_config *cfg) {
+    const sfud_flash *flash = boot_ext_flash();
+    uint32_t end = flash->chip.capacity - ELOG_FLASH_SECTOR_NUM * ELOG_FLASH_SECTOR_SIZE - BOOT_BENCH_AREA_SIZE;
+    int result;
+
+    result = boot_lfs_config(cfg, flash, BOOT_LFS_ADDR, end > BOOT_LFS_ADDR ? end - BOOT_LFS_ADDR : 0);
+    if (result != LFS_ERR_OK) {
+        return result;
+    }
+
+    result = lfs_mount(lfs, cfg);
+    if (result != LFS_ERR_OK) {
+        elog_w(TAG, "%s: no file system at 0x%06x (%d), formatting %u blocks", flash->name,
+                (unsigned) BOOT_LFS_ADDR, result, (unsigned) cfg->block_count);
+        result = lfs_format(lfs, cfg);
+        if (result == LFS_ERR_OK) {
+            result = lfs_mount(lfs, cfg);
+        }
+    }
+    if (result != LFS_ERR_OK) {
+        elog_e(TAG, "%s: file system mount failed (%d)", flash->name, result);
+    } else {
+        elog_i(TAG, "%s: file system at 0x%06x, %u blocks of %u bytes", flash->name, (unsigned) BOOT_LFS_ADDR,
+                (unsigned) cfg->block_count, (unsigned) cfg->block_size);
+    }
+    return result;
+}
+
+/**
+ * erase a free block ahead of need, call it between other work while the file system is mounted
+ *
+ * @note a pass starts with lfs_fs_traverse() when the file system changed since the last one, a call takes one
+ *       block of it: a block in use is skipped, a free one read back as erased is noted, another one is erased in
+ *       the background till a later call
+ *
+ * @param lfs mounted file system of the last boot_lfs_config()
+ */
+void boot_lfs_poll(lfs_t *lfs) {
+    lfs_block_t block;
+    int result;
+
+    if (!lfs_bd.flash || !pre_erase_end(false)) {
+        return;
+    }
+    if (lfs_bd.scan == lfs_bd.blocks) {
+        if (!lfs_bd.changed) {
+            return;
+        }
+        /* the traverse reads by the callbacks, which take the flash, nothing is programmed by it */
+        memset(lfs_used, 0, sizeof(lfs_used));
+        lfs_bd.changed = false;
+        result = lfs_fs_traverse(lfs, block_used, NULL);
+        if (result < 0) {
+            elog_w(TAG, "%s: no pre-erase, traverse failed (%d)", lfs_bd.flash->name, result);
+            return;
+        }
+        lfs_bd.scan = 0;
+    }
+    while (lfs_bd.scan < lfs_bd.blocks && (BLOCK_BIT(lfs_used, lfs_bd.scan) || BLOCK_BIT(lfs_erased, lfs_bd.scan))) {
+        lfs_bd.scan++;
+    }
+    if (lfs_bd.scan == lfs_bd.blocks) {
+        return;
+    }
+    block = lfs_bd.scan++;
+    lfs_take();
+    if (block_erased(block)) {
+        BLOCK_SET(lfs_erased, block);
+        return;
+    }
+    lfs_bd.erasing = block;
+    lfs_bd.op.done = NULL;
+    if (sfud_erase_async(lfs_bd.flash, &lfs_bd.op, lfs_bd.addr + block * lfs_bd.block_size, lfs_bd.block_size)
+            != SFUD_SUCCESS) {
+        lfs_bd.op.flash = NULL;
+    }
+}
+
+/**
+ * wait for the background erase, the flash is free for others then
+ */
+void boot_lfs_flush(void) {
+    if (lfs_bd.flash) {
+        pre_erase_end(true);
+    }
+}
+
+#endif /* BOOT_LFS */
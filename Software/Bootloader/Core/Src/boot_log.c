@@ -0,0 +1,70 @@
+/**
+ * @file boot_log.c
+ * @brief Copy of the elog output in a no-init RAM_D3 ring, kept over warm resets.
+ */
+#include "boot_log.h"
+#include "main.h"
+#include <string.h>
+
+/* placed at BOOT_LOG_ADDR by the linker script */
+boot_log boot_log_record __attribute__((section(".boot_log"), aligned(32)));
+
+/* the application reads RAM_D3 uncached, with a reset the dirty lines would be lost */
+static void log_clean(const void *addr, size_t size) {
+    SCB_CleanDCache_by_Addr((uint32_t *) (uintptr_t) addr, (int32_t) size);
+}
+
+/**
+ * keep the ring of the last runs, or start it over when it isn't valid
+ *
+ * @note call it before the first log
+ */
+void boot_log_init(void) {
+    boot_log *log = &boot_log_record;
+
+    if (log->magic != BOOT_LOG_MAGIC || log->version != BOOT_LOG_VERSION || log->size != BOOT_LOG_SIZE
+            || log->write - log->read > BOOT_LOG_SIZE) {
+        memset(log, 0, offsetof(boot_log, data));
+        log->version = BOOT_LOG_VERSION;
+        log->size = BOOT_LOG_SIZE;
+        log->magic = BOOT_LOG_MAGIC;
+    }
+    log->boots++;
+    log_clean(log, offsetof(boot_log, data));
+}
+
+/**
+ * append to the ring, the oldest bytes go when it is full
+ *
+ * @note the elog output lock is held, the interrupts are masked
+ *
+ * @param log output of log
+ * @param size log size
+ */
+void boot_log_write(const char *log, size_t size) {
+    boot_log *rec = &boot_log_record;
+    size_t pos, len;
+
+    if (rec->magic != BOOT_LOG_MAGIC || size == 0) {
+        return;
+    }
+    if (size > BOOT_LOG_SIZE) {
+        rec->write += size - BOOT_LOG_SIZE;
+        log += size - BOOT_LOG_SIZE;
+        size = BOOT_LOG_SIZE;
+    }
+    pos = rec->write & (BOOT_LOG_SIZE - 1);
+    len = BOOT_LOG_SIZE - pos < size ? BOOT_LOG_SIZE - pos : size;
+    memcpy(&rec->data[pos], log, len);
+    log_clean(&rec->data[pos], len);
+    if (len < size) {
+        memcpy(rec->data, log + len, size - len);
+        log_clean(rec->data, size - len);
+    }
+    rec->write += size;
+    if (rec->write - rec->read > BOOT_LOG_SIZE) {
+        rec->lost += rec->write - rec->read - BOOT_LOG_SIZE;
+        rec->read = rec->write - BOOT_LOG_SIZE;
+    }
+    log_clean(rec, offsetof(boot_log, data));
+}
@@ -0,0 +1,90 @@
+/**
+ * @file boot_lz4.c
+ * @brief Decoder of the LZ4 block format, see boot_lz4.h.
+ */
+#include "boot_lz4.h"
+#include <string.h>
+
+#define LZ4_MIN_MATCH                   4
+#define LZ4_RUN_MASK                    0x0F
+
+/**
+ * add the 255-run extension bytes of a literal count or match length
+ *
+ * @return false: the block ends inside the extension
+ */
+static bool get_length(const uint8_t **in, const uint8_t *in_end, size_t *len) {
+    uint8_t byte;
+
+    do {
+        if (*in == in_end) {
+            return false;
+        }
+        byte = *(*in)++;
+        *len += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+/**
+ * decode a whole block
+ *
+ * @param in block, read once from start to end, the XIP window may hold it
+ * @param in_len bytes of the block
+ * @param out output buffer
+ * @param out_len decoded size
+ *
+ * @return true: the block decodes to exactly out_len bytes, false: it's corrupt, out holds garbage
+ */
+bool boot_lz4_decode(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len) {
+    const uint8_t *in_end = in + in_len, *match;
+    uint8_t *op = out, *out_end = out + out_len;
+    size_t len, offset, n;
+    uint8_t token;
+
+    while (in < in_end) {
+        token = *in++;
+        len = token >> 4;
+        if (len == LZ4_RUN_MASK && !get_length(&in, in_end, &len)) {
+            return false;
+        }
+        if (len > (size_t) (in_end - in) || len > (size_t) (out_end - op)) {
+            return false;
+        }
+        memcpy(op, in, len);
+        in += len;
+        op += len;
+        /* the last sequence ends with its literals */
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            return false;
+        }
+        offset = in[0] | ((size_t) in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t) (op - out)) {
+            return false;
+        }
+        len = token & LZ4_RUN_MASK;
+        if (len == LZ4_RUN_MASK && !get_length(&in, in_end, &len)) {
+            return false;
+        }
+        len += LZ4_MIN_MATCH;
+        if (len > (size_t) (out_end - op)) {
+            return false;
+        }
+        /* an overlapping match repeats its offset bytes: each copy doubles the distance it may take at once */
+        match = op - offset;
+        while (len) {
+            n = (size_t) (op - match) < len ? (size_t) (op - match) : len;
+            memcpy(op, match, n);
+            op += n;
+            len -= n;
+        }
+    }
+
+    return op == out_end;
+}
@@ -0,0 +1,212 @@
+/**
+ * @file boot_mem.c
+ * @brief Memory copy and fill by the MDMA, see boot_mem.h.
+ */
+#include "boot_mem.h"
+#include "boot_trace.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include <string.h>
+
+/* channel 0 serves the OCTOSPI1 FIFO, channel 1 the CRC unit, channel 2 the scatter loader */
+#define MEM_MDMA_CHANNEL                MDMA_Channel3
+/* MDMA block data length is 17 bits */
+#define MEM_BLOCK_MAX_SIZE              (64 * 1024)
+
+static MDMA_HandleTypeDef hmdma_mem;
+/* the fill byte in all four bytes of a word, read by every beat of a fill */
+static uint32_t mem_fill_word;
+/* the transfer running: the next block, the bytes left, the destination lines to drop at the end */
+static uint32_t mem_src, mem_dst;
+static size_t mem_left;
+static uint8_t *mem_lines;
+static size_t mem_lines_len;
+static boot_task *mem_task;
+static volatile bool mem_busy;
+static volatile bool mem_failed;
+
+static void mem_end(bool ok) {
+    dma_complete_rx(mem_lines, mem_lines_len);
+    mem_failed = !ok;
+    mem_busy = false;
+    if (mem_task) {
+        boot_sched_post(mem_task);
+    }
+}
+
+static bool mem_block_start(void) {
+    size_t len = mem_left > MEM_BLOCK_MAX_SIZE ? MEM_BLOCK_MAX_SIZE : mem_left;
+
+    boot_trace_begin(BOOT_TRACE_MDMA_COPY, len);
+    if (HAL_MDMA_Start_IT(&hmdma_mem, mem_src, mem_dst, len, 1) != HAL_OK) {
+        return false;
+    }
+    if (hmdma_mem.Init.SourceInc != MDMA_SRC_INC_DISABLE) {
+        mem_src += len;
+    }
+    mem_dst += len;
+    mem_left -= len;
+    return true;
+}
+
+static void mem_xfer_cplt(MDMA_HandleTypeDef *hmdma) {
+    (void) hmdma;
+    boot_trace_end(BOOT_TRACE_MDMA_COPY, 0);
+    if (mem_left == 0) {
+        mem_end(true);
+    } else if (!mem_block_start()) {
+        mem_end(false);
+    }
+}
+
+static void mem_xfer_error(MDMA_HandleTypeDef *hmdma) {
+    (void) hmdma;
+    boot_trace_end(BOOT_TRACE_MDMA_COPY, 0);
+    mem_end(false);
+}
+
+/**
+ * set the channel up for a copy or a fill
+ *
+ * @param fill true: the source is mem_fill_word, not moving
+ * @param src_word the source is on 4 bytes, it's read in words
+ */
+static bool mem_setup(bool fill, bool src_word, uint32_t dst) {
+    __HAL_RCC_MDMA_CLK_ENABLE();
+
+    hmdma_mem.Instance = MEM_MDMA_CHANNEL;
+    hmdma_mem.Init.Request = MDMA_REQUEST_SW;
+    hmdma_mem.Init.TransferTriggerMode = MDMA_FULL_TRANSFER;
+    hmdma_mem.Init.Priority = MDMA_PRIORITY_MEDIUM;
+    hmdma_mem.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    hmdma_mem.Init.SourceInc = fill ? MDMA_SRC_INC_DISABLE : src_word ? MDMA_SRC_INC_WORD : MDMA_SRC_INC_BYTE;
+    hmdma_mem.Init.DestinationInc = MDMA_DEST_INC_WORD;
+    hmdma_mem.Init.SourceDataSize = fill || src_word ? MDMA_SRC_DATASIZE_WORD : MDMA_SRC_DATASIZE_BYTE;
+    hmdma_mem.Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    hmdma_mem.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    hmdma_mem.Init.BufferTransferLength = 128;
+    /* bursts keep the OCTOSPI1 prefetching, the fill word is read once per beat, the TCMs are behind the AHBS */
+    hmdma_mem.Init.SourceBurst = fill ? MDMA_SOURCE_BURST_SINGLE : MDMA_SOURCE_BURST_16BEATS;
+    hmdma_mem.Init.DestBurst = dst >= 0x24000000UL ? MDMA_DEST_BURST_16BEATS : MDMA_DEST_BURST_SINGLE;
+    hmdma_mem.Init.SourceBlockAddressOffset = 0;
+    hmdma_mem.Init.DestBlockAddressOffset = 0;
+    if (HAL_MDMA_Init(&hmdma_mem) != HAL_OK) {
+        return false;
+    }
+    HAL_MDMA_RegisterCallback(&hmdma_mem, HAL_MDMA_XFER_CPLT_CB_ID, mem_xfer_cplt);
+    HAL_MDMA_RegisterCallback(&hmdma_mem, HAL_MDMA_XFER_ERROR_CB_ID, mem_xfer_error);
+    /* shared with the OCTOSPI1 FIFO channel, HAL_OSPI_MspInit() sets the same */
+    HAL_NVIC_SetPriority(MDMA_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(MDMA_IRQn);
+    return true;
+}
+
+/**
+ * the CPU does the bytes out of the destination lines and a short transfer, the MDMA the lines
+ *
+ * @param src source, NULL: a fill with value
+ */
+static void mem_start(uint8_t *dst, const uint8_t *src, uint8_t value, size_t len, boot_task *task) {
+    size_t head = (size_t) (-(uintptr_t) dst & (DMA_ALIGN - 1)), tail;
+
+    boot_mem_wait();
+    if (head > len) {
+        head = len;
+    }
+    tail = (len - head) & (DMA_ALIGN - 1);
+    mem_task = task;
+    mem_failed = false;
+    if (len - head - tail < BOOT_MEM_DMA_MIN) {
+        head = len;
+        tail = 0;
+    }
+    /* the bytes before the first line and after the last one, the whole of a short transfer */
+    if (src) {
+        memcpy(dst, src, head);
+        memcpy(dst + len - tail, src + len - tail, tail);
+    } else {
+        memset(dst, value, head);
+        memset(dst + len - tail, value, tail);
+    }
+    mem_lines = dst + head;
+    mem_lines_len = len - head - tail;
+    if (mem_lines_len == 0) {
+        if (task) {
+            boot_sched_post(task);
+        }
+        return;
+    }
+
+    if (src) {
+        mem_src = (uint32_t) (uintptr_t) (src + head);
+        dma_prepare_tx(src + head, mem_lines_len);
+    } else {
+        mem_fill_word = value * 0x01010101UL;
+        mem_src = (uint32_t) (uintptr_t) &mem_fill_word;
+        dma_prepare_tx(&mem_fill_word, sizeof(mem_fill_word));
+    }
+    mem_dst = (uint32_t) (uintptr_t) mem_lines;
+    mem_left = mem_lines_len;
+    dma_prepare_rx(mem_lines, mem_lines_len);
+    mem_busy = true;
+    if (!mem_setup(!src, mem_src % 4 == 0, mem_dst) || !mem_block_start()) {
+        /* the MDMA can't take it, the CPU does it all the same */
+        mem_busy = false;
+        if (src) {
+            memcpy(mem_lines, src + head, mem_lines_len);
+        } else {
+            memset(mem_lines, value, mem_lines_len);
+        }
+        if (task) {
+            boot_sched_post(task);
+        }
+    }
+}
+
+/**
+ * start a copy, the source and the destination don't overlap
+ *
+ * @param task posted at the end, NULL: none
+ */
+void boot_mem_copy(void *dst, const void *src, size_t len, boot_task *task) {
+    mem_start((uint8_t *) dst, (const uint8_t *) src, 0, len, task);
+}
+
+/**
+ * start a fill with a byte value
+ *
+ * @param task posted at the end, NULL: none
+ */
+void boot_mem_fill(void *dst, uint8_t value, size_t len, boot_task *task) {
+    mem_start((uint8_t *) dst, NULL, value, len, task);
+}
+
+bool boot_mem_busy(void) {
+    return mem_busy;
+}
+
+/**
+ * wait for the end of the transfer running
+ *
+ * @return false: the MDMA failed, the destination has undefined content
+ */
+bool boot_mem_wait(void) {
+    while (mem_busy) {
+        if (__get_PRIMASK()) {
+            /* called with the interrupts masked, serve the handler here */
+            boot_mem_irq_handler();
+        } else {
+            __WFI();
+        }
+    }
+    return !mem_failed;
+}
+
+/**
+ * from MDMA_IRQHandler(), the interrupt of all the channels
+ */
+void boot_mem_irq_handler(void) {
+    if (hmdma_mem.Instance) {
+        HAL_MDMA_IRQHandler(&hmdma_mem);
+    }
+}
@@ -0,0 +1,264 @@
+/**
+ * @file boot_netlog.c
+ * @brief Copy of the elog output to the ESP32-C3 over the ESP-Hosted link, see boot_netlog.h.
+ */
+#include "boot_netlog.h"
+#include "boot_esp.h"
+#include "dma_pool.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+typedef enum {
+    NETLOG_LINE_START,                           /**< nothing of the line yet, or its colour sequence */
+    NETLOG_LINE_CSI,                             /**< in the colour sequence, up to its 'm' */
+    NETLOG_LINE_KEEP,                            /**< the level is known, the line goes into the frame */
+    NETLOG_LINE_DROP,                            /**< dropped up to its newline */
+} netlog_line;
+
+typedef struct {
+    bool on;                                     /**< between boot_netlog_start() and boot_netlog_stop() */
+    uint8_t *frame;                              /**< open frame, NULL: none */
+    uint32_t fill;                               /**< text bytes in the frame */
+    uint32_t line_start;                         /**< text offset of the current line, the whole lines end there */
+    uint32_t limit;                              /**< fill the current line may reach with the queue backed up */
+    netlog_line line;
+    uint16_t seq;                                /**< seq_num of the next frame */
+    uint32_t dropped;                            /**< lines dropped since the last frame sent */
+    boot_netlog_stats stats;
+} netlog_state;
+
+static netlog_state netlog;
+
+static char *netlog_text(uint8_t *frame) {
+    return (char *) (frame + sizeof(esp_spi_header) + sizeof(boot_netlog_msg));
+}
+
+/**
+ * fill the frame the line may reach by the first letter of its elog prefix
+ */
+static uint32_t netlog_limit(char level) {
+    switch (level) {
+    case 'A':
+    case 'E':
+    case 'W':
+        return BOOT_NETLOG_TEXT_SIZE;
+    case 'D':
+    case 'V':
+        return BOOT_NETLOG_LOW_FILL;
+    default:
+        return BOOT_NETLOG_INFO_FILL;
+    }
+}
+
+/**
+ * a TX frame for the log, with at most one frame queued and the reserve of the pool left to the RX side
+ */
+static uint8_t *netlog_take(void) {
+    if (esp_spi_tx_pending() > 1 || dma_pool_free_count() < BOOT_NETLOG_POOL_RESERVE) {
+        return NULL;
+    }
+    return esp_spi_tx_get();
+}
+
+static void netlog_drop_line(void) {
+    netlog.fill = netlog.line_start;
+    netlog.line = NETLOG_LINE_DROP;
+    netlog.dropped++;
+    netlog.stats.dropped++;
+}
+
+/**
+ * queue the first len text bytes of a frame
+ */
+static void netlog_put(uint8_t *frame, uint32_t len) {
+    esp_spi_header *header = (esp_spi_header *) frame;
+    boot_netlog_msg *msg = (boot_netlog_msg *) (frame + sizeof(esp_spi_header));
+
+    memset(header, 0, sizeof(esp_spi_header));
+    header->if_type_num = BOOT_ESP_IF_TYPE_SERIAL | (BOOT_NETLOG_IF_NUM << 4);
+    header->len = (uint16_t) (sizeof(boot_netlog_msg) + len);
+    header->offset = sizeof(esp_spi_header);
+    header->seq_num = netlog.seq++;
+    msg->magic = BOOT_NETLOG_MSG_MAGIC;
+    msg->dropped = netlog.dropped;
+    netlog.dropped = 0;
+    netlog.stats.frames++;
+    esp_spi_tx_put(frame);
+}
+
+/**
+ * queue the whole lines of the open frame, the part of the current line goes on in a new one
+ */
+static void netlog_send(void) {
+    uint32_t tail = netlog.fill - netlog.line_start;
+    uint8_t *next = NULL;
+
+    if (tail && (next = netlog_take()) != NULL) {
+        memcpy(netlog_text(next), netlog_text(netlog.frame) + netlog.line_start, tail);
+    } else if (tail) {
+        netlog_drop_line();
+        tail = 0;
+    }
+    netlog_put(netlog.frame, netlog.line_start);
+    netlog.frame = next;
+    netlog.fill = tail;
+    netlog.line_start = 0;
+}
+
+/**
+ * copy a piece of the current line into the frames, the line is dropped when it doesn't fit
+ */
+static void netlog_copy(const char *data, size_t len) {
+    uint32_t n;
+
+    while (len) {
+        if (!netlog.frame) {
+            netlog.fill = netlog.line_start = 0;
+            if ((netlog.frame = netlog_take()) == NULL) {
+                netlog_drop_line();
+                return;
+            }
+        }
+        if (netlog.fill == BOOT_NETLOG_TEXT_SIZE) {
+            /* a line longer than a frame, or no frame to go on in */
+            if (netlog.line_start == 0 || esp_spi_tx_pending()) {
+                netlog_drop_line();
+                return;
+            }
+            netlog_send();
+            if (netlog.line == NETLOG_LINE_DROP) {
+                return;
+            }
+            continue;
+        }
+        n = BOOT_NETLOG_TEXT_SIZE - netlog.fill;
+        if (n > len) {
+            n = (uint32_t) len;
+        }
+        /* the queue is backed up, the lower levels leave the rest of the frame to the higher ones */
+        if (netlog.fill + n > netlog.limit && esp_spi_tx_pending()) {
+            netlog_drop_line();
+            return;
+        }
+        memcpy(netlog_text(netlog.frame) + netlog.fill, data, n);
+        netlog.fill += n;
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * the current line is in the frame up to its newline, the frame goes when nothing waits in the queue
+ */
+static void netlog_line_end(void) {
+    netlog.line_start = netlog.fill;
+    netlog.stats.lines++;
+    if (!esp_spi_tx_pending()) {
+        netlog_send();
+    }
+}
+
+/**
+ * take the log to the ESP32, the link of esp_spi.h is up
+ */
+void boot_netlog_start(void) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    memset(&netlog, 0, sizeof(netlog));
+    netlog.limit = BOOT_NETLOG_TEXT_SIZE;
+    netlog.on = true;
+    __set_PRIMASK(primask);
+}
+
+/**
+ * send what is left and stop, before esp_spi_deinit()
+ */
+void boot_netlog_stop(void) {
+    uint32_t start = HAL_GetTick(), primask;
+    bool busy;
+
+    do {
+        primask = __get_PRIMASK();
+        __disable_irq();
+        boot_netlog_flush();
+        busy = (netlog.frame && netlog.line_start) || esp_spi_tx_busy();
+        __set_PRIMASK(primask);
+    } while (busy && HAL_GetTick() - start <= BOOT_NETLOG_STOP_TIMEOUT_MS);
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    /* queued anyway, esp_spi_deinit() gives back the frames not sent */
+    if (netlog.frame) {
+        netlog_put(netlog.frame, netlog.line_start);
+        netlog.frame = NULL;
+    }
+    netlog.on = false;
+    __set_PRIMASK(primask);
+}
+
+/**
+ * batch a log output into the frames
+ *
+ * @note the elog output lock is held, the interrupts are masked
+ *
+ * @param log output of log
+ * @param size log size
+ */
+void boot_netlog_write(const char *log, size_t size) {
+    const char *end;
+    size_t len;
+
+    if (!netlog.on) {
+        return;
+    }
+    while (size) {
+        end = NULL;
+        if (netlog.line == NETLOG_LINE_START && *log != '\033') {
+            netlog.limit = netlog_limit(*log);
+            netlog.line = NETLOG_LINE_KEEP;
+        }
+        if (netlog.line == NETLOG_LINE_KEEP || netlog.line == NETLOG_LINE_DROP) {
+            end = memchr(log, '\n', size);
+            len = end ? (size_t) (end - log) + 1 : size;
+        } else {
+            /* the colour sequence a byte at a time, the level letter follows its 'm' */
+            len = 1;
+            netlog.line = netlog.line == NETLOG_LINE_CSI && *log == 'm' ? NETLOG_LINE_START : NETLOG_LINE_CSI;
+        }
+        if (netlog.line != NETLOG_LINE_DROP) {
+            netlog_copy(log, len);
+        }
+        if (end) {
+            if (netlog.line == NETLOG_LINE_KEEP) {
+                netlog_line_end();
+            }
+            netlog.line = NETLOG_LINE_START;
+            netlog.limit = BOOT_NETLOG_TEXT_SIZE;
+        }
+        log += len;
+        size -= len;
+    }
+}
+
+/**
+ * send the whole lines of the open frame when nothing waits in the queue, e.g. before the log goes quiet
+ */
+void boot_netlog_flush(void) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (netlog.on && netlog.frame && netlog.line_start && !esp_spi_tx_pending()) {
+        netlog_send();
+    }
+    __set_PRIMASK(primask);
+}
+
+void boot_netlog_get_stats(boot_netlog_stats *stats) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    *stats = netlog.stats;
+    __set_PRIMASK(primask);
+}
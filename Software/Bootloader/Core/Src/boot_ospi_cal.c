@@ -0,0 +1,395 @@
+/**
+ * @file boot_ospi_cal.c
+ * @brief OCTOSPI1 read timing calibration of the MAIN flash, see boot_ospi_cal.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_OSPI_CAL
+
+#include "boot_ospi_cal.h"
+#include "boot_clock.h"
+#include "boot_cmp.h"
+#include "boot_image.h"
+#include "boot_slot.h"
+#include "main.h"
+#include "octospi.h"
+#include "elog.h"
+#include <stddef.h>
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "ospi_cal");
+
+/* DLYB CFGR SEL of the length measurement, 12 delay cells, and its last output clock phase */
+#define CAL_DLYB_SEL_LENGTH             12
+#define CAL_DLYB_SEL_MAX                11
+#define CAL_DLYB_UNIT_MAX               127
+#define CAL_DLYB_TIMEOUT_MS             2
+#define CAL_BLOCK_SIZE                  256
+
+extern sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash);
+extern sfud_err qspi_exit_memory_mapped_mode(sfud_flash *flash);
+extern void qspi_set_sample_shift(sfud_flash *flash, bool shift);
+
+/* AXI SRAM, the MDMA of the indirect read reaches it */
+static uint8_t cal_pattern[BOOT_OSPI_CAL_PATTERN_SIZE] __attribute__((aligned(32)));
+static uint8_t cal_buf[BOOT_OSPI_CAL_PATTERN_SIZE] __attribute__((aligned(32)));
+
+/**
+ * the pattern, 256-byte blocks of all-0/all-1, 0x55/0xAA, walking ones and zeros and LFSR bytes,
+ * the first ones toggle every data line at each clock, the last ones are data of no order
+ */
+static void cal_pattern_make(uint8_t *pattern) {
+    uint32_t lfsr = 0xACE1;
+    size_t i, block;
+
+    for (i = 0; i < BOOT_OSPI_CAL_PATTERN_SIZE; i++) {
+        block = i / CAL_BLOCK_SIZE;
+        switch (block) {
+        case 0:
+            pattern[i] = i & 1 ? 0xFF : 0x00;
+            break;
+        case 1:
+            pattern[i] = i & 1 ? 0xAA : 0x55;
+            break;
+        case 2:
+            pattern[i] = (uint8_t) (1U << (i % 8));
+            break;
+        case 3:
+            pattern[i] = (uint8_t) ~(1U << (i % 8));
+            break;
+        default:
+            /* x^16 + x^14 + x^13 + x^11 + 1 */
+            lfsr = (lfsr >> 1) ^ (-(lfsr & 1U) & 0xB400U);
+            pattern[i] = (uint8_t) lfsr;
+            break;
+        }
+    }
+}
+
+static uint8_t cal_prescaler_min(uint32_t kernel) {
+    uint32_t prescaler = (kernel + BOOT_OSPI_CAL_MAX_HZ - 1) / BOOT_OSPI_CAL_MAX_HZ;
+
+    return (uint8_t) (prescaler ? prescaler : 1);
+}
+
+/* the one of boot_clock_retime() */
+static uint8_t cal_prescaler_default(uint32_t kernel) {
+    return (uint8_t) ((kernel + BOOT_CLOCK_OSPI_MAX_HZ - 1) / BOOT_CLOCK_OSPI_MAX_HZ);
+}
+
+static void cal_point_default(boot_ospi_cal_point *point, uint32_t kernel) {
+    memset(point, 0, sizeof(boot_ospi_cal_point));
+    point->prescaler = cal_prescaler_default(kernel);
+    point->sample_shift = 1;
+}
+
+static void cal_prescaler_set(uint8_t prescaler) {
+    while (READ_BIT(hospi1.Instance->SR, OCTOSPI_SR_BUSY)) {
+    }
+    hospi1.Init.ClockPrescaler = prescaler;
+    MODIFY_REG(hospi1.Instance->DCR2, OCTOSPI_DCR2_PRESCALER, (prescaler - 1U) << OCTOSPI_DCR2_PRESCALER_Pos);
+}
+
+/**
+ * the configuration of the delay block can only be written with SEN set, DEN keeps it running
+ */
+static void cal_dlyb_config(uint8_t sel, uint8_t unit) {
+    DLYB_OCTOSPI1->CR = DLYB_CR_DEN | DLYB_CR_SEN;
+    DLYB_OCTOSPI1->CFGR = ((uint32_t) sel << DLYB_CFGR_SEL_Pos) | ((uint32_t) unit << DLYB_CFGR_UNIT_Pos);
+    DLYB_OCTOSPI1->CR = DLYB_CR_DEN;
+}
+
+static void cal_dlyb_use(bool use) {
+    while (READ_BIT(hospi1.Instance->SR, OCTOSPI_SR_BUSY)) {
+    }
+    if (use) {
+        CLEAR_BIT(hospi1.Instance->DCR1, OCTOSPI_DCR1_DLYBYP);
+        hospi1.Init.DelayBlockBypass = HAL_OSPI_DELAY_BLOCK_USED;
+    } else {
+        SET_BIT(hospi1.Instance->DCR1, OCTOSPI_DCR1_DLYBYP);
+        hospi1.Init.DelayBlockBypass = HAL_OSPI_DELAY_BLOCK_BYPASSED;
+        DLYB_OCTOSPI1->CR = 0;
+    }
+}
+
+/**
+ * size the delay unit to one period of the OCTOSPI clock of the current prescaler (RM0468, DLYB)
+ *
+ * @param unit the UNIT of 12 cells over one period out
+ * @param sel_max the last valid output clock phase out
+ *
+ * @return false: no unit is long enough, the clock is too slow for the delay line
+ */
+static bool cal_dlyb_measure(uint8_t *unit, uint8_t *sel_max) {
+    uint32_t lng = 0, start;
+    uint8_t sel;
+    bool found = false;
+
+    /* the delay line measures the clock of the flash, it must run between the commands too */
+    while (READ_BIT(hospi1.Instance->SR, OCTOSPI_SR_BUSY)) {
+    }
+    SET_BIT(hospi1.Instance->DCR1, OCTOSPI_DCR1_FRCK);
+    cal_dlyb_use(true);
+    DLYB_OCTOSPI1->CR = DLYB_CR_DEN | DLYB_CR_SEN;
+    for (uint32_t u = 0; u <= CAL_DLYB_UNIT_MAX && !found; u++) {
+        DLYB_OCTOSPI1->CFGR = ((uint32_t) CAL_DLYB_SEL_LENGTH << DLYB_CFGR_SEL_Pos) | (u << DLYB_CFGR_UNIT_Pos);
+        start = HAL_GetTick();
+        while (!READ_BIT(DLYB_OCTOSPI1->CFGR, DLYB_CFGR_LNGF)) {
+            if (HAL_GetTick() - start > CAL_DLYB_TIMEOUT_MS) {
+                break;
+            }
+        }
+        lng = (DLYB_OCTOSPI1->CFGR & DLYB_CFGR_LNG) >> DLYB_CFGR_LNG_Pos;
+        /* one period in the line: some cell is set and the first edge isn't in the last 2 cells */
+        if (READ_BIT(DLYB_OCTOSPI1->CFGR, DLYB_CFGR_LNGF) && lng != 0 && (lng & 0xC00) != 0xC00) {
+            *unit = (uint8_t) u;
+            found = true;
+        }
+    }
+    DLYB_OCTOSPI1->CR = DLYB_CR_DEN;
+    while (READ_BIT(hospi1.Instance->SR, OCTOSPI_SR_BUSY)) {
+    }
+    CLEAR_BIT(hospi1.Instance->DCR1, OCTOSPI_DCR1_FRCK);
+    if (!found) {
+        return false;
+    }
+    /* the highest cell set is where the period ends */
+    for (sel = CAL_DLYB_SEL_MAX - 1; sel > 0 && !(lng & (1U << sel)); sel--) {
+    }
+    *sel_max = sel;
+    return sel > 0;
+}
+
+static void cal_point_set(sfud_flash *flash, const boot_ospi_cal_point *point) {
+    cal_prescaler_set(point->prescaler);
+    qspi_set_sample_shift(flash, point->sample_shift != 0);
+    if (point->dlyb) {
+        cal_dlyb_config(point->dlyb_sel, point->dlyb_unit);
+    }
+    cal_dlyb_use(point->dlyb != 0);
+}
+
+/**
+ * read the pattern BOOT_OSPI_CAL_PASSES times by the indirect read and through the window
+ *
+ * @note the SFUD read cache is left out, spi.qspi_read() reads the flash each time
+ */
+static bool cal_check(sfud_flash *flash) {
+    const uint8_t *mapped = (const uint8_t *) (OCTOSPI1_BASE + BOOT_OSPI_CAL_ADDR);
+    bool same;
+
+    for (size_t pass = 0; pass < BOOT_OSPI_CAL_PASSES; pass++) {
+        memset(cal_buf, 0, sizeof(cal_buf));
+        if (flash->spi.qspi_read(&flash->spi, BOOT_OSPI_CAL_ADDR, &flash->read_cmd_format, cal_buf,
+                                 sizeof(cal_buf)) != SFUD_SUCCESS
+                || !boot_cmp_equal(cal_buf, cal_pattern, sizeof(cal_buf))) {
+            return false;
+        }
+        if (qspi_entry_memory_mapped_mode(flash) != SFUD_SUCCESS) {
+            return false;
+        }
+        /* the lines of an earlier pass would hide the fetch */
+        SCB_InvalidateDCache_by_Addr((void *) mapped, BOOT_OSPI_CAL_PATTERN_SIZE);
+        same = boot_cmp_equal(mapped, cal_pattern, BOOT_OSPI_CAL_PATTERN_SIZE);
+        if (qspi_exit_memory_mapped_mode(flash) != SFUD_SUCCESS || !same) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * the good phases of the delay block at the current prescaler, the middle of the longest run of them
+ */
+static bool cal_dlyb_sweep(sfud_flash *flash, boot_ospi_cal_point *point) {
+    uint8_t unit, sel_max, run = 0, best = 0, best_end = 0;
+
+    if (!cal_dlyb_measure(&unit, &sel_max)) {
+        elog_d(TAG, "prescaler %u: no delay unit of one period", point->prescaler);
+        return false;
+    }
+    /* the delay block stands for the half-cycle shift */
+    qspi_set_sample_shift(flash, false);
+    for (uint8_t sel = 0; sel <= sel_max; sel++) {
+        cal_dlyb_config(sel, unit);
+        if (cal_check(flash)) {
+            run++;
+            if (run > best) {
+                best = run;
+                best_end = sel;
+            }
+        } else {
+            run = 0;
+        }
+    }
+    elog_d(TAG, "prescaler %u: unit %u, %u of %u phases good", point->prescaler, unit, best, sel_max + 1);
+    if (best < 2 * BOOT_OSPI_CAL_MARGIN + 1) {
+        return false;
+    }
+    point->sample_shift = 0;
+    point->dlyb = 1;
+    point->dlyb_unit = unit;
+    point->dlyb_sel = (uint8_t) (best_end + 1 - best + best / 2);
+    point->dlyb_window = best;
+    return true;
+}
+
+/**
+ * sweep the timing points of the MAIN flash, the pattern must be in place, see boot_ospi_cal.h
+ *
+ * @param flash MAIN flash, in indirect mode
+ * @param point the stable point taken out, the default one when none is
+ *
+ * @return false: even the default point failed, it is set anyway
+ */
+bool boot_ospi_cal_run(sfud_flash *flash, boot_ospi_cal_point *point) {
+    uint32_t kernel = boot_clock_ospi_hz();
+    uint8_t prescaler_default = cal_prescaler_default(kernel);
+    bool shift, no_shift;
+
+    for (uint8_t prescaler = cal_prescaler_min(kernel); prescaler <= prescaler_default; prescaler++) {
+        cal_point_default(point, kernel);
+        point->prescaler = prescaler;
+        cal_point_set(flash, point);
+        /* the sampling that needs no delay block first, it holds for half a cycle either way */
+        shift = cal_check(flash);
+        qspi_set_sample_shift(flash, false);
+        no_shift = cal_check(flash);
+        qspi_set_sample_shift(flash, true);
+        if (shift && no_shift) {
+            return true;
+        }
+        if (cal_dlyb_sweep(flash, point)) {
+            cal_point_set(flash, point);
+            return true;
+        }
+        cal_dlyb_use(false);
+        qspi_set_sample_shift(flash, true);
+    }
+    cal_point_default(point, kernel);
+    cal_point_set(flash, point);
+    return cal_check(flash);
+}
+
+static uint32_t record_crc(const boot_ospi_cal_record *record) {
+    return boot_image_crc32(0, record, offsetof(boot_ospi_cal_record, crc));
+}
+
+static bool record_matches(const sfud_flash *flash, const boot_ospi_cal_record *record, uint32_t kernel) {
+    return record->magic == BOOT_OSPI_CAL_MAGIC && record->version == BOOT_OSPI_CAL_VERSION
+            && record->size == sizeof(boot_ospi_cal_record) && record->crc == record_crc(record)
+            && record->kernel_hz == kernel && record->jedec_id[0] == flash->chip.mf_id
+            && record->jedec_id[1] == flash->chip.type_id && record->jedec_id[2] == flash->chip.capacity_id
+            && record->read_instruction == flash->read_cmd_format.instruction
+            && record->point.prescaler >= cal_prescaler_min(kernel)
+            && record->point.prescaler <= cal_prescaler_default(kernel)
+            && (!record->point.dlyb || (record->point.dlyb_sel <= CAL_DLYB_SEL_MAX
+                                        && record->point.dlyb_unit <= CAL_DLYB_UNIT_MAX));
+}
+
+/**
+ * erase the sector, then program the pattern and the record, at the default timing
+ */
+static bool cal_store(const sfud_flash *flash, const boot_ospi_cal_record *record) {
+    if (sfud_erase(flash, BOOT_OSPI_CAL_ADDR, BOOT_OSPI_CAL_SECTOR_SIZE) != SFUD_SUCCESS
+            || sfud_write(flash, BOOT_OSPI_CAL_ADDR, BOOT_OSPI_CAL_PATTERN_SIZE, cal_pattern) != SFUD_SUCCESS) {
+        return false;
+    }
+    return !record || sfud_write(flash, BOOT_OSPI_CAL_RECORD_ADDR, sizeof(boot_ospi_cal_record),
+                                 (const uint8_t *) record) == SFUD_SUCCESS;
+}
+
+/**
+ * the flash is in the slot layout of boot_slot.h: a slot record or a valid slot header, else 0x8000 may be the code
+ * of a pre-slot image, which runs from the flash start
+ */
+static bool cal_layout_in_use(const sfud_flash *flash) {
+    boot_slot_record slot_record;
+    boot_image_header header;
+
+    if (boot_slot_record_read(flash, &slot_record) == SFUD_SUCCESS) {
+        return true;
+    }
+    for (uint8_t slot = 0; slot < BOOT_SLOT_NUM; slot++) {
+        if (sfud_read(flash, boot_slot_addr(slot), sizeof(header), (uint8_t *) &header) == SFUD_SUCCESS
+                && boot_image_header_check(&header, OCTOSPI1_BASE + boot_slot_addr(slot), BOOT_SLOT_SIZE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void cal_report(const char *what, const boot_ospi_cal_point *point, uint32_t kernel) {
+    unsigned khz = (unsigned) (kernel / point->prescaler / 1000U);
+
+    if (point->dlyb) {
+        elog_i(TAG, "%s: %u.%03u MHz, delay block phase %u of unit %u, %u good", what, khz / 1000, khz % 1000,
+               point->dlyb_sel, point->dlyb_unit, point->dlyb_window);
+    } else {
+        elog_i(TAG, "%s: %u.%03u MHz, %s sampling", what, khz / 1000, khz % 1000,
+               point->sample_shift ? "half-cycle" : "unshifted");
+    }
+}
+
+/**
+ * set the calibrated read timing of the MAIN flash, calibrate it first when no stored one fits
+ *
+ * @param flash MAIN flash, its fast read enabled, SYSCLK on the PLL
+ *
+ * @return false: the flash is left at the default timing
+ */
+bool boot_ospi_cal_apply(sfud_flash *flash) {
+    uint32_t kernel = boot_clock_ospi_hz();
+    boot_ospi_cal_point point;
+    boot_ospi_cal_record record;
+
+    if (!flash || !flash->init_ok) {
+        return false;
+    }
+    cal_pattern_make(cal_pattern);
+    if (sfud_read(flash, BOOT_OSPI_CAL_RECORD_ADDR, sizeof(record), (uint8_t *) &record) == SFUD_SUCCESS
+            && record_matches(flash, &record, kernel)) {
+        cal_point_set(flash, &record.point);
+        if (cal_check(flash)) {
+            cal_report("stored timing", &record.point, kernel);
+            return true;
+        }
+        elog_w(TAG, "stored timing fails, calibrating again");
+    }
+
+    cal_point_default(&point, kernel);
+    cal_point_set(flash, &point);
+    /* the sector is erased and programmed from here on */
+    if (!cal_layout_in_use(flash)) {
+        elog_w(TAG, "no slot layout, 0x%06x left alone, default timing", (unsigned) BOOT_OSPI_CAL_ADDR);
+        return false;
+    }
+    if (!cal_check(flash) && (!cal_store(flash, NULL) || !cal_check(flash))) {
+        elog_e(TAG, "no pattern at 0x%06x, default timing", (unsigned) BOOT_OSPI_CAL_ADDR);
+        return false;
+    }
+    if (!boot_ospi_cal_run(flash, &point)) {
+        elog_e(TAG, "default timing fails the pattern");
+        return false;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.magic = BOOT_OSPI_CAL_MAGIC;
+    record.version = BOOT_OSPI_CAL_VERSION;
+    record.size = sizeof(record);
+    record.kernel_hz = kernel;
+    record.jedec_id[0] = flash->chip.mf_id;
+    record.jedec_id[1] = flash->chip.type_id;
+    record.jedec_id[2] = flash->chip.capacity_id;
+    record.read_instruction = flash->read_cmd_format.instruction;
+    record.point = point;
+    record.crc = record_crc(&record);
+
+    /* the erase and program read the status back, at the timing known to hold */
+    cal_point_default(&point, kernel);
+    cal_point_set(flash, &point);
+    if (!cal_store(flash, &record)) {
+        elog_w(TAG, "calibration not stored");
+    }
+    cal_point_set(flash, &record.point);
+    cal_report("calibrated", &record.point, kernel);
+    return true;
+}
@@ -0,0 +1,319 @@
+/**
+ * @file boot_ospi_chain.c
+ * @brief Page programs of the MAIN flash by an MDMA linked list, see boot_ospi_chain.h.
+ */
+#include "boot_ospi_chain.h"
+#include "dma_alloc.h"
+#include <string.h>
+
+/* channel 0 serves the OCTOSPI1 FIFO, 1 the CRC unit, 2 the scatter loader, 3 boot_mem.h */
+#define CHAIN_MDMA_CHANNEL              MDMA_Channel4
+#define CHAIN_FLAGS                     (MDMA_CIFCR_CTEIF | MDMA_CIFCR_CCTCIF | MDMA_CIFCR_CBRTIF | MDMA_CIFCR_CBTIF \
+                                         | MDMA_CIFCR_CLTCIF)
+/* the memory-mapped window of each OCTOSPI, from OCTOSPI1_BASE and OCTOSPI2_BASE */
+#define CHAIN_OSPI_WINDOW_SIZE          0x10000000UL
+/* OCTOSPI clocks between the status reads, BOOT_PART_POLL_INTERVAL of boot_part.hpp */
+#define CHAIN_POLL_INTERVAL             0x10
+
+/* the nodes of one page, in the order of boot_ospi_chain.h */
+enum {
+    NODE_WREN = 0,
+    NODE_PROGRAM,
+    NODE_DLR,
+    NODE_AR,
+    NODE_DATA,
+    NODE_STATUS,
+    NODE_DLR_STATUS,
+    NODE_POLL,
+    NODE_WRITE,
+    NODE_NUM,
+};
+
+/* the per-page words the register nodes write */
+typedef struct {
+    uint32_t dlr;                                /**< page bytes - 1 */
+    uint32_t ar;                                 /**< page address */
+} chain_page;
+
+/* the words of the register nodes, the same for all pages */
+typedef struct {
+    uint32_t ccr_cmd;
+    uint32_t ccr_program;
+    uint32_t ccr_status;
+    uint32_t zero;
+    uint32_t cr_poll;
+    uint32_t cr_write;
+} chain_regs;
+
+/* in the DTCM, the MDMA reaches it by the AHBS and the D-Cache is off the path: the CPU writes the nodes and the
+ * words with no cache maintenance, dma_prepare_tx() cleans the page data only */
+static MDMA_LinkNodeTypeDef chain_nodes[BOOT_OSPI_CHAIN_PAGES][NODE_NUM]
+        __attribute__((section(".dtcm_bss"), aligned(8)));
+static chain_page chain_pages[BOOT_OSPI_CHAIN_PAGES] __attribute__((section(".dtcm_bss")));
+static chain_regs chain_reg __attribute__((section(".dtcm_bss")));
+/* the list is built for this OCTOSPI and program instruction, NULL: not built */
+static OCTOSPI_TypeDef *chain_ospi;
+static uint8_t chain_cmd;
+static volatile bool chain_busy;
+static volatile bool chain_failed;
+
+/**
+ * a node which writes one word to an OCTOSPI register, and the mask word behind it when mask_addr isn't 0
+ */
+static bool node_make(MDMA_LinkNodeTypeDef *node, uint32_t request, const void *src, volatile uint32_t *dst,
+                      volatile uint32_t *mask_addr, uint32_t mask_data) {
+    MDMA_LinkNodeConfTypeDef config;
+
+    memset(&config, 0, sizeof(config));
+    config.Init.Request = request;
+    config.Init.TransferTriggerMode = MDMA_BLOCK_TRANSFER;
+    config.Init.Priority = MDMA_PRIORITY_HIGH;
+    config.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    config.Init.SourceInc = MDMA_SRC_INC_DISABLE;
+    config.Init.DestinationInc = MDMA_DEST_INC_DISABLE;
+    config.Init.SourceDataSize = MDMA_SRC_DATASIZE_WORD;
+    config.Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    config.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    config.Init.BufferTransferLength = 4;
+    config.Init.SourceBurst = MDMA_SOURCE_BURST_SINGLE;
+    config.Init.DestBurst = MDMA_DEST_BURST_SINGLE;
+    config.SrcAddress = (uint32_t) (uintptr_t) src;
+    config.DstAddress = (uint32_t) (uintptr_t) dst;
+    config.BlockDataLength = 4;
+    config.BlockCount = 1;
+    config.PostRequestMaskAddress = (uint32_t) (uintptr_t) mask_addr;
+    config.PostRequestMaskData = mask_data;
+    return HAL_MDMA_LinkedList_CreateNode(node, &config) == HAL_OK;
+}
+
+/* the data node: the page to DR, a beat per FIFO threshold request */
+static bool node_data(MDMA_LinkNodeTypeDef *node, OCTOSPI_TypeDef *o) {
+    MDMA_LinkNodeConfTypeDef config;
+
+    memset(&config, 0, sizeof(config));
+    config.Init.Request = MDMA_REQUEST_OCTOSPI1_FIFO_TH;
+    config.Init.TransferTriggerMode = MDMA_BUFFER_TRANSFER;
+    config.Init.Priority = MDMA_PRIORITY_HIGH;
+    config.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    config.Init.SourceInc = MDMA_SRC_INC_WORD;
+    config.Init.DestinationInc = MDMA_DEST_INC_DISABLE;
+    config.Init.SourceDataSize = MDMA_SRC_DATASIZE_WORD;
+    config.Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    config.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    config.Init.BufferTransferLength = BOOT_OSPI_CHAIN_BEAT;
+    config.Init.SourceBurst = MDMA_SOURCE_BURST_SINGLE;
+    config.Init.DestBurst = MDMA_DEST_BURST_SINGLE;
+    /* patched by each chain */
+    config.SrcAddress = (uint32_t) (uintptr_t) chain_pages;
+    config.DstAddress = (uint32_t) (uintptr_t) &o->DR;
+    config.BlockDataLength = BOOT_OSPI_CHAIN_PAGE_MAX;
+    config.BlockCount = 1;
+    return HAL_MDMA_LinkedList_CreateNode(node, &config) == HAL_OK;
+}
+
+/**
+ * build the nodes of all the pages, linked in one list
+ */
+static bool chain_build(OCTOSPI_TypeDef *o, uint8_t program_cmd) {
+    volatile uint32_t *fcr = &o->FCR;
+
+    chain_ospi = NULL;
+    for (uint32_t i = 0; i < BOOT_OSPI_CHAIN_PAGES; i++) {
+        MDMA_LinkNodeTypeDef *node = chain_nodes[i];
+
+        if (!node_make(&node[NODE_WREN], MDMA_REQUEST_OCTOSPI1_FIFO_TH, &chain_reg.ccr_cmd, &o->CCR, &o->IR,
+                       SFUD_CMD_WRITE_ENABLE)
+                || !node_make(&node[NODE_PROGRAM], MDMA_REQUEST_OCTOSPI1_TC, &chain_reg.ccr_program, &o->CCR, fcr,
+                              OCTOSPI_FCR_CTCF)
+                || !node_make(&node[NODE_DLR], MDMA_REQUEST_OCTOSPI1_FIFO_TH, &chain_pages[i].dlr, &o->DLR, &o->IR,
+                              program_cmd)
+                || !node_make(&node[NODE_AR], MDMA_REQUEST_OCTOSPI1_FIFO_TH, &chain_pages[i].ar, &o->AR, NULL, 0)
+                || !node_data(&node[NODE_DATA], o)
+                || !node_make(&node[NODE_STATUS], MDMA_REQUEST_OCTOSPI1_TC, &chain_reg.ccr_status, &o->CCR, fcr,
+                              OCTOSPI_FCR_CTCF)
+                || !node_make(&node[NODE_DLR_STATUS], MDMA_REQUEST_OCTOSPI1_FIFO_TH, &chain_reg.zero, &o->DLR, NULL,
+                              0)
+                || !node_make(&node[NODE_POLL], MDMA_REQUEST_OCTOSPI1_FIFO_TH, &chain_reg.cr_poll, &o->CR, &o->IR,
+                              SFUD_CMD_READ_STATUS_REGISTER)
+                || !node_make(&node[NODE_WRITE], MDMA_REQUEST_OCTOSPI1_TC, &chain_reg.cr_write, &o->CR, fcr,
+                              OCTOSPI_FCR_CTCF | OCTOSPI_FCR_CSMF)) {
+            return false;
+        }
+        for (uint32_t k = 0; k + 1 < NODE_NUM; k++) {
+            node[k].CLAR = (uint32_t) (uintptr_t) &node[k + 1];
+        }
+        node[NODE_WRITE].CLAR = i + 1 < BOOT_OSPI_CHAIN_PAGES ? (uint32_t) (uintptr_t) &chain_nodes[i + 1][0] : 0;
+    }
+    chain_ospi = o;
+    chain_cmd = program_cmd;
+    return true;
+}
+
+/* the pages of [addr, addr + size), 0 when they are more than a list */
+static uint32_t chain_page_num(const boot_ospi_chain_desc *desc, uint32_t addr, size_t size) {
+    uint64_t end = (uint64_t) addr + size, first = addr - addr % desc->page_size;
+    uint64_t num = (end - first + desc->page_size - 1) / desc->page_size;
+
+    return num <= BOOT_OSPI_CHAIN_PAGES ? (uint32_t) num : 0;
+}
+
+/**
+ * the range can go to one chain: whole words, word aligned, in a list, data out of the flash windows
+ */
+bool boot_ospi_chain_fits(const boot_ospi_chain_desc *desc, uint32_t addr, size_t size, const uint8_t *data) {
+    uintptr_t buf = (uintptr_t) data;
+
+    return size && !((addr | size | buf) & 3U) && desc->page_size <= BOOT_OSPI_CHAIN_PAGE_MAX
+            && desc->page_size % 4 == 0 && buf - OCTOSPI1_BASE >= CHAIN_OSPI_WINDOW_SIZE
+            && buf - OCTOSPI2_BASE >= CHAIN_OSPI_WINDOW_SIZE && chain_page_num(desc, addr, size);
+}
+
+/* point the data node of a page at its bytes, the source bus by the address like the HAL does */
+static void chain_data_patch(MDMA_LinkNodeTypeDef *node, const uint8_t *data, uint32_t n) {
+    uint32_t src = (uint32_t) (uintptr_t) data;
+
+    node->CSAR = src;
+    node->CBNDTR = (node->CBNDTR & ~MDMA_CBNDTR_BNDT) | n;
+    if ((src & 0xFF000000UL) == 0x20000000UL || (src & 0xFF000000UL) == 0x00000000UL) {
+        node->CTBR |= MDMA_CTBR_SBUS;
+    } else {
+        node->CTBR &= ~MDMA_CTBR_SBUS;
+    }
+}
+
+static void chain_abort(OCTOSPI_TypeDef *o) {
+    MDMA_Channel_TypeDef *channel = CHAIN_MDMA_CHANNEL;
+
+    channel->CCR &= ~(MDMA_CCR_EN | MDMA_CCR_CTCIE | MDMA_CCR_TEIE);
+    while (channel->CCR & MDMA_CCR_EN) {
+    }
+    channel->CIFCR = CHAIN_FLAGS;
+    o->CR |= OCTOSPI_CR_ABORT;
+    while (o->CR & OCTOSPI_CR_ABORT) {
+    }
+    chain_busy = false;
+}
+
+/**
+ * program the pages of [addr, addr + size) by one chain, the range erased and boot_ospi_chain_fits()
+ *
+ * @param ospi OCTOSPI in indirect mode, not busy
+ * @param timeout_ms the whole chain
+ *
+ * @return SFUD_ERR_TIMEOUT: the chain is aborted, the pages are to be programmed again by the CPU;
+ *         SFUD_ERR_WRITE: the MDMA can't take the list or failed on it
+ */
+sfud_err boot_ospi_chain_program(OCTOSPI_TypeDef *ospi, const boot_ospi_chain_desc *desc, uint32_t addr,
+                                 size_t size, const uint8_t *data, uint32_t timeout_ms) {
+    MDMA_Channel_TypeDef *channel = CHAIN_MDMA_CHANNEL;
+    MDMA_LinkNodeTypeDef *first = &chain_nodes[0][0], *last;
+    uint32_t pages = chain_page_num(desc, addr, size), n, start;
+    const uint8_t *src = data;
+    sfud_err result = SFUD_SUCCESS;
+
+    if (!boot_ospi_chain_fits(desc, addr, size, data)) {
+        return SFUD_ERR_WRITE;
+    }
+    __HAL_RCC_MDMA_CLK_ENABLE();
+    if ((chain_ospi != ospi || chain_cmd != desc->program_cmd) && !chain_build(ospi, desc->program_cmd)) {
+        return SFUD_ERR_WRITE;
+    }
+
+    chain_reg.ccr_cmd = desc->ccr_cmd;
+    chain_reg.ccr_program = desc->ccr_program;
+    chain_reg.ccr_status = desc->ccr_status;
+    chain_reg.zero = 0;
+    chain_reg.cr_write = (desc->cr & ~(OCTOSPI_CR_FMODE | OCTOSPI_CR_FTHRES | OCTOSPI_CR_PMM))
+                         | ((BOOT_OSPI_CHAIN_BEAT - 1) << OCTOSPI_CR_FTHRES_Pos) | OCTOSPI_CR_DMAEN;
+    chain_reg.cr_poll = chain_reg.cr_write | OCTOSPI_CR_FMODE_1 | OCTOSPI_CR_APMS;
+    for (uint32_t i = 0; i < pages; i++) {
+        n = desc->page_size - addr % desc->page_size;
+        if (n > size) {
+            n = size;
+        }
+        chain_pages[i].dlr = n - 1;
+        chain_pages[i].ar = addr;
+        chain_data_patch(&chain_nodes[i][NODE_DATA], src, n);
+        addr += n;
+        src += n;
+        size -= n;
+    }
+    last = &chain_nodes[pages - 1][NODE_WRITE];
+    last->CLAR = 0;
+    dma_prepare_tx(data, (size_t) (src - data));
+
+    /* the registers all the commands share, TCF and SMF of the commands before cleared */
+    while (ospi->SR & OCTOSPI_SR_BUSY) {
+    }
+    ospi->CR = chain_reg.cr_write;
+    ospi->TCR = desc->tcr;
+    ospi->PSMKR = SFUD_STATUS_REGISTER_BUSY;
+    ospi->PSMAR = 0;
+    ospi->PIR = CHAIN_POLL_INTERVAL;
+    ospi->FCR = OCTOSPI_FCR_CTCF | OCTOSPI_FCR_CTEF | OCTOSPI_FCR_CSMF;
+
+    chain_failed = false;
+    chain_busy = true;
+    /* shared with the OCTOSPI1 FIFO channel, HAL_OSPI_MspInit() sets the same */
+    HAL_NVIC_SetPriority(MDMA_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(MDMA_IRQn);
+    channel->CCR = 0;
+    channel->CIFCR = CHAIN_FLAGS;
+    channel->CTCR = first->CTCR;
+    channel->CBNDTR = first->CBNDTR;
+    channel->CSAR = first->CSAR;
+    channel->CDAR = first->CDAR;
+    channel->CBRUR = first->CBRUR;
+    channel->CLAR = first->CLAR;
+    channel->CTBR = first->CTBR;
+    channel->CMAR = first->CMAR;
+    channel->CMDR = first->CMDR;
+    channel->CCR = MDMA_PRIORITY_HIGH | MDMA_CCR_CTCIE | MDMA_CCR_TEIE | MDMA_CCR_EN;
+
+    start = HAL_GetTick();
+    while (chain_busy) {
+        if (HAL_GetTick() - start > timeout_ms) {
+            chain_abort(ospi);
+            result = SFUD_ERR_TIMEOUT;
+            break;
+        }
+        if (__get_PRIMASK()) {
+            /* called with the interrupts masked, serve the handler here */
+            boot_ospi_chain_irq_handler();
+        } else {
+            __WFI();
+        }
+    }
+    if (result == SFUD_SUCCESS && chain_failed) {
+        chain_abort(ospi);
+        result = SFUD_ERR_WRITE;
+    }
+    if (result == SFUD_SUCCESS && (ospi->SR & OCTOSPI_SR_TEF)) {
+        result = SFUD_ERR_WRITE;
+    }
+    ospi->FCR = OCTOSPI_FCR_CTCF | OCTOSPI_FCR_CTEF | OCTOSPI_FCR_CSMF;
+    ospi->CR = desc->cr & ~OCTOSPI_CR_DMAEN;
+    if (pages < BOOT_OSPI_CHAIN_PAGES) {
+        last->CLAR = (uint32_t) (uintptr_t) &chain_nodes[pages][0];
+    }
+
+    return result;
+}
+
+/**
+ * from MDMA_IRQHandler(), the interrupt of all the channels
+ */
+void boot_ospi_chain_irq_handler(void) {
+    MDMA_Channel_TypeDef *channel = CHAIN_MDMA_CHANNEL;
+    uint32_t isr;
+
+    if (!chain_busy) {
+        return;
+    }
+    isr = channel->CISR;
+    if (isr & (MDMA_CISR_TEIF | MDMA_CISR_CTCIF)) {
+        channel->CIFCR = CHAIN_FLAGS;
+        chain_failed = (isr & MDMA_CISR_TEIF) != 0;
+        chain_busy = false;
+    }
+}
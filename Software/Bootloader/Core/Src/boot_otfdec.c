@@ -0,0 +1,102 @@
+/**
+ * @file boot_otfdec.c
+ * @brief On-the-fly decryption of encrypted XIP images by OTFDEC1, see boot_otfdec.h.
+ */
+#include "boot_otfdec.h"
+#include "main.h"
+#include <string.h>
+
+/* OTFDEC region granularity */
+#define OTFDEC_REGION_ALIGN             0x1000UL
+
+/**
+ * load a key into a disabled region, the OTFDEC computes its KEYCRC meanwhile
+ *
+ * @return KEYCRC of the key
+ */
+static uint8_t otfdec_key_load(OTFDEC_Region_TypeDef *region, const uint32_t key[4]) {
+    region->REG_KEYR0 = key[0];
+    region->REG_KEYR1 = key[1];
+    region->REG_KEYR2 = key[2];
+    region->REG_KEYR3 = key[3];
+
+    return (uint8_t) ((region->REG_CONFIGR & OTFDEC_REG_CONFIGR_KEYCRC_Msk) >> OTFDEC_REG_CONFIGR_KEYCRC_Pos);
+}
+
+/**
+ * program the key record, once, the last flash word must still be erased
+ *
+ * @param key AES-128 key, [0] is KEYR0
+ *
+ * @return false: already provisioned or programming failed
+ */
+bool boot_otfdec_key_provision(const uint32_t key[4]) {
+    const boot_otfdec_key_record *stored = (const boot_otfdec_key_record *) BOOT_OTFDEC_KEY_ADDR;
+    boot_otfdec_key_record record __attribute__((aligned(32)));
+    static const uint32_t zero_key[4] = {0};
+    HAL_StatusTypeDef status;
+
+    if (stored->magic != 0xFFFFFFFF) {
+        return false;
+    }
+
+    memset(&record, 0xFF, sizeof(record));
+    memcpy(record.key, key, sizeof(record.key));
+    record.magic = BOOT_OTFDEC_KEY_MAGIC;
+    /* region 4 is never used, the key does not stay there */
+    __HAL_RCC_OTFDEC1_CLK_ENABLE();
+    record.key_crc = otfdec_key_load(OTFDEC1_REGION4, key);
+    otfdec_key_load(OTFDEC1_REGION4, zero_key);
+
+    HAL_FLASH_Unlock();
+    status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, BOOT_OTFDEC_KEY_ADDR, (uint32_t) (uintptr_t) &record);
+    HAL_FLASH_Lock();
+    memset(&record, 0, sizeof(record));
+    /* the CPU may have cached the erased word */
+    SCB_InvalidateDCache_by_Addr((void *) BOOT_OTFDEC_KEY_ADDR, sizeof(boot_otfdec_key_record));
+
+    return status == HAL_OK && stored->magic == BOOT_OTFDEC_KEY_MAGIC;
+}
+
+/**
+ * decrypt the encrypted image of a slot on the fly and lock the OTFDEC until reset
+ *
+ * @note call it after the image checks, they read the image as stored
+ *
+ * @param header image header, BOOT_IMAGE_FLAG_ENCRYPTED
+ * @param slot_mapped_addr memory-mapped address of the slot, 4KB aligned
+ *
+ * @return false: no key is provisioned or the key is not the one provisioned
+ */
+bool boot_otfdec_enable(const boot_image_header *header, uint32_t slot_mapped_addr) {
+    const boot_otfdec_key_record *stored = (const boot_otfdec_key_record *) BOOT_OTFDEC_KEY_ADDR;
+    OTFDEC_Region_TypeDef *region = OTFDEC1_REGION1;
+    uint32_t end = slot_mapped_addr + BOOT_IMAGE_HEADER_SIZE + header->image_size;
+
+    if (stored->magic != BOOT_OTFDEC_KEY_MAGIC || slot_mapped_addr % OTFDEC_REGION_ALIGN) {
+        return false;
+    }
+
+    __HAL_RCC_OTFDEC1_CLK_ENABLE();
+    if (region->REG_CONFIGR & (OTFDEC_REG_CONFIGR_REG_EN | OTFDEC_REG_CONFIGR_CONFIGLOCK)) {
+        return false;
+    }
+
+    /* instruction fetches and data reads are deciphered, the app keeps its constants in flash */
+    region->REG_CONFIGR = OTFDEC_REG_CONFIGR_MODE_1
+            | ((uint32_t) header->otfdec_version << OTFDEC_REG_CONFIGR_VERSION_Pos);
+    region->REG_START_ADDR = slot_mapped_addr;
+    region->REG_END_ADDR = ((end + OTFDEC_REGION_ALIGN - 1) & ~(OTFDEC_REGION_ALIGN - 1)) - 1;
+    region->REG_NONCER0 = header->otfdec_nonce[0];
+    region->REG_NONCER1 = header->otfdec_nonce[1];
+    if (otfdec_key_load(region, stored->key) != (uint8_t) stored->key_crc) {
+        return false;
+    }
+    region->REG_CONFIGR |= OTFDEC_REG_CONFIGR_REG_EN;
+    region->REG_CONFIGR |= OTFDEC_REG_CONFIGR_KEYLOCK | OTFDEC_REG_CONFIGR_CONFIGLOCK;
+
+    /* lines read before are still cipher text */
+    SCB_InvalidateDCache_by_Addr((void *) (uintptr_t) slot_mapped_addr, (int32_t) (end - slot_mapped_addr));
+
+    return true;
+}
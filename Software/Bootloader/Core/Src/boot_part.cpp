@@ -0,0 +1,311 @@
+/**
+ * @file boot_part.cpp
+ * @brief The MAIN flash part of the production boards, its driver of boot_part.hpp, see boot_part.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_PART
+
+#include "boot_part.h"
+#include "boot_part.hpp"
+#include "boot_handoff.h"
+#include "boot_ospi_chain.h"
+#include "elog.h"
+
+ELOG_TAG_DEFINE(TAG, "part");
+
+/* W25Q64JV-IQ: the quad I/O read (1-4-4) with the mode bits out of continuous read, the quad page program (1-1-4) */
+static constexpr boot_part_desc part_w25q64jv = {
+    "W25Q64JV",
+    SFUD_MF_ID_WINBOND, 0x40, 0x17,
+    8UL * 1024 * 1024,
+    3,
+    SFUD_CMD_QUAD_IO_READ_DATA, 4, 4, SFUD_QSPI_MODE_BITS_NORMAL, 4, 4,
+    SFUD_CMD_QUAD_PAGE_PROGRAM, 1, 4,
+    256,
+    3000,
+    {
+        {64 * 1024, 0xD8, 2000},
+        {32 * 1024, 0x52, 1600},
+        {4 * 1024, 0x20, 400},
+    },
+};
+
+/* the timeout clock of the services: the DWT cycle counter, the SysTick and its count belong to the application */
+struct svc_clock {
+    uint32_t start;
+    uint32_t cycles_ms;
+
+    svc_clock() {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->LAR = 0xC5ACCE55;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        start = DWT->CYCCNT;
+        /* the core clock of the RCC registers, the application may have changed the clock tree */
+        cycles_ms = (HAL_RCC_GetSysClockFreq()
+                     >> (D1CorePrescTable[(RCC->D1CFGR & RCC_D1CFGR_D1CPRE) >> RCC_D1CFGR_D1CPRE_Pos] & 0x1FU)) / 1000;
+    }
+
+    uint32_t elapsed_ms() const {
+        return (DWT->CYCCNT - start) / cycles_ms;
+    }
+};
+
+using main_part = boot_part_driver<part_w25q64jv, OCTOSPI1_R_BASE>;
+using svc_part = boot_part_driver<part_w25q64jv, OCTOSPI1_R_BASE, svc_clock>;
+
+/* the page programs of the bootloader run as MDMA chains till one of them fails, the CPU takes them from then on */
+static bool chain_ok = true;
+
+/**
+ * program of the MAIN flash: a list of pages a chain, see boot_ospi_chain.h, by the CPU what doesn't fit one
+ *
+ * A chain which fails is done again by main_part::write(), after the page it left running.
+ */
+static sfud_err main_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data) {
+    constexpr boot_part_desc part = part_w25q64jv;
+    constexpr uint32_t span = BOOT_OSPI_CHAIN_PAGES * part.page_size;
+    OCTOSPI_TypeDef *o = main_part::ospi();
+    uint32_t tcr = main_part::tcr_base(o), cr = o->CR;
+    const boot_ospi_chain_desc desc = {
+        cr, tcr, main_part::ccr_cmd, main_part::ccr_program, main_part::ccr_status, part.program_cmd, part.page_size,
+    };
+    sfud_err result = SFUD_SUCCESS;
+    size_t n;
+
+    while (size && result == SFUD_SUCCESS) {
+        n = span - (addr & (span - 1));
+        if (n > size) {
+            n = size;
+        }
+        if (chain_ok && boot_ospi_chain_fits(&desc, addr, n, data)) {
+            result = boot_ospi_chain_program(o, &desc, addr, n, data,
+                                             boot_part_timeout_ms(BOOT_OSPI_CHAIN_PAGES * part.program_time_max_us));
+            if (result != SFUD_SUCCESS) {
+                chain_ok = false;
+                elog_w(TAG, "%s: page program chain at 0x%06x failed (%d), by the CPU from now on", flash->name,
+                       addr, result);
+                result = main_part::poll(o, cr, tcr, SFUD_STATUS_REGISTER_BUSY, 0,
+                                         boot_part_timeout_ms(part.program_time_max_us));
+                if (result == SFUD_SUCCESS) {
+                    result = main_part::write(flash, addr, n, data);
+                }
+            }
+        } else {
+            result = main_part::write(flash, addr, n, data);
+        }
+        addr += n;
+        data += n;
+        size -= n;
+    }
+    o->CR = cr;
+
+    return result;
+}
+
+static constexpr sfud_part main_ops = {part_w25q64jv.name, main_part::ready, main_part::read, main_write,
+                                       main_part::erase};
+
+/**
+ * attach the part driver to the MAIN flash when it's the board's part, SFUD keeps the flash otherwise
+ *
+ * @param flash MAIN flash, after sfud_qspi_fast_read_enable(): the quad enable bit is set by it
+ *
+ * @return true: attached
+ */
+bool boot_part_attach(sfud_flash *flash) {
+    const boot_part_desc &part = part_w25q64jv;
+    const sfud_qspi_read_cmd_format *format = &flash->read_cmd_format;
+
+    flash->part = NULL;
+    if (!flash->init_ok || flash->index != SFUD_MAIN_FLASH) {
+        return false;
+    }
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    /* its commands are the ones of one part, the two parts need qspi_dual_xfer() of the port */
+    if (flash->dual_quad) {
+        elog_i(TAG, "%s: dual-quad, no part driver", flash->name);
+        return false;
+    }
+#endif
+#ifdef SFUD_USING_QSPI_QPI
+    /* its commands are 1-line, sfud_qspi_qpi_enable() keeps off a flash with a part driver the other way round */
+    if (flash->qpi) {
+        elog_i(TAG, "%s: QPI mode, no part driver", flash->name);
+        return false;
+    }
+#endif
+    if (flash->chip.mf_id != part.mf_id || flash->chip.type_id != part.type_id
+            || flash->chip.capacity_id != part.capacity_id || flash->chip.capacity != part.capacity) {
+        elog_i(TAG, "%s: JEDEC %02x %02x %02x, no part driver", flash->name, flash->chip.mf_id, flash->chip.type_id,
+               flash->chip.capacity_id);
+        return false;
+    }
+    /* the quad commands need the quad enable bit, the quad read of SFUD tells it is set; STR, 3-Byte addresses */
+    if (format->data_lines != part.read_data_lines || format->dtr || flash->addr_in_4_byte) {
+        elog_i(TAG, "%s: %s not in quad STR 3-Byte mode, no part driver", flash->name, part.name);
+        return false;
+    }
+    flash->part = &main_ops;
+    elog_i(TAG, "%s: %s part driver", flash->name, part.name);
+    return true;
+}
+
+/**
+ * the services serve the part the bootloader found at this boot, in the mode boot_part_attach() takes
+ *
+ * @return SFUD_ERR_NOT_FOUND: no such MAIN flash in the handoff record
+ */
+static sfud_err svc_check(uint32_t addr, size_t size) {
+    const boot_handoff_info *info = (const boot_handoff_info *) BOOT_HANDOFF_INFO_ADDR;
+    const boot_handoff_flash *entry = &info->flash[SFUD_MAIN_FLASH];
+    const boot_part_desc &part = part_w25q64jv;
+
+    if (info->magic != BOOT_HANDOFF_INFO_MAGIC || info->version != BOOT_HANDOFF_INFO_VERSION || !entry->valid
+            || entry->mf_id != part.mf_id || entry->type_id != part.type_id
+            || entry->capacity_id != part.capacity_id || entry->capacity != part.capacity
+            || entry->read_data_lines != part.read_data_lines || (entry->read_flags & 1U) || entry->addr_in_4_byte) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    if (addr > part.capacity || size > part.capacity - addr) {
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+    return SFUD_SUCCESS;
+}
+
+/* leave the continuous read, 0xFF on all IO lines for the address and the mode bits, see the port */
+static void svc_continuous_read_reset(OCTOSPI_TypeDef *o, uint32_t tcr) {
+    o->TCR = tcr;
+    o->CCR = (boot_part_lines_mode(4) << OCTOSPI_CCR_IMODE_Pos) | (boot_part_lines_mode(4) << OCTOSPI_CCR_ADMODE_Pos)
+             | (3U << OCTOSPI_CCR_ADSIZE_Pos);
+    o->IR = 0xFF;
+    o->AR = 0xFFFFFFFF;
+    svc_part::complete(o);
+}
+
+/* abort the memory-mapped mode, indirect write from then on, the flash out of the continuous read */
+static void svc_xip_leave(OCTOSPI_TypeDef *o, uint32_t cr, uint32_t ccr, uint32_t tcr) {
+    o->CR = cr | OCTOSPI_CR_ABORT;
+    while (o->CR & OCTOSPI_CR_ABORT) {
+    }
+    while (o->SR & OCTOSPI_SR_BUSY) {
+    }
+    o->CR = cr & ~OCTOSPI_CR_FMODE;
+    if (ccr & OCTOSPI_CCR_SIOO) {
+        svc_continuous_read_reset(o, tcr & ~OCTOSPI_TCR_DCYC);
+    }
+}
+
+/**
+ * run a program or an erase of the services, the memory-mapped mode is paused around it
+ *
+ * The interrupts are masked to the end of an erase too, their handlers and the caller may run from the flash
+ * window. Afterwards the window lines of [start, end) are dropped from the caches.
+ */
+template <typename Op>
+static sfud_err svc_run(uint32_t start, uint32_t end, Op op) {
+    OCTOSPI_TypeDef *o = svc_part::ospi();
+    uint32_t primask = __get_PRIMASK(), cr, ccr, tcr, ir, abr, dlr;
+    sfud_err result;
+    bool mapped;
+
+    __disable_irq();
+    __DSB();
+    __ISB();
+
+    cr = o->CR;
+    ccr = o->CCR;
+    tcr = o->TCR;
+    ir = o->IR;
+    abr = o->ABR;
+    dlr = o->DLR;
+    mapped = (cr & OCTOSPI_CR_FMODE) == OCTOSPI_CR_FMODE;
+    if (mapped) {
+        svc_xip_leave(o, cr, ccr, tcr);
+    }
+
+    result = op();
+
+    if (mapped) {
+        /* the read command of the memory-mapped mode first, CR last enters it again */
+        while (o->SR & OCTOSPI_SR_BUSY) {
+        }
+        o->DLR = dlr;
+        o->TCR = tcr;
+        o->CCR = ccr;
+        o->IR = ir;
+        o->ABR = abr;
+        o->CR = cr;
+    }
+    if (end > start) {
+        SCB_InvalidateDCache_by_Addr((void *) (OCTOSPI1_BASE + start), (int32_t) (end - start));
+        SCB_InvalidateICache();
+    }
+    __DSB();
+    __ISB();
+    __set_PRIMASK(primask);
+
+    return result;
+}
+
+/**
+ * read of the MAIN flash for the application, boot_svc.h: from the window in memory-mapped mode, by the
+ * driver otherwise
+ */
+sfud_err boot_part_svc_read(uint32_t addr, size_t size, uint8_t *data) {
+    sfud_err result = svc_check(addr, size);
+
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    if (!svc_part::ready(NULL)) {
+        memcpy(data, (const uint8_t *) OCTOSPI1_BASE + addr, size);
+        return SFUD_SUCCESS;
+    }
+    return svc_part::read(NULL, addr, size, data);
+}
+
+/**
+ * program of the MAIN flash for the application, boot_svc.h: the range must be erased
+ *
+ * @param data not in the flash window, it's out of memory-mapped mode meanwhile
+ */
+sfud_err boot_part_svc_write(uint32_t addr, size_t size, const uint8_t *data) {
+    uintptr_t buf = (uintptr_t) data;
+    sfud_err result = svc_check(addr, size);
+
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    if (buf < OCTOSPI1_BASE + BOOT_HANDOFF_XIP_WINDOW_SIZE && buf + size > OCTOSPI1_BASE) {
+        return SFUD_ERR_WRITE;
+    }
+    return svc_run(addr, addr + size, [=] {
+        return svc_part::write(NULL, addr, size, data);
+    });
+}
+
+/**
+ * erase of the MAIN flash for the application, boot_svc.h: the units covering the range
+ */
+sfud_err boot_part_svc_erase(uint32_t addr, size_t size) {
+    constexpr uint32_t unit = svc_part::erase_min();
+    sfud_err result = svc_check(addr, size);
+
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    return svc_run(addr & ~(unit - 1), (addr + size + unit - 1) & ~(unit - 1), [=] {
+        return svc_part::erase(NULL, addr, size);
+    });
+}
+
+/**
+ * leave the memory-mapped mode for good, the flash takes commands again, see boot_warm_enter()
+ */
+void boot_part_svc_xip_exit(void) {
+    OCTOSPI_TypeDef *o = svc_part::ospi();
+    uint32_t cr = o->CR;
+
+    if ((cr & OCTOSPI_CR_FMODE) == OCTOSPI_CR_FMODE) {
+        svc_xip_leave(o, cr, o->CCR, o->TCR);
+    }
+}
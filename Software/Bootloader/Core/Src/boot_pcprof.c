@@ -0,0 +1,215 @@
+/**
+ * @file boot_pcprof.c
+ * @brief PC sampling profiler of the application, see boot_pcprof.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_PCPROF
+
+#include "boot_pcprof.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "pcprof");
+
+/* the XIP window of OCTOSPI1 */
+#define XIP_WINDOW_SIZE                 0x10000000UL
+#define DWT_CNT_EVTENA                  (DWT_CTRL_CPIEVTENA_Msk | DWT_CTRL_EXCEVTENA_Msk | DWT_CTRL_SLEEPEVTENA_Msk \
+                                         | DWT_CTRL_LSUEVTENA_Msk | DWT_CTRL_FOLDEVTENA_Msk)
+
+/* placed after the trace record by the linker script, see BOOT_PCPROF_ADDR */
+boot_pcprof boot_pcprof_record __attribute__((section(".boot_pcprof")));
+
+static const char *const mem_names[BOOT_PCPROF_MEM_NUM] = { "itcm", "flash", "xip", "ram", "other" };
+static const char *const cnt_names[BOOT_PCPROF_CNT_NUM] = { "cpi", "exc", "sleep", "lsu", "fold" };
+
+static boot_pcprof_mem pcprof_mem(uint32_t pc) {
+    if (pc < FLASH_BANK1_BASE) {
+        return pc < D1_ITCMRAM_BASE + 0x10000UL ? BOOT_PCPROF_MEM_ITCM : BOOT_PCPROF_MEM_OTHER;
+    }
+    if (pc < D1_DTCMRAM_BASE) {
+        return BOOT_PCPROF_MEM_FLASH;
+    }
+    if (pc < D3_SRAM_BASE + 0x08000000UL) {
+        return BOOT_PCPROF_MEM_RAM;
+    }
+    if (pc - OCTOSPI1_BASE < XIP_WINDOW_SIZE) {
+        return BOOT_PCPROF_MEM_XIP;
+    }
+    return BOOT_PCPROF_MEM_OTHER;
+}
+
+/* the DWT event counters by boot_pcprof_cnt */
+static void pcprof_read_cnt(uint8_t *cnt) {
+    cnt[BOOT_PCPROF_CNT_CPI] = (uint8_t) DWT->CPICNT;
+    cnt[BOOT_PCPROF_CNT_EXC] = (uint8_t) DWT->EXCCNT;
+    cnt[BOOT_PCPROF_CNT_SLEEP] = (uint8_t) DWT->SLEEPCNT;
+    cnt[BOOT_PCPROF_CNT_LSU] = (uint8_t) DWT->LSUCNT;
+    cnt[BOOT_PCPROF_CNT_FOLD] = (uint8_t) DWT->FOLDCNT;
+}
+
+/**
+ * clear the record and start the DWT counters, the prof_start service of boot_svc.h
+ *
+ * Runs in the context of the application, the record is its only RAM.
+ *
+ * @param base first address of the histogram, e.g. OCTOSPI1_BASE + the code of the image
+ * @param size bytes of the range, 2^BOOT_PCPROF_SHIFT_MIN * BOOT_PCPROF_BUCKET_NUM or less for the finest buckets
+ */
+void boot_pcprof_svc_start(uint32_t base, uint32_t size) {
+    boot_pcprof *prof = &boot_pcprof_record;
+    uint32_t shift = BOOT_PCPROF_SHIFT_MIN;
+
+    while (shift < 31 && ((uint64_t) BOOT_PCPROF_BUCKET_NUM << shift) < size) {
+        shift++;
+    }
+    memset(prof, 0, sizeof(boot_pcprof));
+    prof->version = BOOT_PCPROF_VERSION;
+    prof->size = sizeof(boot_pcprof);
+    prof->base = base;
+    prof->range = size;
+    prof->shift = shift;
+    /* as the timeout clock of boot_part.cpp, SystemCoreClock is a variable of the bootloader RAM */
+    prof->core_clock_hz = HAL_RCC_GetSysClockFreq()
+                          >> (D1CorePrescTable[(RCC->D1CFGR & RCC_D1CFGR_D1CPRE) >> RCC_D1CFGR_D1CPRE_Pos] & 0x1FU);
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CPICNT = 0;
+    DWT->EXCCNT = 0;
+    DWT->SLEEPCNT = 0;
+    DWT->LSUCNT = 0;
+    DWT->FOLDCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk | DWT_CNT_EVTENA;
+    prof->last_cycles = DWT->CYCCNT;
+    pcprof_read_cnt(prof->last_cnt);
+    prof->state = BOOT_PCPROF_STATE_RUNNING;
+    prof->magic = BOOT_PCPROF_MAGIC;
+}
+
+/**
+ * count one sample, the prof_sample service of boot_svc.h, from the sampling interrupt of the application
+ *
+ * @param frame exception frame of the interrupt, r0, r1, r2, r3, r12, lr, pc, xpsr
+ */
+void boot_pcprof_svc_sample(const uint32_t *frame) {
+    boot_pcprof *prof = &boot_pcprof_record;
+    uint32_t cycles = DWT->CYCCNT, pc = frame[6], offset;
+    uint8_t cnt[BOOT_PCPROF_CNT_NUM];
+
+    if (prof->magic != BOOT_PCPROF_MAGIC || prof->state != BOOT_PCPROF_STATE_RUNNING) {
+        return;
+    }
+    pcprof_read_cnt(cnt);
+    /* the 8-bit counters move by less than 256 between two samples, the sums take the wrapped difference */
+    for (uint8_t i = 0; i < BOOT_PCPROF_CNT_NUM; i++) {
+        prof->cnt[i] += (uint8_t) (cnt[i] - prof->last_cnt[i]);
+        prof->last_cnt[i] = cnt[i];
+    }
+    prof->cycles += cycles - prof->last_cycles;
+    prof->last_cycles = cycles;
+
+    prof->samples++;
+    prof->mem[pcprof_mem(pc)]++;
+    offset = pc - prof->base;
+    if (offset >= prof->range || (offset >> prof->shift) >= BOOT_PCPROF_BUCKET_NUM) {
+        prof->outside++;
+    } else if (prof->hist[offset >> prof->shift] != 0xFFFF) {
+        prof->hist[offset >> prof->shift]++;
+    }
+}
+
+/**
+ * end the run, the prof_stop service of boot_svc.h, the next boot logs the record
+ */
+void boot_pcprof_svc_stop(void) {
+    boot_pcprof *prof = &boot_pcprof_record;
+
+    if (prof->magic == BOOT_PCPROF_MAGIC && prof->state == BOOT_PCPROF_STATE_RUNNING) {
+        DWT->CTRL &= ~DWT_CNT_EVTENA;
+        prof->state = BOOT_PCPROF_STATE_STOPPED;
+    }
+}
+
+static bool pcprof_valid(const boot_pcprof *prof) {
+    return prof->magic == BOOT_PCPROF_MAGIC && prof->version == BOOT_PCPROF_VERSION
+            && prof->size == sizeof(boot_pcprof) && prof->shift < 32;
+}
+
+/**
+ * the most sampled bucket after the one of (count, index), the ties by index
+ *
+ * @return bucket, BOOT_PCPROF_BUCKET_NUM: none left with samples
+ */
+static uint32_t pcprof_next_top(const boot_pcprof *prof, uint32_t count, uint32_t index) {
+    uint32_t best = BOOT_PCPROF_BUCKET_NUM, best_count = 0;
+
+    for (uint32_t i = 0; i < BOOT_PCPROF_BUCKET_NUM; i++) {
+        uint32_t n = prof->hist[i];
+
+        if (n == 0 || n > count || (n == count && i <= index)) {
+            continue;
+        }
+        if (n > best_count) {
+            best = i;
+            best_count = n;
+        }
+    }
+    return best;
+}
+
+/**
+ * print the record: the memories, the DWT counters and the most sampled buckets, for the console and the boot log
+ */
+void boot_pcprof_print(void) {
+    const boot_pcprof *prof = &boot_pcprof_record;
+    uint32_t samples, mhz, bucket = 0, count = UINT32_MAX, index = 0;
+    uint64_t cycles;
+
+    if (!pcprof_valid(prof)) {
+        elog_raw("no pc profile\r\n");
+        return;
+    }
+    samples = prof->samples ? prof->samples : 1;
+    cycles = prof->cycles ? prof->cycles : 1;
+    mhz = prof->core_clock_hz / 1000000U ? prof->core_clock_hz / 1000000U : 1;
+    elog_raw("%u samples in %u ms at %u MHz, %s, 0x%08x + 0x%x in %u byte buckets\r\n", prof->samples,
+             (uint32_t) (prof->cycles / mhz / 1000U), mhz, prof->state == BOOT_PCPROF_STATE_RUNNING ? "running"
+             : "stopped", prof->base, prof->range, 1U << prof->shift);
+    for (uint8_t i = 0; i < BOOT_PCPROF_MEM_NUM; i++) {
+        elog_raw("%-6s %10u %3u%%\r\n", mem_names[i], prof->mem[i], (uint32_t) (prof->mem[i] * 100ULL / samples));
+    }
+    elog_raw("%-6s %10u %3u%%\r\n", "out", prof->outside, (uint32_t) (prof->outside * 100ULL / samples));
+    /* per 1000 cycles: the shares of the stalls, of the sleep, and the folded instructions */
+    for (uint8_t i = 0; i < BOOT_PCPROF_CNT_NUM; i++) {
+        elog_raw("%-6s %10u %4u/1000 cycles\r\n", cnt_names[i], prof->cnt[i],
+                 (uint32_t) (prof->cnt[i] * 1000ULL / cycles));
+    }
+
+    for (uint8_t n = 0; n < BOOT_PCPROF_TOP_NUM; n++) {
+        bucket = pcprof_next_top(prof, count, index);
+        if (bucket == BOOT_PCPROF_BUCKET_NUM) {
+            break;
+        }
+        count = prof->hist[bucket];
+        index = bucket;
+        elog_raw("0x%08x %8u %3u%%\r\n", prof->base + (bucket << prof->shift), count,
+                 (uint32_t) (count * 100ULL / samples));
+    }
+}
+
+/**
+ * log the profile the application stopped since the last boot, once
+ *
+ * @note after elog_start(), on the full path
+ */
+void boot_pcprof_report(void) {
+    boot_pcprof *prof = &boot_pcprof_record;
+
+    if (!pcprof_valid(prof) || prof->state != BOOT_PCPROF_STATE_STOPPED) {
+        return;
+    }
+    elog_i(TAG, "pc profile of the application:");
+    boot_pcprof_print();
+    prof->state = BOOT_PCPROF_STATE_LOGGED;
+    SCB_CleanDCache_by_Addr((uint32_t *) prof, sizeof(boot_pcprof));
+}
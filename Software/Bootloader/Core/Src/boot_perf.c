@@ -0,0 +1,174 @@
+/**
+ * @file boot_perf.c
+ * @brief History of the boot profiles in the key-value store, see boot_perf.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_PERF
+
+#include "boot_perf.h"
+#include "boot_handoff.h"
+#include "boot_kv.h"
+#include "boot_warm.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "perf");
+
+/* the value is read, changed and written back in place, it's too big for the stack of the jump */
+static boot_perf_history perf_history;
+
+static uint16_t perf_units(uint32_t us) {
+    uint32_t units = (us + BOOT_PERF_UNIT_US / 2) / BOOT_PERF_UNIT_US;
+
+    return units > 0xFFFF ? 0xFFFF : (uint16_t) units;
+}
+
+/* time of this boot, the OCTOSPI1 timing in force and the image booted */
+static void perf_entry_make(boot_perf_entry *entry) {
+    memset(entry, 0, sizeof(boot_perf_entry));
+    for (int i = 0; i < BOOT_STAGE_NUM; i++) {
+        uint32_t us = boot_profile_stage_us((boot_stage) i);
+
+        entry->stage_time[i] = perf_units(us);
+        entry->total_us += us;
+    }
+    entry->image_version = boot_handoff_record.image_version;
+    entry->ospi_prescaler = (uint8_t) (((OCTOSPI1->DCR2 & OCTOSPI_DCR2_PRESCALER) >> OCTOSPI_DCR2_PRESCALER_Pos) + 1);
+    entry->ospi_sshift = (OCTOSPI1->TCR & OCTOSPI_TCR_SSHIFT) ? 1 : 0;
+    if (OCTOSPI1->DCR1 & OCTOSPI_DCR1_DLYBYP) {
+        entry->dlyb_sel = 0xFF;
+    } else {
+        entry->dlyb_sel = (uint8_t) (DLYB_OCTOSPI1->CFGR & DLYB_CFGR_SEL_Msk);
+        entry->dlyb_unit = (uint8_t) ((DLYB_OCTOSPI1->CFGR & DLYB_CFGR_UNIT_Msk) >> DLYB_CFGR_UNIT_Pos);
+    }
+}
+
+static bool perf_over(uint32_t value, uint32_t baseline, uint32_t slack) {
+    return value > baseline + baseline * BOOT_PERF_THRESHOLD_PCT / 100 + slack;
+}
+
+/**
+ * compare an entry with the mean of the unflagged ones of the history
+ *
+ * @return the flags of the entry, 0: no baseline yet
+ */
+static uint32_t perf_compare(const boot_perf_history *history, const boot_perf_entry *entry) {
+    uint32_t stage_sum[BOOT_STAGE_NUM] = {0}, total_sum = 0, flags = 0, num = 0;
+    uint32_t count = history->count < BOOT_PERF_HISTORY_NUM ? history->count : BOOT_PERF_HISTORY_NUM;
+
+    for (uint32_t n = 0; n < count; n++) {
+        const boot_perf_entry *past = &history->entry[n];
+
+        if (past->flags) {
+            continue;
+        }
+        for (int i = 0; i < BOOT_STAGE_NUM; i++) {
+            stage_sum[i] += past->stage_time[i];
+        }
+        total_sum += past->total_us;
+        num++;
+    }
+    if (num < BOOT_PERF_BASELINE_MIN) {
+        return 0;
+    }
+
+    for (int i = 0; i < BOOT_STAGE_NUM; i++) {
+        if (perf_over(entry->stage_time[i], stage_sum[i] / num, BOOT_PERF_SLACK_US / BOOT_PERF_UNIT_US)) {
+            flags |= 1UL << i;
+        }
+    }
+    if (perf_over(entry->total_us, total_sum / num, BOOT_PERF_SLACK_US)) {
+        flags |= BOOT_PERF_FLAG_TOTAL;
+    }
+    return flags;
+}
+
+/* the history of the store, a new one when there's none or of another layout */
+static void perf_history_load(boot_perf_history *history) {
+    size_t len;
+
+    if (boot_kv_get(BOOT_PERF_KV_KEY, history, sizeof(boot_perf_history), &len) != SFUD_SUCCESS
+            || len != sizeof(boot_perf_history) || history->version != BOOT_PERF_VERSION
+            || history->stage_num != BOOT_STAGE_NUM) {
+        memset(history, 0, sizeof(boot_perf_history));
+        history->version = BOOT_PERF_VERSION;
+        history->stage_num = BOOT_STAGE_NUM;
+    }
+}
+
+/**
+ * add the profile of this boot to the history and flag it against the baseline
+ *
+ * @note at the jump, after boot_profile_finish() and before boot_kv_flush() and boot_handoff_prepare()
+ *
+ * @return the flags of the boot, BOOT_PERF_FLAG_TOTAL and (1 << boot_stage), 0: in line or not recorded
+ */
+uint32_t boot_perf_record(void) {
+    boot_perf_history *history = &perf_history;
+    const sfud_flash *ext = sfud_get_device(SFUD_EXT_FLASH);
+    boot_perf_entry entry;
+    sfud_err result;
+
+    if (boot_handoff_record.path != BOOT_HANDOFF_PATH_FULL || boot_handoff_record.updates || boot_warm_entered()
+            || !ext->init_ok) {
+        return 0;
+    }
+
+    perf_history_load(history);
+    perf_entry_make(&entry);
+    entry.flags = perf_compare(history, &entry);
+    history->entry[history->count % BOOT_PERF_HISTORY_NUM] = entry;
+    history->count++;
+    result = boot_kv_set(BOOT_PERF_KV_KEY, history, sizeof(boot_perf_history));
+    if (result != SFUD_SUCCESS) {
+        elog_w(TAG, "boot profile not stored(%d)", result);
+    }
+
+    if (entry.flags) {
+        elog_w(TAG, "boot of %u us slower than the last ones, flags 0x%08x", entry.total_us, entry.flags);
+        for (int i = 0; i < BOOT_STAGE_NUM; i++) {
+            if (entry.flags & (1UL << i)) {
+                elog_w(TAG, "  %s: %u us", boot_profile_stage_name((boot_stage) i),
+                       entry.stage_time[i] * BOOT_PERF_UNIT_US);
+            }
+        }
+    }
+    boot_handoff_record.perf_flags = entry.flags;
+
+    return entry.flags;
+}
+
+/**
+ * print the history, oldest first, for the console
+ */
+void boot_perf_print(void) {
+    boot_perf_history *history = &perf_history;
+    uint32_t count, first;
+
+    perf_history_load(history);
+    count = history->count < BOOT_PERF_HISTORY_NUM ? history->count : BOOT_PERF_HISTORY_NUM;
+    first = history->count - count;
+    elog_raw("%u boots recorded\r\n", history->count);
+    elog_raw("%6s %10s %10s %10s %5s %6s %5s %5s\r\n", "boot", "version", "total us", "flags", "presc", "sshift", "sel",
+             "unit");
+    for (uint32_t n = first; n < history->count; n++) {
+        const boot_perf_entry *entry = &history->entry[n % BOOT_PERF_HISTORY_NUM];
+
+        elog_raw("%6u 0x%08x %10u 0x%08x %5u %6u %5u %5u\r\n", n, entry->image_version, entry->total_us,
+                 entry->flags, entry->ospi_prescaler, entry->ospi_sshift, entry->dlyb_sel, entry->dlyb_unit);
+    }
+    elog_raw("%-16s", "stage us");
+    for (uint32_t n = first; n < history->count; n++) {
+        elog_raw(" %8u", n);
+    }
+    elog_raw("\r\n");
+    for (int i = 0; i < BOOT_STAGE_NUM; i++) {
+        elog_raw("%-16s", boot_profile_stage_name((boot_stage) i));
+        for (uint32_t n = first; n < history->count; n++) {
+            const boot_perf_entry *entry = &history->entry[n % BOOT_PERF_HISTORY_NUM];
+
+            elog_raw(" %7u%c", entry->stage_time[i] * BOOT_PERF_UNIT_US, (entry->flags & (1UL << i)) ? '!' : ' ');
+        }
+        elog_raw("\r\n");
+    }
+}
@@ -0,0 +1,112 @@
+/**
+ * @file boot_profile.c
+ * @brief Boot-stage timing profile kept in no-init RAM_D3.
+ */
+#include "boot_profile.h"
+#include "boot_warm.h"
+#include "main.h"
+#include <string.h>
+
+/* placed at the start of RAM_D3 by the linker script, see BOOT_PROFILE_ADDR */
+boot_profile boot_profile_record __attribute__((section(".boot_profile")));
+
+static const char *const stage_names[BOOT_STAGE_NUM] = {
+    "hal init", "gpio init", "octospi1 init", "usart2 init", "spi2 init", "elog init", "elog start",
+    "sfud init", "sfud fast read", "system clock", "ospi cal", "uart update", "usb update",
+    "esp update", "memory mapped", "slot select", "jump",
+};
+
+/**
+ * start the DWT cycle counter and clear the record
+ *
+ * @note must be the first thing main() does, CYCCNT is reset to 0 here. The reset
+ *       flags are cleared for the startup to tell the next power-on reset.
+ */
+void boot_profile_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    /* the DWT of cortex-m7 is locked after reset */
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    memset(&boot_profile_record, 0, sizeof(boot_profile_record));
+    boot_profile_record.version = BOOT_PROFILE_VERSION;
+    boot_profile_record.stage_num = BOOT_STAGE_NUM;
+    boot_profile_record.reset_flags = RCC->RSR;
+    __HAL_RCC_CLEAR_RESET_FLAGS();
+}
+
+/**
+ * record the end of a boot stage
+ *
+ * @param stage finished stage
+ */
+void boot_profile_mark(boot_stage stage) {
+    if (stage < BOOT_STAGE_NUM) {
+        boot_profile_record.cycles[stage] = DWT->CYCCNT;
+    }
+}
+
+/**
+ * record the jump and publish the record to the application
+ */
+void boot_profile_finish(void) {
+    boot_profile_mark(BOOT_STAGE_JUMP);
+    boot_profile_record.core_clock_hz = SystemCoreClock;
+    boot_profile_record.magic = BOOT_PROFILE_MAGIC;
+    /* the app may start with a clean cache, make sure the record reaches RAM_D3 */
+    SCB_CleanDCache_by_Addr((uint32_t *) &boot_profile_record, sizeof(boot_profile_record));
+}
+
+const char *boot_profile_stage_name(boot_stage stage) {
+    return stage < BOOT_STAGE_NUM ? stage_names[stage] : "?";
+}
+
+/**
+ * time of a stage, from the end of the last stage reached before it
+ *
+ * @return microseconds, 0: the stage wasn't reached
+ */
+uint32_t boot_profile_stage_us(boot_stage stage) {
+    const boot_profile *profile = &boot_profile_record;
+    uint32_t last = 0, hz;
+
+    if (stage >= BOOT_STAGE_NUM || !profile->cycles[stage]) {
+        return 0;
+    }
+    for (int i = (int) stage - 1; i >= 0; i--) {
+        if (profile->cycles[i]) {
+            last = profile->cycles[i];
+            break;
+        }
+    }
+    /* the stages up to the fast read run on HSI, but after the warm entry, see boot_profile.h */
+    hz = stage <= BOOT_STAGE_SFUD_FAST_READ && !boot_warm_entered() ? HSI_VALUE : SystemCoreClock;
+    return (uint32_t) ((uint64_t) (profile->cycles[stage] - last) * 1000000 / hz);
+}
+
+/* the stack area painted by Reset_Handler, see the linker script */
+extern uint32_t _end;
+extern uint32_t _estack;
+
+/**
+ * @return bytes of the stack area
+ */
+uint32_t boot_profile_stack_size(void) {
+    return (uint32_t) ((uintptr_t) &_estack - (uintptr_t) &_end);
+}
+
+/**
+ * find the deepest word of the stack area that isn't the paint any more
+ *
+ * @return bytes of the stack used at most so far, boot_profile_stack_size(): the paint is gone, the stack may
+ *         have overflowed into the sections below
+ */
+uint32_t boot_profile_stack_peak(void) {
+    const uint32_t *word = &_end;
+
+    while (word < &_estack && *word == BOOT_PROFILE_STACK_PAINT) {
+        word++;
+    }
+    return (uint32_t) ((uintptr_t) &_estack - (uintptr_t) word);
+}
@@ -0,0 +1,157 @@
+/**
+ * @file boot_recv.c
+ * @brief SHA-256, CRC-32 and sector CRCs of an upload as it is received, see boot_recv.h.
+ */
+#include "boot_recv.h"
+#include "boot_crc.h"
+#include "boot_hash.h"
+#include "boot_verify.h"
+#include "main.h"
+#include <string.h>
+
+typedef struct {
+    boot_slot_id slot;                           /**< slot of the upload, BOOT_SLOT_NONE: nothing to take */
+    uint32_t offset;                             /**< slot bytes fed so far */
+    uint32_t image_end;                          /**< slot offset past the image, 0: the header isn't in yet */
+    uint32_t image_crc;                          /**< CRC-32 of the image bytes so far */
+    uint32_t sector_crc;                         /**< CRC-32 of the bytes so far of the current sector */
+    boot_image_header header;                    /**< header area as it passed */
+} recv_state;
+
+/* nothing to take till a receiver starts an upload */
+static recv_state recv = {.slot = BOOT_SLOT_NONE};
+static uint32_t recv_sector_crc[BOOT_VERIFY_SECTOR_NUM];
+
+/**
+ * go on with a CRC-32 over a piece, by the CRC unit when the piece is aligned
+ */
+static bool recv_crc(uint32_t *crc, const uint8_t *buf, size_t len) {
+    uintptr_t start = (uintptr_t) buf & ~(uintptr_t) 31;
+
+    if ((uintptr_t) buf % 4) {
+        *crc = boot_image_crc32(*crc, buf, len);
+        return true;
+    }
+    /* the MDMA reads the memory, the CPU may have written the piece through the cache */
+    SCB_CleanDCache_by_Addr((uint32_t *) start, (int32_t) ((uintptr_t) buf + len - start));
+    return boot_crc32_hw_continue(*crc, buf, len, crc);
+}
+
+/**
+ * hash and CRC a piece of the image within one sector, the sector CRC is kept when the piece ends it
+ *
+ * @param pos slot offset of the piece
+ */
+static bool recv_image(uint32_t pos, const uint8_t *buf, size_t len) {
+    uint32_t sector = (pos - BOOT_IMAGE_HEADER_SIZE) / BOOT_VERIFY_SECTOR_SIZE;
+    uint32_t sector_end = BOOT_IMAGE_HEADER_SIZE + (sector + 1) * BOOT_VERIFY_SECTOR_SIZE;
+
+#ifdef BOOT_SLOT_VERIFY_HASH
+    if (hash_stream_feed(buf, len) != SFUD_SUCCESS) {
+        return false;
+    }
+#endif
+    if (!recv_crc(&recv.image_crc, buf, len) || !recv_crc(&recv.sector_crc, buf, len)) {
+        return false;
+    }
+    pos += len;
+    if (pos == sector_end || pos == recv.image_end) {
+        recv_sector_crc[sector] = recv.sector_crc;
+        recv.sector_crc = 0;
+    }
+    return true;
+}
+
+/**
+ * start tracking an upload, before its first frame
+ *
+ * @param slot slot the upload goes to
+ */
+void boot_recv_start(boot_slot_id slot) {
+    memset(&recv, 0, sizeof(recv));
+    recv.slot = slot;
+#ifdef BOOT_SLOT_VERIFY_HASH
+    if (!hash_stream_start()) {
+        recv.slot = BOOT_SLOT_NONE;
+    }
+#endif
+}
+
+/**
+ * take a frame of the upload, its program may be running
+ *
+ * @param offset slot offset of the frame, the end of the last one or the upload is left to the full checks
+ * @param data frame data, any alignment, the DMA2 reaches it or it goes by the CPU
+ * @param len frame size
+ */
+void boot_recv_feed(uint32_t offset, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *) data;
+    uint32_t end = offset + len, pos, stop, sector_end;
+
+    if (recv.slot == BOOT_SLOT_NONE) {
+        return;
+    }
+    if (offset != recv.offset) {
+        recv.slot = BOOT_SLOT_NONE;
+        return;
+    }
+    recv.offset = end;
+    if (offset < sizeof(boot_image_header)) {
+        memcpy((uint8_t *) &recv.header + offset, p,
+               end < sizeof(boot_image_header) ? len : sizeof(boot_image_header) - offset);
+    }
+    if (recv.image_end == 0) {
+        if (end < sizeof(boot_image_header)) {
+            return;
+        }
+        /* the sector table of such an image is checked at the first boot, no sector CRC is kept for it */
+        if (recv.header.image_size > BOOT_SLOT_SIZE - BOOT_IMAGE_HEADER_SIZE
+                || (recv.header.flags & BOOT_IMAGE_FLAG_SECTOR_HASH)) {
+            recv.slot = BOOT_SLOT_NONE;
+            return;
+        }
+        recv.image_end = BOOT_IMAGE_HEADER_SIZE + recv.header.image_size;
+    }
+
+    /* the image part of the frame, split at the sectors */
+    pos = offset > BOOT_IMAGE_HEADER_SIZE ? offset : BOOT_IMAGE_HEADER_SIZE;
+    stop = end < recv.image_end ? end : recv.image_end;
+    while (pos < stop) {
+        sector_end = BOOT_IMAGE_HEADER_SIZE
+                + ((pos - BOOT_IMAGE_HEADER_SIZE) / BOOT_VERIFY_SECTOR_SIZE + 1) * BOOT_VERIFY_SECTOR_SIZE;
+        if (sector_end > stop) {
+            sector_end = stop;
+        }
+        if (!recv_image(pos, p + (pos - offset), sector_end - pos)) {
+            recv.slot = BOOT_SLOT_NONE;
+            return;
+        }
+        pos = sector_end;
+    }
+}
+
+/**
+ * end the tracking and tell whether the upload checked out against the header of the slot
+ *
+ * @param slot slot being committed
+ * @param header its header, read back and checked
+ *
+ * @return the CRC-32 of each image sector, NULL: the first boot checks the image in full
+ */
+const uint32_t *boot_recv_take(boot_slot_id slot, const boot_image_header *header) {
+    bool good = recv.slot != BOOT_SLOT_NONE && recv.slot == slot && recv.image_end && recv.offset >= recv.image_end
+            && memcmp(&recv.header, header, sizeof(boot_image_header)) == 0;
+#ifdef BOOT_SLOT_VERIFY_HASH
+    uint8_t digest[BOOT_HASH_SIZE];
+
+    if (recv.slot != BOOT_SLOT_NONE && (hash_stream_finish(digest) != SFUD_SUCCESS
+            || memcmp(digest, header->image_hash, BOOT_HASH_SIZE) != 0)) {
+        good = false;
+    }
+#endif
+    recv.slot = BOOT_SLOT_NONE;
+    if (!good || recv.image_crc != header->image_crc) {
+        return NULL;
+    }
+    return recv_sector_crc;
+}
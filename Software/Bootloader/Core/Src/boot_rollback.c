@@ -0,0 +1,232 @@
+/**
+ * @file boot_rollback.c
+ * @brief Rollback copy of a bootable slot on the EXT flash, see boot_rollback.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_ROLLBACK
+
+#include "boot_rollback.h"
+#include "boot_cryp.h"
+#include "boot_ext.h"
+#include "boot_image.h"
+#include "boot_install.h"
+#include "boot_lfs.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include "octospi.h"
+#include "elog.h"
+#ifdef ELOG_PORT_FLASH_ENABLE
+#include <elog_flash.h>
+#endif
+#include <stddef.h>
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "rollback");
+
+extern sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash);
+extern sfud_err qspi_exit_memory_mapped_mode(sfud_flash *flash);
+
+/* the page buffers of the copy, the DMA1 can't reach the TCMs */
+static sfud_stream rollback_stream __attribute__((aligned(32)));
+
+static uint32_t record_crc(const boot_rollback_record *record) {
+    return boot_image_crc32(0, record, offsetof(boot_rollback_record, crc));
+}
+
+/* the elog sink, the key-value store and the file system erase the same flash in the background */
+static void rollback_take(void) {
+#ifdef ELOG_PORT_FLASH_ENABLE
+    elog_flash_flush();
+#endif
+    boot_kv_flush();
+#ifdef BOOT_LFS
+    boot_lfs_flush();
+#endif
+}
+
+/**
+ * read the record of the copy on the EXT flash
+ *
+ * @return SFUD_ERR_NOT_FOUND: no copy, or the flash has no room for one
+ */
+static sfud_err record_read(const sfud_flash *ext, boot_rollback_record *record) {
+    sfud_err result;
+
+    if (!ext->init_ok || ext->chip.capacity < BOOT_ROLLBACK_END) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    result = sfud_read(ext, BOOT_ROLLBACK_ADDR, sizeof(*record), (uint8_t *) record);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    if (record->magic != BOOT_ROLLBACK_MAGIC || record->crc != record_crc(record) || record->slot >= BOOT_SLOT_NUM
+            || record->size < BOOT_IMAGE_HEADER_SIZE || record->size > BOOT_SLOT_SIZE) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    return SFUD_SUCCESS;
+}
+
+/**
+ * encrypt the window into the stream, the CRYP takes the next block while the stream programs the last one
+ */
+static sfud_err rollback_write_encrypted(const uint8_t *src, size_t size, const uint32_t nonce[BOOT_CRYP_NONCE_NUM]) {
+    size_t mark = dma_alloc_mark(DMA_REGION_AXI), offset = 0, len, next_len;
+    uint8_t *buf[2];
+    uint8_t cur = 0;
+    sfud_err result;
+
+    buf[0] = dma_alloc_temp(BOOT_ROLLBACK_CRYP_BLOCK_SIZE, DMA_REGION_AXI);
+    buf[1] = dma_alloc_temp(BOOT_ROLLBACK_CRYP_BLOCK_SIZE, DMA_REGION_AXI);
+    if (!buf[0] || !buf[1] || !boot_cryp_ctr_start(nonce)) {
+        dma_alloc_release(DMA_REGION_AXI, mark);
+        return SFUD_ERR_WRITE;
+    }
+    len = size > BOOT_ROLLBACK_CRYP_BLOCK_SIZE ? BOOT_ROLLBACK_CRYP_BLOCK_SIZE : size;
+    result = boot_cryp_ctr_run(src, buf[cur], len);
+    while (result == SFUD_SUCCESS && offset < size) {
+        result = boot_cryp_ctr_wait();
+        if (result != SFUD_SUCCESS) {
+            break;
+        }
+        next_len = size - offset - len > BOOT_ROLLBACK_CRYP_BLOCK_SIZE ? BOOT_ROLLBACK_CRYP_BLOCK_SIZE
+                                                                        : size - offset - len;
+        if (next_len) {
+            result = boot_cryp_ctr_run(src + offset + len, buf[cur ^ 1], next_len);
+        }
+        if (result == SFUD_SUCCESS) {
+            result = sfud_stream_write(&rollback_stream, buf[cur], len);
+        }
+        offset += len;
+        len = next_len;
+        cur ^= 1;
+    }
+    /* an error leaves the last run going, it ends with the stop */
+    if (result != SFUD_SUCCESS) {
+        boot_cryp_ctr_wait();
+    }
+    boot_cryp_ctr_stop();
+    dma_alloc_release(DMA_REGION_AXI, mark);
+    return result;
+}
+
+/**
+ * copy a slot holding a valid image to the EXT flash, before an update overwrites it
+ *
+ * @param slot slot to keep
+ *
+ * @return SFUD_ERR_NOT_FOUND: no valid header in the slot, or no room on the EXT flash
+ */
+sfud_err boot_rollback_save(boot_slot_id slot) {
+    sfud_flash *flash = sfud_get_device(SFUD_MAIN_FLASH);
+    const sfud_flash *ext = boot_ext_flash();
+    uint32_t addr = boot_slot_addr(slot), start = HAL_GetTick(), size;
+    boot_rollback_record record;
+    boot_image_header header;
+    uint8_t cipher;
+    sfud_err result;
+
+    if (!ext->init_ok || ext->chip.capacity < BOOT_ROLLBACK_END) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    result = sfud_read(flash, addr, sizeof(header), (uint8_t *) &header);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    if (!boot_image_header_check(&header, OCTOSPI1_BASE + addr, BOOT_SLOT_SIZE)) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    size = BOOT_IMAGE_HEADER_SIZE + header.image_size;
+    cipher = boot_cryp_ready() ? BOOT_ROLLBACK_CIPHER_AES_CTR : BOOT_ROLLBACK_CIPHER_PLAIN;
+
+    rollback_take();
+    if (record_read(ext, &record) == SFUD_SUCCESS && record.size == size && record.image_crc == header.image_crc
+            && record.image_version == header.image_version && record.cipher == cipher) {
+        elog_i(TAG, "slot %c, version 0x%08x, is kept already", 'A' + slot, header.image_version);
+        return SFUD_SUCCESS;
+    }
+    /* no record while the copy is incomplete */
+    result = sfud_erase(ext, BOOT_ROLLBACK_ADDR, BOOT_ROLLBACK_RECORD_SIZE);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+
+    /* the window feeds the stream, no indirect read of the MAIN flash */
+    result = qspi_entry_memory_mapped_mode(flash);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    SCB_InvalidateDCache_by_Addr((void *) (OCTOSPI1_BASE + addr), (int32_t) size);
+    result = sfud_stream_open(&rollback_stream, ext, BOOT_ROLLBACK_IMAGE_ADDR, size);
+    if (result == SFUD_SUCCESS && cipher == BOOT_ROLLBACK_CIPHER_AES_CTR) {
+        const uint32_t nonce[BOOT_CRYP_NONCE_NUM] = {header.image_crc, header.image_version};
+
+        result = rollback_write_encrypted((const uint8_t *) (OCTOSPI1_BASE + addr), size, nonce);
+    } else if (result == SFUD_SUCCESS) {
+        sfud_stream_write(&rollback_stream, (const void *) (OCTOSPI1_BASE + addr), size);
+    }
+    if (sfud_stream_close(&rollback_stream) != SFUD_SUCCESS && result == SFUD_SUCCESS) {
+        result = SFUD_ERR_WRITE;
+    }
+    if (qspi_exit_memory_mapped_mode(flash) != SFUD_SUCCESS && result == SFUD_SUCCESS) {
+        result = SFUD_ERR_READ;
+    }
+    if (result != SFUD_SUCCESS) {
+        elog_e(TAG, "copy of slot %c failed (%d)", 'A' + slot, result);
+        return result;
+    }
+
+    memset(&record, 0xFF, sizeof(record));
+    record.magic = BOOT_ROLLBACK_MAGIC;
+    record.size = size;
+    record.image_crc = header.image_crc;
+    record.image_version = header.image_version;
+    record.slot = (uint8_t) slot;
+    record.cipher = cipher;
+    if (cipher == BOOT_ROLLBACK_CIPHER_AES_CTR) {
+        record.nonce[0] = header.image_crc;
+        record.nonce[1] = header.image_version;
+    }
+    record.crc = record_crc(&record);
+    result = sfud_write(ext, BOOT_ROLLBACK_ADDR, sizeof(record), (const uint8_t *) &record);
+    if (result == SFUD_SUCCESS) {
+        result = sfud_write_flush(ext);
+    }
+    if (result == SFUD_SUCCESS) {
+        elog_i(TAG, "slot %c, version 0x%08x, kept: %u bytes in %u ms", 'A' + slot, header.image_version,
+               (unsigned) size, (unsigned) (HAL_GetTick() - start));
+    }
+    return result;
+}
+
+/**
+ * install the copy back into the slot it was taken from and select it
+ *
+ * @note the MAIN flash must be in indirect mode
+ *
+ * @return SFUD_ERR_NOT_FOUND: no copy, or its header does not check out in the slot
+ */
+sfud_err boot_rollback_restore(void) {
+    const sfud_flash *flash = sfud_get_device(SFUD_MAIN_FLASH);
+    const sfud_flash *ext = boot_ext_flash();
+    boot_rollback_record record;
+    sfud_err result;
+
+    rollback_take();
+    result = record_read(ext, &record);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    elog_w(TAG, "restoring version 0x%08x into slot %c", record.image_version, 'A' + record.slot);
+    if (record.cipher == BOOT_ROLLBACK_CIPHER_AES_CTR) {
+        boot_install_decrypt(record.nonce);
+    }
+    result = boot_install(ext, BOOT_ROLLBACK_IMAGE_ADDR, flash, boot_slot_addr((boot_slot_id) record.slot),
+                          record.size);
+    boot_install_decrypt(NULL);
+    if (result == SFUD_SUCCESS) {
+        result = boot_slot_commit(flash, (boot_slot_id) record.slot, record.size);
+    }
+    if (result != SFUD_SUCCESS) {
+        elog_e(TAG, "restore failed (%d)", result);
+    }
+    return result;
+}
@@ -0,0 +1,414 @@
+/**
+ * @file boot_scatter.c
+ * @brief Scatter loader of the image sections, see boot_scatter.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_SCATTER
+
+#include "boot_scatter.h"
+#include "boot_heatshrink.h"
+#include "boot_lz4.h"
+#include "main.h"
+#include "elog.h"
+#include <stddef.h>
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "scatter");
+
+/* channel 0 serves the OCTOSPI1 FIFO, channel 1 the CRC unit */
+#define SCATTER_MDMA_CHANNEL            MDMA_Channel2
+/* MDMA block data length is 17 bits */
+#define SCATTER_NODE_MAX_SIZE           (64 * 1024)
+#define SCATTER_NODE_MAX                24
+
+#define SCATTER_ITCM_ADDR               0x00000000UL
+#define SCATTER_ITCM_SIZE               (64 * 1024)
+#define SCATTER_DTCM_ADDR               0x20000000UL
+#define SCATTER_DTCM_SIZE               (128 * 1024)
+#define SCATTER_RAM_D1_ADDR             0x24000000UL
+#define SCATTER_RAM_D1_SIZE             (320 * 1024)
+
+/* end of the ITCM code and of the RAM_D1 data of the bootloader, see the linker script */
+extern uint32_t _eitcm, _ebss;
+
+/* RAM_D3 keeps its content while the list overwrites the rest, non-cacheable once boot_handoff_prepare() ran */
+static MDMA_LinkNodeTypeDef scatter_nodes[SCATTER_NODE_MAX] __attribute__((section(".noinit_d3"), aligned(8)));
+static uint32_t scatter_zero __attribute__((section(".noinit_d3")));
+/* the GOT and the vector table of a PIC image, moved to its slot */
+static uint32_t scatter_got[BOOT_IMAGE_GOT_MAX / 4] __attribute__((section(".noinit_d3")));
+static uint32_t scatter_vector[BOOT_IMAGE_VECTOR_MAX / 4] __attribute__((section(".noinit_d3")));
+/* r9 at the entry, the GOT copy of a PIC image */
+static uint32_t scatter_pic_base;
+static size_t scatter_node_num;
+static boot_heatshrink_decoder scatter_decoder;
+
+static bool range_in(uint32_t addr, uint32_t size, uint32_t start, uint32_t end) {
+    return addr >= start && addr <= end && size <= end - addr;
+}
+
+static bool range_in_ram(uint32_t addr, uint32_t size) {
+    return range_in(addr, size, SCATTER_ITCM_ADDR, SCATTER_ITCM_ADDR + SCATTER_ITCM_SIZE)
+            || range_in(addr, size, SCATTER_DTCM_ADDR, SCATTER_DTCM_ADDR + SCATTER_DTCM_SIZE)
+            || range_in(addr, size, SCATTER_RAM_D1_ADDR, SCATTER_RAM_D1_ADDR + SCATTER_RAM_D1_SIZE);
+}
+
+/**
+ * the RAM the bootloader leaves alone till the jump, the decoded sections go there
+ */
+static bool range_unused(uint32_t addr, uint32_t size) {
+    uint32_t ram_d1 = (uint32_t) (uintptr_t) &_ebss;
+
+    /* the RAM build keeps its .bss in the DTCM, its RAM_D1 holds the code */
+    if (ram_d1 < SCATTER_RAM_D1_ADDR) {
+        ram_d1 = SCATTER_RAM_D1_ADDR + SCATTER_RAM_D1_SIZE;
+    }
+    return range_in(addr, size, (uint32_t) (uintptr_t) &_eitcm, SCATTER_ITCM_ADDR + SCATTER_ITCM_SIZE)
+            || range_in(addr, size, ram_d1, SCATTER_RAM_D1_ADDR + SCATTER_RAM_D1_SIZE);
+}
+
+/**
+ * a RAM image runs from the AXI SRAM or the ITCM, the DTCM is not executable
+ */
+static bool image_check(const boot_image_header *header) {
+    uint32_t size = (header->image_size + 3) & ~3UL;
+
+    return header->ram_addr % 4 == 0 && (range_in(header->ram_addr, size, SCATTER_ITCM_ADDR, SCATTER_ITCM_ADDR
+            + SCATTER_ITCM_SIZE) || range_in(header->ram_addr, size, SCATTER_RAM_D1_ADDR, SCATTER_RAM_D1_ADDR
+            + SCATTER_RAM_D1_SIZE));
+}
+
+/**
+ * decode a compressed RAM image to ram_addr, its range must be unused: the CPU writes it right away
+ *
+ * @param ram_size its decoded size rounded up to 4 bytes, set from the image
+ */
+static bool image_decode(const boot_image_header *header, uint32_t image_addr, uint32_t *ram_size) {
+    uint32_t size = *(const uint32_t *) (uintptr_t) image_addr, offset = header->exec_addr - header->ram_addr;
+
+    if (size < 8 || size > BOOT_IMAGE_LZ4_SIZE_MAX || header->ram_addr % 4
+            || !range_unused(header->ram_addr, (size + 3) & ~3UL) || offset > size - 8
+            || ((header->flags & BOOT_IMAGE_FLAG_VECTOR) && header->vector_size > size - offset)) {
+        elog_e(TAG, "image of 0x%x bytes decoded doesn't fit at 0x%08x", size, header->ram_addr);
+        return false;
+    }
+    *ram_size = (size + 3) & ~3UL;
+    if (!boot_lz4_decode((const uint8_t *) (uintptr_t) (image_addr + BOOT_IMAGE_LZ4_PREFIX_SIZE),
+                         header->image_size - BOOT_IMAGE_LZ4_PREFIX_SIZE, (uint8_t *) (uintptr_t) header->ram_addr,
+                         size)) {
+        elog_e(TAG, "LZ4 image corrupt");
+        return false;
+    }
+    elog_d(TAG, "image decoded: 0x%x to 0x%x bytes at 0x%08x", header->image_size, size, header->ram_addr);
+
+    return true;
+}
+
+static bool ranges_overlap(uint32_t addr1, uint32_t size1, uint32_t addr2, uint32_t size2) {
+    return size1 && size2 && addr1 < addr2 + size2 && addr2 < addr1 + size1;
+}
+
+/**
+ * the vector table copy goes to a TCM, out of the RAM image
+ */
+static bool vector_check(const boot_image_header *header, uint32_t ram_size) {
+    return (range_in(header->vector_addr, header->vector_size, SCATTER_ITCM_ADDR, SCATTER_ITCM_ADDR
+            + SCATTER_ITCM_SIZE) || range_in(header->vector_addr, header->vector_size, SCATTER_DTCM_ADDR,
+            SCATTER_DTCM_ADDR + SCATTER_DTCM_SIZE))
+            && !ranges_overlap(header->vector_addr, header->vector_size, header->ram_addr, ram_size);
+}
+
+static bool section_check(const boot_image_section *section, uint32_t image_size) {
+    if (section->run_addr % 4 || section->run_size % 4 || section->run_size == 0
+            || !range_in_ram(section->run_addr, section->run_size)) {
+        return false;
+    }
+    if (section->type != BOOT_IMAGE_SECTION_ZERO && (section->load_offset % 4
+            || !range_in(section->load_offset, section->load_size, 0, image_size))) {
+        return false;
+    }
+    switch (section->type) {
+    case BOOT_IMAGE_SECTION_COPY:
+        return section->load_size == section->run_size;
+    case BOOT_IMAGE_SECTION_HEATSHRINK:
+        return section->load_size && range_unused(section->run_addr, section->run_size);
+    case BOOT_IMAGE_SECTION_ZERO:
+        return section->load_size == 0;
+    case BOOT_IMAGE_SECTION_GOT:
+        return section->load_size == section->run_size && section->run_size <= BOOT_IMAGE_GOT_MAX;
+    default:
+        return false;
+    }
+}
+
+/**
+ * append the MDMA nodes of a copy, or of a clear with src at scatter_zero
+ */
+static bool nodes_add(uint32_t src, uint32_t dst, uint32_t size, bool zero) {
+    MDMA_LinkNodeConfTypeDef config;
+    uint32_t len;
+
+    memset(&config, 0, sizeof(config));
+    config.Init.Request = MDMA_REQUEST_SW;
+    config.Init.TransferTriggerMode = MDMA_FULL_TRANSFER;
+    config.Init.Priority = MDMA_PRIORITY_VERY_HIGH;
+    config.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    config.Init.SourceInc = zero ? MDMA_SRC_INC_DISABLE : MDMA_SRC_INC_WORD;
+    config.Init.DestinationInc = MDMA_DEST_INC_WORD;
+    config.Init.SourceDataSize = MDMA_SRC_DATASIZE_WORD;
+    config.Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    config.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    config.Init.BufferTransferLength = 128;
+    /* bursts keep the OCTOSPI1 prefetching, the zero word is read once per beat, the TCMs are behind the AHBS */
+    config.Init.SourceBurst = zero ? MDMA_SOURCE_BURST_SINGLE : MDMA_SOURCE_BURST_16BEATS;
+    config.Init.DestBurst = dst >= SCATTER_RAM_D1_ADDR ? MDMA_DEST_BURST_16BEATS : MDMA_DEST_BURST_SINGLE;
+    config.BlockCount = 1;
+
+    while (size) {
+        len = size > SCATTER_NODE_MAX_SIZE ? SCATTER_NODE_MAX_SIZE : size;
+        if (scatter_node_num == SCATTER_NODE_MAX) {
+            return false;
+        }
+        config.SrcAddress = src;
+        config.DstAddress = dst;
+        config.BlockDataLength = len;
+        if (HAL_MDMA_LinkedList_CreateNode(&scatter_nodes[scatter_node_num], &config) != HAL_OK) {
+            return false;
+        }
+        if (scatter_node_num) {
+            scatter_nodes[scatter_node_num - 1].CLAR = (uint32_t) (uintptr_t) &scatter_nodes[scatter_node_num];
+        }
+        scatter_node_num++;
+        src += zero ? 0 : len;
+        dst += len;
+        size -= len;
+    }
+
+    return true;
+}
+
+/**
+ * copy a table of addresses of a PIC image, the ones into the linked image moved by delta
+ */
+static void table_rebase(uint32_t *dst, const uint32_t *src, uint32_t size, const boot_image_header *header,
+                         uint32_t delta) {
+    uint32_t word;
+
+    for (uint32_t i = 0; i < size / 4; i++) {
+        word = src[i];
+        /* a Thumb function address is odd, it's in the range as well */
+        if (word - header->load_addr < header->image_size) {
+            word += delta;
+        }
+        dst[i] = word;
+    }
+}
+
+static bool section_decode(const boot_image_section *section, uint32_t image_addr) {
+    const uint8_t *in = (const uint8_t *) (uintptr_t) (image_addr + section->load_offset);
+    size_t in_len = section->load_size, out_len = 0, len;
+
+    if (!boot_heatshrink_init(&scatter_decoder, section->window_sz2, section->lookahead_sz2)) {
+        return false;
+    }
+    do {
+        len = boot_heatshrink_decode(&scatter_decoder, &in, &in_len, (uint8_t *) (uintptr_t) (section->run_addr
+                                     + out_len), section->run_size - out_len);
+        out_len += len;
+    } while (len && out_len < section->run_size);
+
+    /* the stream must fill the section exactly */
+    return out_len == section->run_size && in_len == 0;
+}
+
+/**
+ * check the RAM copy, the vector table copy and the section table of the image to boot, decode a compressed RAM
+ * image and the compressed sections and build the copy list, the RAM copy first, the vector table next; the GOT
+ * and the vector table of a PIC image are moved to the slot
+ *
+ * @param header image header, checked by boot_image_header_check()
+ * @param slot_mapped_addr memory-mapped address of the slot, the image is readable through it
+ *
+ * @return false: the table is bad, the image must not be booted
+ */
+bool boot_scatter_prepare(const boot_image_header *header, uint32_t slot_mapped_addr) {
+    boot_image_section sections[BOOT_IMAGE_SECTION_MAX];
+    uint32_t image_addr = slot_mapped_addr + BOOT_IMAGE_HEADER_SIZE;
+    uint32_t ram_size = (header->image_size + 3) & ~3UL, vector_size = 0;
+    uint32_t delta = boot_image_delta(header, slot_mapped_addr), vector = boot_image_vector(header, slot_mapped_addr);
+    size_t num = header->section_num, got_num = 0;
+
+    scatter_node_num = 0;
+    scatter_pic_base = 0;
+    if (header->flags & BOOT_IMAGE_FLAG_LZ4) {
+        if (!image_decode(header, image_addr, &ram_size)) {
+            return false;
+        }
+    } else if (header->flags & BOOT_IMAGE_FLAG_RAM) {
+        /* the whole image, a word more at most is read from the slot */
+        if (!image_check(header) || !nodes_add(image_addr, header->ram_addr, ram_size, false)) {
+            elog_e(TAG, "image of 0x%x bytes doesn't fit at 0x%08x", header->image_size, header->ram_addr);
+            return false;
+        }
+    } else {
+        ram_size = 0;
+    }
+    if (header->flags & BOOT_IMAGE_FLAG_VECTOR) {
+        vector_size = header->vector_size;
+        /* the initial SP stays, the handlers move with the image */
+        if (header->flags & BOOT_IMAGE_FLAG_PIC) {
+            table_rebase(scatter_vector, (const uint32_t *) (uintptr_t) vector, vector_size, header, delta);
+            scatter_vector[0] = *(const uint32_t *) (uintptr_t) vector;
+            vector = (uint32_t) (uintptr_t) scatter_vector;
+        }
+        if (!vector_check(header, ram_size) || !nodes_add(vector, header->vector_addr, vector_size, false)) {
+            elog_e(TAG, "vector table of 0x%x bytes doesn't fit at 0x%08x", vector_size, header->vector_addr);
+            scatter_node_num = 0;
+            return false;
+        }
+    }
+    if (!(header->flags & BOOT_IMAGE_FLAG_SECTIONS)) {
+        return true;
+    }
+    memcpy(sections, (const void *) (uintptr_t) (slot_mapped_addr + BOOT_IMAGE_SECTION_OFFSET),
+           num * sizeof(boot_image_section));
+    if (boot_image_crc32(0, sections, num * sizeof(boot_image_section)) != header->section_crc) {
+        elog_e(TAG, "section table CRC mismatch");
+        scatter_node_num = 0;
+        return false;
+    }
+    for (size_t i = 0; i < num; i++) {
+        if (!section_check(&sections[i], header->image_size)) {
+            elog_e(TAG, "section %u: bad range 0x%08x+0x%x, type %u", (unsigned) i, sections[i].run_addr,
+                   sections[i].run_size, sections[i].type);
+            scatter_node_num = 0;
+            return false;
+        }
+        if (ranges_overlap(sections[i].run_addr, sections[i].run_size, header->ram_addr, ram_size)) {
+            elog_e(TAG, "section %u overlaps the RAM image", (unsigned) i);
+            scatter_node_num = 0;
+            return false;
+        }
+        if (ranges_overlap(sections[i].run_addr, sections[i].run_size, header->vector_addr, vector_size)) {
+            elog_e(TAG, "section %u overlaps the vector table", (unsigned) i);
+            scatter_node_num = 0;
+            return false;
+        }
+        for (size_t j = 0; j < i; j++) {
+            if (ranges_overlap(sections[i].run_addr, sections[i].run_size, sections[j].run_addr,
+                               sections[j].run_size)) {
+                elog_e(TAG, "sections %u and %u overlap", (unsigned) j, (unsigned) i);
+                scatter_node_num = 0;
+                return false;
+            }
+        }
+        got_num += sections[i].type == BOOT_IMAGE_SECTION_GOT;
+    }
+    if (got_num != ((header->flags & BOOT_IMAGE_FLAG_PIC) ? 1U : 0U)) {
+        elog_e(TAG, "%u GOT sections, a PIC image takes one, another image none", (unsigned) got_num);
+        scatter_node_num = 0;
+        return false;
+    }
+
+    scatter_zero = 0;
+    for (size_t i = 0; i < num; i++) {
+        const boot_image_section *section = &sections[i];
+        bool ok;
+
+        switch (section->type) {
+        case BOOT_IMAGE_SECTION_HEATSHRINK:
+            ok = section_decode(section, image_addr);
+            break;
+        case BOOT_IMAGE_SECTION_ZERO:
+            ok = nodes_add((uint32_t) (uintptr_t) &scatter_zero, section->run_addr, section->run_size, true);
+            break;
+        case BOOT_IMAGE_SECTION_GOT:
+            table_rebase(scatter_got, (const uint32_t *) (uintptr_t) (image_addr + section->load_offset),
+                         section->run_size, header, delta);
+            ok = nodes_add((uint32_t) (uintptr_t) scatter_got, section->run_addr, section->run_size, false);
+            scatter_pic_base = section->run_addr;
+            break;
+        default:
+            ok = nodes_add(image_addr + section->load_offset, section->run_addr, section->run_size, false);
+            break;
+        }
+        if (!ok) {
+            elog_e(TAG, "section %u at 0x%08x not loaded", (unsigned) i, section->run_addr);
+            scatter_node_num = 0;
+            return false;
+        }
+        elog_d(TAG, "section %u: 0x%08x+0x%x, type %u", (unsigned) i, section->run_addr, section->run_size,
+               section->type);
+    }
+
+    return true;
+}
+
+/**
+ * @return true: boot_scatter_jump() has sections to copy
+ */
+bool boot_scatter_pending(void) {
+    return scatter_node_num != 0;
+}
+
+/**
+ * run the copy list and enter the application, called with the interrupts disabled
+ *
+ * @param stack_top initial MSP of the application
+ * @param vector_addr its vector table
+ * @param entry_addr its reset handler
+ */
+void boot_scatter_jump(uint32_t stack_top, uint32_t vector_addr, uint32_t entry_addr) {
+    MDMA_Channel_TypeDef *channel = SCATTER_MDMA_CHANNEL;
+    const MDMA_LinkNodeTypeDef *first = &scatter_nodes[0];
+    uint32_t ccr = MDMA_PRIORITY_VERY_HIGH | MDMA_CCR_EN;
+
+    __HAL_RCC_MDMA_CLK_ENABLE();
+    /* no dirty line of the bootloader may be written back over a section */
+    SCB_CleanInvalidateDCache();
+
+    channel->CCR = 0;
+    channel->CIFCR = MDMA_CIFCR_CTEIF | MDMA_CIFCR_CCTCIF | MDMA_CIFCR_CBRTIF | MDMA_CIFCR_CBTIF | MDMA_CIFCR_CLTCIF;
+    channel->CTCR = first->CTCR;
+    channel->CBNDTR = first->CBNDTR;
+    channel->CSAR = first->CSAR;
+    channel->CDAR = first->CDAR;
+    channel->CBRUR = first->CBRUR;
+    channel->CLAR = first->CLAR;
+    channel->CTBR = first->CTBR;
+    channel->CMAR = 0;
+    channel->CMDR = 0;
+    channel->CCR = ccr;
+    __DSB();
+
+    /* the sections may overwrite the stack and all the variables, registers only from the request on */
+    __ASM volatile(
+        "    str   %[swrq], [%[channel], %[ccr]]\n"
+        "1:  ldr   r3, [%[channel], %[isr]]\n"
+        "    tst   r3, %[error]\n"
+        "    bne   2f\n"
+        "    tst   r3, %[done]\n"
+        "    beq   1b\n"
+        "    movs  r3, #0\n"
+        "    str   r3, [%[scb], %[iciallu]]\n"
+        "    dsb\n"
+        "    isb\n"
+        "    str   %[vector], [%[scb], %[vtor]]\n"
+        "    msr   msp, %[sp]\n"
+        "    msr   control, r3\n"
+        "    isb\n"
+        "    mov   r9, %[pic]\n"
+        "    cpsie i\n"
+        "    bx    %[entry]\n"
+        "2:  str   %[reset], [%[scb], %[aircr]]\n"
+        "    dsb\n"
+        "3:  b     3b\n"
+        :
+        : [channel] "r" (channel), [swrq] "r" (ccr | MDMA_CCR_SWRQ), [scb] "r" (SCB),
+          [vector] "r" (vector_addr), [sp] "r" (stack_top), [entry] "r" (entry_addr), [pic] "r" (scatter_pic_base),
+          [reset] "r" ((0x5FAUL << SCB_AIRCR_VECTKEY_Pos) | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk)
+                       | SCB_AIRCR_SYSRESETREQ_Msk),
+          [ccr] "i" (offsetof(MDMA_Channel_TypeDef, CCR)), [isr] "i" (offsetof(MDMA_Channel_TypeDef, CISR)),
+          [iciallu] "i" (offsetof(SCB_Type, ICIALLU)), [vtor] "i" (offsetof(SCB_Type, VTOR)),
+          [aircr] "i" (offsetof(SCB_Type, AIRCR)), [error] "i" (MDMA_CISR_TEIF), [done] "i" (MDMA_CISR_CTCIF)
+        : "r3", "r9", "cc", "memory");
+    __builtin_unreachable();
+}
@@ -0,0 +1,102 @@
+/**
+ * @file boot_sched.c
+ * @brief Cooperative run-to-completion scheduler of the update mode, see boot_sched.h.
+ */
+#include "boot_sched.h"
+#include "main.h"
+#include <stddef.h>
+#include <string.h>
+
+static boot_task *task_list;
+/* set by every post, a pass which saw none ready may sleep only when no post came since it started */
+static volatile bool task_posted;
+static boot_sched_stats sched_stats;
+
+void boot_sched_add(boot_task *task) {
+    boot_task **link = &task_list;
+
+    while (*link) {
+        link = &(*link)->next;
+    }
+    task->next = NULL;
+    *link = task;
+    boot_sched_post(task);
+}
+
+void boot_sched_post(boot_task *task) {
+    task->ready = true;
+    task_posted = true;
+}
+
+/**
+ * run one pass over the ready tasks
+ *
+ * @return true: a task ran
+ */
+static bool sched_pass(void) {
+    boot_task *task;
+    bool ran = false;
+
+    sched_stats.passes++;
+    for (task = task_list; task; task = task->next) {
+        if (!task->ready) {
+            continue;
+        }
+        /* cleared before the run, a post while it runs makes it ready again */
+        task->ready = false;
+        if (task->run(task)) {
+            boot_sched_post(task);
+        }
+        sched_stats.runs++;
+        ran = true;
+    }
+    return ran;
+}
+
+/**
+ * wait for an interrupt unless a post came in, the interrupt masked till the WFI takes it
+ */
+static void sched_sleep(void) {
+    uint32_t start;
+
+    __disable_irq();
+    if (!task_posted) {
+        start = DWT->CYCCNT;
+        /* a pending interrupt ends the WFI with PRIMASK set, its handler runs at the unmask */
+        __DSB();
+        __WFI();
+        sched_stats.idle_cycles += DWT->CYCCNT - start;
+        sched_stats.sleeps++;
+    }
+    __enable_irq();
+}
+
+/**
+ * run the tasks of the run list till done(arg) is true, then empty the list
+ *
+ * @param done checked before every pass, after every sleep at the latest
+ * @param arg argument of done
+ */
+void boot_sched_run(bool (*done)(void *arg), void *arg) {
+    uint32_t start;
+
+    memset(&sched_stats, 0, sizeof(sched_stats));
+    while (!done(arg)) {
+        task_posted = false;
+        start = DWT->CYCCNT;
+        if (sched_pass()) {
+            sched_stats.busy_cycles += DWT->CYCCNT - start;
+        }
+        if (!task_posted) {
+            sched_sleep();
+        }
+    }
+    task_list = NULL;
+}
+
+/**
+ * @param stats counters of the last boot_sched_run(), or of the one running
+ */
+void boot_sched_get_stats(boot_sched_stats *stats) {
+    *stats = sched_stats;
+}
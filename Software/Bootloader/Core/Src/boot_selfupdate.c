@@ -0,0 +1,253 @@
+/**
+ * @file boot_selfupdate.c
+ * @brief Update of the bootloader itself from the littlefs of the EXT flash, see boot_selfupdate.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_SELFUPDATE
+
+#include "boot_selfupdate.h"
+
+#ifdef BOOT_LFS
+
+#include "boot_cmp.h"
+#include "boot_crc.h"
+#include "boot_ed25519.h"
+#include "boot_hash.h"
+#include "boot_image.h"
+#include "boot_kv.h"
+#include "boot_lfs.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "self");
+
+#define SELF_WORD_SIZE                  (FLASH_NB_32BITWORD_IN_FLASHWORD * 4)
+/* bank 1 error flags, the CCR1 bits are at the same places */
+#define SELF_SR_ERRORS                  FLASH_FLAG_ALL_ERRORS_BANK1
+/* IWDG1 reload key, harmless while it doesn't run: an option byte may start it at reset */
+#define SELF_IWDG_RELOAD                0xAAAAU
+
+/* end of the RAM_D1 data of the bootloader, see the linker script: the RAM copy goes after it */
+extern uint32_t _ebss, _eram_d1;
+
+static uint8_t self_file_buf[BOOT_LFS_CACHE_SIZE];
+#ifdef BOOT_SIGN_KEY
+static const uint8_t sign_key[BOOT_ED25519_KEY_SIZE] = {BOOT_SIGN_KEY};
+#endif
+
+/**
+ * wait the end of a bank 1 operation, the sector erase takes long enough for a hardware IWDG
+ *
+ * @return true: no error flagged
+ */
+__attribute__((section(".itcm_text"), noinline))
+static bool self_flash_wait(void) {
+    while (FLASH->SR1 & (FLASH_SR_QW | FLASH_SR_BSY)) {
+        IWDG1->KR = SELF_IWDG_RELOAD;
+    }
+    return !(FLASH->SR1 & SELF_SR_ERRORS);
+}
+
+/**
+ * erase the sector, program the flash words of the copy which aren't blank and read them back
+ *
+ * @param image the sector as it has to be, FLASH_SECTOR_SIZE bytes
+ */
+__attribute__((section(".itcm_text"), noinline))
+static bool self_flash_round(const uint32_t *image) {
+    volatile uint32_t *dst = (volatile uint32_t *) BOOT_SELFUPDATE_ADDR;
+    const uint32_t *src = image;
+    uint32_t i, j, blank;
+
+    FLASH->CCR1 = SELF_SR_ERRORS;
+    /* SNB 0, the one sector of the bank */
+    FLASH->CR1 = FLASH_VOLTAGE_RANGE_3 | FLASH_CR_SER;
+    FLASH->CR1 |= FLASH_CR_START;
+    if (!self_flash_wait()) {
+        FLASH->CR1 = FLASH_VOLTAGE_RANGE_3;
+        return false;
+    }
+
+    /* a flash word takes one program, its 8 words fill the write buffer back to back */
+    FLASH->CR1 = FLASH_VOLTAGE_RANGE_3 | FLASH_CR_PG;
+    for (i = 0; i < FLASH_SECTOR_SIZE / SELF_WORD_SIZE; i++, src += FLASH_NB_32BITWORD_IN_FLASHWORD,
+            dst += FLASH_NB_32BITWORD_IN_FLASHWORD) {
+        blank = 0xFFFFFFFFU;
+        for (j = 0; j < FLASH_NB_32BITWORD_IN_FLASHWORD; j++) {
+            blank &= src[j];
+        }
+        if (blank == 0xFFFFFFFFU) {
+            continue;
+        }
+        __ISB();
+        __DSB();
+        for (j = 0; j < FLASH_NB_32BITWORD_IN_FLASHWORD; j++) {
+            dst[j] = src[j];
+        }
+        __ISB();
+        __DSB();
+        if (!self_flash_wait()) {
+            break;
+        }
+    }
+    FLASH->CR1 = FLASH_VOLTAGE_RANGE_3;
+    if (i < FLASH_SECTOR_SIZE / SELF_WORD_SIZE) {
+        return false;
+    }
+
+    /* the D-cache is off, the reads go to the flash */
+    dst = (volatile uint32_t *) BOOT_SELFUPDATE_ADDR;
+    for (i = 0; i < FLASH_SECTOR_SIZE / 4; i++) {
+        if (dst[i] != image[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * put the copy into the internal flash and reset, nothing of the internal flash runs from here on
+ */
+__attribute__((section(".itcm_text"), noinline, noreturn))
+static void self_flash(const uint32_t *image) {
+    uint32_t i;
+
+    __disable_irq();
+    FLASH->KEYR1 = FLASH_KEY1;
+    FLASH->KEYR1 = FLASH_KEY2;
+    for (i = 0; i < BOOT_SELFUPDATE_TRIES && !self_flash_round(image); i++) {
+    }
+    FLASH->CR1 |= FLASH_CR_LOCK;
+
+    /* NVIC_SystemReset() by hand, the CMSIS one isn't forced inline and may be a call into the flash */
+    __DSB();
+    SCB->AIRCR = (0x5FAUL << SCB_AIRCR_VECTKEY_Pos) | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk)
+            | SCB_AIRCR_SYSRESETREQ_Msk;
+    __DSB();
+    while (1) {
+    }
+}
+
+/**
+ * the header of a bootloader image: linked at the internal flash, plain, clear of the OTFDEC key record
+ */
+static bool self_header_check(const boot_image_header *header) {
+    return header->magic == BOOT_IMAGE_MAGIC && header->header_version >= BOOT_IMAGE_HEADER_VERSION_MIN
+            && header->header_version <= BOOT_IMAGE_HEADER_VERSION && header->header_size == BOOT_IMAGE_HEADER_SIZE
+            && header->header_crc == boot_image_crc32(0, header, offsetof(boot_image_header, header_crc))
+            && header->flags == 0 && header->load_addr == BOOT_SELFUPDATE_ADDR
+            && header->exec_addr == BOOT_SELFUPDATE_ADDR && header->image_size >= 8
+            && header->image_size <= BOOT_SELFUPDATE_SIZE_MAX;
+}
+
+/**
+ * read the image of the file into the RAM copy and check it there
+ *
+ * @param image FLASH_SECTOR_SIZE bytes, the image then 0xFF
+ */
+static bool self_read(lfs_t *lfs, lfs_file_t *file, const boot_image_header *header, uint8_t *image) {
+    uint8_t digest[BOOT_HASH_SIZE];
+    uint32_t crc;
+#ifdef BOOT_SIGN_KEY
+    /* the header area first, where the image goes next: the signature covers it up to the signature */
+    if (lfs_file_seek(lfs, file, 0, LFS_SEEK_SET) < 0
+            || lfs_file_read(lfs, file, image, BOOT_IMAGE_HEADER_SIZE) != (lfs_ssize_t) BOOT_IMAGE_HEADER_SIZE
+            || memcmp(image, header, sizeof(boot_image_header)) != 0
+            || !boot_ed25519_verify(image + BOOT_IMAGE_SIGNATURE_OFFSET, image, BOOT_IMAGE_SIGNATURE_OFFSET,
+                                    sign_key)) {
+        elog_e(TAG, "bootloader image signature bad");
+        return false;
+    }
+#endif
+    if (lfs_file_seek(lfs, file, BOOT_IMAGE_HEADER_SIZE, LFS_SEEK_SET) < 0
+            || lfs_file_read(lfs, file, image, header->image_size) != (lfs_ssize_t) header->image_size) {
+        elog_e(TAG, "%s is short", BOOT_SELFUPDATE_PATH);
+        return false;
+    }
+    memset(image + header->image_size, 0xFF, FLASH_SECTOR_SIZE - header->image_size);
+    /* the MDMA of the CRC reads the RAM, not the cache */
+    SCB_CleanDCache_by_Addr((uint32_t *) image, (int32_t) header->image_size);
+    if (!boot_crc32_hw(image, header->image_size, &crc) || crc != header->image_crc) {
+        elog_e(TAG, "bootloader image CRC bad");
+        return false;
+    }
+    if (hash_memory(image, header->image_size, digest) != SFUD_SUCCESS
+            || memcmp(digest, header->image_hash, sizeof(digest)) != 0) {
+        elog_e(TAG, "bootloader image SHA-256 bad");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * update the bootloader from the file system when its image is a new one
+ *
+ * @param lfs mounted file system of the EXT flash, see boot_lfs_mount()
+ *
+ * @return false: no new image, or it didn't check out; a new one resets into it and doesn't return
+ */
+bool boot_selfupdate_run(lfs_t *lfs) {
+    struct lfs_file_config file_cfg = {.buffer = self_file_buf};
+    uintptr_t ram = ((uintptr_t) &_ebss + 31) & ~(uintptr_t) 31;
+    uint8_t *image = (uint8_t *) ram;
+    uint32_t start = HAL_GetTick(), done_crc;
+    boot_image_header header;
+    lfs_file_t file;
+    size_t len;
+    bool good;
+
+    if (lfs_file_opencfg(lfs, &file, BOOT_SELFUPDATE_PATH, LFS_O_RDONLY, &file_cfg) != LFS_ERR_OK) {
+        return false;
+    }
+    if (lfs_file_read(lfs, &file, &header, sizeof(header)) != (lfs_ssize_t) sizeof(header)
+            || !self_header_check(&header)) {
+        elog_w(TAG, "%s is not a bootloader image", BOOT_SELFUPDATE_PATH);
+        lfs_file_close(lfs, &file);
+        return false;
+    }
+    if (boot_kv_get(BOOT_SELFUPDATE_KV_KEY, &done_crc, sizeof(done_crc), &len) == SFUD_SUCCESS
+            && len == sizeof(done_crc) && done_crc == header.header_crc) {
+        lfs_file_close(lfs, &file);
+        return false;
+    }
+    if ((uintptr_t) &_eram_d1 - ram < FLASH_SECTOR_SIZE) {
+        elog_e(TAG, "no RAM_D1 left for the bootloader image");
+        lfs_file_close(lfs, &file);
+        return false;
+    }
+    good = self_read(lfs, &file, &header, image);
+    lfs_file_close(lfs, &file);
+    if (!good) {
+        return false;
+    }
+
+    /* the same image already runs, only the record was missing */
+    if (boot_cmp_equal(image, (const void *) BOOT_SELFUPDATE_ADDR, BOOT_SELFUPDATE_SIZE_MAX)) {
+        elog_i(TAG, "bootloader %08x is the running one", (unsigned) header.image_version);
+        boot_kv_set(BOOT_SELFUPDATE_KV_KEY, &header.header_crc, sizeof(header.header_crc));
+        return false;
+    }
+    if (!(FLASH->WPSN_CUR1 & 1U)) {
+        elog_e(TAG, "the internal flash is write protected");
+        return false;
+    }
+    memcpy(image + BOOT_SELFUPDATE_SIZE_MAX, (const void *) BOOT_OTFDEC_KEY_ADDR, SELF_WORD_SIZE);
+
+    elog_i(TAG, "bootloader %08x, %u bytes checked in %u ms, programming the internal flash",
+           (unsigned) header.image_version, (unsigned) header.image_size, (unsigned) (HAL_GetTick() - start));
+    /* recorded first, the reset comes from the ITCM */
+    boot_kv_set(BOOT_SELFUPDATE_KV_KEY, &header.header_crc, sizeof(header.header_crc));
+    boot_kv_flush();
+#ifdef SFUD_USING_QSPI_QPI
+    /* the new bootloader probes the MAIN flash in SPI mode, the reset doesn't reach it */
+    sfud_qspi_qpi_disable(sfud_get_device(SFUD_MAIN_FLASH));
+#endif
+    elog_port_flush();
+    while (!(USART2->ISR & USART_ISR_TC)) {
+    }
+    /* cleaned on the way, the copy is in the RAM and the read back sees the flash, not stale lines */
+    SCB_DisableDCache();
+    self_flash((const uint32_t *) image);
+}
+
+#endif /* BOOT_LFS */
@@ -0,0 +1,568 @@
+/**
+ * @file boot_slot.c
+ * @brief A/B application slots and the slot-selection record, see boot_slot.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_SLOT
+
+#include "boot_slot.h"
+#include "boot_cmp.h"
+#include "boot_crc.h"
+#include "boot_ed25519.h"
+#include "boot_hash.h"
+#include "boot_recv.h"
+#include "boot_trial.h"
+#include "boot_verify.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "slot");
+
+#if defined(BOOT_SIGN_KEY) && !defined(BOOT_SLOT_VERIFY_HASH)
+#error "the signature covers the image through its SHA-256, BOOT_SIGN_KEY needs BOOT_SLOT_VERIFY_HASH"
+#endif
+
+#define RECORDS_PER_SECTOR              (BOOT_SLOT_RECORD_SECTOR_SIZE / sizeof(boot_slot_record))
+/* records read at once while scanning */
+#define RECORDS_PER_READ                8
+
+typedef struct {
+    boot_slot_record latest;                     /**< record in force, valid when found */
+    bool found;
+    uint8_t latest_sector;                       /**< sector holding the latest record */
+    uint16_t free_index[BOOT_SLOT_RECORD_SECTOR_NUM]; /**< first erased entry, RECORDS_PER_SECTOR: full */
+} record_scan_result;
+
+#ifdef BOOT_SIGN_KEY
+static bool image_sign_check(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header);
+#endif
+
+static uint32_t record_crc(const boot_slot_record *record) {
+    return boot_image_crc32(0, record, offsetof(boot_slot_record, crc));
+}
+
+static bool record_is_valid(const boot_slot_record *record) {
+    return record->magic == BOOT_SLOT_RECORD_MAGIC && record->active < BOOT_SLOT_NUM
+            && record->crc == record_crc(record);
+}
+
+/**
+ * scan both record sectors for the latest record and the append positions
+ */
+static sfud_err record_scan(const sfud_flash *flash, record_scan_result *scan) {
+    boot_slot_record records[RECORDS_PER_READ];
+    sfud_err result;
+
+    memset(scan, 0, sizeof(record_scan_result));
+    for (uint8_t sector = 0; sector < BOOT_SLOT_RECORD_SECTOR_NUM; sector++) {
+        uint32_t addr = BOOT_SLOT_RECORD_ADDR + sector * BOOT_SLOT_RECORD_SECTOR_SIZE;
+        uint16_t index = 0;
+        bool erased = false;
+
+        /* entries are appended in order, the first erased one ends the log of this sector */
+        while (!erased && index < RECORDS_PER_SECTOR) {
+            result = sfud_read(flash, addr + index * sizeof(boot_slot_record), sizeof(records), (uint8_t *) records);
+            if (result != SFUD_SUCCESS) {
+                return result;
+            }
+            for (uint8_t i = 0; i < RECORDS_PER_READ; i++, index++) {
+                if (boot_cmp_blank(&records[i], sizeof(boot_slot_record))) {
+                    erased = true;
+                    break;
+                }
+                /* a torn entry is skipped, the next append goes behind it */
+                if (record_is_valid(&records[i]) && (!scan->found || records[i].seq > scan->latest.seq)) {
+                    scan->latest = records[i];
+                    scan->latest_sector = sector;
+                    scan->found = true;
+                }
+            }
+        }
+        scan->free_index[sector] = index;
+    }
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * get the flash address of a slot
+ *
+ * @param slot slot
+ *
+ * @return address of the slot start (image header)
+ */
+uint32_t boot_slot_addr(boot_slot_id slot) {
+    return slot == BOOT_SLOT_B ? BOOT_SLOT_B_ADDR : BOOT_SLOT_A_ADDR;
+}
+
+/**
+ * read the slot-selection record in force
+ *
+ * @param flash MAIN flash, indirect or memory-mapped mode
+ * @param record the record
+ *
+ * @return SFUD_ERR_NOT_FOUND: no record was ever written
+ */
+sfud_err boot_slot_record_read(const sfud_flash *flash, boot_slot_record *record) {
+    record_scan_result scan;
+    sfud_err result = record_scan(flash, &scan);
+
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    if (!scan.found) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    *record = scan.latest;
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * get where boot_slot_switch() programs the next record
+ *
+ * @param flash MAIN flash, indirect or memory-mapped mode
+ * @param addr flash address of the next record, erased
+ *
+ * @return SFUD_ERR_NOT_FOUND: the sector in use is full, the next switch erases the other one first
+ */
+sfud_err boot_slot_record_next(const sfud_flash *flash, uint32_t *addr) {
+    record_scan_result scan;
+    sfud_err result = record_scan(flash, &scan);
+    uint8_t sector;
+
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    sector = scan.found ? scan.latest_sector : 0;
+    if (scan.free_index[sector] >= RECORDS_PER_SECTOR) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    *addr = BOOT_SLOT_RECORD_ADDR + sector * BOOT_SLOT_RECORD_SECTOR_SIZE
+            + scan.free_index[sector] * sizeof(boot_slot_record);
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * select the slot to boot next time by appending one record
+ *
+ * @note the image in the slot must be complete before, the record is the commit point
+ *
+ * @param flash MAIN flash, indirect mode
+ * @param slot slot to boot
+ *
+ * @return result
+ */
+sfud_err boot_slot_switch(const sfud_flash *flash, boot_slot_id slot) {
+    record_scan_result scan;
+    boot_slot_record record, check;
+    uint8_t sector = 0;
+    uint32_t addr;
+    sfud_err result;
+
+    if (slot >= BOOT_SLOT_NUM) {
+        return SFUD_ERR_WRITE;
+    }
+    result = record_scan(flash, &scan);
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+
+    memset(&record, 0xFF, sizeof(record));
+    record.magic = BOOT_SLOT_RECORD_MAGIC;
+    record.seq = scan.found ? scan.latest.seq + 1 : 0;
+    record.active = slot;
+    record.crc = record_crc(&record);
+
+    if (scan.found) {
+        sector = scan.latest_sector;
+    }
+    if (scan.free_index[sector] >= RECORDS_PER_SECTOR) {
+        /* the other sector only holds older records */
+        sector = (sector + 1) % BOOT_SLOT_RECORD_SECTOR_NUM;
+        result = sfud_erase(flash, BOOT_SLOT_RECORD_ADDR + sector * BOOT_SLOT_RECORD_SECTOR_SIZE,
+                            BOOT_SLOT_RECORD_SECTOR_SIZE);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+        scan.free_index[sector] = 0;
+    }
+
+    addr = BOOT_SLOT_RECORD_ADDR + sector * BOOT_SLOT_RECORD_SECTOR_SIZE
+            + scan.free_index[sector] * sizeof(boot_slot_record);
+    result = sfud_write(flash, addr, sizeof(record), (const uint8_t *) &record);
+    if (result == SFUD_SUCCESS) {
+        result = sfud_read(flash, addr, sizeof(check), (uint8_t *) &check);
+    }
+    if (result == SFUD_SUCCESS && !boot_cmp_equal(&record, &check, sizeof(record))) {
+        result = SFUD_ERR_WRITE;
+    }
+
+    return result;
+}
+
+/**
+ * pick the slot an update goes to, the one which isn't booted
+ *
+ * @note a selected slot without a valid header is taken before a good other one
+ *
+ * @param flash MAIN flash, indirect or memory-mapped mode
+ *
+ * @return slot to write
+ */
+boot_slot_id boot_slot_staging(const sfud_flash *flash) {
+    boot_slot_record record;
+    boot_image_header header;
+    boot_slot_id active = BOOT_SLOT_A;
+
+    if (boot_slot_record_read(flash, &record) == SFUD_SUCCESS) {
+        active = (boot_slot_id) record.active;
+    }
+    if (sfud_read(flash, boot_slot_addr(active), sizeof(header), (uint8_t *) &header) != SFUD_SUCCESS
+            || !boot_image_header_check(&header, OCTOSPI1_BASE + boot_slot_addr(active), BOOT_SLOT_SIZE)) {
+        return active;
+    }
+    return (boot_slot_id) ((active + 1) % BOOT_SLOT_NUM);
+}
+
+/**
+ * select a freshly written slot when its header checks out, on trial till the application confirms it
+ *
+ * @note an upload checked as received (boot_recv.h) is sealed here, any other image is checked in full by
+ *       boot_slot_select() at the next boot, a bad one falls back to the other slot
+ *
+ * @param flash MAIN flash, indirect mode
+ * @param slot written slot
+ * @param size bytes written to the slot, header area included
+ *
+ * @return SFUD_ERR_NOT_FOUND: no valid header or the image is longer than the bytes written
+ */
+sfud_err boot_slot_commit(const sfud_flash *flash, boot_slot_id slot, uint32_t size) {
+    boot_image_header header;
+    boot_slot_record record;
+    uint32_t addr = boot_slot_addr(slot);
+    sfud_err result = sfud_read(flash, addr, sizeof(header), (uint8_t *) &header);
+    const uint32_t *sector_crc;
+
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    sector_crc = boot_recv_take(slot, &header);
+    if (!boot_image_header_check(&header, OCTOSPI1_BASE + addr, BOOT_SLOT_SIZE)
+            || BOOT_IMAGE_HEADER_SIZE + header.image_size > size) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+#ifdef BOOT_SIGN_KEY
+    if (sector_crc && !image_sign_check(flash, slot, &header)) {
+        sector_crc = NULL;
+    }
+#endif
+    if (sector_crc) {
+        elog_i(TAG, "slot %c checked as received, sealed", 'A' + slot);
+        boot_verify_seal_crcs(slot, &header, sector_crc);
+    } else {
+        /* the new image is checked in full on its first boot */
+        boot_verify_clear();
+    }
+    /* the trial is for the record appended next, it comes in force with it */
+    result = boot_slot_record_read(flash, &record);
+    if (result == SFUD_SUCCESS || result == SFUD_ERR_NOT_FOUND) {
+        result = boot_trial_start(flash, slot, result == SFUD_SUCCESS ? record.seq + 1 : 0);
+    }
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    return boot_slot_switch(flash, slot);
+}
+
+/**
+ * check the CRC of the image, the CRC unit reads it from the memory-mapped window, where the slot stores it
+ */
+static bool image_crc_check(boot_slot_id slot, const boot_image_header *header) {
+    uint32_t start = DWT->CYCCNT, cycles, crc, kbps;
+
+    if (!boot_crc32_hw((const void *) (uintptr_t) (OCTOSPI1_BASE + boot_slot_addr(slot) + BOOT_IMAGE_HEADER_SIZE),
+                       header->image_size, &crc)) {
+        elog_e(TAG, "CRC unit failed");
+        return false;
+    }
+    cycles = DWT->CYCCNT - start;
+    kbps = cycles ? (uint32_t) ((uint64_t) header->image_size * (SystemCoreClock / 1000) / cycles) : 0;
+    elog_i(TAG, "CRC of %u bytes in %u us, %u.%03u MB/s", header->image_size,
+           (uint32_t) ((uint64_t) cycles * 1000000 / SystemCoreClock), kbps / 1000, kbps % 1000);
+
+    if (crc != header->image_crc) {
+        elog_e(TAG, "image CRC 0x%08x, expected 0x%08x", crc, header->image_crc);
+        return false;
+    }
+    return true;
+}
+
+#ifdef BOOT_SLOT_VERIFY_HASH
+/**
+ * check the SHA-256 of the image of a slot
+ */
+static bool image_hash_check(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header) {
+    uint8_t digest[BOOT_HASH_SIZE];
+    uint32_t start = DWT->CYCCNT;
+
+    if (hash_region(flash, boot_slot_addr(slot) + BOOT_IMAGE_HEADER_SIZE, header->image_size, digest) != SFUD_SUCCESS) {
+        elog_e(TAG, "HASH unit failed");
+        return false;
+    }
+    elog_i(TAG, "SHA-256 of %u bytes in %u us", header->image_size,
+           (uint32_t) ((uint64_t) (DWT->CYCCNT - start) * 1000000 / SystemCoreClock));
+
+    if (memcmp(digest, header->image_hash, BOOT_HASH_SIZE) != 0) {
+        elog_e(TAG, "image SHA-256 mismatch");
+        return false;
+    }
+    return true;
+}
+
+#ifdef BOOT_VERIFY_DEFER
+static void sector_mark(uint32_t *eager, uint32_t sectors, uint32_t offset, uint32_t size) {
+    for (uint32_t sector = offset / BOOT_IMAGE_SECTOR_SIZE;
+         sector < sectors && sector * BOOT_IMAGE_SECTOR_SIZE < offset + size; sector++) {
+        eager[sector / 32] |= 1UL << (sector % 32);
+    }
+}
+
+/**
+ * the sectors the boot needs checked before the jump: the first one, the one of the vector table, and those the
+ * section table copies to the RAM; the others may be left to the application, see boot_verify.h
+ *
+ * @return false: the section table isn't read, nothing is deferred
+ */
+static bool sectors_eager(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header,
+                          uint32_t *eager) {
+    uint32_t sectors = boot_image_sector_count(header), mapped = OCTOSPI1_BASE + boot_slot_addr(slot);
+    uint32_t vector = boot_image_vector(header, mapped) - (mapped + BOOT_IMAGE_HEADER_SIZE);
+    boot_image_section section;
+
+    memset(eager, 0, BOOT_VERIFY_CLEAN_WORDS * sizeof(uint32_t));
+    sector_mark(eager, sectors, 0, 1);
+    if (vector < header->image_size) {
+        sector_mark(eager, sectors, vector, BOOT_IMAGE_VECTOR_MAX);
+    }
+    if (!(header->flags & BOOT_IMAGE_FLAG_SECTIONS)) {
+        return true;
+    }
+    for (uint16_t i = 0; i < header->section_num; i++) {
+        if (sfud_read(flash, boot_slot_addr(slot) + BOOT_IMAGE_SECTION_OFFSET + i * sizeof(section),
+                      sizeof(section), (uint8_t *) &section) != SFUD_SUCCESS) {
+            return false;
+        }
+        sector_mark(eager, sectors, section.load_offset, section.load_size);
+    }
+    return true;
+}
+#endif /* BOOT_VERIFY_DEFER */
+
+/**
+ * check the sectors of an image with a sector table against it, the clean ones of boot_verify_sector_clean() unread
+ *
+ * @param table temp buffer of the sector table
+ */
+static bool sectors_check(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header,
+                          uint8_t *table) {
+    uint32_t sectors = boot_image_sector_count(header), len = sectors * BOOT_HASH_SIZE, hashed = 0, size;
+    uint32_t table_addr = boot_slot_addr(slot) + boot_image_sector_table(header);
+    uint32_t image_addr = boot_slot_addr(slot) + BOOT_IMAGE_HEADER_SIZE, start = DWT->CYCCNT, deferred = 0;
+    uint32_t pending[BOOT_VERIFY_CLEAN_WORDS] = {0};
+    uint8_t digest[BOOT_HASH_SIZE];
+#ifdef BOOT_VERIFY_DEFER
+    uint32_t eager[BOOT_VERIFY_CLEAN_WORDS];
+    uint32_t state = boot_verify_base_deferred(slot);
+    bool defer = state == BOOT_VERIFY_DEFER_NONE && !(header->flags & (BOOT_IMAGE_FLAG_RAM | BOOT_IMAGE_FLAG_ENCRYPTED))
+                 && sectors_eager(flash, slot, header, eager);
+
+    if (state == BOOT_VERIFY_DEFER_FAILED) {
+        elog_w(TAG, "the application found a bad sector in slot %c", 'A' + slot);
+    }
+#endif
+
+    if (sfud_read(flash, table_addr, len, table) != SFUD_SUCCESS
+            || hash_region(flash, table_addr, len, digest) != SFUD_SUCCESS) {
+        elog_e(TAG, "sector table not read");
+        return false;
+    }
+    if (memcmp(digest, header->sector_hash, BOOT_HASH_SIZE) != 0) {
+        elog_e(TAG, "sector table SHA-256 mismatch");
+        return false;
+    }
+    for (uint32_t sector = 0; sector < sectors; sector++) {
+        if (boot_verify_sector_clean(slot, sector, table + sector * BOOT_HASH_SIZE)) {
+            continue;
+        }
+#ifdef BOOT_VERIFY_DEFER
+        if (defer && !(eager[sector / 32] & (1UL << (sector % 32)))) {
+            pending[sector / 32] |= 1UL << (sector % 32);
+            deferred++;
+            continue;
+        }
+#endif
+        size = header->image_size - sector * BOOT_IMAGE_SECTOR_SIZE;
+        if (size > BOOT_IMAGE_SECTOR_SIZE) {
+            size = BOOT_IMAGE_SECTOR_SIZE;
+        }
+        if (hash_region(flash, image_addr + sector * BOOT_IMAGE_SECTOR_SIZE, size, digest) != SFUD_SUCCESS) {
+            elog_e(TAG, "HASH unit failed");
+            return false;
+        }
+        if (memcmp(digest, table + sector * BOOT_HASH_SIZE, BOOT_HASH_SIZE) != 0) {
+            elog_e(TAG, "sector %u SHA-256 mismatch", sector);
+            return false;
+        }
+        hashed++;
+    }
+    elog_i(TAG, "SHA-256 of %u of %u sectors in %u us, %u left to the application", hashed, sectors,
+           (uint32_t) ((uint64_t) (DWT->CYCCNT - start) * 1000000 / SystemCoreClock), deferred);
+    boot_verify_base_seal(slot, table, sectors, deferred ? pending : NULL);
+    return true;
+}
+
+static bool image_sector_check(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header) {
+    uint32_t sectors = boot_image_sector_count(header);
+    size_t mark = dma_alloc_mark(DMA_REGION_AXI);
+    uint8_t *table = dma_alloc_temp(sectors * BOOT_HASH_SIZE, DMA_REGION_AXI);
+    bool good;
+
+    if (!table || sectors > BOOT_VERIFY_SECTOR_NUM) {
+        elog_e(TAG, "no room for the sector table of %u sectors", sectors);
+        dma_alloc_release(DMA_REGION_AXI, mark);
+        return false;
+    }
+    good = sectors_check(flash, slot, header, table);
+    dma_alloc_release(DMA_REGION_AXI, mark);
+    return good;
+}
+#endif /* BOOT_SLOT_VERIFY_HASH */
+
+#ifdef BOOT_SIGN_KEY
+static const uint8_t sign_key[BOOT_ED25519_KEY_SIZE] = {BOOT_SIGN_KEY};
+
+/**
+ * check the Ed25519 signature of the header area up to the signature, the header and the section table, before the
+ * image is read for its CRC and hash
+ */
+static bool image_sign_check(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header) {
+    size_t mark = dma_alloc_mark(DMA_REGION_AXI);
+    uint8_t *area = dma_alloc_temp(BOOT_IMAGE_HEADER_SIZE, DMA_REGION_AXI);
+    uint32_t start;
+    bool good;
+
+    if (!area || sfud_read(flash, boot_slot_addr(slot), BOOT_IMAGE_HEADER_SIZE, area) != SFUD_SUCCESS) {
+        elog_e(TAG, "image header area not read");
+        dma_alloc_release(DMA_REGION_AXI, mark);
+        return false;
+    }
+    start = DWT->CYCCNT;
+    /* the header checked so far must be the one signed */
+    good = memcmp(area, header, sizeof(boot_image_header)) == 0
+            && boot_ed25519_verify(area + BOOT_IMAGE_SIGNATURE_OFFSET, area, BOOT_IMAGE_SIGNATURE_OFFSET, sign_key);
+    elog_i(TAG, "Ed25519 signature checked in %u us",
+           (uint32_t) ((uint64_t) (DWT->CYCCNT - start) * 1000000 / SystemCoreClock));
+    if (!good) {
+        elog_e(TAG, "image signature bad");
+    }
+    dma_alloc_release(DMA_REGION_AXI, mark);
+    return good;
+}
+#endif /* BOOT_SIGN_KEY */
+
+/**
+ * the full checks of an image, the ones the build and the image ask for
+ */
+static bool image_check(const sfud_flash *flash, boot_slot_id slot, const boot_image_header *header) {
+#ifdef BOOT_SIGN_KEY
+    if (!image_sign_check(flash, slot, header)) {
+        return false;
+    }
+#endif
+#ifdef BOOT_SLOT_VERIFY_HASH
+    if (header->flags & BOOT_IMAGE_FLAG_SECTOR_HASH) {
+        return image_sector_check(flash, slot, header);
+    }
+    return image_crc_check(slot, header) && image_hash_check(flash, slot, header);
+#else
+    return image_crc_check(slot, header);
+#endif
+}
+
+/**
+ * check a rotating sample of an image verified by an earlier boot
+ */
+static bool image_sample_check(const boot_image_header *header) {
+    uint32_t start = DWT->CYCCNT;
+
+    if (!boot_verify_sample(header)) {
+        return false;
+    }
+    elog_i(TAG, "verified before, %u sectors sampled in %u us", BOOT_VERIFY_SAMPLE_SECTORS,
+           (uint32_t) ((uint64_t) (DWT->CYCCNT - start) * 1000000 / SystemCoreClock));
+    return true;
+}
+
+/**
+ * the slot holds a valid image, by the sample of an earlier check or in full
+ */
+static bool slot_check(const sfud_flash *flash, boot_slot_id slot, boot_image_header *header) {
+    if (sfud_read(flash, boot_slot_addr(slot), sizeof(boot_image_header), (uint8_t *) header) != SFUD_SUCCESS
+            || !boot_image_header_check(header, OCTOSPI1_BASE + boot_slot_addr(slot), BOOT_SLOT_SIZE)) {
+        return false;
+    }
+    if (boot_verify_cached(slot, header)) {
+        if (image_sample_check(header)) {
+            return true;
+        }
+        elog_w(TAG, "slot %c changed since it was verified", 'A' + slot);
+    }
+    if (image_check(flash, slot, header)) {
+        /* an image with sectors left to the application is sealed by a later boot, once they passed */
+        if (!boot_verify_deferred()) {
+            boot_verify_seal_image(slot, header);
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * pick the slot to boot, the selected one first, the other one when it holds no valid image
+ *
+ * The boot is counted when the selected slot is on trial, see boot_trial.h. A trial over without a confirm puts
+ * the other slot first, it's selected again when its image is valid.
+ *
+ * @param flash MAIN flash, memory-mapped mode, the image CRC is read through the window
+ * @param header header of the image to boot
+ *
+ * @return slot to boot, BOOT_SLOT_NONE: no valid image
+ */
+boot_slot_id boot_slot_select(const sfud_flash *flash, boot_image_header *header) {
+    boot_slot_record record;
+    boot_slot_id slot = BOOT_SLOT_A, failed = BOOT_SLOT_NONE;
+
+    if (boot_slot_record_read(flash, &record) == SFUD_SUCCESS) {
+        slot = (boot_slot_id) record.active;
+        if (boot_trial_take(flash, &record) == BOOT_TRIAL_FAILED) {
+            failed = slot;
+            slot = (boot_slot_id) ((slot + 1) % BOOT_SLOT_NUM);
+        }
+    }
+
+    for (uint8_t i = 0; i < BOOT_SLOT_NUM; i++, slot = (boot_slot_id) ((slot + 1) % BOOT_SLOT_NUM)) {
+        if (slot_check(flash, slot, header)) {
+            if (failed != BOOT_SLOT_NONE && slot != failed) {
+                elog_w(TAG, "slot %c failed its trial, back to slot %c", 'A' + failed, 'A' + slot);
+                boot_slot_switch(flash, slot);
+            }
+            return slot;
+        }
+        elog_w(TAG, "no valid image in slot %c", 'A' + slot);
+    }
+
+    return BOOT_SLOT_NONE;
+}
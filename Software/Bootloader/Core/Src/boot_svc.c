@@ -0,0 +1,92 @@
+/**
+ * @file boot_svc.c
+ * @brief Service table of the bootloader, see boot_svc.h.
+ */
+#include "boot_svc.h"
+#include "boot_part.h"
+#include "boot_pcprof.h"
+#include "boot_trial.h"
+#include "boot_verify.h"
+#include "boot_warm.h"
+#include "main.h"
+#include <string.h>
+
+/**
+ * zlib CRC-32 by the CRC unit, fed by the CPU: no MDMA channel of the bootloader
+ *
+ * @param crc CRC of the bytes before, 0 to start
+ */
+static uint32_t svc_crc32(uint32_t crc, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *) buf;
+    uint32_t word;
+
+    __HAL_RCC_CRC_CLK_ENABLE();
+    /* as boot_crc32_hw(), the register holds the bit reversed running CRC */
+    CRC->POL = 0x04C11DB7;
+    CRC->INIT = __RBIT(~crc);
+    CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_IN_1 | CRC_CR_REV_OUT;
+    CRC->CR |= CRC_CR_RESET;
+
+    for (; size >= 4; size -= 4, p += 4) {
+        memcpy(&word, p, 4);
+        CRC->DR = word;
+    }
+    /* a byte write is reversed in itself */
+    CRC->CR = (CRC->CR & ~CRC_CR_REV_IN) | CRC_CR_REV_IN_0;
+    for (; size; size--) {
+        *(volatile uint8_t *) &CRC->DR = *p++;
+    }
+    return ~CRC->DR;
+}
+
+/**
+ * SHA-256 by the HASH unit, fed by the CPU, a write of a full FIFO waits for the HASH
+ */
+static void svc_sha256(const void *buf, size_t size, uint8_t *digest) {
+    const uint8_t *p = (const uint8_t *) buf;
+    uint32_t word = 0;
+    size_t n;
+
+    __HAL_RCC_HASH_CLK_ENABLE();
+    /* as hash_start(), 8 bits data so the byte stream is swapped into big-endian words */
+    HASH->CR = HASH_CR_ALGO_1 | HASH_CR_ALGO_0 | HASH_CR_DATATYPE_1;
+    HASH->CR |= HASH_CR_INIT;
+
+    for (n = size; n >= 4; n -= 4, p += 4) {
+        memcpy(&word, p, 4);
+        HASH->DIN = word;
+    }
+    if (n) {
+        word = 0;
+        memcpy(&word, p, n);
+        HASH->DIN = word;
+    }
+    /* valid bits of the last word, then the padding and the digest */
+    HASH->STR = (size % 4) * 8;
+    HASH->STR |= HASH_STR_DCAL;
+    while (!(HASH->SR & HASH_SR_DCIS)) {
+    }
+    for (uint8_t i = 0; i < BOOT_SVC_SHA256_SIZE / 4; i++) {
+        word = __REV(HASH_DIGEST->HR[i]);
+        memcpy(digest + i * 4, &word, 4);
+    }
+}
+
+/* placed at BOOT_SVC_TABLE_ADDR by the linker script */
+__attribute__((section(".boot_svc"), used))
+const boot_svc_table boot_svc = {
+    BOOT_SVC_MAGIC,
+    BOOT_SVC_VERSION,
+    sizeof(boot_svc_table),
+    boot_part_svc_read,
+    boot_part_svc_write,
+    boot_part_svc_erase,
+    svc_crc32,
+    svc_sha256,
+    boot_warm_enter,
+    boot_trial_svc_confirm,
+    boot_pcprof_svc_start,
+    boot_pcprof_svc_sample,
+    boot_pcprof_svc_stop,
+    boot_verify_svc_step,
+};
@@ -0,0 +1,114 @@
+/**
+ * @file boot_time.c
+ * @brief Monotonic microsecond time of the bootloader, see boot_time.h.
+ */
+#include "boot_time.h"
+#include "main.h"
+
+typedef struct {
+    uint64_t base_us;                            /**< the time at base_cycles */
+    uint32_t base_cycles;                        /**< DWT->CYCCNT of the last SysTick or clock change */
+    uint32_t mhz;                                /**< SystemCoreClock in MHz since base_cycles, 0: not read yet */
+    uint64_t last_us;                            /**< the latest reading, the next ones don't go below */
+} time_state;
+
+/* CYCCNT is reset to 0 by boot_profile_init(), the time starts there */
+static time_state boot_time;
+
+/**
+ * the time now, the interrupts are masked
+ */
+static uint64_t time_now(void) {
+    uint32_t cycles = DWT->CYCCNT, mhz = SystemCoreClock / 1000000U;
+    uint64_t now;
+
+    if (!boot_time.mhz) {
+        boot_time.mhz = mhz;
+    }
+    /* the cycles since the base ran at the clock of the base, a new clock counts from now on */
+    now = boot_time.base_us + (cycles - boot_time.base_cycles) / boot_time.mhz;
+    if (now < boot_time.last_us) {
+        now = boot_time.last_us;
+    }
+    if (mhz != boot_time.mhz) {
+        boot_time.base_us = now;
+        boot_time.base_cycles = cycles;
+        boot_time.mhz = mhz;
+    }
+    boot_time.last_us = now;
+    return now;
+}
+
+/**
+ * the cycles from now on count from the time given, the interrupts are masked
+ */
+static void time_rebase(uint64_t us) {
+    boot_time.base_us = us;
+    boot_time.base_cycles = DWT->CYCCNT;
+    boot_time.last_us = us;
+}
+
+/**
+ * microseconds since boot_profile_init(), any context
+ */
+uint64_t boot_time_us(void) {
+    uint32_t primask = __get_PRIMASK();
+    uint64_t now;
+
+    __disable_irq();
+    now = time_now();
+    __set_PRIMASK(primask);
+    return now;
+}
+
+/**
+ * the time us microseconds from now, for boot_time_expired()
+ */
+uint64_t boot_time_deadline(uint32_t us) {
+    return boot_time_us() + us;
+}
+
+bool boot_time_expired(uint64_t deadline) {
+    return boot_time_us() >= deadline;
+}
+
+/**
+ * wait us microseconds on the clock, not less, the interrupts may be masked
+ */
+void boot_time_delay_us(uint32_t us) {
+    uint64_t deadline = boot_time_deadline(us);
+
+    while (boot_time_us() < deadline) {
+    }
+}
+
+/**
+ * SysTick: a tick period since the last one at least, the cycles say more when the ticks were held off
+ */
+void boot_time_tick(void) {
+    uint32_t primask = __get_PRIMASK();
+    uint64_t now, next;
+
+    __disable_irq();
+    now = time_now();
+    next = boot_time.base_us + (uint64_t) uwTickFreq * 1000U;
+    time_rebase(now > next ? now : next);
+    __set_PRIMASK(primask);
+}
+
+/**
+ * milliseconds of the clock, it moves on with the interrupts masked too
+ */
+uint32_t HAL_GetTick(void) {
+    return (uint32_t) (boot_time_us() / 1000U);
+}
+
+/**
+ * wait Delay milliseconds, the HAL one waits a tick more
+ */
+void HAL_Delay(uint32_t Delay) {
+    uint64_t deadline = boot_time_us() + (uint64_t) Delay * 1000U;
+
+    while (boot_time_us() < deadline) {
+    }
+}
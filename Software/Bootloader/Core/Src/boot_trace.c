@@ -0,0 +1,220 @@
+/**
+ * @file boot_trace.c
+ * @brief Latency trace of the DMA transfers and the interrupts, see boot_trace.h.
+ */
+#include "boot_trace.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+/* placed after the fault record by the linker script, see BOOT_TRACE_ADDR */
+boot_trace boot_trace_record __attribute__((section(".boot_trace")));
+
+static const char *const ch_names[BOOT_TRACE_CH_NUM] = {
+    "ospi dma", "spi2 dma", "usart2 dma", "mdma copy", "esp event", "esp xfer",
+};
+
+/* 4 buckets per octave: the top 3 bits of the cycles, the first octave 0~31 in steps of 8 */
+static uint32_t trace_bucket(uint32_t cycles) {
+    uint32_t msb, bucket;
+
+    if (cycles < 32) {
+        return cycles >> 3;
+    }
+    msb = 31U - __CLZ(cycles);
+    bucket = (msb - 4U) * 4U + ((cycles >> (msb - 2U)) & 3U);
+    return bucket < BOOT_TRACE_HIST_NUM ? bucket : BOOT_TRACE_HIST_NUM - 1;
+}
+
+/* the first cycles count of the next bucket */
+static uint32_t trace_bucket_end(uint32_t bucket) {
+    bucket++;
+    if (bucket < 4) {
+        return bucket * 8U;
+    }
+    if (bucket >= BOOT_TRACE_HIST_NUM) {
+        return UINT32_MAX;
+    }
+    return (4U + bucket % 4U) << (bucket / 4U + 2U);
+}
+
+static void trace_push(uint32_t cycles, uint8_t event, uint32_t arg) {
+    boot_trace *trace = &boot_trace_record;
+    boot_trace_entry *entry;
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    entry = &trace->ring[trace->head++ % BOOT_TRACE_RING_NUM];
+    __set_PRIMASK(primask);
+    entry->cycles = cycles;
+    entry->event = event;
+    entry->reserved = 0;
+    entry->arg = arg > 0xFFFF ? 0xFFFF : (uint16_t) arg;
+}
+
+/**
+ * clear the record, the DWT counter runs
+ *
+ * @note right after boot_profile_init(), on every path
+ */
+void boot_trace_init(void) {
+    boot_trace *trace = &boot_trace_record;
+
+    memset(trace, 0, sizeof(boot_trace));
+    trace->version = BOOT_TRACE_VERSION;
+    trace->ch_num = BOOT_TRACE_CH_NUM;
+    for (int i = 0; i < BOOT_TRACE_CH_NUM; i++) {
+        trace->stat[i].min = UINT32_MAX;
+    }
+}
+
+/**
+ * a transfer or wait of the channel starts
+ *
+ * @param arg bytes of the transfer, for the ring
+ */
+void boot_trace_begin(boot_trace_ch ch, uint32_t arg) {
+    uint32_t now = DWT->CYCCNT;
+    boot_trace_stat *stat;
+
+    if (ch >= BOOT_TRACE_CH_NUM) {
+        return;
+    }
+    stat = &boot_trace_record.stat[ch];
+    stat->begin = now;
+    stat->open = 1;
+    trace_push(now, (uint8_t) ch, arg);
+}
+
+/**
+ * the transfer of the last begin of the channel is over, from its interrupt or callback
+ *
+ * @param arg bytes of the transfer, for the ring
+ */
+void boot_trace_end(boot_trace_ch ch, uint32_t arg) {
+    uint32_t now = DWT->CYCCNT, cycles, bucket;
+    boot_trace_stat *stat;
+
+    if (ch >= BOOT_TRACE_CH_NUM) {
+        return;
+    }
+    stat = &boot_trace_record.stat[ch];
+    trace_push(now, (uint8_t) ch | BOOT_TRACE_EVENT_END, arg);
+    if (!stat->open) {
+        return;
+    }
+    stat->open = 0;
+    cycles = now - stat->begin;
+    stat->count++;
+    stat->sum += cycles;
+    if (cycles < stat->min) {
+        stat->min = cycles;
+    }
+    if (cycles > stat->max) {
+        stat->max = cycles;
+    }
+    bucket = trace_bucket(cycles);
+    if (stat->hist[bucket] != 0xFFFF) {
+        stat->hist[bucket]++;
+    }
+}
+
+/**
+ * @param pct percentile, 1~100
+ *
+ * @return cycles, the upper edge of the bucket of the rank, max at most; 0: no pair
+ */
+static uint32_t trace_percentile(const boot_trace_stat *stat, uint32_t pct) {
+    uint32_t total = 0, rank, sum = 0, end;
+
+    /* the counts, not stat->count, a saturated bucket holds fewer */
+    for (uint32_t i = 0; i < BOOT_TRACE_HIST_NUM; i++) {
+        total += stat->hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    rank = (total * pct + 99U) / 100U;
+    for (uint32_t i = 0; i < BOOT_TRACE_HIST_NUM; i++) {
+        sum += stat->hist[i];
+        if (sum >= rank) {
+            end = trace_bucket_end(i);
+            return end - 1U < stat->max ? end - 1U : stat->max;
+        }
+    }
+    return stat->max;
+}
+
+uint32_t boot_trace_percentile(boot_trace_ch ch, uint32_t pct) {
+    return ch < BOOT_TRACE_CH_NUM ? trace_percentile(&boot_trace_record.stat[ch], pct) : 0;
+}
+
+void boot_trace_summarize(boot_trace_ch ch, boot_trace_summary *summary) {
+    const boot_trace_stat *stat;
+
+    memset(summary, 0, sizeof(boot_trace_summary));
+    if (ch >= BOOT_TRACE_CH_NUM || boot_trace_record.stat[ch].count == 0) {
+        return;
+    }
+    stat = &boot_trace_record.stat[ch];
+    summary->count = stat->count;
+    summary->avg = (uint32_t) (stat->sum / stat->count);
+    summary->p50 = trace_percentile(stat, 50);
+    summary->p99 = trace_percentile(stat, 99);
+    summary->max = stat->max;
+}
+
+const char *boot_trace_ch_name(boot_trace_ch ch) {
+    return ch < BOOT_TRACE_CH_NUM ? ch_names[ch] : "?";
+}
+
+/**
+ * publish the record to the application
+ *
+ * @note at the jump, next to boot_profile_finish()
+ */
+void boot_trace_finish(void) {
+    boot_trace_record.core_clock_hz = SystemCoreClock;
+    boot_trace_record.magic = BOOT_TRACE_MAGIC;
+    SCB_CleanDCache_by_Addr((uint32_t *) &boot_trace_record, sizeof(boot_trace_record));
+}
+
+/**
+ * print the channels and the last events of the ring, for the console
+ */
+void boot_trace_print(void) {
+    static boot_trace copy;
+    const boot_trace *trace = &copy;
+    uint32_t mhz = SystemCoreClock / 1000000U, count, first;
+    uint32_t primask = __get_PRIMASK();
+
+    /* the handlers go on meanwhile, the copy is of one instant */
+    __disable_irq();
+    memcpy(&copy, &boot_trace_record, sizeof(boot_trace));
+    __set_PRIMASK(primask);
+
+    elog_raw("%-12s %8s %10s %10s %10s %10s %10s %10s\r\n", "cycles", "count", "min", "avg", "p50", "p90", "p99",
+             "max");
+    for (int i = 0; i < BOOT_TRACE_CH_NUM; i++) {
+        const boot_trace_stat *stat = &trace->stat[i];
+
+        if (stat->count == 0) {
+            continue;
+        }
+        elog_raw("%-12s %8u %10u %10u %10u %10u %10u %10u\r\n", ch_names[i], stat->count, stat->min,
+                 (uint32_t) (stat->sum / stat->count), trace_percentile(stat, 50), trace_percentile(stat, 90),
+                 trace_percentile(stat, 99), stat->max);
+    }
+
+    count = trace->head < BOOT_TRACE_RING_NUM ? trace->head : BOOT_TRACE_RING_NUM;
+    first = trace->head - count;
+    elog_raw("last %u of %u events, at %u MHz\r\n", count, trace->head, mhz);
+    for (uint32_t n = first; n < trace->head; n++) {
+        const boot_trace_entry *entry = &trace->ring[n % BOOT_TRACE_RING_NUM];
+        uint32_t delta = n > first ? entry->cycles - trace->ring[(n - 1) % BOOT_TRACE_RING_NUM].cycles : 0;
+
+        elog_raw("%10u %10u %-12s %-5s %u\r\n", entry->cycles, delta,
+                 boot_trace_ch_name((boot_trace_ch) (entry->event & ~BOOT_TRACE_EVENT_END)),
+                 (entry->event & BOOT_TRACE_EVENT_END) ? "end" : "begin", entry->arg);
+    }
+}
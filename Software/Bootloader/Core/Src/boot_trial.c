@@ -0,0 +1,225 @@
+/**
+ * @file boot_trial.c
+ * @brief Trial boots of a new image, see boot_trial.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_TRIAL
+
+#include "boot_trial.h"
+#include "boot_cmp.h"
+#include "boot_image.h"
+#include "boot_part.h"
+#include "boot_svc.h"
+#include "main.h"
+#include "elog.h"
+#include <stddef.h>
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "trial");
+
+/* entries read at once while scanning */
+#define ENTRIES_PER_READ                8
+#define TRIAL_COUNT_BITS                (BOOT_TRIAL_COUNT_WORDS * 32)
+
+typedef struct {
+    boot_trial_entry latest;                     /**< the last valid entry, when found */
+    bool found;
+    uint32_t addr;                               /**< flash address of latest */
+    uint16_t free_index;                         /**< first erased entry, BOOT_TRIAL_ENTRY_NUM: full */
+} trial_scan_result;
+
+/* this boot is counted in a trial */
+static bool trial_pending;
+
+static uint32_t entry_crc(const boot_trial_entry *entry) {
+    return boot_image_crc32(0, entry, offsetof(boot_trial_entry, crc));
+}
+
+static bool entry_is_valid(const boot_trial_entry *entry) {
+    return entry->magic == BOOT_TRIAL_MAGIC && entry->slot < BOOT_SLOT_NUM && entry->boots <= TRIAL_COUNT_BITS
+            && entry->crc == entry_crc(entry);
+}
+
+/* the boots taken, the bits of count cleared */
+static uint32_t entry_boots_taken(const boot_trial_entry *entry) {
+    uint32_t taken = 0;
+
+    for (uint8_t i = 0; i < BOOT_TRIAL_COUNT_WORDS; i++) {
+        taken += 32U - (uint32_t) __builtin_popcount(entry->count[i]);
+    }
+    return taken;
+}
+
+/**
+ * find the last valid entry and the first erased one of the trial sector
+ */
+static sfud_err trial_scan(const sfud_flash *flash, trial_scan_result *scan) {
+    boot_trial_entry entries[ENTRIES_PER_READ];
+    uint16_t index = 0;
+    bool erased = false;
+    sfud_err result;
+
+    memset(scan, 0, sizeof(*scan));
+    /* entries are appended in order, the first erased one ends the log */
+    while (!erased && index < BOOT_TRIAL_ENTRY_NUM) {
+        result = sfud_read(flash, BOOT_TRIAL_ADDR + index * sizeof(boot_trial_entry), sizeof(entries),
+                           (uint8_t *) entries);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+        for (uint8_t i = 0; i < ENTRIES_PER_READ; i++, index++) {
+            if (boot_cmp_blank(&entries[i], sizeof(boot_trial_entry))) {
+                erased = true;
+                break;
+            }
+            /* a torn entry is skipped, the next trial goes behind it */
+            if (entry_is_valid(&entries[i])) {
+                scan->latest = entries[i];
+                scan->addr = BOOT_TRIAL_ADDR + index * sizeof(boot_trial_entry);
+                scan->found = true;
+            }
+        }
+    }
+    scan->free_index = index;
+
+    return SFUD_SUCCESS;
+}
+
+/**
+ * put a slot on trial, before the record which selects it
+ *
+ * @note a full sector is erased first: a reset right after it leaves the selection in force without its trial,
+ *       once every BOOT_TRIAL_ENTRY_NUM trials
+ *
+ * @param flash MAIN flash, indirect or memory-mapped mode
+ * @param slot slot to be selected
+ * @param seq seq of the slot record which selects it
+ *
+ * @return result
+ */
+sfud_err boot_trial_start(const sfud_flash *flash, boot_slot_id slot, uint32_t seq) {
+    boot_trial_entry entry, check;
+    trial_scan_result scan;
+    uint32_t addr;
+    sfud_err result = trial_scan(flash, &scan);
+
+    if (result != SFUD_SUCCESS) {
+        return result;
+    }
+    if (scan.free_index >= BOOT_TRIAL_ENTRY_NUM) {
+        result = sfud_erase(flash, BOOT_TRIAL_ADDR, BOOT_TRIAL_SECTOR_SIZE);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+        scan.free_index = 0;
+    }
+
+    memset(&entry, 0xFF, sizeof(entry));
+    entry.magic = BOOT_TRIAL_MAGIC;
+    entry.seq = seq;
+    entry.slot = (uint8_t) slot;
+    entry.boots = BOOT_TRIAL_BOOTS;
+    entry.crc = entry_crc(&entry);
+
+    /* confirmed and count stay erased for the boots to clear */
+    addr = BOOT_TRIAL_ADDR + scan.free_index * sizeof(boot_trial_entry);
+    result = sfud_write(flash, addr, offsetof(boot_trial_entry, confirmed), (const uint8_t *) &entry);
+    if (result == SFUD_SUCCESS) {
+        result = sfud_write_flush(flash);
+    }
+    if (result == SFUD_SUCCESS) {
+        result = sfud_read(flash, addr, sizeof(check), (uint8_t *) &check);
+    }
+    if (result == SFUD_SUCCESS && !boot_cmp_equal(&entry, &check, sizeof(entry))) {
+        result = SFUD_ERR_WRITE;
+    }
+    if (result == SFUD_SUCCESS) {
+        elog_i(TAG, "slot %c on trial, %u boots to be confirmed", 'A' + slot, BOOT_TRIAL_BOOTS);
+    }
+    return result;
+}
+
+/**
+ * count this boot in the trial of the slot record in force, one word programmed
+ *
+ * @param flash MAIN flash, indirect or memory-mapped mode
+ * @param record slot record in force
+ *
+ * @return BOOT_TRIAL_FAILED: the trial boots are all taken, or this one can't be counted
+ */
+boot_trial_state boot_trial_take(const sfud_flash *flash, const boot_slot_record *record) {
+    trial_scan_result scan;
+    uint32_t taken, word;
+    uint8_t i;
+
+    trial_pending = false;
+    /* a confirm cut short leaves some bits of it cleared, that's confirmed too */
+    if (trial_scan(flash, &scan) != SFUD_SUCCESS || !scan.found || scan.latest.seq != record->seq
+            || scan.latest.slot != record->active || scan.latest.confirmed != 0xFFFFFFFFUL) {
+        return BOOT_TRIAL_NONE;
+    }
+    taken = entry_boots_taken(&scan.latest);
+    if (taken >= scan.latest.boots) {
+        elog_w(TAG, "slot %c not confirmed in %u boots", 'A' + scan.latest.slot, (unsigned) taken);
+        return BOOT_TRIAL_FAILED;
+    }
+
+    /* the lowest bit still set, whatever a reset in an earlier count left */
+    for (i = 0; i < BOOT_TRIAL_COUNT_WORDS && !scan.latest.count[i]; i++) {
+    }
+    word = scan.latest.count[i] & (scan.latest.count[i] - 1);
+    if (sfud_write(flash, scan.addr + offsetof(boot_trial_entry, count) + i * sizeof(uint32_t), sizeof(word),
+                   (const uint8_t *) &word) != SFUD_SUCCESS || sfud_write_flush(flash) != SFUD_SUCCESS) {
+        /* a boot which isn't counted could be taken again and again */
+        elog_e(TAG, "boot of slot %c not counted", 'A' + scan.latest.slot);
+        return BOOT_TRIAL_FAILED;
+    }
+    trial_pending = true;
+    elog_i(TAG, "slot %c on trial, boot %u of %u", 'A' + scan.latest.slot, (unsigned) (taken + 1),
+           scan.latest.boots);
+
+    return BOOT_TRIAL_COUNTED;
+}
+
+/**
+ * @return true: this boot is counted in a trial, the image isn't confirmed yet
+ */
+bool boot_trial_pending(void) {
+    return trial_pending;
+}
+
+/**
+ * confirm the image on trial, the confirm service of boot_svc.h
+ *
+ * Runs in the context of the application: the flash and CRC services only, none of the bootloader RAM.
+ *
+ * @return SFUD_ERR_NOT_FOUND: no trial was ever started; SFUD_SUCCESS: confirmed, now or before
+ */
+sfud_err boot_trial_svc_confirm(void) {
+    static const uint32_t confirmed = 0;
+    boot_trial_entry entry;
+    uint32_t addr = 0, value = 0;
+    sfud_err result;
+
+    for (uint32_t index = 0; index < BOOT_TRIAL_ENTRY_NUM; index++) {
+        result = boot_part_svc_read(BOOT_TRIAL_ADDR + index * sizeof(entry), sizeof(entry), (uint8_t *) &entry);
+        if (result != SFUD_SUCCESS) {
+            return result;
+        }
+        if (entry.magic == 0xFFFFFFFFUL) {
+            break;
+        }
+        if (entry.magic == BOOT_TRIAL_MAGIC
+                && entry.crc == boot_svc.crc32(0, &entry, offsetof(boot_trial_entry, crc))) {
+            addr = BOOT_TRIAL_ADDR + index * sizeof(entry);
+            value = entry.confirmed;
+        }
+    }
+    if (!addr) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    if (value != 0xFFFFFFFFUL) {
+        return SFUD_SUCCESS;
+    }
+    return boot_part_svc_write(addr + offsetof(boot_trial_entry, confirmed), sizeof(confirmed),
+                               (const uint8_t *) &confirmed);
+}
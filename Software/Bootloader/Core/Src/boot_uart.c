@@ -0,0 +1,645 @@
+/**
+ * @file boot_uart.c
+ * @brief Firmware upload over USART2, see boot_uart.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_UART
+
+#include "boot_uart.h"
+#include "boot_bridge.h"
+#include "boot_console.h"
+#include "boot_crc.h"
+#include "boot_image.h"
+#include "boot_recv.h"
+#include "boot_rollback.h"
+#include "boot_slot.h"
+#include "boot_verify.h"
+#include "spsc_ring.h"
+#include "usart.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "uart");
+
+/* two windows of frames, the DMA keeps filling it while a block is erased */
+#define UART_RING_SIZE                  (16 * 1024)
+#define UART_FRAME_HEADER_SIZE          sizeof(boot_uart_frame)
+#define UART_FRAME_MAX_SIZE             (UART_FRAME_HEADER_SIZE + BOOT_UART_CHUNK_SIZE + 4)
+#define UART_ERASE_BLOCK_SIZE           (64 * 1024)
+#define UART_TX_TIMEOUT_MS              10
+
+/* the DMA1 can't reach the TCMs, both stay in RAM_D1 */
+static uint8_t rx_ring[UART_RING_SIZE] __attribute__((aligned(32)));
+static uint8_t rx_frame[UART_FRAME_MAX_SIZE] __attribute__((aligned(32)));
+/* payload being programmed while the next frame comes in */
+static uint8_t write_buf[BOOT_UART_CHUNK_SIZE] __attribute__((aligned(32)));
+/* the DMA is the producer, frame_poll() the consumer */
+static spsc_ring rx_q;
+static DMA_HandleTypeDef hdma_usart2_rx;
+/* a frame started since boot_uart_arm(), set by the character match */
+static volatile bool uart_matched;
+/* the baud rate outside a transfer, a BAUD frame raises it for the rest of the boot */
+static uint32_t link_baud = BOOT_UART_BAUD_DEFAULT;
+
+typedef struct {
+    const sfud_flash *flash;
+    boot_slot_id slot;                           /**< staging slot */
+    uint32_t size;                               /**< bytes to upload, START */
+    uint32_t done;                               /**< bytes written or being written by op */
+    uint32_t erased_end;                         /**< slot offset the slot is erased up to */
+    uint16_t seq;                                /**< next DATA seq */
+    uint8_t unacked;                             /**< frames written since the last ack */
+    bool nak_sent;                               /**< the frames are dropped until seq comes again */
+    sfud_async op;                               /**< program of the last frame */
+} uart_session;
+
+static bool rx_dma_init(void) {
+    if (hdma_usart2_rx.Instance) {
+        return true;
+    }
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    hdma_usart2_rx.Instance = DMA1_Stream2;
+    hdma_usart2_rx.Init.Request = DMA_REQUEST_USART2_RX;
+    hdma_usart2_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_usart2_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart2_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart2_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart2_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart2_rx.Init.Mode = DMA_CIRCULAR;
+    hdma_usart2_rx.Init.Priority = DMA_PRIORITY_VERY_HIGH;
+    hdma_usart2_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_usart2_rx) != HAL_OK) {
+        hdma_usart2_rx.Instance = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * the oversampling and the kernel clock prescaler closest to a baud rate on PCLK1, 16 times oversampling and the
+ * smaller prescaler first
+ *
+ * @return false: none within BOOT_UART_BAUD_TOLERANCE_PERMILLE, or above BOOT_UART_BAUD_MAX
+ */
+static bool baud_find(uint32_t baud, uint32_t *oversampling, uint32_t *prescaler) {
+    static const uint32_t samples[] = { 16, 8 };
+    uint32_t pclk = HAL_RCC_GetPCLK1Freq(), best = UINT32_MAX;
+
+    if (baud == 0 || baud > BOOT_UART_BAUD_MAX) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+        for (uint32_t p = UART_PRESCALER_DIV1; p <= UART_PRESCALER_DIV256; p++) {
+            /* BRR: the kernel clock in baud periods, twice it with 8 times oversampling */
+            uint32_t clk = pclk / UARTPrescTable[p] * (16 / samples[i]);
+            uint32_t div = (clk + baud / 2) / baud, actual, error;
+
+            if (div < 16 || div > 0xFFFF) {
+                continue;
+            }
+            actual = clk / div;
+            error = (uint32_t) ((uint64_t) (actual > baud ? actual - baud : baud - actual) * 1000 / baud);
+            if (error < best) {
+                best = error;
+                *oversampling = samples[i] == 16 ? UART_OVERSAMPLING_16 : UART_OVERSAMPLING_8;
+                *prescaler = p;
+            }
+        }
+    }
+    return best <= BOOT_UART_BAUD_TOLERANCE_PERMILLE;
+}
+
+/**
+ * (re)configure USART2 and start the circular reception into rx_ring, polled, no interrupts
+ */
+static bool rx_start(uint32_t baud) {
+    uint32_t oversampling, prescaler;
+
+    if (!rx_dma_init() || !baud_find(baud, &oversampling, &prescaler)) {
+        return false;
+    }
+    if (hdma_usart2_rx.State == HAL_DMA_STATE_BUSY) {
+        CLEAR_BIT(USART2->CR3, USART_CR3_DMAR);
+        HAL_DMA_Abort(&hdma_usart2_rx);
+    }
+    huart2.Init.BaudRate = baud;
+    huart2.Init.OverSampling = oversampling;
+    huart2.Init.ClockPrescaler = prescaler;
+    /* a late poll must not stall the reception, the frame CRC catches the lost bytes */
+    huart2.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_RXOVERRUNDISABLE_INIT;
+    huart2.AdvancedInit.OverrunDisable = UART_ADVFEATURE_OVERRUN_DISABLE;
+    if (HAL_UART_Init(&huart2) != HAL_OK || HAL_UARTEx_EnableFifoMode(&huart2) != HAL_OK) {
+        return false;
+    }
+    spsc_ring_init(&rx_q, rx_ring, UART_RING_SIZE);
+    if (HAL_DMA_Start(&hdma_usart2_rx, (uint32_t) (uintptr_t) &USART2->RDR, (uint32_t) (uintptr_t) rx_ring, UART_RING_SIZE)
+            != HAL_OK) {
+        return false;
+    }
+    USART2->ICR = USART_ICR_IDLECF | USART_ICR_ORECF | USART_ICR_FECF | USART_ICR_NECF;
+    SET_BIT(USART2->CR3, USART_CR3_DMAR);
+
+    return true;
+}
+
+/**
+ * stop the reception and give USART2 back to elog at the link baud rate, as MX_USART2_UART_Init() left it at the
+ * default one
+ */
+static void rx_stop(void) {
+    uint32_t oversampling = UART_OVERSAMPLING_16, prescaler = UART_PRESCALER_DIV1;
+
+    CLEAR_BIT(USART2->CR3, USART_CR3_DMAR);
+    HAL_DMA_Abort(&hdma_usart2_rx);
+
+    /* it was found good at the BAUD frame, the clock hasn't changed since */
+    baud_find(link_baud, &oversampling, &prescaler);
+    huart2.Init.BaudRate = link_baud;
+    huart2.Init.OverSampling = oversampling;
+    huart2.Init.ClockPrescaler = prescaler;
+    huart2.AdvancedInit.OverrunDisable = UART_ADVFEATURE_OVERRUN_ENABLE;
+    HAL_UART_Init(&huart2);
+    /* the TX FIFO stays on at a raised rate, the log DMA has 16 bytes of slack */
+    if (link_baud == BOOT_UART_BAUD_DEFAULT) {
+        HAL_UARTEx_DisableFifoMode(&huart2);
+    }
+    huart2.AdvancedInit.AdvFeatureInit = UART_ADVFEATURE_NO_INIT;
+}
+
+static size_t ring_avail(void) {
+    spsc_ring_dma_head(&rx_q, UART_RING_SIZE - __HAL_DMA_GET_COUNTER(&hdma_usart2_rx));
+    return spsc_ring_used(&rx_q);
+}
+
+/**
+ * copy bytes from the ring tail on, the tail stays
+ */
+static void ring_copy(void *dst, size_t offset, size_t len) {
+    uint8_t *p = (uint8_t *) dst, *span;
+    uintptr_t start, end;
+    size_t n;
+
+    while (len && (n = spsc_ring_read_span(&rx_q, offset, &span)) != 0) {
+        n = n < len ? n : len;
+        /* the CPU never writes the ring, its lines are dropped rather than cleaned */
+        start = (uintptr_t) span & ~(uintptr_t) 31;
+        end = ((uintptr_t) span + n + 31) & ~(uintptr_t) 31;
+        SCB_InvalidateDCache_by_Addr((void *) start, (int32_t) (end - start));
+        memcpy(p, span, n);
+        p += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+static void ring_skip(size_t len) {
+    spsc_ring_consume(&rx_q, len);
+}
+
+static uint32_t frame_crc(size_t len) {
+    uint32_t crc;
+
+    SCB_CleanDCache_by_Addr((uint32_t *) rx_frame, (int32_t) ((len + 31) & ~(size_t) 31));
+    if (!boot_crc32_hw(rx_frame, len, &crc)) {
+        crc = boot_image_crc32(0, rx_frame, len);
+    }
+    return crc;
+}
+
+/**
+ * take the next complete frame out of the ring into rx_frame
+ *
+ * @return true: a frame with a good CRC is in rx_frame
+ */
+static bool frame_poll(bool *bad) {
+    boot_uart_frame *frame = (boot_uart_frame *) rx_frame;
+    uint16_t magic;
+    size_t avail, size;
+    uint32_t crc;
+
+    *bad = false;
+    for (avail = ring_avail(); avail >= UART_FRAME_HEADER_SIZE; avail = ring_avail()) {
+        ring_copy(&magic, 0, sizeof(magic));
+        if (magic != BOOT_UART_MAGIC) {
+            ring_skip(1);
+            continue;
+        }
+        ring_copy(frame, 0, UART_FRAME_HEADER_SIZE);
+        if (frame->len > BOOT_UART_CHUNK_SIZE) {
+            ring_skip(1);
+            continue;
+        }
+        size = UART_FRAME_HEADER_SIZE + frame->len;
+        if (avail < size + sizeof(crc)) {
+            return false;
+        }
+        ring_copy(rx_frame, 0, size + sizeof(crc));
+        memcpy(&crc, &rx_frame[size], sizeof(crc));
+        if (crc != frame_crc(size)) {
+            /* the length may be garbage, resync right after the magic */
+            ring_skip(1);
+            *bad = true;
+            return false;
+        }
+        ring_skip(size + sizeof(crc));
+        return true;
+    }
+
+    return false;
+}
+
+static void ack_send(const uart_session *session, boot_uart_status status) {
+    boot_uart_ack ack = {
+        .magic = BOOT_UART_MAGIC,
+        .status = (uint8_t) status,
+        .window = BOOT_UART_WINDOW,
+        .seq = session->seq,
+        .reserved = 0,
+    };
+
+    HAL_UART_Transmit(&huart2, (uint8_t *) &ack, sizeof(ack), UART_TX_TIMEOUT_MS);
+}
+
+/* the test pattern of the BAUD frame at the new rate: all the byte values, the bit edges of 0x55 between them */
+static bool baud_pattern_ok(const boot_uart_frame *frame, uint32_t baud) {
+    const uint8_t *payload = rx_frame + UART_FRAME_HEADER_SIZE;
+
+    if (frame->cmd != BOOT_UART_CMD_BAUD || frame->arg != baud || frame->len != BOOT_UART_BAUD_PATTERN_SIZE) {
+        return false;
+    }
+    for (size_t i = 0; i < BOOT_UART_BAUD_PATTERN_SIZE; i++) {
+        if (payload[i] != (uint8_t) (i ^ 0x55)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * run the BAUD frame in rx_frame: acknowledge it at the link rate, switch, wait the test pattern at the new one
+ *
+ * @return true: the link is at the new rate, false: refused or not confirmed, it's back at the old one
+ */
+static bool baud_switch(const uart_session *session) {
+    const boot_uart_frame *frame = (const boot_uart_frame *) rx_frame;
+    uint32_t baud = frame->arg, oversampling, prescaler, start;
+    bool bad;
+
+    if (frame->len || !baud_find(baud, &oversampling, &prescaler)) {
+        ack_send(session, BOOT_UART_ERR_BAUD);
+        elog_w(TAG, "%u baud refused", baud);
+        return false;
+    }
+    /* no log line may go out at the wrong rate */
+    elog_port_flush();
+    ack_send(session, BOOT_UART_OK);
+    while (!(USART2->ISR & USART_ISR_TC)) {
+    }
+    if (rx_start(baud)) {
+        start = HAL_GetTick();
+        while (HAL_GetTick() - start < BOOT_UART_BAUD_CONFIRM_MS) {
+            if (frame_poll(&bad) && baud_pattern_ok(frame, baud)) {
+                ack_send(session, BOOT_UART_OK);
+                link_baud = baud;
+                elog_i(TAG, "link at %u baud", baud);
+                return true;
+            }
+        }
+    }
+    rx_start(link_baud);
+    elog_w(TAG, "%u baud not confirmed, back to %u", baud, link_baud);
+    return false;
+}
+
+/**
+ * wait for a START frame at the link baud rate, the BAUD frames are served meanwhile
+ *
+ * @param session ack of the BAUD frames
+ * @param timeout_ms time to wait, BOOT_UART_TIMEOUT_MS from a BAUD frame on
+ * @param console a CONSOLE frame does too
+ */
+static bool start_wait(const uart_session *session, uint32_t timeout_ms, bool console) {
+    uint8_t cmd;
+    uint32_t start = HAL_GetTick();
+    bool bad;
+
+    while (HAL_GetTick() - start < timeout_ms) {
+        if (!frame_poll(&bad)) {
+            continue;
+        }
+        cmd = ((boot_uart_frame *) rx_frame)->cmd;
+        if (cmd == BOOT_UART_CMD_START || (console && cmd == BOOT_UART_CMD_CONSOLE)) {
+            return true;
+        }
+        if (cmd == BOOT_UART_CMD_BAUD) {
+            /* a host is there, it gets the time of the request to go on */
+            baud_switch(session);
+            timeout_ms = BOOT_UART_TIMEOUT_MS;
+            start = HAL_GetTick();
+        }
+    }
+    return false;
+}
+
+static boot_uart_status data_write(uart_session *session, const boot_uart_frame *frame) {
+    uint32_t addr = boot_slot_addr(session->slot);
+    uint32_t end = frame->offset + frame->len, len;
+
+    if (frame->offset != session->done || end > session->size) {
+        return BOOT_UART_ERR_SIZE;
+    }
+    /* the flash takes one operation at a time, the erase ahead waits for the last program */
+    if (sfud_async_wait(&session->op) != SFUD_SUCCESS) {
+        return BOOT_UART_ERR_FLASH;
+    }
+    while (session->erased_end < end) {
+        len = session->size - session->erased_end;
+        if (len > UART_ERASE_BLOCK_SIZE) {
+            len = UART_ERASE_BLOCK_SIZE;
+        }
+        boot_verify_dirty(session->flash, addr + session->erased_end, len);
+        if (sfud_erase(session->flash, addr + session->erased_end, len) != SFUD_SUCCESS) {
+            return BOOT_UART_ERR_FLASH;
+        }
+        session->erased_end += len;
+    }
+    /* rx_frame takes the next frame meanwhile */
+    memcpy(write_buf, rx_frame + UART_FRAME_HEADER_SIZE, frame->len);
+    if (sfud_write_async(session->flash, &session->op, addr + frame->offset, frame->len, write_buf)
+            != SFUD_SUCCESS) {
+        return BOOT_UART_ERR_FLASH;
+    }
+    /* hashed while it's programmed */
+    boot_recv_feed(frame->offset, write_buf, frame->len);
+    session->done = end;
+
+    return BOOT_UART_OK;
+}
+
+/**
+ * acknowledge the frames so far, they have to be written first
+ *
+ * @return false: the last program failed, the upload is aborted
+ */
+static bool ack_written(uart_session *session) {
+    if (sfud_async_wait(&session->op) != SFUD_SUCCESS) {
+        ack_send(session, BOOT_UART_ERR_FLASH);
+        return false;
+    }
+    ack_send(session, BOOT_UART_OK);
+    session->unacked = 0;
+    return true;
+}
+
+static boot_uart_status session_end(uart_session *session) {
+    sfud_err result;
+
+    if (session->done != session->size) {
+        return BOOT_UART_NAK;
+    }
+    if (sfud_async_wait(&session->op) != SFUD_SUCCESS) {
+        return BOOT_UART_ERR_FLASH;
+    }
+    result = boot_slot_commit(session->flash, session->slot, session->size);
+    if (result == SFUD_ERR_NOT_FOUND) {
+        return BOOT_UART_ERR_IMAGE;
+    }
+    return result == SFUD_SUCCESS ? BOOT_UART_OK : BOOT_UART_ERR_FLASH;
+}
+
+/**
+ * receive the frames of an upload until END, an error or the timeout
+ */
+static bool session_run(uart_session *session) {
+    const boot_uart_frame *frame = (const boot_uart_frame *) rx_frame;
+    uint32_t last = HAL_GetTick();
+    boot_uart_status status;
+    bool bad;
+
+    while (HAL_GetTick() - last < BOOT_UART_TIMEOUT_MS) {
+        if (!frame_poll(&bad)) {
+            if (bad && !session->nak_sent) {
+                ack_send(session, BOOT_UART_NAK);
+                session->nak_sent = true;
+                session->unacked = 0;
+            }
+            /* the host stopped sending, the window is full or that was the last frame */
+            if (USART2->ISR & USART_ISR_IDLE) {
+                USART2->ICR = USART_ICR_IDLECF;
+                if (session->unacked && !ack_written(session)) {
+                    return false;
+                }
+            }
+            /* the pages of the last frame go out between the polls */
+            sfud_async_poll(&session->op);
+            continue;
+        }
+        last = HAL_GetTick();
+
+        switch (frame->cmd) {
+        case BOOT_UART_CMD_DATA:
+            if (frame->seq != session->seq) {
+                /* go back N, one NAK for the whole run of dropped frames */
+                if (!session->nak_sent) {
+                    ack_send(session, BOOT_UART_NAK);
+                    session->nak_sent = true;
+                    session->unacked = 0;
+                }
+                break;
+            }
+            session->nak_sent = false;
+            status = data_write(session, frame);
+            if (status != BOOT_UART_OK) {
+                ack_send(session, status);
+                return false;
+            }
+            session->seq++;
+            if (++session->unacked >= BOOT_UART_ACK_BATCH && !ack_written(session)) {
+                return false;
+            }
+            break;
+        case BOOT_UART_CMD_END:
+            status = session_end(session);
+            ack_send(session, status);
+            if (status != BOOT_UART_NAK) {
+                return status == BOOT_UART_OK;
+            }
+            session->nak_sent = true;
+            session->unacked = 0;
+            break;
+        default:
+            /* a START repeated before the host saw the ack */
+            break;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * catch the first byte of a frame from now on, no wait, call it right after MX_USART2_UART_Init()
+ *
+ * @note HAL_UART_Init() keeps CR2.ADD, CR1.CMIE and CR3.OVRDIS, the re-timing of boot_clock_retime() leaves the
+ *       match armed; a byte coming while it disables USART2 is lost, the host sends START again
+ */
+void boot_uart_arm(void) {
+    uart_matched = false;
+    /* ADD and OVRDIS are only written with USART2 disabled, nothing was sent yet */
+    CLEAR_BIT(USART2->CR1, USART_CR1_UE);
+    MODIFY_REG(USART2->CR2, USART_CR2_ADD, (uint32_t) (BOOT_UART_MAGIC & 0xFF) << USART_CR2_ADD_Pos);
+    /* RDR isn't read till the update mode, the bytes after the first one overwrite it */
+    SET_BIT(USART2->CR3, USART_CR3_OVRDIS);
+    SET_BIT(USART2->CR1, USART_CR1_UE);
+    USART2->ICR = USART_ICR_CMCF;
+    SET_BIT(USART2->CR1, USART_CR1_CMIE);
+    HAL_NVIC_SetPriority(USART2_IRQn, BOOT_UART_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(USART2_IRQn);
+}
+
+static void disarm(void) {
+    HAL_NVIC_DisableIRQ(USART2_IRQn);
+    CLEAR_BIT(USART2->CR1, USART_CR1_CMIE);
+}
+
+/**
+ * @return true: the application asked for the update mode or the console, see BOOT_UART_REQUEST_MAGIC
+ */
+bool boot_uart_request_pending(void) {
+    uint32_t request;
+
+    __HAL_RCC_RTC_CLK_ENABLE();
+    request = (&RTC->BKP0R)[BOOT_UART_REQUEST_BKP];
+    return request == BOOT_UART_REQUEST_MAGIC || request == BOOT_UART_CONSOLE_MAGIC;
+}
+
+static void request_clear(void) {
+    HAL_PWR_EnableBkUpAccess();
+    (&RTC->BKP0R)[BOOT_UART_REQUEST_BKP] = 0;
+}
+
+/**
+ * take the bytes received so far, the console reads its lines with it while boot_uart_update() runs
+ *
+ * @return bytes copied, 0: none came
+ */
+size_t boot_uart_read(void *buf, size_t len) {
+    size_t avail = ring_avail();
+
+    if (len > avail) {
+        len = avail;
+    }
+    ring_copy(buf, 0, len);
+    ring_skip(len);
+    return len;
+}
+
+/**
+ * the character match, from USART2_IRQHandler()
+ */
+void boot_uart_irq_handler(void) {
+    if (USART2->ISR & USART_ISR_CMF) {
+        USART2->ICR = USART_ICR_CMCF;
+        CLEAR_BIT(USART2->CR1, USART_CR1_CMIE);
+        uart_matched = true;
+    }
+}
+
+/**
+ * run the update mode when a host asks for it, returns at once when neither the match nor the application did
+ *
+ * @param flash MAIN flash, indirect mode
+ *
+ * @return true: an image was uploaded and its slot is selected
+ */
+bool boot_uart_update(const sfud_flash *flash) {
+    const boot_uart_frame *frame = (const boot_uart_frame *) rx_frame;
+    uart_session session;
+    uint32_t baud, oversampling, prescaler, start = 0, wait_ms;
+    boot_console_exit how;
+    bool result = false, console = false;
+
+    disarm();
+    if (boot_uart_request_pending()) {
+        console = (&RTC->BKP0R)[BOOT_UART_REQUEST_BKP] == BOOT_UART_CONSOLE_MAGIC;
+        request_clear();
+        wait_ms = BOOT_UART_TIMEOUT_MS;
+    } else if (uart_matched) {
+        wait_ms = BOOT_UART_WAIT_MS;
+    } else {
+        return false;
+    }
+    /* the log DMA must be done before USART2 is configured again */
+    elog_port_flush();
+    if (!rx_start(link_baud)) {
+        return false;
+    }
+    memset(&session, 0, sizeof(session));
+    if (!console) {
+        if (!start_wait(&session, wait_ms, true)) {
+            rx_stop();
+            return false;
+        }
+        console = frame->cmd == BOOT_UART_CMD_CONSOLE;
+        if (console) {
+            ack_send(&session, BOOT_UART_OK);
+        }
+    }
+    /* the text lines come in through the same ring, the log stays on */
+    if (console) {
+        how = boot_console_run();
+        if (how == BOOT_CONSOLE_EXIT_BRIDGE || how == BOOT_CONSOLE_EXIT_BRIDGE_DOWNLOAD) {
+#ifdef SFUD_USING_QSPI_QPI
+            /* the bridge ends in a reset, which doesn't reach the flash */
+            sfud_qspi_qpi_disable(sfud_get_device(SFUD_MAIN_FLASH));
+#endif
+            elog_port_flush();
+            rx_stop();
+            /* the bridge takes USART2 at the link rate, it only comes back when it can't start */
+            boot_bridge_run(link_baud, how == BOOT_CONSOLE_EXIT_BRIDGE_DOWNLOAD);
+            return false;
+        }
+        if (how != BOOT_CONSOLE_EXIT_UPLOAD || !start_wait(&session, BOOT_UART_TIMEOUT_MS, false)) {
+            elog_port_flush();
+            rx_stop();
+            return false;
+        }
+    }
+    /* the link carries binary frames from now on */
+    elog_i(TAG, "update mode");
+    elog_set_output_enabled(false);
+    elog_port_flush();
+
+    session.flash = flash;
+    session.slot = boot_slot_staging(flash);
+    session.size = frame->offset;
+    baud = frame->arg ? frame->arg : link_baud;
+    if (session.size == 0 || session.size > BOOT_SLOT_SIZE || !baud_find(baud, &oversampling, &prescaler)) {
+        ack_send(&session, BOOT_UART_ERR_SIZE);
+    } else {
+        /* the slot may hold the image to fall back to, the ACK waits for its copy */
+        boot_rollback_save(session.slot);
+        boot_recv_start(session.slot);
+        ack_send(&session, BOOT_UART_OK);
+        while (!(USART2->ISR & USART_ISR_TC)) {
+        }
+        if (rx_start(baud)) {
+            start = HAL_GetTick();
+            result = session_run(&session);
+            start = HAL_GetTick() - start;
+            /* an aborted upload may leave a program running */
+            sfud_async_wait(&session.op);
+        }
+    }
+    while (!(USART2->ISR & USART_ISR_TC)) {
+    }
+    rx_stop();
+
+    elog_set_output_enabled(true);
+    if (result) {
+        elog_i(TAG, "%u bytes into slot %c at %u baud, %u ms", session.size, 'A' + session.slot, baud, start);
+    } else {
+        elog_e(TAG, "update failed at 0x%08x", session.done);
+    }
+    return result;
+}
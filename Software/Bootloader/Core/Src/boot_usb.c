@@ -0,0 +1,903 @@
+/**
+ * @file boot_usb.c
+ * @brief Firmware upload over USB, see boot_usb.h.
+ */
+#define LOG_LVL                         ELOG_TAG_LVL_USB
+
+#include "boot_usb.h"
+#include "boot_crc.h"
+#include "boot_image.h"
+#include "boot_recv.h"
+#include "boot_rollback.h"
+#include "boot_slot.h"
+#include "boot_uart.h"
+#include "boot_verify.h"
+#include "main.h"
+#include "elog.h"
+#include <string.h>
+
+ELOG_TAG_DEFINE(TAG, "usb");
+
+#define USB_BASE                        ((uint32_t) USB1_OTG_HS)
+#define USB_DEV                         ((USB_OTG_DeviceTypeDef *) (USB_BASE + USB_OTG_DEVICE_BASE))
+#define USB_IN(ep)                      ((USB_OTG_INEndpointTypeDef *) (USB_BASE + USB_OTG_IN_ENDPOINT_BASE \
+                                                                        + (ep) * USB_OTG_EP_REG_SIZE))
+#define USB_OUT(ep)                     ((USB_OTG_OUTEndpointTypeDef *) (USB_BASE + USB_OTG_OUT_ENDPOINT_BASE \
+                                                                         + (ep) * USB_OTG_EP_REG_SIZE))
+#define USB_FIFO(ep)                    (*(__IO uint32_t *) (USB_BASE + USB_OTG_FIFO_BASE + (ep) * USB_OTG_FIFO_SIZE))
+#define USB_PCGCCTL                     (*(__IO uint32_t *) (USB_BASE + USB_OTG_PCGCCTL_BASE))
+
+/* full speed, EP0 and the bulk endpoints alike */
+#define USB_EP_SIZE                     64
+/* words of the 4KB FIFO RAM: the shared RX FIFO, then the TX FIFOs of EP0 and EP1 */
+#define USB_RX_FIFO_WORDS               256
+#define USB_TX0_FIFO_WORDS              32
+#define USB_TX1_FIFO_WORDS              32
+#define USB_CORE_TIMEOUT_MS             50
+
+#define USB_FRAME_HEADER_SIZE           sizeof(boot_uart_frame)
+#define USB_FRAME_MAX_SIZE              (USB_FRAME_HEADER_SIZE + BOOT_UART_CHUNK_SIZE + 4)
+/* the OUT transfer of a frame, whole packets: the largest frame still ends with a short one */
+#define USB_FRAME_PACKETS               ((USB_FRAME_MAX_SIZE + USB_EP_SIZE - 1) / USB_EP_SIZE)
+#define USB_BUF_SIZE                    (USB_FRAME_PACKETS * USB_EP_SIZE)
+#define USB_BUF_NUM                     2
+#define USB_ERASE_BLOCK_SIZE            (64 * 1024)
+#define USB_TX_TIMEOUT_MS               100
+
+/* GRXSTSP PKTSTS */
+#define USB_PKTSTS_OUT_DATA             2
+#define USB_PKTSTS_SETUP_DATA           6
+
+/* bRequest */
+#define USB_REQ_GET_STATUS              0
+#define USB_REQ_CLEAR_FEATURE           1
+#define USB_REQ_SET_FEATURE             3
+#define USB_REQ_SET_ADDRESS             5
+#define USB_REQ_GET_DESCRIPTOR          6
+#define USB_REQ_GET_CONFIGURATION       8
+#define USB_REQ_SET_CONFIGURATION       9
+#define USB_REQ_GET_INTERFACE           10
+#define USB_REQ_SET_INTERFACE           11
+
+/* bDescriptorType */
+#define USB_DESC_DEVICE                 1
+#define USB_DESC_CONFIGURATION          2
+#define USB_DESC_STRING                 3
+#define USB_DESC_BOS                    15
+
+/* wIndex of the MS OS 2.0 descriptor set request */
+#define USB_MS_OS_20_DESCRIPTOR_INDEX   7
+#define USB_MS_OS_20_SET_SIZE           30
+
+#define USB_STRING_MAX                  32
+
+static const uint8_t usb_device_desc[] = {
+    18, USB_DESC_DEVICE,
+    0x10, 0x02,                                  /* USB 2.1, the BOS is read */
+    0x00, 0x00, 0x00,                            /* the class is the interface's */
+    USB_EP_SIZE,
+    BOOT_USB_VID & 0xFF, BOOT_USB_VID >> 8,
+    BOOT_USB_PID & 0xFF, BOOT_USB_PID >> 8,
+    0x00, 0x01,                                  /* bcdDevice 1.00 */
+    1, 2, 3,                                     /* manufacturer, product, serial number */
+    1,
+};
+
+static const uint8_t usb_config_desc[] = {
+    9, USB_DESC_CONFIGURATION, 32, 0,
+    1, 1, 0,
+    0xC0,                                        /* self-powered */
+    50,                                          /* 100mA */
+    /* the upload interface, vendor class */
+    9, 4, 0, 0, 2, 0xFF, 0x00, 0x00, 0,
+    7, 5, 0x01, 0x02, USB_EP_SIZE, 0, 0,         /* bulk OUT 0x01 */
+    7, 5, 0x81, 0x02, USB_EP_SIZE, 0, 0,         /* bulk IN 0x81 */
+};
+
+static const uint8_t usb_bos_desc[] = {
+    5, USB_DESC_BOS, 33, 0, 1,
+    /* platform capability, MS OS 2.0 */
+    28, 16, 5, 0,
+    0xDF, 0x60, 0xDD, 0xD8, 0x89, 0x45, 0xC7, 0x4C, 0x9C, 0xD2, 0x65, 0x9D, 0x9E, 0x64, 0x8A, 0x9F,
+    0x00, 0x00, 0x03, 0x06,                      /* Windows 8.1 and later */
+    USB_MS_OS_20_SET_SIZE, 0, BOOT_USB_MS_VENDOR_CODE, 0,
+};
+
+static const uint8_t usb_ms_os_20_set[USB_MS_OS_20_SET_SIZE] = {
+    10, 0, 0, 0, 0x00, 0x00, 0x03, 0x06, USB_MS_OS_20_SET_SIZE, 0,
+    /* the whole device is WinUSB */
+    20, 0, 3, 0, 'W', 'I', 'N', 'U', 'S', 'B', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static const uint8_t usb_lang_desc[] = { 4, USB_DESC_STRING, 0x09, 0x04 };
+
+/* the ordinary .bss of RAM_D1, the frames are programmed straight from there */
+static uint8_t usb_buf[USB_BUF_NUM][USB_BUF_SIZE] __attribute__((aligned(32)));
+
+typedef enum {
+    USB_EP0_IDLE = 0,
+    USB_EP0_DATA_IN,                             /**< the packets of a descriptor go out */
+    USB_EP0_STATUS_OUT,                          /**< the zero-length packet of the host ends it */
+    USB_EP0_STATUS_IN,                           /**< ours ends it */
+} usb_ep0_stage;
+
+typedef struct {
+    uint32_t setup[2];                           /**< last SETUP packet */
+    usb_ep0_stage stage;
+    const uint8_t *ep0_data;                     /**< the rest of the IN data stage */
+    size_t ep0_left;
+    bool ep0_zlp;                                /**< the data stage ends with a zero-length packet */
+    uint8_t config;                              /**< bConfigurationValue, 0: the bulk endpoints are off */
+    uint8_t string[2 + 2 * USB_STRING_MAX];
+    int8_t out_buf;                              /**< buffer EP1 OUT is armed into, -1: none, the host is NAKed */
+    int8_t writing;                              /**< buffer whose payload the flash programs, -1: none */
+    uint16_t out_len;                            /**< bytes of the transfer in out_buf */
+    uint16_t len[USB_BUF_NUM];                   /**< bytes of the frame in a full buffer */
+    bool full[USB_BUF_NUM];                      /**< a frame to take */
+    uint32_t order[USB_BUF_NUM];                 /**< the frames are taken in the order they came */
+    uint32_t count;
+} usb_state;
+
+typedef struct {
+    const sfud_flash *flash;
+    boot_slot_id slot;                           /**< staging slot */
+    uint32_t size;                               /**< bytes to upload, START */
+    uint32_t done;                               /**< bytes written or being written by op */
+    uint32_t erased_end;                         /**< slot offset the slot is erased up to */
+    uint16_t seq;                                /**< next DATA seq */
+    bool nak_sent;                               /**< the frames are dropped until seq comes again */
+    sfud_async op;                               /**< program of the last frame, from usb_state.writing */
+} usb_session;
+
+static usb_state usb;
+
+static bool usb_wait(__IO uint32_t *reg, uint32_t mask, uint32_t value) {
+    uint32_t start = HAL_GetTick();
+
+    while ((*reg & mask) != value) {
+        if (HAL_GetTick() - start >= USB_CORE_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void fifo_read(uint8_t *dst, size_t len) {
+    uint32_t word;
+
+    for (size_t i = 0; i < len; i += 4) {
+        word = USB_FIFO(0);
+        if (dst) {
+            memcpy(dst + i, &word, len - i < 4 ? len - i : 4);
+        }
+    }
+}
+
+static void fifo_write(uint32_t ep, const uint8_t *src, size_t len) {
+    uint32_t word;
+
+    for (size_t i = 0; i < len; i += 4) {
+        word = 0;
+        memcpy(&word, src + i, len - i < 4 ? len - i : 4);
+        USB_FIFO(ep) = word;
+    }
+}
+
+static void usb_tx_flush(uint32_t fifo) {
+    USB1_OTG_HS->GRSTCTL = USB_OTG_GRSTCTL_TXFFLSH | (fifo << USB_OTG_GRSTCTL_TXFNUM_Pos);
+    usb_wait(&USB1_OTG_HS->GRSTCTL, USB_OTG_GRSTCTL_TXFFLSH, 0);
+}
+
+/* EP0 takes the next SETUP, the core needs no enable for one */
+static void ep0_out_start(void) {
+    USB_OUT(0)->DOEPTSIZ = (3U << USB_OTG_DOEPTSIZ_STUPCNT_Pos) | (1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | (3U * 8U);
+}
+
+static void ep0_stall(usb_state *u) {
+    USB_IN(0)->DIEPCTL |= USB_OTG_DIEPCTL_STALL;
+    USB_OUT(0)->DOEPCTL |= USB_OTG_DOEPCTL_STALL;
+    u->stage = USB_EP0_IDLE;
+}
+
+static void ep_in_send(uint32_t ep, const uint8_t *data, size_t len) {
+    USB_IN(ep)->DIEPTSIZ = (1U << USB_OTG_DIEPTSIZ_PKTCNT_Pos) | len;
+    USB_IN(ep)->DIEPCTL |= USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA;
+    fifo_write(ep, data, len);
+}
+
+/* the next packet of the data stage, a packet at a time: the EP0 transfer size has 7 bits */
+static void ep0_in_next(usb_state *u) {
+    size_t len = u->ep0_left > USB_EP_SIZE ? USB_EP_SIZE : u->ep0_left;
+
+    ep_in_send(0, u->ep0_data, len);
+    u->ep0_data += len;
+    u->ep0_left -= len;
+    if (len < USB_EP_SIZE) {
+        u->ep0_zlp = false;
+    }
+}
+
+static void ep0_in_start(usb_state *u, const uint8_t *data, size_t size, uint16_t length) {
+    if (size > length) {
+        size = length;
+    }
+    u->ep0_data = data;
+    u->ep0_left = size;
+    /* a short host buffer ends on the full packet, a longer one needs the short packet */
+    u->ep0_zlp = size < length;
+    u->stage = USB_EP0_DATA_IN;
+    ep0_in_next(u);
+}
+
+static void ep0_status_in(usb_state *u) {
+    u->stage = USB_EP0_STATUS_IN;
+    ep_in_send(0, NULL, 0);
+}
+
+/* UTF-16LE string descriptor of ASCII in u->string */
+static const uint8_t *usb_string(usb_state *u, const char *text, size_t *size) {
+    size_t len = strlen(text);
+
+    if (len > USB_STRING_MAX) {
+        len = USB_STRING_MAX;
+    }
+    u->string[0] = (uint8_t) (2 + 2 * len);
+    u->string[1] = USB_DESC_STRING;
+    for (size_t i = 0; i < len; i++) {
+        u->string[2 + 2 * i] = (uint8_t) text[i];
+        u->string[3 + 2 * i] = 0;
+    }
+    *size = u->string[0];
+    return u->string;
+}
+
+static const uint8_t *usb_descriptor(usb_state *u, uint8_t type, uint8_t index, size_t *size) {
+    static const char hex[] = "0123456789ABCDEF";
+    char serial[25];
+
+    switch (type) {
+    case USB_DESC_DEVICE:
+        *size = sizeof(usb_device_desc);
+        return usb_device_desc;
+    case USB_DESC_CONFIGURATION:
+        *size = sizeof(usb_config_desc);
+        return usb_config_desc;
+    case USB_DESC_BOS:
+        *size = sizeof(usb_bos_desc);
+        return usb_bos_desc;
+    case USB_DESC_STRING:
+        if (index == 0) {
+            *size = sizeof(usb_lang_desc);
+            return usb_lang_desc;
+        } else if (index == 1) {
+            return usb_string(u, "ESPHostedEVB", size);
+        } else if (index == 2) {
+            return usb_string(u, "ESPHostedEVB Bootloader", size);
+        } else if (index == 3) {
+            for (int i = 0; i < 24; i++) {
+                uint32_t word = ((const uint32_t *) UID_BASE)[i / 8];
+
+                serial[i] = hex[(word >> (28 - 4 * (i % 8))) & 0xF];
+            }
+            serial[24] = '\0';
+            return usb_string(u, serial, size);
+        }
+        return NULL;
+    default:
+        /* the device qualifier too, a full-speed device has none */
+        return NULL;
+    }
+}
+
+static void usb_ep1_close(void) {
+    USB_IN(1)->DIEPCTL = (USB_IN(1)->DIEPCTL & USB_OTG_DIEPCTL_EPENA)
+                         ? USB_OTG_DIEPCTL_EPDIS | USB_OTG_DIEPCTL_SNAK : 0;
+    USB_OUT(1)->DOEPCTL = (USB_OUT(1)->DOEPCTL & USB_OTG_DOEPCTL_EPENA)
+                          ? USB_OTG_DOEPCTL_EPDIS | USB_OTG_DOEPCTL_SNAK : USB_OTG_DOEPCTL_SNAK;
+    usb_tx_flush(1);
+}
+
+/**
+ * arm EP1 OUT into a buffer neither holding a frame nor being programmed, the host is NAKed till then
+ */
+static void usb_out_arm(usb_state *u) {
+    if (!u->config || u->out_buf >= 0) {
+        return;
+    }
+    for (int i = 0; i < USB_BUF_NUM; i++) {
+        if (!u->full[i] && u->writing != i) {
+            u->out_buf = (int8_t) i;
+            u->out_len = 0;
+            USB_OUT(1)->DOEPTSIZ = (USB_FRAME_PACKETS << USB_OTG_DOEPTSIZ_PKTCNT_Pos) | USB_BUF_SIZE;
+            USB_OUT(1)->DOEPCTL |= USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA;
+            return;
+        }
+    }
+}
+
+static void usb_configure(usb_state *u, uint8_t config) {
+    u->config = config;
+    usb_ep1_close();
+    u->out_buf = -1;
+    if (!config) {
+        return;
+    }
+    USB_IN(1)->DIEPCTL = USB_OTG_DIEPCTL_USBAEP | (2U << USB_OTG_DIEPCTL_EPTYP_Pos)
+                         | (1U << USB_OTG_DIEPCTL_TXFNUM_Pos) | USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_EP_SIZE;
+    USB_OUT(1)->DOEPCTL = USB_OTG_DOEPCTL_USBAEP | (2U << USB_OTG_DOEPCTL_EPTYP_Pos)
+                          | USB_OTG_DOEPCTL_SD0PID_SEVNFRM | USB_OTG_DOEPCTL_SNAK | USB_EP_SIZE;
+    usb_out_arm(u);
+}
+
+/**
+ * the chapter 9 requests of a single configuration device, and the MS OS 2.0 descriptor set
+ */
+static void usb_setup(usb_state *u) {
+    const uint8_t *s = (const uint8_t *) u->setup;
+    static const uint8_t zero[2] = {0, 0};
+    uint8_t type = s[0], request = s[1];
+    uint16_t value = (uint16_t) (s[2] | s[3] << 8), index = (uint16_t) (s[4] | s[5] << 8);
+    uint16_t length = (uint16_t) (s[6] | s[7] << 8);
+    const uint8_t *data = NULL;
+    size_t size = 0;
+
+    if ((type & 0x60) == 0x40) {
+        if (request == BOOT_USB_MS_VENDOR_CODE && index == USB_MS_OS_20_DESCRIPTOR_INDEX && (type & 0x80)) {
+            ep0_in_start(u, usb_ms_os_20_set, sizeof(usb_ms_os_20_set), length);
+        } else {
+            ep0_stall(u);
+        }
+        return;
+    }
+    if ((type & 0x60) != 0x00) {
+        ep0_stall(u);
+        return;
+    }
+
+    switch (request) {
+    case USB_REQ_GET_DESCRIPTOR:
+        data = usb_descriptor(u, (uint8_t) (value >> 8), (uint8_t) value, &size);
+        break;
+    case USB_REQ_GET_STATUS:
+    case USB_REQ_GET_INTERFACE:
+        data = zero;
+        size = request == USB_REQ_GET_STATUS ? 2 : 1;
+        break;
+    case USB_REQ_GET_CONFIGURATION:
+        data = &u->config;
+        size = 1;
+        break;
+    case USB_REQ_SET_ADDRESS:
+        /* before the status stage, the core answers it at address 0 still */
+        USB_DEV->DCFG = (USB_DEV->DCFG & ~USB_OTG_DCFG_DAD) | ((value & 0x7FU) << USB_OTG_DCFG_DAD_Pos);
+        ep0_status_in(u);
+        return;
+    case USB_REQ_SET_CONFIGURATION:
+        if (value > 1) {
+            ep0_stall(u);
+            return;
+        }
+        usb_configure(u, (uint8_t) value);
+        ep0_status_in(u);
+        return;
+    case USB_REQ_CLEAR_FEATURE:
+        /* ENDPOINT_HALT of a bulk endpoint: the data toggle starts over */
+        if ((type & 0x1F) == 2 && (index & 0x7F) == 1) {
+            if (index & 0x80) {
+                USB_IN(1)->DIEPCTL |= USB_OTG_DIEPCTL_SD0PID_SEVNFRM;
+            } else {
+                USB_OUT(1)->DOEPCTL |= USB_OTG_DOEPCTL_SD0PID_SEVNFRM;
+            }
+        }
+        ep0_status_in(u);
+        return;
+    case USB_REQ_SET_FEATURE:
+    case USB_REQ_SET_INTERFACE:
+        if (request == USB_REQ_SET_INTERFACE && value != 0) {
+            ep0_stall(u);
+            return;
+        }
+        ep0_status_in(u);
+        return;
+    default:
+        break;
+    }
+    if (!data || !(type & 0x80)) {
+        ep0_stall(u);
+        return;
+    }
+    ep0_in_start(u, data, size, length);
+}
+
+static void usb_bus_reset(usb_state *u) {
+    USB_DEV->DCTL &= ~USB_OTG_DCTL_RWUSIG;
+    usb_tx_flush(0x10);
+    for (uint32_t ep = 0; ep < 2; ep++) {
+        USB_IN(ep)->DIEPINT = 0xFB7FU;
+        USB_IN(ep)->DIEPCTL &= ~USB_OTG_DIEPCTL_STALL;
+        USB_OUT(ep)->DOEPINT = 0xFB7FU;
+        USB_OUT(ep)->DOEPCTL &= ~USB_OTG_DOEPCTL_STALL;
+        USB_OUT(ep)->DOEPCTL |= USB_OTG_DOEPCTL_SNAK;
+    }
+    USB_DEV->DCFG &= ~USB_OTG_DCFG_DAD;
+    /* a frame half received is dropped, the host starts over after a reset */
+    usb_configure(u, 0);
+    u->stage = USB_EP0_IDLE;
+    ep0_out_start();
+}
+
+/* one entry of the RX FIFO, the data goes to the SETUP buffer, the armed frame buffer or nowhere */
+static void usb_rx_pop(usb_state *u) {
+    uint32_t status = USB1_OTG_HS->GRXSTSP;
+    uint32_t ep = status & USB_OTG_GRXSTSP_EPNUM;
+    uint32_t len = (status & USB_OTG_GRXSTSP_BCNT) >> USB_OTG_GRXSTSP_BCNT_Pos;
+    uint32_t pktsts = (status & USB_OTG_GRXSTSP_PKTSTS) >> USB_OTG_GRXSTSP_PKTSTS_Pos;
+
+    if (pktsts == USB_PKTSTS_SETUP_DATA) {
+        fifo_read(len == sizeof(u->setup) ? (uint8_t *) u->setup : NULL, len);
+    } else if (pktsts == USB_PKTSTS_OUT_DATA && len) {
+        if (ep == 1 && u->out_buf >= 0 && u->out_len + len <= USB_BUF_SIZE) {
+            fifo_read(usb_buf[u->out_buf] + u->out_len, len);
+            u->out_len += len;
+        } else {
+            fifo_read(NULL, len);
+        }
+    }
+}
+
+static void usb_ep0_out(usb_state *u) {
+    uint32_t flags = USB_OUT(0)->DOEPINT;
+
+    USB_OUT(0)->DOEPINT = flags;
+    if (flags & USB_OTG_DOEPINT_XFRC) {
+        /* the status stage of an IN transfer */
+        if (u->stage == USB_EP0_STATUS_OUT) {
+            u->stage = USB_EP0_IDLE;
+        }
+        ep0_out_start();
+    }
+    if (flags & USB_OTG_DOEPINT_STUP) {
+        usb_setup(u);
+        if (u->stage == USB_EP0_IDLE) {
+            ep0_out_start();
+        }
+    }
+}
+
+static void usb_ep0_in(usb_state *u) {
+    uint32_t flags = USB_IN(0)->DIEPINT;
+
+    USB_IN(0)->DIEPINT = flags;
+    if (!(flags & USB_OTG_DIEPINT_XFRC)) {
+        return;
+    }
+    if (u->stage == USB_EP0_DATA_IN) {
+        if (u->ep0_left || u->ep0_zlp) {
+            ep0_in_next(u);
+            return;
+        }
+        /* the zero-length packet of the host, or the next SETUP */
+        u->stage = USB_EP0_STATUS_OUT;
+        USB_OUT(0)->DOEPTSIZ = (3U << USB_OTG_DOEPTSIZ_STUPCNT_Pos) | (1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos)
+                               | USB_EP_SIZE;
+        USB_OUT(0)->DOEPCTL |= USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA;
+    } else if (u->stage == USB_EP0_STATUS_IN) {
+        u->stage = USB_EP0_IDLE;
+        ep0_out_start();
+    }
+}
+
+static void usb_ep1_out(usb_state *u) {
+    uint32_t flags = USB_OUT(1)->DOEPINT;
+
+    USB_OUT(1)->DOEPINT = flags;
+    if ((flags & USB_OTG_DOEPINT_XFRC) && u->out_buf >= 0) {
+        u->len[u->out_buf] = u->out_len;
+        u->full[u->out_buf] = true;
+        u->order[u->out_buf] = ++u->count;
+        u->out_buf = -1;
+        usb_out_arm(u);
+    }
+}
+
+/**
+ * serve the core: bus reset, enumeration, RX FIFO, endpoint events; never waits
+ */
+static void usb_poll(usb_state *u) {
+    uint32_t status = USB1_OTG_HS->GINTSTS, daint;
+
+    if (status & USB_OTG_GINTSTS_USBRST) {
+        USB1_OTG_HS->GINTSTS = USB_OTG_GINTSTS_USBRST;
+        usb_bus_reset(u);
+    }
+    if (status & USB_OTG_GINTSTS_ENUMDNE) {
+        USB1_OTG_HS->GINTSTS = USB_OTG_GINTSTS_ENUMDNE;
+        /* full speed: EP0 packets of 64 bytes, the turnaround of an AHB clock above 32MHz */
+        USB_IN(0)->DIEPCTL &= ~USB_OTG_DIEPCTL_MPSIZ;
+        USB1_OTG_HS->GUSBCFG = (USB1_OTG_HS->GUSBCFG & ~USB_OTG_GUSBCFG_TRDT) | (6U << USB_OTG_GUSBCFG_TRDT_Pos);
+        USB_DEV->DCTL |= USB_OTG_DCTL_CGINAK;
+    }
+    if (status & USB_OTG_GINTSTS_USBSUSP) {
+        USB1_OTG_HS->GINTSTS = USB_OTG_GINTSTS_USBSUSP;
+    }
+    while (USB1_OTG_HS->GINTSTS & USB_OTG_GINTSTS_RXFLVL) {
+        usb_rx_pop(u);
+    }
+    daint = USB_DEV->DAINT;
+    if (daint & (1U << USB_OTG_DAINT_OEPINT_Pos)) {
+        usb_ep0_out(u);
+    }
+    if (daint & (2U << USB_OTG_DAINT_OEPINT_Pos)) {
+        usb_ep1_out(u);
+    }
+    if (daint & 1U) {
+        usb_ep0_in(u);
+    }
+    if (daint & 2U) {
+        USB_IN(1)->DIEPINT = USB_IN(1)->DIEPINT;
+    }
+}
+
+/**
+ * HSI48 trimmed by the CRS, the PHY and the device core, then the pull-up: the host sees the attach
+ */
+static bool usb_start(usb_state *u) {
+    GPIO_InitTypeDef gpio = {0};
+
+    memset(u, 0, sizeof(usb_state));
+    u->out_buf = -1;
+    u->writing = -1;
+
+    __HAL_RCC_HSI48_ENABLE();
+    if (!usb_wait(&RCC->CR, RCC_CR_HSI48RDY, RCC_CR_HSI48RDY)) {
+        return false;
+    }
+    __HAL_RCC_USB_CONFIG(RCC_USBCLKSOURCE_HSI48);
+    __HAL_RCC_CRS_CLK_ENABLE();
+    /* the USB1 SOF of the host, 1kHz */
+    MODIFY_REG(CRS->CFGR, CRS_CFGR_SYNCSRC, CRS_CFGR_SYNCSRC_1);
+    SET_BIT(CRS->CR, CRS_CR_AUTOTRIMEN | CRS_CR_CEN);
+    HAL_PWREx_EnableUSBVoltageDetector();
+    if (!usb_wait(&PWR->CR3, PWR_CR3_USB33RDY, PWR_CR3_USB33RDY)) {
+        return false;
+    }
+
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    gpio.Pin = GPIO_PIN_11 | GPIO_PIN_12;
+    gpio.Mode = GPIO_MODE_AF_PP;
+    gpio.Pull = GPIO_NOPULL;
+    gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    gpio.Alternate = GPIO_AF10_OTG1_FS;
+    HAL_GPIO_Init(GPIOA, &gpio);
+    __HAL_RCC_USB1_OTG_HS_CLK_ENABLE();
+    __HAL_RCC_USB1_OTG_HS_ULPI_CLK_DISABLE();
+
+    /* the embedded full-speed PHY, then a core reset */
+    USB1_OTG_HS->GUSBCFG |= USB_OTG_GUSBCFG_PHYSEL;
+    if (!usb_wait(&USB1_OTG_HS->GRSTCTL, USB_OTG_GRSTCTL_AHBIDL, USB_OTG_GRSTCTL_AHBIDL)) {
+        return false;
+    }
+    USB1_OTG_HS->GRSTCTL |= USB_OTG_GRSTCTL_CSRST;
+    if (!usb_wait(&USB1_OTG_HS->GRSTCTL, USB_OTG_GRSTCTL_CSRST, 0)) {
+        return false;
+    }
+    USB1_OTG_HS->GCCFG |= USB_OTG_GCCFG_PWRDWN;
+    USB1_OTG_HS->GUSBCFG = (USB1_OTG_HS->GUSBCFG & ~(USB_OTG_GUSBCFG_FHMOD | USB_OTG_GUSBCFG_FDMOD))
+                           | USB_OTG_GUSBCFG_FDMOD;
+    if (!usb_wait(&USB1_OTG_HS->GINTSTS, USB_OTG_GINTSTS_CMOD, 0)) {
+        return false;
+    }
+
+    /* device mode, full speed on the embedded PHY, no VBUS sensing */
+    USB_DEV->DCTL |= USB_OTG_DCTL_SDIS;
+    USB1_OTG_HS->GCCFG &= ~USB_OTG_GCCFG_VBDEN;
+    USB1_OTG_HS->GOTGCTL |= USB_OTG_GOTGCTL_BVALOEN | USB_OTG_GOTGCTL_BVALOVAL;
+    USB_PCGCCTL = 0;
+    USB_DEV->DCFG |= USB_OTG_DCFG_DSPD;
+    USB1_OTG_HS->GRXFSIZ = USB_RX_FIFO_WORDS;
+    USB1_OTG_HS->DIEPTXF0_HNPTXFSIZ = (USB_TX0_FIFO_WORDS << 16) | USB_RX_FIFO_WORDS;
+    USB1_OTG_HS->DIEPTXF[0] = (USB_TX1_FIFO_WORDS << 16) | (USB_RX_FIFO_WORDS + USB_TX0_FIFO_WORDS);
+    usb_tx_flush(0x10);
+    USB1_OTG_HS->GRSTCTL = USB_OTG_GRSTCTL_RXFFLSH;
+    usb_wait(&USB1_OTG_HS->GRSTCTL, USB_OTG_GRSTCTL_RXFFLSH, 0);
+    /* polled, GINTSTS and the endpoint flags are read as they are */
+    USB_DEV->DIEPMSK = 0;
+    USB_DEV->DOEPMSK = 0;
+    USB_DEV->DAINTMSK = 0;
+    USB1_OTG_HS->GINTMSK = 0;
+    USB1_OTG_HS->GINTSTS = 0xBFFFFFFFU;
+
+    USB_DEV->DCTL &= ~USB_OTG_DCTL_SDIS;
+    return true;
+}
+
+/* detach and give the pins and clocks back, the application sets USB up again */
+static void usb_stop(void) {
+    USB_DEV->DCTL |= USB_OTG_DCTL_SDIS;
+    HAL_Delay(3);
+    __HAL_RCC_USB1_OTG_HS_FORCE_RESET();
+    __HAL_RCC_USB1_OTG_HS_RELEASE_RESET();
+    __HAL_RCC_USB1_OTG_HS_CLK_DISABLE();
+    HAL_GPIO_DeInit(GPIOA, GPIO_PIN_11 | GPIO_PIN_12);
+    CLEAR_BIT(CRS->CR, CRS_CR_AUTOTRIMEN | CRS_CR_CEN);
+    __HAL_RCC_CRS_CLK_DISABLE();
+    __HAL_RCC_HSI48_DISABLE();
+}
+
+static void usb_release(usb_state *u, int i) {
+    u->full[i] = false;
+    usb_out_arm(u);
+}
+
+static uint32_t frame_crc(const uint8_t *frame, size_t len) {
+    uint32_t crc;
+
+    /* the CPU wrote the frame out of the FIFO, the MDMA reads the SRAM */
+    SCB_CleanDCache_by_Addr((uint32_t *) frame, (int32_t) len);
+    if (!boot_crc32_hw(frame, len, &crc)) {
+        crc = boot_image_crc32(0, frame, len);
+    }
+    return crc;
+}
+
+/**
+ * the oldest frame received, checked like a frame of the UART
+ *
+ * @param bad set when a frame was dropped for its CRC or length
+ *
+ * @return buffer of the frame, -1: none
+ */
+static int usb_frame_take(usb_state *u, bool *bad) {
+    const boot_uart_frame *frame;
+    int i = -1;
+    uint32_t crc, len;
+
+    *bad = false;
+    for (int n = 0; n < USB_BUF_NUM; n++) {
+        if (u->full[n] && (i < 0 || (int32_t) (u->order[n] - u->order[i]) < 0)) {
+            i = n;
+        }
+    }
+    if (i < 0) {
+        return -1;
+    }
+    frame = (const boot_uart_frame *) usb_buf[i];
+    len = u->len[i];
+    if (len < USB_FRAME_HEADER_SIZE + sizeof(crc) || frame->magic != BOOT_UART_MAGIC
+            || frame->len > BOOT_UART_CHUNK_SIZE || len != USB_FRAME_HEADER_SIZE + frame->len + sizeof(crc)) {
+        *bad = true;
+        usb_release(u, i);
+        return -1;
+    }
+    len -= sizeof(crc);
+    memcpy(&crc, usb_buf[i] + len, sizeof(crc));
+    if (crc != frame_crc(usb_buf[i], len)) {
+        *bad = true;
+        usb_release(u, i);
+        return -1;
+    }
+    return i;
+}
+
+static void ack_send(usb_state *u, const usb_session *session, boot_uart_status status) {
+    boot_uart_ack ack = {
+        .magic = BOOT_UART_MAGIC,
+        .status = (uint8_t) status,
+        .window = USB_BUF_NUM,
+        .seq = session->seq,
+        .reserved = 0,
+    };
+    uint32_t start = HAL_GetTick();
+
+    /* the host reads the acks as they come, the last one is gone but on a stalled host */
+    while (USB_IN(1)->DIEPCTL & USB_OTG_DIEPCTL_EPENA) {
+        usb_poll(u);
+        if (HAL_GetTick() - start >= USB_TX_TIMEOUT_MS || !u->config) {
+            return;
+        }
+    }
+    ep_in_send(1, (const uint8_t *) &ack, sizeof(ack));
+}
+
+/* the program of the last frame is over, its buffer takes the next one */
+static sfud_err usb_written(usb_state *u, usb_session *session) {
+    sfud_err result = sfud_async_wait(&session->op);
+
+    if (u->writing >= 0) {
+        u->writing = -1;
+        usb_out_arm(u);
+    }
+    return result;
+}
+
+static boot_uart_status data_write(usb_state *u, usb_session *session, int i) {
+    const boot_uart_frame *frame = (const boot_uart_frame *) usb_buf[i];
+    uint32_t addr = boot_slot_addr(session->slot);
+    uint32_t end = frame->offset + frame->len, len;
+
+    if (frame->offset != session->done || end > session->size) {
+        return BOOT_UART_ERR_SIZE;
+    }
+    if (usb_written(u, session) != SFUD_SUCCESS) {
+        return BOOT_UART_ERR_FLASH;
+    }
+    while (session->erased_end < end) {
+        len = session->size - session->erased_end;
+        if (len > USB_ERASE_BLOCK_SIZE) {
+            len = USB_ERASE_BLOCK_SIZE;
+        }
+        boot_verify_dirty(session->flash, addr + session->erased_end, len);
+        if (sfud_erase(session->flash, addr + session->erased_end, len) != SFUD_SUCCESS) {
+            return BOOT_UART_ERR_FLASH;
+        }
+        session->erased_end += len;
+    }
+    /* the buffer is held by the program, the other one takes the next frame meanwhile */
+    u->writing = (int8_t) i;
+    if (sfud_write_async(session->flash, &session->op, addr + frame->offset, frame->len,
+                         usb_buf[i] + USB_FRAME_HEADER_SIZE) != SFUD_SUCCESS) {
+        return BOOT_UART_ERR_FLASH;
+    }
+    /* hashed while it's programmed */
+    boot_recv_feed(frame->offset, usb_buf[i] + USB_FRAME_HEADER_SIZE, frame->len);
+    session->done = end;
+
+    return BOOT_UART_OK;
+}
+
+static boot_uart_status session_end(usb_state *u, usb_session *session) {
+    sfud_err result;
+
+    if (session->done != session->size) {
+        return BOOT_UART_NAK;
+    }
+    if (usb_written(u, session) != SFUD_SUCCESS) {
+        return BOOT_UART_ERR_FLASH;
+    }
+    result = boot_slot_commit(session->flash, session->slot, session->size);
+    if (result == SFUD_ERR_NOT_FOUND) {
+        return BOOT_UART_ERR_IMAGE;
+    }
+    return result == SFUD_SUCCESS ? BOOT_UART_OK : BOOT_UART_ERR_FLASH;
+}
+
+/**
+ * serve the device till the frames of an upload end with END, an error or the timeout
+ *
+ * @return true: END was accepted, the slot is selected
+ */
+static bool session_run(usb_state *u, usb_session *session) {
+    const boot_uart_frame *frame;
+    uint32_t last = HAL_GetTick();
+    boot_uart_status status;
+    bool started = false, bad;
+    int i;
+
+    while (HAL_GetTick() - last < BOOT_USB_TIMEOUT_MS) {
+        usb_poll(u);
+        /* the pages of the last frame go out between the polls */
+        if (u->writing >= 0 && sfud_async_poll(&session->op) != SFUD_ERR_BUSY) {
+            u->writing = -1;
+            usb_out_arm(u);
+        }
+        if ((i = usb_frame_take(u, &bad)) < 0) {
+            if (bad && started && !session->nak_sent) {
+                ack_send(u, session, BOOT_UART_NAK);
+                session->nak_sent = true;
+            }
+            continue;
+        }
+        last = HAL_GetTick();
+        frame = (const boot_uart_frame *) usb_buf[i];
+        status = BOOT_UART_OK;
+
+        switch (frame->cmd) {
+        case BOOT_UART_CMD_START:
+            if (started) {
+                break;
+            }
+            session->size = frame->offset;
+            if (session->size == 0 || session->size > BOOT_SLOT_SIZE) {
+                ack_send(u, session, BOOT_UART_ERR_SIZE);
+                usb_release(u, i);
+                return false;
+            }
+            /* the slot may hold the image to fall back to, the ACK waits for its copy */
+            boot_rollback_save(session->slot);
+            ack_send(u, session, BOOT_UART_OK);
+            elog_i(TAG, "upload of %u bytes into slot %c", session->size, 'A' + session->slot);
+            started = true;
+            break;
+        case BOOT_UART_CMD_DATA:
+            if (!started) {
+                break;
+            }
+            if (frame->seq != session->seq) {
+                /* go back N, one NAK for the whole run of dropped frames */
+                if (!session->nak_sent) {
+                    ack_send(u, session, BOOT_UART_NAK);
+                    session->nak_sent = true;
+                }
+                break;
+            }
+            session->nak_sent = false;
+            status = data_write(u, session, i);
+            if (status != BOOT_UART_OK) {
+                ack_send(u, session, status);
+                usb_release(u, i);
+                return false;
+            }
+            session->seq++;
+            break;
+        case BOOT_UART_CMD_END:
+            if (!started) {
+                break;
+            }
+            status = session_end(u, session);
+            ack_send(u, session, status);
+            if (status != BOOT_UART_NAK) {
+                usb_release(u, i);
+                return status == BOOT_UART_OK;
+            }
+            session->nak_sent = true;
+            break;
+        default:
+            break;
+        }
+        /* a DATA frame is released when its program is over */
+        u->full[i] = false;
+        usb_out_arm(u);
+    }
+    return false;
+}
+
+/**
+ * @return true: the application asked for the USB update mode, see BOOT_USB_REQUEST_MAGIC
+ */
+bool boot_usb_request_pending(void) {
+    __HAL_RCC_RTC_CLK_ENABLE();
+    return (&RTC->BKP0R)[BOOT_UART_REQUEST_BKP] == BOOT_USB_REQUEST_MAGIC;
+}
+
+/**
+ * run the USB update mode when the application asked for it, returns at once otherwise
+ *
+ * @param flash MAIN flash, indirect mode
+ *
+ * @return true: an image was uploaded and its slot is selected
+ */
+bool boot_usb_update(const sfud_flash *flash) {
+    usb_state *u = &usb;
+    usb_session session;
+    uint32_t start;
+    bool result = false;
+
+    if (!boot_usb_request_pending()) {
+        return false;
+    }
+    HAL_PWR_EnableBkUpAccess();
+    (&RTC->BKP0R)[BOOT_UART_REQUEST_BKP] = 0;
+
+    memset(&session, 0, sizeof(session));
+    session.flash = flash;
+    session.slot = boot_slot_staging(flash);
+    boot_recv_start(session.slot);
+    start = HAL_GetTick();
+    if (usb_start(u)) {
+        elog_i(TAG, "update mode, %04x:%04x", BOOT_USB_VID, BOOT_USB_PID);
+        result = session_run(u, &session);
+        /* an aborted upload may leave a program running */
+        usb_written(u, &session);
+    } else {
+        elog_e(TAG, "OTG_HS core or clock not ready");
+    }
+    usb_stop();
+
+    start = HAL_GetTick() - start;
+    if (result) {
+        elog_i(TAG, "%u bytes into slot %c, %u ms", session.size, 'A' + session.slot, start);
+    } else {
+        elog_e(TAG, "update failed at 0x%08x", session.done);
+    }
+    return result;
+}
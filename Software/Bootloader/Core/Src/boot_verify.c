@@ -0,0 +1,425 @@
+/**
+ * @file boot_verify.c
+ * @brief Cache of the last fully verified image, see boot_verify.h.
+ */
+#include "boot_verify.h"
+#include "boot_crc.h"
+#include "boot_handoff.h"
+#include "boot_hash.h"
+#include "boot_svc.h"
+#include "main.h"
+#include <string.h>
+
+#define SEAL_WORDS                      (sizeof(boot_verify_seal) / sizeof(uint32_t))
+#define TAMPER_FLAGS                    (RTC_ISR_TAMP1F | RTC_ISR_TAMP2F | RTC_ISR_TAMP3F)
+
+/* CRC-32 of every image sector, in the backup SRAM by the linker script */
+static uint32_t verify_sector_crc[BOOT_VERIFY_SECTOR_NUM] __attribute__((section(".boot_verify")));
+/* per slot digests of the images with a sector table, in the backup SRAM as well */
+static boot_verify_base verify_base[BOOT_SLOT_NUM] __attribute__((section(".boot_verify")));
+static bool verify_sampled;
+/* sectors the last base seal left to the application */
+static uint32_t verify_deferred;
+
+static volatile uint32_t *seal_regs(void) {
+    __HAL_RCC_RTC_CLK_ENABLE();
+    return &RTC->BKP0R + BOOT_VERIFY_BKP_FIRST;
+}
+
+static void seal_read(boot_verify_seal *seal) {
+    volatile uint32_t *regs = seal_regs();
+    uint32_t *word = (uint32_t *) seal;
+
+    for (uint32_t i = 0; i < SEAL_WORDS; i++) {
+        word[i] = regs[i];
+    }
+}
+
+static void seal_write(const boot_verify_seal *seal) {
+    volatile uint32_t *regs = seal_regs();
+    const uint32_t *word = (const uint32_t *) seal;
+
+    HAL_PWR_EnableBkUpAccess();
+    for (uint32_t i = 0; i < SEAL_WORDS; i++) {
+        regs[i] = word[i];
+    }
+}
+
+static uint32_t seal_crc(const boot_verify_seal *seal, uint32_t sectors) {
+    uint32_t crc = boot_image_crc32(0, seal, offsetof(boot_verify_seal, crc));
+
+    return boot_image_crc32(crc, verify_sector_crc, sectors * sizeof(uint32_t));
+}
+
+static uint32_t sector_count(const boot_image_header *header) {
+    return boot_image_sector_count(header);
+}
+
+/* the sector CRCs the seal covers, none for an image with a sector table */
+static uint32_t crc_count(const boot_image_header *header) {
+    return (header->flags & BOOT_IMAGE_FLAG_SECTOR_HASH) ? 0 : sector_count(header);
+}
+
+static uint32_t sector_size(const boot_image_header *header, uint32_t sector) {
+    uint32_t size = header->image_size - sector * BOOT_VERIFY_SECTOR_SIZE;
+
+    return size > BOOT_VERIFY_SECTOR_SIZE ? BOOT_VERIFY_SECTOR_SIZE : size;
+}
+
+/* read where the slot stores the image, a PIC image is linked elsewhere */
+static bool sector_crc(boot_slot_id slot, const boot_image_header *header, uint32_t sector, uint32_t *crc) {
+    uint32_t addr = OCTOSPI1_BASE + boot_slot_addr(slot) + BOOT_IMAGE_HEADER_SIZE + sector * BOOT_VERIFY_SECTOR_SIZE;
+
+    return boot_crc32_hw((const void *) (uintptr_t) addr, sector_size(header, sector), crc);
+}
+
+static uint32_t base_crc(const boot_verify_base *base) {
+    return boot_image_crc32(0, base, offsetof(boot_verify_base, crc));
+}
+
+/* a reset drops the D-Cache, the backup SRAM is cached in the bootloader */
+static void base_write(boot_verify_base *base) {
+    base->crc = base_crc(base);
+    SCB_CleanDCache_by_Addr((uint32_t *) base, sizeof(boot_verify_base));
+}
+
+static bool base_valid(const boot_verify_base *base) {
+    return !(RTC->ISR & TAMPER_FLAGS) && base->magic == BOOT_VERIFY_BASE_MAGIC
+            && base->sectors <= BOOT_VERIFY_SECTOR_NUM && base->crc == base_crc(base);
+}
+
+static void base_drop(boot_slot_id slot) {
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+    verify_base[slot].magic = 0;
+    SCB_CleanDCache_by_Addr((uint32_t *) &verify_base[slot], sizeof(boot_verify_base));
+}
+
+/**
+ * hash a sector of the image of a slot and check it against the base one
+ */
+static bool sector_hash_check(boot_slot_id slot, const boot_image_header *header, uint32_t sector) {
+    uint8_t digest[BOOT_HASH_SIZE];
+    uint32_t addr = boot_slot_addr(slot) + BOOT_IMAGE_HEADER_SIZE + sector * BOOT_VERIFY_SECTOR_SIZE;
+    const boot_verify_base *base = &verify_base[slot];
+
+    return base_valid(base) && sector < base->sectors
+            && hash_region(sfud_get_device(SFUD_MAIN_FLASH), addr, sector_size(header, sector), digest) == SFUD_SUCCESS
+            && memcmp(digest, base->digest[sector], BOOT_VERIFY_DIGEST_SIZE) == 0;
+}
+
+/**
+ * drop the seal, the next boot checks the image in full
+ */
+void boot_verify_clear(void) {
+    volatile uint32_t *regs = seal_regs();
+
+    HAL_PWR_EnableBkUpAccess();
+    regs[offsetof(boot_verify_seal, magic) / sizeof(uint32_t)] = 0;
+    verify_sampled = false;
+}
+
+/**
+ * tell whether the image is the one the seal was made for
+ *
+ * @param slot slot to boot
+ * @param header its image header, checked already
+ *
+ * @return true: boot_verify_sample() may stand in for the full checks
+ */
+bool boot_verify_cached(boot_slot_id slot, const boot_image_header *header) {
+    boot_verify_seal seal;
+    uint32_t sectors = sector_count(header);
+
+    seal_read(&seal);
+    if (RTC->ISR & TAMPER_FLAGS) {
+        return false;
+    }
+    if (seal.magic != BOOT_VERIFY_MAGIC || seal.version != BOOT_VERIFY_VERSION || seal.slot != slot
+            || seal.header_crc != header->header_crc || seal.sample >= sectors) {
+        return false;
+    }
+
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    return seal.crc == seal_crc(&seal, crc_count(header));
+}
+
+/**
+ * check the next BOOT_VERIFY_SAMPLE_SECTORS sectors of a cached image against the sector table
+ *
+ * @note OCTOSPI1 in memory-mapped mode, boot_verify_cached() returned true
+ *
+ * @param header image header
+ *
+ * @return false: a sector changed or the CRC unit failed, the seal is dropped
+ */
+bool boot_verify_sample(const boot_image_header *header) {
+    boot_verify_seal seal;
+    uint32_t sectors = sector_count(header), sector, crc;
+
+    seal_read(&seal);
+    sector = seal.sample;
+    for (uint32_t i = 0; i < BOOT_VERIFY_SAMPLE_SECTORS && i < sectors; i++) {
+        if ((header->flags & BOOT_IMAGE_FLAG_SECTOR_HASH)
+                ? !sector_hash_check((boot_slot_id) seal.slot, header, sector)
+                : !sector_crc((boot_slot_id) seal.slot, header, sector, &crc) || crc != verify_sector_crc[sector]) {
+            /* the slot changed behind the base too */
+            base_drop((boot_slot_id) seal.slot);
+            boot_verify_clear();
+            return false;
+        }
+        sector = (sector + 1) % sectors;
+    }
+
+    seal.sample = (uint8_t) sector;
+    seal.crc = seal_crc(&seal, crc_count(header));
+    seal_write(&seal);
+    verify_sampled = true;
+    verify_deferred = 0;
+    return true;
+}
+
+/* the seal goes first, a failure half way leaves the full checks */
+static bool seal_open(void) {
+    boot_verify_clear();
+    /* the backup regulator keeps the backup SRAM over a VDD loss, the registers survive anyway */
+    if (HAL_PWREx_EnableBkUpReg() != HAL_OK) {
+        return false;
+    }
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    return true;
+}
+
+static void seal_close(boot_slot_id slot, const boot_image_header *header, uint32_t sectors) {
+    boot_verify_seal seal;
+
+    /* a reset drops the D-Cache */
+    SCB_CleanDCache_by_Addr(verify_sector_crc, sizeof(verify_sector_crc));
+
+    memset(&seal, 0, sizeof(seal));
+    seal.magic = BOOT_VERIFY_MAGIC;
+    seal.version = BOOT_VERIFY_VERSION;
+    seal.slot = slot;
+    seal.header_crc = header->header_crc;
+    seal.crc = seal_crc(&seal, sectors);
+    seal_write(&seal);
+}
+
+/**
+ * seal an image which passed the full checks
+ *
+ * @note OCTOSPI1 in memory-mapped mode
+ *
+ * @param slot slot of the image
+ * @param header its image header
+ */
+void boot_verify_seal_image(boot_slot_id slot, const boot_image_header *header) {
+    uint32_t sectors;
+
+    if (!seal_open()) {
+        return;
+    }
+    /* the base of boot_verify_base_seal() stands in for the sector CRCs */
+    sectors = crc_count(header);
+    for (uint32_t sector = 0; sector < sectors; sector++) {
+        if (!sector_crc(slot, header, sector, &verify_sector_crc[sector])) {
+            return;
+        }
+    }
+    seal_close(slot, header, sectors);
+}
+
+/**
+ * seal an image checked as it was received, with the sector CRCs taken on the way, see boot_recv.h
+ *
+ * @param slot slot of the image
+ * @param header its image header, without a sector table
+ * @param sector_crc CRC-32 of each image sector
+ */
+void boot_verify_seal_crcs(boot_slot_id slot, const boot_image_header *header, const uint32_t *sector_crc) {
+    uint32_t sectors = crc_count(header);
+
+    if (!seal_open()) {
+        return;
+    }
+    memcpy(verify_sector_crc, sector_crc, sectors * sizeof(uint32_t));
+    seal_close(slot, header, sectors);
+}
+
+/**
+ * @return true: the image last returned by boot_slot_select() was sampled, not checked in full
+ */
+bool boot_verify_sampled(void) {
+    return verify_sampled;
+}
+
+/**
+ * mark the sectors a MAIN flash erase is about to touch dirty, before the erase starts
+ *
+ * @param flash flash to be erased, nothing is marked for the EXT flash
+ * @param addr start of the range
+ * @param size bytes of the range, the erase granule it's rounded to included
+ */
+void boot_verify_dirty(const sfud_flash *flash, uint32_t addr, size_t size) {
+    boot_verify_seal seal;
+    uint32_t start, end, first, last;
+
+    if (flash != sfud_get_device(SFUD_MAIN_FLASH) || size == 0) {
+        return;
+    }
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+    for (uint8_t slot = 0; slot < BOOT_SLOT_NUM; slot++) {
+        boot_verify_base *base = &verify_base[slot];
+
+        start = boot_slot_addr((boot_slot_id) slot) + BOOT_IMAGE_HEADER_SIZE;
+        end = boot_slot_addr((boot_slot_id) slot) + BOOT_SLOT_SIZE;
+        if (addr >= end || addr + size <= start) {
+            continue;
+        }
+        /* the image being booted changes under the seal, it's checked again */
+        seal_read(&seal);
+        if (seal.magic == BOOT_VERIFY_MAGIC && seal.slot == slot) {
+            boot_verify_clear();
+        }
+        if (!base_valid(base)) {
+            continue;
+        }
+        first = addr > start ? (addr - start) / BOOT_VERIFY_SECTOR_SIZE : 0;
+        last = ((addr + size < end ? addr + size : end) - start - 1) / BOOT_VERIFY_SECTOR_SIZE;
+        for (uint32_t sector = first; sector <= last && sector < BOOT_VERIFY_SECTOR_NUM; sector++) {
+            base->clean[sector / 32] &= ~(1UL << (sector % 32));
+        }
+        base_write(base);
+    }
+}
+
+/**
+ * tell whether a sector may skip its hash, untouched since the base of the slot is sealed and with the same digest
+ *
+ * @param slot slot of the image
+ * @param sector sector of the image
+ * @param digest its SHA-256 in the sector table of the image, checked against sector_hash
+ *
+ * @return true: the sector holds what digest tells
+ */
+bool boot_verify_sector_clean(boot_slot_id slot, uint32_t sector, const uint8_t *digest) {
+    const boot_verify_base *base = &verify_base[slot];
+
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    return base_valid(base) && sector < base->sectors && (base->clean[sector / 32] & (1UL << (sector % 32)))
+            && memcmp(base->digest[sector], digest, BOOT_VERIFY_DIGEST_SIZE) == 0;
+}
+
+/**
+ * seal the base of a slot whose sectors all passed, hashed or clean, but those left to the application
+ *
+ * @param slot slot of the image
+ * @param table its sector table, sectors SHA-256 digests
+ * @param sectors sectors of the image, BOOT_VERIFY_SECTOR_NUM at most
+ * @param pending bit per sector not hashed, for the verify_step service; NULL: none
+ */
+void boot_verify_base_seal(boot_slot_id slot, const uint8_t *table, uint32_t sectors, const uint32_t *pending) {
+    boot_verify_base *base = &verify_base[slot];
+
+    verify_deferred = 0;
+    if (sectors > BOOT_VERIFY_SECTOR_NUM || HAL_PWREx_EnableBkUpReg() != HAL_OK) {
+        return;
+    }
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+    memset(base, 0, sizeof(boot_verify_base));
+    base->magic = BOOT_VERIFY_BASE_MAGIC;
+    base->sectors = sectors;
+    for (uint32_t sector = 0; sector < sectors; sector++) {
+        if (pending && (pending[sector / 32] & (1UL << (sector % 32)))) {
+            verify_deferred++;
+        } else {
+            base->clean[sector / 32] |= 1UL << (sector % 32);
+        }
+        memcpy(base->digest[sector], table + sector * BOOT_HASH_SIZE, BOOT_VERIFY_DIGEST_SIZE);
+    }
+    base->deferred = verify_deferred ? BOOT_VERIFY_DEFER_PENDING : BOOT_VERIFY_DEFER_NONE;
+    base_write(base);
+}
+
+/**
+ * @return BOOT_VERIFY_DEFER_xxx of the base of a slot, BOOT_VERIFY_DEFER_NONE without a base
+ */
+uint32_t boot_verify_base_deferred(boot_slot_id slot) {
+    const boot_verify_base *base = &verify_base[slot];
+
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    return base_valid(base) ? base->deferred : BOOT_VERIFY_DEFER_NONE;
+}
+
+/**
+ * @return sectors of the image last returned by boot_slot_select() left to the application, 0: checked in full
+ */
+uint32_t boot_verify_deferred(void) {
+    return verify_deferred;
+}
+
+/**
+ * @return the base of a slot in the backup SRAM, an application writing the slot zeroes its magic
+ */
+boot_verify_base *boot_verify_base_addr(boot_slot_id slot) {
+    return &verify_base[slot];
+}
+
+/* as base_write(), by the CRC service: boot_image_crc32() takes the DTCM tables of the bootloader */
+static void svc_base_write(boot_verify_base *base) {
+    HAL_PWR_EnableBkUpAccess();
+    base->crc = boot_svc.crc32(0, base, offsetof(boot_verify_base, crc));
+    SCB_CleanDCache_by_Addr((uint32_t *) base, sizeof(boot_verify_base));
+}
+
+/**
+ * hash the next sector the boot left to the application, the verify_step service of boot_svc.h
+ *
+ * Runs in the context of the application, in memory-mapped mode: the sector is read through the window, hashed by
+ * the SHA-256 service and checked against the base of the booted slot, which then marks it clean.
+ *
+ * @return SFUD_SUCCESS: a sector passed, call again; SFUD_ERR_NOT_FOUND: none left, the check is over or was never
+ *         deferred; SFUD_ERR_READ: a sector doesn't pass, the next boot falls back to the other slot
+ */
+sfud_err boot_verify_svc_step(void) {
+    const boot_handoff_info *info = (const boot_handoff_info *) BOOT_HANDOFF_INFO_ADDR;
+    const boot_image_header *header;
+    boot_verify_base *base;
+    uint8_t digest[BOOT_SVC_SHA256_SIZE];
+    uint32_t image, sector;
+
+    if (info->magic != BOOT_HANDOFF_INFO_MAGIC || info->slot >= BOOT_SLOT_NUM) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    base = &verify_base[info->slot];
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    if ((RTC->ISR & TAMPER_FLAGS) || base->magic != BOOT_VERIFY_BASE_MAGIC || base->sectors > BOOT_VERIFY_SECTOR_NUM
+            || base->crc != boot_svc.crc32(0, base, offsetof(boot_verify_base, crc))) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    if (base->deferred != BOOT_VERIFY_DEFER_PENDING) {
+        return base->deferred == BOOT_VERIFY_DEFER_FAILED ? SFUD_ERR_READ : SFUD_ERR_NOT_FOUND;
+    }
+
+    for (sector = 0; sector < base->sectors && (base->clean[sector / 32] & (1UL << (sector % 32))); sector++) {
+    }
+    if (sector == base->sectors) {
+        base->deferred = BOOT_VERIFY_DEFER_NONE;
+        svc_base_write(base);
+        return SFUD_ERR_NOT_FOUND;
+    }
+    image = OCTOSPI1_BASE + boot_slot_addr((boot_slot_id) info->slot);
+    header = (const boot_image_header *) image;
+    boot_svc.sha256((const void *) (image + BOOT_IMAGE_HEADER_SIZE + sector * BOOT_VERIFY_SECTOR_SIZE),
+                    sector_size(header, sector), digest);
+    if (memcmp(digest, base->digest[sector], BOOT_VERIFY_DIGEST_SIZE) != 0) {
+        base->deferred = BOOT_VERIFY_DEFER_FAILED;
+        svc_base_write(base);
+        return SFUD_ERR_READ;
+    }
+    base->clean[sector / 32] |= 1UL << (sector % 32);
+    svc_base_write(base);
+    return SFUD_SUCCESS;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file boot_warm.c
+ * @brief Update mode entered from the application without a reset, see boot_warm.h.
+ */
+#include "boot_warm.h"
+#include "boot_handoff.h"
+#include "boot_part.h"
+#include "boot_uart.h"
+#include "main.h"
+
+/* any reset since boot_profile_init() cleared the flags, the flag is stale then */
+#define WARM_RESET_FLAGS                (RCC_RSR_CPURSTF | RCC_RSR_D1RSTF | RCC_RSR_D2RSTF | RCC_RSR_BORRSTF    \
+                                         | RCC_RSR_PINRSTF | RCC_RSR_PORRSTF | RCC_RSR_SFTRSTF | RCC_RSR_IWDG1RSTF \
+                                         | RCC_RSR_WWDG1RSTF | RCC_RSR_LPWRRSTF)
+
+/* not zeroed by the startup but at a power-on reset, read by SystemInit() before the RAM is set up */
+uint32_t boot_warm_flag __attribute__((section(".noinit_d3")));
+static bool warm_entered;
+
+/* the clock tree is the one of SystemClock_Config() the boot handed over */
+static bool warm_clock_ok(void) {
+    const boot_handoff_info *info = (const boot_handoff_info *) BOOT_HANDOFF_INFO_ADDR;
+    const boot_handoff_clock *clock = &info->clock;
+
+    return info->magic == BOOT_HANDOFF_INFO_MAGIC && info->version == BOOT_HANDOFF_INFO_VERSION
+            && (RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_PLL1
+            && RCC->D1CFGR == clock->rcc_d1cfgr && RCC->D2CFGR == clock->rcc_d2cfgr
+            && RCC->D3CFGR == clock->rcc_d3cfgr && RCC->PLLCKSELR == clock->rcc_pllckselr
+            && RCC->PLLCFGR == clock->rcc_pllcfgr && RCC->PLL1DIVR == clock->rcc_pll1divr
+            && RCC->PLL1FRACR == clock->rcc_pll1fracr && FLASH->ACR == clock->flash_acr;
+}
+
+/* the peripherals of the buses to their reset state, the RCC, PWR, RTC and the flash interface keep theirs */
+static void warm_peripheral_reset(void) {
+    __HAL_RCC_AHB1_FORCE_RESET();
+    __HAL_RCC_AHB2_FORCE_RESET();
+    __HAL_RCC_AHB3_FORCE_RESET();
+    __HAL_RCC_AHB4_FORCE_RESET();
+    __HAL_RCC_APB1L_FORCE_RESET();
+    __HAL_RCC_APB1H_FORCE_RESET();
+    __HAL_RCC_APB2_FORCE_RESET();
+    __HAL_RCC_APB3_FORCE_RESET();
+    __HAL_RCC_APB4_FORCE_RESET();
+    __DSB();
+    __HAL_RCC_AHB1_RELEASE_RESET();
+    __HAL_RCC_AHB2_RELEASE_RESET();
+    __HAL_RCC_AHB3_RELEASE_RESET();
+    __HAL_RCC_AHB4_RELEASE_RESET();
+    __HAL_RCC_APB1L_RELEASE_RESET();
+    __HAL_RCC_APB1H_RELEASE_RESET();
+    __HAL_RCC_APB2_RELEASE_RESET();
+    __HAL_RCC_APB3_RELEASE_RESET();
+    __HAL_RCC_APB4_RELEASE_RESET();
+    __DSB();
+}
+
+/**
+ * enter the UART update mode of the bootloader from the application, the clock tree is kept when it can be
+ *
+ * @note privileged thread mode, runs from the internal flash with no bootloader RAM, see boot_svc.h
+ */
+void boot_warm_enter(void) {
+    const uint32_t *vector = (const uint32_t *) FLASH_BANK1_BASE;
+
+    HAL_PWR_EnableBkUpAccess();
+    __HAL_RCC_RTC_CLK_ENABLE();
+    (&RTC->BKP0R)[BOOT_UART_REQUEST_BKP] = BOOT_UART_REQUEST_MAGIC;
+
+    __disable_irq();
+    if (__get_IPSR() != 0 || !warm_clock_ok()) {
+        NVIC_SystemReset();
+    }
+
+    SysTick->CTRL = 0;
+    SysTick->LOAD = 0;
+    SysTick->VAL = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        NVIC->ICER[i] = 0xFFFFFFFF;
+        NVIC->ICPR[i] = 0xFFFFFFFF;
+    }
+    /* the application may run from the window until here, nothing is fetched from it after */
+    boot_part_svc_xip_exit();
+    SCB_DisableDCache();
+    SCB_DisableICache();
+    HAL_MPU_Disable();
+    warm_peripheral_reset();
+
+    boot_warm_flag = BOOT_WARM_MAGIC;
+    __set_BASEPRI(0);
+    __set_CONTROL(0);
+    __set_MSP(vector[0]);
+    SCB->VTOR = FLASH_BANK1_BASE;
+    __DSB();
+    __ISB();
+    __enable_irq();
+    ((void (*)(void)) vector[1])();
+
+    while (1) {
+    }
+}
+
+/**
+ * the warm entry is on the way, for SystemInit(): no reset since the flags were cleared and the flag left
+ *
+ * @note the flag is only read without a reset flag, the SRAM may hold ECC errors after a power-on reset
+ */
+bool boot_warm_pending(void) {
+    return !(RCC->RSR & WARM_RESET_FLAGS) && boot_warm_flag == BOOT_WARM_MAGIC;
+}
+
+/**
+ * take the flag for boot_warm_entered() and clear it
+ *
+ * @param reset_flags RCC->RSR at the start of main(), before boot_profile_init() clears it
+ */
+void boot_warm_take(uint32_t reset_flags) {
+    warm_entered = !(reset_flags & WARM_RESET_FLAGS) && boot_warm_flag == BOOT_WARM_MAGIC;
+    boot_warm_flag = 0;
+}
+
+/**
+ * @return true: this boot came by boot_warm_enter(), the clock tree is the one of SystemClock_Config()
+ */
+bool boot_warm_entered(void) {
+    return warm_entered;
+}
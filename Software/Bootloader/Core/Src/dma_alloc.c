@@ -0,0 +1,187 @@
+/**
+ * @file dma_alloc.c
+ * @brief DMA buffer allocation per RAM bank and the D-cache upkeep, see dma_alloc.h.
+ */
+#include "dma_alloc.h"
+#include "main.h"
+
+#define TCM_END                         0x20020000UL
+
+/* permanent buffers grow up from the base, temp ones down from the end */
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;                                 /**< permanent bytes */
+    size_t temp;                                 /**< temp bytes */
+    size_t peak;
+    uint32_t fails;
+} dma_arena;
+
+static uint8_t arena_dtcm[DMA_ARENA_DTCM_SIZE] __attribute__((section(".dtcm_bss"), aligned(DMA_ALIGN)));
+static uint8_t arena_axi[DMA_ARENA_AXI_SIZE] __attribute__((aligned(DMA_ALIGN)));
+static uint8_t arena_d2[DMA_ARENA_D2_SIZE] __attribute__((section(".ram_d2"), aligned(DMA_ALIGN)));
+static uint8_t arena_d3[DMA_ARENA_D3_SIZE] __attribute__((section(".noinit_d3"), aligned(DMA_ALIGN)));
+
+static dma_arena arenas[DMA_REGION_NUM] = {
+    [DMA_REGION_DTCM] = {arena_dtcm, sizeof(arena_dtcm)},
+    [DMA_REGION_AXI] = {arena_axi, sizeof(arena_axi)},
+    [DMA_REGION_D2] = {arena_d2, sizeof(arena_d2)},
+    [DMA_REGION_D3] = {arena_d3, sizeof(arena_d3)},
+};
+
+static uint32_t irq_lock(void) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    return primask;
+}
+
+static void irq_unlock(uint32_t primask) {
+    __set_PRIMASK(primask);
+}
+
+static void *arena_take(dma_region region, size_t size, bool temp) {
+    dma_arena *arena;
+    uint32_t primask;
+    void *buf = NULL;
+
+    if (region >= DMA_REGION_NUM || size == 0) {
+        return NULL;
+    }
+    arena = &arenas[region];
+    size = (size + DMA_ALIGN - 1) & ~(size_t) (DMA_ALIGN - 1);
+
+    primask = irq_lock();
+    if (arena->size - arena->used - arena->temp >= size) {
+        if (temp) {
+            arena->temp += size;
+            buf = arena->base + arena->size - arena->temp;
+        } else {
+            buf = arena->base + arena->used;
+            arena->used += size;
+        }
+        if (arena->used + arena->temp > arena->peak) {
+            arena->peak = arena->used + arena->temp;
+        }
+    } else {
+        arena->fails++;
+    }
+    irq_unlock(primask);
+
+    return buf;
+}
+
+/**
+ * take a buffer of a bank for good, on a cache line and of whole lines
+ *
+ * @param size bytes, rounded up to DMA_ALIGN
+ * @param region bank, see the table of dma_alloc.h
+ *
+ * @return NULL: the arena of the bank is used up
+ */
+void *dma_alloc(size_t size, dma_region region) {
+    return arena_take(region, size, false);
+}
+
+/**
+ * @return bytes the arena of a bank has left
+ */
+size_t dma_alloc_left(dma_region region) {
+    return region < DMA_REGION_NUM ? arenas[region].size - arenas[region].used - arenas[region].temp : 0;
+}
+
+/**
+ * open a scope of temp buffers
+ *
+ * @return the mark dma_alloc_release() takes
+ */
+size_t dma_alloc_mark(dma_region region) {
+    return region < DMA_REGION_NUM ? arenas[region].temp : 0;
+}
+
+/**
+ * take a buffer of a bank until the release of the scope, on a cache line and of whole lines
+ *
+ * @param size bytes, rounded up to DMA_ALIGN
+ * @param region bank, see the table of dma_alloc.h
+ *
+ * @return NULL: the arena of the bank is used up
+ */
+void *dma_alloc_temp(size_t size, dma_region region) {
+    return arena_take(region, size, true);
+}
+
+/**
+ * return the temp buffers taken since dma_alloc_mark()
+ */
+void dma_alloc_release(dma_region region, size_t mark) {
+    uint32_t primask;
+
+    if (region >= DMA_REGION_NUM) {
+        return;
+    }
+    primask = irq_lock();
+    if (mark < arenas[region].temp) {
+        arenas[region].temp = mark;
+    }
+    irq_unlock(primask);
+}
+
+void dma_alloc_get_stats(dma_region region, dma_alloc_stats *stats) {
+    uint32_t primask;
+
+    if (region >= DMA_REGION_NUM) {
+        return;
+    }
+    primask = irq_lock();
+    stats->size = arenas[region].size;
+    stats->used = arenas[region].used + arenas[region].temp;
+    stats->peak = arenas[region].peak;
+    stats->fails = arenas[region].fails;
+    irq_unlock(primask);
+}
+
+/* the ITCM and the DTCM are below the cache */
+static bool is_tcm(const void *buf) {
+    return (uintptr_t) buf < TCM_END;
+}
+
+/**
+ * write the lines of a buffer back before a DMA reads it, any alignment
+ */
+void dma_prepare_tx(const void *buf, size_t len) {
+    uintptr_t start = (uintptr_t) buf & ~(uintptr_t) (DMA_ALIGN - 1);
+
+    if (len == 0 || is_tcm(buf)) {
+        return;
+    }
+    SCB_CleanDCache_by_Addr((uint32_t *) start, (int32_t) ((uintptr_t) buf + len - start));
+}
+
+static bool rx_invalidate(void *buf, size_t len) {
+    if (((uintptr_t) buf | len) & (DMA_ALIGN - 1)) {
+        return false;
+    }
+    if (len && !is_tcm(buf)) {
+        SCB_InvalidateDCache_by_Addr(buf, (int32_t) len);
+    }
+    return true;
+}
+
+/**
+ * drop the lines of a buffer before a DMA writes it, so no dirty one is evicted over the data
+ *
+ * @return false: buf or len is not on DMA_ALIGN, nothing is done
+ */
+bool dma_prepare_rx(void *buf, size_t len) {
+    return rx_invalidate(buf, len);
+}
+
+/**
+ * drop the lines of a buffer a DMA has written, the CPU reads the data from the RAM
+ *
+ * @return false: buf or len is not on DMA_ALIGN, nothing is done
+ */
+bool dma_complete_rx(void *buf, size_t len) {
+    return rx_invalidate(buf, len);
+}
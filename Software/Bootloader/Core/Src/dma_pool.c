@@ -0,0 +1,127 @@
+/**
+ * @file dma_pool.c
+ * @brief Fixed-block pool of DMA buffers in RAM_D2, see dma_pool.h.
+ */
+#include "dma_pool.h"
+#include "dma_alloc.h"
+#include "main.h"
+#include <stdbool.h>
+
+/* not cleared by the startup, only the bookkeeping below is */
+static uint8_t pool_blocks[DMA_POOL_BLOCKS][DMA_POOL_BLOCK_SIZE]
+        __attribute__((section(".ram_d2"), aligned(DMA_ALIGN)));
+static uint8_t pool_refs[DMA_POOL_BLOCKS];
+static uint8_t pool_free_idx[DMA_POOL_BLOCKS];
+static uint32_t pool_free_num;
+static bool pool_ready;
+static dma_pool_stats pool_stats;
+
+static uint32_t irq_lock(void) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    return primask;
+}
+
+static void irq_unlock(uint32_t primask) {
+    __set_PRIMASK(primask);
+}
+
+static int block_index(const void *block) {
+    uintptr_t offset = (uintptr_t) block - (uintptr_t) pool_blocks[0];
+
+    if ((uintptr_t) block < (uintptr_t) pool_blocks[0] || offset >= sizeof(pool_blocks)
+            || offset % DMA_POOL_BLOCK_SIZE) {
+        return -1;
+    }
+    return (int) (offset / DMA_POOL_BLOCK_SIZE);
+}
+
+/* on the first call, the bookkeeping is in .bss */
+static void pool_init(void) {
+    uint32_t i;
+
+    for (i = 0; i < DMA_POOL_BLOCKS; i++) {
+        pool_free_idx[i] = (uint8_t) (DMA_POOL_BLOCKS - 1 - i);
+    }
+    pool_free_num = DMA_POOL_BLOCKS;
+    pool_stats.free_min = DMA_POOL_BLOCKS;
+    pool_ready = true;
+}
+
+/**
+ * take a block, its one reference is the caller's
+ *
+ * @return NULL: all blocks are taken
+ */
+void *dma_pool_alloc(void) {
+    uint32_t primask = irq_lock();
+    void *block = NULL;
+    uint8_t idx;
+
+    if (!pool_ready) {
+        pool_init();
+    }
+    if (pool_free_num) {
+        idx = pool_free_idx[--pool_free_num];
+        pool_refs[idx] = 1;
+        block = pool_blocks[idx];
+        pool_stats.allocs++;
+        if (pool_free_num < pool_stats.free_min) {
+            pool_stats.free_min = pool_free_num;
+        }
+    } else {
+        pool_stats.fails++;
+    }
+    irq_unlock(primask);
+
+    return block;
+}
+
+/**
+ * add a holder to a block taken with dma_pool_alloc()
+ */
+void dma_pool_ref(void *block) {
+    int idx = block_index(block);
+    uint32_t primask;
+
+    if (idx < 0) {
+        return;
+    }
+    primask = irq_lock();
+    if (pool_refs[idx]) {
+        pool_refs[idx]++;
+    }
+    irq_unlock(primask);
+}
+
+/**
+ * drop a reference, the block is free again when no holder is left
+ */
+void dma_pool_free(void *block) {
+    int idx = block_index(block);
+    uint32_t primask;
+
+    if (idx < 0) {
+        return;
+    }
+    primask = irq_lock();
+    if (pool_refs[idx] && --pool_refs[idx] == 0) {
+        pool_free_idx[pool_free_num++] = (uint8_t) idx;
+    }
+    irq_unlock(primask);
+}
+
+uint32_t dma_pool_free_count(void) {
+    return pool_ready ? pool_free_num : DMA_POOL_BLOCKS;
+}
+
+void dma_pool_get_stats(dma_pool_stats *stats) {
+    uint32_t primask = irq_lock();
+
+    *stats = pool_stats;
+    if (!pool_ready) {
+        stats->free_min = DMA_POOL_BLOCKS;
+    }
+    irq_unlock(primask);
+}
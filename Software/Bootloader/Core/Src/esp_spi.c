@@ -0,0 +1,490 @@
+/**
+ * @file esp_spi.c
+ * @brief ESP-Hosted SPI host transport to the ESP32-C3, see esp_spi.h.
+ */
+#include "esp_spi.h"
+#include "boot_trace.h"
+#include "dma_alloc.h"
+#include "dma_pool.h"
+#include "spsc_ring.h"
+#include "main.h"
+#include <string.h>
+
+/* SPI3: PC10 SCK, PC11 MISO, PC12 MOSI, PA15 CS by software */
+#define ESP_CS_PORT                     GPIOA
+#define ESP_CS_PIN                      GPIO_PIN_15
+#define ESP_HS_PORT                     GPIOD
+#define ESP_HS_PIN                      GPIO_PIN_2
+#define ESP_DR_PORT                     GPIOD
+#define ESP_DR_PIN                      GPIO_PIN_3
+/* entries of a frame FIFO, the frames of a queue fit, a power of two */
+#define ESP_FIFO_LEN                    4
+
+#if ESP_SPI_FRAME_SIZE > DMA_POOL_BLOCK_SIZE || ESP_SPI_TX_FRAMES > ESP_FIFO_LEN || ESP_SPI_RX_FRAMES > ESP_FIFO_LEN
+#error "the frames don't fit the pool blocks or the FIFOs"
+#endif
+
+/* sent when nothing is queued, a header of 0s is an empty frame; the DMA1 can't reach the TCMs */
+static uint8_t *empty_frame;
+static SPI_HandleTypeDef hspi3;
+static DMA_HandleTypeDef hdma_spi3_rx;
+static DMA_HandleTypeDef hdma_spi3_tx;
+
+/* frame pointers; the handlers push rx_ready, the thread pops it without a lock */
+static uint8_t *tx_ready_buf[ESP_FIFO_LEN], *rx_ready_buf[ESP_FIFO_LEN];
+static spsc_ring tx_ready = { (uint8_t *) tx_ready_buf, sizeof(tx_ready_buf) - 1, 0, 0 };
+static spsc_ring rx_ready = { (uint8_t *) rx_ready_buf, sizeof(rx_ready_buf) - 1, 0, 0 };
+/* the handlers share one priority, the rest of the thread side masks them */
+static uint32_t tx_taken;                            /**< TX frames of the caller or queued */
+static volatile bool xfer_busy;
+static uint8_t *xfer_tx;                             /**< TX frame of the transaction, NULL: empty_frame */
+static uint8_t *xfer_rx;                             /**< RX frame of the transaction */
+static uint32_t xfer_start;                          /**< CYCCNT at CS low */
+static uint32_t event_cycles;                        /**< CYCCNT of the first event not served yet */
+static bool event_pending;
+static esp_spi_stats stats;
+static void (*xfer_notify)(void);
+
+static uint32_t irq_lock(void) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    return primask;
+}
+
+static void irq_unlock(uint32_t primask) {
+    __set_PRIMASK(primask);
+}
+
+static uint8_t fifo_count(const spsc_ring *fifo) {
+    return (uint8_t) (spsc_ring_used(fifo) / sizeof(uint8_t *));
+}
+
+static void fifo_push(spsc_ring *fifo, uint8_t *frame) {
+    spsc_ring_write(fifo, &frame, sizeof(frame));
+}
+
+static uint8_t *fifo_pop(spsc_ring *fifo) {
+    uint8_t *frame = NULL;
+
+    spsc_ring_read(fifo, &frame, sizeof(frame));
+    return frame;
+}
+
+static void tx_frame_free(uint8_t *frame) {
+    dma_pool_free(frame);
+    tx_taken--;
+}
+
+static void event_mark(void) {
+    if (!event_pending) {
+        event_cycles = DWT->CYCCNT;
+        event_pending = true;
+        boot_trace_begin(BOOT_TRACE_ESP_EVENT, 0);
+    }
+}
+
+/**
+ * sum of the header and payload bytes of a frame, its checksum field as 0
+ */
+uint16_t esp_spi_checksum(const uint8_t *frame) {
+    const esp_spi_header *header = (const esp_spi_header *) frame;
+    uint32_t len = (uint32_t) header->offset + header->len, i;
+    uint16_t sum = 0;
+
+    if (len > ESP_SPI_FRAME_SIZE) {
+        len = ESP_SPI_FRAME_SIZE;
+    }
+    for (i = 0; i < len; i++) {
+        sum += frame[i];
+    }
+    return sum - (header->checksum & 0xFF) - (header->checksum >> 8);
+}
+
+static bool frame_is_valid(const uint8_t *frame) {
+    const esp_spi_header *header = (const esp_spi_header *) frame;
+
+    return header->offset >= sizeof(esp_spi_header)
+            && (uint32_t) header->offset + header->len <= ESP_SPI_FRAME_SIZE
+            && esp_spi_checksum(frame) == header->checksum;
+}
+
+/**
+ * start the next transaction when the slave is ready and there's a reason to, with the handlers masked
+ */
+static void xfer_kick(void) {
+    uint8_t *tx;
+    uint32_t now;
+
+    if (xfer_busy || HAL_GPIO_ReadPin(ESP_HS_PORT, ESP_HS_PIN) != GPIO_PIN_SET) {
+        return;
+    }
+    if (!fifo_count(&tx_ready) && HAL_GPIO_ReadPin(ESP_DR_PORT, ESP_DR_PIN) != GPIO_PIN_SET) {
+        event_pending = false;
+        return;
+    }
+    /* the frames received wait for the caller, its flow control */
+    if (fifo_count(&rx_ready) >= ESP_SPI_RX_FRAMES || (xfer_rx = dma_pool_alloc()) == NULL) {
+        stats.stalls++;
+        return;
+    }
+    xfer_tx = fifo_count(&tx_ready) ? fifo_pop(&tx_ready) : NULL;
+    tx = xfer_tx ? xfer_tx : empty_frame;
+
+    dma_prepare_tx(tx, ESP_SPI_FRAME_SIZE);
+    dma_prepare_rx(xfer_rx, ESP_SPI_FRAME_SIZE);
+    HAL_GPIO_WritePin(ESP_CS_PORT, ESP_CS_PIN, GPIO_PIN_RESET);
+    now = DWT->CYCCNT;
+    if (event_pending) {
+        uint32_t cycles = now - event_cycles;
+
+        stats.start_cycles += cycles;
+        if (cycles > stats.start_cycles_max) {
+            stats.start_cycles_max = cycles;
+        }
+        event_pending = false;
+        boot_trace_end(BOOT_TRACE_ESP_EVENT, 0);
+    }
+    xfer_start = now;
+    boot_trace_begin(BOOT_TRACE_ESP_XFER, ESP_SPI_FRAME_SIZE);
+    xfer_busy = true;
+    if (HAL_SPI_TransmitReceive_DMA(&hspi3, tx, xfer_rx, ESP_SPI_FRAME_SIZE) != HAL_OK) {
+        HAL_GPIO_WritePin(ESP_CS_PORT, ESP_CS_PIN, GPIO_PIN_SET);
+        xfer_busy = false;
+        stats.errors++;
+        dma_pool_free(xfer_rx);
+        if (xfer_tx) {
+            tx_frame_free(xfer_tx);
+        }
+    }
+}
+
+/**
+ * turn the frames of an ended transaction around and start the next one
+ */
+static void xfer_check(void) {
+    const esp_spi_header *header;
+
+    if (!xfer_busy || hspi3.State != HAL_SPI_STATE_READY) {
+        return;
+    }
+    HAL_GPIO_WritePin(ESP_CS_PORT, ESP_CS_PIN, GPIO_PIN_SET);
+    stats.busy_cycles += DWT->CYCCNT - xfer_start;
+    boot_trace_end(BOOT_TRACE_ESP_XFER, ESP_SPI_FRAME_SIZE);
+    stats.xfers++;
+    dma_complete_rx(xfer_rx, ESP_SPI_FRAME_SIZE);
+
+    header = (const esp_spi_header *) xfer_rx;
+    if (hspi3.ErrorCode != HAL_SPI_ERROR_NONE) {
+        stats.errors++;
+        dma_pool_free(xfer_rx);
+    } else if (header->len == 0) {
+        dma_pool_free(xfer_rx);
+    } else if (!frame_is_valid(xfer_rx)) {
+        stats.rx_dropped++;
+        dma_pool_free(xfer_rx);
+    } else {
+        stats.rx_frames++;
+        stats.rx_bytes += header->offset + header->len;
+        fifo_push(&rx_ready, xfer_rx);
+    }
+    if (xfer_tx) {
+        if (hspi3.ErrorCode == HAL_SPI_ERROR_NONE) {
+            header = (const esp_spi_header *) xfer_tx;
+            stats.tx_frames++;
+            stats.tx_bytes += header->offset + header->len;
+        }
+        tx_frame_free(xfer_tx);
+    }
+    xfer_busy = false;
+    event_mark();
+    xfer_kick();
+    if (xfer_notify) {
+        xfer_notify();
+    }
+}
+
+static void esp_dma_init(DMA_HandleTypeDef *hdma, DMA_Stream_TypeDef *stream, uint32_t request, uint32_t direction) {
+    hdma->Instance = stream;
+    hdma->Init.Request = request;
+    hdma->Init.Direction = direction;
+    hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma->Init.MemInc = DMA_MINC_ENABLE;
+    hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma->Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma->Init.Mode = DMA_NORMAL;
+    hdma->Init.Priority = DMA_PRIORITY_HIGH;
+    hdma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+}
+
+/**
+ * set up SPI3, its DMA and the lines of the slave, then serve the link from the interrupts
+ */
+bool esp_spi_init(void) {
+    GPIO_InitTypeDef gpio = {0};
+    uint32_t primask;
+
+    if (hspi3.Instance) {
+        return true;
+    }
+    if (!empty_frame) {
+        empty_frame = dma_alloc(ESP_SPI_FRAME_SIZE, DMA_REGION_AXI);
+        if (!empty_frame) {
+            return false;
+        }
+        memset(empty_frame, 0, ESP_SPI_FRAME_SIZE);
+    }
+    __HAL_RCC_GPIOA_CLK_ENABLE();
+    __HAL_RCC_GPIOC_CLK_ENABLE();
+    __HAL_RCC_GPIOD_CLK_ENABLE();
+    __HAL_RCC_SPI3_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    HAL_GPIO_WritePin(ESP_CS_PORT, ESP_CS_PIN, GPIO_PIN_SET);
+    gpio.Pin = ESP_CS_PIN;
+    gpio.Mode = GPIO_MODE_OUTPUT_PP;
+    gpio.Pull = GPIO_NOPULL;
+    gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    HAL_GPIO_Init(ESP_CS_PORT, &gpio);
+
+    gpio.Pin = GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12;
+    gpio.Mode = GPIO_MODE_AF_PP;
+    gpio.Alternate = GPIO_AF6_SPI3;
+    HAL_GPIO_Init(GPIOC, &gpio);
+
+    /* HANDSHAKE and DATA_READY, the ESP32 drives them, low while it boots */
+    gpio.Pin = ESP_HS_PIN | ESP_DR_PIN;
+    gpio.Mode = GPIO_MODE_IT_RISING;
+    gpio.Pull = GPIO_PULLDOWN;
+    gpio.Speed = GPIO_SPEED_FREQ_LOW;
+    gpio.Alternate = 0;
+    HAL_GPIO_Init(GPIOD, &gpio);
+
+    esp_dma_init(&hdma_spi3_rx, DMA1_Stream3, DMA_REQUEST_SPI3_RX, DMA_PERIPH_TO_MEMORY);
+    esp_dma_init(&hdma_spi3_tx, DMA1_Stream4, DMA_REQUEST_SPI3_TX, DMA_MEMORY_TO_PERIPH);
+    if (HAL_DMA_Init(&hdma_spi3_rx) != HAL_OK || HAL_DMA_Init(&hdma_spi3_tx) != HAL_OK) {
+        return false;
+    }
+
+    hspi3.Instance = SPI3;
+    hspi3.Init.Mode = SPI_MODE_MASTER;
+    hspi3.Init.Direction = SPI_DIRECTION_2LINES;
+    hspi3.Init.DataSize = SPI_DATASIZE_8BIT;
+    /* mode 3 as the ESP32-C3 slave of ESP-Hosted, 110MHz / 4 */
+    hspi3.Init.CLKPolarity = SPI_POLARITY_HIGH;
+    hspi3.Init.CLKPhase = SPI_PHASE_2EDGE;
+    hspi3.Init.NSS = SPI_NSS_SOFT;
+    hspi3.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_4;
+    hspi3.Init.FirstBit = SPI_FIRSTBIT_MSB;
+    hspi3.Init.TIMode = SPI_TIMODE_DISABLE;
+    hspi3.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+    hspi3.Init.CRCPolynomial = 0x0;
+    hspi3.Init.NSSPMode = SPI_NSS_PULSE_DISABLE;
+    hspi3.Init.NSSPolarity = SPI_NSS_POLARITY_LOW;
+    hspi3.Init.FifoThreshold = SPI_FIFO_THRESHOLD_01DATA;
+    hspi3.Init.TxCRCInitializationPattern = SPI_CRC_INITIALIZATION_ALL_ZERO_PATTERN;
+    hspi3.Init.RxCRCInitializationPattern = SPI_CRC_INITIALIZATION_ALL_ZERO_PATTERN;
+    hspi3.Init.MasterSSIdleness = SPI_MASTER_SS_IDLENESS_00CYCLE;
+    hspi3.Init.MasterInterDataIdleness = SPI_MASTER_INTERDATA_IDLENESS_00CYCLE;
+    hspi3.Init.MasterReceiverAutoSusp = SPI_MASTER_RX_AUTOSUSP_DISABLE;
+    /* SCK stays high between the transactions */
+    hspi3.Init.MasterKeepIOState = SPI_MASTER_KEEP_IO_STATE_ENABLE;
+    hspi3.Init.IOSwap = SPI_IO_SWAP_DISABLE;
+    if (HAL_SPI_Init(&hspi3) != HAL_OK) {
+        hspi3.Instance = NULL;
+        return false;
+    }
+    __HAL_LINKDMA(&hspi3, hdmarx, hdma_spi3_rx);
+    __HAL_LINKDMA(&hspi3, hdmatx, hdma_spi3_tx);
+
+    memset(&stats, 0, sizeof(stats));
+    tx_taken = 0;
+    tx_ready.head = tx_ready.tail = 0;
+    rx_ready.head = rx_ready.tail = 0;
+    xfer_busy = false;
+    event_pending = false;
+
+    HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, ESP_SPI_IRQ_PRIORITY, 0);
+    HAL_NVIC_SetPriority(DMA1_Stream4_IRQn, ESP_SPI_IRQ_PRIORITY, 0);
+    HAL_NVIC_SetPriority(SPI3_IRQn, ESP_SPI_IRQ_PRIORITY, 0);
+    HAL_NVIC_SetPriority(EXTI2_IRQn, ESP_SPI_IRQ_PRIORITY, 0);
+    HAL_NVIC_SetPriority(EXTI3_IRQn, ESP_SPI_IRQ_PRIORITY, 0);
+    primask = irq_lock();
+    HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+    HAL_NVIC_EnableIRQ(DMA1_Stream4_IRQn);
+    HAL_NVIC_EnableIRQ(SPI3_IRQn);
+    HAL_NVIC_EnableIRQ(EXTI2_IRQn);
+    HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+    /* no edge comes when the slave is up already */
+    event_mark();
+    xfer_kick();
+    irq_unlock(primask);
+
+    return true;
+}
+
+void esp_spi_deinit(void) {
+    HAL_NVIC_DisableIRQ(EXTI2_IRQn);
+    HAL_NVIC_DisableIRQ(EXTI3_IRQn);
+    HAL_NVIC_DisableIRQ(SPI3_IRQn);
+    HAL_NVIC_DisableIRQ(DMA1_Stream3_IRQn);
+    HAL_NVIC_DisableIRQ(DMA1_Stream4_IRQn);
+    if (xfer_busy) {
+        HAL_SPI_Abort(&hspi3);
+        HAL_GPIO_WritePin(ESP_CS_PORT, ESP_CS_PIN, GPIO_PIN_SET);
+        xfer_busy = false;
+        dma_pool_free(xfer_rx);
+        if (xfer_tx) {
+            tx_frame_free(xfer_tx);
+        }
+    }
+    /* the frames nobody took go back to the pool */
+    while (fifo_count(&tx_ready)) {
+        tx_frame_free(fifo_pop(&tx_ready));
+    }
+    while (fifo_count(&rx_ready)) {
+        dma_pool_free(fifo_pop(&rx_ready));
+    }
+    HAL_SPI_DeInit(&hspi3);
+    HAL_DMA_DeInit(&hdma_spi3_rx);
+    HAL_DMA_DeInit(&hdma_spi3_tx);
+    __HAL_RCC_SPI3_CLK_DISABLE();
+    HAL_GPIO_DeInit(GPIOC, GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12);
+    HAL_GPIO_DeInit(ESP_CS_PORT, ESP_CS_PIN);
+    HAL_GPIO_DeInit(GPIOD, ESP_HS_PIN | ESP_DR_PIN);
+    hspi3.Instance = NULL;
+    xfer_notify = NULL;
+}
+
+/**
+ * call notify from the handlers at the end of every transaction, a frame may be received or a TX frame free
+ *
+ * @param notify NULL: none, kept till esp_spi_deinit()
+ */
+void esp_spi_set_notify(void (*notify)(void)) {
+    uint32_t primask = irq_lock();
+
+    xfer_notify = notify;
+    irq_unlock(primask);
+}
+
+/**
+ * @note before esp_spi_init() DATA_READY is an input for the one read, its reset state again after it: the check at
+ * boot costs no SPI3, DMA or EXTI set up
+ *
+ * @return true: the slave has something to send
+ */
+bool esp_spi_data_ready(void) {
+    GPIO_InitTypeDef gpio = {0};
+    bool ready;
+
+    if (hspi3.Instance) {
+        return HAL_GPIO_ReadPin(ESP_DR_PORT, ESP_DR_PIN) == GPIO_PIN_SET;
+    }
+    __HAL_RCC_GPIOD_CLK_ENABLE();
+    gpio.Pin = ESP_DR_PIN;
+    gpio.Mode = GPIO_MODE_INPUT;
+    gpio.Pull = GPIO_PULLDOWN;
+    gpio.Speed = GPIO_SPEED_FREQ_LOW;
+    HAL_GPIO_Init(ESP_DR_PORT, &gpio);
+    ready = HAL_GPIO_ReadPin(ESP_DR_PORT, ESP_DR_PIN) == GPIO_PIN_SET;
+    HAL_GPIO_DeInit(ESP_DR_PORT, ESP_DR_PIN);
+    return ready;
+}
+
+/**
+ * @return true: a queued TX frame isn't sent yet, or a transaction is on
+ */
+bool esp_spi_tx_busy(void) {
+    return fifo_count(&tx_ready) || xfer_busy;
+}
+
+/**
+ * @return TX frames queued, no transaction took them yet
+ */
+uint32_t esp_spi_tx_pending(void) {
+    return fifo_count(&tx_ready);
+}
+
+/**
+ * @return a free TX frame to fill, NULL: all of them are queued or in a transaction
+ */
+uint8_t *esp_spi_tx_get(void) {
+    uint32_t primask = irq_lock();
+    uint8_t *frame = tx_taken < ESP_SPI_TX_FRAMES ? dma_pool_alloc() : NULL;
+
+    if (frame) {
+        tx_taken++;
+    }
+    irq_unlock(primask);
+    return frame;
+}
+
+/**
+ * queue a frame of esp_spi_tx_get(), the header and payload filled
+ */
+void esp_spi_tx_put(uint8_t *frame) {
+    esp_spi_header *header = (esp_spi_header *) frame;
+    uint32_t primask;
+
+    header->checksum = 0;
+    header->checksum = esp_spi_checksum(frame);
+    primask = irq_lock();
+    fifo_push(&tx_ready, frame);
+    event_mark();
+    xfer_kick();
+    irq_unlock(primask);
+}
+
+/**
+ * @return the oldest frame received, NULL: none
+ */
+uint8_t *esp_spi_rx_get(void) {
+    /* the only reader of rx_ready, the handlers only push */
+    return fifo_pop(&rx_ready);
+}
+
+/**
+ * drop the reference of esp_spi_rx_get() to a frame, a stalled slave goes on
+ */
+void esp_spi_rx_release(uint8_t *frame) {
+    uint32_t primask = irq_lock();
+
+    dma_pool_free(frame);
+    event_mark();
+    xfer_kick();
+    irq_unlock(primask);
+}
+
+void esp_spi_get_stats(esp_spi_stats *out) {
+    uint32_t primask = irq_lock();
+
+    *out = stats;
+    irq_unlock(primask);
+}
+
+void esp_spi_exti_irq_handler(void) {
+    if (__HAL_GPIO_EXTI_GET_IT(ESP_HS_PIN)) {
+        __HAL_GPIO_EXTI_CLEAR_IT(ESP_HS_PIN);
+    }
+    if (__HAL_GPIO_EXTI_GET_IT(ESP_DR_PIN)) {
+        __HAL_GPIO_EXTI_CLEAR_IT(ESP_DR_PIN);
+    }
+    event_mark();
+    xfer_kick();
+}
+
+void esp_spi_dma_rx_irq_handler(void) {
+    HAL_DMA_IRQHandler(&hdma_spi3_rx);
+    xfer_check();
+}
+
+void esp_spi_dma_tx_irq_handler(void) {
+    HAL_DMA_IRQHandler(&hdma_spi3_tx);
+    xfer_check();
+}
+
+void esp_spi_irq_handler(void) {
+    HAL_SPI_IRQHandler(&hspi3);
+    xfer_check();
+}
@@ -28,8 +28,42 @@
 /* USER CODE BEGIN Includes */
 #include <stdio.h>
 #include <string.h>
+/* before the first elog.h, no header above includes it */
+#define LOG_LVL ELOG_TAG_LVL_BOOTLOADER
 #include "elog.h"
 #include "sfud.h"
+#include "boot_profile.h"
+#include "boot_clock.h"
+#include "boot_ospi_cal.h"
+#include "boot_handoff.h"
+#include "boot_direct.h"
+#include "boot_slot.h"
+#include "boot_trial.h"
+#include "boot_verify.h"
+#include "boot_otfdec.h"
+#include "boot_uart.h"
+#include "boot_usb.h"
+#include "boot_esp.h"
+#include "boot_bench.h"
+#include "boot_agent.h"
+#include "boot_scatter.h"
+#include "boot_kv.h"
+#include "boot_lfs.h"
+#include "boot_rollback.h"
+#include "boot_espflash.h"
+#include "boot_selfupdate.h"
+#include "boot_fault.h"
+#include "boot_pcprof.h"
+#include "boot_ext.h"
+#include "boot_part.h"
+#include "boot_warm.h"
+#include "boot_perf.h"
+#include "boot_trace.h"
+#include "dma_alloc.h"
+#include "dma_pool.h"
+#ifdef ELOG_PORT_FLASH_ENABLE
+#include "elog_flash.h"
+#endif
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -56,12 +90,51 @@
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 /* USER CODE BEGIN PFP */
-static const char *const TAG = "bootloader";
+ELOG_TAG_DEFINE(TAG, "bootloader");
 volatile uint32_t global_stack_top;
 volatile uint32_t global_vector_addr;
 volatile uint32_t global_entry_addr;
 
-__STATIC_FORCEINLINE void JumpToApp(uint32_t stack_top, uint32_t vector_addr, uint32_t entry_addr) {
+#ifdef SFUD_USING_STATS
+/* SFUD counters of the boot on the log, the handoff record takes them too */
+static void SfudStatsLog(void) {
+    static const char *const op_name[SFUD_STATS_OP_NUM] = {"read", "write", "erase", "status"};
+
+    for (size_t i = 0; i < SFUD_FLASH_DEVICE_NUM; i++) {
+        const sfud_flash *flash = sfud_get_device(i);
+        const sfud_stats *stats = sfud_get_stats(flash);
+
+        for (size_t op = 0; stats && op < SFUD_STATS_OP_NUM; op++) {
+            const sfud_stats_entry *entry = &stats->op[op];
+
+            if (entry->count) {
+                elog_i(TAG, "%s %s: %u calls, %u bytes, %u us (max %u, busy %u), %u retries, %u bus errors",
+                       flash->name, op_name[op], entry->count, entry->bytes, entry->total_us, entry->max_us,
+                       entry->busy_us, entry->retries, entry->bus_errors);
+            }
+        }
+    }
+}
+#endif
+
+/* high-water marks of the stack and the static arenas, the sizes of dma_alloc.h and dma_pool.h are set from them */
+static void MemStatsLog(void) {
+    static const char *const region_name[DMA_REGION_NUM] = {"DTCM", "AXI", "D2", "D3"};
+    dma_alloc_stats arena;
+    dma_pool_stats pool;
+
+    elog_i(TAG, "stack: %u of %u bytes used at most", boot_profile_stack_peak(), boot_profile_stack_size());
+    for (size_t i = 0; i < DMA_REGION_NUM; i++) {
+        dma_alloc_get_stats((dma_region) i, &arena);
+        elog_i(TAG, "arena %s: %u of %u bytes taken, peak %u, %u failed", region_name[i], arena.used, arena.size,
+               arena.peak, arena.fails);
+    }
+    dma_pool_get_stats(&pool);
+    elog_i(TAG, "dma pool: %u blocks handed out, %u of %u free at least, %u failed", pool.allocs, pool.free_min,
+           DMA_POOL_BLOCKS, pool.fails);
+}
+
+__STATIC_FORCEINLINE void JumpToApp(uint32_t stack_top, uint32_t vector_addr, uint32_t entry_addr, uint32_t xip_size) {
     // copy them to avoid use the var in stack after stack changing
     global_stack_top = stack_top;
     global_vector_addr = vector_addr;
@@ -70,11 +143,29 @@ __STATIC_FORCEINLINE void JumpToApp(uint32_t stack_top, uint32_t vector_addr, ui
     elog_i(TAG, "stack_top: 0x%08x", global_stack_top);
     elog_i(TAG, "vector_addr: 0x%08x", global_vector_addr);
     elog_i(TAG, "entry_addr: 0x%08x", global_entry_addr);
-
-    HAL_MPU_Disable();
-    SCB_DisableDCache();
-    SCB_DisableICache();
-
+#ifdef SFUD_USING_STATS
+    SfudStatsLog();
+#endif
+    MemStatsLog();
+
+    boot_profile_finish();
+    boot_trace_finish();
+    /* the stage times against the last boots, stored before the flush */
+    boot_perf_record();
+    /* the application gets the EXT flash idle */
+    boot_kv_flush();
+#ifdef BOOT_LFS
+    boot_lfs_flush();
+#endif
+#ifdef ELOG_PORT_FLASH_ENABLE
+    elog_flash_flush();
+#endif
+    sfud_write_flush(sfud_get_device(SFUD_EXT_FLASH));
+
+    boot_handoff_prepare(OCTOSPI1_BASE, xip_size);
+
+    /* the log DMA must be done before its interrupt is gone */
+    elog_port_flush();
     __disable_irq();
 
     SysTick->CTRL = 0;
@@ -85,6 +176,11 @@ __STATIC_FORCEINLINE void JumpToApp(uint32_t stack_top, uint32_t vector_addr, ui
         NVIC->ICPR[i] = 0xFFFFFFFF;
     }
 
+    if (boot_scatter_pending()) {
+        /* the copy of the sections may overwrite the bootloader's RAM, it enters the app itself */
+        boot_scatter_jump(global_stack_top, global_vector_addr, global_entry_addr);
+    }
+
     __enable_irq();
 
     __set_MSP(global_stack_top);
@@ -96,42 +192,55 @@ __STATIC_FORCEINLINE void JumpToApp(uint32_t stack_top, uint32_t vector_addr, ui
 
 }
 
-__STATIC_FORCEINLINE void EntryApp() {
-    extern sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash);
+__STATIC_FORCEINLINE bool AppStackValid(uint32_t stack_top) {
+    return stack_top >= 0x20000000 && stack_top <= 0x24050000;
+}
+
+/* vector_addr is VTOR of the app, stored_addr where its vector table is read before a RAM image is copied, delta
+ * moves the reset handler of a PIC image to its slot */
+__STATIC_FORCEINLINE void EntryApp(uint32_t vector_addr, uint32_t stored_addr, uint32_t delta) {
     sfud_flash *flash = sfud_get_device(SFUD_MAIN_FLASH);
-    qspi_entry_memory_mapped_mode(flash);
-
-//    /* Set OTFDEC Mode */
-//    if (HAL_OTFDEC_RegionSetMode(&hotfdec1, OTFDEC_REGION1, OTFDEC_REG_MODE_INSTRUCTION_OR_DATA_ACCESSES) != HAL_OK) {
-//        Error_Handler();
-//    }
-//
-//    /* Set OTFDEC Key */
-//    if (HAL_OTFDEC_RegionSetKey(&hotfdec1, OTFDEC_REGION1, key) != HAL_OK) {
-//        Error_Handler();
-//    }
-//
-//    OTFDEC_RegionConfigTypeDef Config;
-//    /* Configure and lock region,enable OTFDEC decryption */
-//    Config.Nonce[0] = iv[0];
-//    Config.Nonce[1] = iv[1];
-//    Config.StartAddress = OCTOSPI1_BASE;
-//    Config.EndAddress = OCTOSPI1_BASE + 1 * 1024 * 1024;
-//    Config.Version = 0xABBA;
-//    if (HAL_OTFDEC_RegionConfig(&hotfdec1, OTFDEC_REGION1, &Config, OTFDEC_REG_CONFIGR_LOCK_ENABLE) != HAL_OK) {
-//        Error_Handler();
-//    }
-
-    uint32_t *stack_top = (uint32_t *) (OCTOSPI1_BASE);
-    uint32_t *entry_addr = (uint32_t *) (OCTOSPI1_BASE + sizeof(uint32_t));
-    uint32_t vector_addr = OCTOSPI1_BASE;
-    JumpToApp(*stack_top, vector_addr, *entry_addr);
+
+    uint32_t *stack_top = (uint32_t *) (stored_addr);
+    uint32_t *entry_addr = (uint32_t *) (stored_addr + sizeof(uint32_t));
+    /* the legacy layout is booted without a header, refuse to jump into erased flash */
+    if (!AppStackValid(*stack_top)) {
+        extern sfud_err qspi_exit_memory_mapped_mode(sfud_flash *flash);
+        elog_e(TAG, "no vector table at 0x%08x", vector_addr);
+        qspi_exit_memory_mapped_mode(flash);
+        return;
+    }
+    JumpToApp(*stack_top, vector_addr, *entry_addr + delta, flash->chip.capacity);
 }
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 
+#ifndef BOOT_AGENT
+/* the direct path, OCTOSPI1 memory-mapped and the slot checked by boot_direct_enter() */
+static void DirectBoot(const boot_direct *direct) {
+    uint32_t slot_addr = OCTOSPI1_BASE + boot_slot_addr((boot_slot_id) direct->slot);
+    const boot_image_header *header = (const boot_image_header *) slot_addr;
+    const uint32_t *vector = (const uint32_t *) boot_image_vector(header, slot_addr);
+
+    boot_handoff_info_init(BOOT_HANDOFF_PATH_DIRECT);
+    boot_handoff_info_slot((boot_slot_id) direct->slot, header, BOOT_HANDOFF_IMAGE_HEADER
+            | ((header->flags & BOOT_IMAGE_FLAG_ENCRYPTED) ? BOOT_HANDOFF_IMAGE_DECRYPTED : 0)
+            | ((header->flags & BOOT_IMAGE_FLAG_RAM) ? BOOT_HANDOFF_IMAGE_RAM : 0));
+#ifdef BOOT_DIRECT_LL
+    boot_clock_config_ll();
+#else
+    SystemClock_Config();
+#endif
+    /* the kernel clock the record's prescaler was set for */
+    boot_clock_ospi();
+    boot_profile_mark(BOOT_STAGE_SYSTEM_CLOCK);
+    JumpToApp(vector[0], boot_image_vtor(header), vector[1] + boot_image_delta(header, slot_addr),
+              direct->xip_size);
+}
+#endif
+
 /* USER CODE END 0 */
 
 /**
@@ -142,7 +251,23 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
-
+    boot_profile_init();
+    boot_trace_init();
+    /* the application may have come in by boot_warm_enter(), the PLL is running then */
+    boot_warm_take(boot_profile_record.reset_flags);
+#if !defined(BOOT_AGENT) && defined(BOOT_DIRECT_LL)
+    {
+        /* a warm reset after a good boot goes straight to the same slot, no HAL on the way */
+        const boot_direct *direct;
+
+        SCB_EnableICache();
+        SCB_EnableDCache();
+        direct = boot_direct_enter_ll();
+        if (direct) {
+            DirectBoot(direct);
+        }
+    }
+#endif
   /* USER CODE END 1 */
 
   /* Enable the CPU Cache */
@@ -159,12 +284,11 @@ int main(void)
   HAL_Init();
 
   /* USER CODE BEGIN Init */
-
+    boot_profile_mark(BOOT_STAGE_HAL_INIT);
+    /* SystemClock_Config() runs in boot_clock_switch(), once the flashes are up */
+    boot_clock_start();
   /* USER CODE END Init */
 
-  /* Configure the system clock */
-  SystemClock_Config();
-
   /* USER CODE BEGIN SysInit */
 
   /* USER CODE END SysInit */
@@ -172,12 +296,32 @@ int main(void)
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
   MX_OCTOSPI1_Init();
-  MX_USART2_UART_Init();
-  MX_SPI2_Init();
   /* USER CODE BEGIN 2 */
+#if !defined(BOOT_AGENT) && !defined(BOOT_DIRECT_LL)
+    {
+        /* a warm reset after a good boot goes straight to the same slot */
+        const boot_direct *direct = boot_direct_enter();
+
+        if (direct) {
+            DirectBoot(direct);
+        }
+    }
+#endif
+    boot_direct_clear();
+    boot_handoff_info_init(BOOT_HANDOFF_PATH_FULL);
+    /* not called by the generated code, the direct boot doesn't need them */
+    MX_USART2_UART_Init();
+#if !defined(BOOT_AGENT) && !defined(BOOT_BENCH)
+    /* a host byte from now on asks for the update mode, the boot never waits for one */
+    boot_uart_arm();
+#endif
+    /* SPI2 and the EXT flash come up on their first use, boot_ext.h */
+    /* still on HSI, the MX_ inits timed the peripherals for the PLL */
+    boot_clock_retime();
     // note: qspi freq is set a little too low
     /* initialize EasyLogger */
     elog_init();
+    boot_profile_mark(BOOT_STAGE_ELOG_INIT);
     /* set EasyLogger log format */
     elog_set_fmt(ELOG_LVL_ASSERT, ELOG_FMT_ALL);
     elog_set_fmt(ELOG_LVL_ERROR, ELOG_FMT_LVL | ELOG_FMT_TAG | ELOG_FMT_TIME);
@@ -186,24 +330,164 @@ int main(void)
     elog_set_fmt(ELOG_LVL_DEBUG, ELOG_FMT_LVL | ELOG_FMT_TAG | ELOG_FMT_TIME);
     /* start EasyLogger */
     elog_start();
+    boot_profile_mark(BOOT_STAGE_ELOG_START);
+    if (boot_warm_entered()) {
+        elog_i(TAG, "warm entry from the application, SYSCLK %u MHz kept",
+               (unsigned) (HAL_RCC_GetSysClockFreq() / 1000000U));
+    }
 
     if (sfud_init() != SFUD_SUCCESS) {
         elog_e(TAG, "SFUD init failed!");
     }
+    boot_profile_mark(BOOT_STAGE_SFUD_INIT);
+    boot_fault_save();
+    boot_pcprof_report();
     sfud_qspi_fast_read_enable(sfud_get_device(SFUD_MAIN_FLASH), 4);
+    /* the board's part gets its compile-time driver, another one stays on SFUD */
+    boot_part_attach(sfud_get_device(SFUD_MAIN_FLASH));
+    boot_profile_mark(BOOT_STAGE_SFUD_FAST_READ);
+    boot_clock_switch();
+    boot_profile_mark(BOOT_STAGE_SYSTEM_CLOCK);
+    elog_i(TAG, "SYSCLK %u MHz", (unsigned) (HAL_RCC_GetSysClockFreq() / 1000000U));
+#ifndef BOOT_AGENT
+    /* the prescaler and sampling of the MAIN flash, before anything is read from it at the PLL clock */
+    boot_ospi_cal_apply(sfud_get_device(SFUD_MAIN_FLASH));
+    boot_profile_mark(BOOT_STAGE_OSPI_CAL);
+#endif
+    boot_handoff_info_flash(sfud_get_device(SFUD_MAIN_FLASH));
+#ifdef SFUD_USING_QSPI_QPI
+    /* the programs and erases of the updates in QPI mode, the handoff above has the quad read the application gets */
+    sfud_qspi_qpi_enable(sfud_get_device(SFUD_MAIN_FLASH));
+#endif
+#if defined(BOOT_BENCH) || defined(BOOT_AGENT)
+    boot_ext_flash();
+#endif
+#ifdef BOOT_BENCH
+    /* ESPHostedEVBBench.elf measures the flashes, the memories and the log and boots nothing */
+    boot_bench_run();
+    boot_bench_mem_run();
+    boot_bench_log_run();
+    while (1) {
+        HAL_Delay(1000);
+    }
+#endif
+#ifdef BOOT_AGENT
+    /* ESPHostedEVBAgent.elf programs the flashes for the debugger and boots nothing */
+    boot_agent_run();
+#endif
+    /* the compaction and its erase go on while the update windows run on the MAIN flash */
+    boot_kv_poll();
+    if (boot_uart_update(sfud_get_device(SFUD_MAIN_FLASH))) {
+        boot_handoff_info_update(BOOT_HANDOFF_UPDATE_UART);
+    }
+    boot_profile_mark(BOOT_STAGE_UART_UPDATE);
+    if (boot_usb_update(sfud_get_device(SFUD_MAIN_FLASH))) {
+        boot_handoff_info_update(BOOT_HANDOFF_UPDATE_USB);
+    }
+    boot_profile_mark(BOOT_STAGE_USB_UPDATE);
+    if (boot_esp_update(sfud_get_device(SFUD_MAIN_FLASH))) {
+        boot_handoff_info_update(BOOT_HANDOFF_UPDATE_ESP);
+    }
+    boot_profile_mark(BOOT_STAGE_ESP_UPDATE);
+#ifdef BOOT_LFS
+    {
+        static lfs_t lfs;
+        static struct lfs_config lfs_cfg;
+
+        /* a new bootloader of the file system first, it resets into it; the ESP32 bundle is flashed once */
+        if (boot_lfs_mount(&lfs, &lfs_cfg) == LFS_ERR_OK) {
+            boot_selfupdate_run(&lfs);
+            boot_espflash_update(&lfs);
+            lfs_unmount(&lfs);
+        }
+    }
+#endif
+    boot_kv_flush();
+#ifdef ELOG_PORT_FLASH_ENABLE
+    /* the flash log is the one user of the EXT flash left on a plain boot, its buffer is programmed from here on */
+    boot_ext_flash();
+    elog_flash_poll();
+#endif
 
 //    char buf[100];
 //    sfud_read(sfud_get_device(SFUD_MAIN_FLASH), 0, 100, buf);
 //    elog_i(TAG, "Read 100 bytes from flash:");
 //    elog_hexdump(TAG, 16, buf, 100);
 
-    EntryApp();
+    {
+        extern sfud_err qspi_entry_memory_mapped_mode(sfud_flash *flash);
+        boot_image_header header;
+        boot_slot_id slot;
+
+#ifdef SFUD_USING_QSPI_QPI
+        /* the application and the direct record get the flash in SPI mode, with the quad read of the handoff */
+        sfud_qspi_qpi_disable(sfud_get_device(SFUD_MAIN_FLASH));
+#endif
+        /* the image check reads through the window, the jump needs it as well */
+        qspi_entry_memory_mapped_mode(sfud_get_device(SFUD_MAIN_FLASH));
+        boot_profile_mark(BOOT_STAGE_MEMORY_MAPPED);
+        slot = boot_slot_select(sfud_get_device(SFUD_MAIN_FLASH), &header);
+        if (slot == BOOT_SLOT_NONE) {
+            extern sfud_err qspi_exit_memory_mapped_mode(sfud_flash *flash);
+            bool restored;
+
+            /* no slot boots, the copy kept by the last update goes back */
+            qspi_exit_memory_mapped_mode(sfud_get_device(SFUD_MAIN_FLASH));
+            restored = boot_rollback_restore() == SFUD_SUCCESS;
+            qspi_entry_memory_mapped_mode(sfud_get_device(SFUD_MAIN_FLASH));
+            if (restored) {
+                slot = boot_slot_select(sfud_get_device(SFUD_MAIN_FLASH), &header);
+            }
+        }
+
+        boot_profile_mark(BOOT_STAGE_SLOT_SELECT);
+        if (slot != BOOT_SLOT_NONE) {
+            uint32_t slot_addr = OCTOSPI1_BASE + boot_slot_addr(slot);
+
+            elog_i(TAG, "boot slot %c, version 0x%08x", 'A' + slot, header.image_version);
+            if ((header.flags & BOOT_IMAGE_FLAG_ENCRYPTED) && !boot_otfdec_enable(&header, slot_addr)) {
+                elog_e(TAG, "the image is encrypted, no matching OTFDEC key");
+            } else if (!boot_scatter_prepare(&header, slot_addr)) {
+                elog_e(TAG, "the section table of the image is bad");
+            } else {
+                boot_handoff_info_slot(slot, &header, BOOT_HANDOFF_IMAGE_HEADER
+                        | (boot_verify_sampled() ? BOOT_HANDOFF_IMAGE_SAMPLED
+                        : (boot_verify_deferred() ? 0 : BOOT_HANDOFF_IMAGE_CRC
+#ifdef BOOT_SLOT_VERIFY_HASH
+                        | BOOT_HANDOFF_IMAGE_HASH
+#endif
+                        )
+#ifdef BOOT_SIGN_KEY
+                        | BOOT_HANDOFF_IMAGE_SIGNED
+#endif
+                        )
+                        | ((header.flags & BOOT_IMAGE_FLAG_ENCRYPTED) ? BOOT_HANDOFF_IMAGE_DECRYPTED : 0)
+                        | ((header.flags & BOOT_IMAGE_FLAG_RAM) ? BOOT_HANDOFF_IMAGE_RAM : 0)
+                        | (boot_trial_pending() ? BOOT_HANDOFF_IMAGE_TRIAL : 0));
+                boot_handoff_info_deferred((uint8_t) boot_verify_deferred());
+                /* a boot on trial leaves no direct record, the warm resets count too, nor one not checked in full */
+                if (AppStackValid(*(const uint32_t *) boot_image_vector(&header, slot_addr)) && !boot_trial_pending()
+                        && !boot_verify_deferred()) {
+                    boot_direct_save(sfud_get_device(SFUD_MAIN_FLASH), slot, &header);
+                }
+                EntryApp(boot_image_vtor(&header), boot_image_vector(&header, slot_addr),
+                         boot_image_delta(&header, slot_addr));
+            }
+        } else {
+            /* images of the pre-slot layout have their vector table at the flash start */
+            elog_w(TAG, "no valid slot, try the legacy layout");
+            EntryApp(OCTOSPI1_BASE, OCTOSPI1_BASE, 0);
+        }
+    }
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
     while (1) {
         elog_i(TAG, "Hello World!");
+#ifdef ELOG_PORT_FLASH_ENABLE
+        elog_flash_poll();
+#endif
         HAL_Delay(1000);
     /* USER CODE END WHILE */
 
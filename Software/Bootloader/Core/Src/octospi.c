@@ -21,7 +21,11 @@
 #include "octospi.h"
 
 /* USER CODE BEGIN 0 */
+#include "boot_profile.h"
+#include <sfud_cfg.h>
 
+/* MDMA of the indirect reads, the request is the FIFO threshold flag */
+MDMA_HandleTypeDef hmdma_octospi1_fifo_th;
 /* USER CODE END 0 */
 
 OSPI_HandleTypeDef hospi1;
@@ -31,7 +35,8 @@ void MX_OCTOSPI1_Init(void)
 {
 
   /* USER CODE BEGIN OCTOSPI1_Init 0 */
-
+  /* MX_GPIO_Init() has no user code section, it is the stage right before this one */
+  boot_profile_mark(BOOT_STAGE_GPIO_INIT);
   /* USER CODE END OCTOSPI1_Init 0 */
 
   OSPIM_CfgTypeDef sOspiManagerCfg = {0};
@@ -67,7 +72,21 @@ void MX_OCTOSPI1_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN OCTOSPI1_Init 2 */
-
+#ifdef SFUD_USING_QSPI_DUALQUAD
+  /* the second part on IO4 ~ IO7, HAL_OSPI_Init() has set up the single one above: DQM and twice the size */
+  __HAL_OSPI_DISABLE(&hospi1);
+  SET_BIT(hospi1.Instance->CR, OCTOSPI_CR_DQM);
+  MODIFY_REG(hospi1.Instance->DCR1, OCTOSPI_DCR1_DEVSIZE, (hospi1.Init.DeviceSize + 1) << OCTOSPI_DCR1_DEVSIZE_Pos);
+  hospi1.Init.DualQuad = HAL_OSPI_DUALQUAD_ENABLE;
+  hospi1.Init.DeviceSize++;
+  __HAL_OSPI_ENABLE(&hospi1);
+  sOspiManagerCfg.IOHighPort = HAL_OSPIM_IOPORT_1_HIGH;
+  if (HAL_OSPIM_Config(&hospi1, &sOspiManagerCfg, HAL_OSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK)
+  {
+    Error_Handler();
+  }
+#endif
+  boot_profile_mark(BOOT_STAGE_OCTOSPI1_INIT);
   /* USER CODE END OCTOSPI1_Init 2 */
 
 }
@@ -143,7 +162,44 @@ void HAL_OSPI_MspInit(OSPI_HandleTypeDef* ospiHandle)
     HAL_GPIO_Init(GPIOE, &GPIO_InitStruct);
 
   /* USER CODE BEGIN OCTOSPI1_MspInit 1 */
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    /* PE7 ~ PE10 ------> OCTOSPIM_P1_IO4 ~ IO7, the second part */
+    GPIO_InitStruct.Pin = GPIO_PIN_7|GPIO_PIN_8|GPIO_PIN_9|GPIO_PIN_10;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF10_OCTOSPIM_P1;
+    HAL_GPIO_Init(GPIOE, &GPIO_InitStruct);
+#endif
+
+    __HAL_RCC_MDMA_CLK_ENABLE();
+
+    /* words from the FIFO, one buffer transfer per FIFO threshold (8 bytes) */
+    hmdma_octospi1_fifo_th.Instance = MDMA_Channel0;
+    hmdma_octospi1_fifo_th.Init.Request = MDMA_REQUEST_OCTOSPI1_FIFO_TH;
+    hmdma_octospi1_fifo_th.Init.TransferTriggerMode = MDMA_BUFFER_TRANSFER;
+    hmdma_octospi1_fifo_th.Init.Priority = MDMA_PRIORITY_HIGH;
+    hmdma_octospi1_fifo_th.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    hmdma_octospi1_fifo_th.Init.SourceInc = MDMA_SRC_INC_DISABLE;
+    hmdma_octospi1_fifo_th.Init.DestinationInc = MDMA_DEST_INC_WORD;
+    hmdma_octospi1_fifo_th.Init.SourceDataSize = MDMA_SRC_DATASIZE_WORD;
+    hmdma_octospi1_fifo_th.Init.DestDataSize = MDMA_DEST_DATASIZE_WORD;
+    hmdma_octospi1_fifo_th.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    hmdma_octospi1_fifo_th.Init.BufferTransferLength = 8;
+    hmdma_octospi1_fifo_th.Init.SourceBurst = MDMA_SOURCE_BURST_SINGLE;
+    hmdma_octospi1_fifo_th.Init.DestBurst = MDMA_DEST_BURST_SINGLE;
+    hmdma_octospi1_fifo_th.Init.SourceBlockAddressOffset = 0;
+    hmdma_octospi1_fifo_th.Init.DestBlockAddressOffset = 0;
+    if (HAL_MDMA_Init(&hmdma_octospi1_fifo_th) != HAL_OK)
+    {
+      Error_Handler();
+    }
+    __HAL_LINKDMA(ospiHandle, hmdma, hmdma_octospi1_fifo_th);
 
+    HAL_NVIC_SetPriority(MDMA_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(MDMA_IRQn);
+    HAL_NVIC_SetPriority(OCTOSPI1_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(OCTOSPI1_IRQn);
   /* USER CODE END OCTOSPI1_MspInit 1 */
   }
 }
@@ -175,7 +231,12 @@ void HAL_OSPI_MspDeInit(OSPI_HandleTypeDef* ospiHandle)
     HAL_GPIO_DeInit(GPIOE, GPIO_PIN_11);
 
   /* USER CODE BEGIN OCTOSPI1_MspDeInit 1 */
-
+#ifdef SFUD_USING_QSPI_DUALQUAD
+    HAL_GPIO_DeInit(GPIOE, GPIO_PIN_7|GPIO_PIN_8|GPIO_PIN_9|GPIO_PIN_10);
+#endif
+    HAL_MDMA_DeInit(ospiHandle->hmdma);
+    HAL_NVIC_DisableIRQ(MDMA_IRQn);
+    HAL_NVIC_DisableIRQ(OCTOSPI1_IRQn);
   /* USER CODE END OCTOSPI1_MspDeInit 1 */
   }
 }
@@ -0,0 +1,133 @@
+/**
+ * @file spsc_ring.c
+ * @brief Single-producer single-consumer byte ring, see spsc_ring.h.
+ */
+#include "spsc_ring.h"
+#include "main.h"
+#include <string.h>
+
+/**
+ * @param buf ring buffer, kept by the ring
+ * @param size bytes of buf, a power of two
+ */
+void spsc_ring_init(spsc_ring *ring, void *buf, size_t size) {
+    ring->buf = (uint8_t *) buf;
+    ring->mask = (uint32_t) size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+size_t spsc_ring_used(const spsc_ring *ring) {
+    return ring->head - ring->tail;
+}
+
+size_t spsc_ring_free(const spsc_ring *ring) {
+    return ring->mask + 1 - (ring->head - ring->tail);
+}
+
+/**
+ * @return free bytes at *data, contiguous, up to the buffer end
+ */
+size_t spsc_ring_write_span(const spsc_ring *ring, uint8_t **data) {
+    uint32_t head = ring->head, pos = head & ring->mask;
+    size_t len = ring->mask + 1 - (head - ring->tail);
+
+    *data = &ring->buf[pos];
+    return len < ring->mask + 1 - pos ? len : ring->mask + 1 - pos;
+}
+
+/**
+ * put len bytes written in place, spsc_ring_write_span() at most
+ */
+void spsc_ring_commit(spsc_ring *ring, size_t len) {
+    /* the data before the count, for the consumer and a DMA */
+    __DMB();
+    ring->head += (uint32_t) len;
+}
+
+/**
+ * @param offset bytes after the tail, they stay
+ *
+ * @return bytes at *data, contiguous, up to the buffer end, 0: none past offset
+ */
+size_t spsc_ring_read_span(const spsc_ring *ring, size_t offset, uint8_t **data) {
+    uint32_t tail = ring->tail + (uint32_t) offset, pos = tail & ring->mask;
+    size_t used = ring->head - ring->tail;
+
+    /* the count before the data */
+    __DMB();
+    *data = &ring->buf[pos];
+    if (used <= offset) {
+        return 0;
+    }
+    used -= offset;
+    return used < ring->mask + 1 - pos ? used : ring->mask + 1 - pos;
+}
+
+/**
+ * take len bytes read in place, spsc_ring_used() at most
+ */
+void spsc_ring_consume(spsc_ring *ring, size_t len) {
+    /* the data is read before the producer may overwrite it */
+    __DMB();
+    ring->tail += (uint32_t) len;
+}
+
+/**
+ * @return bytes copied in, what doesn't fit is left
+ */
+size_t spsc_ring_write(spsc_ring *ring, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *) data;
+    size_t done = 0, n;
+    uint8_t *span;
+
+    /* two spans at most, the second one from the buffer start */
+    while (done < len && (n = spsc_ring_write_span(ring, &span)) != 0) {
+        if (n > len - done) {
+            n = len - done;
+        }
+        memcpy(span, p + done, n);
+        spsc_ring_commit(ring, n);
+        done += n;
+    }
+    return done;
+}
+
+/**
+ * @return bytes copied out, the ring stays as it is
+ */
+size_t spsc_ring_peek(const spsc_ring *ring, size_t offset, void *data, size_t len) {
+    uint8_t *p = (uint8_t *) data, *span;
+    size_t done = 0, n;
+
+    while (done < len && (n = spsc_ring_read_span(ring, offset + done, &span)) != 0) {
+        if (n > len - done) {
+            n = len - done;
+        }
+        memcpy(p + done, span, n);
+        done += n;
+    }
+    return done;
+}
+
+/**
+ * @return bytes copied out and taken
+ */
+size_t spsc_ring_read(spsc_ring *ring, void *data, size_t len) {
+    size_t done = spsc_ring_peek(ring, 0, data, len);
+
+    spsc_ring_consume(ring, done);
+    return done;
+}
+
+/**
+ * move head to where a circular DMA over the whole buffer writes next
+ *
+ * @param pos buffer offset of the next byte of the DMA, size - NDTR
+ */
+void spsc_ring_dma_head(spsc_ring *ring, size_t pos) {
+    uint32_t tail = ring->tail;
+
+    /* from the tail, a lap of the DMA leaves less than a full ring rather than more */
+    ring->head = tail + (((uint32_t) pos - tail) & ring->mask);
+}
@@ -22,6 +22,15 @@
 #include "stm32h7xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "octospi.h"
+#include "spi.h"
+#include "elog.h"
+#include "esp_spi.h"
+#include "boot_time.h"
+#include "boot_fault.h"
+#include "boot_uart.h"
+#include "boot_mem.h"
+#include "boot_ospi_chain.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -69,7 +78,7 @@
 void NMI_Handler(void)
 {
   /* USER CODE BEGIN NonMaskableInt_IRQn 0 */
-
+  BOOT_FAULT_CAPTURE();
   /* USER CODE END NonMaskableInt_IRQn 0 */
   /* USER CODE BEGIN NonMaskableInt_IRQn 1 */
    while (1)
@@ -84,7 +93,7 @@ void NMI_Handler(void)
 void HardFault_Handler(void)
 {
   /* USER CODE BEGIN HardFault_IRQn 0 */
-
+  BOOT_FAULT_CAPTURE();
   /* USER CODE END HardFault_IRQn 0 */
   while (1)
   {
@@ -99,7 +108,7 @@ void HardFault_Handler(void)
 void MemManage_Handler(void)
 {
   /* USER CODE BEGIN MemoryManagement_IRQn 0 */
-
+  BOOT_FAULT_CAPTURE();
   /* USER CODE END MemoryManagement_IRQn 0 */
   while (1)
   {
@@ -114,7 +123,7 @@ void MemManage_Handler(void)
 void BusFault_Handler(void)
 {
   /* USER CODE BEGIN BusFault_IRQn 0 */
-
+  BOOT_FAULT_CAPTURE();
   /* USER CODE END BusFault_IRQn 0 */
   while (1)
   {
@@ -129,7 +138,7 @@ void BusFault_Handler(void)
 void UsageFault_Handler(void)
 {
   /* USER CODE BEGIN UsageFault_IRQn 0 */
-
+  BOOT_FAULT_CAPTURE();
   /* USER CODE END UsageFault_IRQn 0 */
   while (1)
   {
@@ -187,7 +196,7 @@ void SysTick_Handler(void)
   /* USER CODE END SysTick_IRQn 0 */
   HAL_IncTick();
   /* USER CODE BEGIN SysTick_IRQn 1 */
-
+  boot_time_tick();
   /* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -200,4 +209,102 @@ void SysTick_Handler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles OCTOSPI1 global interrupt.
+  */
+void OCTOSPI1_IRQHandler(void)
+{
+  HAL_OSPI_IRQHandler(&hospi1);
+}
+
+/**
+  * @brief This function handles MDMA global interrupt.
+  */
+void MDMA_IRQHandler(void)
+{
+  HAL_MDMA_IRQHandler(&hmdma_octospi1_fifo_th);
+  boot_mem_irq_handler();
+  boot_ospi_chain_irq_handler();
+}
+
+/**
+  * @brief This function handles DMA1 stream0 global interrupt.
+  */
+void DMA1_Stream0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi2_rx);
+}
+
+/**
+  * @brief This function handles DMA1 stream1 global interrupt.
+  */
+void DMA1_Stream1_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi2_tx);
+}
+
+/**
+  * @brief This function handles SPI2 global interrupt.
+  */
+void SPI2_IRQHandler(void)
+{
+  HAL_SPI_IRQHandler(&hspi2);
+}
+
+/**
+  * @brief This function handles DMA1 stream5 global interrupt, the elog output.
+  */
+void DMA1_Stream5_IRQHandler(void)
+{
+  elog_port_irq_handler();
+}
+
+/**
+  * @brief This function handles DMA1 stream3 global interrupt, the ESP-Hosted RX.
+  */
+void DMA1_Stream3_IRQHandler(void)
+{
+  esp_spi_dma_rx_irq_handler();
+}
+
+/**
+  * @brief This function handles DMA1 stream4 global interrupt, the ESP-Hosted TX.
+  */
+void DMA1_Stream4_IRQHandler(void)
+{
+  esp_spi_dma_tx_irq_handler();
+}
+
+/**
+  * @brief This function handles SPI3 global interrupt.
+  */
+void SPI3_IRQHandler(void)
+{
+  esp_spi_irq_handler();
+}
+
+/**
+  * @brief This function handles EXTI line2 interrupt, the ESP32 HANDSHAKE.
+  */
+void EXTI2_IRQHandler(void)
+{
+  esp_spi_exti_irq_handler();
+}
+
+/**
+  * @brief This function handles EXTI line3 interrupt, the ESP32 DATA_READY.
+  */
+void EXTI3_IRQHandler(void)
+{
+  esp_spi_exti_irq_handler();
+}
+
+/**
+  * @brief This function handles USART2 global interrupt, the update mode character match.
+  */
+void USART2_IRQHandler(void)
+{
+  boot_uart_irq_handler();
+}
+
 /* USER CODE END 1 */
@@ -50,6 +50,7 @@
   */
 
 #include "stm32h7xx.h"
+#include "boot_warm.h"
 #include <math.h>
 
 #if !defined  (HSE_VALUE)
@@ -188,73 +189,76 @@ void SystemInit (void)
     SCB->CPACR |= ((3UL << (10*2))|(3UL << (11*2)));  /* set CP10 and CP11 Full Access */
   #endif
   /* Reset the RCC clock configuration to the default reset state ------------*/
-
-   /* Increasing the CPU frequency */
-  if(FLASH_LATENCY_DEFAULT  > (READ_BIT((FLASH->ACR), FLASH_ACR_LATENCY)))
+  /* the warm entry of boot_warm.h keeps the clock tree of the application */
+  if (!boot_warm_pending())
   {
-    /* Program the new number of wait states to the LATENCY bits in the FLASH_ACR register */
-    MODIFY_REG(FLASH->ACR, FLASH_ACR_LATENCY, (uint32_t)(FLASH_LATENCY_DEFAULT));
-  }
+     /* Increasing the CPU frequency */
+    if(FLASH_LATENCY_DEFAULT  > (READ_BIT((FLASH->ACR), FLASH_ACR_LATENCY)))
+    {
+      /* Program the new number of wait states to the LATENCY bits in the FLASH_ACR register */
+      MODIFY_REG(FLASH->ACR, FLASH_ACR_LATENCY, (uint32_t)(FLASH_LATENCY_DEFAULT));
+    }
 
-  /* Set HSION bit */
-  RCC->CR |= RCC_CR_HSION;
+    /* Set HSION bit */
+    RCC->CR |= RCC_CR_HSION;
 
-  /* Reset CFGR register */
-  RCC->CFGR = 0x00000000;
+    /* Reset CFGR register */
+    RCC->CFGR = 0x00000000;
 
-  /* Reset HSEON, HSECSSON, CSION, HSI48ON, CSIKERON, PLL1ON, PLL2ON and PLL3ON bits */
-  RCC->CR &= 0xEAF6ED7FU;
+    /* Reset HSEON, HSECSSON, CSION, HSI48ON, CSIKERON, PLL1ON, PLL2ON and PLL3ON bits */
+    RCC->CR &= 0xEAF6ED7FU;
 
-   /* Decreasing the number of wait states because of lower CPU frequency */
-  if(FLASH_LATENCY_DEFAULT  < (READ_BIT((FLASH->ACR), FLASH_ACR_LATENCY)))
-  {
-    /* Program the new number of wait states to the LATENCY bits in the FLASH_ACR register */
-    MODIFY_REG(FLASH->ACR, FLASH_ACR_LATENCY, (uint32_t)(FLASH_LATENCY_DEFAULT));
-  }
+     /* Decreasing the number of wait states because of lower CPU frequency */
+    if(FLASH_LATENCY_DEFAULT  < (READ_BIT((FLASH->ACR), FLASH_ACR_LATENCY)))
+    {
+      /* Program the new number of wait states to the LATENCY bits in the FLASH_ACR register */
+      MODIFY_REG(FLASH->ACR, FLASH_ACR_LATENCY, (uint32_t)(FLASH_LATENCY_DEFAULT));
+    }
 
 #if defined(D3_SRAM_BASE)
-  /* Reset D1CFGR register */
-  RCC->D1CFGR = 0x00000000;
+    /* Reset D1CFGR register */
+    RCC->D1CFGR = 0x00000000;
 
-  /* Reset D2CFGR register */
-  RCC->D2CFGR = 0x00000000;
+    /* Reset D2CFGR register */
+    RCC->D2CFGR = 0x00000000;
 
-  /* Reset D3CFGR register */
-  RCC->D3CFGR = 0x00000000;
+    /* Reset D3CFGR register */
+    RCC->D3CFGR = 0x00000000;
 #else
-  /* Reset CDCFGR1 register */
-  RCC->CDCFGR1 = 0x00000000;
+    /* Reset CDCFGR1 register */
+    RCC->CDCFGR1 = 0x00000000;
 
-  /* Reset CDCFGR2 register */
-  RCC->CDCFGR2 = 0x00000000;
+    /* Reset CDCFGR2 register */
+    RCC->CDCFGR2 = 0x00000000;
 
-  /* Reset SRDCFGR register */
-  RCC->SRDCFGR = 0x00000000;
+    /* Reset SRDCFGR register */
+    RCC->SRDCFGR = 0x00000000;
 #endif
-  /* Reset PLLCKSELR register */
-  RCC->PLLCKSELR = 0x02020200;
+    /* Reset PLLCKSELR register */
+    RCC->PLLCKSELR = 0x02020200;
 
-  /* Reset PLLCFGR register */
-  RCC->PLLCFGR = 0x01FF0000;
-  /* Reset PLL1DIVR register */
-  RCC->PLL1DIVR = 0x01010280;
-  /* Reset PLL1FRACR register */
-  RCC->PLL1FRACR = 0x00000000;
+    /* Reset PLLCFGR register */
+    RCC->PLLCFGR = 0x01FF0000;
+    /* Reset PLL1DIVR register */
+    RCC->PLL1DIVR = 0x01010280;
+    /* Reset PLL1FRACR register */
+    RCC->PLL1FRACR = 0x00000000;
 
-  /* Reset PLL2DIVR register */
-  RCC->PLL2DIVR = 0x01010280;
+    /* Reset PLL2DIVR register */
+    RCC->PLL2DIVR = 0x01010280;
 
-  /* Reset PLL2FRACR register */
+    /* Reset PLL2FRACR register */
 
-  RCC->PLL2FRACR = 0x00000000;
-  /* Reset PLL3DIVR register */
-  RCC->PLL3DIVR = 0x01010280;
+    RCC->PLL2FRACR = 0x00000000;
+    /* Reset PLL3DIVR register */
+    RCC->PLL3DIVR = 0x01010280;
 
-  /* Reset PLL3FRACR register */
-  RCC->PLL3FRACR = 0x00000000;
+    /* Reset PLL3FRACR register */
+    RCC->PLL3FRACR = 0x00000000;
 
-  /* Reset HSEBYP bit */
-  RCC->CR &= 0xFFFBFFFFU;
+    /* Reset HSEBYP bit */
+    RCC->CR &= 0xFFFBFFFFU;
+  }
 
   /* Disable all interrupts */
   RCC->CIER = 0x00000000;
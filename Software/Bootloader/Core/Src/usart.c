@@ -21,7 +21,7 @@
 #include "usart.h"
 
 /* USER CODE BEGIN 0 */
-
+#include "boot_profile.h"
 /* USER CODE END 0 */
 
 UART_HandleTypeDef huart2;
@@ -66,7 +66,7 @@ void MX_USART2_UART_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN USART2_Init 2 */
-
+  boot_profile_mark(BOOT_STAGE_USART2_INIT);
   /* USER CODE END USART2_Init 2 */
 
 }
@@ -45,6 +45,13 @@ defined in linker script */
 .word  _ebss
 /* stack used for SystemInit_ExtMemCtl; always internal RAM used */
 
+/* reset cause flags, RCC->RSR of the CPU */
+.equ  RCC_RSR,         0x580244D0
+.equ  RCC_RSR_BORRSTF, 0x00200000
+.equ  RCC_RSR_PORRSTF, 0x00800000
+/* stack paint, BOOT_PROFILE_STACK_PAINT of boot_profile.h */
+.equ  STACK_PAINT,     0x5354414B
+
 /**
  * @brief  This is the code that gets called when the processor first
  *          starts execution following a reset event. Only the absolutely
@@ -65,35 +72,63 @@ Reset_Handler:
 /* Call the clock system initialization function.*/
   bl  SystemInit
 
+/* After a power-on or brown-out reset the SRAMs hold random data with
+   random ECC bits, a first partial write or read of it is an ECC error.
+   Zero the RAM banks before anything is written to them, nothing is on
+   the stack yet. After any other reset the contents and their ECC
+   survive, the no-init records too. The flags are cleared by
+   boot_profile_init(). */
+  ldr r0, =RCC_RSR
+  ldr r0, [r0]
+  tst r0, #(RCC_RSR_PORRSTF | RCC_RSR_BORRSTF)
+  beq SkipEccInit
+  ldr r0, =_sram_d1
+  ldr r1, =_eram_d1
+  bl  ZeroWords
+  ldr r0, =_sdtcm
+  ldr r1, =_edtcm
+  bl  ZeroWords
+  ldr r0, =_sram_d2
+  ldr r1, =_eram_d2
+  bl  ZeroWords
+  ldr r0, =_sram_d3
+  ldr r1, =_eram_d3
+  bl  ZeroWords
+SkipEccInit:
+
 /* Copy the data segment initializers from flash to SRAM */
   ldr r0, =_sdata
   ldr r1, =_edata
   ldr r2, =_sidata
-  movs r3, #0
-  b LoopCopyDataInit
+  bl  CopyWords
 
-CopyDataInit:
-  ldr r4, [r2, r3]
-  str r4, [r0, r3]
-  adds r3, r3, #4
-
-LoopCopyDataInit:
-  adds r4, r0, r3
-  cmp r4, r1
-  bcc CopyDataInit
-/* Zero fill the bss segment. */
-  ldr r2, =_sbss
-  ldr r4, =_ebss
-  movs r3, #0
-  b LoopFillZerobss
+/* Copy the DTCM data (.dtcm_data) from flash */
+  ldr r0, =_sdtcm_data
+  ldr r1, =_edtcm_data
+  ldr r2, =_sidtcm_data
+  bl  CopyWords
 
-FillZerobss:
-  str  r3, [r2]
-  adds r2, r2, #4
+/* Copy the ITCM code (.itcm) from flash */
+  ldr r0, =_sitcm
+  ldr r1, =_eitcm
+  ldr r2, =_siitcm
+  bl  CopyWords
 
-LoopFillZerobss:
-  cmp r2, r4
-  bcc FillZerobss
+/* Zero fill the bss segment. */
+  ldr r0, =_sbss
+  ldr r1, =_ebss
+  bl  ZeroWords
+  ldr r0, =_sdtcm_bss
+  ldr r1, =_edtcm_bss
+  bl  ZeroWords
+
+/* Paint the stack area, from the end of the DTCM sections to _estack, the
+   deepest word that changed is the stack peak of boot_profile_stack_peak().
+   sp is still at _estack, nothing is on the stack. */
+  ldr r0, =_end
+  ldr r1, =_estack
+  ldr r3, =STACK_PAINT
+  bl  FillWords
 
 /* Call static constructors */
     bl __libc_init_array
@@ -102,6 +137,83 @@ LoopFillZerobss:
   bx  lr
 .size  Reset_Handler, .-Reset_Handler
 
+/**
+ * @brief  Copy words in 32 byte bursts, then the tail one word at a time.
+ * @param  r0: destination, r1: destination end, r2: source, all word aligned
+ * @retval None, r0-r10 and r12 are clobbered
+*/
+    .section  .text.CopyWords
+  .type  CopyWords, %function
+CopyWords:
+  sub r12, r1, r0
+  cmp r12, #32
+  blo CopyWordsTail
+  ldmia r2!, {r3-r10}
+  stmia r0!, {r3-r10}
+  b CopyWords
+
+CopyWordsTail:
+  cmp r0, r1
+  bhs CopyWordsDone
+  ldr r3, [r2], #4
+  str r3, [r0], #4
+  b CopyWordsTail
+
+CopyWordsDone:
+  bx  lr
+.size  CopyWords, .-CopyWords
+
+/**
+ * @brief  Zero words in 32 byte bursts, then the tail one word at a time.
+ * @param  r0: start, r1: end, both word aligned
+ * @retval None, r0, r3-r10 and r12 are clobbered
+*/
+    .section  .text.ZeroWords
+  .type  ZeroWords, %function
+ZeroWords:
+  movs r3, #0
+  movs r4, #0
+  movs r5, #0
+  movs r6, #0
+  movs r7, #0
+  mov r8, #0
+  mov r9, #0
+  mov r10, #0
+
+ZeroWordsBurst:
+  sub r12, r1, r0
+  cmp r12, #32
+  blo ZeroWordsTail
+  stmia r0!, {r3-r10}
+  b ZeroWordsBurst
+
+ZeroWordsTail:
+  cmp r0, r1
+  bhs ZeroWordsDone
+  str r3, [r0], #4
+  b ZeroWordsTail
+
+ZeroWordsDone:
+  bx  lr
+.size  ZeroWords, .-ZeroWords
+
+/**
+ * @brief  Fill words with a pattern, one word at a time.
+ * @param  r0: start, r1: end, both word aligned, r3: pattern
+ * @retval None, r0 is clobbered
+*/
+    .section  .text.FillWords
+  .type  FillWords, %function
+FillWords:
+  cmp r0, r1
+  bhs FillWordsDone
+  str r3, [r0], #4
+  b FillWords
+
+FillWordsDone:
+  bx  lr
+.size  FillWords, .-FillWords
+
 /**
  * @brief  This is the code that gets called when the processor receives an
  *         unexpected interrupt.  This simply enters an infinite loop, preserving
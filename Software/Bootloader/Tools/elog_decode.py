@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Decode the EasyLogger binary output (ELOG_BIN_OUTPUT_ENABLE) of the bootloader.
+
+The format strings are read from the .elog_fmt section of the ELF the board
+runs, the tag and %s strings from its loaded sections. Text in between the
+frames (elog_raw, hexdump, SFUD) is passed through.
+
+    python3 elog_decode.py build/ESPHostedEVBBootloader.elf /dev/ttyUSB0
+    python3 elog_decode.py build/ESPHostedEVBBootloader.elf capture.bin
+
+Needs pyelftools; the serial port is read as a plain file, set its baud rate
+with stty first.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+SYNC = 0xA5
+HEAD = struct.Struct("<BBHII")
+LEVELS = "AEWIDV"
+SPEC = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|t|j)?([diouxXcsp%])")
+
+
+class Elf:
+    def __init__(self, path):
+        self.file = open(path, "rb")
+        elf = ELFFile(self.file)
+        fmt = elf.get_section_by_name(".elog_fmt")
+        if fmt is None:
+            sys.exit("no .elog_fmt section, build with ELOG_BIN_OUTPUT_ENABLE")
+        self.fmt = fmt.data()
+        self.segments = [(s["p_vaddr"], s.data()) for s in elf.iter_segments() if s["p_type"] == "PT_LOAD"]
+
+    def string(self, addr):
+        for base, data in self.segments:
+            if base <= addr < base + len(data):
+                end = data.find(b"\0", addr - base)
+                return data[addr - base:end].decode(errors="replace")
+        return "<0x%08x>" % addr
+
+    def record(self, id):
+        end = self.fmt.find(b"\0", id)
+        where = self.fmt[id:end].decode()
+        return where, self.fmt[end + 1:self.fmt.find(b"\0", end + 1)].decode()
+
+    def format(self, fmt, args):
+        args = iter(args)
+
+        def arg(m):
+            flags, conv = m.group(1), m.group(3)
+            if conv == "%":
+                return "%"
+            value = next(args, 0)
+            if conv == "s":
+                return ("%" + flags + "s") % self.string(value)
+            if conv == "p":
+                return "0x%08x" % value
+            if conv in "di":
+                value -= (value & 0x80000000) << 1
+            return ("%" + flags + ("d" if conv == "u" else conv)) % value
+
+        return SPEC.sub(arg, fmt)
+
+
+def decode(elf, stream, out):
+    buf = b""
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            break
+        buf += chunk
+        sync = buf.find(bytes([SYNC]))
+        if sync < 0:
+            out.write(buf.decode(errors="replace"))
+            buf = b""
+            continue
+        if sync:
+            out.write(buf[:sync].decode(errors="replace"))
+            buf = buf[sync:]
+        if len(buf) < HEAD.size:
+            continue
+        _, level_argc, id, tick, tag = HEAD.unpack_from(buf)
+        level, argc = level_argc >> 4, level_argc & 0x0F
+        if level >= len(LEVELS) or argc > 8 or id >= len(elf.fmt):
+            # not a frame, drop the sync byte and go on
+            buf = buf[1:]
+            continue
+        size = HEAD.size + 4 * argc
+        if len(buf) < size:
+            continue
+        args = struct.unpack_from("<%dI" % argc, buf, HEAD.size)
+        buf = buf[size:]
+        where, fmt = elf.record(id)
+        out.write("%s/%-10s [%u] (%s) %s\n" % (LEVELS[level], elf.string(tag), tick, where, elf.format(fmt, args)))
+        out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="ELF of the running firmware")
+    parser.add_argument("input", nargs="?", default="-", help="serial port or capture file, - for stdin")
+    opts = parser.parse_args()
+
+    elf = Elf(opts.elf)
+    stream = sys.stdin.buffer if opts.input == "-" else open(opts.input, "rb", buffering=0)
+    try:
+        decode(elf, stream, sys.stdout)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,375 @@
+#!/usr/bin/env python3
+"""Pack an application ELF into a slot image of the bootloader, see Core/Inc/boot_image.h.
+
+The image is the loadable segments of the ELF at their load addresses, as
+objcopy -O binary puts them, behind the header area: the boot_image_header,
+the section table of --section and the signature. With --sector-hash the
+sector table follows the image. The output is the whole slot content, it
+goes to the slot at offset 0; the same inputs always give the same bytes.
+
+    python3 image_pack.py app.elf -o app.img --version 1.4.0 --sector-hash
+    python3 image_pack.py app.elf -o app.img --version 1.4.0 --sign-key signer.pem
+    python3 image_pack.py app.elf -o app.img --ram --slot B --lz4
+    python3 image_pack.py app.elf -o app.img --section .itcm_text --section .dtcm_bss --vector 0x20000000
+    python3 image_pack.py app.elf -o app.img --pic --vector 0x20000000
+    python3 image_pack.py app.elf -o app.img --encrypt-key 000102...0f --nonce 0011223344556677
+    python3 image_pack.py app.elf -o app.img --delta release-1.3.img --delta-output 1.3-1.4.bdlt
+
+Needs pyelftools; cryptography for --sign-key and --encrypt-key, lz4 for
+--lz4, heatshrink2 for --delta-heatshrink.
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+from elftools.elf.elffile import ELFFile
+
+HEADER_SIZE = 0x400
+SECTION_OFFSET = 0x100
+SECTION_MAX = 12
+SIGNATURE_OFFSET = 0x3C0
+SECTOR_SIZE = 0x10000
+LZ4_SIZE_MAX = 320 * 1024
+VECTOR_MAX = 0x400
+GOT_MAX = 0x800
+HEADER_VERSION = 2
+
+IMAGE_MAGIC = 0x474D4942
+DELTA_MAGIC = 0x544C4442
+
+FLAG_ENCRYPTED = 1 << 0
+FLAG_SECTIONS = 1 << 1
+FLAG_RAM = 1 << 2
+FLAG_VECTOR = 1 << 3
+FLAG_SECTOR_HASH = 1 << 4
+FLAG_LZ4 = 1 << 5
+FLAG_PIC = 1 << 6
+
+SECTION_COPY = 0
+SECTION_ZERO = 2
+SECTION_GOT = 3
+
+DELTA_NONE = 0
+DELTA_HEATSHRINK = 1
+
+# boot_image_header, boot_image_section and boot_delta_header, header_crc last
+HEADER = struct.Struct("<IHHIIIIII32s2IHHIIII32sI")
+SECTION = struct.Struct("<IIIIBBBB")
+DELTA = struct.Struct("<IBBBBIIII")
+
+# memory-mapped slots of the MAIN flash, OCTOSPI1 window + BOOT_SLOT_A_ADDR / BOOT_SLOT_B_ADDR
+OSPI_BASE = 0x90000000
+SLOTS = {"A": OSPI_BASE + 0x010000, "B": OSPI_BASE + 0x400000}
+SLOT_SIZE = 0x3F0000
+
+# bsdiff style matching of the delta, bytes of a match and of a step of its extension
+DELTA_BLOCK = 16
+
+
+def fail(msg):
+    sys.exit("image_pack: " + msg)
+
+
+def align4(n):
+    return (n + 3) & ~3
+
+
+class Elf:
+    def __init__(self, path):
+        self.elf = ELFFile(open(path, "rb"))
+        self.segments = [s for s in self.elf.iter_segments() if s["p_type"] == "PT_LOAD" and s["p_filesz"]]
+        if not self.segments:
+            fail("%s has no loadable segment" % path)
+
+    def image(self):
+        """the loadable bytes from the lowest load address on, the gaps zero like objcopy -O binary"""
+        base = min(s["p_paddr"] for s in self.segments)
+        end = max(s["p_paddr"] + s["p_filesz"] for s in self.segments)
+        image = bytearray(end - base)
+        for s in self.segments:
+            image[s["p_paddr"] - base:s["p_paddr"] - base + s["p_filesz"]] = s.data()
+        return base, bytes(image)
+
+    def section(self, name):
+        section = self.elf.get_section_by_name(name)
+        if section is None:
+            fail("no %s section in the ELF" % name)
+        return section
+
+    def load_addr(self, section):
+        """the LMA of a section, where its bytes are in the image"""
+        for s in self.segments:
+            if s.section_in_segment(section):
+                return s["p_paddr"] + section["sh_addr"] - s["p_vaddr"]
+        fail("%s isn't in a loadable segment" % section.name)
+
+
+def parse_int(text):
+    return int(text, 0)
+
+
+def parse_version(text):
+    parts = [int(p) for p in text.split(".")]
+    if len(parts) != 3 or parts[0] > 0xFF or parts[1] > 0xFF or parts[2] > 0xFFFF:
+        fail("--version takes major.minor.patch")
+    return (parts[0] << 24) | (parts[1] << 16) | parts[2]
+
+
+def parse_hex(text, size, what):
+    try:
+        data = bytes.fromhex(text)
+    except ValueError:
+        data = b""
+    if len(data) != size:
+        fail("%s takes %d hex digits" % (what, 2 * size))
+    return data
+
+
+def check_vector(opts, flags, size):
+    align = 128
+    while align < size:
+        align <<= 1
+    if size < 8 or size % 4 or size > VECTOR_MAX or opts.vector % align:
+        fail("the vector table copy at 0x%08x of %u bytes isn't aligned or too big" % (opts.vector, size))
+    return flags | FLAG_VECTOR
+
+
+def sections(opts, elf, base):
+    """the section table of --section, and the GOT of a PIC image"""
+    table = []
+    names = list(opts.section)
+    if opts.pic and ".got" not in names:
+        names.append(".got")
+    for name in names:
+        section = elf.section(name)
+        run_size = align4(section["sh_size"])
+        if section["sh_addr"] % 4 or run_size == 0:
+            fail("%s is empty or not 4 bytes aligned" % name)
+        if section["sh_type"] == "SHT_NOBITS":
+            table.append(SECTION.pack(0, 0, section["sh_addr"], run_size, SECTION_ZERO, 0, 0, 0))
+            continue
+        offset = elf.load_addr(section) - base
+        if offset % 4 or offset < 0:
+            fail("%s isn't stored 4 bytes aligned in the image" % name)
+        kind = SECTION_GOT if opts.pic and name == ".got" else SECTION_COPY
+        if kind == SECTION_GOT and run_size > GOT_MAX:
+            fail("the GOT has %u bytes, %u at most" % (run_size, GOT_MAX))
+        table.append(SECTION.pack(offset, run_size, section["sh_addr"], run_size, kind, 0, 0, 0))
+    if len(table) > SECTION_MAX:
+        fail("%u sections, %u at most" % (len(table), SECTION_MAX))
+    return table
+
+
+def lz4_compress(image):
+    import lz4.block
+
+    if len(image) > LZ4_SIZE_MAX:
+        fail("the RAM image has %u bytes, %u at most for --lz4" % (len(image), LZ4_SIZE_MAX))
+    return struct.pack("<I", len(image)) + lz4.block.compress(image, store_size=False)
+
+
+def otfdec_encrypt(image, addr, key, nonce, version):
+    """AES-128-CTR as OTFDEC1 deciphers it: the block of each 16 bytes is NONCER1, NONCER0, the region version and
+    the AHB address, the keystream is taken little-endian off the 128 bits bus"""
+    from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+
+    aes = Cipher(algorithms.AES(key), modes.ECB()).encryptor()
+    out = bytearray(image)
+    for i in range(0, len(out), 16):
+        block = struct.pack(">IIII", nonce[1], nonce[0], version, (addr + i) & ~0xF)
+        stream = aes.update(block)[::-1]
+        for j in range(min(16, len(out) - i)):
+            out[i + j] ^= stream[j]
+    return bytes(out)
+
+
+def sign(path, data, public_key):
+    from cryptography.hazmat.primitives import serialization
+    from cryptography.hazmat.primitives.asymmetric.ed25519 import Ed25519PrivateKey
+
+    with open(path, "rb") as f:
+        key = serialization.load_pem_private_key(f.read(), password=None)
+    if not isinstance(key, Ed25519PrivateKey):
+        fail("%s isn't an Ed25519 private key" % path)
+    raw = key.public_key().public_bytes(serialization.Encoding.Raw, serialization.PublicFormat.Raw)
+    if public_key and raw != public_key:
+        fail("%s doesn't match the public key %s" % (path, public_key.hex()))
+    return key.sign(data)
+
+
+def pack(opts):
+    elf = Elf(opts.elf)
+    base, image = elf.image()
+    flags = 0
+    vector = elf.elf.get_section_by_name(".isr_vector")
+    exec_addr = vector["sh_addr"] if vector is not None else base
+    ram_addr = 0
+
+    if opts.ram:
+        # linked to run at ram_addr, stored in the slot of --slot
+        if opts.slot is None or opts.pic or opts.encrypt_key:
+            fail("--ram takes --slot, and no --pic or --encrypt-key")
+        flags |= FLAG_RAM
+        ram_addr = base
+        load_addr = SLOTS[opts.slot] + HEADER_SIZE
+    elif opts.pic:
+        if opts.encrypt_key or opts.lz4 or opts.vector is None:
+            fail("--pic takes --vector, and no --encrypt-key or --lz4")
+        flags |= FLAG_PIC
+        load_addr = base
+    else:
+        load_addr = base
+        if load_addr - HEADER_SIZE not in SLOTS.values():
+            fail("the image is linked at 0x%08x, not behind the header area of a slot" % load_addr)
+        if opts.slot is not None and SLOTS[opts.slot] + HEADER_SIZE != load_addr:
+            fail("the image is linked for the other slot")
+    if opts.lz4 and (not opts.ram or opts.section):
+        fail("--lz4 takes --ram, and no --section")
+
+    table = sections(opts, elf, base)
+    if table:
+        flags |= FLAG_SECTIONS
+    vector_size = 0
+    if opts.vector is not None:
+        if vector is None:
+            fail("--vector needs the .isr_vector section")
+        vector_size = vector["sh_size"]
+        flags = check_vector(opts, flags, vector_size)
+    if exec_addr % 0x400 or exec_addr < base or exec_addr - base > len(image) - 8:
+        fail("the vector table at 0x%08x isn't 1KB aligned at the image start" % exec_addr)
+
+    if opts.lz4:
+        flags |= FLAG_LZ4
+        image = lz4_compress(image)
+    nonce = [0, 0]
+    if opts.encrypt_key:
+        if opts.nonce is None:
+            fail("--encrypt-key takes --nonce")
+        nonce = list(struct.unpack("<II", parse_hex(opts.nonce, 8, "--nonce")))
+        flags |= FLAG_ENCRYPTED
+        image = otfdec_encrypt(image, load_addr, parse_hex(opts.encrypt_key, 16, "--encrypt-key"), nonce,
+                               opts.otfdec_version)
+
+    sector_table = b""
+    sector_hash = b"\xff" * 32
+    if opts.sector_hash:
+        flags |= FLAG_SECTOR_HASH
+        sector_table = b"".join(hashlib.sha256(image[i:i + SECTOR_SIZE]).digest()
+                                for i in range(0, len(image), SECTOR_SIZE))
+        sector_hash = hashlib.sha256(sector_table).digest()
+    size = HEADER_SIZE + align4(len(image)) + len(sector_table)
+    if size > SLOT_SIZE:
+        fail("%u bytes don't fit the slot, %u at most" % (size, SLOT_SIZE))
+
+    section_data = b"".join(table)
+    fields = [IMAGE_MAGIC, HEADER_VERSION, HEADER_SIZE, parse_version(opts.version), len(image), load_addr, exec_addr,
+              flags, zlib.crc32(image), hashlib.sha256(image).digest(), nonce[0], nonce[1], opts.otfdec_version,
+              len(table), zlib.crc32(section_data) if table else 0, ram_addr, opts.vector or 0, vector_size,
+              sector_hash, 0]
+    header = bytearray(HEADER.pack(*fields))
+    struct.pack_into("<I", header, HEADER.size - 4, zlib.crc32(header[:HEADER.size - 4]))
+
+    area = bytearray(b"\xff" * HEADER_SIZE)
+    area[:HEADER.size] = header
+    area[SECTION_OFFSET:SECTION_OFFSET + len(section_data)] = section_data
+    if opts.sign_key:
+        public_key = parse_hex(opts.public_key, 32, "--public-key") if opts.public_key else None
+        area[SIGNATURE_OFFSET:] = sign(opts.sign_key, bytes(area[:SIGNATURE_OFFSET]), public_key)
+    return bytes(area) + image + b"\xff" * (align4(len(image)) - len(image)) + sector_table
+
+
+def delta_body(old, new):
+    """the (diff_len, extra_len, seek) runs of boot_install_delta(), bsdiff style: each run of new starting at a
+    block found in old goes on as a diff while half its bytes match old at least"""
+    index = {}
+    for i in range(0, len(old) - DELTA_BLOCK + 1, 4):
+        index.setdefault(old[i:i + DELTA_BLOCK], i)
+
+    def find(start):
+        for s in range(start, len(new) - DELTA_BLOCK + 1):
+            m = index.get(new[s:s + DELTA_BLOCK])
+            if m is not None:
+                return s, m
+        return len(new), 0
+
+    def extend(o, s):
+        n, limit = 0, min(len(old) - o, len(new) - s)
+        while n < limit:
+            step = min(DELTA_BLOCK, limit - n)
+            if 2 * sum(new[s + n + i] == old[o + n + i] for i in range(step)) < step:
+                break
+            n += step
+        return n
+
+    body = []
+    s, o = find(0)
+    if s:
+        body.append(struct.pack("<IIi", 0, s, o) + new[:s])
+    while s < len(new):
+        n = extend(o, s)
+        s2, o2 = find(s + n)
+        diff = bytes((new[s + i] - old[o + i]) & 0xFF for i in range(n))
+        seek = o2 - (o + n) if s2 < len(new) else 0
+        body.append(struct.pack("<IIi", n, s2 - s - n, seek) + diff + new[s + n:s2])
+        s, o = s2, o2
+    return b"".join(body)
+
+
+def delta(opts, new):
+    with open(opts.delta, "rb") as f:
+        old = f.read()
+    if len(old) < HEADER.size or struct.unpack_from("<I", old)[0] != IMAGE_MAGIC:
+        fail("%s isn't a packed image" % opts.delta)
+    old_crc = HEADER.unpack_from(old)[8]
+    body = delta_body(old, new)
+    compression, window_sz2, lookahead_sz2 = DELTA_NONE, 0, 0
+    if opts.delta_heatshrink:
+        import heatshrink2
+
+        compression = DELTA_HEATSHRINK
+        window_sz2, lookahead_sz2 = (int(p) for p in opts.delta_heatshrink.split(","))
+        body = heatshrink2.compress(body, window_sz2=window_sz2, lookahead_sz2=lookahead_sz2)
+    header = bytearray(DELTA.pack(DELTA_MAGIC, compression, window_sz2, lookahead_sz2, 0, old_crc, len(old),
+                                  len(new), 0))
+    struct.pack_into("<I", header, DELTA.size - 4, zlib.crc32(header[:DELTA.size - 4]))
+    return bytes(header) + body
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="application ELF")
+    parser.add_argument("-o", "--output", required=True, help="slot image, header area included")
+    parser.add_argument("--version", default="0.0.0", help="image version, major.minor.patch")
+    parser.add_argument("--slot", choices=sorted(SLOTS), help="slot the image is stored in, required with --ram")
+    parser.add_argument("--ram", action="store_true", help="the ELF is linked to run from RAM, BOOT_IMAGE_FLAG_RAM")
+    parser.add_argument("--lz4", action="store_true", help="store the RAM image LZ4 compressed")
+    parser.add_argument("--pic", action="store_true", help="position-independent image, its .got is a GOT section")
+    parser.add_argument("--section", action="append", default=[], help="ELF section the bootloader loads, repeated")
+    parser.add_argument("--vector", type=parse_int, help="RAM address of the vector table copy")
+    parser.add_argument("--sector-hash", action="store_true", help="append the sector table")
+    parser.add_argument("--encrypt-key", help="OTFDEC AES-128 key, 32 hex digits, KEYR3 first")
+    parser.add_argument("--nonce", help="OTFDEC nonce, 16 hex digits, NONCER0 little-endian first")
+    parser.add_argument("--otfdec-version", type=parse_int, default=0, help="OTFDEC region version")
+    parser.add_argument("--sign-key", help="Ed25519 private key, PEM")
+    parser.add_argument("--public-key", help="BOOT_SIGN_KEY of the bootloader, the sign key must match it")
+    parser.add_argument("--delta", help="packed image of the previous release")
+    parser.add_argument("--delta-output", help="delta patch from --delta to this image")
+    parser.add_argument("--delta-heatshrink", help="compress the patch body, window_sz2,lookahead_sz2")
+    opts = parser.parse_args()
+    if bool(opts.delta) != bool(opts.delta_output):
+        fail("--delta and --delta-output go together")
+
+    image = pack(opts)
+    with open(opts.output, "wb") as f:
+        f.write(image)
+    if opts.delta:
+        patch = delta(opts, image)
+        with open(opts.delta_output, "wb") as f:
+            f.write(patch)
+
+
+if __name__ == "__main__":
+    main()
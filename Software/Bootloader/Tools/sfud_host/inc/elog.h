@@ -0,0 +1,39 @@
+/**
+ * @file elog.h
+ * @brief EasyLogger stand-in of the host SFUD build, the SFUD lines go to stdout.
+ *
+ * Only what sfud_def.h takes from EasyLogger: the levels, the SFUD tag level,
+ * elog_info()/elog_debug() and ELOG_TAG(), a plain string here.
+ * ELOG_TAG_LVL_SFUD is the one of elog_cfg.h unless the build sets another.
+ */
+#ifndef __ELOG_H__
+#define __ELOG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ELOG_LVL_ASSERT                      0
+#define ELOG_LVL_ERROR                       1
+#define ELOG_LVL_WARN                        2
+#define ELOG_LVL_INFO                        3
+#define ELOG_LVL_DEBUG                       4
+#define ELOG_LVL_VERBOSE                     5
+
+#ifndef ELOG_TAG_LVL_SFUD
+#define ELOG_TAG_LVL_SFUD                    ELOG_LVL_INFO
+#endif
+
+/* the tag stays its name, the host has no tag table to intern it in */
+#define ELOG_TAG(s)                          (s)
+
+void elog_host_output(const char *level, const char *tag, const char *format, ...);
+
+#define elog_info(tag, ...)                  elog_host_output("I", tag, __VA_ARGS__)
+#define elog_debug(tag, ...)                 elog_host_output("D", tag, __VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ELOG_H__ */
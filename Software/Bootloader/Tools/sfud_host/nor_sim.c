@@ -0,0 +1,511 @@
+/**
+ * @file nor_sim.c
+ * @brief In-memory model of a SPI NOR flash with simulated timing, see nor_sim.h.
+ */
+#include "nor_sim.h"
+#include <sfud.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SR1_BUSY                        (1U << 0)
+#define SR1_WEL                         (1U << 1)
+/* bits of the status register 1 a status write doesn't touch */
+#define SR1_READ_ONLY                   (SR1_BUSY | SR1_WEL)
+#define SR2_SUS                         (1U << 7)
+
+#define CMD_QUAD_PAGE_PROGRAM           0x32
+#define CMD_SUSPEND                     0x75
+#define CMD_RESUME                      0x7A
+#define CMD_CHIP_ERASE_ALT              0x60
+
+/* mode and dummy clocks the model expects, the SFDP table tells the same */
+#define FAST_READ_DUMMY                 8
+#define DUAL_IO_MODE                    4
+#define QUAD_IO_MODE                    2
+#define QUAD_IO_DUMMY                   4
+
+static uint64_t sim_now;
+
+/**
+ * @return simulated time in ns, it starts at 0 and only goes on by the bus and nor_sim_delay()
+ */
+uint64_t nor_sim_now(void) {
+    return sim_now;
+}
+
+/**
+ * let the simulated time go on, the retry delay of the port and the waits of the callers
+ */
+void nor_sim_delay(uint64_t ns) {
+    sim_now += ns;
+}
+
+static void violation(nor_sim *nor, const nor_sim_cmd *cmd, const char *rule) {
+    nor->stats.violations++;
+    fprintf(stderr, "nor_sim %s: %02Xh at 0x%06X, %s\n", nor->config->name, cmd->instruction, (unsigned) cmd->addr,
+            rule);
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+}
+
+static uint8_t log2_size(uint32_t size) {
+    uint8_t n = 0;
+
+    while (size > 1) {
+        size >>= 1;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * JESD216B: the SFDP header, the basic parameter header and the 16 DWORDs basic table at 30h
+ */
+static void sfdp_build(nor_sim *nor) {
+    const nor_sim_config *config = nor->config;
+    uint8_t *header = nor->sfdp, *table = nor->sfdp + 0x30;
+    uint32_t dw1 = 0xFF000000UL;
+    size_t i;
+
+    memset(nor->sfdp, 0xFF, sizeof(nor->sfdp));
+    memcpy(header, "SFDP", 4);
+    header[4] = 6;                                 /* minor revision */
+    header[5] = 1;                                 /* major revision */
+    header[6] = 0;                                 /* one parameter header */
+    header[8] = 0x00;                              /* basic table ID LSB */
+    header[9] = 6;
+    header[10] = 1;
+    header[11] = 16;                               /* DWORDs */
+    header[12] = 0x30;
+    header[13] = 0x00;
+    header[14] = 0x00;
+    header[15] = 0xFF;                             /* basic table ID MSB */
+
+    memset(table, 0, 16 * 4);
+    /* 4KB erase throughout, 64 bytes or larger write granularity, 3-Byte addresses */
+    for (i = 0; i < NOR_SIM_ERASE_TYPE_NUM; i++) {
+        if (config->eraser[i].size == 4096) {
+            dw1 |= 0x01 | (uint32_t) config->eraser[i].cmd << 8;
+        }
+    }
+    if (!(dw1 & 0x03)) {
+        dw1 |= 0x03;
+    }
+    dw1 |= 1U << 2;
+    if (config->dual) {
+        dw1 |= (1UL << 16) | (1UL << 20);
+    }
+    if (config->quad) {
+        dw1 |= (1UL << 21) | (1UL << 22);
+    }
+    put32(table + 0, dw1);
+    put32(table + 4, config->capacity * 8 - 1);
+    /* 1-4-4 and 1-1-4: wait states in bits 4:0, mode clocks in bits 7:5, then the instruction */
+    table[8] = config->quad ? (QUAD_IO_MODE << 5 | QUAD_IO_DUMMY) : 0;
+    table[9] = config->quad ? SFUD_CMD_QUAD_IO_READ_DATA : 0;
+    table[10] = config->quad ? FAST_READ_DUMMY : 0;
+    table[11] = config->quad ? SFUD_CMD_QUAD_OUTPUT_READ_DATA : 0;
+    /* 1-1-2 and 1-2-2 */
+    table[12] = config->dual ? FAST_READ_DUMMY : 0;
+    table[13] = config->dual ? SFUD_CMD_DUAL_OUTPUT_READ_DATA : 0;
+    table[14] = config->dual ? (DUAL_IO_MODE << 5) : 0;
+    table[15] = config->dual ? SFUD_CMD_DUAL_IO_READ_DATA : 0;
+    /* no 2-2-2 and 4-4-4 reads */
+    put32(table + 16, 0xFFFFFFEEUL);
+    put32(table + 20, 0x0000FFFFUL);
+    put32(table + 24, 0x0000FFFFUL);
+    /* erase types, 8th and 9th DWORD */
+    for (i = 0; i < NOR_SIM_ERASE_TYPE_NUM; i++) {
+        if (config->eraser[i].size) {
+            table[28 + 2 * i] = log2_size(config->eraser[i].size);
+            table[28 + 2 * i + 1] = config->eraser[i].cmd;
+        }
+    }
+    /* suspend and resume, 12th and 13th DWORD, bit 31 of the 12th clear: supported */
+    put32(table + 44, config->suspend ? 0x7FFFFFFFUL : 0xFFFFFFFFUL);
+    if (config->suspend) {
+        table[48] = CMD_RESUME;
+        table[49] = CMD_SUSPEND;
+        table[50] = CMD_RESUME;
+        table[51] = CMD_SUSPEND;
+    }
+    /* quad enable requirement, bits 22:20 of the 15th DWORD */
+    table[58] = (uint8_t) ((config->quad_enable & 0x07) << 4);
+}
+
+/**
+ * set up the model, the array erased
+ *
+ * @param nor model
+ * @param config part, it must outlive the model
+ *
+ * @return false: no memory for the array
+ */
+bool nor_sim_init(nor_sim *nor, const nor_sim_config *config) {
+    memset(nor, 0, sizeof(nor_sim));
+    nor->config = config;
+    nor->array = malloc(config->capacity);
+    if (!nor->array) {
+        return false;
+    }
+    memset(nor->array, 0xFF, config->capacity);
+    sfdp_build(nor);
+
+    return true;
+}
+
+void nor_sim_deinit(nor_sim *nor) {
+    free(nor->array);
+    nor->array = NULL;
+}
+
+/**
+ * @return true: a program, erase or status write is still running
+ */
+bool nor_sim_busy(const nor_sim *nor) {
+    return sim_now < nor->busy_until;
+}
+
+static bool qe_set(const nor_sim *nor) {
+    switch (nor->config->quad_enable) {
+    case SFUD_SFDP_QE_NONE:
+        return true;
+    case SFUD_SFDP_QE_SR1_BIT6:
+        return (nor->sr1 & (1U << 6)) != 0;
+    case SFUD_SFDP_QE_SR2_BIT7:
+        return (nor->sr2 & (1U << 7)) != 0;
+    default:
+        return (nor->sr2 & (1U << 1)) != 0;
+    }
+}
+
+static uint64_t bus_ns(const nor_sim *nor, const nor_sim_cmd *cmd) {
+    uint8_t addr_lines = cmd->addr_lines ? cmd->addr_lines : 1, data_lines = cmd->data_lines ? cmd->data_lines : 1;
+    uint64_t cycles = 8 + cmd->addr_size * 8U / addr_lines + cmd->dummy_cycles + cmd->data_size * 8U / data_lines;
+
+    return cycles * 1000000000ULL / nor->config->timing.sck_hz;
+}
+
+static void busy_for(nor_sim *nor, uint64_t us) {
+    nor->busy_until = sim_now + us * 1000;
+}
+
+static bool write_enabled(nor_sim *nor, const nor_sim_cmd *cmd) {
+    if (!(nor->sr1 & SR1_WEL)) {
+        violation(nor, cmd, "no write enable");
+        return false;
+    }
+    nor->sr1 &= ~SR1_WEL;
+    return true;
+}
+
+static void status_read(nor_sim *nor, const nor_sim_cmd *cmd, uint8_t value) {
+    nor->stats.status_reads++;
+    /* the status register goes out as long as the clock runs */
+    if (cmd->read_buf) {
+        memset(cmd->read_buf, value, cmd->data_size);
+    }
+}
+
+static void status_write(nor_sim *nor, const nor_sim_cmd *cmd, uint8_t *sr) {
+    bool is_volatile = nor->vsr_write_enabled;
+
+    nor->vsr_write_enabled = false;
+    if (!cmd->write_buf || !cmd->data_size) {
+        violation(nor, cmd, "status write without data");
+        return;
+    }
+    if (!is_volatile && !write_enabled(nor, cmd)) {
+        return;
+    }
+    if (sr == &nor->sr1) {
+        nor->sr1 = (nor->sr1 & SR1_READ_ONLY) | (cmd->write_buf[0] & ~SR1_READ_ONLY);
+        /* 01h with a second byte writes the status register 2 as well */
+        if (cmd->data_size > 1) {
+            nor->sr2 = (nor->sr2 & SR2_SUS) | (cmd->write_buf[1] & ~SR2_SUS);
+        }
+    } else {
+        nor->sr2 = (nor->sr2 & SR2_SUS) | (cmd->write_buf[0] & ~SR2_SUS);
+    }
+    if (!is_volatile) {
+        busy_for(nor, nor->config->timing.status_write_us);
+    }
+}
+
+/**
+ * the reads of the array, the mode and dummy clocks must be the ones of the part
+ */
+static void array_read(nor_sim *nor, const nor_sim_cmd *cmd) {
+    const nor_sim_config *config = nor->config;
+    uint8_t dummy = 0, lines = 1;
+    bool supported = true;
+
+    switch (cmd->instruction) {
+    case SFUD_CMD_READ_DATA:
+        break;
+    case SFUD_CMD_FAST_READ_DATA:
+        dummy = FAST_READ_DUMMY;
+        break;
+    case SFUD_CMD_DUAL_OUTPUT_READ_DATA:
+        dummy = FAST_READ_DUMMY;
+        lines = 2;
+        supported = config->dual;
+        break;
+    case SFUD_CMD_DUAL_IO_READ_DATA:
+        dummy = DUAL_IO_MODE;
+        lines = 2;
+        supported = config->dual;
+        break;
+    case SFUD_CMD_QUAD_OUTPUT_READ_DATA:
+        dummy = FAST_READ_DUMMY;
+        lines = 4;
+        supported = config->quad;
+        break;
+    case SFUD_CMD_QUAD_IO_READ_DATA:
+        dummy = QUAD_IO_MODE + QUAD_IO_DUMMY;
+        lines = 4;
+        supported = config->quad;
+        break;
+    }
+    if (cmd->read_buf) {
+        memset(cmd->read_buf, 0xFF, cmd->data_size);
+    }
+    if (!supported) {
+        violation(nor, cmd, "read not supported");
+        return;
+    }
+    if (lines == 4 && !qe_set(nor)) {
+        violation(nor, cmd, "quad read with QE clear");
+        return;
+    }
+    if ((cmd->data_lines ? cmd->data_lines : 1) != lines || cmd->dummy_cycles != dummy) {
+        violation(nor, cmd, "lines or dummy clocks of another read");
+        return;
+    }
+    if (nor->suspended_left && nor->suspended_size && cmd->addr < nor->suspended_addr + nor->suspended_size
+            && cmd->addr + cmd->data_size > nor->suspended_addr) {
+        violation(nor, cmd, "read of the suspended erase block");
+    }
+    if (!cmd->read_buf) {
+        return;
+    }
+    nor->stats.reads++;
+    nor->stats.bytes_read += cmd->data_size;
+    /* a read goes on past the end from address 0 */
+    for (size_t i = 0; i < cmd->data_size; i++) {
+        cmd->read_buf[i] = nor->array[(cmd->addr + i) % config->capacity];
+    }
+}
+
+static void page_program(nor_sim *nor, const nor_sim_cmd *cmd) {
+    const nor_sim_config *config = nor->config;
+    uint32_t page = cmd->addr - cmd->addr % config->page_size, offset = cmd->addr % config->page_size;
+
+    if (cmd->instruction == CMD_QUAD_PAGE_PROGRAM && (!config->quad || !qe_set(nor))) {
+        violation(nor, cmd, "quad program without quad");
+        return;
+    }
+    if (!write_enabled(nor, cmd)) {
+        return;
+    }
+    if (cmd->addr >= config->capacity) {
+        violation(nor, cmd, "address out of the array");
+        return;
+    }
+    if (offset + cmd->data_size > config->page_size) {
+        violation(nor, cmd, "program over the page end, it wraps");
+    }
+    /* only the last page_size bytes stay when more come */
+    for (size_t i = 0; i < cmd->data_size; i++) {
+        nor->array[page + (offset + i) % config->page_size] &= cmd->write_buf[i];
+    }
+    nor->stats.programs++;
+    nor->stats.bytes_programmed += cmd->data_size;
+    busy_for(nor, (uint64_t) config->timing.page_program_us
+                  * (cmd->data_size < config->page_size ? cmd->data_size : config->page_size) / config->page_size);
+}
+
+/**
+ * @return false: not an erase instruction of the part
+ */
+static bool block_erase(nor_sim *nor, const nor_sim_cmd *cmd) {
+    const nor_sim_config *config = nor->config;
+    uint32_t size = 0, addr;
+    size_t type;
+
+    for (type = 0; type < NOR_SIM_ERASE_TYPE_NUM; type++) {
+        if (config->eraser[type].size && config->eraser[type].cmd == cmd->instruction) {
+            size = config->eraser[type].size;
+            break;
+        }
+    }
+    if (!size) {
+        return false;
+    }
+    if (!write_enabled(nor, cmd)) {
+        return true;
+    }
+    if (cmd->addr >= config->capacity) {
+        violation(nor, cmd, "address out of the array");
+        return true;
+    }
+    if (cmd->addr % size) {
+        violation(nor, cmd, "erase address not aligned, the whole block goes");
+    }
+    addr = cmd->addr - cmd->addr % size;
+    memset(nor->array + addr, 0xFF, size);
+    nor->stats.erases[type]++;
+    nor->suspended_addr = addr;
+    nor->suspended_size = size;
+    busy_for(nor, config->timing.erase_us[type]);
+    return true;
+}
+
+static void suspend(nor_sim *nor, const nor_sim_cmd *cmd) {
+    if (!nor->config->suspend) {
+        violation(nor, cmd, "suspend not supported");
+        return;
+    }
+    if (!nor_sim_busy(nor) || nor->suspended_left) {
+        /* nothing to suspend, ignored */
+        return;
+    }
+    nor->suspended_left = nor->busy_until - sim_now;
+    nor->sr2 |= SR2_SUS;
+    nor->stats.suspends++;
+    busy_for(nor, nor->config->timing.suspend_us);
+}
+
+static void resume(nor_sim *nor, const nor_sim_cmd *cmd) {
+    if (!nor->suspended_left) {
+        return;
+    }
+    nor->busy_until = sim_now + nor->suspended_left;
+    nor->suspended_left = 0;
+    nor->sr2 &= ~SR2_SUS;
+    (void) cmd;
+}
+
+/**
+ * run one command, the bus phases take their time first
+ *
+ * @param nor model
+ * @param cmd command, its read_buf gets the answer
+ */
+void nor_sim_command(nor_sim *nor, const nor_sim_cmd *cmd) {
+    bool reset_enabled = nor->reset_enabled;
+    uint8_t id[3];
+
+    nor->stats.commands++;
+    sim_now += bus_ns(nor, cmd);
+    nor->reset_enabled = false;
+
+    if (nor_sim_busy(nor) && cmd->instruction != SFUD_CMD_READ_STATUS_REGISTER
+            && cmd->instruction != SFUD_CMD_READ_STATUS_REGISTER_2 && cmd->instruction != CMD_SUSPEND
+            && cmd->instruction != SFUD_CMD_ENABLE_RESET && cmd->instruction != SFUD_CMD_RESET) {
+        violation(nor, cmd, "command while busy");
+        if (cmd->read_buf) {
+            memset(cmd->read_buf, 0xFF, cmd->data_size);
+        }
+        return;
+    }
+    /* no erase or program while one is suspended, the reads and the resume are fine */
+    if (nor->suspended_left && (cmd->instruction == SFUD_CMD_PAGE_PROGRAM
+            || cmd->instruction == CMD_QUAD_PAGE_PROGRAM || cmd->instruction == SFUD_CMD_ERASE_CHIP
+            || cmd->instruction == CMD_CHIP_ERASE_ALT)) {
+        violation(nor, cmd, "program or erase while suspended");
+        return;
+    }
+
+    switch (cmd->instruction) {
+    case SFUD_CMD_WRITE_ENABLE:
+        nor->sr1 |= SR1_WEL;
+        break;
+    case SFUD_CMD_WRITE_DISABLE:
+        nor->sr1 &= ~SR1_WEL;
+        break;
+    case SFUD_VOLATILE_SR_WRITE_ENABLE:
+        nor->vsr_write_enabled = true;
+        break;
+    case SFUD_CMD_READ_STATUS_REGISTER:
+        status_read(nor, cmd, nor->sr1 | (nor_sim_busy(nor) ? SR1_BUSY : 0));
+        break;
+    case SFUD_CMD_READ_STATUS_REGISTER_2:
+        status_read(nor, cmd, nor->sr2);
+        break;
+    case SFUD_CMD_WRITE_STATUS_REGISTER:
+        status_write(nor, cmd, &nor->sr1);
+        break;
+    case SFUD_CMD_WRITE_STATUS_REGISTER_2:
+        status_write(nor, cmd, &nor->sr2);
+        break;
+    case SFUD_CMD_JEDEC_ID:
+        memcpy(id, nor->config->jedec_id, sizeof(id));
+        for (size_t i = 0; cmd->read_buf && i < cmd->data_size; i++) {
+            cmd->read_buf[i] = i < sizeof(id) ? id[i] : 0xFF;
+        }
+        break;
+    case SFUD_CMD_READ_SFDP_REGISTER:
+        for (size_t i = 0; cmd->read_buf && i < cmd->data_size; i++) {
+            cmd->read_buf[i] = nor->config->sfdp && cmd->addr + i < sizeof(nor->sfdp) ? nor->sfdp[cmd->addr + i] : 0xFF;
+        }
+        break;
+    case SFUD_CMD_READ_DATA:
+    case SFUD_CMD_FAST_READ_DATA:
+    case SFUD_CMD_DUAL_OUTPUT_READ_DATA:
+    case SFUD_CMD_DUAL_IO_READ_DATA:
+    case SFUD_CMD_QUAD_OUTPUT_READ_DATA:
+    case SFUD_CMD_QUAD_IO_READ_DATA:
+        array_read(nor, cmd);
+        break;
+    case SFUD_CMD_PAGE_PROGRAM:
+    case CMD_QUAD_PAGE_PROGRAM:
+        page_program(nor, cmd);
+        break;
+    case SFUD_CMD_ERASE_CHIP:
+    case CMD_CHIP_ERASE_ALT:
+        if (write_enabled(nor, cmd)) {
+            memset(nor->array, 0xFF, nor->config->capacity);
+            nor->stats.chip_erases++;
+            nor->busy_until = sim_now + (uint64_t) nor->config->timing.chip_erase_ms * 1000000;
+        }
+        break;
+    case CMD_SUSPEND:
+        suspend(nor, cmd);
+        break;
+    case CMD_RESUME:
+        resume(nor, cmd);
+        break;
+    case SFUD_CMD_ENABLE_RESET:
+        nor->reset_enabled = true;
+        break;
+    case SFUD_CMD_RESET:
+        if (!reset_enabled) {
+            violation(nor, cmd, "reset without 66h");
+            break;
+        }
+        /* the running operation is abandoned, the volatile state is lost */
+        nor->busy_until = sim_now;
+        nor->suspended_left = 0;
+        nor->suspended_size = 0;
+        nor->sr1 &= ~SR1_WEL;
+        nor->sr2 &= ~SR2_SUS;
+        nor->vsr_write_enabled = false;
+        break;
+    case SFUD_CMD_ENTER_4B_ADDRESS_MODE:
+    case SFUD_CMD_EXIT_4B_ADDRESS_MODE:
+        /* the model has 3-Byte addresses only */
+        break;
+    default:
+        if (!block_erase(nor, cmd)) {
+            violation(nor, cmd, "unknown instruction");
+        }
+        break;
+    }
+}
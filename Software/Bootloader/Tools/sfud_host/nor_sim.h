@@ -0,0 +1,119 @@
+/**
+ * @file nor_sim.h
+ * @brief In-memory model of a SPI NOR flash with simulated timing, behind the host SFUD port.
+ *
+ * The model takes one command at a time, split in its phases as sfud_spi_xfer
+ * has them, and keeps the rules of a real part:
+ *  - program and erase need the write enable latch, which they clear
+ *  - a program only clears bits and wraps at the page end
+ *  - an erase clears the aligned block holding its address
+ *  - a busy part answers only the status reads, the suspend and the reset
+ *  - the 1-1-4 and 1-4-4 reads and the quad program need the QE bit
+ * A command which breaks one of them is counted in nor_sim_stats.violations
+ * and reported, the part then does what a real one would do, mostly nothing.
+ *
+ * Time is simulated: the bus phases take their cycles at timing.sck_hz,
+ * program, erase and status writes keep the part busy for their timing, and
+ * nor_sim_delay() is the only way waiting moves the clock on. A run which
+ * takes seconds on a board takes milliseconds on the host.
+ *
+ * The SFDP answer is built from the config: the JESD216B basic table with
+ * the erase types, the fast reads, the suspend instructions and the quad
+ * enable requirement.
+ */
+#ifndef _NOR_SIM_H_
+#define _NOR_SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NOR_SIM_ERASE_TYPE_NUM                   4
+/* SFDP header, one parameter header and the 16 DWORDs basic table */
+#define NOR_SIM_SFDP_SIZE                        0x70
+
+typedef struct {
+    uint32_t sck_hz;                             /**< bus clock */
+    uint32_t page_program_us;                    /**< tPP of a whole page, a part page takes its share */
+    uint32_t erase_us[NOR_SIM_ERASE_TYPE_NUM];   /**< tSE/tBE of each erase type */
+    uint32_t chip_erase_ms;                      /**< tCE */
+    uint32_t status_write_us;                    /**< tW */
+    uint32_t suspend_us;                         /**< tSUS, suspend to ready */
+} nor_sim_timing;
+
+typedef struct {
+    const char *name;                            /**< shown in the reports */
+    uint8_t jedec_id[3];                         /**< manufacturer, memory type, capacity */
+    uint32_t capacity;                           /**< bytes, up to 16MB, 3-Byte addresses */
+    uint16_t page_size;                          /**< page program wrap size */
+    struct {
+        uint32_t size;                           /**< bytes, a power of 2, 0: not available */
+        uint8_t cmd;                             /**< erase instruction */
+    } eraser[NOR_SIM_ERASE_TYPE_NUM];
+    bool sfdp;                                   /**< the part answers the SFDP read */
+    bool dual;                                   /**< 1-1-2 (3Bh) and 1-2-2 (BBh) reads */
+    bool quad;                                   /**< 1-1-4 (6Bh) and 1-4-4 (EBh) reads, quad program (32h) */
+    uint8_t quad_enable;                         /**< SFUD_SFDP_QE_xxx of the SFDP table, the QE bit it names */
+    bool suspend;                                /**< erase and program suspend (75h) and resume (7Ah) */
+    nor_sim_timing timing;
+} nor_sim_config;
+
+typedef struct {
+    uint32_t commands;                           /**< commands taken, the rejected ones included */
+    uint32_t status_reads;                       /**< 05h and 35h, the busy polls */
+    uint32_t reads;                              /**< array reads */
+    uint64_t bytes_read;
+    uint32_t programs;                           /**< page programs */
+    uint64_t bytes_programmed;
+    uint32_t erases[NOR_SIM_ERASE_TYPE_NUM];     /**< erases of each type */
+    uint32_t chip_erases;
+    uint32_t suspends;
+    uint32_t violations;                         /**< commands which broke a rule, see nor_sim.h */
+} nor_sim_stats;
+
+/**
+ * one command, the phases apart
+ */
+typedef struct {
+    uint8_t instruction;
+    uint8_t addr_size;                           /**< address bytes, 0: no address phase */
+    uint8_t addr_lines;                          /**< 0: 1 line */
+    uint8_t data_lines;                          /**< 0: 1 line */
+    uint8_t dummy_cycles;                        /**< mode and dummy clocks after the address */
+    uint32_t addr;
+    const uint8_t *write_buf;                    /**< data to the part, NULL: none */
+    uint8_t *read_buf;                           /**< data from the part, NULL: none */
+    size_t data_size;
+} nor_sim_cmd;
+
+typedef struct {
+    const nor_sim_config *config;
+    uint8_t *array;                              /**< capacity bytes */
+    uint8_t sr1;                                 /**< status register 1, BUSY is kept apart */
+    uint8_t sr2;                                 /**< status register 2 */
+    bool reset_enabled;                          /**< 66h came, 99h resets */
+    bool vsr_write_enabled;                      /**< 50h came, the next status write is volatile */
+    uint64_t busy_until;                         /**< ns of nor_sim_now() the running operation ends */
+    uint64_t suspended_left;                     /**< ns the suspended operation still takes, 0: none */
+    uint32_t suspended_addr;                     /**< block of the suspended erase */
+    uint32_t suspended_size;                     /**< its size, 0: a program is suspended */
+    uint8_t sfdp[NOR_SIM_SFDP_SIZE];
+    nor_sim_stats stats;
+} nor_sim;
+
+bool nor_sim_init(nor_sim *nor, const nor_sim_config *config);
+void nor_sim_deinit(nor_sim *nor);
+void nor_sim_command(nor_sim *nor, const nor_sim_cmd *cmd);
+bool nor_sim_busy(const nor_sim *nor);
+uint64_t nor_sim_now(void);
+void nor_sim_delay(uint64_t ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NOR_SIM_H_ */
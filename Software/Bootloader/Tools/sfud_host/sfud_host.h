@@ -0,0 +1,22 @@
+/**
+ * @file sfud_host.h
+ * @brief Host build of SFUD: the port over the nor_sim models, see sfud_host_port.c.
+ */
+#ifndef _SFUD_HOST_H_
+#define _SFUD_HOST_H_
+
+#include <stddef.h>
+#include "nor_sim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void sfud_host_attach(size_t index, nor_sim *nor);
+void sfud_host_probe_cache_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SFUD_HOST_H_ */
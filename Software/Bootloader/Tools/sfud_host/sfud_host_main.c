@@ -0,0 +1,427 @@
+/**
+ * @file sfud_host_main.c
+ * @brief sfud_host: SFUD of the bootloader run on the host against two simulated parts.
+ *
+ * The MAIN flash is a W25Q64JV-like quad part, the EXT flash an 8MB part
+ * out of SFUD_FLASH_EXT_INFO_TABLE with 4KB, 32KB and 64KB erases, so SFUD
+ * takes it from the SFDP table alone. On each one the run does a cold and a
+ * warm (probe cache) init, an unaligned erase plan, the erase, the program
+ * and the read back, the MAIN flash at each read width, a batch of scattered
+ * reads, on the MAIN flash the erase of the programmed range and its blank
+ * check, a background erase with reads suspending it, small sequential
+ * writes, which the write buffer merges on the EXT flash, and a stream of
+ * odd sized chunks at the pace of a 921600 baud UART, then an erase of a few
+ * bytes inside a unit with a line of it cached and a page of it pending. Each step prints its simulated time and
+ * the model statistics.
+ *
+ * The exit status is 1 when a step failed, the data read back was wrong or
+ * SFUD broke a rule of the model (see nor_sim.h), so the run can gate a
+ * change of the core or of the erase planner before it goes to the board.
+ */
+#include "sfud_host.h"
+#include <sfud.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* an erase which starts and ends off the 64KB blocks */
+#define PLAN_ADDR                       0x11000UL
+#define PLAN_SIZE                       0x2E000UL
+#define ASYNC_ADDR                      0x100000UL
+#define ASYNC_SIZE                      0x20000UL
+#define ASYNC_READ_ADDR                 0x200000UL
+#define ASYNC_READ_SIZE                 0x100
+/* records of the key-value store size, the last page stays partly pending */
+#define SMALL_ADDR                      0x300000UL
+#define SMALL_SIZE                      0x1F10UL
+#define SMALL_RECORD                    16
+/* a stream which ends inside a page, the chunks arrive at about 11us a byte */
+#define STREAM_ADDR                     0x380000UL
+#define STREAM_SIZE                     0x9123UL
+#define STREAM_BYTE_NS                  11000
+/* a 4KB erase unit, the erase asks for a few bytes inside it */
+#define UNIT_ADDR                       0x3A0000UL
+#define UNIT_SIZE                       0x1000UL
+#define UNIT_ERASE_OFFSET               0x100
+#define UNIT_RECORD                     16
+
+static const nor_sim_config main_config = {
+    .name = "MAIN",
+    .jedec_id = {0xEF, 0x40, 0x17},
+    .capacity = 8 * 1024 * 1024,
+    .page_size = 256,
+    .eraser = {{4096, 0x20}, {32768, 0x52}, {65536, 0xD8}},
+    .sfdp = true,
+    .dual = true,
+    .quad = true,
+    .quad_enable = SFUD_SFDP_QE_SR2_BIT1,
+    .suspend = true,
+    /* W25Q64JV typical figures */
+    .timing = {
+        .sck_hz = 100000000,
+        .page_program_us = 400,
+        .erase_us = {45000, 120000, 150000},
+        .chip_erase_ms = 20000,
+        .status_write_us = 10000,
+        .suspend_us = 20,
+    },
+};
+
+static const nor_sim_config ext_config = {
+    .name = "EXT",
+    .jedec_id = {0x9D, 0x60, 0x17},
+    .capacity = 8 * 1024 * 1024,
+    .page_size = 256,
+    .eraser = {{4096, 0x20}, {32768, 0x52}, {65536, 0xD8}},
+    .sfdp = true,
+    .dual = true,
+    .quad = false,
+    .quad_enable = SFUD_SFDP_QE_NONE,
+    .suspend = true,
+    .timing = {
+        .sck_hz = 50000000,
+        .page_program_us = 700,
+        .erase_us = {70000, 150000, 300000},
+        .chip_erase_ms = 30000,
+        .status_write_us = 5000,
+        .suspend_us = 100,
+    },
+};
+
+static nor_sim main_nor, ext_nor;
+static uint8_t data[PLAN_SIZE], readback[PLAN_SIZE];
+static int failures;
+
+static void check(const char *name, const char *step, sfud_err result) {
+    if (result != SFUD_SUCCESS) {
+        printf("%-5s %-24s failed, error %d\n", name, step, result);
+        failures++;
+    }
+}
+
+static void step_time(const char *name, const char *step, uint64_t start, size_t bytes) {
+    uint64_t ns = nor_sim_now() - start;
+
+    printf("%-5s %-24s %10zu %12.3f ms", name, step, bytes, ns / 1e6);
+    if (bytes && ns) {
+        printf(" %9.3f MB/s", bytes * 1e3 / ns);
+    }
+    printf("\n");
+}
+
+static void print_stats(const nor_sim *nor) {
+    const nor_sim_stats *stats = &nor->stats;
+
+    printf("%-5s commands %" PRIu32 ", status reads %" PRIu32 ", reads %" PRIu32 " (%" PRIu64 " bytes), programs %"
+           PRIu32 " (%" PRIu64 " bytes), erases", nor->config->name, stats->commands, stats->status_reads,
+           stats->reads, stats->bytes_read, stats->programs, stats->bytes_programmed);
+    for (size_t i = 0; i < NOR_SIM_ERASE_TYPE_NUM; i++) {
+        if (nor->config->eraser[i].size) {
+            printf(" %" PRIu32 "x%uKB", stats->erases[i], (unsigned) (nor->config->eraser[i].size / 1024));
+        }
+    }
+    printf(", suspends %" PRIu32 ", violations %" PRIu32 "\n", stats->suspends, stats->violations);
+}
+
+#ifdef SFUD_USING_STATS
+static void print_sfud_stats(const sfud_flash *flash) {
+    static const char *const names[SFUD_STATS_OP_NUM] = {"read", "write", "erase", "status"};
+    const sfud_stats *stats = sfud_get_stats(flash);
+
+    for (size_t i = 0; stats && i < SFUD_STATS_OP_NUM; i++) {
+        const sfud_stats_entry *entry = &stats->op[i];
+
+        printf("%-5s sfud %-6s %8" PRIu32 " calls %10" PRIu32 " bytes %10" PRIu32 " us (max %" PRIu32
+               "), busy %" PRIu32 " us, %" PRIu32 " retries, %" PRIu32 " bus errors\n", flash->name, names[i],
+               entry->count, entry->bytes, entry->total_us, entry->max_us, entry->busy_us, entry->retries,
+               entry->bus_errors);
+        failures += entry->bus_errors;
+    }
+}
+#endif
+
+static void init(const char *step) {
+    uint64_t start = nor_sim_now();
+
+    check("all", step, sfud_init());
+    /* SFUD_INIT_FLASHES leaves the EXT flash to its first use, as boot_ext.c does */
+    check("EXT", step, sfud_device_init(sfud_get_device(SFUD_EXT_FLASH)));
+    step_time("all", step, start, 0);
+}
+
+static void plan(const sfud_flash *flash) {
+    sfud_erase_run runs[SFUD_ERASE_PLAN_MAX_RUNS];
+    size_t num = sfud_erase_plan(flash, PLAN_ADDR, PLAN_SIZE, runs);
+
+    printf("%-5s erase plan of 0x%06lx+0x%lx:", flash->name, PLAN_ADDR, PLAN_SIZE);
+    for (size_t i = 0; i < num; i++) {
+        printf(" %02Xh 0x%06" PRIx32 " %" PRIu32 "x%" PRIu32 "KB", runs[i].cmd, runs[i].addr, runs[i].count,
+               runs[i].size / 1024);
+    }
+    printf("\n");
+    if (!num) {
+        check(flash->name, "erase plan", SFUD_ERR_ADDR_OUT_OF_BOUND);
+    }
+}
+
+static void read_back(const sfud_flash *flash, const char *step) {
+    uint64_t start = nor_sim_now();
+
+    memset(readback, 0, sizeof(readback));
+    check(flash->name, step, sfud_read(flash, PLAN_ADDR, PLAN_SIZE, readback));
+    step_time(flash->name, step, start, PLAN_SIZE);
+    if (memcmp(data, readback, PLAN_SIZE)) {
+        printf("%-5s %-24s read back mismatch\n", flash->name, step);
+        failures++;
+    }
+}
+
+/**
+ * read scattered ranges of the programmed area in one sfud_read_multi(), two of them adjacent
+ */
+static void multi_read(const sfud_flash *flash) {
+    static const uint32_t offsets[] = {0x0, 0x40, 0x1000, 0x8123, 0x20000};
+    static const size_t sizes[] = {0x40, 0x100, 0x8, 0x10, 0x200};
+    sfud_iovec ranges[sizeof(offsets) / sizeof(offsets[0])];
+    uint64_t start;
+    size_t i, total = 0;
+
+    memset(readback, 0, PLAN_SIZE);
+    for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        ranges[i].addr = PLAN_ADDR + offsets[i];
+        ranges[i].size = sizes[i];
+        ranges[i].data = readback + offsets[i];
+        total += sizes[i];
+    }
+    start = nor_sim_now();
+    check(flash->name, "read multi", sfud_read_multi(flash, ranges, i));
+    step_time(flash->name, "read multi", start, total);
+    for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        if (memcmp(data + offsets[i], readback + offsets[i], sizes[i])) {
+            printf("%-5s %-24s read back mismatch\n", flash->name, "read multi");
+            failures++;
+            break;
+        }
+    }
+}
+
+static void erase_write_read(sfud_flash *flash) {
+    uint64_t start;
+
+    plan(flash);
+    start = nor_sim_now();
+    check(flash->name, "erase", sfud_erase(flash, PLAN_ADDR, PLAN_SIZE));
+    step_time(flash->name, "erase", start, PLAN_SIZE);
+
+    start = nor_sim_now();
+    check(flash->name, "program", sfud_write(flash, PLAN_ADDR, PLAN_SIZE, data));
+    step_time(flash->name, "program", start, PLAN_SIZE);
+
+#ifdef SFUD_USING_QSPI
+    if (flash->spi.qspi_read) {
+        static const uint8_t widths[] = {1, 2, 4};
+        char step[24];
+
+        for (size_t i = 0; i < sizeof(widths); i++) {
+            snprintf(step, sizeof(step), "read x%u", widths[i]);
+            check(flash->name, step, sfud_qspi_fast_read_enable(flash, widths[i]));
+            read_back(flash, step);
+        }
+        multi_read(flash);
+        return;
+    }
+#endif
+    read_back(flash, "read");
+    multi_read(flash);
+}
+
+#ifdef SFUD_USING_BLANK_CHECK
+/**
+ * erase the programmed range again, it reads blank then, and once more: the units known blank are skipped
+ */
+static void erase_blank(const sfud_flash *flash) {
+    uint32_t erases = 0;
+    uint64_t start;
+    size_t i;
+
+    start = nor_sim_now();
+    check(flash->name, "erase programmed", sfud_erase(flash, PLAN_ADDR, PLAN_SIZE));
+    step_time(flash->name, "erase programmed", start, PLAN_SIZE);
+    memset(readback, 0, PLAN_SIZE);
+    check(flash->name, "erase programmed", sfud_read(flash, PLAN_ADDR, PLAN_SIZE, readback));
+    for (i = 0; i < PLAN_SIZE && readback[i] == 0xFF; i++) {
+    }
+    if (i < PLAN_SIZE) {
+        printf("%-5s %-24s not blank at 0x%06lx\n", flash->name, "erase programmed", (unsigned long) (PLAN_ADDR + i));
+        failures++;
+    }
+
+    for (i = 0; i < NOR_SIM_ERASE_TYPE_NUM; i++) {
+        erases += ((const nor_sim *) flash->spi.user_data)->stats.erases[i];
+    }
+    start = nor_sim_now();
+    check(flash->name, "erase blank", sfud_erase(flash, PLAN_ADDR, PLAN_SIZE));
+    step_time(flash->name, "erase blank", start, PLAN_SIZE);
+    for (i = 0; i < NOR_SIM_ERASE_TYPE_NUM; i++) {
+        erases -= ((const nor_sim *) flash->spi.user_data)->stats.erases[i];
+    }
+    if (erases) {
+        printf("%-5s %-24s erased again\n", flash->name, "erase blank");
+        failures++;
+    }
+}
+#endif
+
+/**
+ * erase in the background, read the flash meanwhile, the reads suspend the erase
+ */
+static void async_erase(const sfud_flash *flash) {
+    uint8_t buf[ASYNC_READ_SIZE];
+    uint64_t start = nor_sim_now();
+    uint32_t reads = 0;
+    sfud_async op;
+    sfud_err result;
+
+    memset(&op, 0, sizeof(op));
+    check(flash->name, "async erase", sfud_erase_async(flash, &op, ASYNC_ADDR, ASYNC_SIZE));
+    while ((result = sfud_async_poll(&op)) == SFUD_ERR_BUSY) {
+        /* the erase gets 1ms between two reads */
+        nor_sim_delay(1000000);
+        if (reads < 16) {
+            check(flash->name, "async read", sfud_async_read(&op, ASYNC_READ_ADDR + reads * ASYNC_READ_SIZE,
+                                                              sizeof(buf), buf));
+            reads++;
+        }
+    }
+    check(flash->name, "async erase", result);
+    step_time(flash->name, "async erase, 16 reads", start, ASYNC_SIZE);
+}
+
+/**
+ * write SMALL_RECORD bytes at a time, read them back, the read programs the pending ones
+ */
+static void small_writes(const sfud_flash *flash) {
+    uint64_t start;
+
+    check(flash->name, "small writes", sfud_erase(flash, SMALL_ADDR, SMALL_SIZE));
+    start = nor_sim_now();
+    for (size_t i = 0; i < SMALL_SIZE; i += SMALL_RECORD) {
+        check(flash->name, "small writes", sfud_write(flash, SMALL_ADDR + i, SMALL_RECORD, data + i));
+    }
+    step_time(flash->name, "small writes", start, SMALL_SIZE);
+
+    memset(readback, 0, SMALL_SIZE);
+    check(flash->name, "small writes read", sfud_read(flash, SMALL_ADDR, SMALL_SIZE, readback));
+    check(flash->name, "small writes flush", sfud_write_flush(flash));
+    if (memcmp(data, readback, SMALL_SIZE)) {
+        printf("%-5s %-24s read back mismatch\n", flash->name, "small writes");
+        failures++;
+    }
+}
+
+/**
+ * write chunks of odd sizes through a sfud_stream as they arrive, read them back
+ */
+static void stream_write(const sfud_flash *flash) {
+    static const size_t chunks[] = {1, 7, 300, 33, 4097, 256, 2, 1029};
+    static sfud_stream stream;
+    uint64_t start = nor_sim_now();
+    size_t done = 0, len, i = 0;
+
+    check(flash->name, "stream", sfud_stream_open(&stream, flash, STREAM_ADDR, STREAM_SIZE));
+    while (done < STREAM_SIZE) {
+        len = chunks[i++ % (sizeof(chunks) / sizeof(chunks[0]))];
+        if (len > STREAM_SIZE - done) {
+            len = STREAM_SIZE - done;
+        }
+        nor_sim_delay((uint64_t) len * STREAM_BYTE_NS);
+        check(flash->name, "stream", sfud_stream_write(&stream, data + done, len));
+        done += len;
+    }
+    check(flash->name, "stream", sfud_stream_close(&stream));
+    step_time(flash->name, "stream, UART pace", start, STREAM_SIZE);
+
+    memset(readback, 0, STREAM_SIZE);
+    check(flash->name, "stream read", sfud_read(flash, STREAM_ADDR, STREAM_SIZE, readback));
+    if (memcmp(data, readback, STREAM_SIZE)) {
+        printf("%-5s %-24s read back mismatch\n", flash->name, "stream");
+        failures++;
+    }
+}
+
+/**
+ * erase UNIT_RECORD bytes of a programmed unit with a line of it in the read cache and a record of it in the write
+ * buffer: the erase takes the whole unit, the read of it must give 0xFF, neither the old line nor the record
+ */
+static void unit_erase(const sfud_flash *flash) {
+    uint64_t start = nor_sim_now();
+    uint8_t record[UNIT_RECORD];
+
+    check(flash->name, "unit erase", sfud_erase(flash, UNIT_ADDR, UNIT_SIZE));
+    check(flash->name, "unit erase", sfud_write(flash, UNIT_ADDR, UNIT_SIZE, data));
+    check(flash->name, "unit erase", sfud_read(flash, UNIT_ADDR + UNIT_SIZE / 4, sizeof(record), record));
+    check(flash->name, "unit erase", sfud_write(flash, UNIT_ADDR + UNIT_SIZE / 2, sizeof(record), data));
+    check(flash->name, "unit erase", sfud_erase(flash, UNIT_ADDR + UNIT_ERASE_OFFSET, UNIT_RECORD));
+    step_time(flash->name, "unit erase", start, UNIT_SIZE);
+
+    memset(record, 0, sizeof(record));
+    check(flash->name, "unit erase read", sfud_read(flash, UNIT_ADDR + UNIT_SIZE / 4, sizeof(record), record));
+    memset(readback, 0, UNIT_SIZE);
+    check(flash->name, "unit erase read", sfud_read(flash, UNIT_ADDR, UNIT_SIZE, readback));
+    check(flash->name, "unit erase flush", sfud_write_flush(flash));
+    check(flash->name, "unit erase read", sfud_read(flash, UNIT_ADDR, UNIT_SIZE, readback + UNIT_SIZE));
+    for (size_t i = 0; i < 2 * UNIT_SIZE; i++) {
+        if (readback[i] != 0xFF || (i < sizeof(record) && record[i] != 0xFF)) {
+            printf("%-5s %-24s not erased\n", flash->name, "unit erase");
+            failures++;
+            break;
+        }
+    }
+}
+
+int main(void) {
+    sfud_flash *main_flash, *ext_flash;
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t) (i * 7 + (i >> 8));
+    }
+    if (!nor_sim_init(&main_nor, &main_config) || !nor_sim_init(&ext_nor, &ext_config)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    sfud_host_attach(SFUD_MAIN_FLASH, &main_nor);
+    sfud_host_attach(SFUD_EXT_FLASH, &ext_nor);
+
+    printf("%-5s %-24s %10s %15s %14s\n", "flash", "step", "bytes", "time", "rate");
+    init("init, cold");
+    init("init, probe cache");
+    main_flash = sfud_get_device(SFUD_MAIN_FLASH);
+    ext_flash = sfud_get_device(SFUD_EXT_FLASH);
+
+    erase_write_read(ext_flash);
+    async_erase(ext_flash);
+    small_writes(ext_flash);
+    stream_write(ext_flash);
+    unit_erase(ext_flash);
+    erase_write_read(main_flash);
+#ifdef SFUD_USING_BLANK_CHECK
+    erase_blank(main_flash);
+#endif
+    async_erase(main_flash);
+    small_writes(main_flash);
+    stream_write(main_flash);
+
+    print_stats(&ext_nor);
+    print_stats(&main_nor);
+#ifdef SFUD_USING_STATS
+    print_sfud_stats(ext_flash);
+    print_sfud_stats(main_flash);
+#endif
+    failures += ext_nor.stats.violations + main_nor.stats.violations;
+
+    nor_sim_deinit(&main_nor);
+    nor_sim_deinit(&ext_nor);
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,249 @@
+/**
+ * @file sfud_host_port.c
+ * @brief SFUD port of the host build, each flash device is a nor_sim model.
+ *
+ * The target port (Core/SFUD/sfud/port/sfud_port.c) gives the EXT flash
+ * wr() and xfer() and the MAIN flash qspi_read() on top, this one does the
+ * same over the models attached by sfud_host_attach(), so the core takes the
+ * same paths as on the board. The retry delay moves the simulated clock on
+ * by 100us, the busy polls count as they would on the bus.
+ */
+#include "sfud_host.h"
+#include <sfud.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RETRY_DELAY_NS                  100000ULL
+
+static nor_sim *host_nor[SFUD_FLASH_DEVICE_NUM];
+static sfud_probe_cache probe_cache[SFUD_FLASH_DEVICE_NUM];
+
+/**
+ * put a model behind a flash device, before sfud_init()
+ *
+ * @param index SFUD_EXT_FLASH or SFUD_MAIN_FLASH
+ * @param nor model, NULL: the device fails to init
+ */
+void sfud_host_attach(size_t index, nor_sim *nor) {
+    if (index < SFUD_FLASH_DEVICE_NUM) {
+        host_nor[index] = nor;
+    }
+}
+
+/**
+ * forget the probe cache, the next sfud_init() probes the parts again like a cold boot
+ */
+void sfud_host_probe_cache_clear(void) {
+    memset(probe_cache, 0, sizeof(probe_cache));
+}
+
+static bool has_address(uint8_t instruction) {
+    switch (instruction) {
+    case SFUD_CMD_WRITE_ENABLE:
+    case SFUD_CMD_WRITE_DISABLE:
+    case SFUD_VOLATILE_SR_WRITE_ENABLE:
+    case SFUD_CMD_READ_STATUS_REGISTER:
+    case SFUD_CMD_READ_STATUS_REGISTER_2:
+    case SFUD_CMD_WRITE_STATUS_REGISTER:
+    case SFUD_CMD_WRITE_STATUS_REGISTER_2:
+    case SFUD_CMD_JEDEC_ID:
+    case SFUD_CMD_ERASE_CHIP:
+    case 0x60:
+    case 0x75:
+    case 0x7A:
+    case SFUD_CMD_ENABLE_RESET:
+    case SFUD_CMD_RESET:
+    case SFUD_CMD_ENTER_4B_ADDRESS_MODE:
+    case SFUD_CMD_EXIT_4B_ADDRESS_MODE:
+    case 0xAB:
+    case 0xB9:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static sfud_err host_run(const sfud_spi *spi, const nor_sim_cmd *cmd) {
+    nor_sim *nor = (nor_sim *) spi->user_data;
+
+    if (!nor) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+    nor_sim_command(nor, cmd);
+    return SFUD_SUCCESS;
+}
+
+/**
+ * the packed command: instruction, the address by the instruction, then the dummy bytes of a read or the data
+ */
+static sfud_err host_write_read(const sfud_spi *spi, const uint8_t *write_buf, size_t write_size, uint8_t *read_buf,
+                                size_t read_size) {
+    const sfud_flash *flash = (const sfud_flash *) ((const uint8_t *) spi - offsetof(sfud_flash, spi));
+    nor_sim_cmd cmd;
+    size_t count = 1;
+
+    if (!write_buf || !write_size) {
+        return SFUD_ERR_WRITE;
+    }
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.instruction = write_buf[0];
+    if (write_size > 1 && has_address(cmd.instruction)) {
+        /* the SFDP read always has a 3-Byte address */
+        cmd.addr_size = flash->addr_in_4_byte && cmd.instruction != SFUD_CMD_READ_SFDP_REGISTER ? 4 : 3;
+        if (write_size < 1U + cmd.addr_size) {
+            return SFUD_ERR_WRITE;
+        }
+        for (size_t i = 0; i < cmd.addr_size; i++) {
+            cmd.addr = cmd.addr << 8 | write_buf[1 + i];
+        }
+        count += cmd.addr_size;
+    }
+    if (read_buf) {
+        cmd.dummy_cycles = (uint8_t) ((write_size - count) * 8);
+        cmd.read_buf = read_buf;
+        cmd.data_size = read_size;
+    } else {
+        cmd.write_buf = write_buf + count;
+        cmd.data_size = write_size - count;
+    }
+
+    return host_run(spi, &cmd);
+}
+
+static sfud_err host_xfer(const sfud_spi *spi, const sfud_spi_xfer *xfer) {
+    uint8_t addr_lines = xfer->addr_lines ? xfer->addr_lines : 1;
+    nor_sim_cmd cmd = {
+        .instruction = xfer->instruction,
+        .addr_size = xfer->addr_size,
+        .addr_lines = xfer->addr_lines,
+        .data_lines = xfer->data_lines,
+        /* the dummy bytes go on the address lines */
+        .dummy_cycles = (uint8_t) (xfer->dummy_size * 8 / addr_lines),
+        .addr = xfer->addr,
+        .write_buf = xfer->write_buf,
+        .read_buf = xfer->read_buf,
+        .data_size = xfer->data_size,
+    };
+
+    return host_run(spi, &cmd);
+}
+
+#ifdef SFUD_USING_QSPI
+static sfud_err host_qspi_read(const struct __sfud_spi *spi, uint32_t addr,
+                               sfud_qspi_read_cmd_format *qspi_read_cmd_format, uint8_t *read_buf, size_t read_size) {
+    const sfud_qspi_read_cmd_format *format = qspi_read_cmd_format;
+    nor_sim_cmd cmd = {
+        .instruction = format->instruction,
+        .addr_size = format->address_size / 8,
+        .addr_lines = format->address_lines,
+        .data_lines = format->data_lines,
+        .dummy_cycles = format->dummy_cycles,
+        .addr = addr,
+        .read_buf = read_buf,
+        .data_size = read_size,
+    };
+
+    if (format->dtr) {
+        /* the model has no DTR reads, report it as the read it is not */
+        cmd.dummy_cycles = 0xFF;
+    }
+    /* the mode bits are one byte on the alternate bytes lines */
+    if (format->alternate_bytes_lines) {
+        cmd.dummy_cycles += 8 / format->alternate_bytes_lines;
+    }
+
+    return host_run(spi, &cmd);
+}
+#endif
+
+static void retry_delay_100us(void) {
+    nor_sim_delay(RETRY_DELAY_NS);
+}
+
+sfud_err sfud_spi_port_init(sfud_flash *flash) {
+    if (flash->index >= SFUD_FLASH_DEVICE_NUM || !host_nor[flash->index]) {
+        return SFUD_ERR_NOT_FOUND;
+    }
+
+    flash->spi.wr = host_write_read;
+    flash->spi.xfer = host_xfer;
+#ifdef SFUD_USING_QSPI
+    /* the OCTOSPI flash only, as on the board */
+    flash->spi.qspi_read = flash->index == SFUD_MAIN_FLASH ? host_qspi_read : NULL;
+#endif
+    flash->spi.user_data = host_nor[flash->index];
+    /* about 100 microsecond delay, simulated */
+    flash->retry.delay = retry_delay_100us;
+    /* about 60 seconds timeout */
+    flash->retry.times = 60 * 10000;
+
+    return SFUD_SUCCESS;
+}
+
+sfud_err sfud_spi_port_deinit(sfud_flash *flash) {
+    (void) flash;
+    return SFUD_SUCCESS;
+}
+
+#ifdef SFUD_USING_PROBE_CACHE
+bool sfud_port_probe_cache_read(const sfud_flash *flash, sfud_probe_cache *cache) {
+    if (flash->index >= SFUD_FLASH_DEVICE_NUM) {
+        return false;
+    }
+    memcpy(cache, &probe_cache[flash->index], sizeof(sfud_probe_cache));
+    return true;
+}
+
+void sfud_port_probe_cache_write(const sfud_flash *flash, const sfud_probe_cache *cache) {
+    if (flash->index >= SFUD_FLASH_DEVICE_NUM) {
+        return;
+    }
+    memcpy(&probe_cache[flash->index], cache, sizeof(sfud_probe_cache));
+}
+#endif /* SFUD_USING_PROBE_CACHE */
+
+#ifdef SFUD_USING_STATS
+uint32_t sfud_port_time_us(void) {
+    return (uint32_t) (nor_sim_now() / 1000);
+}
+#endif
+
+#ifdef SFUD_USING_WRITE_VERIFY
+/* zlib CRC-32 bit by bit, the CRC unit of the board port */
+uint32_t sfud_port_crc32(uint32_t crc, const void *buf, size_t size) {
+    const uint8_t *p = (const uint8_t *) buf;
+
+    crc = ~crc;
+    while (size--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+#endif
+
+#ifdef SFUD_USING_BLANK_CHECK
+/* the models have no memory-mapped window, the core reads the units it checks */
+const void *sfud_port_mapped(const sfud_flash *flash, uint32_t addr, size_t size) {
+    (void) flash;
+    (void) addr;
+    (void) size;
+    return NULL;
+}
+#endif
+
+/**
+ * elog_info() and elog_debug() of the EasyLogger stand-in, see inc/elog.h
+ */
+void elog_host_output(const char *level, const char *tag, const char *format, ...) {
+    va_list args;
+
+    printf("%s/%s ", level, tag);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
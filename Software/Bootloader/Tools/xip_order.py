@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+"""Order the code of an XIP application by its PC profile, a linker script fragment, see Core/Inc/boot_pcprof.h.
+
+The profile is the boot_pcprof record the application took with the
+prof_start, prof_sample and prof_stop services: the console capture of
+"pcprof hex", or the bytes of the record (a debugger dump of
+BOOT_PCPROF_ADDR). The map is the one GNU ld wrote for the profiled build
+(-Wl,-Map), the application compiled with -ffunction-sections: each
+function is an input section of its own, its address and size are in the
+map.
+
+The samples of a bucket go to the input sections it overlaps, by the bytes
+of the overlap. The sections with samples come first, the most samples per
+byte first, so the hot code sits in as few flash lines and I-cache sets as
+it can; the sections of the profiled range without any come after them.
+The fragment goes into the .text output section of the application linker
+script ahead of its wildcard, the first match places a section:
+
+    .text :
+    {
+        . = ALIGN(4);
+        INCLUDE xip_order.ld
+        *(.text)
+        *(.text*)
+        ...
+
+Code added since the profiled build isn't listed, the wildcard puts it after
+the cold code; a new profile orders it again.
+
+    python3 xip_order.py app.map capture.log -o xip_order.ld
+    python3 xip_order.py app.map run1.bin run2.bin -o xip_order.ld --top 40
+
+Pure Python, no module beyond the standard library.
+"""
+
+import argparse
+import collections
+import os
+import re
+import struct
+import sys
+
+# boot_pcprof of boot_pcprof.h, the histogram after the fixed fields
+PCPROF_ADDR = 0x38002000
+PCPROF_MAGIC = 0x46504342
+PCPROF_VERSION = 1
+PCPROF_BUCKET_NUM = 1024
+PCPROF = struct.Struct("<IHHIIIIIII5B7xQ5I5II")
+PCPROF_SIZE = PCPROF.size + PCPROF_BUCKET_NUM * 2
+MEM_NAMES = ("itcm", "flash", "xip", "ram", "other")
+
+# the L1 I-cache of the STM32H730
+ICACHE_SIZE = 32 * 1024
+
+HEX_LINE = re.compile(r"([0-9a-fA-F]{8}):((?: [0-9a-fA-F]{2})+)\s*$")
+MAP_SECTION = re.compile(r"^ (\.\S+)(?:\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*))?$")
+MAP_PLACE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+MAP_SYMBOL = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_.$][\w.$]*)$")
+
+
+def fail(msg):
+    sys.exit("xip_order: " + msg)
+
+
+class Profile:
+    def __init__(self, path, data):
+        if len(data) < PCPROF_SIZE:
+            fail("%s: %u bytes of the record, %u needed" % (path, len(data), PCPROF_SIZE))
+        fields = PCPROF.unpack_from(data)
+        magic, version, size, state, self.base, self.range, self.shift, _, self.samples = fields[:9]
+        if magic != PCPROF_MAGIC or version != PCPROF_VERSION or size != PCPROF_SIZE:
+            fail("%s: no pc profile record of version %u" % (path, PCPROF_VERSION))
+        if state == 1:
+            print("%s: the profile was still running" % path, file=sys.stderr)
+        self.mem = fields[21:26]
+        self.outside = fields[26]
+        self.hist = struct.unpack_from("<%uH" % PCPROF_BUCKET_NUM, data, PCPROF.size)
+        if 0xFFFF in self.hist:
+            print("%s: saturated buckets, the shares are low for them" % path, file=sys.stderr)
+
+    def merge(self, other):
+        if (other.base, other.range, other.shift) != (self.base, self.range, self.shift):
+            fail("the profiles cover other ranges, 0x%08x + 0x%x and 0x%08x + 0x%x"
+                 % (self.base, self.range, other.base, other.range))
+        self.samples += other.samples
+        self.mem = [a + b for a, b in zip(self.mem, other.mem)]
+        self.outside += other.outside
+        self.hist = [a + b for a, b in zip(self.hist, other.hist)]
+
+
+def read_profile(path):
+    """the record of a binary dump, or the last one of the hex lines of a console capture"""
+    data = open(path, "rb").read()
+    if data[:4] == struct.pack("<I", PCPROF_MAGIC):
+        return Profile(path, data)
+    record = bytearray(PCPROF_SIZE)
+    seen = set()
+    for line in data.decode(errors="replace").splitlines():
+        m = HEX_LINE.search(line)
+        if not m:
+            continue
+        addr = int(m.group(1), 16) - PCPROF_ADDR
+        for i, byte in enumerate(m.group(2).split()):
+            if 0 <= addr + i < PCPROF_SIZE:
+                record[addr + i] = int(byte, 16)
+                seen.add(addr + i)
+    if len(seen) != PCPROF_SIZE:
+        fail("%s: no \"pcprof hex\" output, %u of %u bytes of the record" % (path, len(seen), PCPROF_SIZE))
+    return Profile(path, bytes(record))
+
+
+class Section:
+    def __init__(self, name, addr, size, obj):
+        self.name = name
+        self.addr = addr
+        self.size = size
+        self.obj = obj
+        self.symbol = None
+        self.samples = 0.0
+
+
+def read_map(path):
+    """the code input sections GNU ld placed, from its memory map"""
+    sections = []
+    pending = None
+    placing = False
+    for line in open(path, errors="replace"):
+        line = line.rstrip("\n")
+        if line.startswith("Linker script and memory map"):
+            placing = True
+            continue
+        if not placing:
+            continue
+        m = MAP_SECTION.match(line)
+        if m:
+            pending = None
+            if m.group(2) is None:
+                # a long name, its place is on the next line
+                pending = m.group(1)
+            elif m.group(1).startswith(".text") and int(m.group(3), 16):
+                sections.append(Section(m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4)))
+            continue
+        m = MAP_PLACE.match(line)
+        if m and pending:
+            if pending.startswith(".text") and int(m.group(2), 16):
+                sections.append(Section(pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3)))
+            pending = None
+            continue
+        m = MAP_SYMBOL.match(line)
+        if m and sections and sections[-1].symbol is None:
+            addr = int(m.group(1), 16)
+            if sections[-1].addr <= addr < sections[-1].addr + sections[-1].size:
+                sections[-1].symbol = m.group(2)
+        pending = None
+    if not sections:
+        fail("%s: no .text input section in the memory map" % path)
+    return sections
+
+
+def attribute(profile, sections):
+    """the samples of each bucket shared by the bytes of the sections in it"""
+    width = 1 << profile.shift
+    for s in sections:
+        start = max(s.addr, profile.base) - profile.base
+        end = min(s.addr + s.size, profile.base + profile.range) - profile.base
+        for b in range(start >> profile.shift, min((end + width - 1) >> profile.shift, PCPROF_BUCKET_NUM)):
+            if not profile.hist[b]:
+                continue
+            lo, hi = max(start, b << profile.shift), min(end, (b + 1) << profile.shift)
+            if hi > lo:
+                s.samples += profile.hist[b] * (hi - lo) / width
+
+
+def pattern(section, dups):
+    """the input section spec, the object named when another one has a section of the same name"""
+    if not dups[section.name]:
+        return "*(%s)" % section.name
+    m = re.match(r"^(.*)\((.*)\)$", section.obj)
+    if m:
+        return "*%s:%s(%s)" % (os.path.basename(m.group(1)), m.group(2), section.name)
+    return "*%s(%s)" % (os.path.basename(section.obj), section.name)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="GNU ld map of the profiled application build")
+    parser.add_argument("profile", nargs="+", help="\"pcprof hex\" capture or record dump, several are added up")
+    parser.add_argument("-o", "--output", required=True, help="linker script fragment")
+    parser.add_argument("--min-samples", type=float, default=1.0, help="samples of a hot section, at least")
+    parser.add_argument("--top", type=int, default=20, help="hot sections listed on the report")
+    opts = parser.parse_args()
+
+    profile = read_profile(opts.profile[0])
+    for path in opts.profile[1:]:
+        profile.merge(read_profile(path))
+    sections = [s for s in read_map(opts.map)
+                if s.addr < profile.base + profile.range and s.addr + s.size > profile.base]
+    if not sections:
+        fail("no code of the map in the profiled range 0x%08x + 0x%x" % (profile.base, profile.range))
+    attribute(profile, sections)
+
+    in_range = sum(profile.hist)
+    hot = sorted((s for s in sections if s.samples >= opts.min_samples),
+                 key=lambda s: (-s.samples / s.size, s.addr))
+    cold = sorted((s for s in sections if s.samples < opts.min_samples), key=lambda s: s.addr)
+    names = collections.Counter(s.name for s in sections)
+    dups = {name: names[name] > 1 for name in names}
+    hot_bytes = sum(s.size for s in hot)
+    hot_samples = sum(s.samples for s in hot)
+
+    with open(opts.output, "w") as f:
+        f.write("/* generated by xip_order.py from %s, %u samples in 0x%08x + 0x%x */\n"
+                % (", ".join(os.path.basename(p) for p in opts.profile), in_range, profile.base, profile.range))
+        f.write("/* hot: %u sections, %u bytes */\n" % (len(hot), hot_bytes))
+        for s in hot:
+            f.write("%s /* %.1f samples */\n" % (pattern(s, dups), s.samples))
+        f.write("/* cold: %u sections, %u bytes */\n" % (len(cold), sum(s.size for s in cold)))
+        for s in cold:
+            f.write("%s\n" % pattern(s, dups))
+
+    total = profile.samples or 1
+    print("%u samples: %s, %u out of the range"
+          % (profile.samples, ", ".join("%s %u%%" % (n, c * 100 // total) for n, c in zip(MEM_NAMES, profile.mem)),
+             profile.outside))
+    print("%u hot sections, %u bytes (%u%% of the %u KB I-cache), %u%% of the samples in range"
+          % (len(hot), hot_bytes, hot_bytes * 100 // ICACHE_SIZE, ICACHE_SIZE // 1024,
+             hot_samples * 100 // (in_range or 1)))
+    for s in hot[:opts.top]:
+        print("%8.1f %3u%% %6u  0x%08x  %s" % (s.samples, s.samples * 100 // (in_range or 1), s.size, s.addr,
+                                               s.symbol or s.name))
+
+
+if __name__ == "__main__":
+    main()